@@ -1,23 +1,19 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <math.h>
+#include <stdlib.h>
+
 #include "azure_c_shared_utility/xlogging.h"
 
 #include "parson.h"
 
 #include "ModbusPnp.h"
 #include "ModbusCapability.h"
+#include "ModbusReadPlanner.h"
+#include "ModbusScheduler.h"
+#include "ModbusConnectionManager.h"
 #include "ModbusConnection/ModbusConnection.h"
-#include "azure_c_shared_utility/condition.h"
-
-static bool ModbusPnP_ContinueReadTasks = false;
-// This condition variable is used to signal when to stop polling
-// and only serves to establish the event notification mechanism using 
-// azure_c's shared utility library. The lock passed into the Condition_Wait
-// function does not protect against any shared resource, and is instead created
-// to comply with the cross-platform library's function signature
-
-static COND_HANDLE StopPolling;
 
 #pragma region Commands
 
@@ -71,6 +67,10 @@ ModbusPnp_CommandHandler(
     capContext->hDevice = modbusDevice->hDevice;
     capContext->connectionType = modbusDevice->DeviceConfig->ConnectionType;
     capContext->hLock = modbusDevice->hConnectionLock;
+    capContext->tcpLink = modbusDevice->TcpLink;
+    capContext->rtuBus = modbusDevice->RtuBus;
+    capContext->writeQueue = (NULL != modbusDevice->Connection) ? modbusDevice->Connection->WriteQueue : NULL;
+    capContext->unitId = modbusDevice->DeviceConfig->UnitId;
     capContext->componentName = modbusDevice->ComponentName;
 
     char * CommandValueString = (char*) json_value_get_string(CommandValue);
@@ -154,6 +154,10 @@ void ModbusPnp_PropertyHandler(
     capContext->hDevice = modbusDevice->hDevice;
     capContext->connectionType = modbusDevice->DeviceConfig->ConnectionType;
     capContext->hLock= modbusDevice->hConnectionLock;
+    capContext->tcpLink = modbusDevice->TcpLink;
+    capContext->rtuBus = modbusDevice->RtuBus;
+    capContext->writeQueue = (NULL != modbusDevice->Connection) ? modbusDevice->Connection->WriteQueue : NULL;
+    capContext->unitId = modbusDevice->DeviceConfig->UnitId;
     capContext->clientHandle = modbusDevice->ClientHandle;
     capContext->clientType = modbusDevice->ClientType;
     capContext->componentName = modbusDevice->ComponentName;
@@ -224,40 +228,6 @@ ModbusPnp_ReportReadOnlyProperty(
     return iothubClientResult;
 }
 
-int
-ModbusPnp_PollingSingleProperty(
-    void *param)
-{
-    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
-    CapabilityContext* context = param;
-    ModbusProperty* property = context->capability;
-    LogInfo("Start polling task for property \"%s\".", property->Name);
-    uint8_t resultedData[MODBUS_RESPONSE_MAX_LENGTH];
-    memset(resultedData, 0x00, MODBUS_RESPONSE_MAX_LENGTH);
-
-    LOCK_HANDLE lock;
-    lock = Lock_Init();
-    Lock(lock);
-
-    while (ModbusPnP_ContinueReadTasks)
-    {
-        int resultLen = ModbusPnp_ReadCapability(context, Property, resultedData);
-        if (resultLen > 0)
-        {
-            result = ModbusPnp_ReportReadOnlyProperty(context, context->componentName, property->Name, (const char*) resultedData);
-        }
-
-        Condition_Wait(StopPolling, lock, property->DefaultFrequency);
-    }
-
-    Unlock(lock);
-    Lock_Deinit(lock);
-    LogInfo("Stopped polling task for property \"%s\".", property->Name);
-    free(context);
-    ThreadAPI_Exit(THREADAPI_OK);
-    return result;
-}
-
 #pragma endregion
 
 #pragma region SendTelemetry
@@ -269,6 +239,31 @@ void ModbusPnp_ReportTelemetryCallback(
     LogInfo("ModbusPnp_ReportTelemetryCallback called, result=%d, telemetry name=%s", pnpSendEventStatus, (const char*) userContextCallback);
 }
 
+static IOTHUB_CLIENT_RESULT
+ModbusPnp_SendTelemetryMessage(
+    CapabilityContext* CapabilityContext,
+    const char * ComponentName,
+    const char* TelemetryData,
+    const char* CallbackName)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    IOTHUB_MESSAGE_HANDLE messageHandle = NULL;
+
+    if ((messageHandle = PnP_CreateTelemetryMessageHandle(ComponentName, TelemetryData)) == NULL)
+    {
+        LogError("Modbus Adapter: PnP_CreateTelemetryMessageHandle failed.");
+    }
+    else if ((result = PnpBridgeClient_SendEventAsync(CapabilityContext->clientHandle, messageHandle,
+            ModbusPnp_ReportTelemetryCallback, (void*) CallbackName)) != IOTHUB_CLIENT_OK)
+    {
+        LogError("Modbus Adapter: IoTHub client call to_SendEventAsync failed for device, error=%d", result);
+    }
+
+    IoTHubMessage_Destroy(messageHandle);
+
+    return result;
+}
+
 IOTHUB_CLIENT_RESULT
 ModbusPnp_ReportTelemetry(
     CapabilityContext* CapabilityContext,
@@ -276,179 +271,205 @@ ModbusPnp_ReportTelemetry(
     const char* TelemetryName,
     const char* TelemetryValue)
 {
-    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
-    IOTHUB_MESSAGE_HANDLE messageHandle = NULL;
-
     if (CapabilityContext == NULL)
     {
-        return result;
+        return IOTHUB_CLIENT_OK;
     }
     else if (CapabilityContext->clientHandle == NULL)
     {
         LogInfo("Modbus Adapter: Client handle is not initialized");
-        return result;
+        return IOTHUB_CLIENT_OK;
     }
 
     char telemetryMessageData[512] = {0};
     sprintf(telemetryMessageData, "{\"%s\":%s}", TelemetryName, TelemetryValue);
 
-    if ((messageHandle = PnP_CreateTelemetryMessageHandle(ComponentName, (const char*) telemetryMessageData)) == NULL)
+    return ModbusPnp_SendTelemetryMessage(CapabilityContext, ComponentName, (const char*) telemetryMessageData, TelemetryName);
+}
+
+void ModbusPnp_SendTelemetryBundle(
+    CapabilityContext* context)
+{
+    MODBUS_TELEMETRY_BUNDLE* bundle = context->telemetryBundle;
+
+    if (NULL == bundle || 0 == bundle->Length)
     {
-        LogError("Modbus Adapter: PnP_CreateTelemetryMessageHandle failed.");
+        return;
     }
-    else if ((result = PnpBridgeClient_SendEventAsync(CapabilityContext->clientHandle, messageHandle,
-            ModbusPnp_ReportTelemetryCallback, (void*) TelemetryName)) != IOTHUB_CLIENT_OK)
+
+    // Room for the closing brace was kept when the values were added
+    bundle->Data[bundle->Length++] = '}';
+    bundle->Data[bundle->Length] = '\0';
+    bundle->Length = 0;
+
+    if (context->clientHandle == NULL)
     {
-        LogError("Modbus Adapter: IoTHub client call to_SendEventAsync failed for device, error=%d", result);
+        LogInfo("Modbus Adapter: Client handle is not initialized");
+        return;
     }
 
-    IoTHubMessage_Destroy(messageHandle);
-
-    return result;
+    (void)ModbusPnp_SendTelemetryMessage(context, (const char*) context->componentName,
+        (const char*) bundle->Data, (const char*) context->componentName);
 }
 
-int ModbusPnp_PollingSingleTelemetry(
-    void *param)
+static void ModbusPnp_BundleTelemetry(
+    CapabilityContext* context,
+    const char* TelemetryName,
+    const char* TelemetryValue)
 {
-    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
-    CapabilityContext* context = (CapabilityContext*) param;
-    ModbusTelemetry* telemetry = (ModbusTelemetry*) context->capability;
-    LogInfo("Start polling task for telemetry \"%s\".", telemetry->Name);
-    uint8_t resultedData[MODBUS_RESPONSE_MAX_LENGTH];
+    MODBUS_TELEMETRY_BUNDLE* bundle = context->telemetryBundle;
+
+    // The separator or opening brace, quotes and colon of the value, the closing brace and the terminator
+    size_t needed = strlen(TelemetryName) + strlen(TelemetryValue) + 6;
 
-    LOCK_HANDLE lock;
-    lock = Lock_Init();
-    Lock(lock);
-    while (ModbusPnP_ContinueReadTasks)
+    if (bundle->Length > 0 && bundle->Length + needed > MODBUS_TELEMETRY_BUNDLE_MAX_LENGTH)
     {
-        memset(resultedData, 0x00, MODBUS_RESPONSE_MAX_LENGTH);
-        int resultLen = ModbusPnp_ReadCapability(context, Telemetry, resultedData);
+        ModbusPnp_SendTelemetryBundle(context);
+    }
 
-        if (resultLen > 0) {
-            result = ModbusPnp_ReportTelemetry(context, (const char*) context->componentName,
-                (const char*) telemetry->Name, (const char*) resultedData);
+    if (bundle->Length + needed > bundle->Capacity)
+    {
+        size_t capacity = (2 * bundle->Capacity > bundle->Length + needed) ? 2 * bundle->Capacity : bundle->Length + needed;
+        char* data = realloc(bundle->Data, capacity);
+        if (NULL == data)
+        {
+            LogError("Modbus Adapter: Could not allocate memory for telemetry of %s.", context->componentName);
+            return;
         }
 
-        Condition_Wait(StopPolling, lock, telemetry->DefaultFrequency);
+        bundle->Data = data;
+        bundle->Capacity = capacity;
     }
-    Unlock(lock);
-    Lock_Deinit(lock);
 
-    LogInfo("Stopped polling task for telemetry \"%s\".", telemetry->Name);
-    free(context);
-    ThreadAPI_Exit(THREADAPI_OK);
-    return result;
+    bundle->Length += sprintf(bundle->Data + bundle->Length, "%c\"%s\":%s",
+        (0 == bundle->Length) ? '{' : ',', TelemetryName, TelemetryValue);
 }
 
-#pragma endregion
-
-void StopPollingTasks()
+// Turns a decoded value into a number to compare with the last one. Values that are not a number,
+// such as strings and null, are hashed, and compare equal only when they are identical.
+static double ModbusPnp_GetComparableValue(
+    const char* value,
+    bool* isNumber)
 {
-    ModbusPnP_ContinueReadTasks = false;
-    if (Condition_Post(StopPolling) != COND_OK)
+    char* end = NULL;
+    double number = strtod(value, &end);
+
+    *isNumber = (end != value && '\0' == *end);
+    if (*isNumber)
     {
-        LogError("Condition variable could not be signalled.");
+        return number;
+    }
+    if (0 == strcmp(value, "true") || 0 == strcmp(value, "false"))
+    {
+        *isNumber = true;
+        return ('t' == value[0]) ? 1.0 : 0.0;
     }
-}
-
-IOTHUB_CLIENT_RESULT ModbusPnp_StartPollingAllTelemetryProperty(
-    void* context)
-{
-    PMODBUS_DEVICE_CONTEXT deviceContext = (PMODBUS_DEVICE_CONTEXT)context;
-    const ModbusInterfaceConfig* interfaceConfig = deviceContext->InterfaceConfig;
-    SINGLYLINKEDLIST_HANDLE telemetryList = interfaceConfig->Events;
-    int telemetryCount = ModbusPnp_GetListCount(interfaceConfig->Events);
-    LIST_ITEM_HANDLE telemetryItemHandle = NULL;
-
-    SINGLYLINKEDLIST_HANDLE propertyList = interfaceConfig->Properties;
-    int propertyCount = ModbusPnp_GetListCount(interfaceConfig->Properties);
-    LIST_ITEM_HANDLE propertyItemHandle = NULL;
-
 
-    // Initialize the polling tasks for telemetry and properties
-    deviceContext->PollingTasks = NULL;
-    if (telemetryCount > 0 || propertyCount > 0)
+    uint32_t hash = 2166136261u;
+    for (const char* c = value; '\0' != *c; c++)
     {
-        deviceContext->PollingTasks = calloc((telemetryCount + propertyCount), sizeof(THREAD_HANDLE));
-        if (NULL == deviceContext->PollingTasks) {
-            return IOTHUB_CLIENT_ERROR;
-        }
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
     }
+    return (double)hash;
+}
 
-    StopPolling = Condition_Init();
-    ModbusPnP_ContinueReadTasks = true;
+static const MODBUS_ADAPTIVE_POLLING* ModbusPnp_GetAdaptivePolling(
+    const MODBUS_BLOCK_CAPABILITY* capability)
+{
+    return (Telemetry == capability->Type) ? &(((ModbusTelemetry*)capability->Capability)->Polling) :
+        &(((ModbusProperty*)capability->Capability)->Polling);
+}
 
-    for (int i = 0; i < telemetryCount; i++)
+MODBUS_BLOCK_CHANGE ModbusPnp_ReportBlock(
+    CapabilityContext* context,
+    const MODBUS_READ_BLOCK* block,
+    const uint8_t* response,
+    uint16_t responseStartAddress,
+    double* lastValues)
+{
+    uint8_t resultedData[MODBUS_RESPONSE_MAX_LENGTH];
+    MODBUS_BLOCK_CHANGE change = MODBUS_BLOCK_STEADY;
+
+    // One request read every capability of the block, which are decoded from the same response
+    for (int i = 0; i < block->CapabilityCount; i++)
     {
-        if (NULL == telemetryItemHandle)
+        memset(resultedData, 0x00, MODBUS_RESPONSE_MAX_LENGTH);
+        int resultLen = ModbusPnp_DecodeBlockCapability(context->connectionType, block, i, response, responseStartAddress, resultedData);
+        if (resultLen <= 0)
         {
-            telemetryItemHandle = singlylinkedlist_get_head_item(telemetryList);
+            continue;
         }
-        else
+
+        // A value read for the first time counts as changed. The deadband of anything but a
+        // number is 0, so that any change of it counts as moving fast.
+        bool isNumber = false;
+        double value = ModbusPnp_GetComparableValue((const char*) resultedData, &isNumber);
+        double deadband = isNumber ? ModbusPnp_GetAdaptivePolling(&(block->Capabilities[i]))->Deadband : 0;
+        double delta = fabs(value - lastValues[i]);
+        if (isnan(lastValues[i]) || delta > deadband)
         {
-            telemetryItemHandle = singlylinkedlist_get_next_item(telemetryItemHandle);
+            MODBUS_BLOCK_CHANGE valueChange = (isnan(lastValues[i]) || delta <= MODBUS_FAST_CHANGE_DEADBANDS * deadband) ?
+                MODBUS_BLOCK_CHANGED : MODBUS_BLOCK_MOVING_FAST;
+            if (valueChange > change)
+            {
+                change = valueChange;
+            }
+            lastValues[i] = value;
         }
 
-        const ModbusTelemetry* telemetry = singlylinkedlist_item_get_value(telemetryItemHandle);
-        CapabilityContext* pollingPayload = calloc(1, sizeof(CapabilityContext));
-        if (!pollingPayload)
+        if (Telemetry == block->Capabilities[i].Type)
         {
-            LogError("Could not allocate memory for telemetry polling capability context.");
-            continue;
+            ModbusTelemetry* telemetry = (ModbusTelemetry*) block->Capabilities[i].Capability;
+            if (NULL != context->telemetryBundle)
+            {
+                ModbusPnp_BundleTelemetry(context, (const char*) telemetry->Name, (const char*) resultedData);
+            }
+            else
+            {
+                (void)ModbusPnp_ReportTelemetry(context, (const char*) context->componentName,
+                    (const char*) telemetry->Name, (const char*) resultedData);
+            }
         }
-        pollingPayload->hDevice = deviceContext->hDevice;
-        pollingPayload->capability = (void*)telemetry;
-        pollingPayload->hLock = deviceContext->hConnectionLock;
-        pollingPayload->connectionType = deviceContext->DeviceConfig->ConnectionType;
-        pollingPayload->clientHandle = deviceContext->ClientHandle;
-        pollingPayload->clientType = deviceContext->ClientType;
-        pollingPayload->componentName = deviceContext->ComponentName;
-
-        if (ThreadAPI_Create(&(deviceContext->PollingTasks[i]), ModbusPnp_PollingSingleTelemetry, (void*)pollingPayload) != THREADAPI_OK)
+        else
         {
-#ifdef WIN32
-            LogError("Failed to create worker thread for telemetry \"%s\", 0x%x", telemetry->Name, GetLastError());
-#else
-            LogError("Failed to create worker thread for telemetry \"%s\".", telemetry->Name);
-#endif
+            ModbusProperty* property = (ModbusProperty*) block->Capabilities[i].Capability;
+            (void)ModbusPnp_ReportReadOnlyProperty(context, context->componentName,
+                property->Name, (const char*) resultedData);
         }
     }
 
-    for (int i = 0; i < propertyCount; i++)
+    return change;
+}
+
+#pragma endregion
+
+IOTHUB_CLIENT_RESULT ModbusPnp_StartPollingAllTelemetryProperty(
+    void* context)
+{
+    PMODBUS_DEVICE_CONTEXT deviceContext = (PMODBUS_DEVICE_CONTEXT)context;
+
+    // Every device on a connection is polled by the scheduler of the connection
+    deviceContext->Scheduler = deviceContext->Connection->Scheduler;
+
+    IOTHUB_CLIENT_RESULT result = ModbusScheduler_AddDevice(deviceContext->Scheduler, deviceContext);
+    if (IOTHUB_CLIENT_OK != result)
     {
-        if (NULL == propertyItemHandle)
-        {
-            propertyItemHandle = singlylinkedlist_get_head_item(propertyList);
-        }
-        else
-        {
-            propertyItemHandle = singlylinkedlist_get_next_item(propertyItemHandle);
-        }
+        deviceContext->Scheduler = NULL;
+    }
 
-        const ModbusProperty* property = singlylinkedlist_item_get_value(propertyItemHandle);
-        CapabilityContext* pollingPayload = calloc(1, sizeof(CapabilityContext));
-        if (!pollingPayload)
-        {
-            LogError("Could not allocate memory for property polling capability context.");
-            continue;
-        }
-        pollingPayload->hDevice = deviceContext->hDevice;
-        pollingPayload->capability = (void*)property;
-        pollingPayload->hLock = deviceContext->hConnectionLock;
-        pollingPayload->connectionType = deviceContext->DeviceConfig->ConnectionType;
-        pollingPayload->clientType = deviceContext->ClientType;
-        pollingPayload->clientHandle = deviceContext->ClientHandle;
-        pollingPayload->componentName = deviceContext->ComponentName;
-
-        if (ThreadAPI_Create(&(deviceContext->PollingTasks[telemetryCount + i]), ModbusPnp_PollingSingleProperty, (void*)pollingPayload) != THREADAPI_OK)
-        {
-#ifdef WIN32
-            LogError("Failed to create worker thread for property \"%s\", 0x%x", property->Name, GetLastError());
-#else
-            LogError("Failed to create worker thread for property \"%s\".", property->Name);
-#endif
-        }
+    return result;
+}
+
+void ModbusPnp_StopPollingAllTelemetryProperty(
+    void* context)
+{
+    PMODBUS_DEVICE_CONTEXT deviceContext = (PMODBUS_DEVICE_CONTEXT)context;
+
+    if (NULL == deviceContext->Scheduler)
+    {
+        return;
     }
 
-    return IOTHUB_CLIENT_OK;
+    ModbusScheduler_RemoveDevice(deviceContext->Scheduler, deviceContext);
+    deviceContext->Scheduler = NULL;
 }
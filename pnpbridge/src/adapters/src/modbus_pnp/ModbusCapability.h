@@ -20,6 +20,7 @@ extern "C"
 #include <pnpadapter_api.h>
 #include "azure_c_shared_utility/lock.h"
 #include "ModbusConnection/ModbusConnectionHelper.h"
+#include "ModbusValueCodec.h"
 
 typedef enum ModbusAccessType
 {
@@ -27,14 +28,23 @@ typedef enum ModbusAccessType
     READ_WRITE = 2
 } ModbusAccessType;
 
+// Polling of a capability whose interval adapts to how its value moves, between MinInterval and
+// MaxInterval. It is polled at a fixed DefaultFrequency when the two are equal.
+typedef struct _MODBUS_ADAPTIVE_POLLING {
+    int MinInterval;
+    int MaxInterval;
+    double Deadband;            // Changes of at most this much count as unchanged
+} MODBUS_ADAPTIVE_POLLING;
+
 typedef struct ModbusTelemetry {
     char*  Name;
     const char*  StartAddress;
     uint16_t Length;
     ModbusDataType  DataType;
     double ConversionCoefficient;
-    MODBUS_READ_REQUEST  ReadRequest;
+    MODBUS_VALUE_CODEC Codec;
     int    DefaultFrequency;
+    MODBUS_ADAPTIVE_POLLING Polling;
     CapabilityType Type;
 } ModbusTelemetry, *PModbusTelemetry;
 
@@ -46,9 +56,9 @@ typedef struct ModbusProperty {
     uint16_t Length;
     ModbusDataType  DataType;
     double ConversionCoefficient;
-    MODBUS_READ_REQUEST  ReadRequest;
-    MODBUS_WRITE_1_REG_REQUEST WriteRequest;
+    MODBUS_VALUE_CODEC Codec;
     int    DefaultFrequency;
+    MODBUS_ADAPTIVE_POLLING Polling;
     ModbusAccessType Access;
     CapabilityType Type;
 } ModbusProperty, *PModbusProperty;
@@ -59,10 +69,21 @@ typedef struct ModbusCommand {
     uint16_t Length;
     ModbusDataType  DataType;
     double ConversionCoefficient;
-    MODBUS_WRITE_1_REG_REQUEST WriteRequest;
+    MODBUS_VALUE_CODEC Codec;
     CapabilityType Type;
 } ModbusCommand, *PModbusCommand;
 
+// A poll of a device reads more telemetry than fits in one message only for large devices, which
+// are then sent in several messages well within the 256 KB limit of IoT Hub
+#define MODBUS_TELEMETRY_BUNDLE_MAX_LENGTH (64 * 1024)
+
+// The telemetry values read in one pass of the scheduler, sent together as one JSON object
+typedef struct _MODBUS_TELEMETRY_BUNDLE {
+    char* Data;
+    size_t Length;
+    size_t Capacity;
+} MODBUS_TELEMETRY_BUNDLE;
+
 typedef struct CapabilityContext {
     void* capability;
     HANDLE hDevice;
@@ -71,10 +92,40 @@ typedef struct CapabilityContext {
     PNP_BRIDGE_CLIENT_HANDLE clientHandle;
     PNP_BRIDGE_IOT_TYPE clientType;
     char * componentName;
+    struct _MODBUS_TCP_LINK* tcpLink;
+    struct _MODBUS_RTU_BUS* rtuBus;
+    struct _MODBUS_WRITE_QUEUE* writeQueue;    // Coalesces the writes of every device on the connection
+    MODBUS_TELEMETRY_BUNDLE* telemetryBundle;    // NULL when each value is sent in a message of its own
+    uint8_t unitId;
 }CapabilityContext;
 
 IOTHUB_CLIENT_RESULT ModbusPnp_StartPollingAllTelemetryProperty(void* context);
-void StopPollingTasks();
+void ModbusPnp_StopPollingAllTelemetryProperty(void* context);
+
+struct _MODBUS_READ_BLOCK;
+
+// How the values of a block moved since its last read
+typedef enum _MODBUS_BLOCK_CHANGE {
+    MODBUS_BLOCK_STEADY,        // Every value is within its deadband of the last one
+    MODBUS_BLOCK_CHANGED,
+    MODBUS_BLOCK_MOVING_FAST    // A value moved by more than MODBUS_FAST_CHANGE_DEADBANDS deadbands
+} MODBUS_BLOCK_CHANGE;
+
+#define MODBUS_FAST_CHANGE_DEADBANDS 4
+
+// Reports every capability of a block read by the poll scheduler. The response may be that of a
+// wider read, whose data starts at responseStartAddress. lastValues holds a value per capability
+// of the block, NAN until first read, which is compared against and updated.
+MODBUS_BLOCK_CHANGE ModbusPnp_ReportBlock(
+    CapabilityContext* context,
+    const struct _MODBUS_READ_BLOCK* block,
+    const uint8_t* response,
+    uint16_t responseStartAddress,
+    double* lastValues);
+
+// Sends the telemetry collected by ModbusPnp_ReportBlock since the last call as one message, if any
+void ModbusPnp_SendTelemetryBundle(
+    CapabilityContext* context);
 
 int ModbusPnp_CommandHandler(
     PNPBRIDGE_COMPONENT_HANDLE PnpComponentHandle,
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+
+#include "ModbusBackoff.h"
+
+void ModbusBackoff_Init(
+    MODBUS_BACKOFF* backoff,
+    uint32_t initialMs,
+    uint32_t maxMs)
+{
+    backoff->InitialMs = (0 == initialMs) ? 1 : initialMs;
+    backoff->MaxMs = (maxMs < backoff->InitialMs) ? backoff->InitialMs : maxMs;
+    backoff->Attempts = 0;
+}
+
+uint32_t ModbusBackoff_Next(
+    MODBUS_BACKOFF* backoff)
+{
+    uint64_t ceiling = backoff->InitialMs;
+    for (uint32_t i = 0; i < backoff->Attempts && ceiling < backoff->MaxMs; i++)
+    {
+        ceiling *= 2;
+    }
+    if (ceiling > backoff->MaxMs)
+    {
+        ceiling = backoff->MaxMs;
+    }
+    else
+    {
+        backoff->Attempts++;
+    }
+
+    uint32_t half = (uint32_t)(ceiling / 2);
+    return half + (uint32_t)(rand() % (int)(ceiling - half + 1));
+}
+
+void ModbusBackoff_Reset(
+    MODBUS_BACKOFF* backoff)
+{
+    backoff->Attempts = 0;
+}
+
+void ModbusCircuitBreaker_Init(
+    MODBUS_CIRCUIT_BREAKER* breaker,
+    int failureThreshold,
+    uint32_t initialDelayMs,
+    uint32_t maxDelayMs)
+{
+    breaker->State = MODBUS_CIRCUIT_CLOSED;
+    breaker->FailureThreshold = (failureThreshold < 1) ? 1 : failureThreshold;
+    breaker->ConsecutiveFailures = 0;
+    breaker->RetryTime = 0;
+    ModbusBackoff_Init(&(breaker->Backoff), initialDelayMs, maxDelayMs);
+}
+
+bool ModbusCircuitBreaker_Allow(
+    MODBUS_CIRCUIT_BREAKER* breaker,
+    uint64_t now)
+{
+    if (MODBUS_CIRCUIT_OPEN != breaker->State)
+    {
+        return true;
+    }
+
+    if (now < breaker->RetryTime)
+    {
+        return false;
+    }
+
+    breaker->State = MODBUS_CIRCUIT_HALF_OPEN;
+    return true;
+}
+
+bool ModbusCircuitBreaker_RecordSuccess(
+    MODBUS_CIRCUIT_BREAKER* breaker)
+{
+    bool wasOpen = (MODBUS_CIRCUIT_CLOSED != breaker->State);
+
+    breaker->State = MODBUS_CIRCUIT_CLOSED;
+    breaker->ConsecutiveFailures = 0;
+    ModbusBackoff_Reset(&(breaker->Backoff));
+    return wasOpen;
+}
+
+bool ModbusCircuitBreaker_RecordFailure(
+    MODBUS_CIRCUIT_BREAKER* breaker,
+    uint64_t now)
+{
+    // Reads that were already on their way when the breaker opened change nothing
+    if (MODBUS_CIRCUIT_OPEN == breaker->State)
+    {
+        return false;
+    }
+
+    breaker->ConsecutiveFailures++;
+    if (MODBUS_CIRCUIT_HALF_OPEN != breaker->State && breaker->ConsecutiveFailures < breaker->FailureThreshold)
+    {
+        return false;
+    }
+
+    breaker->State = MODBUS_CIRCUIT_OPEN;
+    breaker->RetryTime = now + ModbusBackoff_Next(&(breaker->Backoff));
+    return true;
+}
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Delays between attempts to reopen a connection that failed
+#define MODBUS_RECONNECT_INITIAL_DELAY_MS 500
+#define MODBUS_RECONNECT_MAX_DELAY_MS 30000
+
+// Polling of a device is suspended after this many reads in a row fail, first for the initial
+// delay, and for twice as long each time a trial read fails after it
+#define MODBUS_CIRCUIT_BREAKER_FAILURE_THRESHOLD 5
+#define MODBUS_CIRCUIT_BREAKER_INITIAL_DELAY_MS 1000
+#define MODBUS_CIRCUIT_BREAKER_MAX_DELAY_MS 60000
+
+// Exponential backoff with jitter. Each delay is drawn between half and all of a ceiling that
+// doubles with every attempt up to MaxMs, so that the devices behind a gateway that went away do
+// not all retry at the same moment.
+typedef struct _MODBUS_BACKOFF {
+    uint32_t InitialMs;
+    uint32_t MaxMs;
+    uint32_t Attempts;
+} MODBUS_BACKOFF;
+
+void ModbusBackoff_Init(
+    MODBUS_BACKOFF* backoff,
+    uint32_t initialMs,
+    uint32_t maxMs);
+
+// Returns the delay before the next attempt, and counts the attempt
+uint32_t ModbusBackoff_Next(
+    MODBUS_BACKOFF* backoff);
+
+// Starts over from the initial delay, once an attempt succeeded
+void ModbusBackoff_Reset(
+    MODBUS_BACKOFF* backoff);
+
+typedef enum _MODBUS_CIRCUIT_STATE {
+    MODBUS_CIRCUIT_CLOSED,      // Reads go through
+    MODBUS_CIRCUIT_OPEN,        // Reads are suspended until RetryTime
+    MODBUS_CIRCUIT_HALF_OPEN    // Reads go through on trial, and the first result decides
+} MODBUS_CIRCUIT_STATE;
+
+// Stops a device that keeps failing from taking up its connection, and from logging every failed
+// read, while it is unreachable
+typedef struct _MODBUS_CIRCUIT_BREAKER {
+    MODBUS_CIRCUIT_STATE State;
+    int FailureThreshold;
+    int ConsecutiveFailures;
+    uint64_t RetryTime;
+    MODBUS_BACKOFF Backoff;
+} MODBUS_CIRCUIT_BREAKER;
+
+void ModbusCircuitBreaker_Init(
+    MODBUS_CIRCUIT_BREAKER* breaker,
+    int failureThreshold,
+    uint32_t initialDelayMs,
+    uint32_t maxDelayMs);
+
+// Returns whether a read may go out at now. An open breaker lets reads through on trial once its
+// delay is over.
+bool ModbusCircuitBreaker_Allow(
+    MODBUS_CIRCUIT_BREAKER* breaker,
+    uint64_t now);
+
+// Closes the breaker. Returns true when it was not closed before.
+bool ModbusCircuitBreaker_RecordSuccess(
+    MODBUS_CIRCUIT_BREAKER* breaker);
+
+// Counts a failed read, and opens the breaker at the threshold or when a trial fails. Returns true
+// when the breaker opened.
+bool ModbusCircuitBreaker_RecordFailure(
+    MODBUS_CIRCUIT_BREAKER* breaker,
+    uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
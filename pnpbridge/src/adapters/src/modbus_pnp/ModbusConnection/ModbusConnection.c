@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "ModbusConnection.h"
+#include "../ModbusWriteQueue.h"
 
 int ModbusPnp_GetHeaderSize(
     MODBUS_CONNECTION_TYPE connectionType)
@@ -49,44 +50,53 @@ bool ValidateModbusResponse(
     }
 }
 
-int ProcessModbusResponse(
-    MODBUS_CONNECTION_TYPE connectionType,
-    CapabilityType capabilityType,
-    void* capability,
-    uint8_t* response,
-    size_t responseLength,
+// Formats the registers of a string capability in quotes, last register first with each register
+// high byte first. Bytes are written as two hex digits, or as they are when hex is false and they
+// are letters, digits or underscores.
+static int ModbusPnp_FormatCapabilityString(
+    const uint8_t* data,
+    int dataLength,
+    bool hex,
     uint8_t* result)
 {
-    int stepSize = 0;
-    int dataOffset = ModbusPnp_GetHeaderSize(connectionType);
-    int resultLength = -1;
+    static const char hexDigits[] = "0123456789ABCDEF";
+    int resultLength = 0;
 
-    // Get excpectd number of bits or registers in the payload
-    switch (response[dataOffset])   // Function code
+    result[resultLength++] = '\"';
+    for (int i = 0; i < dataLength * 2 && resultLength < MODBUS_RESPONSE_MAX_LENGTH - 4; i++)
     {
-    case ReadCoils:
-    case ReadInputs:
-        stepSize = 1;
-        dataOffset += 2;            // Header + Function Code (1 uint8_t) + Data Length (1 uint8_t)
-        break;
-    case ReadHoldingRegisters:
-    case ReadInputRegisters:
-        stepSize = 2;
-        dataOffset += 2;            // Header + Function Code (1 uint8_t) + Data Length (1 uint8_t)
-        break;
-    case WriteCoil:
-        stepSize = 1;
-        dataOffset += 3;            // Header + Function Code (1 uint8_t) + Address (2 uint8_t)
-        break;
-    case WriteHoldingRegister:
-        stepSize = 2;
-        dataOffset += 3;            // Header + Function Code (1 uint8_t) + Address (2 uint8_t)
-        break;
+        uint8_t byte = data[(dataLength - 1 - i / 2) * 2 + i % 2];
+        if (!hex && iscsym(byte) != 0)
+        {
+            result[resultLength++] = byte;
+        }
+        else
+        {
+            result[resultLength++] = (uint8_t)hexDigits[byte >> 4];
+            result[resultLength++] = (uint8_t)hexDigits[byte & 0x0f];
+        }
     }
+    result[resultLength++] = '\"';
+    result[resultLength] = '\0';
 
+    return resultLength;
+}
+
+// Formats the value of a capability from its data in a response: its registers when stepSize
+// is 2, or its bit at bitOffset of data when stepSize is 1
+static int ModbusPnp_FormatCapabilityValue(
+    CapabilityType capabilityType,
+    void* capability,
+    int stepSize,
+    const uint8_t* data,
+    uint16_t bitOffset,
+    uint8_t* result)
+{
     ModbusDataType dataType = INVALID;
     int dataLength = 0;
     double conversionCoefficient = 1.0;
+    const MODBUS_VALUE_CODEC* codec = NULL;
+    MODBUS_VALUE_CODEC defaultCodec;
     switch (capabilityType) {
     case Telemetry:
     {
@@ -94,6 +104,7 @@ int ProcessModbusResponse(
         dataType = telemetry->DataType;
         dataLength = telemetry->Length;
         conversionCoefficient = telemetry->ConversionCoefficient;
+        codec = &(telemetry->Codec);
         break;
     }
     case Property:
@@ -102,6 +113,7 @@ int ProcessModbusResponse(
         dataType = property->DataType;
         dataLength = property->Length;
         conversionCoefficient = property->ConversionCoefficient;
+        codec = &(property->Codec);
         break;
     }
     case Command:
@@ -110,230 +122,104 @@ int ProcessModbusResponse(
         dataType = command->DataType;
         dataLength = command->Length;
         conversionCoefficient = command->ConversionCoefficient;
+        codec = &(command->Codec);
         break;
     }
     }
 
-    // Check Endian-ness
-
     if (stepSize == 1)
     {
         // Read bits (1 bit)
-        uint8_t bitVal = (uint8_t)(response[dataOffset] & 0b1);
-        const char* data = (bitVal == (uint8_t)1) ? "true" : "false";
-        resultLength = sprintf_s((char*)result, MODBUS_RESPONSE_MAX_LENGTH, "%s", data);
+        uint8_t bitVal = (uint8_t)((data[bitOffset / 8] >> (bitOffset % 8)) & 0b1);
+        const char* value = (bitVal == (uint8_t)1) ? "true" : "false";
+        return sprintf_s((char*)result, MODBUS_RESPONSE_MAX_LENGTH, "%s", value);
     }
-    else if (stepSize == 2)
+
+    if (stepSize != 2)
     {
-        double value = 0.0;
-        switch (dataType)
-        {
-        case HEXSTRING:
-        {
-            uint8_t *strBuffer = calloc((dataLength * 2) + 1, sizeof(uint8_t));
-            if (NULL == strBuffer)
-            {
-                LogError("Failed to convert the response to string: Memory allocation failed.");
-                return -1;
-            }
-            // Reverse data array
-            for (int i = 0; i < dataLength * 2; i++)
-            {
-                strBuffer[(dataLength * 2) - i - 1] = response[dataOffset + i];
-            }
-
-            uint8_t temp = 0x00;
-            for (int i = 0; i < dataLength; i++)
-            {
-                temp = strBuffer[i * 2];
-                strBuffer[i * 2] = strBuffer[(i * 2) + 1];
-                strBuffer[(i * 2) + 1] = temp;
-            }
-
-            // Convert Hex string
-            char* strPtr = (char*)result;
-            *(strPtr++) = '\"';
-            resultLength = 1;
-            for (int i = 0; i < (dataLength * 2); i++)
-            {
-                int length = 0;
-                length = sprintf_s(strPtr, MODBUS_RESPONSE_MAX_LENGTH - resultLength - 2, "%02X", (uint8_t)strBuffer[i]);
-                strPtr += length;
-                resultLength += length;
-            }
-
-            if (resultLength < (MODBUS_RESPONSE_MAX_LENGTH - 2))
-            {
-                result[resultLength++] = '\"';
-                result[resultLength++] = '\0';
-            }
-            free(strBuffer);
-            return resultLength;
-        }
-        case STRING:
-        {
-            uint8_t *strBuffer = calloc((dataLength * 2) + 1, sizeof(uint8_t));
-            if (NULL == strBuffer)
-            {
-                LogError("Failed to convert the response to string: Memory allocation failed.");
-                return -1;
-            }
-            // Reverse data array
-            for (int i = 0; i < dataLength * 2; i++)
-            {
-                strBuffer[(dataLength * 2) - i - 1] = response[dataOffset + i];
-            }
-
-            char temp = 0x00;
-            for (int i = 0; i < dataLength; i++)
-            {
-                temp = strBuffer[i * 2];
-                strBuffer[i * 2] = strBuffer[(i * 2) + 1];
-                strBuffer[(i * 2) + 1] = temp;
-            }
-
-            // Convert non-alpha-numberic char to Hex char
-            char* strPtr = (char*)result;
-            *(strPtr++) = '\"';
-            resultLength = 1;
-            for (int i = 0; i < (dataLength * 2); i++)
-            {
-                int length = 0;
-                if (iscsym(strBuffer[i]) != 0)
-                {
-                    length = sprintf_s(strPtr, MODBUS_RESPONSE_MAX_LENGTH - resultLength - 2, "%c", (char)strBuffer[i]);
-                }
-                else
-                {
-                    length = sprintf_s(strPtr, MODBUS_RESPONSE_MAX_LENGTH - resultLength - 2, "%02X", (uint8_t)strBuffer[i]);
-                }
-
-                strPtr += length;
-                resultLength += length;
-            }
-
-            if (resultLength < (MODBUS_RESPONSE_MAX_LENGTH - 2))
-            {
-                result[resultLength++] = '\"';
-                result[resultLength++] = '\0';
-            }
-            free(strBuffer);
-            return resultLength;
-        }
-        case NUMERIC:
+        return -1;
+    }
+
+    switch (dataType)
+    {
+    case HEXSTRING:
+        return ModbusPnp_FormatCapabilityString(data, dataLength, true, result);
+    case STRING:
+        return ModbusPnp_FormatCapabilityString(data, dataLength, false, result);
+    default:
+        break;
+    }
+
+    // Numbers are decoded by the codec set up with the capability, or by a default one for a
+    // capability that was not parsed from a configuration. The data is only read, since it may be
+    // shared with other capabilities.
+    if (NULL == codec || NULL == codec->Decode)
+    {
+        if (!ModbusValueCodec_Init(&defaultCodec, dataType, (uint16_t)dataLength, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN))
         {
-            int n = 1;
-            if (dataLength > 1 && *(char *)&n == 1)
-            {
-                // Is little Endian, reverse response array
-                uint8_t temp = 0x00;
-                for (size_t i = dataOffset, j = responseLength - 1; i < ((responseLength - dataOffset) / 2); i++, j--)
-                {
-                    temp = response[i];
-                    response[i] = response[j];
-                    response[j] = temp;
-                }
-            }
-
-            switch (dataLength)
-            {
-                case 1:
-                {
-                    uint16_t rawValue = ((response[dataOffset] << 8) + response[dataOffset + 1]);
-                    value = rawValue * conversionCoefficient;
-                    break;
-                }
-                case 2:
-                {
-                    uint32_t rawValue = 0;
-                    for (int i = 0; i < dataLength; i++)
-                    {
-                        rawValue <<= 16;
-                        rawValue += ((response[dataOffset + i * 2] << 8) + response[dataOffset + 1]);
-                    }
-                    value = rawValue * conversionCoefficient;
-                    break;
-                }
-                case 4:
-                {
-                    uint64_t rawValue = 0;
-                    for (int i = 0; i < dataLength; i++)
-                    {
-                        rawValue <<= 16;
-                        rawValue += ((response[dataOffset + i * 2] << 8) + response[dataOffset + 1]);
-                    }
-                    value = rawValue * conversionCoefficient;
-                    break;
-                }
-            }
-            break;
-        }
-        default:
             LogError("Unsupported datatype.");
             return -1;
         }
-        resultLength = sprintf_s((char*)result, MODBUS_RESPONSE_MAX_LENGTH, "%g", value);
+        codec = &defaultCodec;
     }
-    return resultLength;
-}
-bool ModbusPnp_CloseDevice(
-    MODBUS_CONNECTION_TYPE connectionType,
-    HANDLE hDevice,
-    LOCK_HANDLE hLock)
-{
-    bool result = false;
-    switch (connectionType)
-    {
-        case TCP:
-            result = ModbusTcp_CloseDevice((SOCKET)hDevice, hLock);
-            break;
-        case RTU:
-            result = ModbusRtu_CloseDevice(hDevice, hLock);
-            break;
-        default:
-            break;
-    }
-    return result;
+
+    return ModbusValueCodec_Format(codec, data, conversionCoefficient, (char*)result, MODBUS_RESPONSE_MAX_LENGTH);
 }
 
-IOTHUB_CLIENT_RESULT ModbusPnp_SetReadRequest(
-    ModbusDeviceConfig* deviceConfig,
+int ProcessModbusResponse(
+    MODBUS_CONNECTION_TYPE connectionType,
     CapabilityType capabilityType,
-    void* capability)
+    void* capability,
+    uint8_t* response,
+    size_t responseLength,
+    uint8_t* result)
 {
-    int result = IOTHUB_CLIENT_ERROR;
-    switch (deviceConfig->ConnectionType)
+    AZURE_UNREFERENCED_PARAMETER(responseLength);
+    int stepSize = 0;
+    int dataOffset = ModbusPnp_GetHeaderSize(connectionType);
+
+    // Get excpectd number of bits or registers in the payload
+    switch (response[dataOffset])   // Function code
     {
-        case TCP:
-            result = ModbusTcp_SetReadRequest(capabilityType, capability, deviceConfig->UnitId);
-            break;
-        case RTU:
-            result = ModbusRtu_SetReadRequest(capabilityType, capability, deviceConfig->UnitId);
-            break;
-        default:
-            break;
+    case ReadCoils:
+    case ReadInputs:
+        stepSize = 1;
+        dataOffset += 2;            // Header + Function Code (1 uint8_t) + Data Length (1 uint8_t)
+        break;
+    case ReadHoldingRegisters:
+    case ReadInputRegisters:
+        stepSize = 2;
+        dataOffset += 2;            // Header + Function Code (1 uint8_t) + Data Length (1 uint8_t)
+        break;
+    case WriteCoil:
+        stepSize = 1;
+        dataOffset += 3;            // Header + Function Code (1 uint8_t) + Address (2 uint8_t)
+        break;
+    case WriteHoldingRegister:
+        stepSize = 2;
+        dataOffset += 3;            // Header + Function Code (1 uint8_t) + Address (2 uint8_t)
+        break;
     }
-    return result;
+
+    return ModbusPnp_FormatCapabilityValue(capabilityType, capability, stepSize, response + dataOffset, 0, result);
 }
 
-IOTHUB_CLIENT_RESULT ModbusPnp_SetWriteRequest(
+bool ModbusPnp_CloseDevice(
     MODBUS_CONNECTION_TYPE connectionType,
-    CapabilityType capabilityType,
-    void* capability,
-    char* valueStr)
+    HANDLE hDevice,
+    LOCK_HANDLE hLock)
 {
-    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_ERROR;
+    bool result = false;
     switch (connectionType)
     {
         case TCP:
-            result = ModbusTcp_SetWriteRequest(capabilityType, capability, valueStr);
+            result = ModbusTcp_CloseDevice((SOCKET)hDevice, hLock);
             break;
         case RTU:
-            result = ModbusRtu_SetWriteRequest(capabilityType, capability, valueStr);
+            result = ModbusRtu_CloseDevice(hDevice, hLock);
             break;
         default:
             break;
-
     }
     return result;
 }
@@ -351,7 +237,7 @@ int ModbusPnp_ReadResponse(
             result = ModbusTcp_ReadResponse((SOCKET)handler, responseArr, arrLen);
             break;
         case RTU:
-            result = ModbusRtu_ReadResponse(handler, responseArr, arrLen);
+            result = ModbusRtu_ReadResponse(handler, responseArr, arrLen, ModbusRtu_GetResponseTimeoutMs(0, arrLen));
             break;
         default:
             break;
@@ -387,11 +273,16 @@ int ModbusPnp_ReadCapability(
 {
     uint8_t response[MODBUS_RESPONSE_MAX_LENGTH];
     memset(response, 0x00, MODBUS_RESPONSE_MAX_LENGTH);
-    size_t responseLength = 0;
+    int responseLength = 0;
 
     int resultLength = -1;
 
     const char* capabilityName = NULL;
+    const char* startAddress = NULL;
+    uint16_t length = 0;
+    uint8_t functionCode = 0;
+    uint16_t modbusAddress = 0;
+    MODBUS_READ_REQUEST request;
     uint8_t* requestArr = NULL;
     int requestArrSize = 0;
 
@@ -401,39 +292,16 @@ int ModbusPnp_ReadCapability(
         {
             ModbusTelemetry* telemetry = (ModbusTelemetry*) (capabilityContext->capability);
             capabilityName = telemetry->Name;
-
-            switch (capabilityContext->connectionType)
-            {
-                case TCP:
-                    requestArr = telemetry->ReadRequest.TcpArr;
-                    requestArrSize = sizeof(telemetry->ReadRequest.TcpArr);
-                    break;
-                case RTU:
-                    requestArr = telemetry->ReadRequest.RtuArr;
-                    requestArrSize = sizeof(telemetry->ReadRequest.RtuArr);
-                    break;
-                default:
-                    break;
-            }
+            startAddress = telemetry->StartAddress;
+            length = telemetry->Length;
             break;
         }
         case Property:
         {
             ModbusProperty* property = (ModbusProperty*) (capabilityContext->capability);
             capabilityName = property->Name;
-            switch (capabilityContext->connectionType)
-            {
-                case TCP:
-                    requestArr = property->ReadRequest.TcpArr;
-                    requestArrSize = sizeof(property->ReadRequest.TcpArr);
-                    break;
-                case RTU:
-                    requestArr = property->ReadRequest.RtuArr;
-                    requestArrSize = sizeof(property->ReadRequest.RtuArr);
-                    break;
-                default:
-                    break;
-            }
+            startAddress = property->StartAddress;
+            length = property->Length;
             break;
         }
     default:
@@ -442,21 +310,31 @@ int ModbusPnp_ReadCapability(
         goto exit;
     }
 
-    if (LOCK_OK != Lock(capabilityContext->hLock))
+    if (!ModbusConnectionHelper_GetFunctionCode(startAddress, true, &functionCode, &modbusAddress))
     {
-        LogError("Device communicate lock is abandoned.");
+        LogError("Failed to get Modbus function code for capability \"%s\".", capabilityName);
         resultLength = -1;
         goto exit;
     }
 
-    if (requestArrSize != ModbusPnp_SendRequest(capabilityContext->connectionType, capabilityContext->hDevice, requestArr, requestArrSize))
+    // Capabilities are shared by every device of an interface, so the request is the caller's own
+    memset(&request, 0, sizeof(request));
+    ModbusPnp_EncodeReadRequest(capabilityContext->connectionType, &request, functionCode, modbusAddress, length, capabilityContext->unitId);
+    switch (capabilityContext->connectionType)
     {
-        LogError("Failed to send read request for capability \"%s\".", capabilityName);
-        resultLength = -1;
-        goto exit;
+        case TCP:
+            requestArr = request.TcpArr;
+            requestArrSize = sizeof(request.TcpArr);
+            break;
+        case RTU:
+            requestArr = request.RtuArr;
+            requestArrSize = sizeof(request.RtuArr);
+            break;
+        default:
+            break;
     }
 
-    responseLength = ModbusPnp_ReadResponse(capabilityContext->connectionType, capabilityContext->hDevice, response, MODBUS_RESPONSE_MAX_LENGTH);
+    responseLength = ModbusPnp_Transact(capabilityContext, requestArr, requestArrSize, response, MODBUS_RESPONSE_MAX_LENGTH);
     if (responseLength < 0)
     {
         LogError("Failed to get read response for capability \"%s\".", capabilityName);
@@ -484,7 +362,6 @@ int ModbusPnp_ReadCapability(
     }
 
 exit:
-    Unlock(capabilityContext->hLock);
     return resultLength;
 }
 
@@ -494,14 +371,16 @@ int ModbusPnp_WriteToCapability(
     char* requestStr,
     uint8_t* resultedData)
 {
-    uint8_t response[MODBUS_RESPONSE_MAX_LENGTH];
-    memset(response, 0x00, MODBUS_RESPONSE_MAX_LENGTH);
-    size_t responseLength = 0;
+    MODBUS_WRITE write;
+    uint8_t data[MODBUS_MAX_WRITE_DATA_LENGTH];
     int resultLength = -1;
+    int writeResult = -1;
 
     const char* capabilityName = NULL;
-    uint8_t* requestArr = NULL;
-    int requestArrSize = 0;
+    const char* startAddress = NULL;
+    ModbusDataType dataType = INVALID;
+    uint16_t length = 0;
+    const MODBUS_VALUE_CODEC* codec = NULL;
 
     switch (capabilityType)
     {
@@ -509,50 +388,20 @@ int ModbusPnp_WriteToCapability(
         {
             ModbusCommand* command = (ModbusCommand*)(capabilityContext->capability);
             capabilityName = command->Name;
-            if (IOTHUB_CLIENT_OK != ModbusPnp_SetWriteRequest(capabilityContext->connectionType, Command, command, requestStr))
-            {
-                LogError("Failed to create write request for command \"%s\".", capabilityName);
-                return -1;
-            }
-
-            switch (capabilityContext->connectionType)
-            {
-                case TCP:
-                    requestArr = command->WriteRequest.TcpArr;
-                    requestArrSize = sizeof(command->WriteRequest.TcpArr);
-                    break;
-                case RTU:
-                    requestArr = command->WriteRequest.RtuArr;
-                    requestArrSize = sizeof(command->WriteRequest.RtuArr);
-                    break;
-                default:
-                    break;
-            }
+            startAddress = command->StartAddress;
+            dataType = command->DataType;
+            length = command->Length;
+            codec = &(command->Codec);
             break;
         }
         case Property:
         {
             ModbusProperty* property = (ModbusProperty*)(capabilityContext->capability);
             capabilityName = property->Name;
-            if (IOTHUB_CLIENT_OK != ModbusPnp_SetWriteRequest(capabilityContext->connectionType, Property, property, requestStr))
-            {
-                LogError("Failed to create write request for writable property \"%s\".", capabilityName);
-                return -1;
-            }
-
-            switch (capabilityContext->connectionType)
-            {
-                case TCP:
-                    requestArr = property->WriteRequest.TcpArr;
-                    requestArrSize = sizeof(property->WriteRequest.TcpArr);
-                    break;
-                case RTU:
-                    requestArr = property->WriteRequest.RtuArr;
-                    requestArrSize = sizeof(property->WriteRequest.RtuArr);
-                    break;
-                default:
-                    break;
-            }
+            startAddress = property->StartAddress;
+            dataType = property->DataType;
+            length = property->Length;
+            codec = &(property->Codec);
             break;
         }
         default:
@@ -561,46 +410,326 @@ int ModbusPnp_WriteToCapability(
             goto exit;
     }
 
-    if (LOCK_OK != Lock(capabilityContext->hLock))
+    write.UnitId = capabilityContext->unitId;
+    write.Quantity = (0 == length) ? 1 : length;
+    if (!ModbusConnectionHelper_GetFunctionCode(startAddress, false, &(write.FunctionCode), &(write.Address)) ||
+        (WriteCoil != write.FunctionCode && WriteHoldingRegister != write.FunctionCode))
     {
-        LogError("Device communicate lock is abandoned.");
+        LogError("Capability \"%s\" is neither a coil nor a holding register, which are the ones that can be written.", capabilityName);
         resultLength = -1;
         goto exit;
     }
 
-    if (requestArrSize != ModbusPnp_SendRequest(capabilityContext->connectionType, capabilityContext->hDevice, requestArr, requestArrSize))
+    if (write.Quantity > MODBUS_MAX_WRITE_REGISTERS)
     {
-        LogError("Failed to send write request for capability \"%s\".", capabilityName);
+        LogError("Capability \"%s\" spans more than the %d coils or registers a single request can write.", capabilityName, MODBUS_MAX_WRITE_REGISTERS);
         resultLength = -1;
         goto exit;
     }
 
-    responseLength = ModbusPnp_ReadResponse(capabilityContext->connectionType, capabilityContext->hDevice, response, MODBUS_RESPONSE_MAX_LENGTH);
-    if (responseLength < 0)
+    if (!ModbusConnectionHelper_ConvertValueStrToRegisters(codec, dataType, write.FunctionCode, requestStr, write.Quantity, write.Values))
     {
-        LogError("Failed to get write response for capability \"%s\".", capabilityName);
+        LogError("Failed to convert data \"%s\" to write to capability \"%s\".", requestStr, capabilityName);
         resultLength = -1;
         goto exit;
     }
 
-    if (ValidateModbusResponse(capabilityContext->connectionType, response, requestArr))
+    // A property write is left to the write queue, to send along with the writes next to it, while
+    // a command waits for its write to be done
+    if (NULL != capabilityContext->writeQueue)
     {
-        resultLength = ProcessModbusResponse(capabilityContext->connectionType, capabilityType, capabilityContext->capability, response, responseLength, resultedData);
-        if (resultLength < 0)
-        {
-            LogError("Failed to parse response for command \"%s\".", capabilityName);
-            resultLength = -1;
-            goto exit;
-        }
+        writeResult = (IOTHUB_CLIENT_OK == ModbusWriteQueue_Write(capabilityContext->writeQueue, &write, Command == capabilityType)) ? 0 : -1;
     }
     else
     {
-        LogError("Invalid response for command \"%s\".", capabilityName);
+        writeResult = ModbusPnp_Write(capabilityContext, &write);
+    }
+
+    if (writeResult < 0)
+    {
+        LogError("Failed to write to capability \"%s\".", capabilityName);
+        resultLength = -1;
+        goto exit;
+    }
+
+    if (Property == capabilityType && NULL != capabilityContext->writeQueue)
+    {
+        resultLength = 0;
+        goto exit;
+    }
+
+    // The device has taken the value as written, which is the result
+    for (int i = 0; i < write.Quantity; i++)
+    {
+        data[i * 2] = (uint8_t)(write.Values[i] >> 8);
+        data[i * 2 + 1] = (uint8_t)(write.Values[i] & 0xff);
+    }
+    resultLength = ModbusPnp_FormatCapabilityValue(capabilityType, capabilityContext->capability, (WriteCoil == write.FunctionCode) ? 1 : 2, data, 0, resultedData);
+    if (resultLength < 0)
+    {
+        LogError("Failed to format the value written to capability \"%s\".", capabilityName);
         resultLength = -1;
         goto exit;
     }
 
 exit:
-    Unlock(capabilityContext->hLock);
     return resultLength;
-}
\ No newline at end of file
+}
+
+int ModbusPnp_Write(
+    CapabilityContext* capabilityContext,
+    const MODBUS_WRITE* write)
+{
+    MODBUS_WRITE_1_REG_REQUEST singleRequest;
+    MODBUS_WRITE_MULTIPLE_REQUEST multipleRequest;
+    uint8_t response[MODBUS_RESPONSE_MAX_LENGTH];
+    uint8_t* requestArr = NULL;
+    uint32_t requestArrSize = 0;
+
+    if (1 == write->Quantity)
+    {
+        switch (capabilityContext->connectionType)
+        {
+            case TCP:
+                ModbusTcp_EncodeWriteRequest(&singleRequest, write->FunctionCode, write->Address, write->Values[0], write->UnitId);
+                requestArr = singleRequest.TcpArr;
+                requestArrSize = sizeof(singleRequest.TcpArr);
+                break;
+            case RTU:
+                ModbusRtu_EncodeWriteRequest(&singleRequest, write->FunctionCode, write->Address, write->Values[0], write->UnitId);
+                requestArr = singleRequest.RtuArr;
+                requestArrSize = sizeof(singleRequest.RtuArr);
+                break;
+            default:
+                break;
+        }
+    }
+    else
+    {
+        uint8_t functionCode = (WriteCoil == write->FunctionCode) ? WriteCoils : WriteHoldingRegisters;
+        switch (capabilityContext->connectionType)
+        {
+            case TCP:
+                requestArrSize = ModbusTcp_EncodeWriteMultipleRequest(&multipleRequest, functionCode, write->Address, write->Quantity, write->Values, write->UnitId);
+                requestArr = multipleRequest.TcpArr;
+                break;
+            case RTU:
+                requestArrSize = ModbusRtu_EncodeWriteMultipleRequest(&multipleRequest, functionCode, write->Address, write->Quantity, write->Values, write->UnitId);
+                requestArr = multipleRequest.RtuArr;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (NULL == requestArr)
+    {
+        LogError("Modbus write is not supported for the connection type.");
+        return -1;
+    }
+
+    memset(response, 0x00, sizeof(response));
+    if (ModbusPnp_Transact(capabilityContext, requestArr, requestArrSize, response, sizeof(response)) < 0)
+    {
+        LogError("Failed to get write response for %d coils or registers at %d.", write->Quantity, write->Address);
+        return -1;
+    }
+
+    if (!ValidateModbusResponse(capabilityContext->connectionType, response, requestArr))
+    {
+        LogError("Invalid response for writing %d coils or registers at %d.", write->Quantity, write->Address);
+        return -1;
+    }
+
+    return 0;
+}
+
+void ModbusPnp_EncodeReadRequest(
+    MODBUS_CONNECTION_TYPE connectionType,
+    MODBUS_READ_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t quantity,
+    uint8_t unitId)
+{
+    switch (connectionType)
+    {
+        case TCP:
+            ModbusTcp_EncodeReadRequest(request, functionCode, modbusAddress, quantity, unitId);
+            break;
+        case RTU:
+            ModbusRtu_EncodeReadRequest(request, functionCode, modbusAddress, quantity, unitId);
+            break;
+        default:
+            break;
+    }
+}
+
+int ModbusPnp_Transact(
+    CapabilityContext* capabilityContext,
+    uint8_t* requestArr,
+    uint32_t requestArrSize,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    if (NULL != capabilityContext->tcpLink)
+    {
+        return ModbusTcpLink_Transact(capabilityContext->tcpLink, requestArr, requestArrSize, response, responseSize);
+    }
+
+    if (NULL != capabilityContext->rtuBus)
+    {
+        return ModbusRtuBus_Transact(capabilityContext->rtuBus, requestArr, requestArrSize, response, responseSize);
+    }
+
+    if (LOCK_OK != Lock(capabilityContext->hLock))
+    {
+        LogError("Device communicate lock is abandoned.");
+        return -1;
+    }
+
+    int responseLength = -1;
+    if ((int)requestArrSize != ModbusPnp_SendRequest(capabilityContext->connectionType, capabilityContext->hDevice, requestArr, requestArrSize))
+    {
+        LogError("Failed to send request.");
+    }
+    else
+    {
+        responseLength = ModbusPnp_ReadResponse(capabilityContext->connectionType, capabilityContext->hDevice, response, responseSize);
+    }
+
+    Unlock(capabilityContext->hLock);
+    return responseLength;
+}
+
+static uint8_t* ModbusPnp_GetBlockRequest(
+    MODBUS_CONNECTION_TYPE connectionType,
+    const MODBUS_READ_BLOCK* block,
+    uint32_t* requestArrSize)
+{
+    switch (connectionType)
+    {
+        case TCP:
+            *requestArrSize = sizeof(block->ReadRequest.TcpArr);
+            return (uint8_t*)block->ReadRequest.TcpArr;
+        case RTU:
+            *requestArrSize = sizeof(block->ReadRequest.RtuArr);
+            return (uint8_t*)block->ReadRequest.RtuArr;
+        default:
+            return NULL;
+    }
+}
+
+void ModbusPnp_BeginReadBlock(
+    CapabilityContext* capabilityContext,
+    const MODBUS_READ_BLOCK* block,
+    uint8_t* response,
+    uint32_t responseSize,
+    MODBUS_PENDING_READ* pending)
+{
+    uint32_t requestArrSize = 0;
+    uint8_t* requestArr = ModbusPnp_GetBlockRequest(capabilityContext->connectionType, block, &requestArrSize);
+
+    pending->Context = capabilityContext;
+    pending->Block = block;
+    pending->Response = response;
+    pending->ResponseSize = responseSize;
+    pending->Transaction = -1;
+    pending->Failed = false;
+
+    if (NULL == requestArr)
+    {
+        LogError("Modbus read is not supported for the connection type.");
+        pending->Failed = true;
+    }
+    else if (NULL != capabilityContext->tcpLink)
+    {
+        pending->Transaction = ModbusTcpLink_Submit(capabilityContext->tcpLink, requestArr, requestArrSize, response, responseSize);
+        if (pending->Transaction < 0)
+        {
+            LogError("Failed to send read request for %d registers at %d.", block->Quantity, block->StartAddress);
+            pending->Failed = true;
+        }
+    }
+}
+
+int ModbusPnp_EndReadBlock(
+    MODBUS_PENDING_READ* pending)
+{
+    CapabilityContext* capabilityContext = pending->Context;
+    const MODBUS_READ_BLOCK* block = pending->Block;
+    uint8_t* response = pending->Response;
+    uint32_t requestArrSize = 0;
+    uint8_t* requestArr = ModbusPnp_GetBlockRequest(capabilityContext->connectionType, block, &requestArrSize);
+    int received = -1;
+
+    if (pending->Failed)
+    {
+        return -1;
+    }
+
+    if (pending->Transaction >= 0)
+    {
+        received = ModbusTcpLink_Wait(capabilityContext->tcpLink, pending->Transaction, MODBUS_TCP_RESPONSE_TIMEOUT_MS);
+    }
+    else
+    {
+        received = ModbusPnp_Transact(capabilityContext, requestArr, requestArrSize, response, pending->ResponseSize);
+    }
+
+    if (received < 0)
+    {
+        LogError("Failed to get read response for %d registers at %d.", block->Quantity, block->StartAddress);
+        return -1;
+    }
+
+    if (!ValidateModbusResponse(capabilityContext->connectionType, response, requestArr))
+    {
+        LogError("Invalid response for reading %d registers at %d.", block->Quantity, block->StartAddress);
+        return -1;
+    }
+
+    // Every capability is decoded from this response, so it must hold all of the block
+    int headerSize = ModbusPnp_GetHeaderSize(capabilityContext->connectionType);
+    int byteCount = (ReadCoils == block->FunctionCode || ReadInputs == block->FunctionCode) ? (block->Quantity + 7) / 8 : block->Quantity * 2;
+    if (received < headerSize + 2 + byteCount || response[headerSize + 1] != byteCount)
+    {
+        LogError("Truncated response for reading %d registers at %d.", block->Quantity, block->StartAddress);
+        return -1;
+    }
+
+    return received;
+}
+
+int ModbusPnp_ReadBlock(
+    CapabilityContext* capabilityContext,
+    const MODBUS_READ_BLOCK* block,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    MODBUS_PENDING_READ pending;
+    ModbusPnp_BeginReadBlock(capabilityContext, block, response, responseSize, &pending);
+    return ModbusPnp_EndReadBlock(&pending);
+}
+
+int ModbusPnp_DecodeBlockCapability(
+    MODBUS_CONNECTION_TYPE connectionType,
+    const MODBUS_READ_BLOCK* block,
+    int index,
+    const uint8_t* response,
+    uint16_t responseStartAddress,
+    uint8_t* resultedData)
+{
+    const MODBUS_BLOCK_CAPABILITY* blockCapability = &(block->Capabilities[index]);
+    uint16_t offset = (uint16_t)(block->StartAddress - responseStartAddress + blockCapability->Offset);
+
+    // Header + Function Code (1 uint8_t) + Data Length (1 uint8_t)
+    const uint8_t* data = response + ModbusPnp_GetHeaderSize(connectionType) + 2;
+
+    if (ReadCoils == block->FunctionCode || ReadInputs == block->FunctionCode)
+    {
+        return ModbusPnp_FormatCapabilityValue(blockCapability->Type, blockCapability->Capability, 1, data, offset, resultedData);
+    }
+
+    return ModbusPnp_FormatCapabilityValue(blockCapability->Type, blockCapability->Capability, 2, data + offset * 2, 0, resultedData);
+}
@@ -11,16 +11,61 @@ extern "C"
 #include "ModbusConnectionHelper.h"
 #include "ModbusRtuConnection.h"
 #include "ModbusTCPConnection.h"
+#include "ModbusTCPLink.h"
+#include "ModbusRtuBus.h"
 #include "../ModbusPnp.h"
 #include "../ModbusCapability.h"
+#include "../ModbusReadPlanner.h"
 
 // ModbusConnection "Public" methods
 
 bool ModbusPnp_CloseDevice(MODBUS_CONNECTION_TYPE connectionType, HANDLE hDevice, LOCK_HANDLE lock);
-IOTHUB_CLIENT_RESULT ModbusPnp_SetReadRequest(ModbusDeviceConfig* deviceConfig, CapabilityType capabilityType, void* capability);
 int ModbusPnp_ReadCapability(CapabilityContext* capabilityContext, CapabilityType capabilityType, uint8_t* resultedData);
 int ModbusPnp_WriteToCapability(CapabilityContext* capabilityContext, CapabilityType capabilityType, char* requestStr, uint8_t* resultedData);
 
+void ModbusPnp_EncodeReadRequest(MODBUS_CONNECTION_TYPE connectionType, MODBUS_READ_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t quantity, uint8_t unitId);
+
+// A write of consecutive coils or registers of a unit
+typedef struct _MODBUS_WRITE {
+    uint8_t UnitId;
+    uint8_t FunctionCode;       // WriteCoil or WriteHoldingRegister, whatever the quantity
+    uint16_t Address;
+    uint16_t Quantity;          // Up to MODBUS_MAX_WRITE_COILS coils or MODBUS_MAX_WRITE_REGISTERS registers
+    uint16_t Values[MODBUS_MAX_WRITE_COILS];
+} MODBUS_WRITE;
+
+// Writes a single coil or register with Write Single Coil or Write Single Register, and more with
+// Write Multiple Coils or Write Multiple Registers. Returns 0, or -1 on failure.
+int ModbusPnp_Write(CapabilityContext* capabilityContext, const MODBUS_WRITE* write);
+
+// Sends a request and reads its response, through the shared link or bus of the device, or under
+// the connection lock otherwise. Returns the length of the response, or -1 on failure.
+int ModbusPnp_Transact(CapabilityContext* capabilityContext, uint8_t* requestArr, uint32_t requestArrSize, uint8_t* response, uint32_t responseSize);
+
+// A block read on its way. Reads through a TCP link are sent when begun, so that several may be in
+// flight; other reads are performed when ended.
+typedef struct _MODBUS_PENDING_READ {
+    CapabilityContext* Context;
+    const MODBUS_READ_BLOCK* Block;
+    uint8_t* Response;
+    uint32_t ResponseSize;
+    int Transaction;            // Transaction on the TCP link, or -1 when not sent yet
+    bool Failed;
+} MODBUS_PENDING_READ;
+
+void ModbusPnp_BeginReadBlock(CapabilityContext* capabilityContext, const MODBUS_READ_BLOCK* block, uint8_t* response, uint32_t responseSize, MODBUS_PENDING_READ* pending);
+
+// Completes a block read. Returns the length of the response, which holds the data of every
+// capability of the block, or -1 on failure.
+int ModbusPnp_EndReadBlock(MODBUS_PENDING_READ* pending);
+
+// Reads all of a block in one request
+int ModbusPnp_ReadBlock(CapabilityContext* capabilityContext, const MODBUS_READ_BLOCK* block, uint8_t* response, uint32_t responseSize);
+
+// Formats the value of the index-th capability of a block from the response of ModbusPnp_ReadBlock.
+// The response may be that of a wider read, whose data starts at responseStartAddress.
+int ModbusPnp_DecodeBlockCapability(MODBUS_CONNECTION_TYPE connectionType, const MODBUS_READ_BLOCK* block, int index, const uint8_t* response, uint16_t responseStartAddress, uint8_t* resultedData);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
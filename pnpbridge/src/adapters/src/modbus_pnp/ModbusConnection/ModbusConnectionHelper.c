@@ -3,6 +3,7 @@
 
 #include "ModbusConnectionHelper.h"
 #include <stdlib.h>
+#include <string.h>
 
 bool ModbusConnectionHelper_GetFunctionCode(
     const char* startAddress,
@@ -10,8 +11,8 @@ bool ModbusConnectionHelper_GetFunctionCode(
     uint8_t* functionCode,
     uint16_t* modbusAddress)
 {
-    char entityChar = startAddress[0];
-    uint8_t entityType = (uint8_t)atoi(&entityChar);
+    // The first digit of the address is the entity type
+    uint8_t entityType = (uint8_t)(startAddress[0] - '0');
     switch (entityType)
     {
         case CoilStatus:
@@ -45,38 +46,90 @@ bool ModbusConnectionHelper_GetFunctionCode(
     return true;
 }
 
-bool ModbusConnectionHelper_ConvertValueStrToUInt16(
+bool ModbusConnectionHelper_ConvertValueStrToRegisters(
+    const MODBUS_VALUE_CODEC* codec,
     ModbusDataType dataType,
     FunctionCodeType functionCodeType,
-    char* valueStr,
-    uint16_t* value)
+    const char* valueStr,
+    uint16_t quantity,
+    uint16_t* values)
 {
+    MODBUS_VALUE_CODEC defaultCodec;
+
     switch (dataType)
     {
         case FLAG:
-            if (functionCodeType <= ReadInputs || functionCodeType == WriteCoil)
+        {
+            // On, or off
+            uint16_t value = (strcmp(valueStr, "true") == 0) ? 0xFF00 : 0x0000;
+            for (int i = 0; i < quantity; i++)
             {
-                if (strcmp(valueStr, "true") == 0)
-                {
-                    // On
-                    *value = 0xFF00;
-                }
-                else
-                {
-                    // Off
-                    *value = 0x0000;
-                }
+                values[i] = (functionCodeType <= ReadInputs || functionCodeType == WriteCoil) ? value : 0;
             }
             return true;
-        case NUMERIC:
-            *value = (uint16_t)atoi(valueStr);
-            return true;
+        }
         case STRING:
-        default:
+        case HEXSTRING:
+        case INVALID:
             break;
+        default:
+        {
+            if (NULL == codec || NULL == codec->Decode)
+            {
+                if (!ModbusValueCodec_Init(&defaultCodec, dataType, quantity, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN))
+                {
+                    return false;
+                }
+                codec = &defaultCodec;
+            }
+
+            // The registers after the ones the value is decoded from are cleared
+            for (int i = codec->Registers; i < quantity; i++)
+            {
+                values[i] = 0;
+            }
+            return ModbusValueCodec_Encode(codec, valueStr, values);
+        }
     }
 
     return false;
 }
 
+uint32_t ModbusConnectionHelper_EncodeWriteMultiplePayload(
+    MODBUS_WRITE_MULTIPLE_PAYLOAD* payload,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t quantity,
+    const uint16_t* values)
+{
+    payload->FunctionCode = functionCode;
+    payload->StartAddr_Hi = (modbusAddress >> 8) & 0xff;
+    payload->StartAddr_Lo = modbusAddress & 0xff;
+    payload->Quantity_Hi = (quantity >> 8) & 0xff;
+    payload->Quantity_Lo = quantity & 0xff;
+
+    if (WriteCoils == functionCode)
+    {
+        payload->ByteCount = (uint8_t)((quantity + 7) / 8);
+        memset(payload->Values, 0, payload->ByteCount);
+        for (int i = 0; i < quantity; i++)
+        {
+            if (0 != values[i])
+            {
+                payload->Values[i / 8] |= (uint8_t)(1 << (i % 8));
+            }
+        }
+    }
+    else
+    {
+        payload->ByteCount = (uint8_t)(quantity * 2);
+        for (int i = 0; i < quantity; i++)
+        {
+            payload->Values[i * 2] = (values[i] >> 8) & 0xff;
+            payload->Values[i * 2 + 1] = values[i] & 0xff;
+        }
+    }
 
+    // Function code, address, quantity and byte count come before the values
+    return 6 + payload->ByteCount;
+}
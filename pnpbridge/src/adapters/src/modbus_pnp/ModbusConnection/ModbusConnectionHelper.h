@@ -8,10 +8,17 @@ extern "C"
 #endif
 #include <iothub_device_client.h>
 #include "../ModbusEnum.h"
+#include "../ModbusValueCodec.h"
 
 #define MODBUS_EXCEPTION_CODE 0x80
 #define MODBUS_RESPONSE_MAX_LENGTH 32
 
+// Largest quantities a single Write Multiple Coils or Write Multiple Registers request may carry,
+// from the Modbus application protocol specification. Both fit in 246 bytes of values.
+#define MODBUS_MAX_WRITE_REGISTERS 123
+#define MODBUS_MAX_WRITE_COILS 1968
+#define MODBUS_MAX_WRITE_DATA_LENGTH 246
+
     // Modbus Operation
     typedef struct _MODBUS_TCP_MBAP_HEADER
     {
@@ -87,9 +94,51 @@ extern "C"
         MODBUS_RTU_WRITE_1_REG_REQUEST RtuRequest;
     } MODBUS_WRITE_1_REG_REQUEST;
 
+    // Write Multiple Values request
+
+    typedef struct _MODBUS_WRITE_MULTIPLE_PAYLOAD
+    {
+        uint8_t  FunctionCode;  // Function Code: WriteCoils or WriteHoldingRegisters
+        uint8_t  StartAddr_Hi;  // High uint8_t for starting address
+        uint8_t  StartAddr_Lo;  // Low uint8_t for starting address
+        uint8_t  Quantity_Hi;   // High uint8_t of Number of coils or registers to write
+        uint8_t  Quantity_Lo;   // Low uint8_t of Number of coils or registers to write
+        uint8_t  ByteCount;     // Number of bytes of Values in use
+        uint8_t  Values[MODBUS_MAX_WRITE_DATA_LENGTH]; // Registers high byte first, or coils 8 to a byte from the lowest bit
+    } MODBUS_WRITE_MULTIPLE_PAYLOAD;
+
+    typedef struct _MODBUS_TCP_WRITE_MULTIPLE_REQUEST
+    {
+        MODBUS_TCP_MBAP_HEADER MBAP;            // MBAP header for Modbus TCP/IP
+        MODBUS_WRITE_MULTIPLE_PAYLOAD Payload;  // Request payload
+    } MODBUS_TCP_WRITE_MULTIPLE_REQUEST;
+
+    typedef struct _MODBUS_RTU_WRITE_MULTIPLE_REQUEST
+    {
+        uint8_t UnitID;                         // Unit ID: slave address for the Modbus device.
+        MODBUS_WRITE_MULTIPLE_PAYLOAD Payload;  // Request payload
+        uint8_t CRC[2];                         // Room for the CRC, which follows the last byte of values in use
+    } MODBUS_RTU_WRITE_MULTIPLE_REQUEST;
+
+    typedef union _MODBUS_WRITE_MULTIPLE_REQUEST
+    {
+        uint8_t TcpArr[sizeof(MODBUS_TCP_WRITE_MULTIPLE_REQUEST)];
+        uint8_t RtuArr[sizeof(MODBUS_RTU_WRITE_MULTIPLE_REQUEST)];
+        MODBUS_TCP_WRITE_MULTIPLE_REQUEST TcpRequest;
+        MODBUS_RTU_WRITE_MULTIPLE_REQUEST RtuRequest;
+    } MODBUS_WRITE_MULTIPLE_REQUEST;
+
 #pragma region functions
     bool ModbusConnectionHelper_GetFunctionCode(const char* startAddress, bool isRead, uint8_t* functionCode, uint16_t* modbusAddress);
-    bool ModbusConnectionHelper_ConvertValueStrToUInt16(ModbusDataType dataType, FunctionCodeType functionCodeType, char* valueStr, uint16_t* value);
+
+    // Converts a value to write to the quantity coils or registers of a capability. A number is laid
+    // out by the codec of the capability, as it is read, or high word first without one, and a flag
+    // turns each coil on or off.
+    bool ModbusConnectionHelper_ConvertValueStrToRegisters(const MODBUS_VALUE_CODEC* codec, ModbusDataType dataType, FunctionCodeType functionCodeType, const char* valueStr, uint16_t quantity, uint16_t* values);
+
+    // Fills in the payload of a Write Multiple Coils or Write Multiple Registers request, and returns
+    // its length. A coil is turned on when its value is not 0.
+    uint32_t ModbusConnectionHelper_EncodeWriteMultiplePayload(MODBUS_WRITE_MULTIPLE_PAYLOAD* payload, uint8_t functionCode, uint16_t modbusAddress, uint16_t quantity, const uint16_t* values);
 #pragma endregion
 
 #ifdef __cplusplus
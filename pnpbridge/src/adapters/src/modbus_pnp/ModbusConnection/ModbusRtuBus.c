@@ -0,0 +1,221 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusRtuBus.h"
+#include "../ModbusPnp.h"
+
+typedef struct _MODBUS_RTU_BUS {
+    HANDLE Port;                        // INVALID_FILE while not open
+    MODBUS_RTU_BUS_OPEN Open;           // NULL when the bus does not reopen its port
+    void* OpenContext;
+    MODBUS_BACKOFF Backoff;
+    tickcounter_ms_t NextOpen;          // When the port may be opened again after a failed attempt
+    uint32_t BaudRate;
+    LOCK_HANDLE Lock;                   // Held for the whole of a transaction
+    TICK_COUNTER_HANDLE TickCounter;
+    tickcounter_ms_t SilenceMs;
+    tickcounter_ms_t LastFrameEnd;      // When the last response, or failed request, ended
+} MODBUS_RTU_BUS;
+
+uint32_t ModbusRtu_GetInterFrameSilenceUs(
+    uint32_t baudRate)
+{
+    if (0 == baudRate || baudRate > MODBUS_RTU_FIXED_SILENCE_BAUD_RATE)
+    {
+        return MODBUS_RTU_FIXED_SILENCE_US;
+    }
+
+    // 3.5 characters of 11 bits each
+    return (uint32_t)((35ull * 11 * 1000000 + 10ull * baudRate - 1) / (10ull * baudRate));
+}
+
+static MODBUS_RTU_BUS* ModbusRtuBus_Start(
+    HANDLE port,
+    MODBUS_RTU_BUS_OPEN open,
+    void* context,
+    uint32_t baudRate)
+{
+    MODBUS_RTU_BUS* bus = calloc(1, sizeof(MODBUS_RTU_BUS));
+    if (NULL == bus)
+    {
+        LogError("Could not allocate memory for Modbus RTU bus.");
+        return NULL;
+    }
+
+    bus->Port = port;
+    bus->Open = open;
+    bus->OpenContext = context;
+    ModbusBackoff_Init(&(bus->Backoff), MODBUS_RECONNECT_INITIAL_DELAY_MS, MODBUS_RECONNECT_MAX_DELAY_MS);
+    bus->BaudRate = baudRate;
+    bus->SilenceMs = (ModbusRtu_GetInterFrameSilenceUs(baudRate) + 999) / 1000;
+    bus->Lock = Lock_Init();
+    bus->TickCounter = tickcounter_create();
+    if (NULL == bus->Lock || NULL == bus->TickCounter)
+    {
+        LogError("Could not initialize Modbus RTU bus.");
+        if (NULL != bus->TickCounter)
+        {
+            tickcounter_destroy(bus->TickCounter);
+        }
+        if (NULL != bus->Lock)
+        {
+            Lock_Deinit(bus->Lock);
+        }
+        free(bus);
+        return NULL;
+    }
+
+    (void)tickcounter_get_current_ms(bus->TickCounter, &(bus->LastFrameEnd));
+    return bus;
+}
+
+MODBUS_RTU_BUS_HANDLE ModbusRtuBus_Create(
+    HANDLE port,
+    uint32_t baudRate)
+{
+    return ModbusRtuBus_Start(port, NULL, NULL, baudRate);
+}
+
+MODBUS_RTU_BUS_HANDLE ModbusRtuBus_CreateReopening(
+    MODBUS_RTU_BUS_OPEN open,
+    void* context,
+    uint32_t baudRate)
+{
+    return ModbusRtuBus_Start(INVALID_FILE, open, context, baudRate);
+}
+
+void ModbusRtuBus_Destroy(
+    MODBUS_RTU_BUS_HANDLE bus)
+{
+    if (NULL == bus)
+    {
+        return;
+    }
+
+    if (INVALID_FILE != bus->Port)
+    {
+        (void)ModbusRtu_CloseDevice(bus->Port, bus->Lock);
+    }
+    tickcounter_destroy(bus->TickCounter);
+    Lock_Deinit(bus->Lock);
+    free(bus);
+}
+
+uint32_t ModbusRtuBus_GetBaudRate(
+    MODBUS_RTU_BUS_HANDLE bus)
+{
+    return bus->BaudRate;
+}
+
+static void ModbusRtuBus_ClosePort(
+    HANDLE port)
+{
+#ifdef WIN32
+    CloseHandle(port);
+#else
+    close(port);
+#endif
+}
+
+// Opens the port of a bus that has none, unless an attempt failed too recently. Called with the
+// bus lock held.
+static bool ModbusRtuBus_Reopen(
+    MODBUS_RTU_BUS* bus,
+    tickcounter_ms_t now)
+{
+    if (NULL == bus->Open || now < bus->NextOpen)
+    {
+        return false;
+    }
+
+    bus->Port = bus->Open(bus->OpenContext);
+    if (INVALID_FILE == bus->Port)
+    {
+        uint32_t delayMs = ModbusBackoff_Next(&(bus->Backoff));
+        LogInfo("Opening serial port failed, trying again in %u ms.", delayMs);
+        bus->NextOpen = now + delayMs;
+        return false;
+    }
+
+    ModbusBackoff_Reset(&(bus->Backoff));
+    bus->LastFrameEnd = now;
+    return true;
+}
+
+int ModbusRtuBus_Transact(
+    MODBUS_RTU_BUS_HANDLE bus,
+    uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    return ModbusRtuBus_TransactWithin(bus, request, requestLength, response, responseSize, MODBUS_RTU_TURNAROUND_TIMEOUT_MS);
+}
+
+int ModbusRtuBus_TransactWithin(
+    MODBUS_RTU_BUS_HANDLE bus,
+    uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize,
+    uint32_t turnaroundMs)
+{
+    tickcounter_ms_t now = 0;
+    int responseLength = -1;
+
+    if (LOCK_OK != Lock(bus->Lock))
+    {
+        LogError("Device communicate lock is abandoned.");
+        return -1;
+    }
+
+    (void)tickcounter_get_current_ms(bus->TickCounter, &now);
+    if (INVALID_FILE == bus->Port && !ModbusRtuBus_Reopen(bus, now))
+    {
+        Unlock(bus->Lock);
+        return -1;
+    }
+
+    // The tick counter counts whole milliseconds, so a full one more than the silence has passed
+    // once it has advanced by SilenceMs + 1
+    if (now - bus->LastFrameEnd <= bus->SilenceMs)
+    {
+        ThreadAPI_Sleep((unsigned int)(bus->SilenceMs + 1 - (now - bus->LastFrameEnd)));
+    }
+
+    bool portFailed = false;
+    if ((int)requestLength != ModbusRtu_SendRequest(bus->Port, request, requestLength))
+    {
+        LogError("Failed to send request.");
+        portFailed = true;
+    }
+    else
+    {
+        // The request is only handed to the port, so the wait includes sending it, then the response
+        uint32_t timeoutMs = ModbusRtu_GetTurnaroundTimeoutMs(bus->BaudRate,
+            requestLength + ModbusRtu_GetExpectedResponseLength(request), turnaroundMs);
+        responseLength = ModbusRtu_ReadResponse(bus->Port, response, responseSize, timeoutMs);
+        portFailed = (MODBUS_RTU_PORT_ERROR == responseLength);
+    }
+
+    if (portFailed && NULL != bus->Open)
+    {
+        LogError("Serial port failed, it is opened again on the next request.");
+        ModbusRtuBus_ClosePort(bus->Port);
+        bus->Port = INVALID_FILE;
+    }
+    if (responseLength < 0)
+    {
+        responseLength = -1;
+    }
+
+    (void)tickcounter_get_current_ms(bus->TickCounter, &(bus->LastFrameEnd));
+    Unlock(bus->Lock);
+
+    return responseLength;
+}
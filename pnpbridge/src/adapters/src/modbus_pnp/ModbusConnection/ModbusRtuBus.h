@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusRtuConnection.h"
+#include "ModbusBackoff.h"
+
+// Above 19200 baud the inter-frame silence is fixed rather than 3.5 characters long
+#define MODBUS_RTU_FIXED_SILENCE_BAUD_RATE 19200
+#define MODBUS_RTU_FIXED_SILENCE_US 1750
+
+// A bus is one serial port, shared by every unit ID on the RS-485 segment behind it. Transactions
+// on the bus take turns, and each request waits for the line to have been silent for 3.5
+// characters so that slaves can tell the frames apart.
+typedef struct _MODBUS_RTU_BUS* MODBUS_RTU_BUS_HANDLE;
+
+// Silence the Modbus over serial line specification requires between two frames, with 11 bits
+// to a character
+uint32_t ModbusRtu_GetInterFrameSilenceUs(
+    uint32_t baudRate);
+
+// Opens the serial port of a bus, returning INVALID_FILE on failure
+typedef HANDLE (*MODBUS_RTU_BUS_OPEN)(
+    void* context);
+
+// Takes over an open serial port, which the bus closes when destroyed
+MODBUS_RTU_BUS_HANDLE ModbusRtuBus_Create(
+    HANDLE port,
+    uint32_t baudRate);
+
+// Creates a bus that opens its port with open on the first transaction, and again on the first
+// after the port fails. Failed attempts back off, and transactions fail right away until the next
+// attempt is due.
+MODBUS_RTU_BUS_HANDLE ModbusRtuBus_CreateReopening(
+    MODBUS_RTU_BUS_OPEN open,
+    void* context,
+    uint32_t baudRate);
+
+void ModbusRtuBus_Destroy(
+    MODBUS_RTU_BUS_HANDLE bus);
+
+uint32_t ModbusRtuBus_GetBaudRate(
+    MODBUS_RTU_BUS_HANDLE bus);
+
+// Sends a request once the bus is free and silent, and reads its response. Returns the length of
+// the response, or -1 on failure.
+int ModbusRtuBus_Transact(
+    MODBUS_RTU_BUS_HANDLE bus,
+    uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize);
+
+// Transacts like ModbusRtuBus_Transact with a slave that starts answering within turnaroundMs,
+// rather than MODBUS_RTU_TURNAROUND_TIMEOUT_MS
+int ModbusRtuBus_TransactWithin(
+    MODBUS_RTU_BUS_HANDLE bus,
+    uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize,
+    uint32_t turnaroundMs);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,9 +4,49 @@
 #include "azure_c_shared_utility/threadapi.h"
 #include "ModbusRtuConnection.h"
 #ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
 #include <unistd.h>
 #endif // WIN32
 
+// CRC of every byte value, for the reflected polynomial 0xA001 of Modbus
+static const uint16_t ModbusRtu_CrcTable[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
 uint16_t GetCRC(
     uint8_t *message,
     size_t length)
@@ -18,19 +58,9 @@ uint16_t GetCRC(
 
     uint16_t crcFull = 0xFFFF;
 
-    for (int i = 0; i < (int)length; ++i)
+    for (size_t i = 0; i < length; ++i)
     {
-        crcFull = (uint16_t)(crcFull ^ message[i]);
-
-        for (int j = 0; j < 8; ++j)
-        {
-            uint8_t  crcLsb = (uint8_t)(crcFull & 0x0001);
-            crcFull = (uint16_t)((crcFull >> 1) & 0x7FFF);
-            if (crcLsb == 1)
-            {
-                crcFull = (uint16_t)(crcFull ^ 0xA001);
-            }
-        }
+        crcFull = (uint16_t)((crcFull >> 8) ^ ModbusRtu_CrcTable[(crcFull ^ message[i]) & 0xFF]);
     }
     return crcFull;
 }
@@ -62,121 +92,190 @@ bool ModbusRtu_CloseDevice(
     return result;
 }
 
-IOTHUB_CLIENT_RESULT ModbusRtu_SetReadRequest(
-    CapabilityType capabilityType,
-    void* capability,
+void ModbusRtu_EncodeReadRequest(
+    MODBUS_READ_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t quantity,
     uint8_t unitId)
 {
-    uint16_t modbusAddress = 0;
-    switch (capabilityType)
-    {
-        case Telemetry:
-        {
-            ModbusTelemetry* telemetry = (ModbusTelemetry*)capability;
+    request->RtuRequest.UnitID = unitId;
+    request->RtuRequest.Payload.FunctionCode = functionCode;
+    request->RtuRequest.Payload.StartAddr_Hi = (modbusAddress >> 8) & 0xff;
+    request->RtuRequest.Payload.StartAddr_Lo = modbusAddress & 0xff;
+    request->RtuRequest.Payload.ReadLen_Hi = (quantity >> 8) & 0xff;
+    request->RtuRequest.Payload.ReadLen_Lo = quantity & 0xff;
+    request->RtuRequest.CRC = GetCRC(request->RtuArr, RTU_REQUEST_SIZE - 2);
+}
 
-            if (!ModbusConnectionHelper_GetFunctionCode(telemetry->StartAddress, true, &(telemetry->ReadRequest.RtuRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for telemetry \"%s\".", telemetry->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
+void ModbusRtu_EncodeWriteRequest(
+    MODBUS_WRITE_1_REG_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t value,
+    uint8_t unitId)
+{
+    request->RtuRequest.UnitID = unitId;
+    request->RtuRequest.Payload.FunctionCode = functionCode;
+    request->RtuRequest.Payload.RegAddr_Hi = (modbusAddress >> 8) & 0xff;
+    request->RtuRequest.Payload.RegAddr_Lo = modbusAddress & 0xff;
+    request->RtuRequest.Payload.Value_Hi = (value >> 8) & 0xff;
+    request->RtuRequest.Payload.Value_Lo = value & 0xff;
+    request->RtuRequest.CRC = GetCRC(request->RtuArr, RTU_REQUEST_SIZE - 2);
+}
 
-            telemetry->ReadRequest.RtuRequest.UnitID = unitId;
-            telemetry->ReadRequest.RtuRequest.Payload.StartAddr_Hi = (modbusAddress >> 8) & 0xff;
-            telemetry->ReadRequest.RtuRequest.Payload.StartAddr_Lo = modbusAddress & 0xff;
-            telemetry->ReadRequest.RtuRequest.Payload.ReadLen_Hi = (telemetry->Length >> 8) & 0xff;
-            telemetry->ReadRequest.RtuRequest.Payload.ReadLen_Lo = telemetry->Length & 0xff;
-            telemetry->ReadRequest.RtuRequest.CRC = GetCRC(telemetry->ReadRequest.RtuArr, RTU_REQUEST_SIZE - 2);
+uint32_t ModbusRtu_EncodeWriteMultipleRequest(
+    MODBUS_WRITE_MULTIPLE_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t quantity,
+    const uint16_t* values,
+    uint8_t unitId)
+{
+    request->RtuRequest.UnitID = unitId;
+    uint32_t length = RTU_HEADER_SIZE + ModbusConnectionHelper_EncodeWriteMultiplePayload(&(request->RtuRequest.Payload), functionCode, modbusAddress, quantity, values);
 
-            break;
-        }
-        case Property:
-        {
-            ModbusProperty* property = (ModbusProperty*)capability;
-            if (!ModbusConnectionHelper_GetFunctionCode(property->StartAddress, true, &(property->ReadRequest.RtuRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for property \"%s\".", property->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
+    // The CRC goes low byte first, right after the values
+    uint16_t crc = GetCRC(request->RtuArr, length);
+    request->RtuArr[length] = (uint8_t)(crc & 0xff);
+    request->RtuArr[length + 1] = (uint8_t)(crc >> 8);
 
-            property->ReadRequest.RtuRequest.UnitID = unitId;
-            property->ReadRequest.RtuRequest.Payload.StartAddr_Hi = (modbusAddress >> 8) & 0xff;
-            property->ReadRequest.RtuRequest.Payload.StartAddr_Lo = modbusAddress & 0xff;
-            property->ReadRequest.RtuRequest.Payload.ReadLen_Hi = (property->Length >> 8) & 0xff;
-            property->ReadRequest.RtuRequest.Payload.ReadLen_Lo = property->Length & 0xff;
-            property->ReadRequest.RtuRequest.CRC = GetCRC(property->ReadRequest.RtuArr, RTU_REQUEST_SIZE - 2);
-            break;
-        }
+    return length + 2;
+}
+
+uint32_t ModbusRtu_GetExpectedResponseLength(
+    const uint8_t* request)
+{
+    uint8_t functionCode = request[RTU_HEADER_SIZE];
+    uint16_t quantity = (uint16_t)((request[RTU_HEADER_SIZE + 3] << 8) | request[RTU_HEADER_SIZE + 4]);
+
+    switch (functionCode)
+    {
+        case ReadCoils:
+        case ReadInputs:
+            return RTU_HEADER_SIZE + 2 + (quantity + 7) / 8 + 2;
+        case ReadHoldingRegisters:
+        case ReadInputRegisters:
+            return RTU_HEADER_SIZE + 2 + quantity * 2 + 2;
         default:
-            LogError("Modbus read if not supported for the capability.");
-            return IOTHUB_CLIENT_ERROR;
+            // A single write is echoed back, and a multiple write answered with its address and
+            // quantity, which take as long
+            return RTU_REQUEST_SIZE;
     }
-
-    return IOTHUB_CLIENT_OK;
 }
 
-IOTHUB_CLIENT_RESULT ModbusRtu_SetWriteRequest(
-    CapabilityType capabilityType,
-    void* capability,
-    char* valueStr)
+uint32_t ModbusRtu_GetResponseTimeoutMs(
+    uint32_t baudRate,
+    uint32_t expectedLength)
 {
-    uint16_t binaryData = 0;
-    uint16_t modbusAddress = 0;
+    return ModbusRtu_GetTurnaroundTimeoutMs(baudRate, expectedLength, MODBUS_RTU_TURNAROUND_TIMEOUT_MS);
+}
 
-    switch (capabilityType)
+uint32_t ModbusRtu_GetTurnaroundTimeoutMs(
+    uint32_t baudRate,
+    uint32_t expectedLength,
+    uint32_t turnaroundMs)
+{
+    if (0 == baudRate)
     {
-        case Command:
-        {
-            ModbusCommand* command = (ModbusCommand*)capability;
+        baudRate = MODBUS_RTU_DEFAULT_BAUD_RATE;
+    }
 
+    // Time for the slave to start answering, then for the frame itself at 11 bits a character,
+    // and for the silence that ends it
+    return turnaroundMs + (expectedLength * 11 * 1000 + baudRate - 1) / baudRate + 4;
+}
 
-            if (!ModbusConnectionHelper_GetFunctionCode(command->StartAddress, false, &(command->WriteRequest.RtuRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for command \"%s\".", command->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
+// Length of the frame that starts with unit ID, function code and one more byte
+static uint32_t ModbusRtu_GetFrameLength(
+    const uint8_t* frame)
+{
+    uint8_t functionCode = frame[RTU_HEADER_SIZE];
 
-            if (!ModbusConnectionHelper_ConvertValueStrToUInt16(command->DataType, command->WriteRequest.RtuRequest.Payload.FunctionCode, valueStr, &binaryData))
-            {
-                LogError("Failed to convert data \"%s\" to byte array command \"%s\".", valueStr, command->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
+    if (functionCode & MODBUS_EXCEPTION_CODE)
+    {
+        return RTU_HEADER_SIZE + 2 + 2;
+    }
 
-            command->WriteRequest.RtuRequest.Payload.RegAddr_Hi = (modbusAddress >> 8) & 0xff;
-            command->WriteRequest.RtuRequest.Payload.RegAddr_Lo = modbusAddress & 0xff;
-            command->WriteRequest.RtuRequest.Payload.Value_Hi = (binaryData >> 8) & 0xff;
-            command->WriteRequest.RtuRequest.Payload.Value_Lo = binaryData & 0xff;
-            command->WriteRequest.RtuRequest.CRC = GetCRC(command->WriteRequest.RtuArr, RTU_REQUEST_SIZE - 2);
+    switch (functionCode)
+    {
+        case WriteCoil:
+        case WriteHoldingRegister:
+        case WriteCoils:
+        case WriteHoldingRegisters:
+            return RTU_REQUEST_SIZE;
+        default:
+            return RTU_HEADER_SIZE + 2 + frame[RTU_HEADER_SIZE + 1] + 2;
+    }
+}
 
-            break;
-        }
-        case Property:
+static uint64_t ModbusRtu_GetTimeMs(void)
+{
+#ifdef WIN32
+    return GetTickCount64();
+#else
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+#endif
+}
+
+// Reads what is available of up to length bytes before the deadline. Returns the number of bytes
+// read, 0 once the deadline passed, or -1 on failure.
+static int ModbusRtu_ReadAvailable(
+    HANDLE handler,
+    uint8_t* buffer,
+    uint32_t length,
+    uint64_t deadline)
+{
+    for (;;)
+    {
+        uint64_t now = ModbusRtu_GetTimeMs();
+        if (now >= deadline)
         {
-            ModbusProperty* property = (ModbusProperty*)capability;
-            if (!ModbusConnectionHelper_GetFunctionCode(property->StartAddress, false, &(property->WriteRequest.RtuRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for property \"%s\".", property->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
+            return 0;
+        }
 
-            if (!ModbusConnectionHelper_ConvertValueStrToUInt16(property->DataType, property->WriteRequest.RtuRequest.Payload.FunctionCode, valueStr, &binaryData))
+#ifdef WIN32
+        // The read returns early as set by the port's timeouts
+        DWORD received = 0;
+        if (!ReadFile(handler, buffer, length, &received, NULL))
+        {
+            return -1;
+        }
+        if (received > 0)
+        {
+            return (int)received;
+        }
+        Sleep(1);
+#else
+        struct pollfd port = { handler, POLLIN, 0 };
+        int ready = poll(&port, 1, (int)(deadline - now));
+        if (ready < 0)
+        {
+            if (EINTR == errno)
             {
-                LogError("Failed to convert data \"%s\" to byte array command \"%s\".", valueStr, property->Name);
-                return IOTHUB_CLIENT_ERROR;
+                continue;
             }
+            return -1;
+        }
+        if (0 == ready)
+        {
+            return 0;
+        }
 
-            property->WriteRequest.RtuRequest.Payload.RegAddr_Hi = (modbusAddress >> 8) & 0xff;
-            property->WriteRequest.RtuRequest.Payload.RegAddr_Lo = modbusAddress & 0xff;
-            property->WriteRequest.RtuRequest.Payload.Value_Hi = (binaryData >> 8) & 0xff;
-            property->WriteRequest.RtuRequest.Payload.Value_Lo = binaryData & 0xff;
-            property->WriteRequest.RtuRequest.CRC = GetCRC(property->WriteRequest.RtuArr, RTU_REQUEST_SIZE - 2);
-            break;
+        ssize_t received = read(handler, buffer, length);
+        if (received > 0)
+        {
+            return (int)received;
         }
-        default:
-            LogError("Modbus read if not supported for the capability.");
-            return IOTHUB_CLIENT_ERROR;
+        if (0 == received || (EAGAIN != errno && EINTR != errno))
+        {
+            // The port hung up
+            return -1;
+        }
+#endif
     }
-
-    return IOTHUB_CLIENT_OK;
 }
 
 int ModbusRtu_SendRequest(
@@ -200,6 +299,14 @@ int ModbusRtu_SendRequest(
 
     uint32_t totalBytesSent = 0;
 
+    // Drop what is left of an earlier response that came too late, so it is not taken for the
+    // response to this request
+#ifdef WIN32
+    PurgeComm(handler, PURGE_RXCLEAR);
+#else
+    (void)tcflush(handler, TCIFLUSH);
+#endif
+
 #ifdef WIN32
     DWORD bytesSent = 0;
     if (!WriteFile((HANDLE)handler,
@@ -227,7 +334,8 @@ int ModbusRtu_SendRequest(
 int ModbusRtu_ReadResponse(
     HANDLE handler,
     uint8_t *response,
-    uint32_t arrLen)
+    uint32_t arrLen,
+    uint32_t timeoutMs)
 {
 #ifdef WIN32
     if (NULL == handler || NULL == response)
@@ -243,86 +351,51 @@ int ModbusRtu_ReadResponse(
     }
 #endif
 
-    bool result = false;
-    uint32_t bytesReceived = 0;
+    uint64_t deadline = ModbusRtu_GetTimeMs() + timeoutMs;
     uint32_t totalBytesReceived = 0;
-    int retry = 0;
-    const int retryLimit = 3;
 
-    while (totalBytesReceived < RTU_HEADER_SIZE && retry < retryLimit)
-    {
-#ifdef WIN32
-        DWORD received = 0;
-        result = (FALSE != ReadFile(handler,
-            (response + totalBytesReceived),
-            (arrLen - totalBytesReceived - 1),
-            &received,
-            NULL));
-        bytesReceived = received;
-#else
-        bytesReceived = read(handler, response, (arrLen - totalBytesReceived - 1));
-        result = (bytesReceived > 0);
-#endif
+    // Read up to the byte that tells the length of the frame, then the rest of it, so that the
+    // read never runs into a following frame
+    uint32_t frameLength = RTU_HEADER_SIZE + 2;
+    bool lengthKnown = false;
 
-        if (bytesReceived > 0)
-        {
-            totalBytesReceived += bytesReceived;
-        }
-        else
-        {
-            retry++;
-            ThreadAPI_Sleep(2 * 1000);
-        }
-    }
-
-    if (response[1] != WriteCoil && response[1] != WriteHoldingRegister)
+    while (totalBytesReceived < frameLength)
     {
-        // Get data length from the PDU
-        uint16_t length = (uint16_t)(response[1] >= MODBUS_EXCEPTION_CODE ? 2 : response[2] + 2);
-        uint32_t expectedResponseLength = length + RTU_HEADER_SIZE + 2; //HEADER_SIZE + CRC_SIZE;
-
-        if (expectedResponseLength != arrLen)
-        {
-            //TODO
-            //Array.Resize<uint8_t>(ref response, expectedResponseLength);
-        }
-
-        while (totalBytesReceived < expectedResponseLength && retry < retryLimit)
+        int bytesReceived = ModbusRtu_ReadAvailable(handler, response + totalBytesReceived,
+            frameLength - totalBytesReceived, deadline);
+        if (bytesReceived <= 0)
         {
-#ifdef WIN32
-            DWORD received = 0;
-            result = (FALSE != ReadFile(handler,
-                (response + totalBytesReceived),
-                (arrLen - totalBytesReceived - 1),
-                &received,
-                NULL));
-            bytesReceived = received;
-#else
-            bytesReceived = read(handler, response, (arrLen - totalBytesReceived - 1));
-            result = (bytesReceived > 0);
-#endif
-
-            if (bytesReceived > 0)
+            if (0 == bytesReceived)
             {
-                totalBytesReceived += bytesReceived;
+                LogError("Timed out after %u ms with %u bytes of the response.", timeoutMs, totalBytesReceived);
             }
             else
             {
-                retry++;
-                ThreadAPI_Sleep(2 * 1000);
+                LogError("Failed to read response.");
+                return MODBUS_RTU_PORT_ERROR;
+            }
+            return -1;
+        }
+        totalBytesReceived += bytesReceived;
+
+        if (!lengthKnown && totalBytesReceived >= RTU_HEADER_SIZE + 2)
+        {
+            frameLength = ModbusRtu_GetFrameLength(response);
+            lengthKnown = true;
+            if (frameLength > arrLen)
+            {
+                LogError("Response of %u bytes does not fit in %u bytes.", frameLength, arrLen);
+                return -1;
             }
         }
     }
 
-    if (!result)
+    uint16_t crc = (uint16_t)(response[frameLength - 2] | (response[frameLength - 1] << 8));
+    if (crc != GetCRC(response, frameLength - 2))
     {
-#ifdef WIN32
-        LogError("Failed to read response: %x.", GetLastError());
-#else
-        LogError("Failed to read response.");
-#endif
+        LogError("Response failed its CRC check.");
         return -1;
     }
 
-    return totalBytesReceived;
-}
\ No newline at end of file
+    return (int)totalBytesReceived;
+}
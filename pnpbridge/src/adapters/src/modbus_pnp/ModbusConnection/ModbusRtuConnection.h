@@ -14,13 +14,38 @@ extern "C"
 #define RTU_REQUEST_SIZE 8
 #define RTU_HEADER_SIZE 1
 
+// Time a slave has to start answering a request
+#define MODBUS_RTU_TURNAROUND_TIMEOUT_MS 1000
+
+// Baud rate response timeouts are computed at when the port's is not known
+#define MODBUS_RTU_DEFAULT_BAUD_RATE 9600
+
+// Returned by ModbusRtu_ReadResponse when the port itself failed, as when a USB adapter is unplugged
+#define MODBUS_RTU_PORT_ERROR -2
+
+uint16_t GetCRC(uint8_t* message, size_t length);
 int ModbusRtu_GetHeaderSize(void);
 bool ModbusRtu_CloseDevice(HANDLE hDevice, LOCK_HANDLE lock);
 
-IOTHUB_CLIENT_RESULT ModbusRtu_SetReadRequest(CapabilityType capabilityType, void* capability, uint8_t unitId);
-IOTHUB_CLIENT_RESULT ModbusRtu_SetWriteRequest(CapabilityType capabilityType, void* capability, char* valueStr);
+void ModbusRtu_EncodeReadRequest(MODBUS_READ_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t quantity, uint8_t unitId);
+void ModbusRtu_EncodeWriteRequest(MODBUS_WRITE_1_REG_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t value, uint8_t unitId);
+
+// Returns the length of the request, with its CRC
+uint32_t ModbusRtu_EncodeWriteMultipleRequest(MODBUS_WRITE_MULTIPLE_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t quantity, const uint16_t* values, uint8_t unitId);
 int ModbusRtu_SendRequest(HANDLE handler, uint8_t *requestArr, uint32_t arrLen);
-int ModbusRtu_ReadResponse(HANDLE handler, uint8_t *response, uint32_t arrLen);
+
+// Length of a complete response to a request, when the slave does not answer with an exception
+uint32_t ModbusRtu_GetExpectedResponseLength(const uint8_t* request);
+
+// Time to wait for a response of expectedLength bytes at baudRate
+uint32_t ModbusRtu_GetResponseTimeoutMs(uint32_t baudRate, uint32_t expectedLength);
+
+// The same for a slave that starts answering within turnaroundMs
+uint32_t ModbusRtu_GetTurnaroundTimeoutMs(uint32_t baudRate, uint32_t expectedLength, uint32_t turnaroundMs);
+
+// Reads one response frame, which must arrive within timeoutMs and pass its CRC check. Returns its
+// length, -1 when no valid frame arrived, or MODBUS_RTU_PORT_ERROR.
+int ModbusRtu_ReadResponse(HANDLE handler, uint8_t *response, uint32_t arrLen, uint32_t timeoutMs);
 
 #ifdef __cplusplus
 }
@@ -48,137 +48,64 @@ bool ModbusTcp_CloseDevice(
     return true;
 }
 
-IOTHUB_CLIENT_RESULT ModbusTcp_SetReadRequest(
-    CapabilityType capabilityType,
-    void* capability,
+void ModbusTcp_EncodeReadRequest(
+    MODBUS_READ_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t quantity,
     uint8_t unitId)
 {
-    switch (capabilityType)
-    {
-        case Telemetry:
-        {
-            ModbusTelemetry* telemetry = (ModbusTelemetry*)capability;
-            uint16_t modbusAddress = 0;
-
-            if (!ModbusConnectionHelper_GetFunctionCode(telemetry->StartAddress, true, &(telemetry->ReadRequest.TcpRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for telemetry \"%s\".", telemetry->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
-
-            telemetry->ReadRequest.TcpRequest.MBAP.ProtocolID_Hi = 0x00;
-            telemetry->ReadRequest.TcpRequest.MBAP.ProtocolID_Lo = 0x00;
-            telemetry->ReadRequest.TcpRequest.MBAP.Length_Hi = 0x00;
-            telemetry->ReadRequest.TcpRequest.MBAP.Length_Lo = 0x06;
-            telemetry->ReadRequest.TcpRequest.MBAP.UnitID = unitId;
-
-            telemetry->ReadRequest.TcpRequest.Payload.StartAddr_Hi = (modbusAddress >> 8) & 0xff;
-            telemetry->ReadRequest.TcpRequest.Payload.StartAddr_Lo = modbusAddress & 0xff;
-            telemetry->ReadRequest.TcpRequest.Payload.ReadLen_Hi = (telemetry->Length >> 8) & 0xff;
-            telemetry->ReadRequest.TcpRequest.Payload.ReadLen_Lo = telemetry->Length & 0xff;
-            break;
-        }
-        case Property:
-        {
-            ModbusProperty* property = (ModbusProperty*)capability;
-            uint16_t modbusAddress = 0;
-            if (!ModbusConnectionHelper_GetFunctionCode(property->StartAddress, true, &(property->ReadRequest.TcpRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for property \"%s\".", property->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
-
-            property->ReadRequest.TcpRequest.MBAP.ProtocolID_Hi = 0x00;
-            property->ReadRequest.TcpRequest.MBAP.ProtocolID_Lo = 0x00;
-            property->ReadRequest.TcpRequest.MBAP.Length_Hi = 0x00;
-            property->ReadRequest.TcpRequest.MBAP.Length_Lo = 0x06;
-            property->ReadRequest.TcpRequest.MBAP.UnitID = unitId;
-
-            property->ReadRequest.TcpRequest.Payload.StartAddr_Hi = (modbusAddress >> 8) & 0xff;
-            property->ReadRequest.TcpRequest.Payload.StartAddr_Lo = modbusAddress & 0xff;
-            property->ReadRequest.TcpRequest.Payload.ReadLen_Hi = (property->Length >> 8) & 0xff;
-            property->ReadRequest.TcpRequest.Payload.ReadLen_Lo = property->Length & 0xff;
-            break;
-        }
-        default:
-            LogError("Modbus read if not supported for the capability.");
-            return IOTHUB_CLIENT_ERROR;
-    }
-
-    return IOTHUB_CLIENT_OK;
+    request->TcpRequest.MBAP.ProtocolID_Hi = 0x00;
+    request->TcpRequest.MBAP.ProtocolID_Lo = 0x00;
+    request->TcpRequest.MBAP.Length_Hi = 0x00;
+    request->TcpRequest.MBAP.Length_Lo = 0x06;
+    request->TcpRequest.MBAP.UnitID = unitId;
+
+    request->TcpRequest.Payload.FunctionCode = functionCode;
+    request->TcpRequest.Payload.StartAddr_Hi = (modbusAddress >> 8) & 0xff;
+    request->TcpRequest.Payload.StartAddr_Lo = modbusAddress & 0xff;
+    request->TcpRequest.Payload.ReadLen_Hi = (quantity >> 8) & 0xff;
+    request->TcpRequest.Payload.ReadLen_Lo = quantity & 0xff;
 }
 
-IOTHUB_CLIENT_RESULT ModbusTcp_SetWriteRequest(
-    CapabilityType capabilityType,
-    void* capability,
-    char* valueStr)
+void ModbusTcp_EncodeWriteRequest(
+    MODBUS_WRITE_1_REG_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t value,
+    uint8_t unitId)
 {
-    uint16_t binaryData = 0;
-
-    switch (capabilityType)
-    {
-        case Command:
-        {
-            ModbusCommand* command = (ModbusCommand*)capability;
-            uint16_t modbusAddress = 0;
-
-            if (!ModbusConnectionHelper_GetFunctionCode(command->StartAddress, false, &(command->WriteRequest.TcpRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for command \"%s\".", command->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
-
-            if (!ModbusConnectionHelper_ConvertValueStrToUInt16(command->DataType, command->WriteRequest.TcpRequest.Payload.FunctionCode, valueStr, &binaryData))
-            {
-                LogError("Failed to convert data \"%s\" to byte array command \"%s\".", valueStr, command->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
-
-            command->WriteRequest.TcpRequest.MBAP.ProtocolID_Hi = 0x00;
-            command->WriteRequest.TcpRequest.MBAP.ProtocolID_Lo = 0x00;
-            command->WriteRequest.TcpRequest.MBAP.Length_Hi = 0x00;
-            command->WriteRequest.TcpRequest.MBAP.Length_Lo = 0x06;
-
-            command->WriteRequest.TcpRequest.Payload.RegAddr_Hi = (modbusAddress >> 8) & 0xff;
-            command->WriteRequest.TcpRequest.Payload.RegAddr_Lo = modbusAddress & 0xff;
-            command->WriteRequest.TcpRequest.Payload.Value_Hi = (binaryData >> 8) & 0xff;
-            command->WriteRequest.TcpRequest.Payload.Value_Lo = binaryData & 0xff;
-
-            break;
-        }
-        case Property:
-        {
-            ModbusProperty* property = (ModbusProperty*)capability;
-            uint16_t modbusAddress = 0;
-            if (!ModbusConnectionHelper_GetFunctionCode(property->StartAddress, false, &(property->WriteRequest.TcpRequest.Payload.FunctionCode), &modbusAddress))
-            {
-                LogError("Failed to get Modbus function code for property \"%s\".", property->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
-
-            if (!ModbusConnectionHelper_ConvertValueStrToUInt16(property->DataType, property->WriteRequest.TcpRequest.Payload.FunctionCode, valueStr, &binaryData))
-            {
-                LogError("Failed to convert data \"%s\" to byte array command \"%s\".", valueStr, property->Name);
-                return IOTHUB_CLIENT_ERROR;
-            }
+    request->TcpRequest.MBAP.ProtocolID_Hi = 0x00;
+    request->TcpRequest.MBAP.ProtocolID_Lo = 0x00;
+    request->TcpRequest.MBAP.Length_Hi = 0x00;
+    request->TcpRequest.MBAP.Length_Lo = 0x06;
+    request->TcpRequest.MBAP.UnitID = unitId;
+
+    request->TcpRequest.Payload.FunctionCode = functionCode;
+    request->TcpRequest.Payload.RegAddr_Hi = (modbusAddress >> 8) & 0xff;
+    request->TcpRequest.Payload.RegAddr_Lo = modbusAddress & 0xff;
+    request->TcpRequest.Payload.Value_Hi = (value >> 8) & 0xff;
+    request->TcpRequest.Payload.Value_Lo = value & 0xff;
+}
 
-            property->WriteRequest.TcpRequest.MBAP.ProtocolID_Hi = 0x00;
-            property->WriteRequest.TcpRequest.MBAP.ProtocolID_Lo = 0x00;
-            property->WriteRequest.TcpRequest.MBAP.Length_Hi = 0x00;
-            property->WriteRequest.TcpRequest.MBAP.Length_Lo = 0x06;
+uint32_t ModbusTcp_EncodeWriteMultipleRequest(
+    MODBUS_WRITE_MULTIPLE_REQUEST* request,
+    uint8_t functionCode,
+    uint16_t modbusAddress,
+    uint16_t quantity,
+    const uint16_t* values,
+    uint8_t unitId)
+{
+    uint32_t payloadLength = ModbusConnectionHelper_EncodeWriteMultiplePayload(&(request->TcpRequest.Payload), functionCode, modbusAddress, quantity, values);
 
-            property->WriteRequest.TcpRequest.Payload.RegAddr_Hi = (modbusAddress >> 8) & 0xff;
-            property->WriteRequest.TcpRequest.Payload.RegAddr_Lo = modbusAddress & 0xff;
-            property->WriteRequest.TcpRequest.Payload.Value_Hi = (binaryData >> 8) & 0xff;
-            property->WriteRequest.TcpRequest.Payload.Value_Lo = binaryData & 0xff;
-            break;
-        }
-        default:
-            LogError("Modbus read if not supported for the capability.");
-            return IOTHUB_CLIENT_ERROR;
-        }
+    // The length field counts the unit ID and the PDU
+    request->TcpRequest.MBAP.ProtocolID_Hi = 0x00;
+    request->TcpRequest.MBAP.ProtocolID_Lo = 0x00;
+    request->TcpRequest.MBAP.Length_Hi = ((payloadLength + 1) >> 8) & 0xff;
+    request->TcpRequest.MBAP.Length_Lo = (payloadLength + 1) & 0xff;
+    request->TcpRequest.MBAP.UnitID = unitId;
 
-    return IOTHUB_CLIENT_OK;
+    return TCP_HEADER_SIZE + payloadLength;
 }
 
 int ModbusTcp_SendRequest(
@@ -212,7 +139,12 @@ int ModbusTcp_SendRequest(
         return -1;
     }
 #endif
+#ifdef MSG_NOSIGNAL
+    // A device that went away fails the send, rather than raising SIGPIPE in the bridge
+    int totalBytesSent = send(socket, (const char*)requestArr, arrLen, MSG_NOSIGNAL);
+#else
     int totalBytesSent = send(socket, (const char*)requestArr, arrLen, 0);
+#endif
 
     if (SOCKET_ERROR == totalBytesSent) {
         // Error setting serial port state
@@ -258,21 +190,43 @@ int ModbusTcp_ReadResponse(
         return -1;
     }
 #endif
-    bytesReceived = recv(socket, (char*)(response + totalBytesReceived), arrLen - totalBytesReceived, 0);
-
-    if (bytesReceived > 0)
-    {
-        totalBytesReceived += bytesReceived;
-    }
-    else if (SOCKET_ERROR == bytesReceived)
+    // A response may arrive in several segments: keep reading until the MBAP header and as many
+    // bytes as its length field announces are in
+    uint32_t expectedLength = TCP_HEADER_SIZE;
+    do
     {
+        bytesReceived = recv(socket, (char*)(response + totalBytesReceived), arrLen - totalBytesReceived, 0);
+
+        if (bytesReceived > 0)
+        {
+            totalBytesReceived += bytesReceived;
+        }
+        else if (SOCKET_ERROR == bytesReceived)
+        {
 #ifdef WIN32
-        LogError("Failed to read from socket with error: %ld.", WSAGetLastError());
+            LogError("Failed to read from socket with error: %ld.", WSAGetLastError());
 #else
-        LogError("Failed to read from socket.");
+            LogError("Failed to read from socket.");
 #endif
-        return -1;
-    }
+            return -1;
+        }
+        else
+        {
+            // Connection closed by the device
+            break;
+        }
+
+        if (totalBytesReceived >= TCP_HEADER_SIZE - 1)
+        {
+            // The length field counts the unit ID and the PDU
+            expectedLength = (TCP_HEADER_SIZE - 1) + ((response[4] << 8) | response[5]);
+            if (expectedLength > arrLen)
+            {
+                LogError("Response of %u bytes does not fit in a buffer of %u bytes.", expectedLength, arrLen);
+                return -1;
+            }
+        }
+    } while ((uint32_t)totalBytesReceived < expectedLength);
 
     return totalBytesReceived;
 }
\ No newline at end of file
@@ -28,8 +28,11 @@ typedef int SOCKET;
 int ModbusTcp_GetHeaderSize(void);
 bool ModbusTcp_CloseDevice(SOCKET hDevice, LOCK_HANDLE lock);
 
-IOTHUB_CLIENT_RESULT ModbusTcp_SetReadRequest(CapabilityType capabilityType, void* capability, uint8_t unitId);
-IOTHUB_CLIENT_RESULT ModbusTcp_SetWriteRequest(CapabilityType capabilityType, void* capability, char* valueStr);
+void ModbusTcp_EncodeReadRequest(MODBUS_READ_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t quantity, uint8_t unitId);
+void ModbusTcp_EncodeWriteRequest(MODBUS_WRITE_1_REG_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t value, uint8_t unitId);
+
+// Returns the length of the request
+uint32_t ModbusTcp_EncodeWriteMultipleRequest(MODBUS_WRITE_MULTIPLE_REQUEST* request, uint8_t functionCode, uint16_t modbusAddress, uint16_t quantity, const uint16_t* values, uint8_t unitId);
 int ModbusTcp_SendRequest(SOCKET handler, uint8_t *requestArr, uint32_t arrLen);
 int ModbusTcp_ReadResponse(SOCKET handler, uint8_t *response, uint32_t arrLen);
 
@@ -0,0 +1,518 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusTCPLink.h"
+#include "../ModbusReadPlanner.h"
+
+typedef struct _MODBUS_TCP_TRANSACTION {
+    bool InUse;
+    bool Done;
+    uint16_t TransactionId;
+    uint8_t UnitId;
+    uint8_t* Response;
+    uint32_t ResponseSize;
+    int ResponseLength;             // -1 when the transaction failed
+    COND_HANDLE Completed;          // Signalled when Done is set; only the transaction's waiter waits on it
+} MODBUS_TCP_TRANSACTION;
+
+typedef struct _MODBUS_TCP_LINK {
+    SOCKET Socket;                  // INVALID_SOCKET while not connected. Changed with both locks held.
+    LOCK_HANDLE Lock;               // Guards the transactions and the state of the link
+    LOCK_HANDLE SendLock;           // Keeps the bytes of one request together on the socket
+    COND_HANDLE Changed;            // Signalled when a transaction ends, the link fails or is stopped
+    THREAD_HANDLE Receiver;         // Receives responses, and connects again when the socket fails
+    TICK_COUNTER_HANDLE TickCounter;
+    MODBUS_TCP_LINK_CONNECT Connect;    // NULL when the link does not reconnect
+    void* ConnectContext;
+    MODBUS_BACKOFF Backoff;
+    bool Broken;                    // Requests fail while set
+    bool Stopping;
+    int Window;
+    int InFlight;
+    uint16_t NextTransactionId;
+    MODBUS_TCP_TRANSACTION Transactions[MODBUS_TCP_MAX_TRANSACTION_WINDOW];
+} MODBUS_TCP_LINK;
+
+static bool ModbusTcpLink_ReceiveExactly(
+    SOCKET socket,
+    uint8_t* buffer,
+    uint32_t length)
+{
+    uint32_t received = 0;
+    while (received < length)
+    {
+        int bytesReceived = recv(socket, (char*)(buffer + received), length - received, 0);
+        if (bytesReceived <= 0)
+        {
+            return false;
+        }
+        received += bytesReceived;
+    }
+    return true;
+}
+
+// Fails every transaction in flight, and any submitted after, once the socket is gone
+static void ModbusTcpLink_Fail(
+    MODBUS_TCP_LINK* link)
+{
+    Lock(link->Lock);
+    link->Broken = true;
+    for (int i = 0; i < MODBUS_TCP_MAX_TRANSACTION_WINDOW; i++)
+    {
+        MODBUS_TCP_TRANSACTION* transaction = &(link->Transactions[i]);
+        if (transaction->InUse && !transaction->Done)
+        {
+            transaction->ResponseLength = -1;
+            transaction->Done = true;
+            (void)Condition_Post(transaction->Completed);
+        }
+    }
+    (void)Condition_Post(link->Changed);
+    Unlock(link->Lock);
+}
+
+// Reads responses off the socket and hands each to the transaction with its transaction ID, until
+// the socket fails or is shut down
+static void ModbusTcpLink_ReceiveResponses(
+    MODBUS_TCP_LINK* link)
+{
+    uint8_t frame[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+
+    while (ModbusTcpLink_ReceiveExactly(link->Socket, frame, TCP_HEADER_SIZE))
+    {
+        // The length field counts the unit ID and the PDU
+        uint32_t length = (TCP_HEADER_SIZE - 1) + ((frame[4] << 8) | frame[5]);
+        if (length <= TCP_HEADER_SIZE || length > sizeof(frame))
+        {
+            LogError("Modbus TCP response of %u bytes is malformed, dropping the connection.", length);
+            break;
+        }
+        if (!ModbusTcpLink_ReceiveExactly(link->Socket, frame + TCP_HEADER_SIZE, length - TCP_HEADER_SIZE))
+        {
+            break;
+        }
+
+        uint16_t transactionId = (uint16_t)((frame[0] << 8) | frame[1]);
+        MODBUS_TCP_TRANSACTION* transaction = NULL;
+
+        Lock(link->Lock);
+        for (int i = 0; i < MODBUS_TCP_MAX_TRANSACTION_WINDOW; i++)
+        {
+            if (link->Transactions[i].InUse && !link->Transactions[i].Done &&
+                link->Transactions[i].TransactionId == transactionId)
+            {
+                transaction = &(link->Transactions[i]);
+                break;
+            }
+        }
+
+        if (NULL == transaction)
+        {
+            // The request timed out, and its transaction is over
+            LogError("Dropping Modbus TCP response to transaction %d, which is no longer waited for.", transactionId);
+        }
+        else if (frame[6] != transaction->UnitId || length > transaction->ResponseSize)
+        {
+            LogError("Modbus TCP response to transaction %d does not match its request.", transactionId);
+            transaction->ResponseLength = -1;
+            transaction->Done = true;
+            (void)Condition_Post(transaction->Completed);
+        }
+        else
+        {
+            memcpy(transaction->Response, frame, length);
+            transaction->ResponseLength = (int)length;
+            transaction->Done = true;
+            (void)Condition_Post(transaction->Completed);
+        }
+        Unlock(link->Lock);
+    }
+}
+
+static void ModbusTcpLink_CloseSocket(
+    SOCKET socket)
+{
+#ifdef WIN32
+    closesocket(socket);
+    WSACleanup();
+#else
+    close(socket);
+#endif
+}
+
+// Connects until an attempt succeeds, waiting longer after each that fails. Returns false when
+// the link is stopped first.
+static bool ModbusTcpLink_Reconnect(
+    MODBUS_TCP_LINK* link)
+{
+    for (;;)
+    {
+        SOCKET socket = link->Connect(link->ConnectContext);
+
+        Lock(link->SendLock);
+        Lock(link->Lock);
+        bool stopping = link->Stopping;
+        if (!stopping && INVALID_SOCKET != socket)
+        {
+            link->Socket = socket;
+            link->Broken = false;
+        }
+        Unlock(link->Lock);
+        Unlock(link->SendLock);
+
+        if (INVALID_SOCKET != socket)
+        {
+            if (stopping)
+            {
+                ModbusTcpLink_CloseSocket(socket);
+                return false;
+            }
+            ModbusBackoff_Reset(&(link->Backoff));
+            return true;
+        }
+
+        uint32_t delayMs = ModbusBackoff_Next(&(link->Backoff));
+        LogInfo("Modbus TCP connection failed, trying again in %u ms.", delayMs);
+
+        tickcounter_ms_t start = 0;
+        tickcounter_ms_t now = 0;
+        (void)tickcounter_get_current_ms(link->TickCounter, &start);
+        now = start;
+
+        Lock(link->Lock);
+        while (!link->Stopping && now - start < delayMs)
+        {
+            (void)Condition_Wait(link->Changed, link->Lock, (int)(delayMs - (now - start)));
+            (void)tickcounter_get_current_ms(link->TickCounter, &now);
+        }
+        stopping = link->Stopping;
+        Unlock(link->Lock);
+
+        if (stopping)
+        {
+            return false;
+        }
+    }
+}
+
+static int ModbusTcpLink_Receive(
+    void* param)
+{
+    MODBUS_TCP_LINK* link = (MODBUS_TCP_LINK*)param;
+
+    for (;;)
+    {
+        if (INVALID_SOCKET == link->Socket && !ModbusTcpLink_Reconnect(link))
+        {
+            break;
+        }
+
+        ModbusTcpLink_ReceiveResponses(link);
+        ModbusTcpLink_Fail(link);
+
+        Lock(link->SendLock);
+        Lock(link->Lock);
+        SOCKET socket = link->Socket;
+        link->Socket = INVALID_SOCKET;
+        bool stopping = link->Stopping;
+        Unlock(link->Lock);
+        Unlock(link->SendLock);
+
+        ModbusTcpLink_CloseSocket(socket);
+        if (stopping || NULL == link->Connect)
+        {
+            break;
+        }
+        LogError("Modbus TCP connection dropped, reconnecting.");
+    }
+
+    ThreadAPI_Exit(THREADAPI_OK);
+    return 0;
+}
+
+static void ModbusTcpLink_EndTransaction(
+    MODBUS_TCP_LINK* link,
+    MODBUS_TCP_TRANSACTION* transaction)
+{
+    transaction->InUse = false;
+    transaction->Response = NULL;
+    link->InFlight--;
+    (void)Condition_Post(link->Changed);
+}
+
+static MODBUS_TCP_LINK* ModbusTcpLink_Start(
+    SOCKET socket,
+    MODBUS_TCP_LINK_CONNECT connect,
+    void* context,
+    int window)
+{
+    MODBUS_TCP_LINK* link = calloc(1, sizeof(MODBUS_TCP_LINK));
+    if (NULL == link)
+    {
+        LogError("Could not allocate memory for Modbus TCP link.");
+        return NULL;
+    }
+
+    if (window < 1)
+    {
+        window = 1;
+    }
+    else if (window > MODBUS_TCP_MAX_TRANSACTION_WINDOW)
+    {
+        LogInfo("Modbus TCP transaction window %d is above the maximum of %d.", window, MODBUS_TCP_MAX_TRANSACTION_WINDOW);
+        window = MODBUS_TCP_MAX_TRANSACTION_WINDOW;
+    }
+
+    link->Socket = socket;
+    link->Broken = (INVALID_SOCKET == socket);
+    link->Connect = connect;
+    link->ConnectContext = context;
+    ModbusBackoff_Init(&(link->Backoff), MODBUS_RECONNECT_INITIAL_DELAY_MS, MODBUS_RECONNECT_MAX_DELAY_MS);
+    link->Window = window;
+    link->Lock = Lock_Init();
+    link->SendLock = Lock_Init();
+    link->Changed = Condition_Init();
+    link->TickCounter = tickcounter_create();
+    if (NULL == link->Lock || NULL == link->SendLock || NULL == link->Changed || NULL == link->TickCounter)
+    {
+        LogError("Could not initialize Modbus TCP link.");
+        goto fail;
+    }
+
+    for (int i = 0; i < MODBUS_TCP_MAX_TRANSACTION_WINDOW; i++)
+    {
+        link->Transactions[i].Completed = Condition_Init();
+        if (NULL == link->Transactions[i].Completed)
+        {
+            LogError("Could not initialize Modbus TCP link.");
+            goto fail;
+        }
+    }
+
+    if (THREADAPI_OK != ThreadAPI_Create(&(link->Receiver), ModbusTcpLink_Receive, link))
+    {
+        LogError("Failed to create Modbus TCP receiver thread.");
+        goto fail;
+    }
+
+    return link;
+
+fail:
+    for (int i = 0; i < MODBUS_TCP_MAX_TRANSACTION_WINDOW; i++)
+    {
+        if (NULL != link->Transactions[i].Completed)
+        {
+            Condition_Deinit(link->Transactions[i].Completed);
+        }
+    }
+    if (NULL != link->TickCounter)
+    {
+        tickcounter_destroy(link->TickCounter);
+    }
+    if (NULL != link->Changed)
+    {
+        Condition_Deinit(link->Changed);
+    }
+    if (NULL != link->SendLock)
+    {
+        Lock_Deinit(link->SendLock);
+    }
+    if (NULL != link->Lock)
+    {
+        Lock_Deinit(link->Lock);
+    }
+    free(link);
+    return NULL;
+}
+
+MODBUS_TCP_LINK_HANDLE ModbusTcpLink_Create(
+    SOCKET socket,
+    int window)
+{
+    return ModbusTcpLink_Start(socket, NULL, NULL, window);
+}
+
+MODBUS_TCP_LINK_HANDLE ModbusTcpLink_CreateReconnecting(
+    MODBUS_TCP_LINK_CONNECT connect,
+    void* context,
+    int window)
+{
+    return ModbusTcpLink_Start(INVALID_SOCKET, connect, context, window);
+}
+
+void ModbusTcpLink_Destroy(
+    MODBUS_TCP_LINK_HANDLE link)
+{
+    if (NULL == link)
+    {
+        return;
+    }
+
+    Lock(link->Lock);
+    link->Stopping = true;
+    (void)Condition_Post(link->Changed);
+    Unlock(link->Lock);
+
+    // Shutting the socket down ends the receiver's read, after which it closes the socket
+    Lock(link->SendLock);
+    if (INVALID_SOCKET != link->Socket)
+    {
+#ifdef WIN32
+        shutdown(link->Socket, SD_BOTH);
+#else
+        shutdown(link->Socket, SHUT_RDWR);
+#endif
+    }
+    Unlock(link->SendLock);
+
+    int res = 0;
+    if (THREADAPI_OK != ThreadAPI_Join(link->Receiver, &res))
+    {
+        LogError("Failed to stop Modbus TCP receiver thread.");
+    }
+
+    for (int i = 0; i < MODBUS_TCP_MAX_TRANSACTION_WINDOW; i++)
+    {
+        Condition_Deinit(link->Transactions[i].Completed);
+    }
+    tickcounter_destroy(link->TickCounter);
+    Condition_Deinit(link->Changed);
+    Lock_Deinit(link->SendLock);
+    Lock_Deinit(link->Lock);
+    free(link);
+
+    LogInfo("Socket Closed.");
+}
+
+int ModbusTcpLink_GetWindow(
+    MODBUS_TCP_LINK_HANDLE link)
+{
+    return link->Window;
+}
+
+int ModbusTcpLink_Submit(
+    MODBUS_TCP_LINK_HANDLE link,
+    const uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    uint8_t frame[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    int index = -1;
+
+    if (NULL == request || requestLength <= TCP_HEADER_SIZE || requestLength > sizeof(frame))
+    {
+        LogError("Failed to send request: the request is not a Modbus TCP frame.");
+        return -1;
+    }
+
+    Lock(link->Lock);
+    while (!link->Broken && link->InFlight >= link->Window)
+    {
+        (void)Condition_Wait(link->Changed, link->Lock, 0);
+    }
+
+    if (link->Broken)
+    {
+        // Pass the wake-up on to anyone else waiting for room in the window
+        (void)Condition_Post(link->Changed);
+        Unlock(link->Lock);
+        LogError("Failed to send request: the connection is closed.");
+        return -1;
+    }
+
+    for (int i = 0; i < MODBUS_TCP_MAX_TRANSACTION_WINDOW; i++)
+    {
+        if (!link->Transactions[i].InUse)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    MODBUS_TCP_TRANSACTION* transaction = &(link->Transactions[index]);
+    transaction->InUse = true;
+    transaction->Done = false;
+    transaction->TransactionId = link->NextTransactionId++;
+    transaction->UnitId = request[6];
+    transaction->Response = response;
+    transaction->ResponseSize = responseSize;
+    transaction->ResponseLength = -1;
+    link->InFlight++;
+    Unlock(link->Lock);
+
+    // The request itself may be shared, so the transaction ID goes into a copy of it
+    memcpy(frame, request, requestLength);
+    frame[0] = (uint8_t)(transaction->TransactionId >> 8);
+    frame[1] = (uint8_t)(transaction->TransactionId & 0xff);
+
+    Lock(link->SendLock);
+    int bytesSent = ModbusTcp_SendRequest(link->Socket, frame, requestLength);
+    Unlock(link->SendLock);
+
+    if (bytesSent != (int)requestLength)
+    {
+        Lock(link->Lock);
+        ModbusTcpLink_EndTransaction(link, transaction);
+        Unlock(link->Lock);
+        return -1;
+    }
+
+    return index;
+}
+
+int ModbusTcpLink_Wait(
+    MODBUS_TCP_LINK_HANDLE link,
+    int transactionIndex,
+    int timeoutMs)
+{
+    MODBUS_TCP_TRANSACTION* transaction = &(link->Transactions[transactionIndex]);
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t now = 0;
+    int responseLength = -1;
+
+    (void)tickcounter_get_current_ms(link->TickCounter, &start);
+
+    Lock(link->Lock);
+    while (!transaction->Done)
+    {
+        (void)tickcounter_get_current_ms(link->TickCounter, &now);
+        if (now - start >= (tickcounter_ms_t)timeoutMs)
+        {
+            LogError("Timed out waiting for the response to Modbus TCP transaction %d.", transaction->TransactionId);
+            break;
+        }
+        (void)Condition_Wait(transaction->Completed, link->Lock, (int)(timeoutMs - (now - start)));
+    }
+
+    if (transaction->Done)
+    {
+        responseLength = transaction->ResponseLength;
+    }
+
+    // A response that arrives after this is dropped by the receiver
+    ModbusTcpLink_EndTransaction(link, transaction);
+    Unlock(link->Lock);
+
+    return responseLength;
+}
+
+int ModbusTcpLink_Transact(
+    MODBUS_TCP_LINK_HANDLE link,
+    const uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    int transaction = ModbusTcpLink_Submit(link, request, requestLength, response, responseSize);
+    if (transaction < 0)
+    {
+        return -1;
+    }
+
+    return ModbusTcpLink_Wait(link, transaction, MODBUS_TCP_RESPONSE_TIMEOUT_MS);
+}
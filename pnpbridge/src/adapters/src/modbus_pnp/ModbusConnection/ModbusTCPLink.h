@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusTCPConnection.h"
+#include "ModbusBackoff.h"
+
+// Requests a link keeps in flight unless configured otherwise. Many devices handle one request at
+// a time, so pipelining is only turned on for gateways that are known to accept it.
+#define MODBUS_TCP_DEFAULT_TRANSACTION_WINDOW 1
+#define MODBUS_TCP_MAX_TRANSACTION_WINDOW 16
+
+// Time to wait for the response to a request
+#define MODBUS_TCP_RESPONSE_TIMEOUT_MS 5000
+
+// Time a connection attempt may take before it is given up
+#define MODBUS_TCP_CONNECT_TIMEOUT_MS 3000
+
+// A link is one socket to a Modbus TCP device or gateway, shared by every unit ID behind it. Each
+// request gets an MBAP transaction ID of its own, so that up to a window of them can be in flight
+// at once. A receiver thread hands each response to the request with its transaction ID, in
+// whatever order the responses arrive.
+typedef struct _MODBUS_TCP_LINK* MODBUS_TCP_LINK_HANDLE;
+
+// Opens a new connection for a link, returning INVALID_SOCKET on failure
+typedef SOCKET (*MODBUS_TCP_LINK_CONNECT)(
+    void* context);
+
+// Takes over a connected socket, which the link closes when destroyed. The link fails for good
+// once the socket does.
+MODBUS_TCP_LINK_HANDLE ModbusTcpLink_Create(
+    SOCKET socket,
+    int window);
+
+// Creates a link that connects with connect, and connects again whenever the connection drops,
+// backing off between failed attempts. Requests fail right away while the link is not connected.
+MODBUS_TCP_LINK_HANDLE ModbusTcpLink_CreateReconnecting(
+    MODBUS_TCP_LINK_CONNECT connect,
+    void* context,
+    int window);
+
+// Every transaction must have completed. A connection attempt in progress is waited for.
+void ModbusTcpLink_Destroy(
+    MODBUS_TCP_LINK_HANDLE link);
+
+int ModbusTcpLink_GetWindow(
+    MODBUS_TCP_LINK_HANDLE link);
+
+// Sends a request once fewer than a window of them are in flight. The response is written to
+// response when it arrives. Returns the transaction to wait for, or -1 on failure.
+int ModbusTcpLink_Submit(
+    MODBUS_TCP_LINK_HANDLE link,
+    const uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize);
+
+// Waits for the response to a submitted transaction. Returns its length, or -1 when it did not
+// arrive within timeoutMs or the link failed. The transaction is over either way.
+int ModbusTcpLink_Wait(
+    MODBUS_TCP_LINK_HANDLE link,
+    int transaction,
+    int timeoutMs);
+
+// Submits a request and waits for its response
+int ModbusTcpLink_Transact(
+    MODBUS_TCP_LINK_HANDLE link,
+    const uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+
+#include "ModbusConnectionManager.h"
+
+void ModbusPnp_GetConnectionName(
+    const ModbusDeviceConfig* deviceConfig,
+    char* name,
+    size_t nameSize)
+{
+    if (TCP == deviceConfig->ConnectionType)
+    {
+        (void)snprintf(name, nameSize, "%s:%d", deviceConfig->ConnectionConfig.TcpConfig.Host,
+            deviceConfig->ConnectionConfig.TcpConfig.Port);
+    }
+    else
+    {
+        (void)snprintf(name, nameSize, "%s", deviceConfig->ConnectionConfig.RtuConfig.Port);
+    }
+}
+
+MODBUS_CONNECTION_MANAGER* ModbusConnectionManager_Create(void)
+{
+    MODBUS_CONNECTION_MANAGER* manager = calloc(1, sizeof(MODBUS_CONNECTION_MANAGER));
+    if (NULL == manager)
+    {
+        LogError("Could not allocate memory for Modbus connection manager.");
+        return NULL;
+    }
+
+    manager->Lock = Lock_Init();
+    manager->Connections = singlylinkedlist_create();
+    if (NULL == manager->Lock || NULL == manager->Connections)
+    {
+        LogError("Could not initialize Modbus connection manager.");
+        ModbusConnectionManager_Destroy(manager);
+        return NULL;
+    }
+
+    return manager;
+}
+
+void ModbusConnectionManager_Destroy(
+    MODBUS_CONNECTION_MANAGER* manager)
+{
+    if (NULL == manager)
+    {
+        return;
+    }
+
+    if (NULL != manager->Connections)
+    {
+        if (NULL != singlylinkedlist_get_head_item(manager->Connections))
+        {
+            LogError("Modbus connection manager destroyed with connections in use.");
+        }
+        singlylinkedlist_destroy(manager->Connections);
+    }
+
+    if (NULL != manager->Lock)
+    {
+        Lock_Deinit(manager->Lock);
+    }
+
+    free(manager);
+}
+
+static void ModbusConnectionManager_Close(
+    MODBUS_CONNECTION* connection)
+{
+    // Writes still waiting go out before the connection closes
+    if (NULL != connection->WriteQueue)
+    {
+        ModbusWriteQueue_Destroy(connection->WriteQueue);
+    }
+
+    if (NULL != connection->Scheduler)
+    {
+        ModbusScheduler_Destroy(connection->Scheduler);
+    }
+
+    if (NULL != connection->TcpLink)
+    {
+        ModbusTcpLink_Destroy(connection->TcpLink);
+    }
+
+    if (NULL != connection->RtuBus)
+    {
+        ModbusRtuBus_Destroy(connection->RtuBus);
+    }
+
+    free(connection->Address);
+    free(connection->Name);
+    free(connection);
+}
+
+static SOCKET ModbusConnectionManager_ConnectSocket(
+    void* context)
+{
+    MODBUS_CONNECTION* connection = (MODBUS_CONNECTION*)context;
+    SOCKET socket = INVALID_SOCKET;
+
+    if (IOTHUB_CLIENT_OK != ModbusPnp_OpenSocket(&(connection->Config.TcpConfig), &socket))
+    {
+        return INVALID_SOCKET;
+    }
+    return socket;
+}
+
+static HANDLE ModbusConnectionManager_OpenSerial(
+    void* context)
+{
+    MODBUS_CONNECTION* connection = (MODBUS_CONNECTION*)context;
+    HANDLE port = INVALID_FILE;
+
+    if (IOTHUB_CLIENT_OK != ModbusPnp_OpenSerial(&(connection->Config.RtuConfig), &port))
+    {
+        return INVALID_FILE;
+    }
+    return port;
+}
+
+static MODBUS_CONNECTION* ModbusConnectionManager_Open(
+    ModbusDeviceConfig* deviceConfig,
+    const char* name)
+{
+    int pipelineDepth = 1;
+
+    MODBUS_CONNECTION* connection = calloc(1, sizeof(MODBUS_CONNECTION));
+    if (NULL == connection)
+    {
+        LogError("Could not allocate memory for Modbus connection.");
+        return NULL;
+    }
+    connection->ConnectionType = deviceConfig->ConnectionType;
+
+    if (0 != mallocAndStrcpy_s(&(connection->Name), name))
+    {
+        LogError("Could not allocate memory for Modbus connection name.");
+        goto fail;
+    }
+
+    connection->Config = deviceConfig->ConnectionConfig;
+    const char* address = (TCP == deviceConfig->ConnectionType) ?
+        deviceConfig->ConnectionConfig.TcpConfig.Host : deviceConfig->ConnectionConfig.RtuConfig.Port;
+    if (0 != mallocAndStrcpy_s(&(connection->Address), address))
+    {
+        LogError("Could not allocate memory for Modbus connection address.");
+        goto fail;
+    }
+
+    if (TCP == deviceConfig->ConnectionType)
+    {
+        connection->Config.TcpConfig.Host = connection->Address;
+        connection->TcpLink = ModbusTcpLink_CreateReconnecting(ModbusConnectionManager_ConnectSocket, connection,
+            connection->Config.TcpConfig.TransactionWindow);
+        if (NULL != connection->TcpLink)
+        {
+            // The scheduler keeps as many reads in flight as the link lets through
+            pipelineDepth = ModbusTcpLink_GetWindow(connection->TcpLink);
+        }
+    }
+    else
+    {
+        connection->Config.RtuConfig.Port = connection->Address;
+        connection->RtuBus = ModbusRtuBus_CreateReopening(ModbusConnectionManager_OpenSerial, connection,
+            connection->Config.RtuConfig.BaudRate);
+    }
+
+    if (NULL == connection->TcpLink && NULL == connection->RtuBus)
+    {
+        LogError("Failed to create connection to \"%s\".", name);
+        goto fail;
+    }
+
+    connection->Scheduler = ModbusScheduler_Create(name, pipelineDepth);
+    if (NULL == connection->Scheduler)
+    {
+        goto fail;
+    }
+
+    CapabilityContext writeContext;
+    memset(&writeContext, 0, sizeof(writeContext));
+    writeContext.connectionType = connection->ConnectionType;
+    writeContext.hDevice = INVALID_FILE;
+    writeContext.tcpLink = connection->TcpLink;
+    writeContext.rtuBus = connection->RtuBus;
+    connection->WriteQueue = ModbusWriteQueue_Create(name, &writeContext, deviceConfig->WriteCoalesceWindow);
+    if (NULL == connection->WriteQueue)
+    {
+        goto fail;
+    }
+
+    return connection;
+
+fail:
+    ModbusConnectionManager_Close(connection);
+    return NULL;
+}
+
+// A connection that is already open keeps its settings, which the device is expected to share
+static void ModbusConnectionManager_CheckSettings(
+    const MODBUS_CONNECTION* connection,
+    const ModbusDeviceConfig* deviceConfig)
+{
+    if (connection->ConnectionType != deviceConfig->ConnectionType)
+    {
+        return;
+    }
+
+    if (TCP == connection->ConnectionType &&
+        deviceConfig->ConnectionConfig.TcpConfig.TransactionWindow != ModbusTcpLink_GetWindow(connection->TcpLink))
+    {
+        LogInfo("Connection to \"%s\" is already open with a transaction window of %d, which is kept.",
+            connection->Name, ModbusTcpLink_GetWindow(connection->TcpLink));
+    }
+    else if (RTU == connection->ConnectionType &&
+        deviceConfig->ConnectionConfig.RtuConfig.BaudRate != ModbusRtuBus_GetBaudRate(connection->RtuBus))
+    {
+        LogInfo("Serial port \"%s\" is already open at %u baud, which is kept.",
+            connection->Name, ModbusRtuBus_GetBaudRate(connection->RtuBus));
+    }
+}
+
+static bool ModbusConnectionManager_MatchName(
+    LIST_ITEM_HANDLE listItem,
+    const void* matchContext)
+{
+    const MODBUS_CONNECTION* connection = singlylinkedlist_item_get_value(listItem);
+    return 0 == strcmp(connection->Name, (const char*)matchContext);
+}
+
+IOTHUB_CLIENT_RESULT ModbusConnectionManager_Acquire(
+    MODBUS_CONNECTION_MANAGER* manager,
+    ModbusDeviceConfig* deviceConfig,
+    MODBUS_CONNECTION** connection)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    char name[128];
+
+    *connection = NULL;
+    if (TCP != deviceConfig->ConnectionType && RTU != deviceConfig->ConnectionType)
+    {
+        LogError("Modbus connection type is not supported.");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    ModbusPnp_GetConnectionName(deviceConfig, name, sizeof(name));
+
+    Lock(manager->Lock);
+    LIST_ITEM_HANDLE item = singlylinkedlist_find(manager->Connections, ModbusConnectionManager_MatchName, name);
+    if (NULL != item)
+    {
+        *connection = (MODBUS_CONNECTION*)singlylinkedlist_item_get_value(item);
+        (*connection)->RefCount++;
+        ModbusConnectionManager_CheckSettings(*connection, deviceConfig);
+        goto exit;
+    }
+
+    *connection = ModbusConnectionManager_Open(deviceConfig, name);
+    if (NULL == *connection)
+    {
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    if (NULL == singlylinkedlist_add(manager->Connections, *connection))
+    {
+        LogError("Could not add connection to \"%s\" to the open connections.", name);
+        ModbusConnectionManager_Close(*connection);
+        *connection = NULL;
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+    (*connection)->RefCount = 1;
+
+exit:
+    Unlock(manager->Lock);
+    return result;
+}
+
+void ModbusConnectionManager_Release(
+    MODBUS_CONNECTION_MANAGER* manager,
+    MODBUS_CONNECTION* connection)
+{
+    if (NULL == connection)
+    {
+        return;
+    }
+
+    Lock(manager->Lock);
+    if (--connection->RefCount > 0)
+    {
+        Unlock(manager->Lock);
+        return;
+    }
+
+    LIST_ITEM_HANDLE item = singlylinkedlist_find(manager->Connections, ModbusConnectionManager_MatchName, connection->Name);
+    if (NULL != item)
+    {
+        (void)singlylinkedlist_remove(manager->Connections, item);
+    }
+    Unlock(manager->Lock);
+
+    ModbusConnectionManager_Close(connection);
+}
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusPnp.h"
+#include "ModbusScheduler.h"
+#include "ModbusWriteQueue.h"
+#include "ModbusConnection/ModbusTCPLink.h"
+#include "ModbusConnection/ModbusRtuBus.h"
+
+// One physical connection, shared by every device that is reached through it. A Modbus TCP gateway
+// serves many unit IDs over a single socket, and an RS-485 segment many unit IDs over a single
+// serial port, which their devices share rather than each opening one.
+// The connection is opened again whenever it fails, so it keeps settings of its own rather than
+// those of the device that opened it, which may go before it.
+typedef struct _MODBUS_CONNECTION {
+    char* Name;                             // "host:port", or the serial port
+    MODBUS_CONNECTION_TYPE ConnectionType;
+    MODBUS_CONNECTION_CONFIG Config;        // With the host or serial port copied into Address
+    char* Address;
+    MODBUS_TCP_LINK_HANDLE TcpLink;
+    MODBUS_RTU_BUS_HANDLE RtuBus;
+    MODBUS_SCHEDULER_HANDLE Scheduler;      // Polls every device of the connection
+    MODBUS_WRITE_QUEUE_HANDLE WriteQueue;   // Writes to every device of the connection
+    int RefCount;
+} MODBUS_CONNECTION;
+
+// Keeps the open connections of the adapter, keyed by their name
+typedef struct _MODBUS_CONNECTION_MANAGER {
+    LOCK_HANDLE Lock;
+    SINGLYLINKEDLIST_HANDLE Connections;
+} MODBUS_CONNECTION_MANAGER;
+
+// Names the physical connection of a device: "host:port", or the serial port
+void ModbusPnp_GetConnectionName(
+    const ModbusDeviceConfig* deviceConfig,
+    char* name,
+    size_t nameSize);
+
+MODBUS_CONNECTION_MANAGER* ModbusConnectionManager_Create(void);
+
+// Every connection must have been released
+void ModbusConnectionManager_Destroy(
+    MODBUS_CONNECTION_MANAGER* manager);
+
+// Returns the connection to the serial port, or TCP host and port, of a device, creating it when no
+// other device uses it yet. The connection opens in the background, and is opened again after it
+// fails, so a device that cannot be reached yet does not fail here.
+IOTHUB_CLIENT_RESULT ModbusConnectionManager_Acquire(
+    MODBUS_CONNECTION_MANAGER* manager,
+    ModbusDeviceConfig* deviceConfig,
+    MODBUS_CONNECTION** connection);
+
+// Closes the connection once the last device using it releases it
+void ModbusConnectionManager_Release(
+    MODBUS_CONNECTION_MANAGER* manager,
+    MODBUS_CONNECTION* connection);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,462 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "parson.h"
+
+#include "ModbusDiscovery.h"
+#include "ModbusConnection/ModbusConnection.h"
+
+// Exceptions a gateway answers with for a unit behind it that did not answer the gateway
+#define MODBUS_GATEWAY_PATH_UNAVAILABLE 0x0A
+#define MODBUS_GATEWAY_TARGET_FAILED 0x0B
+
+#define MODBUS_DISCOVERY_COMPONENT_NAME_LENGTH 64
+
+// Unit IDs left to probe, shared by the connections probing them
+typedef struct _MODBUS_DISCOVERY_SCAN {
+    MODBUS_CONNECTION_TYPE ConnectionType;
+    SINGLYLINKEDLIST_HANDLE InterfaceDefinitions;
+    ModbusProperty Probe;               // Read when no interface has a fingerprint
+    uint32_t TimeoutMs;
+    LOCK_HANDLE Lock;                   // Guards NextUnitId and Probes
+    int NextUnitId;
+    int LastUnitId;
+    int Probes;
+    bool Present[MODBUS_DISCOVERY_LAST_UNIT_ID + 1];
+    const ModbusInterfaceConfig* Matched[MODBUS_DISCOVERY_LAST_UNIT_ID + 1];
+} MODBUS_DISCOVERY_SCAN;
+
+// One connection probing units: a TCP link with one request in flight, or the serial bus
+typedef struct _MODBUS_DISCOVERY_LANE {
+    MODBUS_DISCOVERY_SCAN* Scan;
+    MODBUS_TCP_LINK_HANDLE TcpLink;
+    MODBUS_RTU_BUS_HANDLE RtuBus;
+    THREAD_HANDLE Thread;
+} MODBUS_DISCOVERY_LANE;
+
+void ModbusDiscovery_InitOptions(
+    MODBUS_DISCOVERY_OPTIONS* options)
+{
+    options->FirstUnitId = MODBUS_DISCOVERY_FIRST_UNIT_ID;
+    options->LastUnitId = MODBUS_DISCOVERY_LAST_UNIT_ID;
+    options->Connections = MODBUS_DISCOVERY_DEFAULT_CONNECTIONS;
+    options->TimeoutMs = 0;
+}
+
+static int ModbusDiscovery_Transact(
+    MODBUS_DISCOVERY_LANE* lane,
+    uint8_t* request,
+    uint32_t requestLength,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    if (NULL != lane->TcpLink)
+    {
+        int transaction = ModbusTcpLink_Submit(lane->TcpLink, request, requestLength, response, responseSize);
+        return (transaction < 0) ? -1 : ModbusTcpLink_Wait(lane->TcpLink, transaction, (int)lane->Scan->TimeoutMs);
+    }
+
+    return ModbusRtuBus_TransactWithin(lane->RtuBus, request, requestLength, response, responseSize, lane->Scan->TimeoutMs);
+}
+
+// Reads a capability of a unit into value, formatted as the adapter reports it. Returns the length
+// of value, 0 when the unit answered without it, such as with an exception, or -1 when the unit did
+// not answer.
+static int ModbusDiscovery_Read(
+    MODBUS_DISCOVERY_LANE* lane,
+    uint8_t unitId,
+    ModbusProperty* capability,
+    uint8_t* value)
+{
+    MODBUS_DISCOVERY_SCAN* scan = lane->Scan;
+    MODBUS_BLOCK_CAPABILITY blockCapability = { capability, Property, 0 };
+    MODBUS_READ_BLOCK block;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+
+    memset(&block, 0, sizeof(block));
+    if (!ModbusConnectionHelper_GetFunctionCode(capability->StartAddress, true, &(block.FunctionCode), &(block.StartAddress)))
+    {
+        return -1;
+    }
+    block.Quantity = capability->Length;
+    block.CapabilityCount = 1;
+    block.Capabilities = &blockCapability;
+    ModbusPnp_EncodeReadRequest(scan->ConnectionType, &(block.ReadRequest), block.FunctionCode, block.StartAddress, block.Quantity, unitId);
+
+    uint8_t* request = (TCP == scan->ConnectionType) ? block.ReadRequest.TcpArr : block.ReadRequest.RtuArr;
+    uint32_t requestLength = (TCP == scan->ConnectionType) ? sizeof(block.ReadRequest.TcpArr) : sizeof(block.ReadRequest.RtuArr);
+    int headerSize = (TCP == scan->ConnectionType) ? ModbusTcp_GetHeaderSize() : ModbusRtu_GetHeaderSize();
+
+    Lock(scan->Lock);
+    scan->Probes++;
+    Unlock(scan->Lock);
+
+    // The header ends with the unit ID, which a late response of another unit does not have
+    int received = ModbusDiscovery_Transact(lane, request, requestLength, response, sizeof(response));
+    if (received < headerSize + 2 || response[headerSize - 1] != unitId)
+    {
+        return -1;
+    }
+
+    if (response[headerSize] == (block.FunctionCode | MODBUS_EXCEPTION_CODE))
+    {
+        uint8_t exceptionCode = response[headerSize + 1];
+        return (MODBUS_GATEWAY_PATH_UNAVAILABLE == exceptionCode || MODBUS_GATEWAY_TARGET_FAILED == exceptionCode) ? -1 : 0;
+    }
+
+    int byteCount = (ReadCoils == block.FunctionCode || ReadInputs == block.FunctionCode) ? (block.Quantity + 7) / 8 : block.Quantity * 2;
+    if (response[headerSize] != block.FunctionCode || received < headerSize + 2 + byteCount || response[headerSize + 1] != byteCount)
+    {
+        return 0;
+    }
+
+    memset(value, 0x00, MODBUS_RESPONSE_MAX_LENGTH);
+    int length = ModbusPnp_DecodeBlockCapability(scan->ConnectionType, &block, 0, response, block.StartAddress, value);
+    return (length > 0) ? length : 0;
+}
+
+// Tells whether a value read, as the adapter formats it, is the value of a fingerprint. Numbers
+// are compared as numbers, since they are formatted to a precision of their own, and strings
+// without their quotes.
+static bool ModbusDiscovery_IsFingerprint(
+    const JSON_Value* expected,
+    const char* value)
+{
+    switch (json_value_get_type(expected))
+    {
+        case JSONNumber:
+        {
+            char* end = NULL;
+            double number = strtod(value, &end);
+            double expectedNumber = json_value_get_number(expected);
+            return end != value && fabs(number - expectedNumber) <= 1e-6 * fmax(1.0, fabs(expectedNumber));
+        }
+        case JSONBoolean:
+            return 0 == strcmp(value, (1 == json_value_get_boolean(expected)) ? "true" : "false");
+        case JSONString:
+        {
+            const char* text = json_value_get_string(expected);
+            size_t length = strlen(value);
+            return length >= 2 && '\"' == value[0] && '\"' == value[length - 1] &&
+                length - 2 == strlen(text) && 0 == strncmp(value + 1, text, length - 2);
+        }
+        default:
+            return false;
+    }
+}
+
+// Finds out whether a unit is there, and which interface it belongs to. The first read tells
+// whether it is there, and the fingerprints of the other interfaces are only read from units that
+// are.
+static void ModbusDiscovery_ProbeUnit(
+    MODBUS_DISCOVERY_LANE* lane,
+    uint8_t unitId)
+{
+    MODBUS_DISCOVERY_SCAN* scan = lane->Scan;
+    uint8_t value[MODBUS_RESPONSE_MAX_LENGTH];
+
+    LIST_ITEM_HANDLE item = singlylinkedlist_get_head_item(scan->InterfaceDefinitions);
+    for (; NULL != item; item = singlylinkedlist_get_next_item(item))
+    {
+        const ModbusInterfaceConfig* interfaceConfig = (const ModbusInterfaceConfig*)singlylinkedlist_item_get_value(item);
+        if (NULL == interfaceConfig->Fingerprint)
+        {
+            continue;
+        }
+
+        int length = ModbusDiscovery_Read(lane, unitId, interfaceConfig->Fingerprint, value);
+        if (length < 0 && !scan->Present[unitId])
+        {
+            return;
+        }
+        scan->Present[unitId] = true;
+
+        if (length > 0 && ModbusDiscovery_IsFingerprint(interfaceConfig->FingerprintValue, (const char*)value))
+        {
+            scan->Matched[unitId] = interfaceConfig;
+            return;
+        }
+    }
+
+    if (!scan->Present[unitId])
+    {
+        scan->Present[unitId] = (ModbusDiscovery_Read(lane, unitId, &(scan->Probe), value) >= 0);
+    }
+}
+
+// Probes the next unit ID left, until none is
+static int ModbusDiscovery_Probe(
+    void* context)
+{
+    MODBUS_DISCOVERY_LANE* lane = (MODBUS_DISCOVERY_LANE*)context;
+    MODBUS_DISCOVERY_SCAN* scan = lane->Scan;
+
+    for (;;)
+    {
+        Lock(scan->Lock);
+        int unitId = scan->NextUnitId++;
+        Unlock(scan->Lock);
+
+        if (unitId > scan->LastUnitId)
+        {
+            break;
+        }
+        ModbusDiscovery_ProbeUnit(lane, (uint8_t)unitId);
+    }
+
+    return 0;
+}
+
+// Opens up to connections connections to a TCP device or gateway, returning how many were opened
+static int ModbusDiscovery_OpenTcpLanes(
+    const ModbusDeviceConfig* deviceConfig,
+    int connections,
+    MODBUS_DISCOVERY_SCAN* scan,
+    MODBUS_DISCOVERY_LANE* lanes)
+{
+    MODBUS_TCP_CONFIG tcpConfig = deviceConfig->ConnectionConfig.TcpConfig;
+    int laneCount = 0;
+
+    // A gateway that takes fewer connections is scanned over the ones it took
+    while (laneCount < connections)
+    {
+        SOCKET socket = INVALID_SOCKET;
+        if (IOTHUB_CLIENT_OK != ModbusPnp_OpenSocket(&tcpConfig, &socket))
+        {
+            break;
+        }
+
+        lanes[laneCount].TcpLink = ModbusTcpLink_Create(socket, 1);
+        if (NULL == lanes[laneCount].TcpLink)
+        {
+            (void)ModbusTcp_CloseDevice(socket, scan->Lock);
+            break;
+        }
+        lanes[laneCount].Scan = scan;
+        laneCount++;
+    }
+
+    return laneCount;
+}
+
+IOTHUB_CLIENT_RESULT ModbusDiscovery_Scan(
+    const ModbusDeviceConfig* deviceConfig,
+    SINGLYLINKEDLIST_HANDLE interfaceDefinitions,
+    const MODBUS_DISCOVERY_OPTIONS* options,
+    MODBUS_DISCOVERY_RESULT* result)
+{
+    IOTHUB_CLIENT_RESULT status = IOTHUB_CLIENT_OK;
+    MODBUS_DISCOVERY_SCAN scan;
+    MODBUS_DISCOVERY_LANE lanes[MODBUS_DISCOVERY_MAX_CONNECTIONS];
+    int laneCount = 0;
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+
+    memset(result, 0, sizeof(MODBUS_DISCOVERY_RESULT));
+    memset(&scan, 0, sizeof(scan));
+    memset(lanes, 0, sizeof(lanes));
+
+    if (options->FirstUnitId < MODBUS_DISCOVERY_FIRST_UNIT_ID || options->LastUnitId > MODBUS_DISCOVERY_LAST_UNIT_ID ||
+        options->FirstUnitId > options->LastUnitId)
+    {
+        LogError("Unit IDs to discover must be from %d to %d.", MODBUS_DISCOVERY_FIRST_UNIT_ID, MODBUS_DISCOVERY_LAST_UNIT_ID);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    LIST_ITEM_HANDLE item = singlylinkedlist_get_head_item(interfaceDefinitions);
+    for (; NULL != item; item = singlylinkedlist_get_next_item(item))
+    {
+        const ModbusInterfaceConfig* interfaceConfig = (const ModbusInterfaceConfig*)singlylinkedlist_item_get_value(item);
+        uint8_t functionCode = 0;
+        uint16_t address = 0;
+        if (NULL != interfaceConfig->Fingerprint &&
+            !ModbusConnectionHelper_GetFunctionCode(interfaceConfig->Fingerprint->StartAddress, true, &functionCode, &address))
+        {
+            LogError("\"startAddress\" of the fingerprint of \"%s\" is in valid.", interfaceConfig->Id);
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+    }
+
+    scan.ConnectionType = deviceConfig->ConnectionType;
+    scan.InterfaceDefinitions = interfaceDefinitions;
+    scan.Probe.StartAddress = MODBUS_DISCOVERY_PROBE_ADDRESS;
+    scan.Probe.Length = 1;
+    scan.Probe.DataType = NUMERIC;
+    scan.Probe.ConversionCoefficient = 1;
+    scan.NextUnitId = options->FirstUnitId;
+    scan.LastUnitId = options->LastUnitId;
+    scan.Lock = Lock_Init();
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    if (NULL == scan.Lock || NULL == tickCounter)
+    {
+        LogError("Could not initialize Modbus discovery.");
+        status = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+
+    if (TCP == deviceConfig->ConnectionType)
+    {
+        int connections = (options->Connections < 1) ? 1 : (options->Connections > MODBUS_DISCOVERY_MAX_CONNECTIONS) ? MODBUS_DISCOVERY_MAX_CONNECTIONS : options->Connections;
+        if (connections > options->LastUnitId - options->FirstUnitId + 1)
+        {
+            connections = options->LastUnitId - options->FirstUnitId + 1;
+        }
+        scan.TimeoutMs = (options->TimeoutMs > 0) ? (uint32_t)options->TimeoutMs : MODBUS_DISCOVERY_TCP_TIMEOUT_MS;
+
+        laneCount = ModbusDiscovery_OpenTcpLanes(deviceConfig, connections, &scan, lanes);
+        if (0 == laneCount)
+        {
+            LogError("Failed to connect to %s:%d to discover its units.", deviceConfig->ConnectionConfig.TcpConfig.Host,
+                deviceConfig->ConnectionConfig.TcpConfig.Port);
+            status = IOTHUB_CLIENT_ERROR;
+            goto exit;
+        }
+    }
+    else
+    {
+        // Slaves on a serial line take turns, so its units are probed one at a time
+        MODBUS_RTU_CONFIG rtuConfig = deviceConfig->ConnectionConfig.RtuConfig;
+        HANDLE port = INVALID_FILE;
+        scan.TimeoutMs = (options->TimeoutMs > 0) ? (uint32_t)options->TimeoutMs : MODBUS_DISCOVERY_RTU_TURNAROUND_MS;
+
+        if (IOTHUB_CLIENT_OK != ModbusPnp_OpenSerial(&rtuConfig, &port))
+        {
+            LogError("Failed to open %s to discover its units.", rtuConfig.Port);
+            status = IOTHUB_CLIENT_ERROR;
+            goto exit;
+        }
+
+        lanes[0].RtuBus = ModbusRtuBus_Create(port, rtuConfig.BaudRate);
+        if (NULL == lanes[0].RtuBus)
+        {
+            (void)ModbusRtu_CloseDevice(port, scan.Lock);
+            status = IOTHUB_CLIENT_ERROR;
+            goto exit;
+        }
+        lanes[0].Scan = &scan;
+        laneCount = 1;
+    }
+
+    // The first connection probes on this thread. Should a thread fail to start, the others take
+    // on the unit IDs it would have probed.
+    for (int i = 1; i < laneCount; i++)
+    {
+        if (THREADAPI_OK != ThreadAPI_Create(&(lanes[i].Thread), ModbusDiscovery_Probe, &lanes[i]))
+        {
+            LogError("Failed to start probing over connection %d.", i);
+            lanes[i].Thread = NULL;
+        }
+    }
+    (void)ModbusDiscovery_Probe(&lanes[0]);
+
+    for (int i = 0; i < laneCount; i++)
+    {
+        if (NULL != lanes[i].Thread)
+        {
+            (void)ThreadAPI_Join(lanes[i].Thread, NULL);
+        }
+    }
+
+    for (int unitId = options->FirstUnitId; unitId <= options->LastUnitId; unitId++)
+    {
+        if (scan.Present[unitId])
+        {
+            result->Units[result->UnitCount].UnitId = (uint8_t)unitId;
+            result->Units[result->UnitCount].Interface = scan.Matched[unitId];
+            result->UnitCount++;
+        }
+    }
+    result->Probes = scan.Probes;
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+    result->ElapsedMs = (uint32_t)(end - start);
+
+    LogInfo("Discovered %d Modbus units in %u ms, with %d probes over %d connections.", result->UnitCount,
+        result->ElapsedMs, result->Probes, laneCount);
+
+exit:
+    for (int i = 0; i < laneCount; i++)
+    {
+        if (NULL != lanes[i].TcpLink)
+        {
+            ModbusTcpLink_Destroy(lanes[i].TcpLink);
+        }
+        if (NULL != lanes[i].RtuBus)
+        {
+            ModbusRtuBus_Destroy(lanes[i].RtuBus);
+        }
+    }
+    if (NULL != tickCounter)
+    {
+        tickcounter_destroy(tickCounter);
+    }
+    if (NULL != scan.Lock)
+    {
+        Lock_Deinit(scan.Lock);
+    }
+    return status;
+}
+
+char* ModbusDiscovery_FormatComponents(
+    const JSON_Object* adapterConfig,
+    const MODBUS_DISCOVERY_RESULT* result,
+    const char* componentPrefix)
+{
+    char* serialized = NULL;
+    JSON_Value* components = json_value_init_array();
+    if (NULL == components)
+    {
+        LogError("Could not allocate memory for discovered components.");
+        return NULL;
+    }
+
+    for (int i = 0; i < result->UnitCount; i++)
+    {
+        const MODBUS_DISCOVERED_UNIT* unit = &(result->Units[i]);
+        if (NULL == unit->Interface)
+        {
+            continue;
+        }
+
+        char name[MODBUS_DISCOVERY_COMPONENT_NAME_LENGTH];
+        (void)snprintf(name, sizeof(name), "%s%u", componentPrefix, (unsigned int)unit->UnitId);
+
+        // The component keeps the connection settings it was found with
+        JSON_Value* component = json_value_init_object();
+        JSON_Value* config = json_value_deep_copy(json_object_get_wrapping_value(adapterConfig));
+        JSON_Object* componentObject = json_value_get_object(component);
+        JSON_Object* configObject = json_value_get_object(config);
+        if (NULL == componentObject || NULL == configObject ||
+            JSONSuccess != json_object_set_number(configObject, PNP_CONFIG_ADAPTER_INTERFACE_UNITID, unit->UnitId) ||
+            JSONSuccess != json_object_set_string(configObject, PNP_CONFIG_ADAPTER_MODBUS_IDENTITY, unit->Interface->Id) ||
+            JSONSuccess != json_object_set_string(componentObject, "pnp_bridge_component_name", name) ||
+            JSONSuccess != json_object_set_string(componentObject, "pnp_bridge_adapter_id", PNP_CONFIG_ADAPTER_MODBUS_ADAPTER_ID) ||
+            JSONSuccess != json_object_set_value(componentObject, "pnp_bridge_adapter_config", config))
+        {
+            LogError("Failed to format the component of unit %u.", (unsigned int)unit->UnitId);
+            json_value_free(config);
+            json_value_free(component);
+            goto exit;
+        }
+
+        if (JSONSuccess != json_array_append_value(json_value_get_array(components), component))
+        {
+            LogError("Failed to format the component of unit %u.", (unsigned int)unit->UnitId);
+            json_value_free(component);
+            goto exit;
+        }
+    }
+
+    serialized = json_serialize_to_string_pretty(components);
+
+exit:
+    json_value_free(components);
+    return serialized;
+}
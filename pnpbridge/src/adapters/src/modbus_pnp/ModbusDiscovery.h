@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusPnp.h"
+
+// Unit IDs a slave may have. 0 is the broadcast address, which no slave answers, and 248 to 255
+// are reserved.
+#define MODBUS_DISCOVERY_FIRST_UNIT_ID 1
+#define MODBUS_DISCOVERY_LAST_UNIT_ID 247
+
+// Connections a TCP scan probes over at once unless told otherwise. A gateway forwards the probes
+// of each connection on its own, so that absent units time out side by side.
+#define MODBUS_DISCOVERY_DEFAULT_CONNECTIONS 8
+#define MODBUS_DISCOVERY_MAX_CONNECTIONS 32
+
+// Time a unit has to answer a probe over TCP, which is far shorter than that of a poll: a present
+// unit answers at once, and the scan waits this long for each absent one
+#define MODBUS_DISCOVERY_TCP_TIMEOUT_MS 250
+
+// Time a slave on a serial line has to start answering a probe. The request and response frames
+// take as long on top as the baud rate makes them.
+#define MODBUS_DISCOVERY_RTU_TURNAROUND_MS 50
+
+// Register read from each unit when no interface has a fingerprint to read instead
+#define MODBUS_DISCOVERY_PROBE_ADDRESS "40001"
+
+typedef struct _MODBUS_DISCOVERY_OPTIONS {
+    uint8_t FirstUnitId;
+    uint8_t LastUnitId;
+    int Connections;            // TCP only
+    int TimeoutMs;              // Response timeout over TCP, turnaround over RTU
+} MODBUS_DISCOVERY_OPTIONS;
+
+typedef struct _MODBUS_DISCOVERED_UNIT {
+    uint8_t UnitId;
+    const ModbusInterfaceConfig* Interface;     // Whose fingerprint the unit holds, or NULL
+} MODBUS_DISCOVERED_UNIT;
+
+// The units that answered, by unit ID
+typedef struct _MODBUS_DISCOVERY_RESULT {
+    int UnitCount;
+    MODBUS_DISCOVERED_UNIT Units[MODBUS_DISCOVERY_LAST_UNIT_ID];
+    int Probes;                 // Requests sent
+    uint32_t ElapsedMs;
+} MODBUS_DISCOVERY_RESULT;
+
+// Sets the options to scan every unit ID, with the defaults above
+void ModbusDiscovery_InitOptions(
+    MODBUS_DISCOVERY_OPTIONS* options);
+
+// Finds the units that answer on the connection of deviceConfig, whose unit ID is not used. Over
+// TCP the unit IDs are probed over several connections at once; on a serial line one at a time,
+// with a timeout for the baud rate, and never at the broadcast address. A unit that answers with
+// anything but a gateway exception is there. Each is then matched with the first interface of
+// interfaceDefinitions whose fingerprint it holds.
+IOTHUB_CLIENT_RESULT ModbusDiscovery_Scan(
+    const ModbusDeviceConfig* deviceConfig,
+    SINGLYLINKEDLIST_HANDLE interfaceDefinitions,
+    const MODBUS_DISCOVERY_OPTIONS* options,
+    MODBUS_DISCOVERY_RESULT* result);
+
+// Formats the pnp_bridge_interface_components entries of the units matched with an interface, as
+// a JSON array. Each is named componentPrefix followed by its unit ID, and has a copy of
+// adapterConfig, the pnp_bridge_adapter_config that the connection was scanned with, with its
+// unit_id and modbus_identity. Returns NULL on failure, or a string to free with
+// json_free_serialized_string.
+char* ModbusDiscovery_FormatComponents(
+    const JSON_Object* adapterConfig,
+    const MODBUS_DISCOVERY_RESULT* result,
+    const char* componentPrefix);
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,6 +13,11 @@ typedef enum ModbusDataType
     FLAG,
     STRING,
     HEXSTRING,
+    INT16,
+    INT32,
+    UINT32,
+    FLOAT32,
+    FLOAT64,
     INVALID
 } ModbusDataType;
 
@@ -31,7 +36,9 @@ typedef enum FunctionCodeType
     ReadHoldingRegisters = 3,
     ReadInputRegisters = 4,
     WriteCoil = 5,
-    WriteHoldingRegister = 6
+    WriteHoldingRegister = 6,
+    WriteCoils = 15,
+    WriteHoldingRegisters = 16
 } FunctionCodeType;
 
 typedef enum CapabilityType {
@@ -12,9 +12,14 @@
 #include "parson.h"
 #include "ModbusPnp.h"
 #include "ModbusCapability.h"
+#include "ModbusReadPlanner.h"
+#include "ModbusConnectionManager.h"
+#include "ModbusWriteQueue.h"
 #include "ModbusConnection/ModbusConnection.h"
 
 #ifndef WIN32
+    #include <netinet/tcp.h>
+    #include <poll.h>
     #include <strings.h>
     #define strcmpcasei strcasecmp
 #else
@@ -62,9 +67,176 @@ ModbusDataType ToModbusDataTypeEnum(
     {
         return FLAG;
     }
+    else if (strcmpcasei(dataType, "int16") == 0) {
+        return INT16;
+    }
+    else if (strcmpcasei(dataType, "int32") == 0) {
+        return INT32;
+    }
+    else if (strcmpcasei(dataType, "uint32") == 0) {
+        return UINT32;
+    }
+    else if (strcmpcasei(dataType, "float32") == 0) {
+        return FLOAT32;
+    }
+    else if (strcmpcasei(dataType, "float64") == 0) {
+        return FLOAT64;
+    }
     return INVALID;
 }
 
+// Reads "bigEndian" or "littleEndian", which is big endian when missing
+bool ModbusPnp_ParseByteOrder(
+    const char* byteOrderStr,
+    MODBUS_BYTE_ORDER* byteOrder)
+{
+    if (NULL == byteOrderStr || strcmpcasei(byteOrderStr, "bigEndian") == 0) {
+        *byteOrder = MODBUS_BIG_ENDIAN;
+        return true;
+    }
+    else if (strcmpcasei(byteOrderStr, "littleEndian") == 0) {
+        *byteOrder = MODBUS_LITTLE_ENDIAN;
+        return true;
+    }
+    return false;
+}
+
+// Sets up the decoding of a numeric capability from its "wordOrder" and "byteOrder"
+IOTHUB_CLIENT_RESULT ModbusPnp_ParseValueCodec(
+    JSON_Object* capabilityArgs,
+    const char* name,
+    ModbusDataType dataType,
+    uint16_t length,
+    MODBUS_VALUE_CODEC* codec)
+{
+    MODBUS_BYTE_ORDER wordOrder = MODBUS_BIG_ENDIAN;
+    MODBUS_BYTE_ORDER byteOrder = MODBUS_BIG_ENDIAN;
+
+    if (FLAG == dataType || STRING == dataType || HEXSTRING == dataType)
+    {
+        return IOTHUB_CLIENT_OK;
+    }
+
+    if (!ModbusPnp_ParseByteOrder(json_object_dotget_string(capabilityArgs, "wordOrder"), &wordOrder) ||
+        !ModbusPnp_ParseByteOrder(json_object_dotget_string(capabilityArgs, "byteOrder"), &byteOrder))
+    {
+        LogError("\"wordOrder\" and \"byteOrder\" of capability \"%s\" must be \"bigEndian\" or \"littleEndian\".", name);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    if (!ModbusValueCodec_Init(codec, dataType, length, wordOrder, byteOrder))
+    {
+        LogError("\"length\" of capability \"%s\" is shorter than the %d registers of its \"dataType\".", name, ModbusValueCodec_GetRegisterCount(dataType));
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
+// Reads the optional minInterval, maxInterval and deadband of a polled capability. The interval
+// adapts only when minInterval <= defaultFrequency <= maxInterval are not all equal.
+static IOTHUB_CLIENT_RESULT ModbusPnp_ParseAdaptivePolling(
+    JSON_Object* capabilityArgs,
+    const char* name,
+    int defaultFrequency,
+    MODBUS_ADAPTIVE_POLLING* polling)
+{
+    polling->MinInterval = defaultFrequency;
+    polling->MaxInterval = defaultFrequency;
+    polling->Deadband = 0;
+
+    if (json_object_has_value_of_type(capabilityArgs, "minInterval", JSONNumber))
+    {
+        polling->MinInterval = (int)json_object_get_number(capabilityArgs, "minInterval");
+    }
+    if (json_object_has_value_of_type(capabilityArgs, "maxInterval", JSONNumber))
+    {
+        polling->MaxInterval = (int)json_object_get_number(capabilityArgs, "maxInterval");
+    }
+    if (json_object_has_value_of_type(capabilityArgs, "deadband", JSONNumber))
+    {
+        polling->Deadband = json_object_get_number(capabilityArgs, "deadband");
+    }
+
+    if (polling->MinInterval != polling->MaxInterval &&
+        (defaultFrequency <= 0 || polling->MinInterval <= 0 || polling->MinInterval > defaultFrequency ||
+        polling->MaxInterval < defaultFrequency))
+    {
+        LogError("\"minInterval\" and \"maxInterval\" of capability \"%s\" must be positive, with \"defaultFrequency\" in between.", name);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+    if (polling->Deadband < 0)
+    {
+        LogError("\"deadband\" of capability \"%s\" is in valid.", name);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
+// Reads the optional fingerprint of an interface: registers or a coil whose value tells its devices
+// from devices of other interfaces, decoded like a property, and the "value" they hold
+static IOTHUB_CLIENT_RESULT ModbusPnp_ParseFingerprint(
+    JSON_Object* fingerprintArgs,
+    ModbusInterfaceConfig* interfaceConfig)
+{
+    const char* name = PNP_CONFIG_ADAPTER_INTERFACE_FINGERPRINT;
+    ModbusProperty* fingerprint = calloc(1, sizeof(ModbusProperty));
+    if (NULL == fingerprint)
+    {
+        LogError("Failed to allocation memory for fingerprint configuration.");
+        return IOTHUB_CLIENT_ERROR;
+    }
+    interfaceConfig->Fingerprint = fingerprint;
+
+    mallocAndStrcpy_s(&fingerprint->Name, name);
+
+    fingerprint->StartAddress = json_object_dotget_string(fingerprintArgs, "startAddress");
+    if (NULL == fingerprint->StartAddress)
+    {
+        LogError("\"startAddress\" of the fingerprint is in valid.");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    fingerprint->Length = (uint16_t)json_object_dotget_number(fingerprintArgs, "length");
+    if (0 == fingerprint->Length)
+    {
+        LogError("\"length\" of the fingerprint is in valid.");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    const char* dataTypeStr = (const char*)json_object_dotget_string(fingerprintArgs, "dataType");
+    fingerprint->DataType = (NULL != dataTypeStr) ? ToModbusDataTypeEnum(dataTypeStr) : INVALID;
+    if (fingerprint->DataType == INVALID)
+    {
+        LogError("\"dataType\" of the fingerprint is in valid.");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    fingerprint->ConversionCoefficient = 1;
+    if (json_object_has_value_of_type(fingerprintArgs, "conversionCoefficient", JSONNumber))
+    {
+        fingerprint->ConversionCoefficient = json_object_get_number(fingerprintArgs, "conversionCoefficient");
+    }
+    fingerprint->Access = 1;
+
+    if (IOTHUB_CLIENT_OK != ModbusPnp_ParseValueCodec(fingerprintArgs, name, fingerprint->DataType, fingerprint->Length, &(fingerprint->Codec)))
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    interfaceConfig->FingerprintValue = json_object_get_value(fingerprintArgs, "value");
+    if (!json_object_has_value_of_type(fingerprintArgs, "value", JSONString) &&
+        !json_object_has_value_of_type(fingerprintArgs, "value", JSONNumber) &&
+        !json_object_has_value_of_type(fingerprintArgs, "value", JSONBoolean))
+    {
+        LogError("\"value\" of the fingerprint must be a string, a number or a boolean.");
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
 IOTHUB_CLIENT_RESULT ModbusPnp_ParseInterfaceConfig(
     PModbusInterfaceConfig * ModbusInterfaceConfig,
     JSON_Object* ConfigObj)
@@ -133,6 +305,11 @@ IOTHUB_CLIENT_RESULT ModbusPnp_ParseInterfaceConfig(
             return IOTHUB_CLIENT_INVALID_ARG;
         }
 
+        if (IOTHUB_CLIENT_OK != ModbusPnp_ParseAdaptivePolling(telemetryArgs, name, telemetry->DefaultFrequency, &(telemetry->Polling)))
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+
         telemetry->ConversionCoefficient = json_object_dotget_number(telemetryArgs, "conversionCoefficient");
         if (0 == telemetry->ConversionCoefficient)
         {
@@ -140,6 +317,11 @@ IOTHUB_CLIENT_RESULT ModbusPnp_ParseInterfaceConfig(
             return IOTHUB_CLIENT_INVALID_ARG;
         }
 
+        if (IOTHUB_CLIENT_OK != ModbusPnp_ParseValueCodec(telemetryArgs, name, telemetry->DataType, telemetry->Length, &(telemetry->Codec)))
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+
         singlylinkedlist_add((*ModbusInterfaceConfig)->Events, telemetry);
     }
 
@@ -198,6 +380,11 @@ IOTHUB_CLIENT_RESULT ModbusPnp_ParseInterfaceConfig(
             return IOTHUB_CLIENT_INVALID_ARG;
         }
 
+        if (IOTHUB_CLIENT_OK != ModbusPnp_ParseAdaptivePolling(propertyArgs, name, property->DefaultFrequency, &(property->Polling)))
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+
         property->ConversionCoefficient = json_object_dotget_number(propertyArgs, "conversionCoefficient");
         if (0 == property->ConversionCoefficient)
         {
@@ -205,6 +392,11 @@ IOTHUB_CLIENT_RESULT ModbusPnp_ParseInterfaceConfig(
             return IOTHUB_CLIENT_INVALID_ARG;
         }
 
+        if (IOTHUB_CLIENT_OK != ModbusPnp_ParseValueCodec(propertyArgs, name, property->DataType, property->Length, &(property->Codec)))
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+
         property->Access = (int)json_object_dotget_number(propertyArgs, "access");
         if (0 == property->Access)
         {
@@ -271,9 +463,20 @@ IOTHUB_CLIENT_RESULT ModbusPnp_ParseInterfaceConfig(
             return IOTHUB_CLIENT_INVALID_ARG;
         }
 
+        if (IOTHUB_CLIENT_OK != ModbusPnp_ParseValueCodec(commandArgs, name, command->DataType, command->Length, &(command->Codec)))
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+
         singlylinkedlist_add((*ModbusInterfaceConfig)->Commands, command);
     }
 
+    JSON_Object* fingerprintArgs = json_object_dotget_object(ConfigObj, PNP_CONFIG_ADAPTER_INTERFACE_FINGERPRINT);
+    if (NULL != fingerprintArgs)
+    {
+        return ModbusPnp_ParseFingerprint(fingerprintArgs, *ModbusInterfaceConfig);
+    }
+
     return IOTHUB_CLIENT_OK;
 }
 
@@ -394,6 +597,17 @@ int ModbusPnP_ParseTcpSettings(
         return IOTHUB_CLIENT_INVALID_ARG;
     }
 
+    // Requests kept in flight on the connection, for gateways that answer them concurrently
+    deviceConfig->ConnectionConfig.TcpConfig.TransactionWindow = MODBUS_TCP_DEFAULT_TRANSACTION_WINDOW;
+    if (json_object_has_value_of_type(configObj, PNP_CONFIG_ADAPTER_INTERFACE_TRANSACTION_WINDOW, JSONNumber)) {
+        int window = (int)json_object_get_number(configObj, PNP_CONFIG_ADAPTER_INTERFACE_TRANSACTION_WINDOW);
+        if (window < 1 || window > MODBUS_TCP_MAX_TRANSACTION_WINDOW) {
+            LogError("\"transaction_window\" is invalide in TCP configuration: must be from 1 to %d.", MODBUS_TCP_MAX_TRANSACTION_WINDOW);
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+        deviceConfig->ConnectionConfig.TcpConfig.TransactionWindow = (uint8_t)window;
+    }
+
     deviceConfig->ConnectionType = TCP;
 
     return IOTHUB_CLIENT_OK;
@@ -405,6 +619,27 @@ int ModbusPnP_ParseTcpSettings(
 SINGLYLINKEDLIST_HANDLE ModbusDeviceList = NULL;
 int ModbusDeviceCount = 0;
 
+#ifndef WIN32
+static speed_t ModbusPnp_GetSerialSpeed(
+    uint32_t baudRate)
+{
+    switch (baudRate)
+    {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        default:
+            LogError("Baud rate %u is not supported, using 9600.", baudRate);
+            return B9600;
+    }
+}
+#endif
+
 int ModbusPnp_OpenSerial(
     MODBUS_RTU_CONFIG* rtuConfig,
     HANDLE *serialHandle)
@@ -464,7 +699,20 @@ int ModbusPnp_OpenSerial(
 #else
     struct termios settings;
     tcgetattr(*serialHandle, &settings);
-    cfsetospeed(&settings, rtuConfig->BaudRate);
+
+    // Frames are binary, and the adapter waits for them with poll(), so reads return whatever
+    // has arrived
+    settings.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+    settings.c_oflag &= ~OPOST;
+    settings.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    settings.c_cflag &= ~CSIZE;
+    settings.c_cflag |= ((7 == rtuConfig->DataBits) ? CS7 : CS8) | CLOCAL | CREAD;
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = 0;
+
+    speed_t speed = ModbusPnp_GetSerialSpeed(rtuConfig->BaudRate);
+    cfsetospeed(&settings, speed);
+    cfsetispeed(&settings, speed);
     if (rtuConfig->Parity == NOPARITY)
     {
         settings.c_cflag &= ~PARENB;
@@ -498,6 +746,69 @@ int ModbusPnp_OpenSerial(
     return IOTHUB_CLIENT_OK;
 }
 
+static bool ModbusPnp_SetSocketBlocking(
+    SOCKET socketHandle,
+    bool blocking)
+{
+#ifdef WIN32
+    u_long nonBlocking = blocking ? 0 : 1;
+    return 0 == ioctlsocket(socketHandle, FIONBIO, &nonBlocking);
+#else
+    int flags = fcntl(socketHandle, F_GETFL, 0);
+    if (flags < 0)
+    {
+        return false;
+    }
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    return 0 == fcntl(socketHandle, F_SETFL, flags);
+#endif
+}
+
+// Waits for a nonblocking connect to complete. Returns 0 once connected, or SOCKET_ERROR when the
+// connection was refused or did not complete within timeoutMs.
+static int ModbusPnp_WaitForConnect(
+    SOCKET socketHandle,
+    int timeoutMs)
+{
+#ifdef WIN32
+    fd_set writable;
+    fd_set failed;
+    struct timeval timeout;
+    FD_ZERO(&writable);
+    FD_ZERO(&failed);
+    FD_SET(socketHandle, &writable);
+    FD_SET(socketHandle, &failed);
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+    if (1 > select(0, NULL, &writable, &failed, &timeout) || FD_ISSET(socketHandle, &failed))
+    {
+        return SOCKET_ERROR;
+    }
+    return 0;
+#else
+    struct pollfd connecting = { socketHandle, POLLOUT, 0 };
+    int ready = 0;
+    do
+    {
+        ready = poll(&connecting, 1, timeoutMs);
+    } while (ready < 0 && EINTR == errno);
+
+    if (1 != ready)
+    {
+        return SOCKET_ERROR;
+    }
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (0 != getsockopt(socketHandle, SOL_SOCKET, SO_ERROR, &error, &length) || 0 != error)
+    {
+        return SOCKET_ERROR;
+    }
+    return 0;
+#endif
+}
+
 int ModbusPnp_OpenSocket(
     MODBUS_TCP_CONFIG* tcpConfig,
     SOCKET *socketHandle)
@@ -524,37 +835,67 @@ int ModbusPnp_OpenSocket(
         goto ExitOnError;
     }
 
-    // Connect to device
+    // Connect to device, without blocking for longer than the connect timeout on a host that
+    // does not answer
     struct sockaddr_in deviceAddress;
     deviceAddress.sin_family = AF_INET;
     deviceAddress.sin_addr.s_addr = inet_addr(tcpConfig->Host);
     deviceAddress.sin_port = htons(tcpConfig->Port);
 
+    if (!ModbusPnp_SetSocketBlocking(*socketHandle, false))
+    {
+        LogError("Failed to make socket for \"%s:%d\" nonblocking.", tcpConfig->Host, tcpConfig->Port);
+        goto CloseOnError;
+    }
+
     result = connect(*socketHandle, (struct sockaddr *)& deviceAddress, sizeof(deviceAddress));
-    if (result == SOCKET_ERROR) {
 #ifdef WIN32
-        LogError("Failed to connect with socket \"%s:%d\" with error: %ld.", tcpConfig->Host, tcpConfig->Port, WSAGetLastError());
+    if (result == SOCKET_ERROR && WSAEWOULDBLOCK == WSAGetLastError())
 #else
-        LogError("Failed to connect with socket \"%s:%d\".", tcpConfig->Host, tcpConfig->Port);
+    if (result == SOCKET_ERROR && EINPROGRESS == errno)
 #endif
+    {
+        result = ModbusPnp_WaitForConnect(*socketHandle, MODBUS_TCP_CONNECT_TIMEOUT_MS);
+    }
 
+    if (result == SOCKET_ERROR) {
 #ifdef WIN32
-        if (SOCKET_ERROR == closesocket(*socketHandle))
-        {
-            LogError("Failed to close socket with error: %ld.", WSAGetLastError());
-        }
+        LogError("Failed to connect with socket \"%s:%d\" with error: %ld.", tcpConfig->Host, tcpConfig->Port, WSAGetLastError());
 #else
-        if (!(close(*socketHandle)))
-        {
-            LogError("Failed to close socket");
-        }
-
+        LogError("Failed to connect with socket \"%s:%d\".", tcpConfig->Host, tcpConfig->Port);
 #endif
-        goto ExitOnError;
+        goto CloseOnError;
     }
+
+    // Requests and responses go through blocking calls once connected
+    if (!ModbusPnp_SetSocketBlocking(*socketHandle, true))
+    {
+        LogError("Failed to make socket for \"%s:%d\" blocking.", tcpConfig->Host, tcpConfig->Port);
+        goto CloseOnError;
+    }
+
+    // A request is written in one piece, so holding it back until the last one is acknowledged
+    // only delays it, by as long as the device delays its acknowledgement when it does not answer
+    int noDelay = 1;
+    (void)setsockopt(*socketHandle, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
     LogInfo("Connected to device at \"%s:%d\".", tcpConfig->Host, tcpConfig->Port);
     return IOTHUB_CLIENT_OK;
 
+CloseOnError:
+#ifdef WIN32
+    if (SOCKET_ERROR == closesocket(*socketHandle))
+    {
+        LogError("Failed to close socket with error: %ld.", WSAGetLastError());
+    }
+#else
+    if (0 != close(*socketHandle))
+    {
+        LogError("Failed to close socket");
+    }
+#endif
+    *socketHandle = INVALID_SOCKET;
+
 ExitOnError:
 #ifdef WIN32
     WSACleanup();
@@ -626,26 +967,8 @@ void ModbusPnp_FreePropertyList(
 void Modbus_CleanupPollingTasks(
     PMODBUS_DEVICE_CONTEXT deviceContext)
 {
-    if (NULL != deviceContext->PollingTasks)
-    {
-        StopPollingTasks();
-        const ModbusInterfaceConfig* interfaceConfig = (PModbusInterfaceConfig)(deviceContext->InterfaceConfig);
-        int telemetryCount = ModbusPnp_GetListCount(interfaceConfig->Events);
-        int propertyCount = ModbusPnp_GetListCount(interfaceConfig->Properties);
-        int threadCount = telemetryCount + propertyCount;
-
-        for (int i = 0; i < threadCount; i++)
-        {
-            int res = 0;
-            int result = ThreadAPI_Join(deviceContext->PollingTasks[i], &res);
-            if (result != THREADAPI_OK)
-            {
-                LogError("Failed to stop thread. error: %02X.", result);
-            }
-            //TODO: To be able to stop sleeping thread
-        }
-        free(deviceContext->PollingTasks);
-    }
+    // Stops the polling of this device only; other Modbus components keep polling
+    ModbusPnp_StopPollingAllTelemetryProperty(deviceContext);
 }
 
 IOTHUB_CLIENT_RESULT
@@ -688,12 +1011,23 @@ IOTHUB_CLIENT_RESULT Modbus_DestroyPnpAdapter(
             ModbusPnp_FreeTelemetryList(def->Events);
             ModbusPnp_FreeCommandList(def->Commands);
             ModbusPnp_FreePropertyList(def->Properties);
+            ModbusPnp_DestroyReadTables(def);
+            if (NULL != def->ReadTablesLock)
+            {
+                Lock_Deinit(def->ReadTablesLock);
+            }
+            if (NULL != def->Fingerprint)
+            {
+                free(def->Fingerprint->Name);
+                free(def->Fingerprint);
+            }
 
             free(def);
             interfaceDef = singlylinkedlist_get_next_item(interfaceDef);
         }
         singlylinkedlist_destroy(adapterContext->InterfaceDefinitions);
     }
+    ModbusConnectionManager_Destroy(adapterContext->ConnectionManager);
     free(adapterContext);
     return result;
 }
@@ -713,6 +1047,14 @@ IOTHUB_CLIENT_RESULT Modbus_CreatePnpAdapter(
 
     adapterContext->InterfaceDefinitions = singlylinkedlist_create();
 
+    // TCP devices behind the same host and port share one connection
+    adapterContext->ConnectionManager = ModbusConnectionManager_Create();
+    if (NULL == adapterContext->ConnectionManager)
+    {
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
     if (AdapterGlobalConfig == NULL)
     {
         LogError("Modbus adapter requires associated global parameters in config");
@@ -739,6 +1081,16 @@ IOTHUB_CLIENT_RESULT Modbus_CreatePnpAdapter(
             goto exit;
         }
 
+        interfaceConfig->ReadTablesLock = Lock_Init();
+        if (NULL == interfaceConfig->ReadTablesLock)
+        {
+            LogError("Could not initialize lock for interface configuration %s", modbusConfigIdentity);
+            result = IOTHUB_CLIENT_ERROR;
+            free((char*)interfaceConfig->Id);
+            free(interfaceConfig);
+            goto exit;
+        }
+
         JSON_Object* interfaceConfigJson = json_object_get_object(AdapterGlobalConfig, modbusConfigIdentity);
 
         if (IOTHUB_CLIENT_OK != ModbusPnp_ParseInterfaceConfig(&interfaceConfig, interfaceConfigJson))
@@ -802,6 +1154,24 @@ IOTHUB_CLIENT_RESULT Modbus_ParseDeviceConfig(
     }
 
     DeviceConfig->UnitId = (uint8_t)json_object_get_number(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_UNITID);
+
+    DeviceConfig->ReadGapTolerance = MODBUS_DEFAULT_READ_GAP_TOLERANCE;
+    if (json_object_has_value_of_type(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_READ_GAP_TOLERANCE, JSONNumber))
+    {
+        DeviceConfig->ReadGapTolerance = (uint16_t)json_object_get_number(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_READ_GAP_TOLERANCE);
+    }
+
+    DeviceConfig->WriteCoalesceWindow = MODBUS_DEFAULT_WRITE_COALESCE_WINDOW_MS;
+    if (json_object_has_value_of_type(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_WRITE_COALESCE_WINDOW, JSONNumber))
+    {
+        DeviceConfig->WriteCoalesceWindow = (uint16_t)json_object_get_number(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_WRITE_COALESCE_WINDOW);
+    }
+
+    DeviceConfig->BundleTelemetry = true;
+    if (json_object_has_value_of_type(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_BUNDLE_TELEMETRY, JSONBoolean))
+    {
+        DeviceConfig->BundleTelemetry = (1 == json_object_get_boolean(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_BUNDLE_TELEMETRY));
+    }
     JSON_Object* rtuArgs = json_object_get_object(AdapterComponentConfig, PNP_CONFIG_ADAPTER_INTERFACE_RTU);
     if (NULL != rtuArgs && ModbusPnp_ParseRtuSettings(DeviceConfig, rtuArgs) != IOTHUB_CLIENT_OK) {
         LogError("Failed to parse RTU connection settings.");
@@ -834,6 +1204,13 @@ IOTHUB_CLIENT_RESULT Modbus_DestroyPnpComponent(
         return IOTHUB_CLIENT_OK;
     }
 
+    ModbusPnp_DestroyReadPlan(deviceContext->ReadPlan);
+
+    if (NULL != deviceContext->Connection)
+    {
+        ModbusConnectionManager_Release(deviceContext->ConnectionManager, deviceContext->Connection);
+    }
+
     if (NULL != deviceContext->DeviceConfig)
     {
         free(deviceContext->DeviceConfig);
@@ -867,6 +1244,7 @@ Modbus_CreatePnpComponent(
         result = IOTHUB_CLIENT_ERROR;
         goto exit;
     }
+    deviceContext->hDevice = INVALID_FILE;
 
     if (strlen(ComponentName) > PNP_MAXIMUM_COMPONENT_LENGTH)
     {
@@ -925,215 +1303,38 @@ Modbus_CreatePnpComponent(
         goto exit;
     }
 
-    // Open the device
-    if (deviceConfig->ConnectionType == RTU)
+    // Open the device, or share the connection another device already opened to its serial port
+    // or TCP host
+    deviceContext->ConnectionManager = adapterContext->ConnectionManager;
+    result = ModbusConnectionManager_Acquire(deviceContext->ConnectionManager, deviceConfig,
+                &(deviceContext->Connection));
+    if (IOTHUB_CLIENT_OK != result)
     {
-        result = ModbusPnp_OpenSerial(&(deviceConfig->ConnectionConfig.RtuConfig), 
-                    &(deviceContext->hDevice));
-        if (IOTHUB_CLIENT_OK != result)
+        if (deviceConfig->ConnectionType == RTU)
         {
             LogError("Failed to open serial connection to \"%s\".", 
                         deviceConfig->ConnectionConfig.RtuConfig.Port);
-            goto exit;
         }
-    }
-    else if (deviceConfig->ConnectionType == TCP)
-    {
-        result = ModbusPnp_OpenSocket(&(deviceConfig->ConnectionConfig.TcpConfig), 
-                    (SOCKET*)&(deviceContext->hDevice));
-        if (IOTHUB_CLIENT_OK != result)
+        else
         {
             LogError("Failed to open socket connection to \"%s:%d\".", 
                 deviceConfig->ConnectionConfig.TcpConfig.Host, 
                 deviceConfig->ConnectionConfig.TcpConfig.Port);
-            goto exit;
         }
-    }
-    else
-    {
         goto exit;
     }
 
     deviceContext->DeviceConfig = deviceConfig;
+    deviceContext->TcpLink = deviceContext->Connection->TcpLink;
+    deviceContext->RtuBus = deviceContext->Connection->RtuBus;
 
-    // Set read requests for telemetry
-    if (NULL != deviceContext->InterfaceConfig->Events)
-    {
-        LIST_ITEM_HANDLE telemetryHandle = singlylinkedlist_get_head_item(deviceContext->InterfaceConfig->Events);
-
-        while (NULL != telemetryHandle) {
-            PModbusTelemetry telemetry = (PModbusTelemetry)singlylinkedlist_item_get_value(telemetryHandle);
-            result = ModbusPnp_SetReadRequest(deviceConfig, Telemetry, telemetry);
-            if (IOTHUB_CLIENT_OK != result)
-            {
-                LogError("Failed to create read request for telemetry \"%s\".", telemetry->Name);
-                return IOTHUB_CLIENT_INVALID_ARG;
-            }
-            telemetryHandle = singlylinkedlist_get_next_item(telemetryHandle);
-        }
-    }
-
-    // Set read requests for property
-    if (NULL != deviceContext->InterfaceConfig->Properties)
-    {
-        LIST_ITEM_HANDLE propertyhandle = singlylinkedlist_get_head_item(deviceContext->InterfaceConfig->Properties);
-
-        while (NULL != propertyhandle) {
-            PModbusProperty property = (PModbusProperty)singlylinkedlist_item_get_value(propertyhandle);
-            switch (deviceConfig->ConnectionType)
-            {
-                case TCP:
-                    property->WriteRequest.TcpRequest.MBAP.UnitID = deviceContext->DeviceConfig->UnitId;
-                    break;
-                case RTU:
-                    property->WriteRequest.RtuRequest.UnitID = deviceContext->DeviceConfig->UnitId;
-                    break;
-                default:
-                    break;
-            }
-
-            result = ModbusPnp_SetReadRequest(deviceConfig, Property, property);
-            if (IOTHUB_CLIENT_OK != result)
-            {
-                LogError("Failed to create read request for telemetry \"%s\".", property->Name);
-                return IOTHUB_CLIENT_INVALID_ARG;
-            }
-            propertyhandle = singlylinkedlist_get_next_item(propertyhandle);
-        }
-    }
-
-    // Set read requests for commands
-    if (NULL != deviceContext->InterfaceConfig->Commands)
-    {
-        LIST_ITEM_HANDLE commandHandle = singlylinkedlist_get_head_item(deviceContext->InterfaceConfig->Commands);
-
-        while (NULL != commandHandle) {
-            PModbusCommand command = (PModbusCommand)singlylinkedlist_item_get_value(commandHandle);
-            switch (deviceConfig->ConnectionType)
-            {
-                case TCP:
-                    command->WriteRequest.TcpRequest.MBAP.UnitID = deviceContext->DeviceConfig->UnitId;
-                    break;
-                case RTU:
-                    command->WriteRequest.RtuRequest.UnitID = deviceContext->DeviceConfig->UnitId;
-                    break;
-                default:
-                    break;
-            }
-            commandHandle = singlylinkedlist_get_next_item(commandHandle);
-        }
-    }
-
-    int propertyCount = 0;
-    int commandCount = 0;
-
-    // Construct a property table
-    if (NULL != deviceContext->InterfaceConfig->Properties)
-    {
-        MODBUS_PROPERTY_UPDATE_CALLBACK* propertyUpdateTable = NULL;
-        char** propertyNames = NULL;
-        SINGLYLINKEDLIST_HANDLE propertyList = deviceContext->InterfaceConfig->Properties;
-        propertyCount = ModbusPnp_GetListCount(deviceContext->InterfaceConfig->Properties);
-
-        int readWritePropertyCount = 0;
-        LIST_ITEM_HANDLE propertyItemHandle = NULL;
-        SINGLYLINKEDLIST_HANDLE readWritePropertyList = singlylinkedlist_create();
-
-        for (int i = 0; i < propertyCount; i++)
-        {
-            if (NULL == propertyItemHandle)
-            {
-                propertyItemHandle = singlylinkedlist_get_head_item(propertyList);
-            }
-            else
-            {
-                propertyItemHandle = singlylinkedlist_get_next_item(propertyItemHandle);
-            }
-
-            const ModbusProperty* property = singlylinkedlist_item_get_value(propertyItemHandle);
-
-            if (READ_WRITE == property->Access)
-            {
-                readWritePropertyCount++;
-                singlylinkedlist_add(readWritePropertyList, property);
-            }
-        }
-
-        if (readWritePropertyCount > 0)
-        {
-            propertyNames = calloc(1, sizeof(char*) * readWritePropertyCount);
-            if (NULL == propertyNames) {
-                result = IOTHUB_CLIENT_ERROR;
-                goto exit;
-            }
-
-            propertyUpdateTable = calloc(1, sizeof(MODBUS_PROPERTY_UPDATE_CALLBACK*) * readWritePropertyCount);
-            if (NULL == propertyUpdateTable) {
-                result = IOTHUB_CLIENT_ERROR;
-                goto exit;
-            }
-
-            propertyItemHandle = NULL;
-            for (int i = 0; i < readWritePropertyCount; i++)
-            {
-                if (NULL == propertyItemHandle)
-                {
-                    propertyItemHandle = singlylinkedlist_get_head_item(readWritePropertyList);
-                }
-                else
-                {
-                    propertyItemHandle = singlylinkedlist_get_next_item(propertyItemHandle);
-                }
-
-                const ModbusProperty* property = singlylinkedlist_item_get_value(propertyItemHandle);
-
-                propertyNames[i] = (char*)property->Name;
-                propertyUpdateTable[i] = ModbusPnp_PropertyHandler;
-            }
-        }
-    }
-
-    // Construct command table
-    if (NULL != deviceContext->InterfaceConfig->Commands)
+    // Group the reads of telemetry and properties into as few requests as possible. The blocks are
+    // worked out by the first device of the interface, and only encoded for the unit of the others.
+    result = ModbusPnp_CreateReadPlan(deviceConfig, deviceContext->InterfaceConfig, deviceConfig->ReadGapTolerance, &(deviceContext->ReadPlan));
+    if (IOTHUB_CLIENT_OK != result)
     {
-        char** commandNames = NULL;
-        MODBUS_COMMAND_EXECUTE_CALLBACK* commandUpdateTable = NULL;
-        SINGLYLINKEDLIST_HANDLE commandList = deviceContext->InterfaceConfig->Commands;
-        commandCount = ModbusPnp_GetListCount(commandList);
-
-        if (commandCount > 0)
-        {
-            commandNames = calloc(1, sizeof(char*) * commandCount);
-            if (NULL == commandNames) {
-                result = IOTHUB_CLIENT_ERROR;
-                goto exit;
-            }
-
-            commandUpdateTable = calloc(1, sizeof(MODBUS_COMMAND_EXECUTE_CALLBACK*) * commandCount);
-            if (NULL == commandUpdateTable) {
-                result = IOTHUB_CLIENT_ERROR;
-                goto exit;
-            }
-
-            LIST_ITEM_HANDLE commandItemHandle = NULL;
-            for (int i = 0; i < commandCount; i++)
-            {
-                if (NULL == commandItemHandle)
-                {
-                    commandItemHandle = singlylinkedlist_get_head_item(commandList);
-                }
-                else
-                {
-                    commandItemHandle = singlylinkedlist_get_next_item(commandItemHandle);
-                }
-
-                if (NULL != commandItemHandle) {
-                    const ModbusCommand* command = singlylinkedlist_item_get_value(commandItemHandle);
-                    commandNames[i] = (char*)command->Name;
-                    commandUpdateTable[i] = ModbusPnp_CommandHandler;
-                }
-            }
-        }
+        LogError("Failed to plan the reads of telemetry and properties.");
+        goto exit;
     }
 
     PnpComponentHandleSetContext(BridgeComponentHandle, deviceContext);
@@ -1143,6 +1344,11 @@ Modbus_CreatePnpComponent(
 exit:
     if (result != IOTHUB_CLIENT_OK)
     {
+        if (NULL != deviceContext && NULL != deviceContext->Connection)
+        {
+            ModbusConnectionManager_Release(deviceContext->ConnectionManager, deviceContext->Connection);
+            deviceContext->Connection = NULL;
+        }
         Modbus_DestroyPnpComponent(BridgeComponentHandle);
     }
 
@@ -1159,6 +1365,14 @@ IOTHUB_CLIENT_RESULT Modbus_StopPnpComponent(
 
     Modbus_CleanupPollingTasks(deviceContext);
 
+    // Other devices may still be using the connection, which closes with the last of them
+    if (NULL != deviceContext->Connection) {
+        ModbusConnectionManager_Release(deviceContext->ConnectionManager, deviceContext->Connection);
+        deviceContext->Connection = NULL;
+        deviceContext->TcpLink = NULL;
+        deviceContext->RtuBus = NULL;
+    }
+
     if (INVALID_FILE != deviceContext->hDevice) {
 
         ModbusPnp_CloseDevice(deviceContext->DeviceConfig->ConnectionType, deviceContext->hDevice, 
@@ -1175,7 +1389,7 @@ IOTHUB_CLIENT_RESULT Modbus_StopPnpComponent(
 #pragma endregion
 
 PNP_ADAPTER ModbusPnpInterface = {
-    .identity = "modbus-pnp-interface",
+    .identity = PNP_CONFIG_ADAPTER_MODBUS_ADAPTER_ID,
     .createAdapter = Modbus_CreatePnpAdapter,
     .createPnpComponent = Modbus_CreatePnpComponent,
     .startPnpComponent = Modbus_StartPnpComponent,
@@ -14,6 +14,7 @@ extern "C"
 #include "azure_c_shared_utility/lock.h"
 #include "azure_c_shared_utility/condition.h"
 #include <ctype.h>
+#include <stdbool.h>
 #ifdef WIN32
 #include <Windows.h>
 #include <cfgmgr32.h>
@@ -51,6 +52,7 @@ typedef int SOCKET;
 #endif
 
 #include "ModbusEnum.h"
+#include "ModbusConnection/ModbusBackoff.h"
 
     typedef struct _MODBUS_RTU_CONFIG
     {
@@ -65,6 +67,7 @@ typedef int SOCKET;
     {
         char* Host;
         uint16_t Port;
+        uint8_t TransactionWindow;      // Requests kept in flight on the connection
     } MODBUS_TCP_CONFIG;
 
     typedef union _MODBUS_CONNECTION_CONFIG
@@ -76,6 +79,9 @@ typedef int SOCKET;
     typedef struct ModbusDeviceConfig
     {
         uint8_t UnitId;
+        uint16_t ReadGapTolerance;
+        uint16_t WriteCoalesceWindow;   // Milliseconds writes wait for adjacent ones to go along with
+        bool BundleTelemetry;           // Sends the telemetry read in one poll as one message
         MODBUS_CONNECTION_TYPE ConnectionType;
         MODBUS_CONNECTION_CONFIG ConnectionConfig;
     } ModbusDeviceConfig, *PModbusDeviceConfig;
@@ -86,6 +92,10 @@ typedef int SOCKET;
         SINGLYLINKEDLIST_HANDLE Events;
         SINGLYLINKEDLIST_HANDLE Properties;
         SINGLYLINKEDLIST_HANDLE Commands;
+        struct _MODBUS_READ_TABLE* ReadTables;     // Compiled by the first device at each read gap tolerance
+        LOCK_HANDLE ReadTablesLock;                // Guards ReadTables, as devices may start at once
+        struct ModbusProperty* Fingerprint;        // Read by discovery to tell devices of the interface
+        const JSON_Value* FingerprintValue;        // from others, which hold this value in it. NULL for none.
     } ModbusInterfaceConfig, *PModbusInterfaceConfig;
 
     typedef struct _MODBUS_DEVICE_CONTEXT {
@@ -96,16 +106,25 @@ typedef int SOCKET;
 
         PModbusDeviceConfig DeviceConfig;
         PModbusInterfaceConfig InterfaceConfig;
-        THREAD_HANDLE* PollingTasks;
+        struct _MODBUS_READ_PLAN* ReadPlan;
+        struct _MODBUS_SCHEDULER* Scheduler;
+        struct _MODBUS_CONNECTION_MANAGER* ConnectionManager;
+        struct _MODBUS_CONNECTION* Connection;     // Shared with the other devices on the port or host
+        struct _MODBUS_TCP_LINK* TcpLink;
+        struct _MODBUS_RTU_BUS* RtuBus;
+        MODBUS_CIRCUIT_BREAKER PollBreaker;        // Suspends polling while the device keeps failing
         char * ComponentName;
         PNP_BRIDGE_IOT_TYPE ClientType;
     } MODBUS_DEVICE_CONTEXT, *PMODBUS_DEVICE_CONTEXT;
 
     typedef struct _MODBUS_ADAPTER_CONTEXT {
         SINGLYLINKEDLIST_HANDLE InterfaceDefinitions;
+        struct _MODBUS_CONNECTION_MANAGER* ConnectionManager;
     } MODBUS_ADAPTER_CONTEXT, * PMODBUS_ADAPTER_CONTEXT;
 
     int ModbusPnp_GetListCount(SINGLYLINKEDLIST_HANDLE list);
+    int ModbusPnp_OpenSerial(MODBUS_RTU_CONFIG* rtuConfig, HANDLE* serialHandle);
+    int ModbusPnp_OpenSocket(MODBUS_TCP_CONFIG* tcpConfig, SOCKET* socketHandle);
 
     typedef int(*MODBUS_COMMAND_EXECUTE_CALLBACK)(
         PNPBRIDGE_COMPONENT_HANDLE PnpComponentHandle,
@@ -122,10 +141,18 @@ typedef int SOCKET;
         void* userContextCallback);
 
     // Modbus Adapter Config
+    #define PNP_CONFIG_ADAPTER_MODBUS_ADAPTER_ID "modbus-pnp-interface"
     #define PNP_CONFIG_ADAPTER_MODBUS_IDENTITY "modbus_identity"
     #define PNP_CONFIG_ADAPTER_INTERFACE_UNITID "unit_id"
     #define PNP_CONFIG_ADAPTER_INTERFACE_TCP "tcp"
     #define PNP_CONFIG_ADAPTER_INTERFACE_RTU "rtu"
+    #define PNP_CONFIG_ADAPTER_INTERFACE_READ_GAP_TOLERANCE "read_gap_tolerance"
+    #define PNP_CONFIG_ADAPTER_INTERFACE_TRANSACTION_WINDOW "transaction_window"
+    #define PNP_CONFIG_ADAPTER_INTERFACE_WRITE_COALESCE_WINDOW "write_coalesce_window"
+    #define PNP_CONFIG_ADAPTER_INTERFACE_BUNDLE_TELEMETRY "bundle_telemetry"
+
+    // Modbus Adapter Global Config
+    #define PNP_CONFIG_ADAPTER_INTERFACE_FINGERPRINT "fingerprint"
 
     // TODO: Fix this missing reference
     #ifndef AZURE_UNREFERENCED_PARAMETER
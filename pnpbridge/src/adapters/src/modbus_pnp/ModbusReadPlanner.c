@@ -0,0 +1,315 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "azure_c_shared_utility/xlogging.h"
+
+#include "ModbusReadPlanner.h"
+#include "ModbusConnection/ModbusConnection.h"
+
+// A read of one capability, before it is merged into a block
+typedef struct _MODBUS_PLANNED_READ {
+    void* Capability;
+    CapabilityType Type;
+    uint8_t FunctionCode;
+    uint16_t Address;
+    uint16_t Quantity;
+    int Period;
+    MODBUS_ADAPTIVE_POLLING Polling;
+} MODBUS_PLANNED_READ;
+
+static bool ModbusPnp_IsBitRead(
+    uint8_t functionCode)
+{
+    return (ReadCoils == functionCode) || (ReadInputs == functionCode);
+}
+
+// Orders reads by period and adaptive bounds, then function code, then address, so that the reads a
+// block may merge are next to each other
+static int ModbusPnp_ComparePlannedReads(
+    const void* left,
+    const void* right)
+{
+    const MODBUS_PLANNED_READ* a = (const MODBUS_PLANNED_READ*)left;
+    const MODBUS_PLANNED_READ* b = (const MODBUS_PLANNED_READ*)right;
+
+    if (a->Period != b->Period)
+    {
+        return (a->Period < b->Period) ? -1 : 1;
+    }
+    if (a->Polling.MinInterval != b->Polling.MinInterval)
+    {
+        return (a->Polling.MinInterval < b->Polling.MinInterval) ? -1 : 1;
+    }
+    if (a->Polling.MaxInterval != b->Polling.MaxInterval)
+    {
+        return (a->Polling.MaxInterval < b->Polling.MaxInterval) ? -1 : 1;
+    }
+    if (a->FunctionCode != b->FunctionCode)
+    {
+        return (a->FunctionCode < b->FunctionCode) ? -1 : 1;
+    }
+    if (a->Address != b->Address)
+    {
+        return (a->Address < b->Address) ? -1 : 1;
+    }
+    return 0;
+}
+
+static IOTHUB_CLIENT_RESULT ModbusPnp_SetPlannedRead(
+    MODBUS_PLANNED_READ* read,
+    void* capability,
+    CapabilityType capabilityType,
+    const char* name,
+    const char* startAddress,
+    uint16_t length,
+    int period,
+    const MODBUS_ADAPTIVE_POLLING* polling)
+{
+    read->Capability = capability;
+    read->Type = capabilityType;
+    read->Quantity = length;
+    read->Period = period;
+    read->Polling = *polling;
+
+    if (!ModbusConnectionHelper_GetFunctionCode(startAddress, true, &(read->FunctionCode), &(read->Address)))
+    {
+        LogError("Failed to get Modbus function code for capability \"%s\".", name);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    uint16_t maxQuantity = ModbusPnp_IsBitRead(read->FunctionCode) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+    if (0 == length || length > maxQuantity)
+    {
+        LogError("Length %d of capability \"%s\" cannot be read in one request.", length, name);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
+static void ModbusPnp_DestroyReadTable(
+    MODBUS_READ_TABLE* table)
+{
+    if (NULL == table)
+    {
+        return;
+    }
+
+    free(table->Capabilities);
+    free(table->Blocks);
+    free(table);
+}
+
+// Groups the telemetry and properties of an interface into blocks, which a device only has to
+// encode the requests of
+static IOTHUB_CLIENT_RESULT ModbusPnp_CompileReadTable(
+    const ModbusInterfaceConfig* interfaceConfig,
+    uint16_t gapTolerance,
+    MODBUS_READ_TABLE** readTable)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    MODBUS_PLANNED_READ* reads = NULL;
+    MODBUS_READ_TABLE* table = NULL;
+    int readCount = 0;
+
+    int capabilityCount = ModbusPnp_GetListCount(interfaceConfig->Events) + ModbusPnp_GetListCount(interfaceConfig->Properties);
+
+    table = calloc(1, sizeof(MODBUS_READ_TABLE));
+    if (NULL == table)
+    {
+        LogError("Could not allocate memory for read table.");
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+    table->GapTolerance = gapTolerance;
+
+    if (0 == capabilityCount)
+    {
+        goto exit;
+    }
+
+    reads = calloc(capabilityCount, sizeof(MODBUS_PLANNED_READ));
+    table->Capabilities = calloc(capabilityCount, sizeof(MODBUS_BLOCK_CAPABILITY));
+    table->Blocks = calloc(capabilityCount, sizeof(MODBUS_READ_BLOCK));
+    if (NULL == reads || NULL == table->Capabilities || NULL == table->Blocks)
+    {
+        LogError("Could not allocate memory for read table.");
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    if (NULL != interfaceConfig->Events)
+    {
+        LIST_ITEM_HANDLE telemetryItem = singlylinkedlist_get_head_item(interfaceConfig->Events);
+        while (NULL != telemetryItem)
+        {
+            ModbusTelemetry* telemetry = (ModbusTelemetry*)singlylinkedlist_item_get_value(telemetryItem);
+            result = ModbusPnp_SetPlannedRead(&reads[readCount++], telemetry, Telemetry, telemetry->Name,
+                telemetry->StartAddress, telemetry->Length, telemetry->DefaultFrequency, &(telemetry->Polling));
+            if (IOTHUB_CLIENT_OK != result)
+            {
+                goto exit;
+            }
+            telemetryItem = singlylinkedlist_get_next_item(telemetryItem);
+        }
+    }
+
+    if (NULL != interfaceConfig->Properties)
+    {
+        LIST_ITEM_HANDLE propertyItem = singlylinkedlist_get_head_item(interfaceConfig->Properties);
+        while (NULL != propertyItem)
+        {
+            ModbusProperty* property = (ModbusProperty*)singlylinkedlist_item_get_value(propertyItem);
+            result = ModbusPnp_SetPlannedRead(&reads[readCount++], property, Property, property->Name,
+                property->StartAddress, property->Length, property->DefaultFrequency, &(property->Polling));
+            if (IOTHUB_CLIENT_OK != result)
+            {
+                goto exit;
+            }
+            propertyItem = singlylinkedlist_get_next_item(propertyItem);
+        }
+    }
+
+    qsort(reads, readCount, sizeof(MODBUS_PLANNED_READ), ModbusPnp_ComparePlannedReads);
+
+    // Sweep the sorted reads, growing the current block while the next read is close enough and
+    // the block stays within the quantity limit of a single request. The capabilities of a block
+    // are then the run of sorted reads it took in.
+    for (int i = 0; i < readCount; i++)
+    {
+        const MODBUS_PLANNED_READ* read = &reads[i];
+        MODBUS_READ_BLOCK* block = (table->BlockCount > 0) ? &(table->Blocks[table->BlockCount - 1]) : NULL;
+        uint32_t readEnd = (uint32_t)read->Address + read->Quantity;
+
+        table->Capabilities[i].Capability = read->Capability;
+        table->Capabilities[i].Type = read->Type;
+
+        if (NULL != block && block->Period == read->Period && block->MinInterval == read->Polling.MinInterval &&
+            block->MaxInterval == read->Polling.MaxInterval && block->FunctionCode == read->FunctionCode)
+        {
+            uint32_t blockEnd = (uint32_t)block->StartAddress + block->Quantity;
+            uint32_t maxQuantity = ModbusPnp_IsBitRead(read->FunctionCode) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+            uint32_t end = (readEnd > blockEnd) ? readEnd : blockEnd;
+
+            if ((uint32_t)read->Address <= blockEnd + gapTolerance && end - block->StartAddress <= maxQuantity)
+            {
+                block->Quantity = (uint16_t)(end - block->StartAddress);
+                block->CapabilityCount++;
+                table->Capabilities[i].Offset = (uint16_t)(read->Address - block->StartAddress);
+                continue;
+            }
+        }
+
+        block = &(table->Blocks[table->BlockCount++]);
+        block->FunctionCode = read->FunctionCode;
+        block->StartAddress = read->Address;
+        block->Quantity = read->Quantity;
+        block->Period = read->Period;
+        block->MinInterval = read->Polling.MinInterval;
+        block->MaxInterval = read->Polling.MaxInterval;
+        block->CapabilityCount = 1;
+        block->Capabilities = &(table->Capabilities[i]);
+    }
+    table->CapabilityCount = readCount;
+
+exit:
+    free(reads);
+    if (IOTHUB_CLIENT_OK != result)
+    {
+        ModbusPnp_DestroyReadTable(table);
+        table = NULL;
+    }
+    *readTable = table;
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT ModbusPnp_CreateReadPlan(
+    const ModbusDeviceConfig* deviceConfig,
+    ModbusInterfaceConfig* interfaceConfig,
+    uint16_t gapTolerance,
+    MODBUS_READ_PLAN** readPlan)
+{
+    *readPlan = NULL;
+
+    Lock(interfaceConfig->ReadTablesLock);
+    MODBUS_READ_TABLE* table = interfaceConfig->ReadTables;
+    while (NULL != table && table->GapTolerance != gapTolerance)
+    {
+        table = table->Next;
+    }
+
+    if (NULL == table)
+    {
+        IOTHUB_CLIENT_RESULT result = ModbusPnp_CompileReadTable(interfaceConfig, gapTolerance, &table);
+        if (IOTHUB_CLIENT_OK != result)
+        {
+            Unlock(interfaceConfig->ReadTablesLock);
+            return result;
+        }
+        table->Next = interfaceConfig->ReadTables;
+        interfaceConfig->ReadTables = table;
+    }
+    // A table is never changed once compiled, so the plan is made from it without the lock
+    Unlock(interfaceConfig->ReadTablesLock);
+
+    // The values follow the blocks, at an offset that keeps them aligned
+    size_t valuesOffset = sizeof(MODBUS_READ_PLAN) + table->BlockCount * sizeof(MODBUS_READ_BLOCK);
+    valuesOffset = (valuesOffset + sizeof(double) - 1) / sizeof(double) * sizeof(double);
+
+    MODBUS_READ_PLAN* plan = malloc(valuesOffset + table->CapabilityCount * sizeof(double));
+    if (NULL == plan)
+    {
+        LogError("Could not allocate memory for read plan.");
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    plan->Table = table;
+    plan->UnitId = deviceConfig->UnitId;
+    plan->BlockCount = table->BlockCount;
+    plan->Blocks = (MODBUS_READ_BLOCK*)(plan + 1);
+    plan->LastValues = (double*)((uint8_t*)plan + valuesOffset);
+    for (int c = 0; c < table->CapabilityCount; c++)
+    {
+        plan->LastValues[c] = NAN;
+    }
+    for (int b = 0; b < plan->BlockCount; b++)
+    {
+        MODBUS_READ_BLOCK* block = &(plan->Blocks[b]);
+        *block = table->Blocks[b];
+        ModbusPnp_EncodeReadRequest(deviceConfig->ConnectionType, &(block->ReadRequest), block->FunctionCode,
+            block->StartAddress, block->Quantity, deviceConfig->UnitId);
+    }
+
+    LogInfo("Modbus Adapter: Reading %d capabilities of unit %d in %d block reads.",
+        table->CapabilityCount, deviceConfig->UnitId, plan->BlockCount);
+
+    *readPlan = plan;
+    return IOTHUB_CLIENT_OK;
+}
+
+double* ModbusPnp_GetBlockLastValues(
+    const MODBUS_READ_PLAN* readPlan,
+    const MODBUS_READ_BLOCK* block)
+{
+    return readPlan->LastValues + (block->Capabilities - readPlan->Table->Capabilities);
+}
+
+void ModbusPnp_DestroyReadPlan(
+    MODBUS_READ_PLAN* readPlan)
+{
+    free(readPlan);
+}
+
+void ModbusPnp_DestroyReadTables(
+    ModbusInterfaceConfig* interfaceConfig)
+{
+    while (NULL != interfaceConfig->ReadTables)
+    {
+        MODBUS_READ_TABLE* table = interfaceConfig->ReadTables;
+        interfaceConfig->ReadTables = table->Next;
+        ModbusPnp_DestroyReadTable(table);
+    }
+}
@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusPnp.h"
+#include "ModbusCapability.h"
+
+// Largest quantities a single read may ask for, from the Modbus application protocol specification
+#define MODBUS_MAX_READ_REGISTERS 125
+#define MODBUS_MAX_READ_BITS 2000
+
+// Largest read response: the MBAP header, function code and byte count followed by 250 bytes of
+// data. An RTU response, with a one byte header and a CRC, is shorter.
+#define MODBUS_BLOCK_RESPONSE_MAX_LENGTH 260
+
+// Registers or bits that may be read in between two capabilities, and thrown away, to read them in
+// one request rather than two
+#define MODBUS_DEFAULT_READ_GAP_TOLERANCE 0
+
+typedef struct _MODBUS_BLOCK_CAPABILITY {
+    void* Capability;
+    CapabilityType Type;
+    uint16_t Offset;            // Registers or bits from the start of the block
+} MODBUS_BLOCK_CAPABILITY;
+
+// A block is one read request covering capabilities that share a function code and a polling
+// period, with its adaptive bounds. Each capability is decoded from the block's response at its
+// offset.
+typedef struct _MODBUS_READ_BLOCK {
+    uint8_t FunctionCode;
+    uint16_t StartAddress;
+    uint16_t Quantity;          // Registers, or bits for coils and discrete inputs
+    int Period;
+    int MinInterval;            // The period adapts between these when they differ
+    int MaxInterval;
+    MODBUS_READ_REQUEST ReadRequest;
+    int CapabilityCount;
+    const MODBUS_BLOCK_CAPABILITY* Capabilities;
+} MODBUS_READ_BLOCK;
+
+// The blocks of an interface at one gap tolerance, compiled for the first device of a
+// modbus_identity and shared, unchanged, by the other devices with the same read_gap_tolerance.
+// Its blocks have no read request, which depends on the device.
+typedef struct _MODBUS_READ_TABLE {
+    uint16_t GapTolerance;
+    int CapabilityCount;
+    MODBUS_BLOCK_CAPABILITY* Capabilities;  // Of every block, in block order
+    int BlockCount;
+    MODBUS_READ_BLOCK* Blocks;
+    struct _MODBUS_READ_TABLE* Next;
+} MODBUS_READ_TABLE;
+
+// The reads of one device: the blocks of its table, with their requests encoded for its unit, and
+// the last value read of each capability of the table. The plan is allocated along with its blocks
+// and values, which are not to be freed on their own.
+typedef struct _MODBUS_READ_PLAN {
+    const MODBUS_READ_TABLE* Table;
+    uint8_t UnitId;
+    int BlockCount;
+    MODBUS_READ_BLOCK* Blocks;
+    double* LastValues;         // In the order of Table->Capabilities, NAN until read
+} MODBUS_READ_PLAN;
+
+// Plans the reads of a device from the table of its interface for gapTolerance, which groups the
+// telemetry and properties into as few block reads as the quantity limits allow, merging
+// capabilities at most gapTolerance registers or bits apart. The table is compiled the first time,
+// under the ReadTablesLock of the interface.
+IOTHUB_CLIENT_RESULT ModbusPnp_CreateReadPlan(
+    const ModbusDeviceConfig* deviceConfig,
+    ModbusInterfaceConfig* interfaceConfig,
+    uint16_t gapTolerance,
+    MODBUS_READ_PLAN** readPlan);
+
+// The last values of the capabilities of one block of a plan
+double* ModbusPnp_GetBlockLastValues(
+    const MODBUS_READ_PLAN* readPlan,
+    const MODBUS_READ_BLOCK* block);
+
+void ModbusPnp_DestroyReadPlan(
+    MODBUS_READ_PLAN* readPlan);
+
+// Frees the tables compiled for an interface, once no read plan uses them
+void ModbusPnp_DestroyReadTables(
+    ModbusInterfaceConfig* interfaceConfig);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,734 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusScheduler.h"
+#include "ModbusCapability.h"
+#include "ModbusConnection/ModbusConnection.h"
+
+// Deadline of a block that is read once, when its period is not positive
+#define MODBUS_SCHEDULER_NO_DEADLINE UINT64_MAX
+
+typedef struct _MODBUS_POLL_ENTRY {
+    PMODBUS_DEVICE_CONTEXT Device;
+    CapabilityContext* Context;         // Shared by the entries of a device
+    const MODBUS_READ_BLOCK* Block;
+    double* LastValues;                 // Of the capabilities of the block, in the read plan
+    int Interval;                       // Current period of an adaptive block, only used by the worker
+    uint64_t Deadline;                  // Absolute time the next read of the block is due
+    bool Removed;
+} MODBUS_POLL_ENTRY;
+
+// A request of a pass on its way, covering one or more due blocks of a device
+typedef struct _MODBUS_POLL_READ {
+    MODBUS_POLL_ENTRY** Entries;
+    int EntryCount;
+    const MODBUS_READ_BLOCK* Block;     // The block of the only entry, or MergedBlock
+    MODBUS_READ_BLOCK MergedBlock;
+    MODBUS_PENDING_READ Pending;
+    uint8_t Response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+} MODBUS_POLL_READ;
+
+typedef struct _MODBUS_SCHEDULER {
+    char* ConnectionName;
+    LOCK_HANDLE Lock;
+    COND_HANDLE WorkChanged;            // Signalled when devices come and go, and on destroy
+    COND_HANDLE PassDone;               // Signalled when the worker finishes a pass over due reads
+    THREAD_HANDLE Worker;
+    TICK_COUNTER_HANDLE TickCounter;
+    bool Running;
+    bool InPass;
+
+    // Entries may only be added or compacted while the worker is not in a pass
+    int EntryCount;
+    int EntryCapacity;
+    MODBUS_POLL_ENTRY* Entries;
+    MODBUS_POLL_ENTRY** Due;
+    MODBUS_POLL_ENTRY** Group;
+
+    int PipelineDepth;
+    MODBUS_POLL_READ* Reads;
+
+    uint64_t StartTime;
+    uint64_t NextReport;
+    uint64_t GovernedTime;              // Start of the utilization window of the bus governor
+    uint64_t GovernedBusTimeMs;
+    MODBUS_SCHEDULER_STATISTICS Statistics;
+    MODBUS_SCHEDULER_STATISTICS Reported;
+} MODBUS_SCHEDULER;
+
+static uint64_t ModbusScheduler_Now(
+    MODBUS_SCHEDULER* scheduler)
+{
+    tickcounter_ms_t now = 0;
+    (void)tickcounter_get_current_ms(scheduler->TickCounter, &now);
+    return (uint64_t)now;
+}
+
+static bool ModbusScheduler_IsBitRead(
+    uint8_t functionCode)
+{
+    return (ReadCoils == functionCode) || (ReadInputs == functionCode);
+}
+
+// Orders due reads earliest deadline first, then by address
+static int ModbusScheduler_CompareDueEntries(
+    const void* left,
+    const void* right)
+{
+    const MODBUS_POLL_ENTRY* a = *(const MODBUS_POLL_ENTRY* const*)left;
+    const MODBUS_POLL_ENTRY* b = *(const MODBUS_POLL_ENTRY* const*)right;
+
+    if (a->Deadline != b->Deadline)
+    {
+        return (a->Deadline < b->Deadline) ? -1 : 1;
+    }
+    if (a->Block->StartAddress != b->Block->StartAddress)
+    {
+        return (a->Block->StartAddress < b->Block->StartAddress) ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool ModbusScheduler_IsAdaptive(
+    const MODBUS_READ_BLOCK* block)
+{
+    return block->Period > 0 && block->MinInterval < block->MaxInterval;
+}
+
+// Shortens the interval of an adaptive block whose values move fast and lengthens it while they
+// hold steady, within the bounds of the block
+static void ModbusScheduler_Adapt(
+    MODBUS_POLL_ENTRY* entry,
+    MODBUS_BLOCK_CHANGE change)
+{
+    const MODBUS_READ_BLOCK* block = entry->Block;
+
+    if (!ModbusScheduler_IsAdaptive(block))
+    {
+        return;
+    }
+
+    if (MODBUS_BLOCK_STEADY == change)
+    {
+        entry->Interval = (entry->Interval > block->MaxInterval / 2) ? block->MaxInterval : 2 * entry->Interval;
+    }
+    else if (MODBUS_BLOCK_MOVING_FAST == change)
+    {
+        entry->Interval = (entry->Interval / 2 < block->MinInterval) ? block->MinInterval : entry->Interval / 2;
+    }
+}
+
+// Moves the deadline of a block that was just read to its next period, skipping and counting the
+// periods that went by before the read completed
+static void ModbusScheduler_AdvanceDeadline(
+    MODBUS_SCHEDULER* scheduler,
+    MODBUS_POLL_ENTRY* entry,
+    uint64_t now)
+{
+    if (entry->Block->Period <= 0)
+    {
+        entry->Deadline = MODBUS_SCHEDULER_NO_DEADLINE;
+        return;
+    }
+
+    uint64_t period = (uint64_t)entry->Block->Period;
+    if (ModbusScheduler_IsAdaptive(entry->Block))
+    {
+        // The governor stretches the interval, though never past the longest the block allows
+        period = (uint64_t)entry->Interval * scheduler->Statistics.ThrottlePercent / 100;
+        if (period > (uint64_t)entry->Block->MaxInterval)
+        {
+            period = (uint64_t)entry->Block->MaxInterval;
+        }
+    }
+
+    entry->Deadline += period;
+    if (entry->Deadline < now)
+    {
+        uint64_t missed = (now - entry->Deadline + period - 1) / period;
+        scheduler->Statistics.MissedDeadlines += missed;
+        entry->Deadline += missed * period;
+    }
+}
+
+// Measures the utilization of the connection since the last call, and stretches the intervals of
+// adaptive blocks by as much as it is over budget, or lets them shrink back as much as it is under.
+// Called with the scheduler lock held.
+static void ModbusScheduler_Govern(
+    MODBUS_SCHEDULER* scheduler,
+    uint64_t now)
+{
+    uint64_t elapsed = now - scheduler->GovernedTime;
+    uint64_t busTime = scheduler->Statistics.BusTimeMs - scheduler->GovernedBusTimeMs;
+    uint32_t previous = scheduler->Statistics.ThrottlePercent;
+
+    uint64_t throttle = (uint64_t)previous * busTime * 100 / (elapsed * MODBUS_SCHEDULER_BUS_BUDGET_PERCENT);
+    if (throttle < 100)
+    {
+        throttle = 100;
+    }
+    else if (throttle > MODBUS_SCHEDULER_MAX_THROTTLE_PERCENT)
+    {
+        throttle = MODBUS_SCHEDULER_MAX_THROTTLE_PERCENT;
+    }
+    scheduler->Statistics.ThrottlePercent = (uint32_t)throttle;
+
+    if (100 == previous && throttle > 100)
+    {
+        LogInfo("Modbus Adapter: Connection %s was busy %.1f%% of the last %d ms, throttling adaptive polling.",
+            scheduler->ConnectionName, 100.0 * (double)busTime / (double)elapsed, (int)elapsed);
+    }
+    else if (previous > 100 && 100 == throttle)
+    {
+        LogInfo("Modbus Adapter: Connection %s is no longer throttling adaptive polling.", scheduler->ConnectionName);
+    }
+
+    scheduler->GovernedTime = now;
+    scheduler->GovernedBusTimeMs = scheduler->Statistics.BusTimeMs;
+}
+
+static void ModbusScheduler_ReportStatistics(
+    MODBUS_SCHEDULER* scheduler,
+    uint64_t now)
+{
+    MODBUS_SCHEDULER_STATISTICS* current = &(scheduler->Statistics);
+    MODBUS_SCHEDULER_STATISTICS* reported = &(scheduler->Reported);
+
+    current->ElapsedMs = now - scheduler->StartTime;
+    uint64_t elapsed = current->ElapsedMs - reported->ElapsedMs;
+    uint64_t busTime = current->BusTimeMs - reported->BusTimeMs;
+    uint64_t missed = current->MissedDeadlines - reported->MissedDeadlines;
+
+    if (elapsed > 0)
+    {
+        LogInfo("Modbus Adapter: Connection %s was busy %.1f%% of the last %d s, %d requests for %d block reads, %d missed deadlines.",
+            scheduler->ConnectionName, 100.0 * (double)busTime / (double)elapsed, (int)(elapsed / 1000),
+            (int)(current->Transactions - reported->Transactions), (int)(current->BlockReads - reported->BlockReads), (int)missed);
+    }
+
+    *reported = *current;
+    scheduler->NextReport = now + MODBUS_SCHEDULER_REPORT_INTERVAL_MS;
+}
+
+// Starts the request for a group of due blocks of one device, which reads from startAddress to
+// cover all of them
+static void ModbusScheduler_BeginRead(
+    MODBUS_POLL_READ* read,
+    MODBUS_POLL_ENTRY** entries,
+    int entryCount,
+    uint16_t startAddress,
+    uint16_t quantity)
+{
+    PMODBUS_DEVICE_CONTEXT device = entries[0]->Device;
+
+    read->Entries = entries;
+    read->EntryCount = entryCount;
+    read->Block = entries[0]->Block;
+
+    if (entryCount > 1)
+    {
+        memset(&(read->MergedBlock), 0, sizeof(read->MergedBlock));
+        read->MergedBlock.FunctionCode = read->Block->FunctionCode;
+        read->MergedBlock.StartAddress = startAddress;
+        read->MergedBlock.Quantity = quantity;
+        ModbusPnp_EncodeReadRequest(device->DeviceConfig->ConnectionType, &(read->MergedBlock.ReadRequest),
+            read->MergedBlock.FunctionCode, startAddress, quantity, device->DeviceConfig->UnitId);
+        read->Block = &(read->MergedBlock);
+    }
+
+    ModbusPnp_BeginReadBlock(entries[0]->Context, read->Block, read->Response, sizeof(read->Response), &(read->Pending));
+}
+
+// Waits for the response to a request, then reports the capabilities of each block it covers
+static void ModbusScheduler_EndRead(
+    MODBUS_SCHEDULER* scheduler,
+    MODBUS_POLL_READ* read)
+{
+    int responseLength = ModbusPnp_EndReadBlock(&(read->Pending));
+    uint64_t end = ModbusScheduler_Now(scheduler);
+    PMODBUS_DEVICE_CONTEXT device = read->Entries[0]->Device;
+
+    if (responseLength > 0)
+    {
+        for (int i = 0; i < read->EntryCount; i++)
+        {
+            MODBUS_POLL_ENTRY* entry = read->Entries[i];
+            MODBUS_BLOCK_CHANGE change = ModbusPnp_ReportBlock(entry->Context, entry->Block, read->Response,
+                read->Block->StartAddress, entry->LastValues);
+            ModbusScheduler_Adapt(entry, change);
+        }
+
+        if (ModbusCircuitBreaker_RecordSuccess(&(device->PollBreaker)))
+        {
+            LogInfo("Modbus Adapter: Resuming polling of %s on connection %s.", device->ComponentName, scheduler->ConnectionName);
+        }
+    }
+    else if (ModbusCircuitBreaker_RecordFailure(&(device->PollBreaker), end))
+    {
+        LogError("Modbus Adapter: Suspending polling of %s on connection %s for %d ms after %d failed reads.",
+            device->ComponentName, scheduler->ConnectionName, (int)(device->PollBreaker.RetryTime - end),
+            device->PollBreaker.ConsecutiveFailures);
+    }
+
+    Lock(scheduler->Lock);
+    scheduler->Statistics.Transactions++;
+    scheduler->Statistics.BlockReads += read->EntryCount;
+    for (int i = 0; i < read->EntryCount; i++)
+    {
+        ModbusScheduler_AdvanceDeadline(scheduler, read->Entries[i], end);
+    }
+    Unlock(scheduler->Lock);
+}
+
+// Issues the reads in the due list earliest deadline first. Each read takes along the other due
+// blocks of its device that one request can cover, and up to the pipeline depth of reads are in
+// flight at once. Called without the scheduler lock held, while InPass keeps the entries in place.
+static void ModbusScheduler_ReadDue(
+    MODBUS_SCHEDULER* scheduler,
+    int dueCount)
+{
+    MODBUS_POLL_ENTRY** due = scheduler->Due;
+    int depth = scheduler->PipelineDepth;
+    int groupedCount = 0;
+    int started = 0;
+    int ended = 0;
+
+    qsort(due, dueCount, sizeof(MODBUS_POLL_ENTRY*), ModbusScheduler_CompareDueEntries);
+
+    uint64_t passStart = ModbusScheduler_Now(scheduler);
+    for (int first = 0; first < dueCount; first++)
+    {
+        if (NULL == due[first])
+        {
+            continue;
+        }
+
+        const MODBUS_READ_BLOCK* block = due[first]->Block;
+        PMODBUS_DEVICE_CONTEXT device = due[first]->Device;
+        uint32_t gapTolerance = device->DeviceConfig->ReadGapTolerance;
+        uint32_t maxQuantity = ModbusScheduler_IsBitRead(block->FunctionCode) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+        uint32_t start = block->StartAddress;
+        uint32_t end = start + block->Quantity;
+        MODBUS_POLL_ENTRY** group = scheduler->Group + groupedCount;
+        int groupCount = 0;
+
+        group[groupCount++] = due[first];
+        due[first] = NULL;
+
+        // Taking a block in may bring another within reach, so sweep until the span stops growing
+        bool grown = true;
+        while (grown)
+        {
+            grown = false;
+            for (int i = first + 1; i < dueCount; i++)
+            {
+                if (NULL == due[i] || due[i]->Device != device || due[i]->Block->FunctionCode != block->FunctionCode)
+                {
+                    continue;
+                }
+
+                uint32_t nextStart = due[i]->Block->StartAddress;
+                uint32_t nextEnd = nextStart + due[i]->Block->Quantity;
+                uint32_t mergedStart = (nextStart < start) ? nextStart : start;
+                uint32_t mergedEnd = (nextEnd > end) ? nextEnd : end;
+
+                if (nextStart <= end + gapTolerance && start <= nextEnd + gapTolerance &&
+                    mergedEnd - mergedStart <= maxQuantity)
+                {
+                    start = mergedStart;
+                    end = mergedEnd;
+                    group[groupCount++] = due[i];
+                    due[i] = NULL;
+                    grown = true;
+                }
+            }
+        }
+        groupedCount += groupCount;
+
+        // A device removed during the pass is not read again
+        Lock(scheduler->Lock);
+        bool removed = group[0]->Removed;
+        Unlock(scheduler->Lock);
+
+        if (removed)
+        {
+            continue;
+        }
+
+        if (started - ended == depth)
+        {
+            ModbusScheduler_EndRead(scheduler, &(scheduler->Reads[ended % depth]));
+            ended++;
+        }
+
+        // A suspended device is next due when its circuit breaker lets a trial read through
+        if (!ModbusCircuitBreaker_Allow(&(device->PollBreaker), ModbusScheduler_Now(scheduler)))
+        {
+            Lock(scheduler->Lock);
+            for (int i = 0; i < groupCount; i++)
+            {
+                group[i]->Deadline = device->PollBreaker.RetryTime;
+            }
+            scheduler->Statistics.SuspendedReads += groupCount;
+            Unlock(scheduler->Lock);
+            continue;
+        }
+
+        ModbusScheduler_BeginRead(&(scheduler->Reads[started % depth]), group, groupCount, (uint16_t)start, (uint16_t)(end - start));
+        started++;
+    }
+
+    while (ended < started)
+    {
+        ModbusScheduler_EndRead(scheduler, &(scheduler->Reads[ended % depth]));
+        ended++;
+    }
+
+    // The telemetry a device bundles goes out once every read of the pass has been reported
+    for (int i = 0; i < groupedCount; i++)
+    {
+        ModbusPnp_SendTelemetryBundle(scheduler->Group[i]->Context);
+    }
+
+    if (started > 0)
+    {
+        uint64_t passEnd = ModbusScheduler_Now(scheduler);
+        Lock(scheduler->Lock);
+        scheduler->Statistics.BusTimeMs += passEnd - passStart;
+        Unlock(scheduler->Lock);
+    }
+}
+
+static int ModbusScheduler_Worker(
+    void* param)
+{
+    MODBUS_SCHEDULER* scheduler = (MODBUS_SCHEDULER*)param;
+
+    Lock(scheduler->Lock);
+    while (scheduler->Running)
+    {
+        uint64_t now = ModbusScheduler_Now(scheduler);
+        if (now >= scheduler->NextReport)
+        {
+            ModbusScheduler_ReportStatistics(scheduler, now);
+        }
+        if (now >= scheduler->GovernedTime + MODBUS_SCHEDULER_GOVERNOR_INTERVAL_MS)
+        {
+            ModbusScheduler_Govern(scheduler, now);
+        }
+
+        uint64_t earliest = MODBUS_SCHEDULER_NO_DEADLINE;
+        for (int i = 0; i < scheduler->EntryCount; i++)
+        {
+            if (!scheduler->Entries[i].Removed && scheduler->Entries[i].Deadline < earliest)
+            {
+                earliest = scheduler->Entries[i].Deadline;
+            }
+        }
+
+        if (earliest > now)
+        {
+            uint64_t wait = scheduler->NextReport - now;
+            if (earliest - now < wait)
+            {
+                wait = earliest - now;
+            }
+            (void)Condition_Wait(scheduler->WorkChanged, scheduler->Lock, (int)wait);
+            continue;
+        }
+
+        // Earliest deadline first, taking along every read due within the merge window
+        int dueCount = 0;
+        for (int i = 0; i < scheduler->EntryCount; i++)
+        {
+            MODBUS_POLL_ENTRY* entry = &(scheduler->Entries[i]);
+            if (!entry->Removed && entry->Deadline <= earliest + MODBUS_SCHEDULER_MERGE_WINDOW_MS)
+            {
+                scheduler->Due[dueCount++] = entry;
+            }
+        }
+
+        scheduler->InPass = true;
+        Unlock(scheduler->Lock);
+
+        ModbusScheduler_ReadDue(scheduler, dueCount);
+
+        Lock(scheduler->Lock);
+        scheduler->InPass = false;
+        (void)Condition_Post(scheduler->PassDone);
+    }
+    Unlock(scheduler->Lock);
+
+    ThreadAPI_Exit(THREADAPI_OK);
+    return 0;
+}
+
+// Waits until the worker is between passes, so that entries may be changed. Called with the
+// scheduler lock held.
+static void ModbusScheduler_WaitForPass(
+    MODBUS_SCHEDULER* scheduler)
+{
+    while (scheduler->InPass)
+    {
+        (void)Condition_Wait(scheduler->PassDone, scheduler->Lock, 0);
+    }
+
+    // Pass the wake-up on to anyone else waiting for the same pass
+    (void)Condition_Post(scheduler->PassDone);
+}
+
+MODBUS_SCHEDULER_HANDLE ModbusScheduler_Create(
+    const char* connectionName,
+    int pipelineDepth)
+{
+    MODBUS_SCHEDULER* scheduler = calloc(1, sizeof(MODBUS_SCHEDULER));
+    if (NULL == scheduler)
+    {
+        LogError("Could not allocate memory for Modbus scheduler.");
+        return NULL;
+    }
+
+    if (0 != mallocAndStrcpy_s(&(scheduler->ConnectionName), connectionName))
+    {
+        LogError("Could not allocate memory for Modbus scheduler.");
+        goto fail;
+    }
+
+    scheduler->PipelineDepth = (pipelineDepth < 1) ? 1 : pipelineDepth;
+    scheduler->Reads = calloc(scheduler->PipelineDepth, sizeof(MODBUS_POLL_READ));
+    if (NULL == scheduler->Reads)
+    {
+        LogError("Could not allocate memory for Modbus scheduler.");
+        goto fail;
+    }
+
+    scheduler->Lock = Lock_Init();
+    scheduler->WorkChanged = Condition_Init();
+    scheduler->PassDone = Condition_Init();
+    scheduler->TickCounter = tickcounter_create();
+    if (NULL == scheduler->Lock || NULL == scheduler->WorkChanged || NULL == scheduler->PassDone ||
+        NULL == scheduler->TickCounter)
+    {
+        LogError("Could not initialize Modbus scheduler.");
+        goto fail;
+    }
+
+    scheduler->StartTime = ModbusScheduler_Now(scheduler);
+    scheduler->NextReport = scheduler->StartTime + MODBUS_SCHEDULER_REPORT_INTERVAL_MS;
+    scheduler->GovernedTime = scheduler->StartTime;
+    scheduler->Statistics.ThrottlePercent = 100;
+    scheduler->Running = true;
+
+    if (THREADAPI_OK != ThreadAPI_Create(&(scheduler->Worker), ModbusScheduler_Worker, scheduler))
+    {
+        LogError("Failed to create Modbus scheduler worker thread for connection %s.", connectionName);
+        goto fail;
+    }
+
+    return scheduler;
+
+fail:
+    scheduler->Worker = NULL;
+    ModbusScheduler_Destroy(scheduler);
+    return NULL;
+}
+
+void ModbusScheduler_Destroy(
+    MODBUS_SCHEDULER_HANDLE scheduler)
+{
+    if (NULL == scheduler)
+    {
+        return;
+    }
+
+    if (NULL != scheduler->Worker)
+    {
+        Lock(scheduler->Lock);
+        scheduler->Running = false;
+        (void)Condition_Post(scheduler->WorkChanged);
+        Unlock(scheduler->Lock);
+
+        int res = 0;
+        if (THREADAPI_OK != ThreadAPI_Join(scheduler->Worker, &res))
+        {
+            LogError("Failed to stop Modbus scheduler worker thread.");
+        }
+    }
+
+    if (NULL != scheduler->TickCounter)
+    {
+        tickcounter_destroy(scheduler->TickCounter);
+    }
+    if (NULL != scheduler->PassDone)
+    {
+        Condition_Deinit(scheduler->PassDone);
+    }
+    if (NULL != scheduler->WorkChanged)
+    {
+        Condition_Deinit(scheduler->WorkChanged);
+    }
+    if (NULL != scheduler->Lock)
+    {
+        Lock_Deinit(scheduler->Lock);
+    }
+    free(scheduler->Entries);
+    free(scheduler->Due);
+    free(scheduler->Group);
+    free(scheduler->Reads);
+    free(scheduler->ConnectionName);
+    free(scheduler);
+}
+
+IOTHUB_CLIENT_RESULT ModbusScheduler_AddDevice(
+    MODBUS_SCHEDULER_HANDLE scheduler,
+    PMODBUS_DEVICE_CONTEXT deviceContext)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    const MODBUS_READ_PLAN* readPlan = deviceContext->ReadPlan;
+
+    if (0 == readPlan->BlockCount)
+    {
+        return IOTHUB_CLIENT_OK;
+    }
+
+    // The entries of a device share the context its capabilities are reported with
+    CapabilityContext* context = calloc(1, sizeof(CapabilityContext));
+    if (NULL == context)
+    {
+        LogError("Could not allocate memory for polling capability context.");
+        return IOTHUB_CLIENT_ERROR;
+    }
+    ModbusCircuitBreaker_Init(&(deviceContext->PollBreaker), MODBUS_CIRCUIT_BREAKER_FAILURE_THRESHOLD,
+        MODBUS_CIRCUIT_BREAKER_INITIAL_DELAY_MS, MODBUS_CIRCUIT_BREAKER_MAX_DELAY_MS);
+
+    context->hDevice = deviceContext->hDevice;
+    context->hLock = deviceContext->hConnectionLock;
+    context->tcpLink = deviceContext->TcpLink;
+    context->rtuBus = deviceContext->RtuBus;
+    context->connectionType = deviceContext->DeviceConfig->ConnectionType;
+    context->clientHandle = deviceContext->ClientHandle;
+    context->clientType = deviceContext->ClientType;
+    context->componentName = deviceContext->ComponentName;
+
+    if (deviceContext->DeviceConfig->BundleTelemetry)
+    {
+        context->telemetryBundle = calloc(1, sizeof(MODBUS_TELEMETRY_BUNDLE));
+        if (NULL == context->telemetryBundle)
+        {
+            LogError("Could not allocate memory for telemetry bundle.");
+            free(context);
+            return IOTHUB_CLIENT_ERROR;
+        }
+    }
+
+    Lock(scheduler->Lock);
+    ModbusScheduler_WaitForPass(scheduler);
+
+    int count = scheduler->EntryCount + readPlan->BlockCount;
+    if (count > scheduler->EntryCapacity)
+    {
+        MODBUS_POLL_ENTRY* entries = realloc(scheduler->Entries, count * sizeof(MODBUS_POLL_ENTRY));
+        if (NULL != entries)
+        {
+            scheduler->Entries = entries;
+        }
+        MODBUS_POLL_ENTRY** due = realloc(scheduler->Due, count * sizeof(MODBUS_POLL_ENTRY*));
+        if (NULL != due)
+        {
+            scheduler->Due = due;
+        }
+        MODBUS_POLL_ENTRY** group = realloc(scheduler->Group, count * sizeof(MODBUS_POLL_ENTRY*));
+        if (NULL != group)
+        {
+            scheduler->Group = group;
+        }
+        if (NULL == entries || NULL == due || NULL == group)
+        {
+            LogError("Could not allocate memory for Modbus scheduler entries.");
+            free(context->telemetryBundle);
+            free(context);
+            result = IOTHUB_CLIENT_ERROR;
+            goto exit;
+        }
+        scheduler->EntryCapacity = count;
+    }
+
+    uint64_t now = ModbusScheduler_Now(scheduler);
+    for (int i = 0; i < readPlan->BlockCount; i++)
+    {
+        MODBUS_POLL_ENTRY* entry = &(scheduler->Entries[scheduler->EntryCount++]);
+        entry->Device = deviceContext;
+        entry->Context = context;
+        entry->Block = &(readPlan->Blocks[i]);
+        entry->LastValues = ModbusPnp_GetBlockLastValues(readPlan, entry->Block);
+        entry->Interval = entry->Block->Period;
+        entry->Deadline = now;
+        entry->Removed = false;
+    }
+
+    LogInfo("Modbus Adapter: Polling %d block reads of %s on connection %s.",
+        readPlan->BlockCount, deviceContext->ComponentName, scheduler->ConnectionName);
+    (void)Condition_Post(scheduler->WorkChanged);
+
+exit:
+    Unlock(scheduler->Lock);
+    return result;
+}
+
+void ModbusScheduler_RemoveDevice(
+    MODBUS_SCHEDULER_HANDLE scheduler,
+    PMODBUS_DEVICE_CONTEXT deviceContext)
+{
+    CapabilityContext* context = NULL;
+
+    Lock(scheduler->Lock);
+
+    // Marking the entries first keeps the worker from starting another read of the device while
+    // the current pass finishes
+    for (int i = 0; i < scheduler->EntryCount; i++)
+    {
+        if (scheduler->Entries[i].Device == deviceContext)
+        {
+            scheduler->Entries[i].Removed = true;
+        }
+    }
+
+    ModbusScheduler_WaitForPass(scheduler);
+
+    int kept = 0;
+    for (int i = 0; i < scheduler->EntryCount; i++)
+    {
+        if (scheduler->Entries[i].Device == deviceContext)
+        {
+            context = scheduler->Entries[i].Context;
+            continue;
+        }
+        scheduler->Entries[kept++] = scheduler->Entries[i];
+    }
+    scheduler->EntryCount = kept;
+
+    Unlock(scheduler->Lock);
+
+    if (NULL != context && NULL != context->telemetryBundle)
+    {
+        free(context->telemetryBundle->Data);
+        free(context->telemetryBundle);
+    }
+    free(context);
+}
+
+void ModbusScheduler_GetStatistics(
+    MODBUS_SCHEDULER_HANDLE scheduler,
+    MODBUS_SCHEDULER_STATISTICS* statistics)
+{
+    Lock(scheduler->Lock);
+    scheduler->Statistics.ElapsedMs = ModbusScheduler_Now(scheduler) - scheduler->StartTime;
+    *statistics = scheduler->Statistics;
+    Unlock(scheduler->Lock);
+}
@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusPnp.h"
+#include "ModbusReadPlanner.h"
+
+// Reads due within this many milliseconds of the earliest deadline are issued in the same pass,
+// and adjacent blocks of one device among them are read with a single request
+#define MODBUS_SCHEDULER_MERGE_WINDOW_MS 20
+
+// How often the scheduler logs bus utilization and missed deadlines
+#define MODBUS_SCHEDULER_REPORT_INTERVAL_MS (5 * 60 * 1000)
+
+// The bus governor measures the utilization of the connection over this many milliseconds, and
+// stretches the intervals of adaptive blocks in proportion to how far it is over budget
+#define MODBUS_SCHEDULER_GOVERNOR_INTERVAL_MS 1000
+#define MODBUS_SCHEDULER_BUS_BUDGET_PERCENT 80
+#define MODBUS_SCHEDULER_MAX_THROTTLE_PERCENT 1600
+
+typedef struct _MODBUS_SCHEDULER* MODBUS_SCHEDULER_HANDLE;
+
+typedef struct _MODBUS_SCHEDULER_STATISTICS {
+    uint64_t Transactions;      // Requests sent on the bus
+    uint64_t BlockReads;        // Blocks read, more than Transactions when blocks were merged
+    uint64_t MissedDeadlines;   // Periods skipped because a block was not read before its next one was due
+    uint64_t SuspendedReads;    // Block reads skipped because polling of their device was suspended
+    uint64_t BusTimeMs;         // Time with reads in progress, waiting for the bus and the devices
+    uint64_t ElapsedMs;         // Time since the scheduler started
+    uint32_t ThrottlePercent;   // Stretch of adaptive intervals by the bus governor, 100 for none
+} MODBUS_SCHEDULER_STATISTICS;
+
+// A scheduler owns the polling of one physical connection. A single worker thread reads the
+// blocks of every device added to it, earliest deadline first, so that reads on the connection
+// never compete with each other. Up to pipelineDepth reads are in flight at once, which only a
+// pipelined TCP link makes use of.
+MODBUS_SCHEDULER_HANDLE ModbusScheduler_Create(
+    const char* connectionName,
+    int pipelineDepth);
+
+// Stops the worker thread. Every device must have been removed.
+void ModbusScheduler_Destroy(
+    MODBUS_SCHEDULER_HANDLE scheduler);
+
+// Starts polling the read plan of a device. Every block is first due right away. Polling of the
+// device is suspended, with a circuit breaker, while its reads keep failing. A block with a
+// MinInterval below its MaxInterval is read twice as often while its values move fast, and half
+// as often while they stay within their deadbands.
+IOTHUB_CLIENT_RESULT ModbusScheduler_AddDevice(
+    MODBUS_SCHEDULER_HANDLE scheduler,
+    PMODBUS_DEVICE_CONTEXT deviceContext);
+
+// Stops polling a device, leaving the other devices of the connection alone. Returns once no read
+// of the device is in progress, after which its context may be freed.
+void ModbusScheduler_RemoveDevice(
+    MODBUS_SCHEDULER_HANDLE scheduler,
+    PMODBUS_DEVICE_CONTEXT deviceContext);
+
+void ModbusScheduler_GetStatistics(
+    MODBUS_SCHEDULER_HANDLE scheduler,
+    MODBUS_SCHEDULER_STATISTICS* statistics);
+
+#ifdef __cplusplus
+}
+#endif
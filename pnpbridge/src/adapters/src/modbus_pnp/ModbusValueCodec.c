@@ -0,0 +1,560 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ModbusValueCodec.h"
+
+// Significant digits that always read back as the same float or double (FLT_DECIMAL_DIG and
+// DBL_DECIMAL_DIG, which C99 does not have)
+#define MODBUS_FLOAT32_ROUND_TRIP_DIGITS 9
+#define MODBUS_FLOAT64_ROUND_TRIP_DIGITS 17
+
+// Puts the bytes of the registers together into the bits of the value. With a constant number of
+// bytes the loop unrolls into shifts and ors.
+static uint64_t ModbusValueCodec_Gather(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data,
+    int bytes)
+{
+    uint64_t raw = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        raw |= (uint64_t)data[i] << codec->Shifts[i];
+    }
+    return raw;
+}
+
+static double ModbusValueCodec_DecodeUInt16(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    return (double)ModbusValueCodec_Gather(codec, data, 2);
+}
+
+static double ModbusValueCodec_DecodeUInt32(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    return (double)ModbusValueCodec_Gather(codec, data, 4);
+}
+
+static double ModbusValueCodec_DecodeUInt48(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    return (double)ModbusValueCodec_Gather(codec, data, 6);
+}
+
+static double ModbusValueCodec_DecodeUInt64(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    return (double)ModbusValueCodec_Gather(codec, data, 8);
+}
+
+static double ModbusValueCodec_DecodeInt16(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    return (double)(int16_t)(uint16_t)ModbusValueCodec_Gather(codec, data, 2);
+}
+
+static double ModbusValueCodec_DecodeInt32(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    return (double)(int32_t)(uint32_t)ModbusValueCodec_Gather(codec, data, 4);
+}
+
+static double ModbusValueCodec_DecodeFloat32(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    uint32_t bits = (uint32_t)ModbusValueCodec_Gather(codec, data, 4);
+    float value = 0;
+    memcpy(&value, &bits, sizeof(value));
+    return (double)value;
+}
+
+static double ModbusValueCodec_DecodeFloat64(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data)
+{
+    uint64_t bits = ModbusValueCodec_Gather(codec, data, 8);
+    double value = 0;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint16_t ModbusValueCodec_GetRegisterCount(
+    ModbusDataType dataType)
+{
+    switch (dataType)
+    {
+        case INT16:
+            return 1;
+        case INT32:
+        case UINT32:
+        case FLOAT32:
+            return 2;
+        case FLOAT64:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+bool ModbusValueCodec_Init(
+    MODBUS_VALUE_CODEC* codec,
+    ModbusDataType dataType,
+    uint16_t length,
+    MODBUS_BYTE_ORDER wordOrder,
+    MODBUS_BYTE_ORDER byteOrder)
+{
+    uint16_t registers = ModbusValueCodec_GetRegisterCount(dataType);
+
+    memset(codec, 0, sizeof(MODBUS_VALUE_CODEC));
+    codec->DataType = dataType;
+    codec->Precision = DBL_DIG;
+    switch (dataType)
+    {
+        case NUMERIC:
+        {
+            // An unsigned value of as many registers as the capability has, up to 4
+            static const MODBUS_VALUE_DECODE_KERNEL unsignedKernels[4] = {
+                ModbusValueCodec_DecodeUInt16,
+                ModbusValueCodec_DecodeUInt32,
+                ModbusValueCodec_DecodeUInt48,
+                ModbusValueCodec_DecodeUInt64
+            };
+            registers = (length < 4) ? length : 4;
+            if (0 == registers)
+            {
+                return false;
+            }
+            codec->Decode = unsignedKernels[registers - 1];
+            break;
+        }
+        case INT16:
+            codec->Decode = ModbusValueCodec_DecodeInt16;
+            break;
+        case INT32:
+            codec->Decode = ModbusValueCodec_DecodeInt32;
+            break;
+        case UINT32:
+            codec->Decode = ModbusValueCodec_DecodeUInt32;
+            break;
+        case FLOAT32:
+            codec->Decode = ModbusValueCodec_DecodeFloat32;
+            codec->Precision = FLT_DIG;
+            break;
+        case FLOAT64:
+            codec->Decode = ModbusValueCodec_DecodeFloat64;
+            break;
+        default:
+            return false;
+    }
+
+    if (length < registers)
+    {
+        codec->Decode = NULL;
+        return false;
+    }
+
+    codec->Registers = (uint8_t)registers;
+    for (int i = 0; i < registers * 2; i++)
+    {
+        int word = i / 2;
+        int byte = i % 2;
+        int wordSignificance = (MODBUS_BIG_ENDIAN == wordOrder) ? (registers - 1 - word) : word;
+        int byteSignificance = (MODBUS_BIG_ENDIAN == byteOrder) ? (1 - byte) : byte;
+        codec->Shifts[i] = (uint8_t)(wordSignificance * 16 + byteSignificance * 8);
+    }
+
+    return true;
+}
+
+// Writes the digits of a whole number, returning how many
+static int ModbusValueCodec_FormatDigits(
+    uint64_t value,
+    int minDigits,
+    char* result)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0 || count < minDigits);
+
+    for (int i = 0; i < count; i++)
+    {
+        result[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+static const double ModbusValueCodec_PowersOf10[] = {
+    1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17
+};
+static const uint64_t ModbusValueCodec_Scales[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL
+};
+
+// Whether a magnitude is a whole number of up to precision digits, which is written out as it is
+static bool ModbusValueCodec_IsShortWholeNumber(
+    double magnitude,
+    int precision)
+{
+    return magnitude < ModbusValueCodec_PowersOf10[4 + precision] && magnitude == (double)(uint64_t)magnitude;
+}
+
+// Rounds a magnitude to precision significant digits, like %g does, into scaled, of which the last
+// decimals digits are after the point. Only done as long as %g would not use an exponent: the value
+// is at least 1e-4 and has at most precision digits before the point.
+static bool ModbusValueCodec_RoundDigits(
+    double magnitude,
+    int precision,
+    uint64_t* scaled,
+    int* decimals)
+{
+    int exponent = -4;
+    if (!(magnitude >= ModbusValueCodec_PowersOf10[0] && magnitude < ModbusValueCodec_PowersOf10[4 + precision]))
+    {
+        return false;
+    }
+
+    while (magnitude >= ModbusValueCodec_PowersOf10[exponent + 5])
+    {
+        exponent++;
+    }
+
+    // The rounding error of the scaling is taken into account, so that the last digit is
+    // rounded from the exact value, half to even, as printf rounds it
+    *decimals = precision - 1 - exponent;
+    double scale = (double)ModbusValueCodec_Scales[*decimals];
+    double product = magnitude * scale;
+    double error = fma(magnitude, scale, -product);
+    double whole = floor(product);
+    double fraction = (product - whole) + error;
+    *scaled = (uint64_t)whole;
+    if (fraction > 0.5 || (0.5 == fraction && 1 == (*scaled & 1)))
+    {
+        (*scaled)++;
+    }
+
+    // Rounded up to one more digit before the point, which %g writes with an exponent
+    return *scaled < ModbusValueCodec_Scales[precision];
+}
+
+int ModbusValueCodec_FormatNumber(
+    double value,
+    int precision,
+    char* result,
+    size_t resultSize)
+{
+    // NaN and infinities have no JSON representation
+    if (value != value || value > DBL_MAX || value < -DBL_MAX)
+    {
+        return snprintf(result, resultSize, "null");
+    }
+
+    if (resultSize < MODBUS_VALUE_MAX_LENGTH || precision < 1 || precision > 15)
+    {
+        return snprintf(result, resultSize, "%.*g", precision, value);
+    }
+
+    int length = 0;
+    double magnitude = (value < 0) ? -value : value;
+    if (value < 0)
+    {
+        result[length++] = '-';
+    }
+
+    // Whole numbers of up to precision digits, which most registers hold, are written out as they are
+    if (ModbusValueCodec_IsShortWholeNumber(magnitude, precision))
+    {
+        length += ModbusValueCodec_FormatDigits((uint64_t)magnitude, 1, result + length);
+        result[length] = '\0';
+        return length;
+    }
+
+    uint64_t scaled = 0;
+    int decimals = 0;
+    if (ModbusValueCodec_RoundDigits(magnitude, precision, &scaled, &decimals))
+    {
+        // Trailing zeros of the decimals are left out
+        while (decimals > 0 && 0 == scaled % 10)
+        {
+            scaled /= 10;
+            decimals--;
+        }
+
+        length += ModbusValueCodec_FormatDigits(scaled / ModbusValueCodec_Scales[decimals], 1, result + length);
+        if (decimals > 0)
+        {
+            result[length++] = '.';
+            length += ModbusValueCodec_FormatDigits(scaled % ModbusValueCodec_Scales[decimals], decimals, result + length);
+        }
+        result[length] = '\0';
+        return length;
+    }
+
+    return snprintf(result, resultSize, "%.*g", precision, value);
+}
+
+// Fewest digits, precision at least, with which a finite value reads back as itself. Float32 values
+// only need to read back as the same float. Where the digits are rounded without printf, they are
+// read back without strtod: the digits and the power of 10 they are divided by are exact doubles,
+// so their quotient is the double nearest the number, as strtod would have it.
+static int ModbusValueCodec_RoundTripPrecision(
+    double value,
+    int precision,
+    bool single)
+{
+    int maxPrecision = single ? MODBUS_FLOAT32_ROUND_TRIP_DIGITS : MODBUS_FLOAT64_ROUND_TRIP_DIGITS;
+    double magnitude = (value < 0) ? -value : value;
+
+    // A float reads back from any number nearer to it than to the floats next to it. Halfway
+    // between two floats is a double; a number right on it reads back as the float with an even
+    // significand, which is left to strtof.
+    float f = (float)magnitude;
+    double low = 0;
+    double high = 0;
+    if (single)
+    {
+        low = ((double)f + (double)nextafterf(f, 0)) / 2;
+        high = ((double)f + (double)nextafterf(f, INFINITY)) / 2;
+    }
+
+    for (; precision < maxPrecision; precision++)
+    {
+        uint64_t scaled = 0;
+        int decimals = 0;
+        if (precision <= 15 && ModbusValueCodec_IsShortWholeNumber(magnitude, precision))
+        {
+            break;
+        }
+        if (precision <= 15 && ModbusValueCodec_RoundDigits(magnitude, precision, &scaled, &decimals))
+        {
+            double number = (double)scaled / (double)ModbusValueCodec_Scales[decimals];
+            if (!single)
+            {
+                if (number == magnitude)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (number != low && number != high)
+            {
+                if (number > low && number < high)
+                {
+                    break;
+                }
+                continue;
+            }
+        }
+
+        char formatted[MODBUS_VALUE_MAX_LENGTH];
+        if (snprintf(formatted, sizeof(formatted), "%.*g", precision, magnitude) < (int)sizeof(formatted) &&
+            (single ? (strtof(formatted, NULL) == f) : (strtod(formatted, NULL) == magnitude)))
+        {
+            break;
+        }
+    }
+
+    return precision;
+}
+
+int ModbusValueCodec_Format(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data,
+    double conversionCoefficient,
+    char* result,
+    size_t resultSize)
+{
+    int precision = codec->Precision;
+    if (NUMERIC == codec->DataType)
+    {
+        // Counters are written out from their bits, as a double holds whole numbers exactly only
+        // up to 2^53 and 4 registers go beyond that
+        uint64_t counter = ModbusValueCodec_Gather(codec, data, codec->Registers * 2);
+        if (1 == conversionCoefficient && resultSize >= MODBUS_VALUE_MAX_LENGTH)
+        {
+            int length = ModbusValueCodec_FormatDigits(counter, 1, result);
+            result[length] = '\0';
+            return length;
+        }
+
+        // Scaled ones keep the digits of the counter, as far as a double has them
+        for (uint64_t limit = 1000000000000000ULL; precision < MODBUS_FLOAT64_ROUND_TRIP_DIGITS && counter >= limit; limit *= 10)
+        {
+            precision++;
+        }
+    }
+
+    // As many digits as the value in the registers needs to read back exactly, Precision at least,
+    // so that no digits are lost and none are made up. Scaling adds no digits of its own: 2357
+    // scaled by 0.01 is 23.57, and not the 23.570000000000000284 the multiplication gives.
+    double decoded = codec->Decode(codec, data);
+    if (isfinite(decoded))
+    {
+        precision = ModbusValueCodec_RoundTripPrecision(decoded, precision, FLOAT32 == codec->DataType);
+    }
+
+    return ModbusValueCodec_FormatNumber(decoded * conversionCoefficient, precision, result, resultSize);
+}
+
+// Whether only white space is left after a number
+static bool ModbusValueCodec_IsEnd(
+    const char* end)
+{
+    while (isspace((unsigned char)*end))
+    {
+        end++;
+    }
+    return '\0' == *end;
+}
+
+// Parses a whole number of bits bits, signed or not, into its two's complement. Numbers with
+// decimals or an exponent are rounded to the nearest whole number, half away from zero.
+static bool ModbusValueCodec_ParseWholeNumber(
+    const char* valueStr,
+    int bits,
+    bool isSigned,
+    uint64_t* raw)
+{
+    const char* start = valueStr;
+    char* end = NULL;
+
+    while (isspace((unsigned char)*start))
+    {
+        start++;
+    }
+
+    errno = 0;
+    if (isSigned)
+    {
+        long long value = strtoll(start, &end, 10);
+        int64_t max = (int64_t)((UINT64_C(1) << (bits - 1)) - 1);
+        if (end != start && ('.' == *end || 'e' == *end || 'E' == *end))
+        {
+            double rounded = strtod(start, &end);
+            rounded = trunc((rounded < 0) ? (rounded - 0.5) : (rounded + 0.5));
+            if (!(rounded >= -ldexp(1, bits - 1) && rounded < ldexp(1, bits - 1)))
+            {
+                return false;
+            }
+            value = (long long)rounded;
+        }
+        else if (ERANGE == errno || value < -max - 1 || value > max)
+        {
+            return false;
+        }
+        *raw = (uint64_t)(int64_t)value;
+    }
+    else
+    {
+        // strtoull takes a minus sign and negates the value
+        if ('-' == *start)
+        {
+            return false;
+        }
+        unsigned long long value = strtoull(start, &end, 10);
+        uint64_t max = (64 == bits) ? UINT64_MAX : ((UINT64_C(1) << bits) - 1);
+        if (end != start && ('.' == *end || 'e' == *end || 'E' == *end))
+        {
+            double rounded = trunc(strtod(start, &end) + 0.5);
+            if (!(rounded >= 0 && rounded < ldexp(1, bits)))
+            {
+                return false;
+            }
+            value = (unsigned long long)rounded;
+        }
+        else if (ERANGE == errno || value > max)
+        {
+            return false;
+        }
+        *raw = (uint64_t)value;
+    }
+
+    return end != start && ModbusValueCodec_IsEnd(end);
+}
+
+bool ModbusValueCodec_Encode(
+    const MODBUS_VALUE_CODEC* codec,
+    const char* valueStr,
+    uint16_t* values)
+{
+    uint64_t raw = 0;
+    char* end = NULL;
+
+    // Values out of the range of the type, or followed by anything but white space, are rejected
+    // rather than truncated
+    switch (codec->DataType)
+    {
+        case FLOAT32:
+        {
+            errno = 0;
+            float value = strtof(valueStr, &end);
+            if (end == valueStr || !ModbusValueCodec_IsEnd(end) || (ERANGE == errno && isinf(value)))
+            {
+                return false;
+            }
+            uint32_t bits = 0;
+            memcpy(&bits, &value, sizeof(bits));
+            raw = bits;
+            break;
+        }
+        case FLOAT64:
+        {
+            errno = 0;
+            double value = strtod(valueStr, &end);
+            if (end == valueStr || !ModbusValueCodec_IsEnd(end) || (ERANGE == errno && isinf(value)))
+            {
+                return false;
+            }
+            memcpy(&raw, &value, sizeof(raw));
+            break;
+        }
+        case INT16:
+        case INT32:
+            if (!ModbusValueCodec_ParseWholeNumber(valueStr, codec->Registers * 16, true, &raw))
+            {
+                return false;
+            }
+            break;
+        default:
+            // UINT32, and NUMERIC, which is unsigned in as many registers as it is decoded from
+            if (!ModbusValueCodec_ParseWholeNumber(valueStr, codec->Registers * 16, false, &raw))
+            {
+                return false;
+            }
+            break;
+    }
+
+    uint8_t bytes[8];
+    for (int i = 0; i < codec->Registers * 2; i++)
+    {
+        bytes[i] = (uint8_t)((raw >> codec->Shifts[i]) & 0xff);
+    }
+    for (int i = 0; i < codec->Registers; i++)
+    {
+        values[i] = (uint16_t)((bytes[i * 2] << 8) | bytes[i * 2 + 1]);
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ModbusEnum.h"
+
+// Longest number the codec formats, sign and exponent included
+#define MODBUS_VALUE_MAX_LENGTH 32
+
+typedef enum MODBUS_BYTE_ORDER
+{
+    MODBUS_BIG_ENDIAN,          // Most significant first, as the Modbus specification has it
+    MODBUS_LITTLE_ENDIAN
+} MODBUS_BYTE_ORDER;
+
+struct _MODBUS_VALUE_CODEC;
+
+typedef double(*MODBUS_VALUE_DECODE_KERNEL)(
+    const struct _MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data);
+
+// How a numeric capability is laid out in its registers. The kernel and the position of each byte
+// are worked out once, from the configuration, so that decoding a value does not branch on its
+// type or order.
+typedef struct _MODBUS_VALUE_CODEC {
+    MODBUS_VALUE_DECODE_KERNEL Decode;
+    ModbusDataType DataType;
+    uint8_t Registers;          // Registers the value is decoded from
+    uint8_t Shifts[8];          // Bit position in the value of each byte of its registers
+    uint8_t Precision;          // Fewest significant digits a value that is not a whole number is
+                                // formatted with, more being used where it would not read back
+} MODBUS_VALUE_CODEC;
+
+// Returns the registers a value of the data type spans, or 0 if it depends on the length
+uint16_t ModbusValueCodec_GetRegisterCount(
+    ModbusDataType dataType);
+
+// Sets up the codec of a capability of length registers. Returns false for a data type that is
+// not numeric, or a length too short for it.
+bool ModbusValueCodec_Init(
+    MODBUS_VALUE_CODEC* codec,
+    ModbusDataType dataType,
+    uint16_t length,
+    MODBUS_BYTE_ORDER wordOrder,
+    MODBUS_BYTE_ORDER byteOrder);
+
+// Decodes the value from the data of its registers, scales it by the coefficient and formats it
+// as a JSON number into result, returning its length. The number has the fewest digits that read
+// back as the value, and counters that are not scaled are written out exactly.
+int ModbusValueCodec_Format(
+    const MODBUS_VALUE_CODEC* codec,
+    const uint8_t* data,
+    double conversionCoefficient,
+    char* result,
+    size_t resultSize);
+
+// Formats a number as JSON, as "%.*g" with precision significant digits does, and values that are
+// not finite as null. Numbers that need no exponent, which are most, are formatted without printf.
+int ModbusValueCodec_FormatNumber(
+    double value,
+    int precision,
+    char* result,
+    size_t resultSize);
+
+// Encodes a value given as text into the registers of the codec. Returns false for text that is
+// not a number, is followed by anything but white space, or is out of the range of the data type.
+bool ModbusValueCodec_Encode(
+    const MODBUS_VALUE_CODEC* codec,
+    const char* valueStr,
+    uint16_t* values);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,399 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusWriteQueue.h"
+
+typedef struct _MODBUS_QUEUED_WRITE {
+    MODBUS_WRITE Write;
+    int Index;                          // Order of arrival among the writes sent with it
+    bool Waited;                        // Freed by the writer, once Done, rather than by the worker
+    bool Done;
+    COND_HANDLE Completed;              // Signalled when Done is set; only the writer waits on it
+    IOTHUB_CLIENT_RESULT Result;
+} MODBUS_QUEUED_WRITE;
+
+typedef struct _MODBUS_WRITE_QUEUE {
+    char* ConnectionName;
+    CapabilityContext Context;
+    int WindowMs;
+    LOCK_HANDLE Lock;
+    COND_HANDLE Changed;                // Signalled when writes are queued, and on destroy
+    THREAD_HANDLE Worker;
+    TICK_COUNTER_HANDLE TickCounter;
+    bool Running;
+    bool FlushNow;                      // A writer is waiting, so the window is cut short
+
+    MODBUS_QUEUED_WRITE** Pending;      // In order of arrival
+    int PendingCount;
+    int PendingCapacity;
+    uint64_t FirstQueued;               // Time the first of the pending writes was queued
+
+    MODBUS_WRITE_QUEUE_STATISTICS Statistics;
+} MODBUS_WRITE_QUEUE;
+
+static uint64_t ModbusWriteQueue_Now(
+    MODBUS_WRITE_QUEUE* queue)
+{
+    tickcounter_ms_t now = 0;
+    (void)tickcounter_get_current_ms(queue->TickCounter, &now);
+    return (uint64_t)now;
+}
+
+static void ModbusWriteQueue_FreeWrite(
+    MODBUS_QUEUED_WRITE* queued)
+{
+    if (NULL != queued->Completed)
+    {
+        Condition_Deinit(queued->Completed);
+    }
+    free(queued);
+}
+
+// Orders writes by unit, kind and address, so that the ones that can be coalesced come together
+static int ModbusWriteQueue_CompareAddresses(
+    const void* left,
+    const void* right)
+{
+    const MODBUS_WRITE* a = &((*(const MODBUS_QUEUED_WRITE* const*)left)->Write);
+    const MODBUS_WRITE* b = &((*(const MODBUS_QUEUED_WRITE* const*)right)->Write);
+
+    if (a->UnitId != b->UnitId)
+    {
+        return (a->UnitId < b->UnitId) ? -1 : 1;
+    }
+    if (a->FunctionCode != b->FunctionCode)
+    {
+        return (a->FunctionCode < b->FunctionCode) ? -1 : 1;
+    }
+    if (a->Address != b->Address)
+    {
+        return (a->Address < b->Address) ? -1 : 1;
+    }
+    return (*(const MODBUS_QUEUED_WRITE* const*)left)->Index - (*(const MODBUS_QUEUED_WRITE* const*)right)->Index;
+}
+
+static int ModbusWriteQueue_CompareArrival(
+    const void* left,
+    const void* right)
+{
+    return (*(const MODBUS_QUEUED_WRITE* const*)left)->Index - (*(const MODBUS_QUEUED_WRITE* const*)right)->Index;
+}
+
+// Largest number of coils or registers one write request may carry
+static int ModbusWriteQueue_MaxQuantity(
+    uint8_t functionCode)
+{
+    return (WriteCoil == functionCode) ? MODBUS_MAX_WRITE_COILS : MODBUS_MAX_WRITE_REGISTERS;
+}
+
+// Sends a batch of writes, in as few requests as the adjacent ones among them allow
+static void ModbusWriteQueue_Send(
+    MODBUS_WRITE_QUEUE* queue,
+    MODBUS_QUEUED_WRITE** batch,
+    int count,
+    MODBUS_WRITE_QUEUE_STATISTICS* sent)
+{
+    MODBUS_WRITE merged;
+
+    for (int i = 0; i < count; i++)
+    {
+        batch[i]->Index = i;
+    }
+    qsort(batch, count, sizeof(MODBUS_QUEUED_WRITE*), ModbusWriteQueue_CompareAddresses);
+
+    int first = 0;
+    while (first < count)
+    {
+        const MODBUS_WRITE* write = &(batch[first]->Write);
+        uint32_t start = write->Address;
+        uint32_t end = start + write->Quantity;
+
+        // Take along the writes of the unit that touch or overlap the range so far, as long as they
+        // fit in one request
+        int last = first + 1;
+        while (last < count)
+        {
+            const MODBUS_WRITE* next = &(batch[last]->Write);
+            uint32_t nextEnd = (uint32_t)next->Address + next->Quantity;
+            if (next->UnitId != write->UnitId || next->FunctionCode != write->FunctionCode || next->Address > end ||
+                (int)(((nextEnd > end) ? nextEnd : end) - start) > ModbusWriteQueue_MaxQuantity(write->FunctionCode))
+            {
+                break;
+            }
+            end = (nextEnd > end) ? nextEnd : end;
+            last++;
+        }
+
+        merged.UnitId = write->UnitId;
+        merged.FunctionCode = write->FunctionCode;
+        merged.Address = (uint16_t)start;
+        merged.Quantity = (uint16_t)(end - start);
+
+        // Where writes overlap, the last one to arrive wins
+        qsort(batch + first, last - first, sizeof(MODBUS_QUEUED_WRITE*), ModbusWriteQueue_CompareArrival);
+        for (int i = first; i < last; i++)
+        {
+            const MODBUS_WRITE* part = &(batch[i]->Write);
+            memcpy(merged.Values + (part->Address - start), part->Values, part->Quantity * sizeof(uint16_t));
+        }
+
+        IOTHUB_CLIENT_RESULT result = (0 == ModbusPnp_Write(&(queue->Context), &merged)) ? IOTHUB_CLIENT_OK : IOTHUB_CLIENT_ERROR;
+        sent->Transactions++;
+        if (IOTHUB_CLIENT_OK != result)
+        {
+            sent->Failures++;
+            LogError("Failed to write %d coils or registers at %d of unit %d on %s, for %d write(s).",
+                merged.Quantity, merged.Address, merged.UnitId, queue->ConnectionName, last - first);
+        }
+
+        for (int i = first; i < last; i++)
+        {
+            batch[i]->Result = result;
+        }
+        first = last;
+    }
+}
+
+static int ModbusWriteQueue_Worker(
+    void* param)
+{
+    MODBUS_WRITE_QUEUE* queue = (MODBUS_WRITE_QUEUE*)param;
+    MODBUS_QUEUED_WRITE** batch = NULL;
+    int batchCapacity = 0;
+
+    Lock(queue->Lock);
+    while (queue->Running || queue->PendingCount > 0)
+    {
+        if (0 == queue->PendingCount)
+        {
+            (void)Condition_Wait(queue->Changed, queue->Lock, 0);
+            continue;
+        }
+
+        // Give the writes that follow the first one a chance to join it, unless a writer waits
+        uint64_t now = ModbusWriteQueue_Now(queue);
+        if (queue->Running && !queue->FlushNow && now < queue->FirstQueued + queue->WindowMs)
+        {
+            (void)Condition_Wait(queue->Changed, queue->Lock, (int)(queue->FirstQueued + queue->WindowMs - now));
+            continue;
+        }
+
+        // Take the pending writes over, so that more may be queued while these are sent
+        MODBUS_QUEUED_WRITE** taken = queue->Pending;
+        int takenCapacity = queue->PendingCapacity;
+        int count = queue->PendingCount;
+        queue->Pending = batch;
+        queue->PendingCapacity = batchCapacity;
+        queue->PendingCount = 0;
+        queue->FlushNow = false;
+        batch = taken;
+        batchCapacity = takenCapacity;
+        Unlock(queue->Lock);
+
+        MODBUS_WRITE_QUEUE_STATISTICS sent = { 0, 0, 0 };
+        ModbusWriteQueue_Send(queue, batch, count, &sent);
+
+        Lock(queue->Lock);
+        queue->Statistics.Transactions += sent.Transactions;
+        queue->Statistics.Failures += sent.Failures;
+        for (int i = 0; i < count; i++)
+        {
+            if (batch[i]->Waited)
+            {
+                batch[i]->Done = true;
+                (void)Condition_Post(batch[i]->Completed);
+            }
+            else
+            {
+                free(batch[i]);
+            }
+        }
+    }
+    Unlock(queue->Lock);
+
+    free(batch);
+    ThreadAPI_Exit(THREADAPI_OK);
+    return 0;
+}
+
+MODBUS_WRITE_QUEUE_HANDLE ModbusWriteQueue_Create(
+    const char* connectionName,
+    const CapabilityContext* context,
+    int windowMs)
+{
+    MODBUS_WRITE_QUEUE* queue = calloc(1, sizeof(MODBUS_WRITE_QUEUE));
+    if (NULL == queue)
+    {
+        LogError("Could not allocate memory for Modbus write queue.");
+        return NULL;
+    }
+
+    if (0 != mallocAndStrcpy_s(&(queue->ConnectionName), connectionName))
+    {
+        LogError("Could not allocate memory for Modbus write queue.");
+        goto fail;
+    }
+
+    queue->Context = *context;
+    queue->WindowMs = (windowMs < 0) ? 0 : windowMs;
+    queue->Lock = Lock_Init();
+    queue->Changed = Condition_Init();
+    queue->TickCounter = tickcounter_create();
+    if (NULL == queue->Lock || NULL == queue->Changed || NULL == queue->TickCounter)
+    {
+        LogError("Could not initialize Modbus write queue.");
+        goto fail;
+    }
+
+    queue->Running = true;
+    if (THREADAPI_OK != ThreadAPI_Create(&(queue->Worker), ModbusWriteQueue_Worker, queue))
+    {
+        LogError("Failed to create Modbus write queue worker thread for connection %s.", connectionName);
+        goto fail;
+    }
+
+    return queue;
+
+fail:
+    queue->Worker = NULL;
+    ModbusWriteQueue_Destroy(queue);
+    return NULL;
+}
+
+void ModbusWriteQueue_Destroy(
+    MODBUS_WRITE_QUEUE_HANDLE queue)
+{
+    if (NULL == queue)
+    {
+        return;
+    }
+
+    if (NULL != queue->Worker)
+    {
+        Lock(queue->Lock);
+        queue->Running = false;
+        (void)Condition_Post(queue->Changed);
+        Unlock(queue->Lock);
+
+        int res = 0;
+        if (THREADAPI_OK != ThreadAPI_Join(queue->Worker, &res))
+        {
+            LogError("Failed to stop Modbus write queue worker thread.");
+        }
+    }
+
+    if (NULL != queue->TickCounter)
+    {
+        tickcounter_destroy(queue->TickCounter);
+    }
+    if (NULL != queue->Changed)
+    {
+        Condition_Deinit(queue->Changed);
+    }
+    if (NULL != queue->Lock)
+    {
+        Lock_Deinit(queue->Lock);
+    }
+    free(queue->Pending);
+    free(queue->ConnectionName);
+    free(queue);
+}
+
+IOTHUB_CLIENT_RESULT ModbusWriteQueue_Write(
+    MODBUS_WRITE_QUEUE_HANDLE queue,
+    const MODBUS_WRITE* write,
+    bool wait)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+
+    if (0 == write->Quantity || write->Quantity > ModbusWriteQueue_MaxQuantity(write->FunctionCode))
+    {
+        LogError("Modbus write of %d coils or registers is not supported.", write->Quantity);
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    MODBUS_QUEUED_WRITE* queued = calloc(1, sizeof(MODBUS_QUEUED_WRITE));
+    if (NULL == queued)
+    {
+        LogError("Could not allocate memory for Modbus write.");
+        return IOTHUB_CLIENT_ERROR;
+    }
+    queued->Write = *write;
+    queued->Waited = wait;
+    if (wait)
+    {
+        queued->Completed = Condition_Init();
+        if (NULL == queued->Completed)
+        {
+            LogError("Could not initialize Modbus write.");
+            free(queued);
+            return IOTHUB_CLIENT_ERROR;
+        }
+    }
+
+    Lock(queue->Lock);
+    if (!queue->Running)
+    {
+        LogError("Modbus write queue of %s is stopped.", queue->ConnectionName);
+        ModbusWriteQueue_FreeWrite(queued);
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    if (queue->PendingCount == queue->PendingCapacity)
+    {
+        int capacity = (0 == queue->PendingCapacity) ? 16 : queue->PendingCapacity * 2;
+        MODBUS_QUEUED_WRITE** pending = realloc(queue->Pending, capacity * sizeof(MODBUS_QUEUED_WRITE*));
+        if (NULL == pending)
+        {
+            LogError("Could not allocate memory for Modbus write.");
+            ModbusWriteQueue_FreeWrite(queued);
+            result = IOTHUB_CLIENT_ERROR;
+            goto exit;
+        }
+        queue->Pending = pending;
+        queue->PendingCapacity = capacity;
+    }
+
+    if (0 == queue->PendingCount)
+    {
+        queue->FirstQueued = ModbusWriteQueue_Now(queue);
+    }
+    queue->Pending[queue->PendingCount++] = queued;
+    queue->Statistics.Writes++;
+    if (wait)
+    {
+        queue->FlushNow = true;
+    }
+    (void)Condition_Post(queue->Changed);
+
+    if (wait)
+    {
+        while (!queued->Done)
+        {
+            (void)Condition_Wait(queued->Completed, queue->Lock, 0);
+        }
+        result = queued->Result;
+        ModbusWriteQueue_FreeWrite(queued);
+    }
+
+exit:
+    Unlock(queue->Lock);
+    return result;
+}
+
+void ModbusWriteQueue_GetStatistics(
+    MODBUS_WRITE_QUEUE_HANDLE queue,
+    MODBUS_WRITE_QUEUE_STATISTICS* statistics)
+{
+    Lock(queue->Lock);
+    *statistics = queue->Statistics;
+    Unlock(queue->Lock);
+}
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "ModbusPnp.h"
+#include "ModbusCapability.h"
+#include "ModbusConnection/ModbusConnection.h"
+
+// Writes that arrive within this many milliseconds of the first one waiting are sent together
+#define MODBUS_DEFAULT_WRITE_COALESCE_WINDOW_MS 10
+
+typedef struct _MODBUS_WRITE_QUEUE* MODBUS_WRITE_QUEUE_HANDLE;
+
+typedef struct _MODBUS_WRITE_QUEUE_STATISTICS {
+    uint64_t Writes;            // Writes queued
+    uint64_t Transactions;      // Requests sent for them, fewer than Writes when writes were coalesced
+    uint64_t Failures;          // Requests that failed
+} MODBUS_WRITE_QUEUE_STATISTICS;
+
+// A write queue sends the writes to the devices of one physical connection from a worker thread.
+// It holds on to a write for up to windowMs, and coalesces the writes to adjacent or overlapping
+// coils or registers of a unit that arrive meanwhile into one Write Multiple Coils or Write
+// Multiple Registers request. Where they overlap, the last write wins. A write that is alone
+// goes out as a Write Single Coil or Write Single Register request, as it would without the queue.
+// The context is copied, and tells the queue how to reach the connection.
+MODBUS_WRITE_QUEUE_HANDLE ModbusWriteQueue_Create(
+    const char* connectionName,
+    const CapabilityContext* context,
+    int windowMs);
+
+// Sends the writes that are still waiting, then stops the worker thread
+void ModbusWriteQueue_Destroy(
+    MODBUS_WRITE_QUEUE_HANDLE queue);
+
+// Queues a write. Without wait the result only tells whether the write was queued, and a write
+// that fails later is logged. With wait the writes waiting are sent right away, and the result
+// is that of the request that carried the write.
+IOTHUB_CLIENT_RESULT ModbusWriteQueue_Write(
+    MODBUS_WRITE_QUEUE_HANDLE queue,
+    const MODBUS_WRITE* write,
+    bool wait);
+
+void ModbusWriteQueue_GetStatistics(
+    MODBUS_WRITE_QUEUE_HANDLE queue,
+    MODBUS_WRITE_QUEUE_STATISTICS* statistics);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,199 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIN32
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modbus_simulator.h"
+
+// Moves every register on by one, as if each was a counter
+static void ModbusSimulator_Count(
+    MODBUS_TEST_SLAVE* slave,
+    void* context)
+{
+    (void)context;
+    for (int i = 0; i < MODBUS_TEST_SLAVE_MEMORY; i++)
+    {
+        slave->Registers[i]++;
+    }
+}
+
+// Sets every register to n + 1 plus the signal of the options at this time
+static void ModbusSimulator_Signal(
+    MODBUS_TEST_SLAVE* slave,
+    void* context)
+{
+    const MODBUS_SIMULATOR_OPTIONS* options = (const MODBUS_SIMULATOR_OPTIONS*)context;
+    uint64_t now = ModbusSimulator_GetTimeMs();
+    int signal = 0;
+
+    if (now >= options->SignalStartMs)
+    {
+        signal = (MODBUS_SIMULATOR_STEP == options->Signal) ? MODBUS_SIMULATOR_STEP_HEIGHT :
+            (int)((now - options->SignalStartMs) / (uint64_t)((options->RampMs > 0) ? options->RampMs : 1));
+    }
+
+    for (int i = 0; i < MODBUS_TEST_SLAVE_MEMORY; i++)
+    {
+        slave->Registers[i] = (uint16_t)(i + 1 + signal);
+    }
+}
+
+uint64_t ModbusSimulator_GetTimeMs(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+int ModbusSimulator_Run(
+    const MODBUS_SIMULATOR_OPTIONS* options,
+    int report,
+    int control)
+{
+    if (options->Devices < 1 || options->Devices > MODBUS_SIMULATOR_MAX_DEVICES)
+    {
+        return -1;
+    }
+
+    MODBUS_TEST_SLAVE* slaves = calloc(options->Devices, sizeof(MODBUS_TEST_SLAVE));
+    if (NULL == slaves)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < options->Devices; i++)
+    {
+        MODBUS_TEST_SLAVE* slave = &slaves[i];
+        int result = options->Rtu ? ModbusTestSlave_StartRtu(slave, options->LatencyMs) :
+            ModbusTestSlave_ListenGateway(slave, 0, options->LatencyMs, options->Connections);
+        if (0 != result)
+        {
+            return -1;
+        }
+
+        slave->ExceptionCode = options->ExceptionCode;
+        slave->ExceptionAddress = options->ExceptionAddress;
+        slave->ExceptionQuantity = options->ExceptionQuantity;
+        slave->DropEvery = options->DropEvery;
+        slave->CorruptCrc = options->CorruptCrc;
+        memcpy(slave->Units, options->Units, sizeof(slave->Units));
+        if (MODBUS_SIMULATOR_CONSTANT != options->Signal)
+        {
+            slave->Script = ModbusSimulator_Signal;
+            slave->ScriptContext = (void*)options;
+        }
+        else if (options->Live)
+        {
+            slave->Script = ModbusSimulator_Count;
+        }
+
+        if (options->Rtu)
+        {
+            (void)dprintf(report, "%s\n", slave->PortName);
+        }
+        else
+        {
+            (void)dprintf(report, "%u\n", slave->Port);
+        }
+    }
+
+    // The devices are served until the other end of control is closed, and go away with the process
+    char byte;
+    while (read(control, &byte, 1) > 0)
+    {
+    }
+
+    return 0;
+}
+
+int ModbusSimulator_Start(
+    MODBUS_SIMULATOR* simulator,
+    const MODBUS_SIMULATOR_OPTIONS* options)
+{
+    int reportPipe[2];
+    int controlPipe[2];
+
+    memset(simulator, 0, sizeof(MODBUS_SIMULATOR));
+    simulator->Control = -1;
+    if (0 != pipe(reportPipe))
+    {
+        return -1;
+    }
+    if (0 != pipe(controlPipe))
+    {
+        (void)close(reportPipe[0]);
+        (void)close(reportPipe[1]);
+        return -1;
+    }
+
+    simulator->Process = fork();
+    if (0 == simulator->Process)
+    {
+        (void)close(reportPipe[0]);
+        (void)close(controlPipe[1]);
+        _exit((0 == ModbusSimulator_Run(options, reportPipe[1], controlPipe[0])) ? 0 : 1);
+    }
+
+    (void)close(reportPipe[1]);
+    (void)close(controlPipe[0]);
+    simulator->Control = controlPipe[1];
+    if (simulator->Process < 0)
+    {
+        (void)close(reportPipe[0]);
+        ModbusSimulator_Stop(simulator);
+        return -1;
+    }
+
+    // Every device is being served once its endpoint is reported
+    FILE* endpoints = fdopen(reportPipe[0], "r");
+    if (NULL == endpoints)
+    {
+        (void)close(reportPipe[0]);
+        ModbusSimulator_Stop(simulator);
+        return -1;
+    }
+
+    while (simulator->Devices < options->Devices &&
+        NULL != fgets(simulator->Endpoints[simulator->Devices], MODBUS_TEST_SLAVE_PORT_LENGTH, endpoints))
+    {
+        simulator->Endpoints[simulator->Devices][strcspn(simulator->Endpoints[simulator->Devices], "\n")] = '\0';
+        simulator->Devices++;
+    }
+    (void)fclose(endpoints);
+
+    if (simulator->Devices < options->Devices)
+    {
+        ModbusSimulator_Stop(simulator);
+        return -1;
+    }
+
+    return 0;
+}
+
+void ModbusSimulator_Stop(
+    MODBUS_SIMULATOR* simulator)
+{
+    if (simulator->Control >= 0)
+    {
+        (void)close(simulator->Control);
+        simulator->Control = -1;
+    }
+
+    // A simulator started later holds a copy of control too, so the process is not left to notice
+    if (simulator->Process > 0)
+    {
+        (void)kill(simulator->Process, SIGTERM);
+        (void)waitpid(simulator->Process, NULL, 0);
+        simulator->Process = 0;
+    }
+}
+#endif
@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "modbus_test_slave.h"
+
+#ifndef WIN32
+#include <sys/types.h>
+
+#define MODBUS_SIMULATOR_MAX_DEVICES 64
+#define MODBUS_SIMULATOR_STEP_HEIGHT 1000
+
+// A signal moving the registers below MODBUS_TEST_SLAVE_MEMORY, which then hold n + 1 plus the
+// signal in register n
+typedef enum MODBUS_SIMULATOR_SIGNAL {
+    MODBUS_SIMULATOR_CONSTANT,
+    MODBUS_SIMULATOR_STEP,      // Steps up by MODBUS_SIMULATOR_STEP_HEIGHT at SignalStartMs
+    MODBUS_SIMULATOR_RAMP       // Counts up by one every RampMs from SignalStartMs on
+} MODBUS_SIMULATOR_SIGNAL;
+
+// Settings shared by every device of a simulator
+typedef struct MODBUS_SIMULATOR_OPTIONS {
+    int Devices;
+    bool Rtu;                   // Serve each device on a pseudo-terminal rather than a loopback port
+    int Connections;            // TCP only: connections each device serves at once, as a gateway
+                                // does, 1 when 0
+    uint8_t Units[MODBUS_TEST_SLAVE_UNIT_BYTES];    // Unit IDs each device answers, as
+                                                    // MODBUS_TEST_SLAVE has them
+    int LatencyMs;
+    uint8_t ExceptionCode;      // Faults of each device, as MODBUS_TEST_SLAVE has them
+    uint16_t ExceptionAddress;
+    uint16_t ExceptionQuantity;
+    int DropEvery;
+    bool CorruptCrc;
+    bool Live;                  // Registers below MODBUS_TEST_SLAVE_MEMORY count up with every
+                                // transaction, like measurements of a running process
+    MODBUS_SIMULATOR_SIGNAL Signal;
+    uint64_t SignalStartMs;     // On CLOCK_MONOTONIC, which ModbusSimulator_GetTimeMs reads
+    int RampMs;
+} MODBUS_SIMULATOR_OPTIONS;
+
+// Simulated devices served by a process of their own, so that the CPU time of the process under
+// test is its own
+typedef struct MODBUS_SIMULATOR {
+    pid_t Process;
+    int Control;                // Closing it stops the simulator
+    int Devices;
+    char Endpoints[MODBUS_SIMULATOR_MAX_DEVICES][MODBUS_TEST_SLAVE_PORT_LENGTH];  // Loopback port
+                                                                                  // or terminal
+} MODBUS_SIMULATOR;
+
+// Milliseconds on the clock that signals start by, which is the same in every process
+uint64_t ModbusSimulator_GetTimeMs(void);
+
+// Serves the devices in this process, writing the endpoint of each on a line of its own to
+// report, until control is closed at the other end. Returns 0 once stopped that way.
+int ModbusSimulator_Run(
+    const MODBUS_SIMULATOR_OPTIONS* options,
+    int report,
+    int control);
+
+// Forks a process serving the devices, and returns 0 once all of them are being served
+int ModbusSimulator_Start(
+    MODBUS_SIMULATOR* simulator,
+    const MODBUS_SIMULATOR_OPTIONS* options);
+
+// Stops the process and waits for it to exit
+void ModbusSimulator_Stop(
+    MODBUS_SIMULATOR* simulator);
+#endif
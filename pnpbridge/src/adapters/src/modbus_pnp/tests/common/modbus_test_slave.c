@@ -0,0 +1,676 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIN32
+// For the pseudo-terminal of the RTU slave
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ModbusReadPlanner.h"
+#include "ModbusConnection/ModbusConnection.h"
+#include "modbus_test_slave.h"
+
+static bool ModbusTestSlave_ReadExactly(
+    int socket,
+    uint8_t* buffer,
+    size_t length)
+{
+    size_t received = 0;
+    while (received < length)
+    {
+        ssize_t n = read(socket, buffer + received, length - received);
+        if (n <= 0)
+        {
+            return false;
+        }
+        received += (size_t)n;
+    }
+    return true;
+}
+
+// Reads a request, of as many bytes as the length field of its MBAP header announces
+static bool ModbusTestSlave_ReadRequest(
+    int socket,
+    uint8_t* request)
+{
+    if (!ModbusTestSlave_ReadExactly(socket, request, TCP_HEADER_SIZE))
+    {
+        return false;
+    }
+
+    uint16_t length = (uint16_t)((request[4] << 8) | request[5]);
+    if (length < 2 || (TCP_HEADER_SIZE - 1) + length > MODBUS_BLOCK_RESPONSE_MAX_LENGTH)
+    {
+        return false;
+    }
+    return ModbusTestSlave_ReadExactly(socket, request + TCP_HEADER_SIZE, length - 1);
+}
+
+static void ModbusTestSlave_ResetMemory(
+    MODBUS_TEST_SLAVE* slave)
+{
+    for (int i = 0; i < MODBUS_TEST_SLAVE_MEMORY; i++)
+    {
+        slave->Registers[i] = (uint16_t)(i + 1);
+        slave->Coils[i] = (0 == i % 3);
+    }
+}
+
+static void ModbusTestSlave_ResetFaults(
+    MODBUS_TEST_SLAVE* slave)
+{
+    slave->ExceptionCode = 0;
+    slave->ExceptionAddress = 0;
+    slave->ExceptionQuantity = 0;
+    slave->DropEvery = 0;
+    slave->Script = NULL;
+    slave->ScriptContext = NULL;
+    memset(slave->Units, 0, sizeof(slave->Units));
+    slave->PortName[0] = '\0';
+}
+
+void ModbusTestSlave_AddUnit(
+    uint8_t* units,
+    uint8_t unitId)
+{
+    units[unitId / 8] |= (uint8_t)(1 << (unitId % 8));
+}
+
+// Tells whether the slave answers requests to unitId
+static bool ModbusTestSlave_HasUnit(
+    const MODBUS_TEST_SLAVE* slave,
+    uint8_t unitId)
+{
+    for (int i = 0; i < MODBUS_TEST_SLAVE_UNIT_BYTES; i++)
+    {
+        if (0 != slave->Units[i])
+        {
+            return 0 != (slave->Units[unitId / 8] & (1 << (unitId % 8)));
+        }
+    }
+    return true;
+}
+
+// Fills in the data of a read of quantity registers or bits at address, returning its byte count
+static int ModbusTestSlave_ReadData(
+    MODBUS_TEST_SLAVE* slave,
+    uint8_t functionCode,
+    uint16_t address,
+    uint16_t quantity,
+    uint8_t* data)
+{
+    int byteCount = 0;
+
+    if (ReadCoils == functionCode || ReadInputs == functionCode)
+    {
+        byteCount = (quantity + 7) / 8;
+        memset(data, 0, byteCount);
+        for (int i = 0; i < quantity; i++)
+        {
+            int bit = address + i;
+            if ((bit < MODBUS_TEST_SLAVE_MEMORY) ? slave->Coils[bit] : (0 == bit % 3))
+            {
+                data[i / 8] |= (uint8_t)(1 << (i % 8));
+            }
+        }
+    }
+    else
+    {
+        byteCount = quantity * 2;
+        for (int i = 0; i < quantity; i++)
+        {
+            int reg = address + i;
+            uint16_t value = (reg < MODBUS_TEST_SLAVE_MEMORY) ? slave->Registers[reg] : (uint16_t)(reg + 1);
+            data[i * 2] = (uint8_t)(value >> 8);
+            data[i * 2 + 1] = (uint8_t)(value & 0xff);
+        }
+    }
+
+    return byteCount;
+}
+
+// Stores the values of a write of quantity coils or registers at address
+static void ModbusTestSlave_WriteData(
+    MODBUS_TEST_SLAVE* slave,
+    uint8_t functionCode,
+    uint16_t address,
+    uint16_t quantity,
+    const uint8_t* data)
+{
+    for (int i = 0; i < quantity && address + i < MODBUS_TEST_SLAVE_MEMORY; i++)
+    {
+        switch (functionCode)
+        {
+            case WriteCoil:
+                slave->Coils[address] = (0xFF == data[0]);
+                break;
+            case WriteCoils:
+                slave->Coils[address + i] = (0 != (data[i / 8] & (1 << (i % 8))));
+                break;
+            default:
+                slave->Registers[address + i] = (uint16_t)((data[i * 2] << 8) | data[i * 2 + 1]);
+                break;
+        }
+    }
+}
+
+// Serves the PDU of a request, and builds the PDU of its response, returning its length
+static int ModbusTestSlave_AnswerPdu(
+    MODBUS_TEST_SLAVE* slave,
+    const uint8_t* request,
+    uint8_t* response)
+{
+    uint8_t functionCode = request[0];
+    uint16_t address = (uint16_t)((request[1] << 8) | request[2]);
+    uint16_t quantity = (uint16_t)((request[3] << 8) | request[4]);
+
+    if (NULL != slave->Script)
+    {
+        slave->Script(slave, slave->ScriptContext);
+    }
+
+    slave->LastFunctionCode = functionCode;
+
+    // A single write carries a value where the others have their quantity
+    uint16_t span = (WriteCoil == functionCode || WriteHoldingRegister == functionCode) ? 1 : quantity;
+    if (0 != slave->ExceptionCode && address < slave->ExceptionAddress + slave->ExceptionQuantity &&
+        address + span > slave->ExceptionAddress)
+    {
+        response[0] = (uint8_t)(functionCode | MODBUS_EXCEPTION_CODE);
+        response[1] = slave->ExceptionCode;
+        return 2;
+    }
+
+    switch (functionCode)
+    {
+        case WriteCoil:
+        case WriteHoldingRegister:
+            // A single write is echoed back
+            ModbusTestSlave_WriteData(slave, functionCode, address, 1, request + 3);
+            memcpy(response, request, 5);
+            return 5;
+        case WriteCoils:
+        case WriteHoldingRegisters:
+            // A multiple write is answered with its address and quantity
+            ModbusTestSlave_WriteData(slave, functionCode, address, quantity, request + 6);
+            memcpy(response, request, 5);
+            return 5;
+        default:
+            response[0] = functionCode;
+            response[1] = (uint8_t)ModbusTestSlave_ReadData(slave, functionCode, address, quantity, response + 2);
+            return 2 + response[1];
+    }
+}
+
+// Builds the response to a request, returning its length
+static int ModbusTestSlave_Answer(
+    MODBUS_TEST_SLAVE* slave,
+    const uint8_t* request,
+    uint8_t* response)
+{
+    int pduLength = ModbusTestSlave_AnswerPdu(slave, request + TCP_HEADER_SIZE, response + TCP_HEADER_SIZE);
+
+    // The length field counts the unit ID and the PDU
+    memcpy(response, request, TCP_HEADER_SIZE);
+    response[4] = (uint8_t)((1 + pduLength) >> 8);
+    response[5] = (uint8_t)((1 + pduLength) & 0xff);
+
+    return TCP_HEADER_SIZE + pduLength;
+}
+
+// Builds the response to an RTU request, returning its length
+static int ModbusTestSlave_AnswerRtu(
+    MODBUS_TEST_SLAVE* slave,
+    const uint8_t* request,
+    uint8_t* response)
+{
+    response[0] = request[0];
+    int length = RTU_HEADER_SIZE + ModbusTestSlave_AnswerPdu(slave, request + RTU_HEADER_SIZE, response + RTU_HEADER_SIZE);
+
+    uint16_t crc = GetCRC(response, length);
+    response[length] = (uint8_t)(crc & 0xff);
+    response[length + 1] = (uint8_t)(crc >> 8);
+
+    return length + 2;
+}
+
+// Counts a transaction, and tells whether its response is to be lost
+static bool ModbusTestSlave_DropResponse(
+    MODBUS_TEST_SLAVE* slave)
+{
+    slave->Transactions++;
+    return slave->DropEvery > 0 && 0 == slave->Transactions % slave->DropEvery;
+}
+
+static uint64_t ModbusTestSlave_NowUs(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+// Serves one request at a time like a slave on a serial line, timing the silence before each
+static int ModbusTestSlave_ServeRtu(
+    void* context)
+{
+    MODBUS_TEST_SLAVE* slave = (MODBUS_TEST_SLAVE*)context;
+    uint8_t request[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    uint64_t lastFrameEnd = 0;
+
+    while (ModbusTestSlave_ReadExactly(slave->Socket, request, RTU_REQUEST_SIZE))
+    {
+        // A multiple write goes on with its values, as many bytes of them as its byte count says
+        uint8_t functionCode = request[RTU_HEADER_SIZE];
+        if ((WriteCoils == functionCode || WriteHoldingRegisters == functionCode) &&
+            !ModbusTestSlave_ReadExactly(slave->Socket, request + RTU_REQUEST_SIZE, RTU_HEADER_SIZE + 6 + request[RTU_HEADER_SIZE + 5] + 2 - RTU_REQUEST_SIZE))
+        {
+            break;
+        }
+
+        // Only the slave a request is addressed to answers it
+        if (!ModbusTestSlave_HasUnit(slave, request[0]))
+        {
+            continue;
+        }
+
+        uint64_t now = ModbusTestSlave_NowUs();
+        if (0 != lastFrameEnd && (slave->MinSilenceUs < 0 || (int)(now - lastFrameEnd) < slave->MinSilenceUs))
+        {
+            slave->MinSilenceUs = (int)(now - lastFrameEnd);
+        }
+
+        ThreadAPI_Sleep(slave->LatencyMs);
+        if (slave->Mute)
+        {
+            slave->Transactions++;
+            continue;
+        }
+
+        int length = ModbusTestSlave_AnswerRtu(slave, request, response);
+        if (ModbusTestSlave_DropResponse(slave))
+        {
+            continue;
+        }
+        if (slave->CorruptCrc)
+        {
+            response[length - 1] ^= 0xff;
+        }
+
+        // A slow slave, or a UART with a small FIFO, lets the frame out in more than one piece
+        int split = (slave->ResponseGapMs > 0) ? RTU_HEADER_SIZE + 2 : length;
+        if (write(slave->Socket, response, split) != split)
+        {
+            break;
+        }
+        if (split < length)
+        {
+            ThreadAPI_Sleep(slave->ResponseGapMs);
+            if (write(slave->Socket, response + split, length - split) != length - split)
+            {
+                break;
+            }
+        }
+        lastFrameEnd = ModbusTestSlave_NowUs();
+    }
+
+    return 0;
+}
+
+static int ModbusTestSlave_Serve(
+    void* context)
+{
+    MODBUS_TEST_SLAVE* slave = (MODBUS_TEST_SLAVE*)context;
+    uint8_t requests[MODBUS_TEST_SLAVE_MAX_CONCURRENCY][MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+
+    while (ModbusTestSlave_ReadRequest(slave->Socket, requests[0]))
+    {
+        // Like a gateway in front of several devices, take on the requests sent along with it
+        int count = 1;
+        struct pollfd waiting = { slave->Socket, POLLIN, 0 };
+        while (count < slave->Concurrency && 1 == poll(&waiting, 1, MODBUS_TEST_SLAVE_GATHER_MS) &&
+            ModbusTestSlave_ReadRequest(slave->Socket, requests[count]))
+        {
+            count++;
+        }
+
+        ThreadAPI_Sleep(slave->LatencyMs);
+
+        // The device that answers first is not the one asked first
+        for (int i = count - 1; i >= 0; i--)
+        {
+            if (!ModbusTestSlave_HasUnit(slave, requests[i][TCP_HEADER_SIZE - 1]))
+            {
+                continue;
+            }
+
+            int length = ModbusTestSlave_Answer(slave, requests[i], response);
+            if (ModbusTestSlave_DropResponse(slave))
+            {
+                continue;
+            }
+            if (send(slave->Socket, response, length, MSG_NOSIGNAL) < 0)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Serves the slave end of a connection, the other end of which goes to the adapter
+static int ModbusTestSlave_Run(
+    MODBUS_TEST_SLAVE* slave,
+    int slaveEnd,
+    int masterEnd,
+    THREAD_START_FUNC serve)
+{
+    slave->MasterSocket = masterEnd;
+    slave->Socket = slaveEnd;
+    slave->Listener = -1;
+    slave->Transactions = 0;
+    slave->MinSilenceUs = -1;
+    ModbusTestSlave_ResetMemory(slave);
+    slave->ResponseGapMs = 0;
+    slave->Mute = false;
+    slave->CorruptCrc = false;
+    ModbusTestSlave_ResetFaults(slave);
+    if (THREADAPI_OK != ThreadAPI_Create(&(slave->Thread), serve, slave))
+    {
+        (void)close(masterEnd);
+        (void)close(slaveEnd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ModbusTestSlave_Start(
+    MODBUS_TEST_SLAVE* slave,
+    int latencyMs,
+    int concurrency)
+{
+    slave->LatencyMs = latencyMs;
+    slave->Concurrency = (concurrency < 1) ? 1 : (concurrency > MODBUS_TEST_SLAVE_MAX_CONCURRENCY) ? MODBUS_TEST_SLAVE_MAX_CONCURRENCY : concurrency;
+
+    int sockets[2];
+    if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sockets))
+    {
+        return -1;
+    }
+    return ModbusTestSlave_Run(slave, sockets[1], sockets[0], ModbusTestSlave_Serve);
+}
+
+int ModbusTestSlave_StartRtu(
+    MODBUS_TEST_SLAVE* slave,
+    int latencyMs)
+{
+    struct termios settings;
+    slave->LatencyMs = latencyMs;
+    slave->Concurrency = 1;
+
+    // The adapter gets the terminal end of a pseudo-terminal, which it reads like a serial port
+    int ptm = posix_openpt(O_RDWR | O_NOCTTY);
+    if (ptm < 0)
+    {
+        return -1;
+    }
+
+    const char* ptsName = NULL;
+    int pts = -1;
+    if (0 != grantpt(ptm) || 0 != unlockpt(ptm) || NULL == (ptsName = ptsname(ptm)) ||
+        (pts = open(ptsName, O_RDWR | O_NOCTTY)) < 0)
+    {
+        (void)close(ptm);
+        return -1;
+    }
+
+    // Frames are binary, so nothing may be translated or buffered up to a line end on the way
+    if (0 != tcgetattr(pts, &settings))
+    {
+        (void)close(pts);
+        (void)close(ptm);
+        return -1;
+    }
+    cfmakeraw(&settings);
+    (void)tcsetattr(pts, TCSANOW, &settings);
+
+    int result = ModbusTestSlave_Run(slave, ptm, pts, ModbusTestSlave_ServeRtu);
+    if (0 == result)
+    {
+        (void)snprintf(slave->PortName, sizeof(slave->PortName), "%s", ptsName);
+    }
+    return result;
+}
+
+// Serves a connection to a gateway with the copy of the slave it was given
+static int ModbusTestSlave_ServeSession(
+    void* context)
+{
+    MODBUS_TEST_SLAVE* session = (MODBUS_TEST_SLAVE*)context;
+    (void)ModbusTestSlave_Serve(session);
+
+    Lock(session->Lock);
+    session->Stopping = true;
+    Unlock(session->Lock);
+    return 0;
+}
+
+// Takes on a connection to a gateway, once the connections that are over are cleaned up. Returns
+// false when the gateway serves as many connections as it can already.
+static bool ModbusTestSlave_StartSession(
+    MODBUS_TEST_SLAVE* slave,
+    int connection)
+{
+    MODBUS_TEST_SLAVE* session = NULL;
+    int count = 0;
+
+    Lock(slave->Lock);
+    for (int i = 0; i < slave->SessionCount; i++)
+    {
+        if (slave->Sessions[i]->Stopping)
+        {
+            (void)ThreadAPI_Join(slave->Sessions[i]->Thread, NULL);
+            (void)close(slave->Sessions[i]->Socket);
+            free(slave->Sessions[i]);
+        }
+        else
+        {
+            slave->Sessions[count++] = slave->Sessions[i];
+        }
+    }
+    slave->SessionCount = count;
+
+    if (!slave->Stopping && slave->SessionCount < slave->MaxSessions &&
+        NULL != (session = malloc(sizeof(MODBUS_TEST_SLAVE))))
+    {
+        memcpy(session, slave, sizeof(MODBUS_TEST_SLAVE));
+        session->Socket = connection;
+        session->Listener = -1;
+        session->SessionCount = 0;
+        if (THREADAPI_OK == ThreadAPI_Create(&(session->Thread), ModbusTestSlave_ServeSession, session))
+        {
+            slave->Sessions[slave->SessionCount++] = session;
+        }
+        else
+        {
+            free(session);
+            session = NULL;
+        }
+    }
+    Unlock(slave->Lock);
+
+    return NULL != session;
+}
+
+// Serves each connection to the listening socket in turn, or side by side for a gateway, until
+// the slave is stopped
+static int ModbusTestSlave_Accept(
+    void* context)
+{
+    MODBUS_TEST_SLAVE* slave = (MODBUS_TEST_SLAVE*)context;
+
+    for (;;)
+    {
+        int connection = accept(slave->Listener, NULL, NULL);
+        if (connection < 0)
+        {
+            break;
+        }
+
+        if (slave->MaxSessions > 1)
+        {
+            if (!ModbusTestSlave_StartSession(slave, connection))
+            {
+                (void)close(connection);
+            }
+            continue;
+        }
+
+        Lock(slave->Lock);
+        bool stopping = slave->Stopping;
+        slave->Socket = stopping ? -1 : connection;
+        Unlock(slave->Lock);
+
+        if (!stopping)
+        {
+            (void)ModbusTestSlave_Serve(slave);
+        }
+
+        Lock(slave->Lock);
+        slave->Socket = -1;
+        Unlock(slave->Lock);
+        (void)close(connection);
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int ModbusTestSlave_Listen(
+    MODBUS_TEST_SLAVE* slave,
+    uint16_t port,
+    int latencyMs)
+{
+    return ModbusTestSlave_ListenGateway(slave, port, latencyMs, 1);
+}
+
+int ModbusTestSlave_ListenGateway(
+    MODBUS_TEST_SLAVE* slave,
+    uint16_t port,
+    int latencyMs,
+    int connections)
+{
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+    int reuse = 1;
+
+    slave->LatencyMs = latencyMs;
+    slave->Concurrency = 1;
+    slave->Transactions = 0;
+    slave->MinSilenceUs = -1;
+    ModbusTestSlave_ResetMemory(slave);
+    ModbusTestSlave_ResetFaults(slave);
+    slave->Socket = -1;
+    slave->MasterSocket = -1;
+    slave->Stopping = false;
+    slave->MaxSessions = (connections < 1) ? 1 : (connections > MODBUS_TEST_SLAVE_MAX_SESSIONS) ? MODBUS_TEST_SLAVE_MAX_SESSIONS : connections;
+    slave->SessionCount = 0;
+
+    // The port is taken again right after the slave stops, while its old connection lingers
+    slave->Listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (slave->Listener < 0)
+    {
+        return -1;
+    }
+    (void)setsockopt(slave->Listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (0 != bind(slave->Listener, (struct sockaddr*)&address, sizeof(address)) ||
+        0 != listen(slave->Listener, slave->MaxSessions) ||
+        0 != getsockname(slave->Listener, (struct sockaddr*)&address, &addressLength))
+    {
+        goto fail;
+    }
+    slave->Port = ntohs(address.sin_port);
+
+    slave->Lock = Lock_Init();
+    if (NULL == slave->Lock)
+    {
+        goto fail;
+    }
+    if (THREADAPI_OK != ThreadAPI_Create(&(slave->Thread), ModbusTestSlave_Accept, slave))
+    {
+        Lock_Deinit(slave->Lock);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    (void)close(slave->Listener);
+    slave->Listener = -1;
+    return -1;
+}
+
+void ModbusTestSlave_Stop(
+    MODBUS_TEST_SLAVE* slave)
+{
+    if (slave->Listener >= 0)
+    {
+        Lock(slave->Lock);
+        slave->Stopping = true;
+        if (slave->Socket >= 0)
+        {
+            (void)shutdown(slave->Socket, SHUT_RDWR);
+        }
+        for (int i = 0; i < slave->SessionCount; i++)
+        {
+            (void)shutdown(slave->Sessions[i]->Socket, SHUT_RDWR);
+        }
+        Unlock(slave->Lock);
+
+        (void)shutdown(slave->Listener, SHUT_RDWR);
+        (void)ThreadAPI_Join(slave->Thread, NULL);
+        for (int i = 0; i < slave->SessionCount; i++)
+        {
+            (void)ThreadAPI_Join(slave->Sessions[i]->Thread, NULL);
+            (void)close(slave->Sessions[i]->Socket);
+            free(slave->Sessions[i]);
+        }
+        slave->SessionCount = 0;
+        (void)close(slave->Listener);
+        slave->Listener = -1;
+        Lock_Deinit(slave->Lock);
+        return;
+    }
+
+    if (slave->MasterSocket >= 0)
+    {
+        (void)close(slave->MasterSocket);
+    }
+    (void)ThreadAPI_Join(slave->Thread, NULL);
+    (void)close(slave->Socket);
+}
+#endif
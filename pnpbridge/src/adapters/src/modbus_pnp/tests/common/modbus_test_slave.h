@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/lock.h"
+
+#ifndef WIN32
+#define MODBUS_TEST_SLAVE_MAX_CONCURRENCY 16
+
+// Time a gateway slave waits for more requests to serve along with the first
+#define MODBUS_TEST_SLAVE_GATHER_MS 1
+
+// Coils and registers of a slave below this address can be written, and hold what was written
+#define MODBUS_TEST_SLAVE_MEMORY 1024
+
+// Longest path of the pseudo-terminal of an RTU slave
+#define MODBUS_TEST_SLAVE_PORT_LENGTH 64
+
+// Connections a gateway started with ModbusTestSlave_ListenGateway serves at once
+#define MODBUS_TEST_SLAVE_MAX_SESSIONS 32
+
+// Bytes of a set of unit IDs, a bit for each
+#define MODBUS_TEST_SLAVE_UNIT_BYTES 32
+
+struct MODBUS_TEST_SLAVE;
+
+// Called before the slave answers each request, to change its registers and coils, or its faults,
+// as the test scripts them
+typedef void(*MODBUS_TEST_SLAVE_SCRIPT)(
+    struct MODBUS_TEST_SLAVE* slave,
+    void* context);
+
+// A Modbus TCP slave on one end of a socket pair, for the adapter to talk to through the other.
+// Register n holds n + 1, and coil n is on when n is a multiple of 3, until written. Every
+// transaction takes LatencyMs, like a device on a bus. With a concurrency above 1 the slave acts
+// as a gateway: it serves up to that many waiting requests at once, and answers them last to first.
+// The faults may be set once the slave is started.
+typedef struct MODBUS_TEST_SLAVE {
+    int Socket;
+    int MasterSocket;       // Passed to the adapter as its device handle. Set to -1 once the
+                            // adapter closes it itself.
+    int LatencyMs;
+    int Concurrency;
+    int MinSilenceUs;       // Shortest silence before a request on a serial line, -1 until seen
+    int ResponseGapMs;      // RTU only: pause after the first bytes of each response, 0 for none
+    bool Mute;              // RTU only: take requests without answering them
+    bool CorruptCrc;        // RTU only: send responses with a bad CRC
+    uint8_t ExceptionCode;  // Answered to requests for any of the ExceptionQuantity coils or
+    uint16_t ExceptionAddress;  // registers from ExceptionAddress on, 0 for none
+    uint16_t ExceptionQuantity;
+    int DropEvery;          // Serve every request, but leave every DropEvery-th one unanswered as
+                            // if its response was lost, 0 for none
+    uint8_t Units[MODBUS_TEST_SLAVE_UNIT_BYTES];    // Unit IDs answered, as ModbusTestSlave_AddUnit
+                                                    // sets them. Requests to others go unanswered,
+                                                    // as on a bus they are not on. None set answers
+                                                    // every unit.
+    MODBUS_TEST_SLAVE_SCRIPT Script;
+    void* ScriptContext;
+    int Transactions;
+    uint8_t LastFunctionCode;
+    uint16_t Registers[MODBUS_TEST_SLAVE_MEMORY];
+    bool Coils[MODBUS_TEST_SLAVE_MEMORY];
+    THREAD_HANDLE Thread;
+    int Listener;           // Listening socket of a slave started with ModbusTestSlave_Listen, or -1
+    uint16_t Port;          // Loopback port it listens on
+    bool Stopping;
+    LOCK_HANDLE Lock;       // Guards Socket, Stopping and Sessions of a listening slave
+    int MaxSessions;        // Connections served at once, more than 1 for a gateway
+    int SessionCount;
+    struct MODBUS_TEST_SLAVE* Sessions[MODBUS_TEST_SLAVE_MAX_SESSIONS];
+    char PortName[MODBUS_TEST_SLAVE_PORT_LENGTH];   // Terminal end of an RTU slave, which may be
+                                                    // opened again by name
+} MODBUS_TEST_SLAVE;
+
+// Returns 0 once the slave is serving MasterSocket
+int ModbusTestSlave_Start(
+    MODBUS_TEST_SLAVE* slave,
+    int latencyMs,
+    int concurrency);
+
+// Starts a Modbus RTU slave instead, which serves one request at a time on a pseudo-terminal.
+// MasterSocket is then the raw terminal end of it. The RTU options may be set once it is started.
+int ModbusTestSlave_StartRtu(
+    MODBUS_TEST_SLAVE* slave,
+    int latencyMs);
+
+// Starts a Modbus TCP slave listening on a loopback port instead, which serves one connection at
+// a time. With port 0 the slave picks a free port, and sets Port to it. Stopping the slave closes
+// the port and any connection to it, as a device going away would, and listening again on the
+// same Port brings it back.
+int ModbusTestSlave_Listen(
+    MODBUS_TEST_SLAVE* slave,
+    uint16_t port,
+    int latencyMs);
+
+// Listens like ModbusTestSlave_Listen, but serves up to connections connections at once, like a
+// gateway does. Each is served by a copy of the slave as it was when the connection came in, with
+// registers and coils of its own.
+int ModbusTestSlave_ListenGateway(
+    MODBUS_TEST_SLAVE* slave,
+    uint16_t port,
+    int latencyMs,
+    int connections);
+
+// Adds unitId to a set of unit IDs
+void ModbusTestSlave_AddUnit(
+    uint8_t* units,
+    uint8_t unitId);
+
+// Closes MasterSocket, unless the adapter did, and waits for the slave to see it go
+void ModbusTestSlave_Stop(
+    MODBUS_TEST_SLAVE* slave);
+#endif
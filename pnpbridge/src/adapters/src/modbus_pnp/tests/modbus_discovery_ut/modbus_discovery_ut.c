@@ -0,0 +1,291 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "parson.h"
+
+#include "ModbusCapability.h"
+#include "ModbusDiscovery.h"
+#include "modbus_simulator.h"
+
+#define TEST_CONNECTIONS 8
+#define TEST_TCP_TIMEOUT_MS 20
+#define TEST_RTU_TURNAROUND_MS 10
+#define TEST_RTU_LAST_UNIT_ID 64
+#define TEST_RTU_BAUD_RATE 115200
+#define TEST_HOST "127.0.0.1"
+#define TEST_CONFIG_LENGTH 128
+
+// Register n of a simulated device holds n + 1, which the fingerprint of the meter reads
+static const uint8_t g_units[] = { 3, 17, 64, 130, 200, 247 };
+
+static ModbusProperty g_meterFingerprint;
+static ModbusProperty g_thermostatFingerprint;
+static ModbusInterfaceConfig g_meter;
+static ModbusInterfaceConfig g_thermostat;
+static JSON_Value* g_meterValue;
+static JSON_Value* g_thermostatValue;
+static SINGLYLINKEDLIST_HANDLE g_interfaces;
+
+// Provided by ModbusPnp.c in the adapter
+int ModbusPnp_GetListCount(
+    SINGLYLINKEDLIST_HANDLE list)
+{
+    int count = 0;
+    LIST_ITEM_HANDLE item = (NULL == list) ? NULL : singlylinkedlist_get_head_item(list);
+    while (NULL != item)
+    {
+        count++;
+        item = singlylinkedlist_get_next_item(item);
+    }
+    return count;
+}
+
+#ifndef WIN32
+// Provided by ModbusPnp.c in the adapter, which connects to any host
+int ModbusPnp_OpenSocket(
+    MODBUS_TCP_CONFIG* tcpConfig,
+    SOCKET* socketHandle)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(tcpConfig->Port);
+
+    *socketHandle = socket(AF_INET, SOCK_STREAM, 0);
+    if (*socketHandle < 0 || 0 != connect(*socketHandle, (struct sockaddr*)&address, sizeof(address)))
+    {
+        if (*socketHandle >= 0)
+        {
+            (void)close(*socketHandle);
+        }
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    int noDelay = 1;
+    (void)setsockopt(*socketHandle, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return IOTHUB_CLIENT_OK;
+}
+
+// Provided by ModbusPnp.c in the adapter, which also sets the serial settings
+int ModbusPnp_OpenSerial(
+    MODBUS_RTU_CONFIG* rtuConfig,
+    HANDLE* serialHandle)
+{
+    struct termios settings;
+
+    *serialHandle = open(rtuConfig->Port, O_RDWR | O_NOCTTY);
+    if (*serialHandle < 0)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+    if (0 == tcgetattr(*serialHandle, &settings))
+    {
+        cfmakeraw(&settings);
+        (void)tcsetattr(*serialHandle, TCSANOW, &settings);
+    }
+    return IOTHUB_CLIENT_OK;
+}
+#endif
+
+static void test_set_fingerprint(
+    ModbusInterfaceConfig* interfaceConfig,
+    const char* id,
+    ModbusProperty* fingerprint,
+    JSON_Value* value)
+{
+    memset(fingerprint, 0, sizeof(ModbusProperty));
+    fingerprint->Name = "fingerprint";
+    fingerprint->StartAddress = "40003";
+    fingerprint->Length = 1;
+    fingerprint->DataType = NUMERIC;
+    fingerprint->ConversionCoefficient = 1;
+
+    memset(interfaceConfig, 0, sizeof(ModbusInterfaceConfig));
+    interfaceConfig->Id = id;
+    interfaceConfig->Fingerprint = fingerprint;
+    interfaceConfig->FingerprintValue = value;
+}
+
+static void test_start_simulator(
+    MODBUS_SIMULATOR* simulator,
+    bool rtu)
+{
+    MODBUS_SIMULATOR_OPTIONS options;
+    memset(&options, 0, sizeof(options));
+    options.Devices = 1;
+    options.Rtu = rtu;
+    options.Connections = TEST_CONNECTIONS;
+    options.LatencyMs = 1;
+    for (size_t i = 0; i < sizeof(g_units); i++)
+    {
+        ModbusTestSlave_AddUnit(options.Units, g_units[i]);
+    }
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(simulator, &options));
+}
+
+// Every unit of the simulator up to lastUnitId was found, and is a meter
+static void test_assert_units(
+    const MODBUS_DISCOVERY_RESULT* result,
+    int lastUnitId)
+{
+    int count = 0;
+    for (size_t i = 0; i < sizeof(g_units) && g_units[i] <= lastUnitId; i++)
+    {
+        ASSERT_IS_TRUE(count < result->UnitCount);
+        ASSERT_ARE_EQUAL(int, g_units[i], result->Units[count].UnitId);
+        ASSERT_IS_TRUE(&g_meter == result->Units[count].Interface);
+        count++;
+    }
+    ASSERT_ARE_EQUAL(int, count, result->UnitCount);
+}
+
+BEGIN_TEST_SUITE(modbus_discovery_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    g_meterValue = json_value_init_number(3);
+    g_thermostatValue = json_value_init_number(7);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    json_value_free(g_thermostatValue);
+    json_value_free(g_meterValue);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    // The thermostat comes first, so that every unit is matched against both
+    test_set_fingerprint(&g_thermostat, "thermostat", &g_thermostatFingerprint, g_thermostatValue);
+    test_set_fingerprint(&g_meter, "meter", &g_meterFingerprint, g_meterValue);
+    g_interfaces = singlylinkedlist_create();
+    (void)singlylinkedlist_add(g_interfaces, &g_thermostat);
+    (void)singlylinkedlist_add(g_interfaces, &g_meter);
+}
+
+TEST_FUNCTION_CLEANUP(TestMethodCleanup)
+{
+    singlylinkedlist_destroy(g_interfaces);
+}
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusDiscovery_scans_a_sparse_gateway_over_several_connections)
+{
+    // arrange
+    MODBUS_SIMULATOR simulator;
+    MODBUS_DISCOVERY_OPTIONS options;
+    MODBUS_DISCOVERY_RESULT parallel;
+    MODBUS_DISCOVERY_RESULT serial;
+    ModbusDeviceConfig device;
+    char adapterConfig[TEST_CONFIG_LENGTH];
+    test_start_simulator(&simulator, false);
+
+    memset(&device, 0, sizeof(device));
+    device.ConnectionType = TCP;
+    device.ConnectionConfig.TcpConfig.Host = TEST_HOST;
+    device.ConnectionConfig.TcpConfig.Port = (uint16_t)atoi(simulator.Endpoints[0]);
+    ModbusDiscovery_InitOptions(&options);
+    options.TimeoutMs = TEST_TCP_TIMEOUT_MS;
+
+    // act
+    IOTHUB_CLIENT_RESULT parallelResult = ModbusDiscovery_Scan(&device, g_interfaces, &options, &parallel);
+    options.Connections = 1;
+    IOTHUB_CLIENT_RESULT serialResult = ModbusDiscovery_Scan(&device, g_interfaces, &options, &serial);
+    ModbusSimulator_Stop(&simulator);
+
+    (void)snprintf(adapterConfig, sizeof(adapterConfig), "{\"tcp\":{\"host\":\"" TEST_HOST "\",\"port\":%s}}", simulator.Endpoints[0]);
+    JSON_Value* adapterConfigValue = json_parse_string(adapterConfig);
+    char* components = ModbusDiscovery_FormatComponents(json_value_get_object(adapterConfigValue), &parallel, "meter");
+
+    // assert: the same units are found either way, the absent ones timing out side by side
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, parallelResult);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, serialResult);
+    test_assert_units(&parallel, MODBUS_DISCOVERY_LAST_UNIT_ID);
+    test_assert_units(&serial, MODBUS_DISCOVERY_LAST_UNIT_ID);
+    ASSERT_ARE_EQUAL(int, parallel.Probes, serial.Probes);
+    ASSERT_IS_TRUE(parallel.ElapsedMs * 4 < serial.ElapsedMs);
+
+    // Each unit becomes a component with the connection it was found on
+    ASSERT_IS_NOT_NULL(components);
+    JSON_Value* componentsValue = json_parse_string(components);
+    JSON_Array* componentArray = json_value_get_array(componentsValue);
+    ASSERT_ARE_EQUAL(int, (int)sizeof(g_units), (int)json_array_get_count(componentArray));
+    JSON_Object* first = json_array_get_object(componentArray, 0);
+    ASSERT_ARE_EQUAL(char_ptr, "meter3", json_object_get_string(first, "pnp_bridge_component_name"));
+    ASSERT_ARE_EQUAL(char_ptr, PNP_CONFIG_ADAPTER_MODBUS_ADAPTER_ID, json_object_get_string(first, "pnp_bridge_adapter_id"));
+    ASSERT_ARE_EQUAL(int, 3, (int)json_object_dotget_number(first, "pnp_bridge_adapter_config.unit_id"));
+    ASSERT_ARE_EQUAL(char_ptr, "meter", json_object_dotget_string(first, "pnp_bridge_adapter_config.modbus_identity"));
+    ASSERT_ARE_EQUAL(char_ptr, TEST_HOST, json_object_dotget_string(first, "pnp_bridge_adapter_config.tcp.host"));
+
+    (void)printf("discovery: %d of %d unit IDs found in %u ms over %d connections, %u ms over 1, %d probes\r\n",
+        parallel.UnitCount, MODBUS_DISCOVERY_LAST_UNIT_ID, parallel.ElapsedMs, TEST_CONNECTIONS, serial.ElapsedMs, parallel.Probes);
+
+    json_value_free(componentsValue);
+    json_free_serialized_string(components);
+    json_value_free(adapterConfigValue);
+}
+
+TEST_FUNCTION(ModbusDiscovery_sweeps_a_serial_line_one_unit_at_a_time)
+{
+    // arrange
+    MODBUS_SIMULATOR simulator;
+    MODBUS_DISCOVERY_OPTIONS options;
+    MODBUS_DISCOVERY_RESULT result;
+    ModbusDeviceConfig device;
+    test_start_simulator(&simulator, true);
+
+    memset(&device, 0, sizeof(device));
+    device.ConnectionType = RTU;
+    device.ConnectionConfig.RtuConfig.Port = simulator.Endpoints[0];
+    device.ConnectionConfig.RtuConfig.BaudRate = TEST_RTU_BAUD_RATE;
+    ModbusDiscovery_InitOptions(&options);
+    options.LastUnitId = TEST_RTU_LAST_UNIT_ID;
+    options.TimeoutMs = TEST_RTU_TURNAROUND_MS;
+
+    // act
+    IOTHUB_CLIENT_RESULT scanResult = ModbusDiscovery_Scan(&device, g_interfaces, &options, &result);
+    ModbusSimulator_Stop(&simulator);
+
+    // assert: each absent unit took about its turnaround, rather than the second a poll waits
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, scanResult);
+    test_assert_units(&result, TEST_RTU_LAST_UNIT_ID);
+    ASSERT_IS_TRUE(result.ElapsedMs < (uint32_t)(TEST_RTU_LAST_UNIT_ID * TEST_RTU_TURNAROUND_MS * 3));
+
+    (void)printf("discovery: %d of %d unit IDs found on a serial line at %d baud in %u ms\r\n",
+        result.UnitCount, TEST_RTU_LAST_UNIT_ID, TEST_RTU_BAUD_RATE, result.ElapsedMs);
+}
+#endif
+
+TEST_FUNCTION(ModbusDiscovery_rejects_the_broadcast_address)
+{
+    // arrange
+    MODBUS_DISCOVERY_OPTIONS options;
+    MODBUS_DISCOVERY_RESULT result;
+    ModbusDeviceConfig device;
+    memset(&device, 0, sizeof(device));
+    device.ConnectionType = TCP;
+    ModbusDiscovery_InitOptions(&options);
+    options.FirstUnitId = 0;
+
+    // act
+    IOTHUB_CLIENT_RESULT scanResult = ModbusDiscovery_Scan(&device, g_interfaces, &options, &result);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_ARG, scanResult);
+    ASSERT_ARE_EQUAL(int, 0, result.UnitCount);
+}
+
+END_TEST_SUITE(modbus_discovery_ut)
@@ -0,0 +1,622 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "parson.h"
+
+#include "ModbusPnp.h"
+#include "ModbusReadPlanner.h"
+#include "ModbusScheduler.h"
+#include "modbus_simulator.h"
+
+#define TEST_DEVICES 16
+#define TEST_REGISTERS 300
+#define TEST_BUNDLE_REGISTERS 50
+#define TEST_STARTUP_DEVICES 500
+#define TEST_STARTUP_CONNECTIONS 4
+#define TEST_STARTUP_PERIOD_MS 1000
+#define TEST_PERIOD_MS 100
+#define TEST_SIGNAL_REGISTERS 10
+#define TEST_MIN_INTERVAL_MS 25
+#define TEST_MAX_INTERVAL_MS 800
+#define TEST_DEADBAND 2
+#define TEST_RAMP_MS 5
+#define TEST_RUN_MS 2000
+#define TEST_MAX_SAMPLES (2 * TEST_RUN_MS / TEST_PERIOD_MS)
+#define TEST_NAME_LENGTH 16
+#define TEST_CONFIG_LENGTH 256
+#define TEST_INTERFACE_LENGTH (64 + TEST_REGISTERS * 128)
+#define TEST_IDENTITY "simulated"
+
+// A component of the bridge, which the adapter is handed as a component handle
+typedef struct TEST_COMPONENT {
+    void* Context;
+    char Name[TEST_NAME_LENGTH];
+    JSON_Value* Config;
+    int Messages;           // Telemetry messages sent
+    int Reports;            // Telemetry values sent
+    int WrongValues;        // Values that are not those the simulator holds
+    int Polls;              // Values of the first register, which is read once per poll
+    bool Signalled;         // The simulator adds a signal to the values, which the first register
+    int Signal;             // of a poll is taken as
+    uint64_t SignalSeenMs;  // When the signal was first seen to move
+    tickcounter_ms_t LastPoll;
+    int Jitter[TEST_MAX_SAMPLES];   // How much later or sooner than its period each poll came
+    int JitterCount;
+} TEST_COMPONENT;
+
+extern PNP_ADAPTER ModbusPnpInterface;
+
+static TEST_COMPONENT g_components[TEST_STARTUP_DEVICES];
+static void* g_adapterContext;
+static JSON_Value* g_adapterConfig;
+static char g_client;
+static LOCK_HANDLE g_reportLock;
+static TICK_COUNTER_HANDLE g_tickCounter;
+
+// Provided by the bridge, in place of the component and adapter handles it gives the adapter
+void PnpAdapterHandleSetContext(
+    PNPBRIDGE_ADAPTER_HANDLE AdapterHandle,
+    void* AdapterContext)
+{
+    *(void**)AdapterHandle = AdapterContext;
+}
+
+void* PnpAdapterHandleGetContext(
+    PNPBRIDGE_ADAPTER_HANDLE AdapterHandle)
+{
+    return *(void**)AdapterHandle;
+}
+
+void PnpComponentHandleSetContext(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle,
+    void* ComponentDeviceContext)
+{
+    ((TEST_COMPONENT*)ComponentHandle)->Context = ComponentDeviceContext;
+}
+
+void* PnpComponentHandleGetContext(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle)
+{
+    return ((TEST_COMPONENT*)ComponentHandle)->Context;
+}
+
+void PnpComponentHandleSetPropertyUpdateCallback(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle,
+    PNPBRIDGE_COMPONENT_PROPERTY_CALLBACK PropertyUpdateCallback)
+{
+    (void)ComponentHandle;
+    (void)PropertyUpdateCallback;
+}
+
+void PnpComponentHandleSetCommandCallback(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle,
+    PNPBRIDGE_COMPONENT_METHOD_CALLBACK CommandCallback)
+{
+    (void)ComponentHandle;
+    (void)CommandCallback;
+}
+
+PNP_BRIDGE_CLIENT_HANDLE PnpComponentHandleGetClientHandle(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle)
+{
+    (void)ComponentHandle;
+    return (PNP_BRIDGE_CLIENT_HANDLE)&g_client;
+}
+
+PNP_BRIDGE_IOT_TYPE PnpComponentHandleGetIoTType(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle)
+{
+    (void)ComponentHandle;
+    return PNP_BRIDGE_IOT_TYPE_DEVICE;
+}
+
+// Provided by the bridge, in place of the hub. Telemetry is counted and checked against the
+// simulator, where register n holds n + 1, plus a signal if it has one, and the telemetry of
+// register n is named after n + 1. A message holds one value, or all the values of a poll when the
+// device bundles its telemetry.
+IOTHUB_MESSAGE_HANDLE PnP_CreateTelemetryMessageHandle(
+    const char* componentName,
+    const char* telemetryData)
+{
+    TEST_COMPONENT* component = &g_components[atoi(componentName + strlen("device"))];
+    const char* field = telemetryData;
+    int name = 0;
+    int value = 0;
+    int length = 0;
+    tickcounter_ms_t now = 0;
+
+    (void)tickcounter_get_current_ms(g_tickCounter, &now);
+    Lock(g_reportLock);
+    component->Messages++;
+    while (2 == sscanf(field + 1, "\"r%d\":%d%n", &name, &value, &length))
+    {
+        field += 1 + length;
+        component->Reports++;
+        if (component->Signalled && 1 == name && value - name != component->Signal)
+        {
+            component->Signal = value - name;
+            if (0 == component->SignalSeenMs)
+            {
+                component->SignalSeenMs = ModbusSimulator_GetTimeMs();
+            }
+        }
+
+        if (value - name != component->Signal)
+        {
+            component->WrongValues++;
+        }
+        else if (1 == name)
+        {
+            if (component->Polls > 0 && component->JitterCount < TEST_MAX_SAMPLES)
+            {
+                component->Jitter[component->JitterCount++] = abs((int)(now - component->LastPoll) - TEST_PERIOD_MS);
+            }
+            component->LastPoll = now;
+            component->Polls++;
+        }
+    }
+    if ('{' != telemetryData[0] || 0 != strcmp(field, "}"))
+    {
+        component->WrongValues++;
+    }
+    Unlock(g_reportLock);
+
+    return (IOTHUB_MESSAGE_HANDLE)component;
+}
+
+STRING_HANDLE PnP_CreateReportedProperty(
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue)
+{
+    (void)componentName;
+    (void)propertyName;
+    (void)propertyValue;
+    return NULL;
+}
+
+void IoTHubMessage_Destroy(
+    IOTHUB_MESSAGE_HANDLE iotHubMessageHandle)
+{
+    (void)iotHubMessageHandle;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_SendEventAsync(
+    IOTHUB_DEVICE_CLIENT_HANDLE iotHubClientHandle,
+    IOTHUB_MESSAGE_HANDLE eventMessageHandle,
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback,
+    void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)eventMessageHandle;
+    (void)eventConfirmationCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_SendReportedState(
+    IOTHUB_DEVICE_CLIENT_HANDLE iotHubClientHandle,
+    const unsigned char* reportedState,
+    size_t size,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback,
+    void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)reportedState;
+    (void)size;
+    (void)reportedStateCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+#ifndef WIN32
+// CPU time the test process has used, in microseconds. The simulator has a process of its own.
+static uint64_t test_get_cpu_us(void)
+{
+    struct rusage usage;
+    (void)getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+        (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static int test_compare_jitter(
+    const void* left,
+    const void* right)
+{
+    return *(const int*)left - *(const int*)right;
+}
+
+// Returns the 99th percentile of the poll jitter of the components
+static int test_get_p99_jitter(
+    int first,
+    int count)
+{
+    static int samples[TEST_DEVICES * TEST_MAX_SAMPLES];
+    int sampleCount = 0;
+
+    for (int c = first; c < first + count; c++)
+    {
+        memcpy(samples + sampleCount, g_components[c].Jitter, g_components[c].JitterCount * sizeof(int));
+        sampleCount += g_components[c].JitterCount;
+    }
+    if (0 == sampleCount)
+    {
+        return -1;
+    }
+
+    qsort(samples, sampleCount, sizeof(int), test_compare_jitter);
+    return samples[(sampleCount * 99) / 100];
+}
+
+// Resident memory of the test process, in kilobytes
+static int test_get_rss_kb(void)
+{
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (NULL == statm)
+    {
+        return -1;
+    }
+    if (1 != fscanf(statm, "%*ld %ld", &pages))
+    {
+        pages = 0;
+    }
+    (void)fclose(statm);
+    return (int)(pages * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+// Creates the adapter with an interface of one telemetry per register, from 40001 on, each read
+// every period, or adaptively with the polling settings given
+static void test_create_adapter(
+    int registers,
+    int period,
+    const char* polling)
+{
+    static char interfaceConfig[TEST_INTERFACE_LENGTH];
+    int length = snprintf(interfaceConfig, sizeof(interfaceConfig), "{\"" TEST_IDENTITY "\":{\"telemetry\":{");
+    for (int r = 1; r <= registers; r++)
+    {
+        length += snprintf(interfaceConfig + length, sizeof(interfaceConfig) - length,
+            "%s\"r%d\":{\"startAddress\":\"4%04d\",\"length\":1,\"dataType\":\"integer\",\"defaultFrequency\":%d,\"conversionCoefficient\":1%s}",
+            (1 == r) ? "" : ",", r, r, period, polling);
+    }
+    (void)snprintf(interfaceConfig + length, sizeof(interfaceConfig) - length, "}}}");
+
+    g_adapterConfig = json_parse_string(interfaceConfig);
+    ASSERT_IS_NOT_NULL(g_adapterConfig);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnpInterface.createAdapter(json_value_get_object(g_adapterConfig), &g_adapterContext));
+}
+
+static void test_destroy_adapter(void)
+{
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnpInterface.destroyAdapter(&g_adapterContext));
+    json_value_free(g_adapterConfig);
+    g_adapterConfig = NULL;
+}
+
+// Creates and starts a component polling a unit of the simulated device at an endpoint, a
+// loopback port or a terminal
+static void test_start_component(
+    int index,
+    const char* endpoint,
+    bool rtu,
+    int unitId,
+    bool bundle)
+{
+    TEST_COMPONENT* component = &g_components[index];
+    char config[TEST_CONFIG_LENGTH];
+
+    (void)snprintf(component->Name, sizeof(component->Name), "device%d", index);
+    if (rtu)
+    {
+        (void)snprintf(config, sizeof(config),
+            "{\"modbus_identity\":\"" TEST_IDENTITY "\",\"unit_id\":%d,\"bundle_telemetry\":%s,\"rtu\":{\"port\":\"%s\",\"baudRate\":\"115200\",\"dataBits\":8,\"stopBits\":\"ONE\",\"parity\":\"NONE\"}}",
+            unitId, bundle ? "true" : "false", endpoint);
+    }
+    else
+    {
+        (void)snprintf(config, sizeof(config),
+            "{\"modbus_identity\":\"" TEST_IDENTITY "\",\"unit_id\":%d,\"bundle_telemetry\":%s,\"tcp\":{\"host\":\"127.0.0.1\",\"port\":%s}}",
+            unitId, bundle ? "true" : "false", endpoint);
+    }
+
+    component->Config = json_parse_string(config);
+    ASSERT_IS_NOT_NULL(component->Config);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnpInterface.createPnpComponent(&g_adapterContext, component->Name,
+        json_value_get_object(component->Config), component));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnpInterface.startPnpComponent(&g_adapterContext, component));
+}
+
+// Stops a component, and returns the statistics of the scheduler that polled it
+static void test_stop_component(
+    int index,
+    MODBUS_SCHEDULER_STATISTICS* statistics)
+{
+    TEST_COMPONENT* component = &g_components[index];
+    PMODBUS_DEVICE_CONTEXT deviceContext = (PMODBUS_DEVICE_CONTEXT)component->Context;
+
+    ModbusScheduler_GetStatistics(deviceContext->Scheduler, statistics);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnpInterface.stopPnpComponent(component));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnpInterface.destroyPnpComponent(component));
+    json_value_free(component->Config);
+    component->Config = NULL;
+}
+#endif
+
+BEGIN_TEST_SUITE(modbus_polling_benchmark_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    g_reportLock = Lock_Init();
+    g_tickCounter = tickcounter_create();
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    tickcounter_destroy(g_tickCounter);
+    Lock_Deinit(g_reportLock);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    memset(g_components, 0, sizeof(g_components));
+}
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusPolling_benchmark_of_simulated_tcp_devices)
+{
+    // arrange: every register of every device is read each period
+    MODBUS_SIMULATOR simulator;
+    MODBUS_SIMULATOR_OPTIONS options;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+    uint64_t transactions = 0;
+    memset(&options, 0, sizeof(options));
+    options.Devices = TEST_DEVICES;
+    options.LatencyMs = 1;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&simulator, &options));
+    test_create_adapter(TEST_REGISTERS, TEST_PERIOD_MS, "");
+
+    // act
+    uint64_t cpuStart = test_get_cpu_us();
+    for (int d = 0; d < TEST_DEVICES; d++)
+    {
+        test_start_component(d, simulator.Endpoints[d], false, 1, true);
+    }
+    // Stopping halfway between polls rather than during one keeps the last poll of each device whole
+    ThreadAPI_Sleep(TEST_RUN_MS + TEST_PERIOD_MS / 2);
+    for (int d = 0; d < TEST_DEVICES; d++)
+    {
+        test_stop_component(d, &statistics);
+        transactions += statistics.Transactions;
+    }
+    uint64_t cpuUs = test_get_cpu_us() - cpuStart;
+    test_destroy_adapter();
+    ModbusSimulator_Stop(&simulator);
+
+    // assert: each device was polled once per period, with all of its values right
+    int values = 0;
+    for (int d = 0; d < TEST_DEVICES; d++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, g_components[d].WrongValues);
+        ASSERT_IS_TRUE(g_components[d].Polls >= (TEST_RUN_MS / TEST_PERIOD_MS) * 8 / 10);
+        ASSERT_ARE_EQUAL(int, g_components[d].Polls * TEST_REGISTERS, g_components[d].Reports);
+        ASSERT_ARE_EQUAL(int, g_components[d].Polls, g_components[d].Messages);
+        values += g_components[d].Reports;
+    }
+    int p99JitterMs = test_get_p99_jitter(0, TEST_DEVICES);
+    ASSERT_IS_TRUE(p99JitterMs >= 0 && p99JitterMs < TEST_PERIOD_MS / 2);
+
+    (void)printf("polling: %d devices of %d registers every %d ms, %d reads/s, %d values/s, p99 jitter %d ms, bridge CPU %d%%\r\n",
+        TEST_DEVICES, TEST_REGISTERS, TEST_PERIOD_MS, (int)(transactions * 1000 / TEST_RUN_MS), values * 1000 / TEST_RUN_MS,
+        p99JitterMs, (int)(cpuUs / 10 / TEST_RUN_MS));
+}
+
+TEST_FUNCTION(ModbusPolling_faulty_rtu_device_does_not_hold_back_others)
+{
+    // arrange: a device that loses every fifth response and refuses reads of its second block,
+    // next to a healthy one
+    MODBUS_SIMULATOR healthy;
+    MODBUS_SIMULATOR faulty;
+    MODBUS_SIMULATOR_OPTIONS options;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+    memset(&options, 0, sizeof(options));
+    options.Devices = 1;
+    options.LatencyMs = 1;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&healthy, &options));
+    options.Rtu = true;
+    options.DropEvery = 5;
+    options.ExceptionCode = 2;
+    options.ExceptionAddress = MODBUS_MAX_READ_REGISTERS;
+    options.ExceptionQuantity = 1;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&faulty, &options));
+    test_create_adapter(TEST_REGISTERS, TEST_PERIOD_MS, "");
+
+    // act
+    test_start_component(0, healthy.Endpoints[0], false, 1, true);
+    test_start_component(1, faulty.Endpoints[0], true, 1, true);
+    ThreadAPI_Sleep(TEST_RUN_MS);
+    test_stop_component(1, &statistics);
+    test_stop_component(0, &statistics);
+    test_destroy_adapter();
+    ModbusSimulator_Stop(&faulty);
+    ModbusSimulator_Stop(&healthy);
+
+    // assert: the healthy device kept its period, and the faulty one reported what it answered
+    ASSERT_ARE_EQUAL(int, 0, g_components[0].WrongValues);
+    ASSERT_IS_TRUE(g_components[0].Polls >= (TEST_RUN_MS / TEST_PERIOD_MS) * 8 / 10);
+    ASSERT_IS_TRUE(test_get_p99_jitter(0, 1) < TEST_PERIOD_MS / 2);
+    ASSERT_ARE_EQUAL(int, 0, g_components[1].WrongValues);
+    ASSERT_IS_TRUE(g_components[1].Polls > 0);
+    ASSERT_IS_TRUE(g_components[1].Reports < g_components[1].Polls * TEST_REGISTERS);
+
+    (void)printf("polling: faulty RTU device polled %d times, healthy TCP device %d times with p99 jitter %d ms\r\n",
+        g_components[1].Polls, g_components[0].Polls, test_get_p99_jitter(0, 1));
+}
+
+TEST_FUNCTION(ModbusPolling_bundled_telemetry_is_sent_once_per_poll)
+{
+    // arrange: one device polled with its telemetry sent value by value, then in bundles
+    MODBUS_SIMULATOR simulator;
+    MODBUS_SIMULATOR_OPTIONS options;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+    uint64_t cpuUs[2];
+    memset(&options, 0, sizeof(options));
+    options.Devices = 1;
+    options.LatencyMs = 1;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&simulator, &options));
+    test_create_adapter(TEST_BUNDLE_REGISTERS, TEST_PERIOD_MS, "");
+
+    // act
+    for (int c = 0; c < 2; c++)
+    {
+        uint64_t cpuStart = test_get_cpu_us();
+        test_start_component(c, simulator.Endpoints[0], false, 1, 1 == c);
+        ThreadAPI_Sleep(TEST_RUN_MS + TEST_PERIOD_MS / 2);
+        test_stop_component(c, &statistics);
+        cpuUs[c] = test_get_cpu_us() - cpuStart;
+    }
+    test_destroy_adapter();
+    ModbusSimulator_Stop(&simulator);
+
+    // assert: every value was sent either way, in one message per poll when bundled
+    for (int c = 0; c < 2; c++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, g_components[c].WrongValues);
+        ASSERT_IS_TRUE(g_components[c].Polls >= (TEST_RUN_MS / TEST_PERIOD_MS) * 8 / 10);
+        ASSERT_ARE_EQUAL(int, g_components[c].Polls * TEST_BUNDLE_REGISTERS, g_components[c].Reports);
+    }
+    ASSERT_ARE_EQUAL(int, g_components[0].Reports, g_components[0].Messages);
+    ASSERT_ARE_EQUAL(int, g_components[1].Polls, g_components[1].Messages);
+
+    (void)printf("polling: device of %d registers every %d ms, %d messages/s and bridge CPU %d us/s unbundled, %d messages/s and %d us/s bundled\r\n",
+        TEST_BUNDLE_REGISTERS, TEST_PERIOD_MS,
+        g_components[0].Messages * 1000 / TEST_RUN_MS, (int)(cpuUs[0] * 1000 / TEST_RUN_MS),
+        g_components[1].Messages * 1000 / TEST_RUN_MS, (int)(cpuUs[1] * 1000 / TEST_RUN_MS));
+}
+
+TEST_FUNCTION(ModbusPolling_adaptive_polling_of_step_and_ramp_signals)
+{
+    // arrange: a device whose registers step up, and one whose registers ramp up, both after
+    // holding steady for a while
+    MODBUS_SIMULATOR simulators[2];
+    MODBUS_SIMULATOR_OPTIONS options;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+    char polling[TEST_CONFIG_LENGTH];
+    int signalPolls[2];
+    memset(&options, 0, sizeof(options));
+    options.Devices = 1;
+    options.LatencyMs = 1;
+    options.SignalStartMs = ModbusSimulator_GetTimeMs() + TEST_RUN_MS;
+    options.RampMs = TEST_RAMP_MS;
+    options.Signal = MODBUS_SIMULATOR_STEP;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&simulators[0], &options));
+    options.Signal = MODBUS_SIMULATOR_RAMP;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&simulators[1], &options));
+    (void)snprintf(polling, sizeof(polling), ",\"minInterval\":%d,\"maxInterval\":%d,\"deadband\":%d",
+        TEST_MIN_INTERVAL_MS, TEST_MAX_INTERVAL_MS, TEST_DEADBAND);
+    test_create_adapter(TEST_SIGNAL_REGISTERS, TEST_PERIOD_MS, polling);
+
+    // act
+    for (int c = 0; c < 2; c++)
+    {
+        g_components[c].Signalled = true;
+        test_start_component(c, simulators[c].Endpoints[0], false, 1, true);
+    }
+    ThreadAPI_Sleep((unsigned int)(options.SignalStartMs - ModbusSimulator_GetTimeMs()));
+    for (int c = 0; c < 2; c++)
+    {
+        Lock(g_reportLock);
+        signalPolls[c] = g_components[c].Polls;
+        Unlock(g_reportLock);
+    }
+    ThreadAPI_Sleep(TEST_RUN_MS);
+    for (int c = 0; c < 2; c++)
+    {
+        test_stop_component(c, &statistics);
+        signalPolls[c] = g_components[c].Polls - signalPolls[c];
+    }
+    test_destroy_adapter();
+    ModbusSimulator_Stop(&simulators[1]);
+    ModbusSimulator_Stop(&simulators[0]);
+
+    // assert: both signals were seen within the longest interval. The steady device was read far
+    // less often than every period, and the ramp more often once it was seen moving.
+    int fixedPolls = 2 * TEST_RUN_MS / TEST_PERIOD_MS + 1;
+    int latencyMs[2];
+    for (int c = 0; c < 2; c++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, g_components[c].WrongValues);
+        ASSERT_IS_TRUE(g_components[c].SignalSeenMs >= options.SignalStartMs);
+        latencyMs[c] = (int)(g_components[c].SignalSeenMs - options.SignalStartMs);
+        ASSERT_IS_TRUE(latencyMs[c] <= TEST_MAX_INTERVAL_MS + TEST_PERIOD_MS);
+    }
+    ASSERT_IS_TRUE(g_components[0].Polls * 2 < fixedPolls);
+    ASSERT_IS_TRUE(signalPolls[1] > TEST_RUN_MS / TEST_PERIOD_MS);
+
+    (void)printf("adaptive: step seen after %d ms in %d reads, %d%% fewer than every %d ms; ramp seen after %d ms, then read %d times in %d ms\r\n",
+        latencyMs[0], g_components[0].Polls, 100 - g_components[0].Polls * 100 / fixedPolls, TEST_PERIOD_MS,
+        latencyMs[1], signalPolls[1], TEST_RUN_MS);
+}
+
+TEST_FUNCTION(ModbusPolling_startup_of_identical_devices)
+{
+    // arrange: units 1 and up of a few simulated gateways, all with the same modbus_identity
+    MODBUS_SIMULATOR simulator;
+    MODBUS_SIMULATOR_OPTIONS options;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t started = 0;
+    memset(&options, 0, sizeof(options));
+    options.Devices = TEST_STARTUP_CONNECTIONS;
+    options.LatencyMs = 1;
+    ASSERT_ARE_EQUAL(int, 0, ModbusSimulator_Start(&simulator, &options));
+    test_create_adapter(TEST_BUNDLE_REGISTERS, TEST_STARTUP_PERIOD_MS, "");
+
+    // act
+    int rssStartKb = test_get_rss_kb();
+    (void)tickcounter_get_current_ms(g_tickCounter, &start);
+    for (int d = 0; d < TEST_STARTUP_DEVICES; d++)
+    {
+        test_start_component(d, simulator.Endpoints[d % TEST_STARTUP_CONNECTIONS], false,
+            1 + d / TEST_STARTUP_CONNECTIONS, true);
+    }
+    (void)tickcounter_get_current_ms(g_tickCounter, &started);
+    int rssKb = test_get_rss_kb() - rssStartKb;
+    ThreadAPI_Sleep(TEST_RUN_MS);
+
+    // assert: every device reads the blocks compiled for the first, and was polled
+    const MODBUS_READ_TABLE* table = ((PMODBUS_DEVICE_CONTEXT)g_components[0].Context)->ReadPlan->Table;
+    for (int d = 0; d < TEST_STARTUP_DEVICES; d++)
+    {
+        ASSERT_IS_TRUE(table == ((PMODBUS_DEVICE_CONTEXT)g_components[d].Context)->ReadPlan->Table);
+    }
+    for (int d = 0; d < TEST_STARTUP_DEVICES; d++)
+    {
+        test_stop_component(d, &statistics);
+        ASSERT_ARE_EQUAL(int, 0, g_components[d].WrongValues);
+        ASSERT_IS_TRUE(g_components[d].Polls > 0);
+    }
+    test_destroy_adapter();
+    ModbusSimulator_Stop(&simulator);
+
+    int startupMs = (int)(started - start);
+    (void)printf("startup: %d devices of %d registers on %d connections started in %d ms (%d us each), %d KB resident (%d bytes each)\r\n",
+        TEST_STARTUP_DEVICES, TEST_BUNDLE_REGISTERS, TEST_STARTUP_CONNECTIONS, startupMs,
+        startupMs * 1000 / TEST_STARTUP_DEVICES, rssKb, rssKb * 1024 / TEST_STARTUP_DEVICES);
+}
+#endif
+
+END_TEST_SUITE(modbus_polling_benchmark_ut)
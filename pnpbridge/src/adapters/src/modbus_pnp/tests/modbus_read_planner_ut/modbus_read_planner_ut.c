@@ -0,0 +1,379 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusReadPlanner.h"
+#include "ModbusConnection/ModbusConnection.h"
+#include "modbus_test_slave.h"
+
+#define TEST_MAX_CAPABILITIES 256
+#define TEST_ADDRESS_LENGTH 8
+#define TEST_PERIOD 1000
+#define TEST_CYCLE_REGISTERS 40
+#define TEST_TRANSACTION_LATENCY_MS 2
+
+// Capabilities of the test interface
+static ModbusTelemetry g_telemetry[TEST_MAX_CAPABILITIES];
+static ModbusProperty g_properties[TEST_MAX_CAPABILITIES];
+static char g_telemetryAddresses[TEST_MAX_CAPABILITIES][TEST_ADDRESS_LENGTH];
+static char g_propertyAddresses[TEST_MAX_CAPABILITIES][TEST_ADDRESS_LENGTH];
+static int g_telemetryCount;
+static int g_propertyCount;
+static ModbusInterfaceConfig g_interface;
+static ModbusDeviceConfig g_device;
+static MODBUS_READ_PLAN* g_plan;
+
+// Provided by ModbusPnp.c in the adapter
+int ModbusPnp_GetListCount(
+    SINGLYLINKEDLIST_HANDLE list)
+{
+    int count = 0;
+    LIST_ITEM_HANDLE item = (NULL == list) ? NULL : singlylinkedlist_get_head_item(list);
+    while (NULL != item)
+    {
+        count++;
+        item = singlylinkedlist_get_next_item(item);
+    }
+    return count;
+}
+
+static ModbusTelemetry* test_add_telemetry(
+    int address,
+    uint16_t length,
+    ModbusDataType dataType,
+    int period)
+{
+    ModbusTelemetry* telemetry = &g_telemetry[g_telemetryCount];
+    (void)snprintf(g_telemetryAddresses[g_telemetryCount], TEST_ADDRESS_LENGTH, "%05d", address);
+    telemetry->Name = "telemetry";
+    telemetry->StartAddress = g_telemetryAddresses[g_telemetryCount];
+    telemetry->Length = length;
+    telemetry->DataType = dataType;
+    telemetry->ConversionCoefficient = 1.0;
+    telemetry->DefaultFrequency = period;
+    g_telemetryCount++;
+    (void)singlylinkedlist_add(g_interface.Events, telemetry);
+    return telemetry;
+}
+
+static ModbusProperty* test_add_property(
+    int address,
+    uint16_t length,
+    ModbusDataType dataType,
+    int period)
+{
+    ModbusProperty* property = &g_properties[g_propertyCount];
+    (void)snprintf(g_propertyAddresses[g_propertyCount], TEST_ADDRESS_LENGTH, "%05d", address);
+    property->Name = "property";
+    property->StartAddress = g_propertyAddresses[g_propertyCount];
+    property->Length = length;
+    property->DataType = dataType;
+    property->ConversionCoefficient = 1.0;
+    property->DefaultFrequency = period;
+    property->Access = READ_ONLY;
+    g_propertyCount++;
+    (void)singlylinkedlist_add(g_interface.Properties, property);
+    return property;
+}
+
+#ifndef WIN32
+static MODBUS_TEST_SLAVE g_slave;
+static CapabilityContext g_context;
+
+static void test_start_slave(void)
+{
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Start(&g_slave, TEST_TRANSACTION_LATENCY_MS, 1));
+
+    memset(&g_context, 0, sizeof(g_context));
+    g_context.hDevice = g_slave.MasterSocket;
+    g_context.hLock = Lock_Init();
+    g_context.connectionType = TCP;
+    g_context.unitId = 1;
+}
+
+static void test_stop_slave(void)
+{
+    ModbusTestSlave_Stop(&g_slave);
+    Lock_Deinit(g_context.hLock);
+}
+#endif
+
+BEGIN_TEST_SUITE(modbus_read_planner_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    g_interface.ReadTablesLock = Lock_Init();
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    Lock_Deinit(g_interface.ReadTablesLock);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    if (NULL != g_interface.Events)
+    {
+        singlylinkedlist_destroy(g_interface.Events);
+        singlylinkedlist_destroy(g_interface.Properties);
+    }
+    ModbusPnp_DestroyReadPlan(g_plan);
+    g_plan = NULL;
+    ModbusPnp_DestroyReadTables(&g_interface);
+
+    memset(g_telemetry, 0, sizeof(g_telemetry));
+    memset(g_properties, 0, sizeof(g_properties));
+    g_telemetryCount = 0;
+    g_propertyCount = 0;
+    g_interface.Events = singlylinkedlist_create();
+    g_interface.Properties = singlylinkedlist_create();
+    g_device.UnitId = 1;
+    g_device.ConnectionType = TCP;
+}
+
+TEST_FUNCTION(ModbusPnp_CreateReadPlan_merges_adjacent_registers)
+{
+    // arrange, in reverse order to show the plan does not depend on the order of the config
+    for (int i = TEST_CYCLE_REGISTERS; i > 0; i--)
+    {
+        (void)test_add_telemetry(40000 + i, 1, NUMERIC, TEST_PERIOD);
+    }
+
+    // act
+    IOTHUB_CLIENT_RESULT result = ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, 1, g_plan->BlockCount);
+    ASSERT_ARE_EQUAL(int, ReadHoldingRegisters, g_plan->Blocks[0].FunctionCode);
+    ASSERT_ARE_EQUAL(int, 0, g_plan->Blocks[0].StartAddress);
+    ASSERT_ARE_EQUAL(int, TEST_CYCLE_REGISTERS, g_plan->Blocks[0].Quantity);
+    ASSERT_ARE_EQUAL(int, TEST_CYCLE_REGISTERS, g_plan->Blocks[0].CapabilityCount);
+    for (int i = 0; i < TEST_CYCLE_REGISTERS; i++)
+    {
+        ASSERT_ARE_EQUAL(int, i, g_plan->Blocks[0].Capabilities[i].Offset);
+    }
+
+    // The request asks for the whole block
+    const MODBUS_READ_REG_PAYLOAD* payload = &(g_plan->Blocks[0].ReadRequest.TcpRequest.Payload);
+    ASSERT_ARE_EQUAL(int, ReadHoldingRegisters, payload->FunctionCode);
+    ASSERT_ARE_EQUAL(int, 0, (payload->StartAddr_Hi << 8) | payload->StartAddr_Lo);
+    ASSERT_ARE_EQUAL(int, TEST_CYCLE_REGISTERS, (payload->ReadLen_Hi << 8) | payload->ReadLen_Lo);
+    ASSERT_ARE_EQUAL(int, 1, g_plan->Blocks[0].ReadRequest.TcpRequest.MBAP.UnitID);
+}
+
+TEST_FUNCTION(ModbusPnp_CreateReadPlan_honors_the_gap_tolerance)
+{
+    // arrange
+    (void)test_add_telemetry(40001, 1, NUMERIC, TEST_PERIOD);
+    (void)test_add_telemetry(40006, 2, NUMERIC, TEST_PERIOD);
+
+    // act
+    IOTHUB_CLIENT_RESULT adjacentResult = ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan);
+    int adjacentBlockCount = g_plan->BlockCount;
+    ModbusPnp_DestroyReadPlan(g_plan);
+    IOTHUB_CLIENT_RESULT gapResult = ModbusPnp_CreateReadPlan(&g_device, &g_interface, 4, &g_plan);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, adjacentResult);
+    ASSERT_ARE_EQUAL(int, 2, adjacentBlockCount);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, gapResult);
+    ASSERT_ARE_EQUAL(int, 1, g_plan->BlockCount);
+    ASSERT_ARE_EQUAL(int, 7, g_plan->Blocks[0].Quantity);
+    ASSERT_ARE_EQUAL(int, 5, g_plan->Blocks[0].Capabilities[1].Offset);
+}
+
+TEST_FUNCTION(ModbusPnp_CreateReadPlan_shares_the_table_of_an_interface)
+{
+    // arrange
+    ModbusDeviceConfig otherDevice = g_device;
+    MODBUS_READ_PLAN* otherPlan = NULL;
+    MODBUS_READ_PLAN* gapPlan = NULL;
+    otherDevice.UnitId = 2;
+    (void)test_add_telemetry(40001, 1, NUMERIC, TEST_PERIOD);
+    (void)test_add_telemetry(40006, 2, NUMERIC, TEST_PERIOD);
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&otherDevice, &g_interface, 0, &otherPlan));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&otherDevice, &g_interface, 4, &gapPlan));
+
+    // assert: the devices read the same blocks, each with a request for its own unit
+    ASSERT_IS_TRUE(g_plan->Table == otherPlan->Table);
+    ASSERT_IS_TRUE(g_plan->Blocks[1].Capabilities == otherPlan->Blocks[1].Capabilities);
+    ASSERT_ARE_EQUAL(int, 1, g_plan->Blocks[1].ReadRequest.TcpRequest.MBAP.UnitID);
+    ASSERT_ARE_EQUAL(int, 2, otherPlan->Blocks[1].ReadRequest.TcpRequest.MBAP.UnitID);
+    ASSERT_IS_TRUE(gapPlan->Table != g_plan->Table);
+    ASSERT_ARE_EQUAL(int, 1, gapPlan->BlockCount);
+
+    ModbusPnp_DestroyReadPlan(otherPlan);
+    ModbusPnp_DestroyReadPlan(gapPlan);
+}
+
+TEST_FUNCTION(ModbusPnp_CreateReadPlan_splits_blocks_at_the_request_limit)
+{
+    // arrange
+    for (int i = 1; i <= MODBUS_MAX_READ_REGISTERS + 5; i++)
+    {
+        (void)test_add_telemetry(30000 + i, 1, NUMERIC, TEST_PERIOD);
+    }
+
+    // act
+    IOTHUB_CLIENT_RESULT result = ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, 2, g_plan->BlockCount);
+    ASSERT_ARE_EQUAL(int, ReadInputRegisters, g_plan->Blocks[0].FunctionCode);
+    ASSERT_ARE_EQUAL(int, MODBUS_MAX_READ_REGISTERS, g_plan->Blocks[0].Quantity);
+    ASSERT_ARE_EQUAL(int, MODBUS_MAX_READ_REGISTERS, g_plan->Blocks[1].StartAddress);
+    ASSERT_ARE_EQUAL(int, 5, g_plan->Blocks[1].Quantity);
+}
+
+TEST_FUNCTION(ModbusPnp_CreateReadPlan_keeps_function_codes_and_periods_apart)
+{
+    // arrange
+    (void)test_add_telemetry(40001, 1, NUMERIC, TEST_PERIOD);
+    (void)test_add_property(40002, 1, NUMERIC, TEST_PERIOD);
+    (void)test_add_telemetry(40003, 1, NUMERIC, 5 * TEST_PERIOD);
+    (void)test_add_telemetry(30002, 1, NUMERIC, TEST_PERIOD);
+    (void)test_add_telemetry(1, 1, FLAG, TEST_PERIOD);
+    (void)test_add_property(2, 1, FLAG, TEST_PERIOD);
+
+    // act
+    IOTHUB_CLIENT_RESULT result = ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan);
+
+    // assert: coils, holding and input registers polled every second, holding registers every 5s
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, 4, g_plan->BlockCount);
+    ASSERT_ARE_EQUAL(int, ReadCoils, g_plan->Blocks[0].FunctionCode);
+    ASSERT_ARE_EQUAL(int, 2, g_plan->Blocks[0].CapabilityCount);
+    ASSERT_ARE_EQUAL(int, ReadHoldingRegisters, g_plan->Blocks[1].FunctionCode);
+    ASSERT_ARE_EQUAL(int, 2, g_plan->Blocks[1].CapabilityCount);
+    ASSERT_ARE_EQUAL(int, Property, g_plan->Blocks[1].Capabilities[1].Type);
+    ASSERT_ARE_EQUAL(int, ReadInputRegisters, g_plan->Blocks[2].FunctionCode);
+    ASSERT_ARE_EQUAL(int, 5 * TEST_PERIOD, g_plan->Blocks[3].Period);
+}
+
+TEST_FUNCTION(ModbusPnp_CreateReadPlan_rejects_a_capability_longer_than_a_request)
+{
+    // arrange
+    (void)test_add_telemetry(40001, MODBUS_MAX_READ_REGISTERS + 1, NUMERIC, TEST_PERIOD);
+
+    // act
+    IOTHUB_CLIENT_RESULT result = ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_ARG, result);
+    ASSERT_IS_TRUE(NULL == g_plan);
+}
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusPnp_DecodeBlockCapability_decodes_each_capability_from_the_shared_response)
+{
+    // arrange
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    uint8_t value[MODBUS_RESPONSE_MAX_LENGTH];
+    ModbusTelemetry* half = test_add_telemetry(40003, 1, NUMERIC, TEST_PERIOD);
+    half->ConversionCoefficient = 0.5;
+    (void)test_add_telemetry(40004, 2, NUMERIC, TEST_PERIOD);
+    (void)test_add_telemetry(1, 1, FLAG, TEST_PERIOD);
+    (void)test_add_telemetry(2, 1, FLAG, TEST_PERIOD);
+    (void)test_add_telemetry(10, 1, FLAG, TEST_PERIOD);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&g_device, &g_interface, 8, &g_plan));
+    ASSERT_ARE_EQUAL(int, 2, g_plan->BlockCount);
+    test_start_slave();
+
+    // act
+    int coilResponseLength = ModbusPnp_ReadBlock(&g_context, &g_plan->Blocks[0], response, sizeof(response));
+
+    // assert: coil n is on when n is a multiple of 3
+    ASSERT_IS_TRUE(coilResponseLength > 0);
+    ASSERT_IS_TRUE(ModbusPnp_DecodeBlockCapability(TCP, &g_plan->Blocks[0], 0, response, g_plan->Blocks[0].StartAddress, value) > 0);
+    ASSERT_ARE_EQUAL(char_ptr, "true", (char*)value);
+    ASSERT_IS_TRUE(ModbusPnp_DecodeBlockCapability(TCP, &g_plan->Blocks[0], 1, response, g_plan->Blocks[0].StartAddress, value) > 0);
+    ASSERT_ARE_EQUAL(char_ptr, "false", (char*)value);
+    ASSERT_IS_TRUE(ModbusPnp_DecodeBlockCapability(TCP, &g_plan->Blocks[0], 2, response, g_plan->Blocks[0].StartAddress, value) > 0);
+    ASSERT_ARE_EQUAL(char_ptr, "true", (char*)value);
+
+    // act
+    int registerResponseLength = ModbusPnp_ReadBlock(&g_context, &g_plan->Blocks[1], response, sizeof(response));
+
+    // assert: register n holds n + 1, and a value over two registers comes high word first
+    ASSERT_IS_TRUE(registerResponseLength > 0);
+    ASSERT_IS_TRUE(ModbusPnp_DecodeBlockCapability(TCP, &g_plan->Blocks[1], 0, response, g_plan->Blocks[1].StartAddress, value) > 0);
+    ASSERT_ARE_EQUAL(char_ptr, "1.5", (char*)value);
+    ASSERT_IS_TRUE(ModbusPnp_DecodeBlockCapability(TCP, &g_plan->Blocks[1], 1, response, g_plan->Blocks[1].StartAddress, value) > 0);
+    ASSERT_ARE_EQUAL(char_ptr, "262149", (char*)value);
+
+    test_stop_slave();
+    ASSERT_ARE_EQUAL(int, 2, g_slave.Transactions);
+}
+
+// Bus time of one poll cycle of a device with 40 adjacent holding registers, reading each of them
+// on its own as the adapter used to, then with the read plan
+TEST_FUNCTION(ModbusPnp_ReadBlock_bus_time_per_poll_cycle)
+{
+    // arrange
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    uint8_t value[MODBUS_RESPONSE_MAX_LENGTH];
+    char expected[MODBUS_RESPONSE_MAX_LENGTH];
+    tickcounter_ms_t start;
+    tickcounter_ms_t singleEnd;
+    tickcounter_ms_t blockEnd;
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    ASSERT_IS_NOT_NULL(tickCounter);
+    for (int i = 1; i <= TEST_CYCLE_REGISTERS; i++)
+    {
+        (void)test_add_telemetry(40000 + i, 1, NUMERIC, TEST_PERIOD);
+    }
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&g_device, &g_interface, 0, &g_plan));
+    test_start_slave();
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_CYCLE_REGISTERS; i++)
+    {
+        g_context.capability = &g_telemetry[i];
+        ASSERT_IS_TRUE(ModbusPnp_ReadCapability(&g_context, Telemetry, value) > 0);
+        (void)snprintf(expected, sizeof(expected), "%d", i + 1);
+        ASSERT_ARE_EQUAL(char_ptr, expected, (char*)value);
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &singleEnd);
+    int singleTransactions = g_slave.Transactions;
+
+    for (int b = 0; b < g_plan->BlockCount; b++)
+    {
+        ASSERT_IS_TRUE(ModbusPnp_ReadBlock(&g_context, &g_plan->Blocks[b], response, sizeof(response)) > 0);
+        for (int i = 0; i < g_plan->Blocks[b].CapabilityCount; i++)
+        {
+            ASSERT_IS_TRUE(ModbusPnp_DecodeBlockCapability(TCP, &g_plan->Blocks[b], i, response, g_plan->Blocks[b].StartAddress, value) > 0);
+            (void)snprintf(expected, sizeof(expected), "%d", g_plan->Blocks[b].StartAddress + g_plan->Blocks[b].Capabilities[i].Offset + 1);
+            ASSERT_ARE_EQUAL(char_ptr, expected, (char*)value);
+        }
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &blockEnd);
+    test_stop_slave();
+    tickcounter_destroy(tickCounter);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, TEST_CYCLE_REGISTERS, singleTransactions);
+    ASSERT_ARE_EQUAL(int, TEST_CYCLE_REGISTERS + 1, g_slave.Transactions);
+    ASSERT_IS_TRUE(blockEnd - singleEnd < singleEnd - start);
+
+    (void)printf("read plan: %d registers per cycle in %d transaction(s), bus time %d ms per cycle (one read per register: %d transactions, %d ms)\r\n",
+        TEST_CYCLE_REGISTERS, g_slave.Transactions - singleTransactions, (int)(blockEnd - singleEnd),
+        singleTransactions, (int)(singleEnd - start));
+}
+#endif
+
+END_TEST_SUITE(modbus_read_planner_ut)
@@ -0,0 +1,284 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusReadPlanner.h"
+#include "ModbusConnection/ModbusRtuBus.h"
+#include "modbus_test_slave.h"
+
+#define TEST_BAUD_RATE 9600
+#define TEST_UNITS 4
+#define TEST_TRANSACTIONS_PER_UNIT 10
+#define TEST_LATENCY_MS 2
+#define TEST_CRC_BUFFER_SIZE 256
+#define TEST_CRC_ROUNDS 20000
+
+typedef struct TEST_UNIT {
+    MODBUS_RTU_BUS_HANDLE Bus;
+    uint8_t UnitId;
+    uint16_t Address;
+    int WrongValues;
+    int Failures;
+} TEST_UNIT;
+
+// Polls one unit on the bus. The slave holds n + 1 in register n, and answers as any unit ID.
+static int test_unit(
+    void* param)
+{
+    TEST_UNIT* unit = (TEST_UNIT*)param;
+    MODBUS_READ_REQUEST request;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+
+    ModbusRtu_EncodeReadRequest(&request, ReadHoldingRegisters, unit->Address, 1, unit->UnitId);
+    for (int i = 0; i < TEST_TRANSACTIONS_PER_UNIT; i++)
+    {
+        memset(response, 0, sizeof(response));
+        int responseLength = ModbusRtuBus_Transact(unit->Bus, request.RtuArr, sizeof(request.RtuArr), response, sizeof(response));
+        uint16_t value = (uint16_t)((response[RTU_HEADER_SIZE + 2] << 8) | response[RTU_HEADER_SIZE + 3]);
+        if (responseLength < 0)
+        {
+            unit->Failures++;
+        }
+        else if (responseLength != RTU_HEADER_SIZE + 6 || response[0] != unit->UnitId || value != unit->Address + 1)
+        {
+            unit->WrongValues++;
+        }
+    }
+
+    return 0;
+}
+
+// The CRC the way the specification describes it, one bit at a time
+static uint16_t test_bitwise_crc(
+    const uint8_t* message,
+    size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= message[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+#ifndef WIN32
+// Reads 10 holding registers from unit 1 over the bus, returning the response length
+static int test_read_ten_registers(
+    MODBUS_RTU_BUS_HANDLE bus,
+    uint8_t* response,
+    uint32_t responseSize)
+{
+    MODBUS_READ_REQUEST request;
+    ModbusRtu_EncodeReadRequest(&request, ReadHoldingRegisters, 0, 10, 1);
+    return ModbusRtuBus_Transact(bus, request.RtuArr, sizeof(request.RtuArr), response, responseSize);
+}
+#endif
+
+BEGIN_TEST_SUITE(modbus_rtu_bus_ut)
+
+TEST_FUNCTION(GetCRC_matches_the_bitwise_crc)
+{
+    // arrange
+    uint8_t known[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0A };
+    uint8_t buffer[TEST_CRC_BUFFER_SIZE];
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t tableEnd = 0;
+    tickcounter_ms_t bitwiseEnd = 0;
+    uint16_t tableSum = 0;
+    uint16_t bitwiseSum = 0;
+    srand(1);
+    for (int i = 0; i < TEST_CRC_BUFFER_SIZE; i++)
+    {
+        buffer[i] = (uint8_t)rand();
+    }
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_CRC_ROUNDS; i++)
+    {
+        buffer[0] = (uint8_t)i;
+        tableSum ^= GetCRC(buffer, TEST_CRC_BUFFER_SIZE);
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &tableEnd);
+    for (int i = 0; i < TEST_CRC_ROUNDS; i++)
+    {
+        buffer[0] = (uint8_t)i;
+        bitwiseSum ^= test_bitwise_crc(buffer, TEST_CRC_BUFFER_SIZE);
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &bitwiseEnd);
+    tickcounter_destroy(tickCounter);
+
+    // assert: read 10 registers from unit 1 goes out with CRC C5 CD
+    ASSERT_ARE_EQUAL(int, 0xCDC5, GetCRC(known, sizeof(known)));
+    for (size_t length = 0; length <= TEST_CRC_BUFFER_SIZE; length++)
+    {
+        ASSERT_ARE_EQUAL(int, test_bitwise_crc(buffer, length), GetCRC(buffer, length));
+    }
+    ASSERT_ARE_EQUAL(int, bitwiseSum, tableSum);
+
+    (void)printf("rtu crc: %d frames of %d bytes in %d ms with the table, %d ms bit by bit\r\n",
+        TEST_CRC_ROUNDS, TEST_CRC_BUFFER_SIZE, (int)(tableEnd - start), (int)(bitwiseEnd - tableEnd));
+}
+
+TEST_FUNCTION(ModbusRtu_GetResponseTimeoutMs_grows_with_the_frame_time)
+{
+    MODBUS_READ_REQUEST request;
+    ModbusRtu_EncodeReadRequest(&request, ReadHoldingRegisters, 0, 10, 1);
+
+    // assert: unit ID, function code, byte count, 20 bytes of data and the CRC
+    ASSERT_ARE_EQUAL(int, 25, (int)ModbusRtu_GetExpectedResponseLength(request.RtuArr));
+    ModbusRtu_EncodeReadRequest(&request, ReadCoils, 0, 9, 1);
+    ASSERT_ARE_EQUAL(int, 7, (int)ModbusRtu_GetExpectedResponseLength(request.RtuArr));
+
+    // 25 bytes of 11 bits take 29 ms at 9600 baud and 3 ms at 115200
+    ASSERT_ARE_EQUAL(int, MODBUS_RTU_TURNAROUND_TIMEOUT_MS + 29 + 4, (int)ModbusRtu_GetResponseTimeoutMs(9600, 25));
+    ASSERT_ARE_EQUAL(int, MODBUS_RTU_TURNAROUND_TIMEOUT_MS + 3 + 4, (int)ModbusRtu_GetResponseTimeoutMs(115200, 25));
+    ASSERT_ARE_EQUAL(int, (int)ModbusRtu_GetResponseTimeoutMs(MODBUS_RTU_DEFAULT_BAUD_RATE, 25), (int)ModbusRtu_GetResponseTimeoutMs(0, 25));
+}
+
+TEST_FUNCTION(ModbusRtu_GetInterFrameSilenceUs_is_three_and_a_half_characters)
+{
+    // 3.5 characters of 11 bits, rounded up, and fixed above 19200 baud
+    ASSERT_ARE_EQUAL(int, 4011, (int)ModbusRtu_GetInterFrameSilenceUs(9600));
+    ASSERT_ARE_EQUAL(int, 2006, (int)ModbusRtu_GetInterFrameSilenceUs(19200));
+    ASSERT_ARE_EQUAL(int, MODBUS_RTU_FIXED_SILENCE_US, (int)ModbusRtu_GetInterFrameSilenceUs(38400));
+    ASSERT_ARE_EQUAL(int, MODBUS_RTU_FIXED_SILENCE_US, (int)ModbusRtu_GetInterFrameSilenceUs(115200));
+}
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusRtuBus_serializes_units_with_inter_frame_silence)
+{
+    // arrange: several units on one segment, polled from threads of their own
+    MODBUS_TEST_SLAVE slave;
+    TEST_UNIT units[TEST_UNITS];
+    THREAD_HANDLE threads[TEST_UNITS];
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_StartRtu(&slave, TEST_LATENCY_MS));
+    MODBUS_RTU_BUS_HANDLE bus = ModbusRtuBus_Create(slave.MasterSocket, TEST_BAUD_RATE);
+    ASSERT_IS_NOT_NULL(bus);
+    slave.MasterSocket = -1;
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_UNITS; i++)
+    {
+        units[i].Bus = bus;
+        units[i].UnitId = (uint8_t)(i + 1);
+        units[i].Address = (uint16_t)(100 * i);
+        units[i].WrongValues = 0;
+        units[i].Failures = 0;
+        ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&threads[i], test_unit, &units[i]));
+    }
+    for (int i = 0; i < TEST_UNITS; i++)
+    {
+        (void)ThreadAPI_Join(threads[i], NULL);
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+    ModbusRtuBus_Destroy(bus);
+    ModbusTestSlave_Stop(&slave);
+    tickcounter_destroy(tickCounter);
+
+    // assert: no frame ran into another, and the line was silent long enough before each
+    for (int i = 0; i < TEST_UNITS; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, units[i].Failures);
+        ASSERT_ARE_EQUAL(int, 0, units[i].WrongValues);
+    }
+    ASSERT_ARE_EQUAL(int, TEST_UNITS * TEST_TRANSACTIONS_PER_UNIT, slave.Transactions);
+    ASSERT_IS_TRUE(slave.MinSilenceUs >= (int)ModbusRtu_GetInterFrameSilenceUs(TEST_BAUD_RATE));
+
+    (void)printf("rtu bus: %d transactions from %d units in %d ms at %d baud, shortest silence %d us\r\n",
+        slave.Transactions, TEST_UNITS, (int)(end - start), TEST_BAUD_RATE, slave.MinSilenceUs);
+}
+
+TEST_FUNCTION(ModbusRtuBus_puts_together_a_response_that_arrives_in_pieces)
+{
+    // arrange
+    MODBUS_TEST_SLAVE slave;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_StartRtu(&slave, 0));
+    slave.ResponseGapMs = 20;
+    MODBUS_RTU_BUS_HANDLE bus = ModbusRtuBus_Create(slave.MasterSocket, TEST_BAUD_RATE);
+    ASSERT_IS_NOT_NULL(bus);
+    slave.MasterSocket = -1;
+
+    // act
+    int responseLength = test_read_ten_registers(bus, response, sizeof(response));
+
+    // assert: register 9 holds 10
+    ASSERT_ARE_EQUAL(int, 25, responseLength);
+    ASSERT_ARE_EQUAL(int, 10, (response[RTU_HEADER_SIZE + 20] << 8) | response[RTU_HEADER_SIZE + 21]);
+
+    ModbusRtuBus_Destroy(bus);
+    ModbusTestSlave_Stop(&slave);
+}
+
+TEST_FUNCTION(ModbusRtuBus_gives_up_on_a_silent_slave_at_the_deadline)
+{
+    // arrange
+    MODBUS_TEST_SLAVE slave;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_StartRtu(&slave, 0));
+    slave.Mute = true;
+    MODBUS_RTU_BUS_HANDLE bus = ModbusRtuBus_Create(slave.MasterSocket, TEST_BAUD_RATE);
+    ASSERT_IS_NOT_NULL(bus);
+    slave.MasterSocket = -1;
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    int responseLength = test_read_ten_registers(bus, response, sizeof(response));
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+
+    // assert
+    // The wait covers sending the request as well as the response of 25 bytes
+    int timeoutMs = (int)ModbusRtu_GetResponseTimeoutMs(TEST_BAUD_RATE, RTU_REQUEST_SIZE + 25);
+    ASSERT_ARE_EQUAL(int, -1, responseLength);
+    ASSERT_IS_TRUE((int)(end - start) >= timeoutMs);
+    ASSERT_IS_TRUE((int)(end - start) < timeoutMs + 250);
+
+    ModbusRtuBus_Destroy(bus);
+    ModbusTestSlave_Stop(&slave);
+    tickcounter_destroy(tickCounter);
+}
+
+TEST_FUNCTION(ModbusRtuBus_rejects_a_response_with_a_bad_crc)
+{
+    // arrange
+    MODBUS_TEST_SLAVE slave;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_StartRtu(&slave, 0));
+    slave.CorruptCrc = true;
+    MODBUS_RTU_BUS_HANDLE bus = ModbusRtuBus_Create(slave.MasterSocket, TEST_BAUD_RATE);
+    ASSERT_IS_NOT_NULL(bus);
+    slave.MasterSocket = -1;
+
+    // act
+    int responseLength = test_read_ten_registers(bus, response, sizeof(response));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, -1, responseLength);
+
+    ModbusRtuBus_Destroy(bus);
+    ModbusTestSlave_Stop(&slave);
+}
+#endif
+
+END_TEST_SUITE(modbus_rtu_bus_ut)
@@ -0,0 +1,565 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <netinet/in.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusScheduler.h"
+#include "ModbusReadPlanner.h"
+#include "ModbusConnection/ModbusConnection.h"
+#include "modbus_test_slave.h"
+
+#define TEST_MAX_DEVICES 2
+#define TEST_MAX_CAPABILITIES 8
+#define TEST_ADDRESS_LENGTH 8
+#define TEST_RUN_MS 1000
+#define TEST_OUTAGES 3
+#define TEST_OUTAGE_MS 500
+#define TEST_RECOVERY_TIMEOUT_MS 10000
+
+typedef struct TEST_DEVICE {
+    MODBUS_DEVICE_CONTEXT Context;
+    ModbusDeviceConfig Config;
+    ModbusInterfaceConfig Interface;
+    ModbusTelemetry Telemetry[TEST_MAX_CAPABILITIES];
+    char Addresses[TEST_MAX_CAPABILITIES][TEST_ADDRESS_LENGTH];
+    int TelemetryCount;
+    int Reports[TEST_MAX_CAPABILITIES];
+    int WrongValues;
+    MODBUS_BLOCK_CHANGE Change;     // How the values of the device are reported to move
+    MODBUS_TEST_SLAVE Slave;
+} TEST_DEVICE;
+
+static TEST_DEVICE g_devices[TEST_MAX_DEVICES];
+static LOCK_HANDLE g_reportLock;
+
+// Provided by ModbusPnp.c in the adapter
+int ModbusPnp_GetListCount(
+    SINGLYLINKEDLIST_HANDLE list)
+{
+    int count = 0;
+    LIST_ITEM_HANDLE item = (NULL == list) ? NULL : singlylinkedlist_get_head_item(list);
+    while (NULL != item)
+    {
+        count++;
+        item = singlylinkedlist_get_next_item(item);
+    }
+    return count;
+}
+
+// Provided by ModbusCapability.c in the adapter. Counts the reports of each telemetry, and checks
+// its value against the test slave, which holds n + 1 in register n. The values move as the test
+// set the Change of their device.
+MODBUS_BLOCK_CHANGE ModbusPnp_ReportBlock(
+    CapabilityContext* context,
+    const MODBUS_READ_BLOCK* block,
+    const uint8_t* response,
+    uint16_t responseStartAddress,
+    double* lastValues)
+{
+    uint8_t value[MODBUS_RESPONSE_MAX_LENGTH];
+    char expected[MODBUS_RESPONSE_MAX_LENGTH];
+    MODBUS_BLOCK_CHANGE change = MODBUS_BLOCK_CHANGED;
+
+    (void)lastValues;
+
+    Lock(g_reportLock);
+    for (int i = 0; i < block->CapabilityCount; i++)
+    {
+        for (int d = 0; d < TEST_MAX_DEVICES; d++)
+        {
+            TEST_DEVICE* device = &g_devices[d];
+            ModbusTelemetry* telemetry = (ModbusTelemetry*)block->Capabilities[i].Capability;
+            if (telemetry < device->Telemetry || telemetry >= device->Telemetry + TEST_MAX_CAPABILITIES)
+            {
+                continue;
+            }
+
+            memset(value, 0, sizeof(value));
+            (void)ModbusPnp_DecodeBlockCapability(context->connectionType, block, i, response, responseStartAddress, value);
+            (void)snprintf(expected, sizeof(expected), "%d", block->StartAddress + block->Capabilities[i].Offset + 1);
+            if (0 != strcmp(expected, (char*)value))
+            {
+                device->WrongValues++;
+            }
+            device->Reports[telemetry - device->Telemetry]++;
+            change = device->Change;
+        }
+    }
+    Unlock(g_reportLock);
+    return change;
+}
+
+// Provided by ModbusCapability.c in the adapter. The devices here report each value on its own.
+void ModbusPnp_SendTelemetryBundle(
+    CapabilityContext* context)
+{
+    (void)context;
+}
+
+static void test_add_telemetry(
+    TEST_DEVICE* device,
+    int address,
+    int period)
+{
+    ModbusTelemetry* telemetry = &(device->Telemetry[device->TelemetryCount]);
+    (void)snprintf(device->Addresses[device->TelemetryCount], TEST_ADDRESS_LENGTH, "%05d", address);
+    telemetry->Name = "telemetry";
+    telemetry->StartAddress = device->Addresses[device->TelemetryCount];
+    telemetry->Length = 1;
+    telemetry->DataType = NUMERIC;
+    telemetry->ConversionCoefficient = 1.0;
+    telemetry->DefaultFrequency = period;
+    telemetry->Polling.MinInterval = period;
+    telemetry->Polling.MaxInterval = period;
+    device->TelemetryCount++;
+    (void)singlylinkedlist_add(device->Interface.Events, telemetry);
+}
+
+// Lets the last telemetry added to a device be polled every minInterval to maxInterval
+static void test_set_adaptive(
+    TEST_DEVICE* device,
+    int minInterval,
+    int maxInterval)
+{
+    ModbusTelemetry* telemetry = &(device->Telemetry[device->TelemetryCount - 1]);
+    telemetry->Polling.MinInterval = minInterval;
+    telemetry->Polling.MaxInterval = maxInterval;
+}
+
+static int test_get_reports(
+    TEST_DEVICE* device,
+    int index)
+{
+    Lock(g_reportLock);
+    int reports = device->Reports[index];
+    Unlock(g_reportLock);
+    return reports;
+}
+
+#ifndef WIN32
+// Plans the reads of a device and connects it to a test slave answering after latencyMs
+static PMODBUS_DEVICE_CONTEXT test_start_device(
+    TEST_DEVICE* device,
+    int latencyMs,
+    int concurrency)
+{
+    // Unit 1, unless the test picked another
+    if (0 == device->Config.UnitId)
+    {
+        device->Config.UnitId = 1;
+    }
+    device->Config.ConnectionType = TCP;
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&(device->Config), &(device->Interface),
+        device->Config.ReadGapTolerance, &(device->Context.ReadPlan)));
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Start(&(device->Slave), latencyMs, concurrency));
+
+    device->Context.hDevice = device->Slave.MasterSocket;
+    device->Context.hConnectionLock = Lock_Init();
+    device->Context.DeviceConfig = &(device->Config);
+    device->Context.InterfaceConfig = &(device->Interface);
+    device->Context.ComponentName = "modbusDevice";
+    return &(device->Context);
+}
+
+// Connects a reconnecting link to the listening slave of a device
+static SOCKET test_connect(
+    void* context)
+{
+    MODBUS_TEST_SLAVE* slave = (MODBUS_TEST_SLAVE*)context;
+    struct sockaddr_in address;
+
+    SOCKET socketHandle = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketHandle < 0)
+    {
+        return INVALID_SOCKET;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(slave->Port);
+    if (0 != connect(socketHandle, (struct sockaddr*)&address, sizeof(address)))
+    {
+        (void)close(socketHandle);
+        return INVALID_SOCKET;
+    }
+    return socketHandle;
+}
+
+// CPU time the test process has used, in milliseconds
+static uint64_t test_get_cpu_ms(void)
+{
+    struct rusage usage;
+    (void)getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 +
+        (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+static void test_stop_device(
+    TEST_DEVICE* device)
+{
+    ModbusTestSlave_Stop(&(device->Slave));
+    Lock_Deinit(device->Context.hConnectionLock);
+    ModbusPnp_DestroyReadPlan(device->Context.ReadPlan);
+    device->Context.ReadPlan = NULL;
+}
+#endif
+
+BEGIN_TEST_SUITE(modbus_scheduler_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    g_reportLock = Lock_Init();
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    for (int d = 0; d < TEST_MAX_DEVICES; d++)
+    {
+        if (NULL != g_devices[d].Interface.Events)
+        {
+            singlylinkedlist_destroy(g_devices[d].Interface.Events);
+        }
+        if (NULL != g_devices[d].Interface.ReadTablesLock)
+        {
+            Lock_Deinit(g_devices[d].Interface.ReadTablesLock);
+        }
+    }
+    Lock_Deinit(g_reportLock);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    for (int d = 0; d < TEST_MAX_DEVICES; d++)
+    {
+        if (NULL != g_devices[d].Interface.Events)
+        {
+            singlylinkedlist_destroy(g_devices[d].Interface.Events);
+        }
+        ModbusPnp_DestroyReadTables(&(g_devices[d].Interface));
+        if (NULL != g_devices[d].Interface.ReadTablesLock)
+        {
+            Lock_Deinit(g_devices[d].Interface.ReadTablesLock);
+        }
+        memset(&g_devices[d], 0, sizeof(TEST_DEVICE));
+        g_devices[d].Change = MODBUS_BLOCK_CHANGED;
+        g_devices[d].Interface.Events = singlylinkedlist_create();
+        g_devices[d].Interface.ReadTablesLock = Lock_Init();
+    }
+}
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusScheduler_reads_each_block_at_its_period)
+{
+    // arrange
+    TEST_DEVICE* device = &g_devices[0];
+    test_add_telemetry(device, 40001, 50);
+    test_add_telemetry(device, 40010, 200);
+    PMODBUS_DEVICE_CONTEXT context = test_start_device(device, 1, 1);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("test", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+    MODBUS_SCHEDULER_STATISTICS statistics;
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, context));
+    ThreadAPI_Sleep(TEST_RUN_MS);
+    ModbusScheduler_RemoveDevice(scheduler, context);
+    ModbusScheduler_GetStatistics(scheduler, &statistics);
+    ModbusScheduler_Destroy(scheduler);
+    test_stop_device(device);
+
+    // assert: one read at the start, then one per period
+    ASSERT_IS_TRUE(device->Reports[0] >= 18 && device->Reports[0] <= 22);
+    ASSERT_IS_TRUE(device->Reports[1] >= 5 && device->Reports[1] <= 6);
+    ASSERT_ARE_EQUAL(int, 0, device->WrongValues);
+    ASSERT_ARE_EQUAL(int, 0, (int)statistics.MissedDeadlines);
+    ASSERT_ARE_EQUAL(int, device->Reports[0] + device->Reports[1], (int)statistics.Transactions);
+}
+
+TEST_FUNCTION(ModbusScheduler_merges_adjacent_blocks_that_are_due_together)
+{
+    // arrange: the read plan keeps the two periods apart, in blocks that are due together at
+    // every other read of the faster one
+    TEST_DEVICE* device = &g_devices[0];
+    test_add_telemetry(device, 40001, 100);
+    test_add_telemetry(device, 40002, 200);
+    PMODBUS_DEVICE_CONTEXT context = test_start_device(device, 1, 1);
+    ASSERT_ARE_EQUAL(int, 2, context->ReadPlan->BlockCount);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("test", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+    MODBUS_SCHEDULER_STATISTICS statistics;
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, context));
+    ThreadAPI_Sleep(TEST_RUN_MS);
+    ModbusScheduler_RemoveDevice(scheduler, context);
+    ModbusScheduler_GetStatistics(scheduler, &statistics);
+    ModbusScheduler_Destroy(scheduler);
+    test_stop_device(device);
+
+    // assert: the slower block never costs a request of its own
+    ASSERT_ARE_EQUAL(int, 0, device->WrongValues);
+    ASSERT_ARE_EQUAL(int, device->Reports[0] + device->Reports[1], (int)statistics.BlockReads);
+    ASSERT_ARE_EQUAL(int, device->Reports[0], (int)statistics.Transactions);
+    ASSERT_ARE_EQUAL(int, device->Reports[0], device->Slave.Transactions);
+
+    (void)printf("scheduler: %d block reads in %d requests over %d ms, bus busy %d ms\r\n",
+        (int)statistics.BlockReads, (int)statistics.Transactions, (int)statistics.ElapsedMs, (int)statistics.BusTimeMs);
+}
+
+TEST_FUNCTION(ModbusScheduler_counts_missed_deadlines_on_an_overloaded_connection)
+{
+    // arrange: three reads every 20 ms on a device that takes 10 ms to answer each
+    TEST_DEVICE* device = &g_devices[0];
+    test_add_telemetry(device, 40001, 20);
+    test_add_telemetry(device, 40101, 20);
+    test_add_telemetry(device, 40201, 20);
+    PMODBUS_DEVICE_CONTEXT context = test_start_device(device, 10, 1);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("test", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+    MODBUS_SCHEDULER_STATISTICS statistics;
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, context));
+    ThreadAPI_Sleep(TEST_RUN_MS / 2);
+    ModbusScheduler_RemoveDevice(scheduler, context);
+    ModbusScheduler_GetStatistics(scheduler, &statistics);
+    ModbusScheduler_Destroy(scheduler);
+    test_stop_device(device);
+
+    // assert: the bus is always busy, and the reads still share it evenly
+    ASSERT_IS_TRUE(statistics.MissedDeadlines > 0);
+    ASSERT_IS_TRUE(statistics.BusTimeMs * 10 >= statistics.ElapsedMs * 8);
+    ASSERT_IS_TRUE(abs(device->Reports[0] - device->Reports[2]) <= 2);
+}
+
+TEST_FUNCTION(ModbusScheduler_adapts_the_interval_of_a_block_to_its_values)
+{
+    // arrange: two devices polled every 100 ms, within 25 to 400 ms, one of which holds steady
+    // while the other moves fast
+    test_add_telemetry(&g_devices[0], 40001, 100);
+    test_set_adaptive(&g_devices[0], 25, 400);
+    g_devices[0].Change = MODBUS_BLOCK_STEADY;
+    test_add_telemetry(&g_devices[1], 40001, 100);
+    test_set_adaptive(&g_devices[1], 25, 400);
+    g_devices[1].Change = MODBUS_BLOCK_MOVING_FAST;
+    PMODBUS_DEVICE_CONTEXT steady = test_start_device(&g_devices[0], 1, 1);
+    PMODBUS_DEVICE_CONTEXT moving = test_start_device(&g_devices[1], 1, 1);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("test", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, steady));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, moving));
+    ThreadAPI_Sleep(TEST_RUN_MS);
+    ModbusScheduler_RemoveDevice(scheduler, steady);
+    ModbusScheduler_RemoveDevice(scheduler, moving);
+    ModbusScheduler_Destroy(scheduler);
+    test_stop_device(&g_devices[0]);
+    test_stop_device(&g_devices[1]);
+
+    // assert: reads at 0, 100, 300 and 700 ms of the steady device, and every 25 ms from 75 ms on
+    // of the other, where a fixed period would read each 11 times
+    ASSERT_IS_TRUE(g_devices[0].Reports[0] >= 3 && g_devices[0].Reports[0] <= 5);
+    ASSERT_IS_TRUE(g_devices[1].Reports[0] >= 30);
+    ASSERT_ARE_EQUAL(int, 0, g_devices[0].WrongValues + g_devices[1].WrongValues);
+}
+
+TEST_FUNCTION(ModbusScheduler_throttles_adaptive_blocks_to_the_bus_budget)
+{
+    // arrange: the overloaded connection above, but with reads that may be stretched to 200 ms
+    TEST_DEVICE* device = &g_devices[0];
+    test_add_telemetry(device, 40001, 20);
+    test_set_adaptive(device, 20, 200);
+    test_add_telemetry(device, 40101, 20);
+    test_set_adaptive(device, 20, 200);
+    test_add_telemetry(device, 40201, 20);
+    test_set_adaptive(device, 20, 200);
+    PMODBUS_DEVICE_CONTEXT context = test_start_device(device, 10, 1);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("test", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+    MODBUS_SCHEDULER_STATISTICS settling;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+
+    // act: give the governor a few windows to settle, then measure one more
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, context));
+    ThreadAPI_Sleep(4 * MODBUS_SCHEDULER_GOVERNOR_INTERVAL_MS);
+    ModbusScheduler_GetStatistics(scheduler, &settling);
+    ThreadAPI_Sleep(MODBUS_SCHEDULER_GOVERNOR_INTERVAL_MS);
+    ModbusScheduler_RemoveDevice(scheduler, context);
+    ModbusScheduler_GetStatistics(scheduler, &statistics);
+    ModbusScheduler_Destroy(scheduler);
+    test_stop_device(device);
+
+    // assert: the reads are stretched until the bus is back near its budget
+    uint64_t busTime = statistics.BusTimeMs - settling.BusTimeMs;
+    uint64_t elapsed = statistics.ElapsedMs - settling.ElapsedMs;
+    ASSERT_IS_TRUE(statistics.ThrottlePercent > 100);
+    ASSERT_IS_TRUE(busTime * 100 <= elapsed * (MODBUS_SCHEDULER_BUS_BUDGET_PERCENT + 10));
+    ASSERT_IS_TRUE(abs(device->Reports[0] - device->Reports[2]) <= 2);
+
+    (void)printf("scheduler: adaptive reads throttled to %d%%, bus busy %d ms of %d ms\r\n",
+        (int)statistics.ThrottlePercent, (int)busTime, (int)elapsed);
+}
+
+TEST_FUNCTION(ModbusScheduler_RemoveDevice_stops_only_that_device)
+{
+    // arrange
+    test_add_telemetry(&g_devices[0], 40001, 20);
+    test_add_telemetry(&g_devices[1], 40001, 20);
+    PMODBUS_DEVICE_CONTEXT stopped = test_start_device(&g_devices[0], 1, 1);
+    PMODBUS_DEVICE_CONTEXT polled = test_start_device(&g_devices[1], 1, 1);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("test", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, stopped));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, polled));
+    ThreadAPI_Sleep(TEST_RUN_MS / 4);
+
+    // act
+    ModbusScheduler_RemoveDevice(scheduler, stopped);
+    test_stop_device(&g_devices[0]);
+    int stoppedReports = test_get_reports(&g_devices[0], 0);
+    int polledReports = test_get_reports(&g_devices[1], 0);
+    ThreadAPI_Sleep(TEST_RUN_MS / 4);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, stoppedReports, test_get_reports(&g_devices[0], 0));
+    ASSERT_IS_TRUE(test_get_reports(&g_devices[1], 0) >= polledReports + 10);
+
+    ModbusScheduler_RemoveDevice(scheduler, polled);
+    ModbusScheduler_Destroy(scheduler);
+    test_stop_device(&g_devices[1]);
+    ASSERT_ARE_EQUAL(int, 0, g_devices[1].WrongValues);
+}
+
+TEST_FUNCTION(ModbusScheduler_pipelines_reads_of_devices_behind_a_gateway)
+{
+    // arrange: four reads every 100 ms through a gateway that takes 50 ms to answer, which one at a
+    // time would take twice the period
+    for (int d = 0; d < TEST_MAX_DEVICES; d++)
+    {
+        g_devices[d].Config.UnitId = (uint8_t)(d + 1);
+        test_add_telemetry(&g_devices[d], 40001, 100);
+        test_add_telemetry(&g_devices[d], 40101, 100);
+    }
+    PMODBUS_DEVICE_CONTEXT first = test_start_device(&g_devices[0], 50, 4);
+    PMODBUS_DEVICE_CONTEXT second = test_start_device(&g_devices[1], 50, 1);
+    MODBUS_TCP_LINK_HANDLE link = ModbusTcpLink_Create(g_devices[0].Slave.MasterSocket, 4);
+    ASSERT_IS_NOT_NULL(link);
+    g_devices[0].Slave.MasterSocket = -1;
+    first->TcpLink = link;
+    second->TcpLink = link;
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("gateway", 4);
+    ASSERT_IS_NOT_NULL(scheduler);
+    MODBUS_SCHEDULER_STATISTICS statistics;
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, first));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, second));
+    ThreadAPI_Sleep(TEST_RUN_MS);
+    ModbusScheduler_RemoveDevice(scheduler, first);
+    ModbusScheduler_RemoveDevice(scheduler, second);
+    ModbusScheduler_GetStatistics(scheduler, &statistics);
+    ModbusScheduler_Destroy(scheduler);
+    ModbusTcpLink_Destroy(link);
+
+    // assert: every read keeps its period, and each device gets its own values
+    ASSERT_ARE_EQUAL(int, 0, (int)statistics.MissedDeadlines);
+    for (int d = 0; d < TEST_MAX_DEVICES; d++)
+    {
+        test_stop_device(&g_devices[d]);
+        ASSERT_ARE_EQUAL(int, 0, g_devices[d].WrongValues);
+        ASSERT_IS_TRUE(g_devices[d].Reports[0] >= 9 && g_devices[d].Reports[1] >= 9);
+    }
+    ASSERT_ARE_EQUAL(int, 0, g_devices[1].Slave.Transactions);
+
+    (void)printf("scheduler: %d requests through a gateway over %d ms, bus busy %d ms\r\n",
+        (int)statistics.Transactions, (int)statistics.ElapsedMs, (int)statistics.BusTimeMs);
+}
+
+TEST_FUNCTION(ModbusScheduler_resumes_polling_when_a_device_comes_back)
+{
+    // arrange: a device read every 20 ms, through a link that reconnects to it
+    TEST_DEVICE* device = &g_devices[0];
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t now = 0;
+    int worstRecoveryMs = 0;
+    uint64_t outageCpuMs = 0;
+    MODBUS_SCHEDULER_STATISTICS statistics;
+    test_add_telemetry(device, 40001, 20);
+    device->Config.UnitId = 1;
+    device->Config.ConnectionType = TCP;
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusPnp_CreateReadPlan(&(device->Config), &(device->Interface),
+        0, &(device->Context.ReadPlan)));
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Listen(&(device->Slave), 0, 1));
+    uint16_t port = device->Slave.Port;
+    device->Context.hDevice = INVALID_FILE;
+    device->Context.hConnectionLock = Lock_Init();
+    device->Context.DeviceConfig = &(device->Config);
+    device->Context.InterfaceConfig = &(device->Interface);
+    device->Context.ComponentName = "modbusDevice";
+    device->Context.TcpLink = ModbusTcpLink_CreateReconnecting(test_connect, &(device->Slave), 1);
+    ASSERT_IS_NOT_NULL(device->Context.TcpLink);
+    MODBUS_SCHEDULER_HANDLE scheduler = ModbusScheduler_Create("restarting", 1);
+    ASSERT_IS_NOT_NULL(scheduler);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusScheduler_AddDevice(scheduler, &(device->Context)));
+    ThreadAPI_Sleep(TEST_RUN_MS / 4);
+    ASSERT_IS_TRUE(test_get_reports(device, 0) > 0);
+
+    for (int outage = 0; outage < TEST_OUTAGES; outage++)
+    {
+        // act: the device goes away, and comes back on the same port
+        ModbusTestSlave_Stop(&(device->Slave));
+        uint64_t cpuStart = test_get_cpu_ms();
+        ThreadAPI_Sleep(TEST_OUTAGE_MS);
+        outageCpuMs += test_get_cpu_ms() - cpuStart;
+        int reports = test_get_reports(device, 0);
+        ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Listen(&(device->Slave), port, 1));
+
+        (void)tickcounter_get_current_ms(tickCounter, &start);
+        now = start;
+        while (test_get_reports(device, 0) == reports && now - start < TEST_RECOVERY_TIMEOUT_MS)
+        {
+            ThreadAPI_Sleep(5);
+            (void)tickcounter_get_current_ms(tickCounter, &now);
+        }
+
+        // assert: polling resumes without the device being added again
+        ASSERT_IS_TRUE(test_get_reports(device, 0) > reports);
+        if ((int)(now - start) > worstRecoveryMs)
+        {
+            worstRecoveryMs = (int)(now - start);
+        }
+    }
+
+    ModbusScheduler_RemoveDevice(scheduler, &(device->Context));
+    ModbusScheduler_GetStatistics(scheduler, &statistics);
+    ModbusScheduler_Destroy(scheduler);
+    ModbusTcpLink_Destroy(device->Context.TcpLink);
+    test_stop_device(device);
+    tickcounter_destroy(tickCounter);
+
+    // assert: reads were suspended during the outages, which cost next to no CPU
+    ASSERT_ARE_EQUAL(int, 0, device->WrongValues);
+    ASSERT_IS_TRUE(statistics.SuspendedReads > 0);
+    ASSERT_IS_TRUE(outageCpuMs * 10 < TEST_OUTAGES * TEST_OUTAGE_MS);
+
+    (void)printf("scheduler: recovered from %d outages of %d ms within %d ms, using %d ms of CPU during them, %d reads suspended\r\n",
+        TEST_OUTAGES, TEST_OUTAGE_MS, worstRecoveryMs, (int)outageCpuMs, (int)statistics.SuspendedReads);
+}
+#endif
+
+END_TEST_SUITE(modbus_scheduler_ut)
@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Serves simulated Modbus devices for the bridge to be pointed at, printing the loopback port or
+// the terminal of each on a line of its own, until standard input is closed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "modbus_simulator.h"
+
+static void usage(
+    const char* program)
+{
+    (void)fprintf(stderr,
+        "Usage: %s [--rtu] [--devices N] [--connections N] [--units ID,...] [--latency MS]\r\n"
+        "          [--exception CODE,ADDRESS,QUANTITY]\r\n"
+        "          [--drop-every N] [--corrupt-crc] [--live | --step AFTER_MS | --ramp AFTER_MS,EVERY_MS]\r\n", program);
+}
+
+int main(int argc, char** argv)
+{
+    MODBUS_SIMULATOR_OPTIONS options;
+    memset(&options, 0, sizeof(options));
+    options.Devices = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        unsigned int code = 0;
+        unsigned int address = 0;
+        unsigned int quantity = 0;
+        unsigned int after = 0;
+        unsigned int every = 0;
+
+        if (0 == strcmp(argv[i], "--rtu"))
+        {
+            options.Rtu = true;
+        }
+        else if (0 == strcmp(argv[i], "--corrupt-crc"))
+        {
+            options.CorruptCrc = true;
+        }
+        else if (0 == strcmp(argv[i], "--live"))
+        {
+            options.Live = true;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--devices"))
+        {
+            options.Devices = atoi(value);
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--connections"))
+        {
+            options.Connections = atoi(value);
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--units"))
+        {
+            const char* unit = value;
+            while (NULL != unit)
+            {
+                ModbusTestSlave_AddUnit(options.Units, (uint8_t)atoi(unit));
+                unit = strchr(unit, ',');
+                unit = (NULL != unit) ? unit + 1 : NULL;
+            }
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--latency"))
+        {
+            options.LatencyMs = atoi(value);
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--drop-every"))
+        {
+            options.DropEvery = atoi(value);
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--step") && 1 == sscanf(value, "%u", &after))
+        {
+            options.Signal = MODBUS_SIMULATOR_STEP;
+            options.SignalStartMs = ModbusSimulator_GetTimeMs() + after;
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--ramp") && 2 == sscanf(value, "%u,%u", &after, &every))
+        {
+            options.Signal = MODBUS_SIMULATOR_RAMP;
+            options.SignalStartMs = ModbusSimulator_GetTimeMs() + after;
+            options.RampMs = (int)every;
+            i++;
+        }
+        else if (NULL != value && 0 == strcmp(argv[i], "--exception") &&
+            3 == sscanf(value, "%u,%u,%u", &code, &address, &quantity))
+        {
+            options.ExceptionCode = (uint8_t)code;
+            options.ExceptionAddress = (uint16_t)address;
+            options.ExceptionQuantity = (uint16_t)quantity;
+            i++;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    (void)setvbuf(stdout, NULL, _IONBF, 0);
+    if (0 != ModbusSimulator_Run(&options, STDOUT_FILENO, STDIN_FILENO))
+    {
+        (void)fprintf(stderr, "Failed to start %d simulated devices.\r\n", options.Devices);
+        return 1;
+    }
+
+    return 0;
+}
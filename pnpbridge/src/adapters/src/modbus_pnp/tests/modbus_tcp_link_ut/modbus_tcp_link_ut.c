@@ -0,0 +1,186 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusReadPlanner.h"
+#include "ModbusConnection/ModbusTCPLink.h"
+#include "modbus_test_slave.h"
+
+#define TEST_WINDOW 8
+#define TEST_CLIENTS 4
+#define TEST_TRANSACTIONS_PER_CLIENT 10
+#define TEST_LATENCY_MS 10
+
+typedef struct TEST_CLIENT {
+    MODBUS_TCP_LINK_HANDLE Link;
+    uint16_t Address;
+    int WrongValues;
+    int Failures;
+} TEST_CLIENT;
+
+// The slave holds n + 1 in register n, so the response to a read of one register at address
+// tells which request it answers
+static bool test_response_answers(
+    const uint8_t* response,
+    int responseLength,
+    uint16_t address)
+{
+    uint16_t value = (uint16_t)((response[TCP_HEADER_SIZE + 2] << 8) | response[TCP_HEADER_SIZE + 3]);
+    return responseLength == TCP_HEADER_SIZE + 4 && value == address + 1;
+}
+
+static int test_client(
+    void* param)
+{
+    TEST_CLIENT* client = (TEST_CLIENT*)param;
+    MODBUS_READ_REQUEST request;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+
+    ModbusTcp_EncodeReadRequest(&request, ReadHoldingRegisters, client->Address, 1, 1);
+    for (int i = 0; i < TEST_TRANSACTIONS_PER_CLIENT; i++)
+    {
+        int responseLength = ModbusTcpLink_Transact(client->Link, request.TcpArr, sizeof(request.TcpArr), response, sizeof(response));
+        if (responseLength < 0)
+        {
+            client->Failures++;
+        }
+        else if (!test_response_answers(response, responseLength, client->Address))
+        {
+            client->WrongValues++;
+        }
+    }
+
+    return 0;
+}
+
+#ifndef WIN32
+// Runs the clients against a gateway slave through a link with the given window, returning the
+// time they took
+static int test_run_clients(
+    int window)
+{
+    MODBUS_TEST_SLAVE slave;
+    TEST_CLIENT clients[TEST_CLIENTS];
+    THREAD_HANDLE threads[TEST_CLIENTS];
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Start(&slave, TEST_LATENCY_MS, TEST_WINDOW));
+    MODBUS_TCP_LINK_HANDLE link = ModbusTcpLink_Create(slave.MasterSocket, window);
+    ASSERT_IS_NOT_NULL(link);
+    slave.MasterSocket = -1;
+
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        clients[i].Link = link;
+        clients[i].Address = (uint16_t)(100 * i);
+        clients[i].WrongValues = 0;
+        clients[i].Failures = 0;
+        ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&threads[i], test_client, &clients[i]));
+    }
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        (void)ThreadAPI_Join(threads[i], NULL);
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+
+    ModbusTcpLink_Destroy(link);
+    ModbusTestSlave_Stop(&slave);
+    tickcounter_destroy(tickCounter);
+
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, clients[i].Failures);
+        ASSERT_ARE_EQUAL(int, 0, clients[i].WrongValues);
+    }
+    ASSERT_ARE_EQUAL(int, TEST_CLIENTS * TEST_TRANSACTIONS_PER_CLIENT, slave.Transactions);
+
+    return (int)(end - start);
+}
+#endif
+
+BEGIN_TEST_SUITE(modbus_tcp_link_ut)
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusTcpLink_hands_out_of_order_responses_to_their_requests)
+{
+    // arrange: a gateway that answers the requests it takes on last to first
+    MODBUS_TEST_SLAVE slave;
+    MODBUS_READ_REQUEST requests[TEST_WINDOW];
+    uint8_t responses[TEST_WINDOW][MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    int transactions[TEST_WINDOW];
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Start(&slave, 50, TEST_WINDOW));
+    MODBUS_TCP_LINK_HANDLE link = ModbusTcpLink_Create(slave.MasterSocket, TEST_WINDOW);
+    ASSERT_IS_NOT_NULL(link);
+    slave.MasterSocket = -1;
+
+    // act
+    for (int i = 0; i < TEST_WINDOW; i++)
+    {
+        ModbusTcp_EncodeReadRequest(&requests[i], ReadHoldingRegisters, (uint16_t)(10 * i), 1, 1);
+        transactions[i] = ModbusTcpLink_Submit(link, requests[i].TcpArr, sizeof(requests[i].TcpArr), responses[i], sizeof(responses[i]));
+        ASSERT_IS_TRUE(transactions[i] >= 0);
+    }
+
+    // assert
+    for (int i = 0; i < TEST_WINDOW; i++)
+    {
+        int responseLength = ModbusTcpLink_Wait(link, transactions[i], MODBUS_TCP_RESPONSE_TIMEOUT_MS);
+        ASSERT_IS_TRUE(test_response_answers(responses[i], responseLength, (uint16_t)(10 * i)));
+    }
+
+    ModbusTcpLink_Destroy(link);
+    ModbusTestSlave_Stop(&slave);
+}
+
+TEST_FUNCTION(ModbusTcpLink_window_keeps_a_gateway_busy)
+{
+    // act
+    int serialMs = test_run_clients(1);
+    int pipelinedMs = test_run_clients(TEST_WINDOW);
+
+    // assert: the clients wait on each other with a window of 1, and not with a window above them
+    ASSERT_IS_TRUE(serialMs >= TEST_CLIENTS * TEST_TRANSACTIONS_PER_CLIENT * TEST_LATENCY_MS);
+    ASSERT_IS_TRUE(pipelinedMs * 2 < serialMs);
+
+    (void)printf("tcp link: %d transactions from %d clients in %d ms with a window of 1, %d ms with a window of %d\r\n",
+        TEST_CLIENTS * TEST_TRANSACTIONS_PER_CLIENT, TEST_CLIENTS, serialMs, pipelinedMs, TEST_WINDOW);
+}
+
+TEST_FUNCTION(ModbusTcpLink_fails_transactions_when_the_connection_drops)
+{
+    // arrange: a slave too slow to answer before its connection goes
+    MODBUS_TEST_SLAVE slave;
+    MODBUS_READ_REQUEST request;
+    uint8_t response[MODBUS_BLOCK_RESPONSE_MAX_LENGTH];
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Start(&slave, 200, 1));
+    MODBUS_TCP_LINK_HANDLE link = ModbusTcpLink_Create(slave.MasterSocket, TEST_WINDOW);
+    ASSERT_IS_NOT_NULL(link);
+    slave.MasterSocket = -1;
+    ModbusTcp_EncodeReadRequest(&request, ReadHoldingRegisters, 0, 1, 1);
+    int transaction = ModbusTcpLink_Submit(link, request.TcpArr, sizeof(request.TcpArr), response, sizeof(response));
+    ASSERT_IS_TRUE(transaction >= 0);
+
+    // act
+    (void)shutdown(slave.Socket, SHUT_RDWR);
+
+    // assert: the pending transaction fails, and so do new ones
+    ASSERT_ARE_EQUAL(int, -1, ModbusTcpLink_Wait(link, transaction, MODBUS_TCP_RESPONSE_TIMEOUT_MS));
+    ASSERT_ARE_EQUAL(int, -1, ModbusTcpLink_Submit(link, request.TcpArr, sizeof(request.TcpArr), response, sizeof(response)));
+
+    ModbusTcpLink_Destroy(link);
+    ModbusTestSlave_Stop(&slave);
+}
+#endif
+
+END_TEST_SUITE(modbus_tcp_link_ut)
@@ -0,0 +1,351 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusValueCodec.h"
+
+#define TEST_VALUES 1000
+#define TEST_ROUNDS 200
+
+// Formats the value of a register dump with the codec, as a capability would be reported
+static void test_assert_formats(
+    const char* expected,
+    ModbusDataType dataType,
+    uint16_t length,
+    MODBUS_BYTE_ORDER wordOrder,
+    MODBUS_BYTE_ORDER byteOrder,
+    const uint8_t* data,
+    double conversionCoefficient)
+{
+    MODBUS_VALUE_CODEC codec;
+    char result[MODBUS_VALUE_MAX_LENGTH];
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, dataType, length, wordOrder, byteOrder));
+    int resultLength = ModbusValueCodec_Format(&codec, data, conversionCoefficient, result, sizeof(result));
+    ASSERT_ARE_EQUAL(int, (int)strlen(expected), resultLength);
+    ASSERT_ARE_EQUAL(char_ptr, expected, result);
+}
+
+// The conversion the adapter made before the codec: registers high word first, formatted by sprintf
+static int test_format_with_sprintf(
+    const uint8_t* data,
+    int dataLength,
+    double conversionCoefficient,
+    char* result)
+{
+    uint64_t rawValue = 0;
+    for (int i = 0; i < dataLength && i < 4; i++)
+    {
+        rawValue <<= 16;
+        rawValue += (uint16_t)((data[i * 2] << 8) + data[i * 2 + 1]);
+    }
+    return snprintf(result, MODBUS_VALUE_MAX_LENGTH, "%g", rawValue * conversionCoefficient);
+}
+
+static int test_elapsed_ms(
+    TICK_COUNTER_HANDLE tickCounter,
+    tickcounter_ms_t start)
+{
+    tickcounter_ms_t now = 0;
+    (void)tickcounter_get_current_ms(tickCounter, &now);
+    return (int)(now - start);
+}
+
+BEGIN_TEST_SUITE(modbus_value_codec_ut)
+
+TEST_FUNCTION(ModbusValueCodec_decodes_float32_in_every_word_and_byte_order)
+{
+    // arrange: 23.57 as 0x41BC8F5C
+    const uint8_t bigBig[] = { 0x41, 0xBC, 0x8F, 0x5C };
+    const uint8_t littleBig[] = { 0x8F, 0x5C, 0x41, 0xBC };
+    const uint8_t bigLittle[] = { 0xBC, 0x41, 0x5C, 0x8F };
+    const uint8_t littleLittle[] = { 0x5C, 0x8F, 0xBC, 0x41 };
+
+    // act, assert
+    test_assert_formats("23.57", FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, bigBig, 1);
+    test_assert_formats("23.57", FLOAT32, 2, MODBUS_LITTLE_ENDIAN, MODBUS_BIG_ENDIAN, littleBig, 1);
+    test_assert_formats("23.57", FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_LITTLE_ENDIAN, bigLittle, 1);
+    test_assert_formats("23.57", FLOAT32, 2, MODBUS_LITTLE_ENDIAN, MODBUS_LITTLE_ENDIAN, littleLittle, 1);
+}
+
+TEST_FUNCTION(ModbusValueCodec_decodes_float64)
+{
+    // arrange: 23.57 as 0x403791EB851EB852, and -1234.5 low word first
+    const uint8_t big[] = { 0x40, 0x37, 0x91, 0xEB, 0x85, 0x1E, 0xB8, 0x52 };
+    const uint8_t lowWordFirst[] = { 0x00, 0x00, 0x00, 0x00, 0x4A, 0x00, 0xC0, 0x93 };
+
+    // act, assert
+    test_assert_formats("23.57", FLOAT64, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, big, 1);
+    test_assert_formats("-1234.5", FLOAT64, 4, MODBUS_LITTLE_ENDIAN, MODBUS_BIG_ENDIAN, lowWordFirst, 1);
+}
+
+TEST_FUNCTION(ModbusValueCodec_decodes_signed_and_unsigned_integers)
+{
+    // arrange
+    const uint8_t minusTwo[] = { 0xFF, 0xFF, 0xFF, 0xFE };
+    const uint8_t minusTwoHundred[] = { 0xFF, 0x38 };
+    const uint8_t wordSwapped[] = { 0x00, 0x00, 0x00, 0x01 };
+
+    // act, assert
+    test_assert_formats("-2", INT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, minusTwo, 1);
+    test_assert_formats("4294967294", UINT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, minusTwo, 1);
+    test_assert_formats("-200", INT16, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, minusTwoHundred, 1);
+    test_assert_formats("-2", INT16, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, minusTwoHundred, 0.01);
+    test_assert_formats("65536", UINT32, 2, MODBUS_LITTLE_ENDIAN, MODBUS_BIG_ENDIAN, wordSwapped, 1);
+}
+
+TEST_FUNCTION(ModbusValueCodec_decodes_numbers_as_the_adapter_did)
+{
+    // arrange
+    const uint8_t temperature[] = { 0x09, 0x35 };
+    const uint8_t counter[] = { 0x00, 0x12, 0xD6, 0x87 };
+
+    // act, assert: unsigned, high word first, and whole numbers are no longer rounded to 6 digits
+    test_assert_formats("23.57", NUMERIC, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, temperature, 0.01);
+    test_assert_formats("1234567", NUMERIC, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, counter, 1);
+    test_assert_formats("0.3", NUMERIC, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, (const uint8_t*)"\x00\x03", 0.1);
+}
+
+TEST_FUNCTION(ModbusValueCodec_formats_values_with_the_digits_they_need)
+{
+    // arrange
+    const uint8_t floatTenth[] = { 0x3D, 0xCC, 0xCC, 0xCD };
+    const uint8_t floatAfterOne[] = { 0x3F, 0x80, 0x00, 0x01 };
+    const uint8_t floatLargestOdd[] = { 0x4B, 0x7F, 0xFF, 0xFF };
+    const uint8_t doubleSum[] = { 0x3F, 0xD3, 0x33, 0x33, 0x33, 0x33, 0x33, 0x34 };
+    const uint8_t largestCounter[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    const uint8_t largeCounter[] = { 0x11, 0x22, 0x10, 0xF4, 0x7D, 0xE9, 0x81, 0x15 };
+
+    // act, assert: floats read back as themselves, with no digits beyond those they need
+    test_assert_formats("0.1", FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, floatTenth, 1);
+    test_assert_formats("1.0000001", FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, floatAfterOne, 1);
+    test_assert_formats("16777215", FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, floatLargestOdd, 1);
+    test_assert_formats("0.30000000000000004", FLOAT64, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, doubleSum, 1);
+
+    // Counters past 2^53 are not rounded, and scaled ones keep the digits of the counter
+    test_assert_formats("18446744073709551615", NUMERIC, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, largestCounter, 1);
+    test_assert_formats("1234567890123456789", NUMERIC, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, largeCounter, 1);
+    test_assert_formats("1234567890123456.8", NUMERIC, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN, largeCounter, 0.001);
+}
+
+TEST_FUNCTION(ModbusValueCodec_FormatNumber_writes_json_numbers)
+{
+    // arrange
+    char result[MODBUS_VALUE_MAX_LENGTH];
+
+    // act, assert
+    ASSERT_ARE_EQUAL(int, 4, ModbusValueCodec_FormatNumber(NAN, 15, result, sizeof(result)));
+    ASSERT_ARE_EQUAL(char_ptr, "null", result);
+    (void)ModbusValueCodec_FormatNumber(-INFINITY, 15, result, sizeof(result));
+    ASSERT_ARE_EQUAL(char_ptr, "null", result);
+    (void)ModbusValueCodec_FormatNumber(0, 15, result, sizeof(result));
+    ASSERT_ARE_EQUAL(char_ptr, "0", result);
+    (void)ModbusValueCodec_FormatNumber(-999999999999999.0, 15, result, sizeof(result));
+    ASSERT_ARE_EQUAL(char_ptr, "-999999999999999", result);
+    (void)ModbusValueCodec_FormatNumber(0.000123456789, 6, result, sizeof(result));
+    ASSERT_ARE_EQUAL(char_ptr, "0.000123457", result);
+    (void)ModbusValueCodec_FormatNumber(99.99996, 6, result, sizeof(result));
+    ASSERT_ARE_EQUAL(char_ptr, "100", result);
+    (void)ModbusValueCodec_FormatNumber(1e300, 15, result, sizeof(result));
+    ASSERT_ARE_EQUAL(char_ptr, "1e+300", result);
+}
+
+TEST_FUNCTION(ModbusValueCodec_Init_rejects_a_length_too_short_for_the_type)
+{
+    // arrange
+    MODBUS_VALUE_CODEC codec;
+
+    // act, assert
+    ASSERT_IS_FALSE(ModbusValueCodec_Init(&codec, FLOAT64, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Init(&codec, INT32, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Init(&codec, STRING, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, FLOAT32, 3, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_ARE_EQUAL(int, 2, codec.Registers);
+}
+
+TEST_FUNCTION(ModbusValueCodec_Encode_lays_values_out_as_they_are_decoded)
+{
+    // arrange
+    MODBUS_VALUE_CODEC codec;
+    uint16_t values[4];
+
+    // act, assert: -1.5 is 0xBFC00000
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, FLOAT32, 2, MODBUS_LITTLE_ENDIAN, MODBUS_LITTLE_ENDIAN));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "-1.5", values));
+    ASSERT_ARE_EQUAL(int, 0x0000, values[0]);
+    ASSERT_ARE_EQUAL(int, 0xC0BF, values[1]);
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, INT32, 2, MODBUS_LITTLE_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "-2", values));
+    ASSERT_ARE_EQUAL(int, 0xFFFE, values[0]);
+    ASSERT_ARE_EQUAL(int, 0xFFFF, values[1]);
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, NUMERIC, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "41.6", values));
+    ASSERT_ARE_EQUAL(int, 42, values[0]);
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "warm", values));
+}
+
+TEST_FUNCTION(ModbusValueCodec_Encode_rejects_values_out_of_range)
+{
+    // arrange
+    MODBUS_VALUE_CODEC codec;
+    uint16_t values[4];
+
+    // act, assert
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, INT16, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "40000", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "-32769", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "32767.5", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "1e5", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "-32768", values));
+    ASSERT_ARE_EQUAL(int, 0x8000, values[0]);
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "32767.4", values));
+    ASSERT_ARE_EQUAL(int, 0x7FFF, values[0]);
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, INT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "2147483648", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "-2147483648", values));
+    ASSERT_ARE_EQUAL(int, 0x8000, values[0]);
+    ASSERT_ARE_EQUAL(int, 0x0000, values[1]);
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, UINT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "-1", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "4294967296", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "4294967295", values));
+    ASSERT_ARE_EQUAL(int, 0xFFFF, values[0]);
+    ASSERT_ARE_EQUAL(int, 0xFFFF, values[1]);
+
+    // Numeric values are unsigned, in as many registers as they are decoded from
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, NUMERIC, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "65536", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "-1", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "-0.6", values));
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, NUMERIC, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "18446744073709551616", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "9223372036854775808", values));
+    ASSERT_ARE_EQUAL(int, 0x8000, values[0]);
+    ASSERT_ARE_EQUAL(int, 0x0000, values[3]);
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "18446744073709551615", values));
+    ASSERT_ARE_EQUAL(int, 0xFFFF, values[0]);
+    ASSERT_ARE_EQUAL(int, 0xFFFF, values[3]);
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "1e39", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, FLOAT64, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "-1e309", values));
+}
+
+TEST_FUNCTION(ModbusValueCodec_Encode_rejects_text_after_the_value)
+{
+    // arrange
+    MODBUS_VALUE_CODEC codec;
+    uint16_t values[4];
+
+    // act, assert: white space around the value is allowed
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, INT16, 1, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "12abc", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "12.5.1", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, " ", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, " 12\n", values));
+    ASSERT_ARE_EQUAL(int, 12, values[0]);
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, NUMERIC, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "7 8", values));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "1.5e1x", values));
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "1.5x", values));
+    ASSERT_IS_TRUE(ModbusValueCodec_Encode(&codec, "1.5 ", values));
+
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&codec, FLOAT64, 4, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_FALSE(ModbusValueCodec_Encode(&codec, "2.5 degrees", values));
+}
+
+TEST_FUNCTION(ModbusValueCodec_formats_faster_than_sprintf)
+{
+    // arrange: two register counters, as most telemetry is, and float32 temperatures
+    uint8_t counters[TEST_VALUES][4];
+    uint8_t temperatures[TEST_VALUES][4];
+    char expected[MODBUS_VALUE_MAX_LENGTH];
+    char result[MODBUS_VALUE_MAX_LENGTH];
+    MODBUS_VALUE_CODEC numericCodec;
+    MODBUS_VALUE_CODEC floatCodec;
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    size_t checksum = 0;
+
+    for (int i = 0; i < TEST_VALUES; i++)
+    {
+        uint32_t value = (uint32_t)(i * 977);
+        float temperature = -40.0f + i * 0.137f;
+        uint32_t bits = 0;
+        memcpy(&bits, &temperature, sizeof(bits));
+        for (int j = 0; j < 4; j++)
+        {
+            counters[i][j] = (uint8_t)(value >> (24 - j * 8));
+            temperatures[i][j] = (uint8_t)(bits >> (24 - j * 8));
+        }
+    }
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&numericCodec, NUMERIC, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    ASSERT_IS_TRUE(ModbusValueCodec_Init(&floatCodec, FLOAT32, 2, MODBUS_BIG_ENDIAN, MODBUS_BIG_ENDIAN));
+    for (int i = 0; i < TEST_VALUES; i++)
+    {
+        (void)test_format_with_sprintf(counters[i], 2, 1, expected);
+        (void)ModbusValueCodec_Format(&numericCodec, counters[i], 1, result, sizeof(result));
+        ASSERT_ARE_EQUAL(char_ptr, expected, result);
+    }
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        for (int i = 0; i < TEST_VALUES; i++)
+        {
+            checksum += (size_t)test_format_with_sprintf(counters[i], 2, 1, result);
+        }
+    }
+    int sprintfMs = test_elapsed_ms(tickCounter, start);
+
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        for (int i = 0; i < TEST_VALUES; i++)
+        {
+            checksum += (size_t)ModbusValueCodec_Format(&numericCodec, counters[i], 1, result, sizeof(result));
+        }
+    }
+    int codecMs = test_elapsed_ms(tickCounter, start);
+
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        for (int i = 0; i < TEST_VALUES; i++)
+        {
+            checksum += (size_t)ModbusValueCodec_Format(&floatCodec, temperatures[i], 1, result, sizeof(result));
+        }
+    }
+    int floatMs = test_elapsed_ms(tickCounter, start);
+    tickcounter_destroy(tickCounter);
+
+    // assert
+    ASSERT_IS_TRUE(checksum > 0);
+    ASSERT_IS_TRUE(codecMs < sprintfMs);
+    ASSERT_IS_TRUE(floatMs < sprintfMs);
+
+    (void)printf("value codec: %d values in %d ms with sprintf, %d ms with the codec, %d ms as float32\r\n",
+        TEST_VALUES * TEST_ROUNDS, sprintfMs, codecMs, floatMs);
+}
+
+END_TEST_SUITE(modbus_value_codec_ut)
@@ -0,0 +1,323 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "ModbusWriteQueue.h"
+#include "ModbusConnection/ModbusTCPLink.h"
+#include "ModbusConnection/ModbusRtuBus.h"
+#include "modbus_test_slave.h"
+
+#define TEST_UNIT_ID 1
+#define TEST_WINDOW_MS 50
+#define TEST_BAUD_RATE 9600
+#define TEST_BURST 32
+#define TEST_BURST_ADDRESS 100
+#define TEST_LATENCY_MS 5
+
+#ifndef WIN32
+typedef struct TEST_CONNECTION {
+    MODBUS_TEST_SLAVE Slave;
+    CapabilityContext Context;
+} TEST_CONNECTION;
+
+static void test_connect_tcp(
+    TEST_CONNECTION* connection,
+    int latencyMs)
+{
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_Start(&(connection->Slave), latencyMs, 1));
+    memset(&(connection->Context), 0, sizeof(connection->Context));
+    connection->Context.connectionType = TCP;
+    connection->Context.hDevice = INVALID_FILE;
+    connection->Context.unitId = TEST_UNIT_ID;
+    connection->Context.tcpLink = ModbusTcpLink_Create(connection->Slave.MasterSocket, 1);
+    ASSERT_IS_NOT_NULL(connection->Context.tcpLink);
+    connection->Slave.MasterSocket = -1;
+}
+
+static void test_disconnect(
+    TEST_CONNECTION* connection)
+{
+    if (NULL != connection->Context.tcpLink)
+    {
+        ModbusTcpLink_Destroy(connection->Context.tcpLink);
+    }
+    if (NULL != connection->Context.rtuBus)
+    {
+        ModbusRtuBus_Destroy(connection->Context.rtuBus);
+    }
+    ModbusTestSlave_Stop(&(connection->Slave));
+}
+
+static MODBUS_WRITE test_write(
+    uint8_t functionCode,
+    uint16_t address,
+    uint16_t quantity,
+    uint16_t firstValue)
+{
+    MODBUS_WRITE write;
+    write.UnitId = TEST_UNIT_ID;
+    write.FunctionCode = functionCode;
+    write.Address = address;
+    write.Quantity = quantity;
+    for (int i = 0; i < quantity; i++)
+    {
+        write.Values[i] = (WriteCoil == functionCode) ? (((firstValue + i) % 2) ? 0xFF00 : 0) : (uint16_t)(firstValue + i);
+    }
+    return write;
+}
+
+// Sends a burst of property writes to adjacent registers, with the queue or without it, returning
+// the time it took until the device had them all
+static int test_write_burst(
+    bool queued,
+    int* transactions)
+{
+    TEST_CONNECTION connection;
+    ModbusProperty properties[TEST_BURST];
+    char addresses[TEST_BURST][8];
+    char value[8];
+    uint8_t result[MODBUS_RESPONSE_MAX_LENGTH];
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+
+    test_connect_tcp(&connection, TEST_LATENCY_MS);
+    MODBUS_WRITE_QUEUE_HANDLE queue = NULL;
+    if (queued)
+    {
+        queue = ModbusWriteQueue_Create("test", &(connection.Context), TEST_WINDOW_MS);
+        ASSERT_IS_NOT_NULL(queue);
+        connection.Context.writeQueue = queue;
+    }
+
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_BURST; i++)
+    {
+        memset(&properties[i], 0, sizeof(properties[i]));
+        (void)snprintf(addresses[i], sizeof(addresses[i]), "4%04d", TEST_BURST_ADDRESS + i + 1);
+        (void)snprintf(value, sizeof(value), "%d", 1000 + i);
+        properties[i].Name = "setpoint";
+        properties[i].StartAddress = addresses[i];
+        properties[i].Length = 1;
+        properties[i].DataType = NUMERIC;
+        properties[i].ConversionCoefficient = 1;
+        properties[i].Access = READ_WRITE;
+        connection.Context.capability = &properties[i];
+        ASSERT_IS_TRUE(ModbusPnp_WriteToCapability(&(connection.Context), Property, value, result) >= 0);
+    }
+    // Destroying the queue sends what it still holds
+    ModbusWriteQueue_Destroy(queue);
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+
+    test_disconnect(&connection);
+    tickcounter_destroy(tickCounter);
+
+    for (int i = 0; i < TEST_BURST; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 1000 + i, connection.Slave.Registers[TEST_BURST_ADDRESS + i]);
+    }
+    *transactions = connection.Slave.Transactions;
+
+    return (int)(end - start);
+}
+#endif
+
+BEGIN_TEST_SUITE(modbus_write_queue_ut)
+
+TEST_FUNCTION(ModbusRtu_EncodeWriteMultipleRequest_appends_the_crc_of_the_frame)
+{
+    // arrange
+    MODBUS_WRITE_MULTIPLE_REQUEST request;
+    const uint16_t values[2] = { 0x000A, 0x0102 };
+    const uint8_t expected[] = { 0x11, 0x10, 0x00, 0x01, 0x00, 0x02, 0x04, 0x00, 0x0A, 0x01, 0x02 };
+
+    // act
+    uint32_t length = ModbusRtu_EncodeWriteMultipleRequest(&request, WriteHoldingRegisters, 1, 2, values, 0x11);
+
+    // assert: a frame that ends in its own CRC has a CRC of 0
+    ASSERT_ARE_EQUAL(int, sizeof(expected) + 2, length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(expected, request.RtuArr, sizeof(expected)));
+    ASSERT_ARE_EQUAL(int, 0, GetCRC(request.RtuArr, length));
+}
+
+#ifndef WIN32
+TEST_FUNCTION(ModbusWriteQueue_coalesces_adjacent_register_writes_into_one_request)
+{
+    // arrange
+    TEST_CONNECTION connection;
+    MODBUS_WRITE_QUEUE_STATISTICS statistics;
+    test_connect_tcp(&connection, 0);
+    MODBUS_WRITE_QUEUE_HANDLE queue = ModbusWriteQueue_Create("test", &(connection.Context), TEST_WINDOW_MS);
+    ASSERT_IS_NOT_NULL(queue);
+
+    // act: three writes next to each other, one far from them, and one more next to the first,
+    // which is waited for
+    MODBUS_WRITE writes[] = {
+        test_write(WriteHoldingRegister, 11, 1, 500),
+        test_write(WriteHoldingRegister, 10, 1, 600),
+        test_write(WriteHoldingRegister, 12, 1, 700),
+        test_write(WriteHoldingRegister, 200, 1, 800),
+        test_write(WriteHoldingRegister, 13, 1, 900)
+    };
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusWriteQueue_Write(queue, &writes[i], false));
+    }
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusWriteQueue_Write(queue, &writes[4], true));
+    ModbusWriteQueue_GetStatistics(queue, &statistics);
+
+    ModbusWriteQueue_Destroy(queue);
+    test_disconnect(&connection);
+
+    // assert: registers 10 to 13 were written with one Write Multiple Registers, and 200 on its own
+    ASSERT_ARE_EQUAL(int, 600, connection.Slave.Registers[10]);
+    ASSERT_ARE_EQUAL(int, 500, connection.Slave.Registers[11]);
+    ASSERT_ARE_EQUAL(int, 700, connection.Slave.Registers[12]);
+    ASSERT_ARE_EQUAL(int, 900, connection.Slave.Registers[13]);
+    ASSERT_ARE_EQUAL(int, 800, connection.Slave.Registers[200]);
+    ASSERT_ARE_EQUAL(int, 15, connection.Slave.Registers[14]);
+    ASSERT_ARE_EQUAL(int, 2, connection.Slave.Transactions);
+    ASSERT_ARE_EQUAL(int, WriteHoldingRegister, connection.Slave.LastFunctionCode);
+    ASSERT_ARE_EQUAL(int, 5, (int)statistics.Writes);
+    ASSERT_ARE_EQUAL(int, 2, (int)statistics.Transactions);
+    ASSERT_ARE_EQUAL(int, 0, (int)statistics.Failures);
+}
+
+TEST_FUNCTION(ModbusWriteQueue_last_of_overlapping_writes_wins)
+{
+    // arrange
+    TEST_CONNECTION connection;
+    test_connect_tcp(&connection, 0);
+    MODBUS_WRITE_QUEUE_HANDLE queue = ModbusWriteQueue_Create("test", &(connection.Context), TEST_WINDOW_MS);
+    ASSERT_IS_NOT_NULL(queue);
+    MODBUS_WRITE first = test_write(WriteHoldingRegister, 20, 3, 1);
+    MODBUS_WRITE second = test_write(WriteHoldingRegister, 21, 1, 9);
+
+    // act
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusWriteQueue_Write(queue, &first, false));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusWriteQueue_Write(queue, &second, true));
+
+    ModbusWriteQueue_Destroy(queue);
+    test_disconnect(&connection);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, connection.Slave.Registers[20]);
+    ASSERT_ARE_EQUAL(int, 9, connection.Slave.Registers[21]);
+    ASSERT_ARE_EQUAL(int, 3, connection.Slave.Registers[22]);
+    ASSERT_ARE_EQUAL(int, 1, connection.Slave.Transactions);
+    ASSERT_ARE_EQUAL(int, WriteHoldingRegisters, connection.Slave.LastFunctionCode);
+}
+
+TEST_FUNCTION(ModbusWriteQueue_coalesces_coil_writes_on_an_rtu_bus)
+{
+    // arrange
+    TEST_CONNECTION connection;
+    ASSERT_ARE_EQUAL(int, 0, ModbusTestSlave_StartRtu(&(connection.Slave), 0));
+    memset(&(connection.Context), 0, sizeof(connection.Context));
+    connection.Context.connectionType = RTU;
+    connection.Context.hDevice = INVALID_FILE;
+    connection.Context.rtuBus = ModbusRtuBus_Create(connection.Slave.MasterSocket, TEST_BAUD_RATE);
+    ASSERT_IS_NOT_NULL(connection.Context.rtuBus);
+    connection.Slave.MasterSocket = -1;
+    MODBUS_WRITE_QUEUE_HANDLE queue = ModbusWriteQueue_Create("test", &(connection.Context), TEST_WINDOW_MS);
+    ASSERT_IS_NOT_NULL(queue);
+
+    // act: coils 30 to 39 turned on and off in turn, one at a time
+    for (int i = 0; i < 10; i++)
+    {
+        MODBUS_WRITE write = test_write(WriteCoil, (uint16_t)(30 + i), 1, (uint16_t)i);
+        ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusWriteQueue_Write(queue, &write, 9 == i));
+    }
+
+    ModbusWriteQueue_Destroy(queue);
+    test_disconnect(&connection);
+
+    // assert: they went out as one Write Multiple Coils
+    for (int i = 0; i < 10; i++)
+    {
+        ASSERT_ARE_EQUAL(int, i % 2, connection.Slave.Coils[30 + i]);
+    }
+    ASSERT_ARE_EQUAL(int, 1, connection.Slave.Transactions);
+    ASSERT_ARE_EQUAL(int, WriteCoils, connection.Slave.LastFunctionCode);
+}
+
+TEST_FUNCTION(ModbusWriteQueue_coalesces_more_coils_than_registers_fit_in_a_request)
+{
+    // arrange
+    TEST_CONNECTION connection;
+    test_connect_tcp(&connection, 0);
+    MODBUS_WRITE_QUEUE_HANDLE queue = ModbusWriteQueue_Create("test", &(connection.Context), TEST_WINDOW_MS);
+    ASSERT_IS_NOT_NULL(queue);
+
+    // act: coils 100 to 299, in writes of 8
+    for (int i = 0; i < 25; i++)
+    {
+        MODBUS_WRITE write = test_write(WriteCoil, (uint16_t)(100 + i * 8), 8, 1);
+        ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, ModbusWriteQueue_Write(queue, &write, 24 == i));
+    }
+
+    ModbusWriteQueue_Destroy(queue);
+    test_disconnect(&connection);
+
+    // assert: Write Multiple Coils takes up to 1968 of them, so one request carried all 200
+    for (int i = 0; i < 200; i++)
+    {
+        ASSERT_ARE_EQUAL(int, (i + 1) % 2, connection.Slave.Coils[100 + i]);
+    }
+    ASSERT_ARE_EQUAL(int, 1, connection.Slave.Transactions);
+    ASSERT_ARE_EQUAL(int, WriteCoils, connection.Slave.LastFunctionCode);
+}
+
+TEST_FUNCTION(ModbusPnp_WriteToCapability_writes_a_value_spanning_registers_at_once)
+{
+    // arrange
+    TEST_CONNECTION connection;
+    uint8_t result[MODBUS_RESPONSE_MAX_LENGTH];
+    ModbusCommand command;
+    memset(&command, 0, sizeof(command));
+    command.Name = "setCounter";
+    command.StartAddress = "40051";
+    command.Length = 2;
+    command.DataType = NUMERIC;
+    command.ConversionCoefficient = 1;
+    test_connect_tcp(&connection, 0);
+    connection.Context.capability = &command;
+
+    // act
+    int resultLength = ModbusPnp_WriteToCapability(&(connection.Context), Command, "305419896", result);
+    test_disconnect(&connection);
+
+    // assert: 0x12345678, high word first
+    ASSERT_IS_TRUE(resultLength > 0);
+    ASSERT_ARE_EQUAL(int, 0x1234, connection.Slave.Registers[50]);
+    ASSERT_ARE_EQUAL(int, 0x5678, connection.Slave.Registers[51]);
+    ASSERT_ARE_EQUAL(int, 1, connection.Slave.Transactions);
+    ASSERT_ARE_EQUAL(int, WriteHoldingRegisters, connection.Slave.LastFunctionCode);
+}
+
+TEST_FUNCTION(ModbusWriteQueue_burst_of_property_writes_takes_fewer_transactions)
+{
+    // act
+    int directTransactions = 0;
+    int queuedTransactions = 0;
+    int directMs = test_write_burst(false, &directTransactions);
+    int queuedMs = test_write_burst(true, &queuedTransactions);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, TEST_BURST, directTransactions);
+    ASSERT_IS_TRUE(queuedTransactions < directTransactions);
+
+    (void)printf("write queue: %d property writes in %d transactions and %d ms one by one, %d transactions and %d ms coalesced\r\n",
+        TEST_BURST, directTransactions, directMs, queuedTransactions, queuedMs);
+}
+#endif
+
+END_TEST_SUITE(modbus_write_queue_ut)
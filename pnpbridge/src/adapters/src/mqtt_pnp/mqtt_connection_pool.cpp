@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdio.h>
+#include <stdexcept>
+
+#include "mqtt_connection_pool.hpp"
+
+MqttConnectionPool::~MqttConnectionPool()
+{
+    std::lock_guard<std::mutex> lock(s_Lock);
+    for (auto& connection : s_Connections) {
+        connection.second.ConnectionManager->Disconnect();
+    }
+    s_Connections.clear();
+    for (auto& connection : s_Dropped) {
+        connection.ConnectionManager->Disconnect();
+    }
+    s_Dropped.clear();
+}
+
+MqttConnectionManager*
+MqttConnectionPool::Acquire(
+    const char*             Server,
+    int                     Port,
+    const char*             Username,
+    const char*             Password
+)
+{
+    // Fields are kept apart by a character none of them has
+    std::string key = std::string(Server) + '\n' + std::to_string(Port) + '\n' +
+                      (Username ? Username : "") + '\n' + (Password ? Password : "");
+
+    // Connecting holds the lock, so that components starting together make a single connection
+    std::lock_guard<std::mutex> lock(s_Lock);
+    auto iterator = s_Connections.find(key);
+    if (iterator != s_Connections.end()) {
+        if (iterator->second.ConnectionManager->IsConnected()) {
+            iterator->second.References++;
+            return iterator->second.ConnectionManager.get();
+        }
+
+        // The components still holding the dead connection let go of it as they are destroyed
+        printf("mqtt-pnp: replacing MQTT connection, which went down\n");
+        s_Dropped.push_back(std::move(iterator->second));
+        s_Connections.erase(iterator);
+    }
+
+    PooledConnection connection;
+    connection.ConnectionManager.reset(new MqttConnectionManager());
+    connection.References = 1;
+    connection.ConnectionManager->Connect(Server, Port, Username, Password);
+
+    MqttConnectionManager* connectionManager = connection.ConnectionManager.get();
+    s_Connections.insert(std::make_pair(key, std::move(connection)));
+    return connectionManager;
+}
+
+void
+MqttConnectionPool::Release(
+    MqttConnectionManager*  ConnectionManager,
+    MqttProtocolHandler*    ProtocolHandler
+)
+{
+    std::lock_guard<std::mutex> lock(s_Lock);
+    for (auto iterator = s_Connections.begin(); iterator != s_Connections.end(); ++iterator) {
+        if (iterator->second.ConnectionManager.get() != ConnectionManager) {
+            continue;
+        }
+
+        if (Drop(iterator->second, ProtocolHandler)) {
+            printf("mqtt-pnp: closing MQTT connection, which no component uses\n");
+            s_Connections.erase(iterator);
+        }
+        return;
+    }
+
+    for (auto iterator = s_Dropped.begin(); iterator != s_Dropped.end(); ++iterator) {
+        if (iterator->ConnectionManager.get() != ConnectionManager) {
+            continue;
+        }
+
+        if (Drop(*iterator, ProtocolHandler)) {
+            s_Dropped.erase(iterator);
+        }
+        return;
+    }
+}
+
+bool
+MqttConnectionPool::Drop(
+    PooledConnection&       Connection,
+    MqttProtocolHandler*    ProtocolHandler
+)
+{
+    if (ProtocolHandler != nullptr) {
+        Connection.ConnectionManager->Unsubscribe(ProtocolHandler);
+    }
+
+    if (--Connection.References > 0) {
+        return false;
+    }
+
+    Connection.ConnectionManager->Disconnect();
+    return true;
+}
+
+size_t
+MqttConnectionPool::GetConnectionCount()
+{
+    std::lock_guard<std::mutex> lock(s_Lock);
+    return s_Connections.size();
+}
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "mqtt_manager.hpp"
+
+// The connections of the adapter's components, one per broker and credentials. Components using
+// the same broker share its connection, which is closed when the last of them releases it. A
+// connection that went down is replaced for the components acquiring it from then on.
+class MqttConnectionPool {
+public:
+    ~MqttConnectionPool();
+
+    // Returns the connection to a broker, connecting to it if no component uses it yet. Throws when
+    // the connection can't be made. The username and password may be null.
+    MqttConnectionManager*
+    Acquire(
+        const char*             Server,
+        int                     Port,
+        const char*             Username,
+        const char*             Password
+    );
+
+    // Drops the subscriptions of a component's protocol handler, which may be null, and its hold on
+    // the connection
+    void
+    Release(
+        MqttConnectionManager*  ConnectionManager,
+        MqttProtocolHandler*    ProtocolHandler
+    );
+
+    // Number of connections to brokers that components acquire
+    size_t
+    GetConnectionCount();
+
+private:
+    struct PooledConnection {
+        std::unique_ptr<MqttConnectionManager>  ConnectionManager;
+        int                                     References;
+    };
+
+    std::mutex                  s_Lock;
+    std::map<std::string, PooledConnection>
+                                s_Connections;  // By broker and credentials
+    std::list<PooledConnection> s_Dropped;      // Went down, still held by components
+
+    // Drops a component's hold on a connection and disconnects it if that was the last. Returns
+    // whether it was.
+    bool
+    Drop(
+        PooledConnection&       Connection,
+        MqttProtocolHandler*    ProtocolHandler
+    );
+};
@@ -11,6 +11,23 @@
 #include <map>
 #include <atomic>
 #include <thread>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
 #include "mqtt_manager.hpp"
 
 void
@@ -25,14 +42,69 @@ MqttConnectionManager::Subscribe(
 
     printf("mqtt-pnp: subscribing to MQTT topic %s\n", Topic);
 
-    if (mqtt_client_subscribe(s_MqttClientHandle, GetNextPacketId(), subscribe, 1) != 0) {
+    // Not connected when Connect failed
+    int result = !s_ReactorConnection ? -1 : MqttReactor::Get().Run(s_ReactorConnection, [&]()
+    {
+        // The broker is only asked for the topics no other handler is subscribed to yet
+        std::set<MqttProtocolHandler*>& handlers = s_Topics[std::string(Topic)];
+        if (!handlers.empty()) {
+            handlers.insert(ProtocolHandler);
+            return 0;
+        }
+
+        int subscribed = mqtt_client_subscribe(s_MqttClientHandle, GetNextPacketId(), subscribe, 1);
+        if (subscribed == 0) {
+            handlers.insert(ProtocolHandler);
+        } else {
+            s_Topics.erase(std::string(Topic));
+        }
+        return subscribed;
+    });
+
+    // The connection is left to the other components using it
+    if (result != 0) {
         printf("mqtt-pnp: MQTT subscribe failed\n");
-        Disconnect();
         throw std::invalid_argument("Problem subscribing to MQTT channel");
     }
+}
+
+void
+MqttConnectionManager::Unsubscribe(
+    MqttProtocolHandler *ProtocolHandler
+)
+{
+    if (!s_ReactorConnection) {
+        return;
+    }
+
+    int result = MqttReactor::Get().Run(s_ReactorConnection, [&]()
+    {
+        std::vector<std::string> unused;
+        for (auto iterator = s_Topics.begin(); iterator != s_Topics.end(); ) {
+            iterator->second.erase(ProtocolHandler);
+            if (iterator->second.empty()) {
+                unused.push_back(iterator->first);
+                iterator = s_Topics.erase(iterator);
+            } else {
+                ++iterator;
+            }
+        }
+
+        if (unused.empty()) {
+            return 0;
+        }
 
-    // Add to mapping
-    s_Topics.insert(std::pair<std::string, MqttProtocolHandler*>(std::string(Topic), ProtocolHandler));
+        std::vector<const char*> topics;
+        for (auto& topic : unused) {
+            printf("mqtt-pnp: unsubscribing from MQTT topic %s\n", topic.c_str());
+            topics.push_back(topic.c_str());
+        }
+        return mqtt_client_unsubscribe(s_MqttClientHandle, GetNextPacketId(), topics.data(), topics.size());
+    });
+
+    if (result != 0) {
+        printf("mqtt-pnp: MQTT unsubscribe failed\n");
+    }
 }
 
 uint16_t
@@ -62,9 +134,14 @@ MqttConnectionManager::Publish(
         throw std::runtime_error("Couldn't allocate MQTT publish message");
     }
 
-     if (mqtt_client_publish(s_MqttClientHandle, msg)) {
+    // The reactor sends it right away, instead of the next time the client is worked
+    int result = !s_ReactorConnection ? -1 : MqttReactor::Get().Run(s_ReactorConnection, [&]()
+    {
+        return mqtt_client_publish(s_MqttClientHandle, msg);
+    });
+
+    if (result != 0) {
         mqttmessage_destroy(msg);
-        Disconnect();
         throw std::invalid_argument("Error publishing MQTT message");
     } else {
         mqttmessage_destroy(msg);
@@ -72,23 +149,112 @@ MqttConnectionManager::Publish(
 
 }
 
+std::string
+MqttConnectionManager::CreateClientId()
+{
+    // Brokers drop a connection when another connects with its client ID, so each connection of
+    // every bridge needs one of its own. The ID is kept within the 23 characters every broker takes.
+    static const uint32_t bridgeId = std::random_device()();
+    static std::atomic<uint16_t> nextConnectionId{0};
+    char clientId[24];
+    snprintf(clientId, sizeof(clientId), "pnpbridge-%08x%04x", bridgeId, (unsigned int) nextConnectionId++);
+    return std::string(clientId);
+}
+
+MQTT_SOCKET
+MqttConnectionManager::OpenSocket(
+    const char*         Server,
+    int                 Port
+)
+{
+    struct addrinfo hints = { 0 };
+    struct addrinfo* addresses = nullptr;
+    char port[16];
+    MQTT_SOCKET result = MQTT_INVALID_SOCKET;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    snprintf(port, sizeof(port), "%d", Port);
+    if (getaddrinfo(Server, port, &hints, &addresses) != 0) {
+        printf("mqtt-pnp: couldn't resolve MQTT server %s\n", Server);
+        return MQTT_INVALID_SOCKET;
+    }
+
+    for (struct addrinfo* address = addresses; address != nullptr && result == MQTT_INVALID_SOCKET; address = address->ai_next) {
+        MQTT_SOCKET candidate = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (candidate == MQTT_INVALID_SOCKET) {
+            continue;
+        }
+
+        // The socket is nonblocking from here on: the connect is waited for up to the timeout, and
+        // the reactor reads and writes it
+#ifdef WIN32
+        u_long nonBlocking = 1;
+        bool connecting = ioctlsocket(candidate, FIONBIO, &nonBlocking) == 0;
+        int connected = connecting ? connect(candidate, address->ai_addr, (int) address->ai_addrlen) : SOCKET_ERROR;
+        connecting = connecting && (connected == 0 || WSAGetLastError() == WSAEWOULDBLOCK);
+        WSAPOLLFD pending = { candidate, POLLOUT, 0 };
+        int ready = (connecting && connected != 0) ? WSAPoll(&pending, 1, MQTT_CONNECT_TIMEOUT_MS) : 1;
+#else
+        int flags = fcntl(candidate, F_GETFL, 0);
+        bool connecting = flags >= 0 && fcntl(candidate, F_SETFL, flags | O_NONBLOCK) == 0;
+        int connected = connecting ? connect(candidate, address->ai_addr, address->ai_addrlen) : -1;
+        connecting = connecting && (connected == 0 || errno == EINPROGRESS);
+        struct pollfd pending = { candidate, POLLOUT, 0 };
+        int ready = (connecting && connected != 0) ? poll(&pending, 1, MQTT_CONNECT_TIMEOUT_MS) : 1;
+#endif
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        if (connecting && ready == 1 &&
+            getsockopt(candidate, SOL_SOCKET, SO_ERROR, (char*) &error, &errorLength) == 0 && error == 0) {
+            // Packets are small, and each is sent whole: holding one back for the acknowledgement
+            // of the last only adds to its latency
+            int noDelay = 1;
+            (void) setsockopt(candidate, IPPROTO_TCP, TCP_NODELAY, (const char*) &noDelay, sizeof(noDelay));
+            result = candidate;
+        } else {
+#ifdef WIN32
+            closesocket(candidate);
+#else
+            close(candidate);
+#endif
+        }
+    }
+
+    freeaddrinfo(addresses);
+    if (result == MQTT_INVALID_SOCKET) {
+        printf("mqtt-pnp: couldn't connect to MQTT server %s:%d\n", Server, Port);
+    }
+    return result;
+}
+
 void
 MqttConnectionManager::Connect(
     const char*         Server,
-    int                 Port
+    int                 Port,
+    const char*         Username,
+    const char*         Password
 )
 {
+    s_ClientId = CreateClientId();
+
     MQTT_CLIENT_OPTIONS mqtt_options = { 0 };
-    mqtt_options.clientId = (char*) "azureiotclient";
+    mqtt_options.clientId = (char*) s_ClientId.c_str();
     mqtt_options.willMessage = NULL;
-    mqtt_options.username = NULL;
-    mqtt_options.password = NULL;
+    mqtt_options.username = (char*) Username;
+    mqtt_options.password = (char*) Password;
     mqtt_options.keepAliveInterval = 10;
     mqtt_options.useCleanSession = true;
     mqtt_options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
     // todo: port, qos
-    SOCKETIO_CONFIG socket_config = { Server, Port, NULL };
 
+    // The socket is connected here rather than by the xio, for the reactor to wait on it
+    MQTT_SOCKET socket = OpenSocket(Server, Port);
+    if (socket == MQTT_INVALID_SOCKET) {
+        throw std::invalid_argument("Could not connect to MQTT");
+    }
+    SOCKETIO_CONFIG socket_config = { Server, Port, &socket };
     s_MqttClientHandle =
         mqtt_client_init(
             // OnRecv Callback
@@ -123,47 +289,58 @@ MqttConnectionManager::Connect(
         );
 
     if (!s_MqttClientHandle) {
+#ifdef WIN32
+        closesocket(socket);
+#else
+        close(socket);
+#endif
         throw std::runtime_error("Couldn't allocate new mqtt client handle");
     }
 
     s_XioHandle = xio_create(socketio_get_interface_description(), &socket_config);
     if (!s_XioHandle) {
+#ifdef WIN32
+        closesocket(socket);
+#else
+        close(socket);
+#endif
         mqtt_client_deinit(s_MqttClientHandle);
         s_MqttClientHandle = nullptr;
         throw std::runtime_error("Couldn't create xio handle");
     }
 
+    // The client sends CONNECT right away, on the socket that is already open
+    {
+        std::lock_guard<std::mutex> lock(s_OperationLock);
+        s_ProcessOperation = true;
+        s_OperationSuccess = false;
+    }
     if (mqtt_client_connect(s_MqttClientHandle, s_XioHandle, &mqtt_options) != 0) {
-        mqtt_client_deinit(s_MqttClientHandle);
-        s_MqttClientHandle = nullptr;
-
-        auto xh = s_XioHandle;
-        s_XioHandle = nullptr;
-        xio_close(xh, nullptr, nullptr);
-
+        Disconnect();
         throw std::invalid_argument("Could not connect to MQTT");
     }
 
+    // From here on the client is worked by the reactor, which receives the CONNACK
+    s_ReactorConnection = MqttReactor::Get().Add(s_MqttClientHandle, socket, mqtt_options.keepAliveInterval);
+    if (!s_ReactorConnection) {
+        Disconnect();
+        throw std::runtime_error("Couldn't start serving the MQTT connection");
+    }
+
     // Wait for successful connection
-    s_ProcessOperation = true;
-    while (s_ProcessOperation) {
-        mqtt_client_dowork(s_MqttClientHandle);
+    bool connected = false;
+    {
+        std::unique_lock<std::mutex> lock(s_OperationLock);
+        s_OperationDone.wait_for(lock, std::chrono::milliseconds(MQTT_CONNECT_TIMEOUT_MS), [this]() { return !s_ProcessOperation; });
+        connected = !s_ProcessOperation && s_OperationSuccess;
     }
-    
-    if (!s_OperationSuccess) {
+
+    if (!connected) {
         Disconnect();
         throw std::invalid_argument("Problem getting connect ACK from MQTT");
     }
 
-    // Start worker thread
-    s_RunWorker = true;
-    s_WorkerThread = std::thread([&]()
-    {
-        while (s_RunWorker) {
-            mqtt_client_dowork(s_MqttClientHandle);
-        }
-    });
-    // s_WorkerThread.detach();
+    s_Connected = true;
 }
 
 void
@@ -172,19 +349,20 @@ MqttConnectionManager::OnRecv(
 )
 {
     const char* topicName = mqttmessage_getTopicName(MessageHandle);
-    MqttProtocolHandler* handler_for_topic = nullptr;
+    std::vector<MqttProtocolHandler*> handlers_for_topic;
     const APP_PAYLOAD* mqtt_msg = mqttmessage_getApplicationMsg(MessageHandle);
 
     auto topic_str = std::string(topicName);
 
+    // Copied, as a handler may subscribe or unsubscribe while it is called
     auto iterator = s_Topics.find(topic_str);
     if (iterator != s_Topics.end()) {
-        handler_for_topic = iterator->second;
+        handlers_for_topic.assign(iterator->second.begin(), iterator->second.end());
     }
 
     printf("mqtt-pnp: MQTT receive - topic %s, payload %.*s\n", topicName, (int) mqtt_msg->length, mqtt_msg->message);
 
-    if (handler_for_topic) {
+    for (auto handler_for_topic : handlers_for_topic) {
         handler_for_topic->OnReceive(topicName,
                                      (const char*) mqtt_msg->message,
                                      mqtt_msg->length);
@@ -201,12 +379,12 @@ MqttConnectionManager::OnComplete(
     switch (Result) {
     case MQTT_CLIENT_ON_CONNACK:
         printf("mqtt-pnp: got MQTT CONNACK\n");
-        s_OperationSuccess = true;
-        s_ProcessOperation = false;
+        FinishOperation(true);
         break;
     case MQTT_CLIENT_ON_DISCONNECT:
         printf("mqtt-pnp: got MQTT DISCONNECT\n");
-        // todo stop read thread here
+        s_Connected = false;
+        MqttReactor::Get().CloseCurrent();
         break;
     default:
         break;
@@ -220,27 +398,70 @@ MqttConnectionManager::OnError(
 )
 {
     printf("mqtt-pnp: MQTT error callback\n");
-    s_OperationSuccess = false;
-    s_ProcessOperation = false;
+
+    // The connection is not used again, so its socket is no longer waited on
+    s_Connected = false;
+    MqttReactor::Get().CloseCurrent();
+    FinishOperation(false);
+}
+
+bool
+MqttConnectionManager::IsConnected()
+{
+    return s_Connected;
+}
+
+void
+MqttConnectionManager::FinishOperation(
+    bool                Success
+)
+{
+    std::lock_guard<std::mutex> lock(s_OperationLock);
+    if (s_ProcessOperation) {
+        s_OperationSuccess = Success;
+        s_ProcessOperation = false;
+        s_OperationDone.notify_all();
+    }
 }
 
 void
 MqttConnectionManager::Disconnect()
 {
     printf("mqtt-pnp: disconnect request\n");
-    bool workerRunning = s_RunWorker;
-    if (s_RunWorker) {
-        s_RunWorker = false;
+    s_Connected = false;
+    if (!s_MqttClientHandle) {
+        return;
     }
-    mqtt_client_disconnect(s_MqttClientHandle,
-                           [](void* Context)
-                            {
-                                auto mcm = static_cast<MqttConnectionManager*>(Context);
-                                xio_close(mcm->s_XioHandle, [](void* /*Context*/) { }, Context);
-                            },
-                            this);
 
-    if (workerRunning) {
-        s_WorkerThread.join();
+    auto disconnect = [this]()
+    {
+        return mqtt_client_disconnect(s_MqttClientHandle,
+                                      [](void* Context)
+                                       {
+                                           auto mcm = static_cast<MqttConnectionManager*>(Context);
+                                           xio_close(mcm->s_XioHandle, [](void* /*Context*/) { }, Context);
+                                       },
+                                       this);
+    };
+
+    // Once it is no longer served, the client and its xio, which owns the socket, can go
+    if (s_ReactorConnection) {
+        MqttReactor& reactor = MqttReactor::Get();
+        reactor.Run(s_ReactorConnection, [&]()
+        {
+            int result = disconnect();
+            reactor.CloseCurrent();
+            return result;
+        });
+        reactor.Remove(s_ReactorConnection);
+        s_ReactorConnection = nullptr;
+    } else {
+        disconnect();
     }
+
+    mqtt_client_deinit(s_MqttClientHandle);
+    s_MqttClientHandle = nullptr;
+    xio_destroy(s_XioHandle);
+    s_XioHandle = nullptr;
+    s_Topics.clear();
 }
\ No newline at end of file
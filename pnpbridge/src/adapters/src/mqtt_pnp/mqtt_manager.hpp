@@ -1,7 +1,20 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
 #include "mqtt_protocol_handler.hpp"
+#include "mqtt_reactor.hpp"
+
+// Time the broker has to accept a connection, and then to acknowledge it
+#define MQTT_CONNECT_TIMEOUT_MS 10000
+
+// A connection to a broker, which the components using that broker share. Messages of a topic are
+// handed to every protocol handler subscribed to it.
 class MqttConnectionManager {
 public:
     void
@@ -10,6 +23,13 @@ public:
         MqttProtocolHandler *ProtocolHandler
     );
 
+    // Drops every subscription of a protocol handler, after which it is no longer called. The
+    // broker is unsubscribed from the topics no other handler is subscribed to.
+    void
+    Unsubscribe(
+        MqttProtocolHandler *ProtocolHandler
+    );
+
     void
     Publish(
         const char*         Topic,
@@ -17,24 +37,37 @@ public:
         size_t              MessageSize
     );
 
+    // Connects with a client ID of its own, which no other connection of the bridge uses. The
+    // username and password may be null.
     void
     Connect(
         const char*         Server,
-        int                 Port
+        int                 Port,
+        const char*         Username,
+        const char*         Password
     );
 
     void
     Disconnect();
 
+    // Whether the broker acknowledged the connection and it has not gone down since. A connection
+    // that went down is not made again.
+    bool
+    IsConnected();
+
 private:
     MQTT_CLIENT_HANDLE      s_MqttClientHandle = nullptr;
     XIO_HANDLE              s_XioHandle = nullptr;
+    MqttReactorConnection*  s_ReactorConnection = nullptr;
+    std::mutex              s_OperationLock;    // Guards s_ProcessOperation and s_OperationSuccess
+    std::condition_variable s_OperationDone;
     bool                    s_ProcessOperation = false;
     bool                    s_OperationSuccess = false;
     std::atomic<uint16_t>   s_NextPacketId{0};
-    std::map<std::string, MqttProtocolHandler*> s_Topics;
-    std::thread             s_WorkerThread;
-    bool                    s_RunWorker = true;
+    std::atomic<bool>       s_Connected{false};
+    std::string             s_ClientId;
+    std::map<std::string, std::set<MqttProtocolHandler*>>
+                            s_Topics;           // Used on the reactor thread
 
     void
     OnRecv(
@@ -56,4 +89,20 @@ private:
 
     uint16_t
     GetNextPacketId();
+
+    static
+    std::string
+    CreateClientId();
+
+    static
+    MQTT_SOCKET
+    OpenSocket(
+        const char*         Server,
+        int                 Port
+    );
+
+    void
+    FinishOperation(
+        bool                Success
+    );
 };
\ No newline at end of file
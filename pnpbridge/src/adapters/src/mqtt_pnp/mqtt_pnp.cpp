@@ -27,12 +27,15 @@
 class MqttPnpAdapter {
 public:
     std::map<std::string, JSON_Value*>    s_AdapterConfigs;
+    MqttConnectionPool                    s_ConnectionPool;
 };
 
 MqttPnpInstance::MqttPnpInstance(
     const std::string& componentName):
-    s_ComponentName(componentName),
-    s_ProtocolHandler(nullptr)
+    s_ConnectionPool(nullptr),
+    s_ConnectionManager(nullptr),
+    s_ProtocolHandler(nullptr),
+    s_ComponentName(componentName)
 {
 
 }
@@ -46,7 +49,10 @@ IOTHUB_CLIENT_RESULT MqttPnp_DestroyPnpComponent(
     {
         return IOTHUB_CLIENT_OK;
     }
-    context->s_ConnectionManager.Disconnect();
+    if (context->s_ConnectionPool != nullptr)
+    {
+        context->s_ConnectionPool->Release(context->s_ConnectionManager, context->s_ProtocolHandler);
+    }
     delete context;
 
     return IOTHUB_CLIENT_OK;
@@ -128,6 +134,8 @@ MqttPnp_CreatePnpComponent(
     int mqtt_port = (int) json_object_get_number(AdapterComponentConfig, PNP_CONFIG_ADAPTER_MQTT_PORT);
     const char* protocol = json_object_get_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_MQTT_PROTOCOL);
     const char* mqttConfigId = json_object_get_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_MQTT_IDENTITY);
+    const char* mqtt_username = json_object_get_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_MQTT_USERNAME);
+    const char* mqtt_password = json_object_get_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_MQTT_PASSWORD);
 
     MqttPnpAdapter* adapterContext = reinterpret_cast<MqttPnpAdapter*>(PnpAdapterHandleGetContext(AdapterHandle));
     if (adapterContext == NULL)
@@ -136,36 +144,57 @@ MqttPnp_CreatePnpComponent(
     }
 
     MqttPnpInstance* context = new MqttPnpInstance(ComponentName);
-    LogInfo("mqtt-pnp: connecting to server %s:%d", mqtt_server, mqtt_port);
-
-    try {
-        context->s_ConnectionManager.Connect(mqtt_server, mqtt_port);
-    } catch (const std::exception e) {
-        LogError("mqtt-pnp: Error connecting to MQTT server: %s", e.what());
-    }
-
-    printf("mqtt-pnp: connected to mqtt server\n");
 
-    if (strcmp(protocol, "json_rpc") == 0)
+    if (protocol != NULL && strcmp(protocol, "json_rpc") == 0)
     {
         context->s_ProtocolHandler = (new JsonRpcProtocolHandler(ComponentName));
     }
     else
     {
-        throw std::invalid_argument("Unsupported MQTT Protocol");
+        LogError("mqtt-pnp: Unsupported MQTT Protocol");
+        delete context;
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    if (mqttConfigId != NULL)
+    {
+        mapItem = adapterContext->s_AdapterConfigs.find(std::string(mqttConfigId));
     }
 
-    mapItem = adapterContext->s_AdapterConfigs.find(std::string(mqttConfigId));
-    if (mapItem != adapterContext->s_AdapterConfigs.end())
+    if (mqttConfigId != NULL && mapItem != adapterContext->s_AdapterConfigs.end())
     {
         adapterConfig =  mapItem->second;
     }
     else
     {
-        throw std::invalid_argument("Mqtt adapter doesn't have a supported config");
+        LogError("mqtt-pnp: Mqtt adapter doesn't have a supported config");
+        delete context;
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    // Components on the same broker with the same credentials share one connection
+    LogInfo("mqtt-pnp: connecting to server %s:%d", mqtt_server, mqtt_port);
+
+    try {
+        context->s_ConnectionManager = adapterContext->s_ConnectionPool.Acquire(mqtt_server, mqtt_port, mqtt_username, mqtt_password);
+        context->s_ConnectionPool = &adapterContext->s_ConnectionPool;
+    } catch (const std::exception& e) {
+        LogError("mqtt-pnp: Error connecting to MQTT server: %s", e.what());
+        delete context;
+        return IOTHUB_CLIENT_ERROR;
     }
 
-    context->s_ProtocolHandler->Initialize(&context->s_ConnectionManager, adapterConfig);
+    printf("mqtt-pnp: connected to mqtt server\n");
+
+    // A failed subscription must not escape to the bridge, nor leave the connection held
+    try {
+        context->s_ProtocolHandler->Initialize(context->s_ConnectionManager, adapterConfig);
+    } catch (const std::exception& e) {
+        LogError("mqtt-pnp: Error initializing MQTT protocol handler: %s", e.what());
+        context->s_ConnectionPool->Release(context->s_ConnectionManager, context->s_ProtocolHandler);
+        delete context;
+        return IOTHUB_CLIENT_ERROR;
+    }
 
     PnpComponentHandleSetContext(PnpComponentHandle, context);
     PnpComponentHandleSetPropertyUpdateCallback(PnpComponentHandle, MqttPnp_OnPnpPropertyCallback);
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "mqtt_protocol_handler.hpp"
+#include "mqtt_connection_pool.hpp"
 #include <pnpadapter_api.h>
 #include <nosal.h>
 
@@ -19,7 +20,8 @@ class MqttPnpInstance {
 public:
     MqttPnpInstance(
         const std::string& componentName);
-    MqttConnectionManager   s_ConnectionManager;
+    MqttConnectionPool*     s_ConnectionPool;
+    MqttConnectionManager*  s_ConnectionManager;    // Shared with the components using the same broker
     MqttProtocolHandler* s_ProtocolHandler;
     std::string s_ComponentName;
 };
@@ -29,4 +31,6 @@ public:
 #define PNP_CONFIG_ADAPTER_MQTT_PROTOCOL "mqtt_protocol"
 #define PNP_CONFIG_ADAPTER_MQTT_SERVER "mqtt_server"
 #define PNP_CONFIG_ADAPTER_MQTT_PORT "mqtt_port"
+#define PNP_CONFIG_ADAPTER_MQTT_USERNAME "mqtt_username"
+#define PNP_CONFIG_ADAPTER_MQTT_PASSWORD "mqtt_password"
 #define PNP_CONFIG_ADAPTER_MQTT_SUPPORTED_CONFIG "json_rpc_1"
@@ -0,0 +1,371 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdio.h>
+#include <chrono>
+#include <future>
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+typedef WSAPOLLFD MQTT_POLLFD;
+#define MqttReactor_Poll WSAPoll
+#else
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+typedef struct pollfd MQTT_POLLFD;
+#define MqttReactor_Poll poll
+#endif
+
+#include "mqtt_reactor.hpp"
+
+static
+uint64_t
+MqttReactor_GetTimeMs()
+{
+    return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MqttReactor&
+MqttReactor::Get()
+{
+    static MqttReactor reactor;
+    return reactor;
+}
+
+MqttReactor::~MqttReactor()
+{
+    std::lock_guard<std::mutex> start(s_StartLock);
+    if (s_Thread.joinable()) {
+        Stop();
+    }
+}
+
+bool
+MqttReactor::Start()
+{
+#ifdef WIN32
+    // Windows has no eventfd, so the thread is woken by a datagram it sends itself
+    struct sockaddr_in address = { 0 };
+    int addressLength = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    u_long nonBlocking = 1;
+
+    s_WakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_WakeSocket == INVALID_SOCKET ||
+        bind(s_WakeSocket, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+        getsockname(s_WakeSocket, (struct sockaddr*) &address, &addressLength) != 0 ||
+        connect(s_WakeSocket, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+        ioctlsocket(s_WakeSocket, FIONBIO, &nonBlocking) != 0) {
+        printf("mqtt-pnp: couldn't create the MQTT reactor wake socket\n");
+        if (s_WakeSocket != INVALID_SOCKET) {
+            closesocket(s_WakeSocket);
+            s_WakeSocket = INVALID_SOCKET;
+        }
+        return false;
+    }
+#else
+    s_WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s_WakeFd < 0) {
+        printf("mqtt-pnp: couldn't create the MQTT reactor eventfd\n");
+        return false;
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(s_Lock);
+    s_Stopping = false;
+    s_Thread = std::thread(&MqttReactor::Serve, this);
+    s_ThreadId = s_Thread.get_id();
+    return true;
+}
+
+void
+MqttReactor::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_Lock);
+        s_Stopping = true;
+    }
+    Wake();
+    s_Thread.join();
+
+    std::lock_guard<std::mutex> lock(s_Lock);
+    s_ThreadId = std::thread::id();
+#ifdef WIN32
+    closesocket(s_WakeSocket);
+    s_WakeSocket = INVALID_SOCKET;
+#else
+    close(s_WakeFd);
+    s_WakeFd = -1;
+#endif
+}
+
+void
+MqttReactor::Wake()
+{
+#ifdef WIN32
+    char byte = 0;
+    (void) send(s_WakeSocket, &byte, 1, 0);
+#else
+    uint64_t one = 1;
+    (void) !write(s_WakeFd, &one, sizeof(one));
+#endif
+}
+
+void
+MqttReactor::DrainWakes()
+{
+#ifdef WIN32
+    char bytes[64];
+    while (recv(s_WakeSocket, bytes, sizeof(bytes), 0) > 0) {
+    }
+#else
+    uint64_t count;
+    (void) !read(s_WakeFd, &count, sizeof(count));
+#endif
+}
+
+void
+MqttReactor::Call(
+    std::function<void()>   Operation
+)
+{
+    std::unique_lock<std::mutex> lock(s_Lock);
+    if (std::this_thread::get_id() == s_ThreadId) {
+        lock.unlock();
+        Operation();
+        return;
+    }
+
+    std::promise<void> done;
+    std::future<void> finished = done.get_future();
+    s_Operations.push_back([&]()
+    {
+        Operation();
+        done.set_value();
+    });
+    lock.unlock();
+
+    Wake();
+    finished.wait();
+}
+
+MqttReactorConnection*
+MqttReactor::Add(
+    MQTT_CLIENT_HANDLE      Client,
+    MQTT_SOCKET             Socket,
+    uint16_t                KeepAliveInterval
+)
+{
+    std::lock_guard<std::mutex> start(s_StartLock);
+    if (!s_Thread.joinable() && !Start()) {
+        return nullptr;
+    }
+
+    std::unique_ptr<MqttReactorConnection> connection(new MqttReactorConnection());
+    connection->Client = Client;
+    connection->Socket = Socket;
+    connection->CheckIntervalMs = (KeepAliveInterval > 0) ? (KeepAliveInterval * 1000u) / MQTT_REACTOR_KEEPALIVE_CHECKS : 1000u;
+    connection->NextCheckMs = 0;
+    connection->Due = true;
+    connection->Closed = false;
+    connection->Writing = false;
+
+    MqttReactorConnection* added = connection.get();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(s_Lock);
+            if (!s_Stopping) {
+                s_Connections.push_back(std::move(connection));
+                break;
+            }
+        }
+
+        // The thread is leaving, its last connection having been removed on it, so another one
+        // serves this connection
+        Stop();
+        if (!Start()) {
+            return nullptr;
+        }
+    }
+    Wake();
+    return added;
+}
+
+void
+MqttReactor::Remove(
+    MqttReactorConnection*  Connection
+)
+{
+    // The reactor thread can't wait for itself to stop, and the pass under way may still list the
+    // connection, so there it is only left out until the pass ends
+    {
+        std::lock_guard<std::mutex> lock(s_Lock);
+        if (std::this_thread::get_id() == s_ThreadId) {
+            Connection->Closed = true;
+            s_Operations.push_back([this, Connection]()
+            {
+                std::lock_guard<std::mutex> lock(s_Lock);
+                s_Connections.remove_if([&](const std::unique_ptr<MqttReactorConnection>& c) { return c.get() == Connection; });
+
+                // The thread leaves with its last connection, and Add, which sees it leaving,
+                // starts the next one
+                if (s_Connections.empty()) {
+                    s_Stopping = true;
+                    Wake();
+                }
+            });
+            Wake();
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> start(s_StartLock);
+    bool empty = false;
+
+    Call([&]()
+    {
+        std::lock_guard<std::mutex> lock(s_Lock);
+        s_Connections.remove_if([&](const std::unique_ptr<MqttReactorConnection>& c) { return c.get() == Connection; });
+        empty = s_Connections.empty();
+    });
+
+    // The thread goes away with the last connection, and comes back with the next
+    if (empty) {
+        Stop();
+    }
+}
+
+int
+MqttReactor::Run(
+    MqttReactorConnection*  Connection,
+    std::function<int()>    Operation
+)
+{
+    int result = 0;
+    Call([&]()
+    {
+        // An operation may be run from the callbacks of another client
+        MqttReactorConnection* current = s_Current;
+        s_Current = Connection;
+        result = Operation();
+        s_Current = current;
+        Connection->Due = true;
+    });
+    return result;
+}
+
+void
+MqttReactor::CloseCurrent()
+{
+    if (s_Current != nullptr) {
+        s_Current->Closed = true;
+    }
+}
+
+void
+MqttReactor::Work(
+    MqttReactorConnection*  Connection,
+    uint64_t                Now
+)
+{
+    Connection->Due = false;
+    Connection->NextCheckMs = Now + Connection->CheckIntervalMs;
+    s_Current = Connection;
+    mqtt_client_dowork(Connection->Client);
+    s_Current = nullptr;
+
+    // The xio keeps what the socket would not take, and sends it the next time the client is
+    // worked, which is to be as soon as there is room rather than at the next keep-alive check
+    Connection->Writing = false;
+    if (!Connection->Closed) {
+        MQTT_POLLFD socket = { 0 };
+        socket.fd = Connection->Socket;
+        socket.events = POLLOUT;
+        Connection->Writing = (MqttReactor_Poll(&socket, 1, 0) == 0);
+    }
+}
+
+void
+MqttReactor::Serve()
+{
+    std::vector<MqttReactorConnection*> connections;
+    std::vector<MqttReactorConnection*> polled;
+    std::vector<MQTT_POLLFD> sockets;
+
+    for (;;) {
+        std::vector<std::function<void()>> operations;
+        {
+            std::lock_guard<std::mutex> lock(s_Lock);
+            if (s_Stopping) {
+                break;
+            }
+            operations.swap(s_Operations);
+        }
+
+        // Connections are only removed by operations, so the ones listed after them stay
+        for (auto& operation : operations) {
+            operation();
+        }
+
+        connections.clear();
+        {
+            std::lock_guard<std::mutex> lock(s_Lock);
+            for (auto& connection : s_Connections) {
+                connections.push_back(connection.get());
+            }
+        }
+
+        // Work the clients with I/O, operations or a keep-alive check due, and wait for the rest
+        uint64_t now = MqttReactor_GetTimeMs();
+        int timeoutMs = -1;
+        polled.clear();
+        sockets.clear();
+        MQTT_POLLFD wake = { 0 };
+#ifdef WIN32
+        wake.fd = s_WakeSocket;
+#else
+        wake.fd = s_WakeFd;
+#endif
+        wake.events = POLLIN;
+        sockets.push_back(wake);
+
+        for (auto connection : connections) {
+            if (!connection->Closed && (connection->Due || now >= connection->NextCheckMs)) {
+                Work(connection, now);
+            }
+            if (connection->Closed) {
+                continue;
+            }
+
+            int untilCheckMs = (int) (connection->NextCheckMs - now);
+            if (timeoutMs < 0 || untilCheckMs < timeoutMs) {
+                timeoutMs = untilCheckMs;
+            }
+
+            MQTT_POLLFD socket = { 0 };
+            socket.fd = connection->Socket;
+            socket.events = connection->Writing ? (POLLIN | POLLOUT) : POLLIN;
+            sockets.push_back(socket);
+            polled.push_back(connection);
+        }
+
+        int ready = MqttReactor_Poll(sockets.data(), (unsigned long) sockets.size(), timeoutMs);
+        if (ready <= 0) {
+            continue;
+        }
+
+        if (sockets[0].revents != 0) {
+            DrainWakes();
+        }
+
+        // Errors and hang-ups are worked too, for the client to see them and report them
+        for (size_t i = 0; i < polled.size(); i++) {
+            if (sockets[i + 1].revents != 0) {
+                polled[i]->Due = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "azure_umqtt_c/mqtt_client.h"
+
+#ifdef WIN32
+#include <winsock2.h>
+typedef SOCKET MQTT_SOCKET;
+#define MQTT_INVALID_SOCKET INVALID_SOCKET
+#else
+typedef int MQTT_SOCKET;
+#define MQTT_INVALID_SOCKET -1
+#endif
+
+// Times per keep-alive interval that an idle connection is worked, for the client to send its
+// PINGREQ in time and to notice a missing PINGRESP
+#define MQTT_REACTOR_KEEPALIVE_CHECKS 4
+
+// A connection served by the reactor. Its fields belong to the reactor thread.
+struct MqttReactorConnection {
+    MQTT_CLIENT_HANDLE      Client;
+    MQTT_SOCKET             Socket;
+    uint32_t                CheckIntervalMs;
+    uint64_t                NextCheckMs;
+    bool                    Due;            // Worked on the next pass, after I/O or an operation
+    bool                    Closed;         // The socket is closed or failed, and is not polled
+    bool                    Writing;        // The socket was full when last worked, so it is polled
+                                            // for room to send what the client still holds
+};
+
+// Works the MQTT clients of every connection of the adapter on one thread, which waits for their
+// sockets, for operations and for keep-alive deadlines, and calls mqtt_client_dowork only then.
+// Clients are only touched on this thread, so other threads hand it operations to run.
+class MqttReactor {
+public:
+    static
+    MqttReactor&
+    Get();
+
+    ~MqttReactor();
+
+    // Starts serving a connected client, whose xio reads and writes Socket without blocking
+    MqttReactorConnection*
+    Add(
+        MQTT_CLIENT_HANDLE      Client,
+        MQTT_SOCKET             Socket,
+        uint16_t                KeepAliveInterval
+    );
+
+    // Stops serving a connection, after which its client and socket may be destroyed. On the reactor
+    // thread, from the callbacks of another client, the connection is no longer worked once this
+    // returns, and is removed when the pass under way ends.
+    void
+    Remove(
+        MqttReactorConnection*  Connection
+    );
+
+    // Runs an operation on the client of a connection on the reactor thread, and returns its result
+    int
+    Run(
+        MqttReactorConnection*  Connection,
+        std::function<int()>    Operation
+    );
+
+    // Stops polling the socket of the connection whose client is being worked, once it failed or
+    // was closed. Called from the callbacks of the client.
+    void
+    CloseCurrent();
+
+private:
+    std::mutex                  s_Lock;         // Guards the connections, operations and s_Stopping
+    std::mutex                  s_StartLock;    // Keeps Add and Remove from starting and stopping the thread at once,
+                                                // other than on the reactor thread
+    std::list<std::unique_ptr<MqttReactorConnection>>
+                                s_Connections;  // Removed on the reactor thread only
+    std::vector<std::function<void()>>
+                                s_Operations;
+    std::thread                 s_Thread;
+    std::thread::id             s_ThreadId;
+    MqttReactorConnection*      s_Current = nullptr;    // Whose client is being worked, on the reactor thread
+    bool                        s_Stopping = false;
+#ifdef WIN32
+    MQTT_SOCKET                 s_WakeSocket = MQTT_INVALID_SOCKET;
+#else
+    int                         s_WakeFd = -1;
+#endif
+
+    bool
+    Start();
+
+    void
+    Stop();
+
+    void
+    Wake();
+
+    // Runs an operation on the reactor thread, and waits for it
+    void
+    Call(
+        std::function<void()>   Operation
+    );
+
+    void
+    DrainWakes();
+
+    void
+    Serve();
+
+    void
+    Work(
+        MqttReactorConnection*  Connection,
+        uint64_t                Now
+    );
+};
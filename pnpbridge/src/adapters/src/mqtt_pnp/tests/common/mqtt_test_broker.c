@@ -0,0 +1,510 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIN32
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mqtt_test_broker.h"
+
+#define MQTT_CONNECT 1
+#define MQTT_PUBLISH 3
+#define MQTT_PUBREL 6
+#define MQTT_SUBSCRIBE 8
+#define MQTT_UNSUBSCRIBE 10
+#define MQTT_PINGREQ 12
+#define MQTT_DISCONNECT 14
+
+static void MqttTestBroker_Count(
+    MQTT_TEST_BROKER* broker,
+    int* counter,
+    int change)
+{
+    Lock(broker->Lock);
+    *counter += change;
+    Unlock(broker->Lock);
+}
+
+static bool MqttTestBroker_Send(
+    int socket,
+    const uint8_t* packet,
+    size_t length)
+{
+    size_t sent = 0;
+    while (sent < length)
+    {
+        ssize_t n = send(socket, packet + sent, length - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// Sends a packet of two bytes after its fixed header, such as an acknowledgement of a packet ID
+static bool MqttTestBroker_SendShort(
+    int socket,
+    uint8_t header,
+    const uint8_t* body)
+{
+    uint8_t packet[4] = { header, 2, body[0], body[1] };
+    return MqttTestBroker_Send(socket, packet, sizeof(packet));
+}
+
+static void MqttTestBroker_Close(
+    MQTT_TEST_BROKER* broker,
+    int index)
+{
+    MQTT_TEST_BROKER_CLIENT* client = &(broker->Clients[index]);
+    (void)close(client->Socket);
+    MqttTestBroker_Count(broker, &(broker->Subscriptions), -client->SubscriptionCount);
+    if ('\0' != client->ClientId[0])
+    {
+        MqttTestBroker_Count(broker, &(broker->Connected), -1);
+    }
+
+    broker->ClientCount--;
+    if (index != broker->ClientCount)
+    {
+        memcpy(client, &(broker->Clients[broker->ClientCount]), sizeof(MQTT_TEST_BROKER_CLIENT));
+    }
+}
+
+// Hands a message to the subscribers of its topic, as a PUBLISH at QoS 0
+static void MqttTestBroker_Forward(
+    MQTT_TEST_BROKER* broker,
+    const uint8_t* topic,
+    size_t topicLength,
+    const uint8_t* payload,
+    size_t payloadLength)
+{
+    uint8_t packet[MQTT_TEST_BROKER_PACKET_SIZE + 8];
+    size_t remaining = 2 + topicLength + payloadLength;
+    size_t length = 0;
+
+    if (remaining > MQTT_TEST_BROKER_PACKET_SIZE)
+    {
+        return;
+    }
+
+    packet[length++] = MQTT_PUBLISH << 4;
+    do
+    {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        packet[length++] = (uint8_t)(digit | ((remaining > 0) ? 0x80 : 0));
+    } while (remaining > 0);
+    packet[length++] = (uint8_t)(topicLength >> 8);
+    packet[length++] = (uint8_t)(topicLength & 0xff);
+    memcpy(packet + length, topic, topicLength);
+    length += topicLength;
+    memcpy(packet + length, payload, payloadLength);
+    length += payloadLength;
+
+    for (int i = 0; i < broker->ClientCount; i++)
+    {
+        MQTT_TEST_BROKER_CLIENT* client = &(broker->Clients[i]);
+        for (int j = 0; j < client->SubscriptionCount; j++)
+        {
+            if (strlen(client->Subscriptions[j]) == topicLength && 0 == memcmp(client->Subscriptions[j], topic, topicLength))
+            {
+                (void)MqttTestBroker_Send(client->Socket, packet, length);
+                break;
+            }
+        }
+    }
+}
+
+// Adds or removes the topics of a SUBSCRIBE or UNSUBSCRIBE, returning how many there were
+static int MqttTestBroker_Subscribe(
+    MQTT_TEST_BROKER* broker,
+    MQTT_TEST_BROKER_CLIENT* client,
+    const uint8_t* topics,
+    size_t length,
+    bool subscribe)
+{
+    int count = 0;
+    size_t at = 0;
+    while (at + 2 <= length)
+    {
+        size_t topicLength = (size_t)((topics[at] << 8) | topics[at + 1]);
+        const char* topic = (const char*)(topics + at + 2);
+        at += 2 + topicLength + (subscribe ? 1 : 0);
+        if (at > length || topicLength >= MQTT_TEST_BROKER_TOPIC_LENGTH)
+        {
+            break;
+        }
+        count++;
+
+        int found = -1;
+        for (int i = 0; i < client->SubscriptionCount; i++)
+        {
+            if (strlen(client->Subscriptions[i]) == topicLength && 0 == memcmp(client->Subscriptions[i], topic, topicLength))
+            {
+                found = i;
+            }
+        }
+
+        if (subscribe && found < 0 && client->SubscriptionCount < MQTT_TEST_BROKER_MAX_SUBSCRIPTIONS)
+        {
+            memcpy(client->Subscriptions[client->SubscriptionCount], topic, topicLength);
+            client->Subscriptions[client->SubscriptionCount][topicLength] = '\0';
+            client->SubscriptionCount++;
+            MqttTestBroker_Count(broker, &(broker->Subscriptions), 1);
+        }
+        else if (!subscribe && found >= 0)
+        {
+            client->SubscriptionCount--;
+            memcpy(client->Subscriptions[found], client->Subscriptions[client->SubscriptionCount], MQTT_TEST_BROKER_TOPIC_LENGTH);
+            MqttTestBroker_Count(broker, &(broker->Subscriptions), -1);
+        }
+    }
+    return count;
+}
+
+// Serves one packet of a client, returning false when the client is done
+static bool MqttTestBroker_Serve(
+    MQTT_TEST_BROKER* broker,
+    MQTT_TEST_BROKER_CLIENT* client,
+    uint8_t header,
+    const uint8_t* body,
+    size_t length)
+{
+    switch (header >> 4)
+    {
+        case MQTT_CONNECT:
+        {
+            static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+            // The client ID follows the protocol name, level, flags and keep-alive
+            size_t nameLength = (length < 2) ? 0 : (size_t)((body[0] << 8) | body[1]);
+            size_t idAt = 2 + nameLength + 4;
+            size_t idLength = (idAt + 2 > length) ? 0 : (size_t)((body[idAt] << 8) | body[idAt + 1]);
+            if ('\0' != client->ClientId[0] || 0 == idLength || idLength >= MQTT_TEST_BROKER_CLIENT_ID_LENGTH ||
+                idAt + 2 + idLength > length)
+            {
+                return false;
+            }
+            memcpy(client->ClientId, body + idAt + 2, idLength);
+            client->ClientId[idLength] = '\0';
+
+            // A client connected before with the ID is shut out, and closed once it is next served
+            for (int i = 0; i < broker->ClientCount; i++)
+            {
+                MQTT_TEST_BROKER_CLIENT* other = &(broker->Clients[i]);
+                if (other != client && 0 == strcmp(other->ClientId, client->ClientId))
+                {
+                    (void)shutdown(other->Socket, SHUT_RDWR);
+                    other->ClientId[0] = '\0';
+                    MqttTestBroker_Count(broker, &(broker->Connected), -1);
+                    MqttTestBroker_Count(broker, &(broker->Takeovers), 1);
+                }
+            }
+
+            MqttTestBroker_Count(broker, &(broker->Connections), 1);
+            MqttTestBroker_Count(broker, &(broker->Connected), 1);
+            return MqttTestBroker_Send(client->Socket, connack, sizeof(connack));
+        }
+        case MQTT_PUBLISH:
+        {
+            int qos = (header >> 1) & 0x03;
+            if (length < 2)
+            {
+                return false;
+            }
+            size_t topicLength = (size_t)((body[0] << 8) | body[1]);
+            size_t payloadAt = 2 + topicLength + ((qos > 0) ? 2 : 0);
+            if (payloadAt > length)
+            {
+                return false;
+            }
+
+            MqttTestBroker_Count(broker, &(broker->Publishes), 1);
+            MqttTestBroker_Forward(broker, body + 2, topicLength, body + payloadAt, length - payloadAt);
+
+            // PUBACK for QoS 1, PUBREC for QoS 2, after which the client releases the message
+            return (0 == qos) || MqttTestBroker_SendShort(client->Socket, (1 == qos) ? 0x40 : 0x50, body + 2 + topicLength);
+        }
+        case MQTT_PUBREL:
+            return length >= 2 && MqttTestBroker_SendShort(client->Socket, 0x70, body);
+        case MQTT_SUBSCRIBE:
+        {
+            uint8_t suback[2 + 2 + MQTT_TEST_BROKER_MAX_SUBSCRIPTIONS] = { 0x90 };
+            if (length < 2)
+            {
+                return false;
+            }
+            int count = MqttTestBroker_Subscribe(broker, client, body + 2, length - 2, true);
+            if (count > MQTT_TEST_BROKER_MAX_SUBSCRIPTIONS)
+            {
+                return false;
+            }
+
+            // Every topic is granted QoS 0
+            suback[1] = (uint8_t)(2 + count);
+            suback[2] = body[0];
+            suback[3] = body[1];
+            return MqttTestBroker_Send(client->Socket, suback, 4 + (size_t)count);
+        }
+        case MQTT_UNSUBSCRIBE:
+            if (length < 2)
+            {
+                return false;
+            }
+            (void)MqttTestBroker_Subscribe(broker, client, body + 2, length - 2, false);
+            return MqttTestBroker_SendShort(client->Socket, 0xB0, body);
+        case MQTT_PINGREQ:
+        {
+            static const uint8_t pingresp[] = { 0xD0, 0x00 };
+            MqttTestBroker_Count(broker, &(broker->Pings), 1);
+            return MqttTestBroker_Send(client->Socket, pingresp, sizeof(pingresp));
+        }
+        case MQTT_DISCONNECT:
+        default:
+            return false;
+    }
+}
+
+// Reads what a client sent and serves each whole packet in it, returning false when the client is
+// done
+static bool MqttTestBroker_Receive(
+    MQTT_TEST_BROKER* broker,
+    MQTT_TEST_BROKER_CLIENT* client)
+{
+    ssize_t n = recv(client->Socket, client->Received + client->ReceivedLength,
+        sizeof(client->Received) - client->ReceivedLength, 0);
+    if (n <= 0)
+    {
+        return false;
+    }
+    client->ReceivedLength += (size_t)n;
+
+    for (;;)
+    {
+        // The remaining length follows the first byte, in up to 4 bytes of 7 bits each
+        size_t remaining = 0;
+        size_t headerLength = 1;
+        int shift = 0;
+        bool complete = false;
+        while (headerLength < client->ReceivedLength && headerLength <= 4)
+        {
+            uint8_t digit = client->Received[headerLength++];
+            remaining |= (size_t)(digit & 0x7f) << shift;
+            shift += 7;
+            if (0 == (digit & 0x80))
+            {
+                complete = true;
+                break;
+            }
+        }
+
+        if (!complete)
+        {
+            return headerLength <= 4;
+        }
+        if (headerLength + remaining > sizeof(client->Received))
+        {
+            return false;
+        }
+        if (headerLength + remaining > client->ReceivedLength)
+        {
+            return true;
+        }
+
+        if (!MqttTestBroker_Serve(broker, client, client->Received[0], client->Received + headerLength, remaining))
+        {
+            return false;
+        }
+
+        client->ReceivedLength -= headerLength + remaining;
+        memmove(client->Received, client->Received + headerLength + remaining, client->ReceivedLength);
+    }
+}
+
+static int MqttTestBroker_Run(
+    void* context)
+{
+    MQTT_TEST_BROKER* broker = (MQTT_TEST_BROKER*)context;
+    struct pollfd sockets[2 + MQTT_TEST_BROKER_MAX_CLIENTS];
+
+    for (;;)
+    {
+        sockets[0].fd = broker->Wake[0];
+        sockets[0].events = POLLIN;
+        sockets[1].fd = broker->Listener;
+        sockets[1].events = POLLIN;
+        for (int i = 0; i < broker->ClientCount; i++)
+        {
+            sockets[2 + i].fd = broker->Clients[i].Socket;
+            sockets[2 + i].events = POLLIN;
+        }
+
+        int clientCount = broker->ClientCount;
+        if (poll(sockets, (nfds_t)(2 + clientCount), -1) < 0)
+        {
+            continue;
+        }
+
+        if (0 != sockets[0].revents)
+        {
+            char byte;
+            (void)!read(broker->Wake[0], &byte, 1);
+
+            Lock(broker->Lock);
+            bool stopping = broker->Stopping;
+            bool dropClients = broker->DropClients;
+            broker->DropClients = false;
+            Unlock(broker->Lock);
+
+            if (stopping || dropClients)
+            {
+                while (broker->ClientCount > 0)
+                {
+                    MqttTestBroker_Close(broker, broker->ClientCount - 1);
+                }
+            }
+            if (stopping)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // Clients are served from the last, so that closing one leaves the others in place
+        for (int i = clientCount - 1; i >= 0; i--)
+        {
+            if (0 != sockets[2 + i].revents && !MqttTestBroker_Receive(broker, &(broker->Clients[i])))
+            {
+                MqttTestBroker_Close(broker, i);
+            }
+        }
+
+        if (0 != sockets[1].revents)
+        {
+            int connection = accept(broker->Listener, NULL, NULL);
+            if (connection >= 0 && broker->ClientCount < MQTT_TEST_BROKER_MAX_CLIENTS)
+            {
+                int noDelay = 1;
+                (void)setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                memset(&(broker->Clients[broker->ClientCount]), 0, sizeof(MQTT_TEST_BROKER_CLIENT));
+                broker->Clients[broker->ClientCount].Socket = connection;
+                broker->ClientCount++;
+            }
+            else if (connection >= 0)
+            {
+                (void)close(connection);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void MqttTestBroker_Wake(
+    MQTT_TEST_BROKER* broker)
+{
+    char byte = 0;
+    (void)!write(broker->Wake[1], &byte, 1);
+}
+
+int MqttTestBroker_Start(
+    MQTT_TEST_BROKER* broker)
+{
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+    int reuse = 1;
+
+    memset(broker, 0, sizeof(MQTT_TEST_BROKER));
+    broker->Listener = -1;
+    broker->Wake[0] = -1;
+    broker->Wake[1] = -1;
+
+    broker->Listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (broker->Listener < 0 || 0 != pipe(broker->Wake))
+    {
+        goto fail;
+    }
+    (void)setsockopt(broker->Listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    if (0 != bind(broker->Listener, (struct sockaddr*)&address, sizeof(address)) ||
+        0 != listen(broker->Listener, MQTT_TEST_BROKER_MAX_CLIENTS) ||
+        0 != getsockname(broker->Listener, (struct sockaddr*)&address, &addressLength))
+    {
+        goto fail;
+    }
+    broker->Port = ntohs(address.sin_port);
+
+    broker->Lock = Lock_Init();
+    if (NULL == broker->Lock)
+    {
+        goto fail;
+    }
+    if (THREADAPI_OK != ThreadAPI_Create(&(broker->Thread), MqttTestBroker_Run, broker))
+    {
+        Lock_Deinit(broker->Lock);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (broker->Listener >= 0)
+    {
+        (void)close(broker->Listener);
+    }
+    if (broker->Wake[0] >= 0)
+    {
+        (void)close(broker->Wake[0]);
+        (void)close(broker->Wake[1]);
+    }
+    return -1;
+}
+
+void MqttTestBroker_DropClients(
+    MQTT_TEST_BROKER* broker)
+{
+    Lock(broker->Lock);
+    broker->DropClients = true;
+    Unlock(broker->Lock);
+    MqttTestBroker_Wake(broker);
+}
+
+int MqttTestBroker_Get(
+    MQTT_TEST_BROKER* broker,
+    const int* counter)
+{
+    Lock(broker->Lock);
+    int value = *counter;
+    Unlock(broker->Lock);
+    return value;
+}
+
+void MqttTestBroker_Stop(
+    MQTT_TEST_BROKER* broker)
+{
+    Lock(broker->Lock);
+    broker->Stopping = true;
+    Unlock(broker->Lock);
+    MqttTestBroker_Wake(broker);
+
+    (void)ThreadAPI_Join(broker->Thread, NULL);
+    (void)close(broker->Listener);
+    (void)close(broker->Wake[0]);
+    (void)close(broker->Wake[1]);
+    Lock_Deinit(broker->Lock);
+}
+#endif
@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/lock.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef WIN32
+#define MQTT_TEST_BROKER_MAX_CLIENTS 64
+#define MQTT_TEST_BROKER_MAX_SUBSCRIPTIONS 64
+#define MQTT_TEST_BROKER_TOPIC_LENGTH 128
+#define MQTT_TEST_BROKER_CLIENT_ID_LENGTH 64
+
+// Largest packet a client may send, which is dropped with its connection when larger
+#define MQTT_TEST_BROKER_PACKET_SIZE 4096
+
+typedef struct MQTT_TEST_BROKER_CLIENT {
+    int Socket;
+    char ClientId[MQTT_TEST_BROKER_CLIENT_ID_LENGTH];   // Empty until the client sent CONNECT
+    uint8_t Received[MQTT_TEST_BROKER_PACKET_SIZE];
+    size_t ReceivedLength;
+    int SubscriptionCount;
+    char Subscriptions[MQTT_TEST_BROKER_MAX_SUBSCRIPTIONS][MQTT_TEST_BROKER_TOPIC_LENGTH];
+} MQTT_TEST_BROKER_CLIENT;
+
+// An MQTT 3.1.1 broker on a loopback port, enough for the adapter: it takes connections,
+// subscriptions to exact topics and publishes of any QoS, which it hands to the subscribers of
+// their topic at QoS 0, and answers pings. Like any broker, it drops a client when another connects
+// with its client ID. Clients are served on a thread of their own.
+typedef struct MQTT_TEST_BROKER {
+    uint16_t Port;
+    int Listener;
+    int Wake[2];            // Pipe that wakes the broker to stop, or to drop its clients
+    THREAD_HANDLE Thread;
+    LOCK_HANDLE Lock;       // Guards the fields below
+    bool Stopping;
+    bool DropClients;
+    int Connections;        // Clients connected with CONNECT
+    int Connected;          // Of those, the ones still connected
+    int Takeovers;          // Clients dropped for another connecting with their client ID
+    int Subscriptions;      // Topics subscribed to, over every client
+    int Publishes;          // PUBLISH packets received
+    int Pings;              // PINGREQ packets received
+    int ClientCount;
+    MQTT_TEST_BROKER_CLIENT Clients[MQTT_TEST_BROKER_MAX_CLIENTS];
+} MQTT_TEST_BROKER;
+
+// Starts serving on a free loopback port, which is then in Port. Returns 0 on success.
+int MqttTestBroker_Start(
+    MQTT_TEST_BROKER* broker);
+
+// Closes the connection of every client, as a broker that goes away does
+void MqttTestBroker_DropClients(
+    MQTT_TEST_BROKER* broker);
+
+// Reads one of the counters of the broker
+int MqttTestBroker_Get(
+    MQTT_TEST_BROKER* broker,
+    const int* counter);
+
+void MqttTestBroker_Stop(
+    MQTT_TEST_BROKER* broker);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "mqtt_manager.hpp"
+
+// A protocol handler that counts the messages of the topics it subscribed to, for a test to wait
+// for them
+class MqttTestHandler : public MqttProtocolHandler {
+public:
+    void
+    OnReceive(
+        const char*     /*Topic*/,
+        const char*     /*Message*/,
+        size_t          /*MessageSize*/
+    )
+    {
+        std::lock_guard<std::mutex> lock(s_Lock);
+        s_Received++;
+        s_ReceivedChanged.notify_all();
+    }
+
+    void
+    Initialize(
+        class MqttConnectionManager*
+                                /*ConnectionManager*/,
+        JSON_Value*             /*ProtocolHandlerConfig*/
+    )
+    {
+    }
+
+    void
+    SetIotHubClientHandle(
+        PNPBRIDGE_COMPONENT_HANDLE /*PnpComponentHandle*/
+    )
+    {
+    }
+
+    void
+    OnPnpPropertyCallback(
+        const char*     /*PropertyName*/,
+        JSON_Value*     /*PropertyValue*/,
+        int             /*version*/,
+        void*           /*userContextCallback*/
+    )
+    {
+    }
+
+    int
+    OnPnpCommandCallback(
+        const char*     /*CommandName*/,
+        JSON_Value*     /*CommandValue*/,
+        unsigned char** /*CommandResponse*/,
+        size_t*         /*CommandResponseSize*/
+    )
+    {
+        return 0;
+    }
+
+    void
+    StartTelemetry()
+    {
+    }
+
+    // Waits for the count of messages received to reach a number, returning whether it did
+    bool
+    WaitFor(
+        int             Count,
+        int             TimeoutMs
+    )
+    {
+        std::unique_lock<std::mutex> lock(s_Lock);
+        return s_ReceivedChanged.wait_for(lock, std::chrono::milliseconds(TimeoutMs),
+            [&]() { return s_Received >= Count; });
+    }
+
+    int
+    GetReceived()
+    {
+        std::lock_guard<std::mutex> lock(s_Lock);
+        return s_Received;
+    }
+
+private:
+    std::mutex                  s_Lock;
+    std::condition_variable     s_ReceivedChanged;
+    int                         s_Received = 0;
+};
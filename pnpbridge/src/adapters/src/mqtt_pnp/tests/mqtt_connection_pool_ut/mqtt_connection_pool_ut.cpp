@@ -0,0 +1,253 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+#include "testrunnerswitcher.h"
+
+#include "mqtt_connection_pool.hpp"
+#include "mqtt_test_broker.h"
+#include "mqtt_test_handler.hpp"
+
+#define TEST_COMPONENTS 50
+#define TEST_MESSAGES 2000
+#define TEST_RECEIVE_TIMEOUT_MS 10000
+#define TEST_SETTLE_MS 200
+#define TEST_TOPIC_LENGTH 32
+#define TEST_SHARED_TOPIC "pool/all"
+
+#ifndef WIN32
+static MQTT_TEST_BROKER g_broker;
+static MqttTestHandler* g_handlers;
+static MqttConnectionManager* g_connections[TEST_COMPONENTS];
+static char g_topics[TEST_COMPONENTS][TEST_TOPIC_LENGTH];
+
+// Largest memory the test process has had, in kilobytes, which the broker is part of
+static long test_get_max_rss_kb(void)
+{
+    struct rusage usage;
+    (void)getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static int64_t test_get_time_us(void)
+{
+    return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Waits for one of the counters of the broker to come to a number, returning whether it did
+static bool test_wait_for_broker(
+    const int* counter,
+    int count)
+{
+    for (int waitedMs = 0; waitedMs < TEST_RECEIVE_TIMEOUT_MS; waitedMs += 10)
+    {
+        if (MqttTestBroker_Get(&g_broker, counter) == count)
+        {
+            return true;
+        }
+        ThreadAPI_Sleep(10);
+    }
+    return false;
+}
+
+// Creates a component on the broker, which subscribes to a topic of its own and to the shared one
+static void test_start_component(
+    MqttConnectionPool* pool,
+    int index)
+{
+    (void)snprintf(g_topics[index], sizeof(g_topics[index]), "pool/%d", index);
+    g_connections[index] = pool->Acquire("127.0.0.1", g_broker.Port, NULL, NULL);
+    ASSERT_IS_NOT_NULL(g_connections[index]);
+    g_connections[index]->Subscribe(g_topics[index], &g_handlers[index]);
+    g_connections[index]->Subscribe(TEST_SHARED_TOPIC, &g_handlers[index]);
+}
+#endif
+
+BEGIN_TEST_SUITE(mqtt_connection_pool_ut)
+
+#ifndef WIN32
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    ASSERT_ARE_EQUAL(int, 0, MqttTestBroker_Start(&g_broker));
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    MqttTestBroker_Stop(&g_broker);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    g_handlers = new MqttTestHandler[TEST_COMPONENTS];
+    memset(g_connections, 0, sizeof(g_connections));
+}
+
+TEST_FUNCTION_CLEANUP(TestMethodCleanup)
+{
+    delete[] g_handlers;
+}
+
+TEST_FUNCTION(MqttConnectionPool_benchmark_of_components_sharing_a_broker)
+{
+    // arrange
+    MqttConnectionPool pool;
+    int connections = MqttTestBroker_Get(&g_broker, &g_broker.Connections);
+    long rssStartKb = test_get_max_rss_kb();
+
+    // act: every component starts, then messages go to each of them in turn
+    for (int c = 0; c < TEST_COMPONENTS; c++)
+    {
+        test_start_component(&pool, c);
+    }
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Subscriptions, TEST_COMPONENTS + 1));
+    long rssKb = test_get_max_rss_kb() - rssStartKb;
+
+    g_connections[0]->Publish(TEST_SHARED_TOPIC, "all", 3);
+    for (int c = 0; c < TEST_COMPONENTS; c++)
+    {
+        ASSERT_IS_TRUE(g_handlers[c].WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+    }
+
+    int64_t startUs = test_get_time_us();
+    for (int m = 0; m < TEST_MESSAGES; m++)
+    {
+        int to = m % TEST_COMPONENTS;
+        g_connections[to]->Publish(g_topics[to], "message", 7);
+    }
+    for (int c = 0; c < TEST_COMPONENTS; c++)
+    {
+        ASSERT_IS_TRUE(g_handlers[c].WaitFor(1 + TEST_MESSAGES / TEST_COMPONENTS, TEST_RECEIVE_TIMEOUT_MS));
+    }
+    int64_t elapsedUs = test_get_time_us() - startUs;
+
+    // assert: one connection, which hands each message only to the components of its topic
+    ASSERT_ARE_EQUAL(int, 1, (int)pool.GetConnectionCount());
+    ASSERT_ARE_EQUAL(int, connections + 1, MqttTestBroker_Get(&g_broker, &g_broker.Connections));
+    ASSERT_ARE_EQUAL(int, 1, MqttTestBroker_Get(&g_broker, &g_broker.Connected));
+    ASSERT_ARE_EQUAL(int, 0, MqttTestBroker_Get(&g_broker, &g_broker.Takeovers));
+    ThreadAPI_Sleep(TEST_SETTLE_MS);
+    for (int c = 0; c < TEST_COMPONENTS; c++)
+    {
+        ASSERT_ARE_EQUAL(int, 1 + TEST_MESSAGES / TEST_COMPONENTS, g_handlers[c].GetReceived());
+    }
+
+    (void)printf("mqtt connection pool benchmark: %d components, %d connection, %ld KB, %d messages/s\r\n",
+        TEST_COMPONENTS, (int)pool.GetConnectionCount(), rssKb, (int)((int64_t)TEST_MESSAGES * 1000000 / elapsedUs));
+
+    // cleanup
+    for (int c = 0; c < TEST_COMPONENTS; c++)
+    {
+        pool.Release(g_connections[c], &g_handlers[c]);
+    }
+}
+
+TEST_FUNCTION(MqttConnectionPool_components_leaving_keep_the_connection_of_the_others)
+{
+    // arrange
+    MqttConnectionPool pool;
+    for (int c = 0; c < TEST_COMPONENTS; c++)
+    {
+        test_start_component(&pool, c);
+    }
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Subscriptions, TEST_COMPONENTS + 1));
+
+    // act: all but the last component leave
+    for (int c = 0; c < TEST_COMPONENTS - 1; c++)
+    {
+        pool.Release(g_connections[c], &g_handlers[c]);
+    }
+
+    // assert: only the topics the last component is subscribed to are left, on the same connection
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Subscriptions, 2));
+    ASSERT_ARE_EQUAL(int, 1, MqttTestBroker_Get(&g_broker, &g_broker.Connected));
+    g_connections[TEST_COMPONENTS - 1]->Publish(TEST_SHARED_TOPIC, "all", 3);
+    ASSERT_IS_TRUE(g_handlers[TEST_COMPONENTS - 1].WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+    ThreadAPI_Sleep(TEST_SETTLE_MS);
+    ASSERT_ARE_EQUAL(int, 0, g_handlers[0].GetReceived());
+
+    // the connection is closed with the last component
+    pool.Release(g_connections[TEST_COMPONENTS - 1], &g_handlers[TEST_COMPONENTS - 1]);
+    ASSERT_ARE_EQUAL(int, 0, (int)pool.GetConnectionCount());
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Connected, 0));
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Subscriptions, 0));
+}
+
+TEST_FUNCTION(MqttConnectionPool_connections_with_other_credentials_have_their_own_client_ID)
+{
+    // arrange
+    MqttConnectionPool pool;
+    int takeovers = MqttTestBroker_Get(&g_broker, &g_broker.Takeovers);
+
+    // act
+    MqttConnectionManager* first = pool.Acquire("127.0.0.1", g_broker.Port, "first", "secret");
+    MqttConnectionManager* second = pool.Acquire("127.0.0.1", g_broker.Port, "second", "secret");
+    first->Subscribe("pool/first", &g_handlers[0]);
+    second->Subscribe("pool/second", &g_handlers[1]);
+    ThreadAPI_Sleep(TEST_SETTLE_MS);
+
+    // assert: neither connection took over the other, and both are served
+    ASSERT_IS_TRUE(first != second);
+    ASSERT_ARE_EQUAL(int, 2, (int)pool.GetConnectionCount());
+    ASSERT_ARE_EQUAL(int, 2, MqttTestBroker_Get(&g_broker, &g_broker.Connected));
+    ASSERT_ARE_EQUAL(int, takeovers, MqttTestBroker_Get(&g_broker, &g_broker.Takeovers));
+    first->Publish("pool/second", "first", 5);
+    second->Publish("pool/first", "second", 6);
+    ASSERT_IS_TRUE(g_handlers[0].WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+    ASSERT_IS_TRUE(g_handlers[1].WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+
+    // cleanup
+    pool.Release(first, &g_handlers[0]);
+    pool.Release(second, &g_handlers[1]);
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Connected, 0));
+}
+
+TEST_FUNCTION(MqttConnectionPool_connection_that_went_down_is_replaced)
+{
+    // arrange
+    MqttConnectionPool pool;
+    MqttConnectionManager* dropped = pool.Acquire("127.0.0.1", g_broker.Port, NULL, NULL);
+    dropped->Subscribe("pool/dropped", &g_handlers[0]);
+    MqttTestBroker_DropClients(&g_broker);
+    int waitedMs = 0;
+    while (dropped->IsConnected() && waitedMs < TEST_RECEIVE_TIMEOUT_MS)
+    {
+        ThreadAPI_Sleep(10);
+        waitedMs += 10;
+    }
+    ASSERT_IS_FALSE(dropped->IsConnected());
+
+    // act
+    MqttConnectionManager* replacement = pool.Acquire("127.0.0.1", g_broker.Port, NULL, NULL);
+
+    // assert: the component starting now gets a connection of its own, which is served
+    ASSERT_IS_TRUE(replacement != dropped);
+    ASSERT_IS_TRUE(replacement->IsConnected());
+    ASSERT_ARE_EQUAL(int, 1, (int)pool.GetConnectionCount());
+    replacement->Subscribe("pool/replacement", &g_handlers[1]);
+    replacement->Publish("pool/replacement", "again", 5);
+    ASSERT_IS_TRUE(g_handlers[1].WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+
+    // the component holding the dead connection lets go of it, leaving the replacement
+    pool.Release(dropped, &g_handlers[0]);
+    ASSERT_ARE_EQUAL(int, 1, (int)pool.GetConnectionCount());
+    ASSERT_IS_TRUE(replacement->IsConnected());
+
+    // cleanup
+    pool.Release(replacement, &g_handlers[1]);
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Connected, 0));
+}
+#endif
+
+END_TEST_SUITE(mqtt_connection_pool_ut)
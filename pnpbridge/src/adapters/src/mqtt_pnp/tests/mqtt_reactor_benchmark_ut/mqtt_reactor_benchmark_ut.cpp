@@ -0,0 +1,203 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+#include "testrunnerswitcher.h"
+
+#include "mqtt_manager.hpp"
+#include "mqtt_test_broker.h"
+#include "mqtt_test_handler.hpp"
+
+#define TEST_CONNECTIONS 20
+#define TEST_ROUND_TRIPS 200
+#define TEST_IDLE_MS 2000
+#define TEST_MAX_IDLE_CPU_PERCENT 5
+#define TEST_MAX_P99_LATENCY_US 50000
+#define TEST_RECEIVE_TIMEOUT_MS 5000
+#define TEST_TOPIC_LENGTH 32
+
+#ifndef WIN32
+static MQTT_TEST_BROKER g_broker;
+static MqttConnectionManager g_managers[TEST_CONNECTIONS];
+static MqttTestHandler g_handlers[TEST_CONNECTIONS];
+static int64_t g_latencies[TEST_ROUND_TRIPS];
+
+// CPU time the test process has used, in microseconds, which the broker is part of
+static uint64_t test_get_cpu_us(void)
+{
+    struct rusage usage;
+    (void)getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+        (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static int64_t test_get_time_us(void)
+{
+    return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Waits for one of the counters of the broker to come to a number, returning whether it did
+static bool test_wait_for_broker(
+    const int* counter,
+    int count)
+{
+    for (int waitedMs = 0; waitedMs < TEST_RECEIVE_TIMEOUT_MS; waitedMs += 10)
+    {
+        if (MqttTestBroker_Get(&g_broker, counter) == count)
+        {
+            return true;
+        }
+        ThreadAPI_Sleep(10);
+    }
+    return false;
+}
+
+// Disconnects another connection when it receives a message, as a component that stops from the
+// callbacks of a client does
+class MqttDisconnectingHandler : public MqttTestHandler {
+public:
+    MqttConnectionManager*  s_Other = nullptr;
+
+    void
+    OnReceive(
+        const char*     Topic,
+        const char*     Message,
+        size_t          MessageSize
+    )
+    {
+        if (s_Other != nullptr)
+        {
+            s_Other->Disconnect();
+            s_Other = nullptr;
+        }
+        MqttTestHandler::OnReceive(Topic, Message, MessageSize);
+    }
+};
+
+// Percentage of one core the process used while the connections sat idle
+static uint64_t test_measure_idle_cpu_percent(void)
+{
+    uint64_t cpuStart = test_get_cpu_us();
+    ThreadAPI_Sleep(TEST_IDLE_MS);
+    return (test_get_cpu_us() - cpuStart) * 100 / ((uint64_t)TEST_IDLE_MS * 1000);
+}
+#endif
+
+BEGIN_TEST_SUITE(mqtt_reactor_benchmark_ut)
+
+#ifndef WIN32
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    ASSERT_ARE_EQUAL(int, 0, MqttTestBroker_Start(&g_broker));
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    MqttTestBroker_Stop(&g_broker);
+}
+
+TEST_FUNCTION(MqttReactor_benchmark_of_idle_and_busy_connections)
+{
+    // arrange: every connection subscribes to a topic of its own
+    char topics[TEST_CONNECTIONS][TEST_TOPIC_LENGTH];
+    int subscriptions = MqttTestBroker_Get(&g_broker, &g_broker.Subscriptions);
+    for (int c = 0; c < TEST_CONNECTIONS; c++)
+    {
+        (void)snprintf(topics[c], sizeof(topics[c]), "bench/%d", c);
+        g_managers[c].Connect("127.0.0.1", g_broker.Port, NULL, NULL);
+        g_managers[c].Subscribe(topics[c], &g_handlers[c]);
+    }
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Subscriptions, subscriptions + TEST_CONNECTIONS));
+
+    // act: the connections sit idle, then each message goes from one connection to the next
+    uint64_t idleCpuPercent = test_measure_idle_cpu_percent();
+    for (int i = 0; i < TEST_ROUND_TRIPS; i++)
+    {
+        int to = i % TEST_CONNECTIONS;
+        int64_t sentUs = test_get_time_us();
+        g_managers[(to + 1) % TEST_CONNECTIONS].Publish(topics[to], "ping", 4);
+        ASSERT_IS_TRUE(g_handlers[to].WaitFor(i / TEST_CONNECTIONS + 1, TEST_RECEIVE_TIMEOUT_MS));
+        g_latencies[i] = test_get_time_us() - sentUs;
+    }
+    for (int c = 0; c < TEST_CONNECTIONS; c++)
+    {
+        g_managers[c].Disconnect();
+    }
+
+    // assert: idle connections cost next to nothing, and messages are handled as they come
+    std::sort(g_latencies, g_latencies + TEST_ROUND_TRIPS);
+    int64_t p50Us = g_latencies[TEST_ROUND_TRIPS / 2];
+    int64_t p99Us = g_latencies[TEST_ROUND_TRIPS * 99 / 100];
+    ASSERT_IS_TRUE(idleCpuPercent < TEST_MAX_IDLE_CPU_PERCENT);
+    ASSERT_IS_TRUE(p99Us < TEST_MAX_P99_LATENCY_US);
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Subscriptions, subscriptions));
+
+    (void)printf("mqtt reactor benchmark: %d connections, idle CPU %d%%, round trip p50 %dus p99 %dus\r\n",
+        TEST_CONNECTIONS, (int)idleCpuPercent, (int)p50Us, (int)p99Us);
+}
+
+TEST_FUNCTION(MqttReactor_connections_dropped_by_the_broker_are_not_spun_on)
+{
+    // arrange
+    MqttTestHandler handler;
+    for (int c = 0; c < TEST_CONNECTIONS; c++)
+    {
+        g_managers[c].Connect("127.0.0.1", g_broker.Port, NULL, NULL);
+    }
+
+    // act: the broker goes away, and the connections are left closed until disconnected
+    MqttTestBroker_DropClients(&g_broker);
+    ThreadAPI_Sleep(100);
+    uint64_t idleCpuPercent = test_measure_idle_cpu_percent();
+    for (int c = 0; c < TEST_CONNECTIONS; c++)
+    {
+        g_managers[c].Disconnect();
+    }
+
+    // assert: a closed socket is not waited on again, and a new connection is served as before
+    ASSERT_IS_TRUE(idleCpuPercent < TEST_MAX_IDLE_CPU_PERCENT);
+    g_managers[0].Connect("127.0.0.1", g_broker.Port, NULL, NULL);
+    g_managers[0].Subscribe("bench/again", &handler);
+    g_managers[0].Publish("bench/again", "ping", 4);
+    ASSERT_IS_TRUE(handler.WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+    g_managers[0].Disconnect();
+}
+
+TEST_FUNCTION(MqttReactor_connection_disconnected_from_the_callbacks_of_another)
+{
+    // arrange
+    MqttDisconnectingHandler handler;
+    int connected = MqttTestBroker_Get(&g_broker, &g_broker.Connected);
+    g_managers[0].Connect("127.0.0.1", g_broker.Port, NULL, NULL);
+    g_managers[1].Connect("127.0.0.1", g_broker.Port, NULL, NULL);
+    handler.s_Other = &g_managers[1];
+    g_managers[0].Subscribe("bench/stop", &handler);
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Connected, connected + 2));
+
+    // act
+    g_managers[0].Publish("bench/stop", "stop", 4);
+
+    // assert: the other connection is closed on the reactor thread, which goes on serving this one
+    ASSERT_IS_TRUE(handler.WaitFor(1, TEST_RECEIVE_TIMEOUT_MS));
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Connected, connected + 1));
+    g_managers[0].Publish("bench/stop", "again", 5);
+    ASSERT_IS_TRUE(handler.WaitFor(2, TEST_RECEIVE_TIMEOUT_MS));
+    g_managers[0].Disconnect();
+    ASSERT_IS_TRUE(test_wait_for_broker(&g_broker.Connected, connected));
+}
+#endif
+
+END_TEST_SUITE(mqtt_reactor_benchmark_ut)
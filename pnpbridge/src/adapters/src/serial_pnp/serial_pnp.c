@@ -20,15 +20,10 @@
 #include <ctype.h>
 #include <winerror.h>
 #else
-typedef unsigned int DWORD;
-typedef uint8_t byte;
-typedef int HANDLE;
-typedef short USHORT;
-typedef uint16_t UINT16;
-
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <termios.h>
 #include <unistd.h>
@@ -37,124 +32,167 @@ typedef uint16_t UINT16;
 #include "parson.h"
 
 #include "serial_pnp.h"
+#include "serial_pnp_batch.h"
+#include "serial_pnp_cache.h"
+#include "serial_pnp_format.h"
+#include "serial_pnp_hotplug.h"
+#include "serial_pnp_latency.h"
+#include "serial_pnp_tx.h"
+
+static void SerialPnp_Reconnect(
+    PSERIAL_DEVICE_CONTEXT deviceContext);
+
+static IOTHUB_CLIENT_RESULT SerialPnp_RequestDescriptorHash(
+    PSERIAL_DEVICE_CONTEXT device);
+
+static void SerialPnp_CheckDescriptorRequest(
+    PSERIAL_DEVICE_CONTEXT device,
+    uint64_t now);
 
 int SerialPnp_UartReceiver(
     void* context)
 {
-    int result = 0;
     PSERIAL_DEVICE_CONTEXT deviceContext = (PSERIAL_DEVICE_CONTEXT)context;
+    uint64_t nextClockSync = SerialPnp_MonotonicMicroseconds() + (uint64_t)SERIALPNP_CLOCK_SYNC_INTERVAL_MS * 1000;
+    uint64_t nextLatencyLog = SerialPnp_MonotonicMicroseconds() + (uint64_t)SERIALPNP_LATENCY_LOG_INTERVAL_MS * 1000;
 
-    while (result >= 0) {
+    while (!deviceContext->Closing) {
         byte* desc = NULL;
         DWORD length;
 
+        // The port is reopened here when the device went away, or when the link was restarted
+        if (!deviceContext->Connected)
+        {
+            SerialPnp_Reconnect(deviceContext);
+            continue;
+        }
+
         SerialPnp_RxPacket(deviceContext, &desc, &length, 0x00);
         if (desc != NULL)
         {
             SerialPnp_UnsolicitedPacket(deviceContext, desc, length);
             free(desc);
         }
+
+        uint64_t now = SerialPnp_MonotonicMicroseconds();
+        SerialPnp_CheckDescriptorRequest(deviceContext, now);
+
+        // The device clock drifts, so it is sampled again from time to time
+        if (now >= nextClockSync)
+        {
+            nextClockSync = now + (uint64_t)SERIALPNP_CLOCK_SYNC_INTERVAL_MS * 1000;
+            if (deviceContext->DeviceHasClock && deviceContext->Connected &&
+                (IOTHUB_CLIENT_OK != SerialPnp_RequestDescriptorHash(deviceContext)))
+            {
+                LogError("Unable to sample the clock of %s", deviceContext->PortName);
+            }
+        }
+        if (now >= nextLatencyLog)
+        {
+            nextLatencyLog = now + (uint64_t)SERIALPNP_LATENCY_LOG_INTERVAL_MS * 1000;
+            SerialPnp_Latency_Log(deviceContext->Latency, deviceContext->PortName);
+        }
     }
 
     return IOTHUB_CLIENT_OK;
 }
 
-IOTHUB_CLIENT_RESULT SerialPnp_TxPacket(
-    PSERIAL_DEVICE_CONTEXT serialDevice,
-    byte* OutPacket,
-    int Length)
+// SerialPnp_WritePort is the transmit queue's write callback. It writes a batch of frames to the
+// port, which may hold several frames queued by different components.
+static IOTHUB_CLIENT_RESULT SerialPnp_WritePort(
+    void* context,
+    const byte* data,
+    size_t length,
+    uint64_t* writeCalls)
 {
-    DWORD write_size = 0;
+    PSERIAL_DEVICE_CONTEXT serialDevice = (PSERIAL_DEVICE_CONTEXT)context;
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
     int error = 0;
 
-    DWORD txLength = 1 + Length; // "+1" for start of frame byte
-    // First iterate through and find out our new length
-    for (int i = 0; i < Length; i++)
-    {
-        if ((SERIALPNP_START_OF_FRAME_BYTE == OutPacket[i]) || (SERIALPNP_ESCAPE_BYTE == OutPacket[i]))
-        {
-            txLength++;
-        }
-    }
-
-    // Now construct outgoing buffer
-    byte* SerialPnp_TxPacket = malloc(sizeof(byte) * txLength);
-    if (!SerialPnp_TxPacket)
+    // The port is reopened under this lock when the device comes back
+    Lock(serialDevice->TxLock);
+    if (!serialDevice->Connected)
     {
-        LogError("Error out of memory");
+        Unlock(serialDevice->TxLock);
+        LogError("Serial device on %s is disconnected", serialDevice->PortName);
         return IOTHUB_CLIENT_ERROR;
     }
-    txLength = 1;
-    SerialPnp_TxPacket[0] = 0x5A; // Start of frame
-    for (int i = 0; i < Length; i++)
-    {
-        // Escape these bytes where necessary
-        if ((SERIALPNP_START_OF_FRAME_BYTE == OutPacket[i]) || (SERIALPNP_ESCAPE_BYTE == OutPacket[i]))
-        {
-            SerialPnp_TxPacket[txLength++] = SERIALPNP_ESCAPE_BYTE;
-            SerialPnp_TxPacket[txLength++] = (byte)(OutPacket[i] - 1);
-        }
-        else
-        {
-            SerialPnp_TxPacket[txLength++] = OutPacket[i];
-        }
-    }
-
-
 #ifdef WIN32
-    if (!WriteFile(serialDevice->hSerial, SerialPnp_TxPacket, txLength, &write_size, &serialDevice->osWriter))
+    DWORD write_size = 0;
+    (*writeCalls)++;
+    if (!WriteFile(serialDevice->hSerial, data, (DWORD)length, &write_size, &serialDevice->osWriter))
     {
         // Write returned immediately, but is asynchronous
         if (ERROR_IO_PENDING != (error = GetLastError()))
         {
             // Write returned actual error and not just pending
             LogError("write failed: %d", error);
-            return IOTHUB_CLIENT_ERROR;
+            result = IOTHUB_CLIENT_ERROR;
         }
-        else
+        else if (!GetOverlappedResult(serialDevice->hSerial, &serialDevice->osWriter, &write_size, TRUE))
         {
-            if (!GetOverlappedResult(serialDevice->hSerial, &serialDevice->osWriter, &write_size, TRUE))
-            {
-                error = GetLastError();
-                LogError("write failed: %d", error);
-                return IOTHUB_CLIENT_ERROR;
-            }
+            error = GetLastError();
+            LogError("write failed: %d", error);
+            result = IOTHUB_CLIENT_ERROR;
         }
     }
+    if ((IOTHUB_CLIENT_OK == result) && (write_size != length))
+    {
+        LogError("Timeout while writing");
+        result = IOTHUB_CLIENT_INDEFINITE_TIME;
+    }
 #else
-    if ((write_size = write(serialDevice->hSerial, (const void *)SerialPnp_TxPacket, (size_t)txLength)) == -1)
+    size_t written = 0;
+    while (written < length)
     {
-        LogError("write failed");
-        error = -1;
+        (*writeCalls)++;
+        ssize_t writeResult = write(serialDevice->hSerial, data + written, length - written);
+        if (writeResult < 0)
+        {
+            error = errno;
+            if (EINTR == error)
+            {
+                continue;
+            }
+            LogError("write failed: %s", strerror(error));
+            result = IOTHUB_CLIENT_ERROR;
+            break;
+        }
+        written += (size_t)writeResult;
     }
 #endif
+    Unlock(serialDevice->TxLock);
 
-    if (write_size != txLength)
-    {
-        LogError("Timeout while writing");
-        return IOTHUB_CLIENT_INDEFINITE_TIME;
-    }
-    free(SerialPnp_TxPacket);
-    return IOTHUB_CLIENT_OK;
+    return result;
 }
 
-const EventDefinition* SerialPnp_LookupEvent(
-    SINGLYLINKEDLIST_HANDLE interfaceDefinitions,
-    char* EventName,
-    int InterfaceId)
+// SerialPnp_TxPacket frames a packet and returns once it has been written to the device
+IOTHUB_CLIENT_RESULT SerialPnp_TxPacket(
+    PSERIAL_DEVICE_CONTEXT serialDevice,
+    byte* OutPacket,
+    int Length)
+{
+    return SerialPnp_TxQueue_Send(serialDevice->TxQueue, OutPacket, (size_t)Length, true);
+}
+
+// SerialPnp_PostPacket frames a packet and returns without waiting for it to be written, so that
+// packets sent in quick succession can share a write
+static IOTHUB_CLIENT_RESULT SerialPnp_PostPacket(
+    PSERIAL_DEVICE_CONTEXT serialDevice,
+    byte* OutPacket,
+    int Length)
 {
-    const InterfaceDefinition* interfaceDef;
-    LIST_ITEM_HANDLE interfaceDefHandle = singlylinkedlist_get_head_item(interfaceDefinitions);
+    return SerialPnp_TxQueue_Send(serialDevice->TxQueue, OutPacket, (size_t)Length, false);
+}
 
-    for (int i = 0; i < InterfaceId - 1; i++)
+const EventDefinition* SerialPnp_LookupEvent(
+    const InterfaceDefinition* interfaceDef,
+    const char* EventName)
+{
+    if (NULL == interfaceDef)
     {
-        if (NULL == interfaceDefHandle)
-        {
-            return NULL;
-        }
-        interfaceDefHandle = singlylinkedlist_get_next_item(interfaceDefHandle);
+        return NULL;
     }
-    interfaceDef = singlylinkedlist_item_get_value(interfaceDefHandle);
 
     SINGLYLINKEDLIST_HANDLE events = interfaceDef->Events;
     LIST_ITEM_HANDLE eventDef = singlylinkedlist_get_head_item(events);
@@ -172,103 +210,255 @@ const EventDefinition* SerialPnp_LookupEvent(
     return NULL;
 }
 
-byte* SerialPnp_StringSchemaToBinary(
-    Schema schema,
-    byte* buffer,
-    int* length)
+const PropertyDefinition* SerialPnp_LookupProperty(
+    const InterfaceDefinition* interfaceDef,
+    const char* propertyName);
+
+IOTHUB_CLIENT_RESULT SerialPnp_SendTelemetryAsync(
+    PSERIAL_COMPONENT_CONTEXT ComponentContext,
+    const char* TelemetryJson,
+    const char* Description,
+    const SERIALPNP_EVENT_TIMES* Times);
+
+static void SerialPnp_CheckDescriptorHash(
+    PSERIAL_DEVICE_CONTEXT device,
+    byte* packet,
+    DWORD length);
+
+static void SerialPnp_DescriptorResponse(
+    PSERIAL_DEVICE_CONTEXT device,
+    byte* packet,
+    DWORD length);
+
+// SerialPnp_GetDescriptorHash reads the descriptor hash carried by a reset or descriptor hash response
+static uint32_t SerialPnp_GetDescriptorHash(
+    const byte* packet)
+{
+    return (uint32_t)packet[SERIALPNP_DESCRIPTOR_HASH_OFFSET] |
+           ((uint32_t)packet[SERIALPNP_DESCRIPTOR_HASH_OFFSET + 1] << 8) |
+           ((uint32_t)packet[SERIALPNP_DESCRIPTOR_HASH_OFFSET + 2] << 16) |
+           ((uint32_t)packet[SERIALPNP_DESCRIPTOR_HASH_OFFSET + 3] << 24);
+}
+
+// SerialPnp_GetDeviceTime reads a device clock reading (LE) from a packet
+static uint32_t SerialPnp_GetDeviceTime(
+    const byte* field)
 {
-    byte* bd = NULL;
-    char* data = (char*)buffer;
+    return (uint32_t)field[0] | ((uint32_t)field[1] << 8) | ((uint32_t)field[2] << 16) | ((uint32_t)field[3] << 24);
+}
 
-    if ((Float == schema) || (Int == schema))
+// SerialPnp_DeviceTimeToHost converts the time an event was captured on the device to host time,
+// or 0 while the device clock is not synchronized
+static uint64_t SerialPnp_DeviceTimeToHost(
+    PSERIAL_DEVICE_CONTEXT device,
+    uint32_t deviceTime,
+    uint64_t receivedTime)
+{
+    uint64_t hostTime = 0;
+    if (!SerialPnp_DeviceClock_ToHost(&device->DeviceClock, deviceTime, &hostTime))
     {
-        bd = malloc(sizeof(byte) * 4);
-        if (!bd)
-        {
-            LogError("Error out of memory");
-            return NULL;
-        }
-        *length = 4;
+        return 0;
+    }
 
-        if (schema == Float)
-        {
-            float x = 0;
-            x = (float)atof(data);
-            memcpy(bd, &x, sizeof(float));
-        }
-        else if (schema == Int)
-        {
-            int x;
-            x = atoi(data);
-            memcpy(bd, &x, sizeof(int));
-        }
+    // Within the precision of the clock estimate an event may seem to arrive before it was captured
+    return (hostTime > receivedTime) ? receivedTime : hostTime;
+}
+
+// SerialPnp_GetInterface resolves an interface number from the wire to its descriptor entry
+static const InterfaceDefinition* SerialPnp_GetInterface(
+    PSERIAL_DEVICE_CONTEXT device,
+    int InterfaceIndex)
+{
+    if ((InterfaceIndex < 0) || (InterfaceIndex >= device->InterfaceCount))
+    {
+        return NULL;
     }
-    else if (Boolean == schema)
+    return device->Interfaces[InterfaceIndex];
+}
+
+static void SerialPnp_FreeInterfaceDefinitions(
+    SINGLYLINKEDLIST_HANDLE interfaceDefinitions);
+
+// SerialPnp_AcquireComponentInterface resolves the interface of a component outside the reader, which
+// replaces the interface table when the device changes its descriptor. The definition stays valid
+// until SerialPnp_ReleaseComponentInterface, even if it is replaced in the meantime.
+static const InterfaceDefinition* SerialPnp_AcquireComponentInterface(
+    PSERIAL_COMPONENT_CONTEXT component)
+{
+    Lock(component->Device->ComponentTableLock);
+    component->Device->InterfaceUsers++;
+    const InterfaceDefinition* interfaceDef = SerialPnp_GetInterface(component->Device, component->InterfaceIndex);
+    Unlock(component->Device->ComponentTableLock);
+    return interfaceDef;
+}
+
+// SerialPnp_ReleaseComponentInterface ends the use of a definition, freeing those the device replaced
+// once nothing uses them any more
+static void SerialPnp_ReleaseComponentInterface(
+    PSERIAL_COMPONENT_CONTEXT component)
+{
+    PSERIAL_DEVICE_CONTEXT device = component->Device;
+
+    Lock(device->ComponentTableLock);
+    if (0 == --device->InterfaceUsers)
     {
-        bd = malloc(sizeof(byte) * 1);
-        if (!bd)
+        LIST_ITEM_HANDLE retiredItem;
+        while (NULL != (retiredItem = singlylinkedlist_get_head_item(device->RetiredInterfaceDefinitions)))
         {
-            LogError("Error out of memory");
-            return NULL;
+            SerialPnp_FreeInterfaceDefinitions((SINGLYLINKEDLIST_HANDLE)singlylinkedlist_item_get_value(retiredItem));
+            (void)singlylinkedlist_remove(device->RetiredInterfaceDefinitions, retiredItem);
         }
+    }
+    Unlock(device->ComponentTableLock);
+}
 
-        *length = 1;
-        if (strcmp(data, "true"))
-        {
-            bd[0] = 1;
-        }
-        else if (strcmp(data, "false"))
-        {
-            bd[0] = 0;
-        }
-        else
+// Samples of one event batch are grouped into as few telemetry messages as possible: a sample
+// starts a new message only when its event is already in the current one, or it was taken at
+// a different time
+typedef struct _SERIAL_EVENT_BATCH_CONTEXT {
+    PSERIAL_DEVICE_CONTEXT Device;
+    PSERIAL_COMPONENT_CONTEXT Component;
+    JSON_Value* Message;
+    uint16_t TimeDelta;
+    int SampleCount;
+    // Device time at which the batch was sent, when the device timestamps its events
+    bool HasTimestamp;
+    uint32_t Timestamp;
+    uint64_t Received;
+} SERIAL_EVENT_BATCH_CONTEXT;
+
+static void SerialPnp_FlushEventBatchMessage(
+    SERIAL_EVENT_BATCH_CONTEXT* batch)
+{
+    if (0 == batch->SampleCount)
+    {
+        return;
+    }
+
+    char* telemetry = json_serialize_to_string(batch->Message);
+    if (NULL == telemetry)
+    {
+        LogError("Unable to serialize event batch telemetry");
+    }
+    else
+    {
+        SERIALPNP_EVENT_TIMES times = { 0 };
+        times.Received = batch->Received;
+        times.Decoded = SerialPnp_MonotonicMicroseconds();
+        times.DeviceAge = batch->TimeDelta;
+        if (batch->HasTimestamp)
         {
-            free(bd);
-            *length = 0;
-            bd = NULL;
+            times.Captured = SerialPnp_DeviceTimeToHost(batch->Device, batch->Timestamp - batch->TimeDelta, batch->Received);
         }
+
+        SerialPnp_SendTelemetryAsync(batch->Component, telemetry, "event batch", &times);
+        json_free_serialized_string(telemetry);
     }
-    else
+
+    json_object_clear(json_value_get_object(batch->Message));
+    batch->SampleCount = 0;
+}
+
+static void SerialPnp_EventBatchSample(
+    const EventDefinition* Event,
+    uint16_t TimeDelta,
+    const byte* Value,
+    byte ValueLength,
+    void* Context)
+{
+    SERIAL_EVENT_BATCH_CONTEXT* batch = (SERIAL_EVENT_BATCH_CONTEXT*)Context;
+    JSON_Object* message = json_value_get_object(batch->Message);
+
+    if ((batch->SampleCount > 0) &&
+        ((TimeDelta != batch->TimeDelta) || json_object_has_value(message, Event->defintion.Name)))
     {
-        LogError("Unknown schema");
+        SerialPnp_FlushEventBatchMessage(batch);
     }
 
-    return bd;
+    char* rxstrdata = SerialPnp_BinarySchemaToString(Event->DataSchema, (byte*)Value, ValueLength);
+    JSON_Value* value = (NULL != rxstrdata) ? json_parse_string(rxstrdata) : NULL;
+    if (NULL == value)
+    {
+        LogError("Unable to decode sample of event %s", Event->defintion.Name);
+    }
+    else if (JSONSuccess != json_object_set_value(message, Event->defintion.Name, value))
+    {
+        LogError("Unable to add sample of event %s to telemetry", Event->defintion.Name);
+        json_value_free(value);
+    }
+    else
+    {
+        batch->TimeDelta = TimeDelta;
+        batch->SampleCount++;
+    }
+    free(rxstrdata);
 }
 
-char* SerialPnp_BinarySchemaToString(
-    Schema schema,
-    byte* Data,
-    byte length)
+static void SerialPnp_EventBatchPacket(
+    PSERIAL_DEVICE_CONTEXT device,
+    byte* packet,
+    DWORD length,
+    uint64_t receivedTime)
 {
-    const int MAXRXSTRLEN = 12; // longest case INT_MIN = -2147483648 (11 characters + 1)
-    char* rxstrdata = malloc(MAXRXSTRLEN);
-    if (!rxstrdata)
+    SERIAL_EVENT_BATCH_CONTEXT batch = { 0 };
+    IOTHUB_CLIENT_RESULT result;
+
+    if (length < SERIALPNP_BATCH_SAMPLES_OFFSET)
     {
-        LogError("Error out of memory");
-        return NULL;
+        LogError("Malformed event batch packet");
+        return;
     }
+    byte rxInterfaceId = packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET];
+    batch.Device = device;
+    batch.Received = receivedTime;
+    batch.HasTimestamp = SerialPnp_GetEventBatchTimestamp(packet, length, &batch.Timestamp);
 
-    if ((Float == schema) && (4 == length))
+    if (NULL == (batch.Message = json_value_init_object()))
     {
-        sprintf_s(rxstrdata, MAXRXSTRLEN, "%.6f", *((float*)Data));
+        LogError("Error out of memory");
+        return;
     }
-    else if (((Int == schema) && (4 == length)))
+
+    Lock(device->ComponentTableLock);
+
+    const InterfaceDefinition* interfaceDef = SerialPnp_GetInterface(device, rxInterfaceId);
+    batch.Component = device->Components[rxInterfaceId];
+    if ((NULL == interfaceDef) || (NULL == batch.Component) || !batch.Component->Started)
     {
-        sprintf_s(rxstrdata, MAXRXSTRLEN, "%d", *((int*)Data));
+        LogInfo("Dropping event batch from interface %d, no component is bound to it", rxInterfaceId);
     }
-    else if (((Boolean == schema) && (1 == length)))
+    else if (IOTHUB_CLIENT_OK != (result = SerialPnp_DecodeEventBatch(interfaceDef, packet, length, SerialPnp_EventBatchSample, &batch)))
     {
-        sprintf_s(rxstrdata, MAXRXSTRLEN, "%d", *((int*)Data));
+        LogError("Dropping malformed event batch from interface %d, error=%d", rxInterfaceId, result);
     }
     else
     {
-        LogError("Unknown schema");
-        free(rxstrdata);
-        return NULL;
+        SerialPnp_FlushEventBatchMessage(&batch);
+    }
+
+    Unlock(device->ComponentTableLock);
+    json_value_free(batch.Message);
+}
+
+// SerialPnp_SampleDeviceClock takes the device time from the answer to the last descriptor hash
+// request, to relate the timestamps of events to host time
+static void SerialPnp_SampleDeviceClock(
+    PSERIAL_DEVICE_CONTEXT device,
+    const byte* packet,
+    DWORD length,
+    uint64_t responseTime)
+{
+    if (length < SERIALPNP_DEVICE_TIME_PACKET_LENGTH)
+    {
+        return;
     }
 
-    return rxstrdata;
+    device->DeviceHasClock = true;
+    if (!SerialPnp_DeviceClock_AddSample(&device->DeviceClock, device->ClockSyncRequestTime, responseTime,
+            SerialPnp_GetDeviceTime(packet + SERIALPNP_DEVICE_TIME_OFFSET)))
+    {
+        LogInfo("Discarded clock sample of %s, round trip too long", device->PortName);
+    }
 }
 
 void SerialPnp_UnsolicitedPacket(
@@ -276,79 +466,151 @@ void SerialPnp_UnsolicitedPacket(
     byte* packet,
     DWORD length)
 {
-    // Got an event
-    if (SERIALPNP_PACKET_TYPE_EVENT_NOTIFICATION == packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET])
+    uint64_t receivedTime = SerialPnp_MonotonicMicroseconds();
+
+    byte rxPacketType = packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET];
+    if (SERIALPNP_PACKET_TYPE_EVENT_BATCH == rxPacketType)
     {
-        byte rxInterfaceId = packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET];
-        byte rxNameLength = packet[SERIALPNP_PACKET_NAME_LENGTH_OFFSET];
-        DWORD rxDataSize = length - rxNameLength - SERIALPNP_PACKET_NAME_OFFSET;
+        SerialPnp_EventBatchPacket(device, packet, length, receivedTime);
+        return;
+    }
 
-        char* event_name = malloc(sizeof(char) * (rxNameLength + 1));
-        if (!event_name)
-        {
-            LogError("Error out of memory");
-            return;
-        }
-        memcpy(event_name, packet + SERIALPNP_PACKET_NAME_OFFSET, rxNameLength);
-        event_name[rxNameLength] = '\0';
+    if (SERIALPNP_PACKET_TYPE_DESCRIPTOR_RESPONSE == rxPacketType)
+    {
+        SerialPnp_DescriptorResponse(device, packet, length);
+        return;
+    }
 
-        const EventDefinition* ev = SerialPnp_LookupEvent(device->InterfaceDefinitions, event_name, rxInterfaceId);
-        if (!ev)
+    if (SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_RESPONSE == rxPacketType)
+    {
+        SerialPnp_SampleDeviceClock(device, packet, length, receivedTime);
+    }
+    else if (SERIALPNP_PACKET_TYPE_RESET_RESPONSE == rxPacketType)
+    {
+        // The device restarted on its own, with its clock, and stopped timestamping events until asked again
+        device->DeviceClock.Synchronized = false;
+    }
+
+    // The device reports its descriptor hash when asked, and after every reset
+    if ((SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_RESPONSE == rxPacketType) ||
+        (SERIALPNP_PACKET_TYPE_RESET_RESPONSE == rxPacketType))
+    {
+        SerialPnp_CheckDescriptorHash(device, packet, length);
+        if ((SERIALPNP_PACKET_TYPE_RESET_RESPONSE == rxPacketType) &&
+            (length >= SERIALPNP_DEVICE_TIME_PACKET_LENGTH) &&
+            (IOTHUB_CLIENT_OK != SerialPnp_RequestDescriptorHash(device)))
         {
-            LogError("Couldn't find event");
-            free(event_name);
-            return;
+            LogError("Unable to sample the clock of %s", device->PortName);
         }
+        return;
+    }
+
+    // Property responses only echo a write made from here, and are not changes made on the device
+    if ((SERIALPNP_PACKET_TYPE_EVENT_NOTIFICATION != rxPacketType) &&
+        (SERIALPNP_PACKET_TYPE_PROPERTY_NOTIFICATION != rxPacketType))
+    {
+        return;
+    }
+
+    if (length < SERIALPNP_PACKET_NAME_OFFSET)
+    {
+        LogError("Malformed notification packet");
+        return;
+    }
+
+    byte rxInterfaceId = packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET];
+    byte rxNameLength = packet[SERIALPNP_PACKET_NAME_LENGTH_OFFSET];
+    if (length < (DWORD)(SERIALPNP_PACKET_NAME_OFFSET + rxNameLength))
+    {
+        LogError("Malformed notification packet");
+        return;
+    }
+    DWORD rxDataSize = length - rxNameLength - SERIALPNP_PACKET_NAME_OFFSET;
+    byte* rxData = packet + SERIALPNP_PACKET_NAME_OFFSET + rxNameLength;
 
-        byte* rxData = malloc(sizeof(byte) * rxDataSize);
-        if (!rxData)
+    // A timestamped event carries the device time of its capture after the value
+    SERIALPNP_EVENT_TIMES times = { 0 };
+    times.Received = receivedTime;
+    if ((SERIALPNP_PACKET_TYPE_EVENT_NOTIFICATION == rxPacketType) &&
+        (0 != (packet[SERIALPNP_PACKET_FLAGS_OFFSET] & SERIALPNP_PACKET_FLAG_TIMESTAMP)))
+    {
+        if (rxDataSize < SERIALPNP_DEVICE_TIME_LENGTH)
         {
-            LogError("Error out of memory");
-            free(event_name);
+            LogError("Malformed notification packet");
             return;
         }
+        rxDataSize -= SERIALPNP_DEVICE_TIME_LENGTH;
+        times.Captured = SerialPnp_DeviceTimeToHost(device, SerialPnp_GetDeviceTime(rxData + rxDataSize), receivedTime);
+    }
+
+    char* rx_name = malloc(sizeof(char) * (rxNameLength + 1));
+    if (!rx_name)
+    {
+        LogError("Error out of memory");
+        return;
+    }
+    memcpy(rx_name, packet + SERIALPNP_PACKET_NAME_OFFSET, rxNameLength);
+    rx_name[rxNameLength] = '\0';
 
-        memcpy(rxData, packet + SERIALPNP_PACKET_NAME_OFFSET + rxNameLength, rxDataSize);
+    // Hold the table lock while dispatching so the component can't be stopped underneath us
+    Lock(device->ComponentTableLock);
 
-        char* rxstrdata = SerialPnp_BinarySchemaToString(ev->DataSchema, rxData, (byte)rxDataSize);
-        if (!rxstrdata)
+    const InterfaceDefinition* interfaceDef = SerialPnp_GetInterface(device, rxInterfaceId);
+    PSERIAL_COMPONENT_CONTEXT component = device->Components[rxInterfaceId];
+    if ((NULL == interfaceDef) || (NULL == component) || !component->Started)
+    {
+        LogInfo("Dropping %s from interface %d, no component is bound to it", rx_name, rxInterfaceId);
+    }
+    // Got an event
+    else if (SERIALPNP_PACKET_TYPE_EVENT_NOTIFICATION == rxPacketType)
+    {
+        const EventDefinition* ev = SerialPnp_LookupEvent(interfaceDef, rx_name);
+        char* rxstrdata = NULL;
+        if (!ev)
+        {
+            LogError("Couldn't find event %s on interface %d", rx_name, rxInterfaceId);
+        }
+        else if (NULL == (rxstrdata = SerialPnp_BinarySchemaToString(ev->DataSchema, rxData, (byte)rxDataSize)))
         {
             LogError("Unknown schema");
-            free(event_name);
-            free(rxData);
-            return;
         }
-        LogInfo("%s: %s", ev->defintion.Name, rxstrdata);
-
-        SerialPnp_SendEventAsync(device, ev->defintion.Name, rxstrdata);
-
-        free(event_name);
-        free(rxData);
+        else
+        {
+            times.Decoded = SerialPnp_MonotonicMicroseconds();
+            LogInfo("%s: %s", ev->defintion.Name, rxstrdata);
+            SerialPnp_SendEventAsync(component, ev->defintion.Name, rxstrdata, &times);
+            free(rxstrdata);
+        }
     }
     // Got a property update
-    else if (SERIALPNP_PACKET_TYPE_PROPERTY_NOTIFICATION == packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET])
+    else
     {
-        // TODO
+        const PropertyDefinition* prop = SerialPnp_LookupProperty(interfaceDef, rx_name);
+        char* rxstrdata = NULL;
+        if (!prop)
+        {
+            LogError("Couldn't find property %s on interface %d", rx_name, rxInterfaceId);
+        }
+        else if (NULL == (rxstrdata = SerialPnp_BinarySchemaToString(prop->DataSchema, rxData, (byte)rxDataSize)))
+        {
+            LogError("Unknown schema");
+        }
+        else
+        {
+            LogInfo("%s: %s", prop->defintion.Name, rxstrdata);
+            SerialPnp_QueuePropertyReport(component, prop->defintion.Name, rxstrdata);
+            free(rxstrdata);
+        }
     }
+
+    Unlock(device->ComponentTableLock);
+    free(rx_name);
 }
 
 const PropertyDefinition* SerialPnp_LookupProperty(
-    SINGLYLINKEDLIST_HANDLE interfaceDefinitions,
-    const char* propertyName,
-    int InterfaceId)
+    const InterfaceDefinition* interfaceDef,
+    const char* propertyName)
 {
-    LIST_ITEM_HANDLE interfaceDefHandle = singlylinkedlist_get_head_item(interfaceDefinitions);
-    const InterfaceDefinition* interfaceDef;
-
-    for (int i = 0; i < InterfaceId - 1; i++)
-    {
-        if (NULL == interfaceDefHandle)
-        {
-            return NULL;
-        }
-        interfaceDefHandle = singlylinkedlist_get_next_item(interfaceDefHandle);
-    }
-    interfaceDef = singlylinkedlist_item_get_value(interfaceDefHandle);
     if (NULL == interfaceDef)
     {
         return NULL;
@@ -371,22 +633,13 @@ const PropertyDefinition* SerialPnp_LookupProperty(
 }
 
 const CommandDefinition* SerialPnp_LookupCommand(
-    SINGLYLINKEDLIST_HANDLE interfaceDefinitions,
-    const char* commandName,
-    int InterfaceId)
+    const InterfaceDefinition* interfaceDef,
+    const char* commandName)
 {
-    LIST_ITEM_HANDLE interfaceDefHandle = singlylinkedlist_get_head_item(interfaceDefinitions);
-    const InterfaceDefinition* interfaceDef;
-
-    for (int i = 0; i < InterfaceId - 1; i++)
+    if (NULL == interfaceDef)
     {
-        if (NULL == interfaceDefHandle)
-        {
-            return NULL;
-        }
-        interfaceDefHandle = singlylinkedlist_get_next_item(interfaceDefHandle);
+        return NULL;
     }
-    interfaceDef = singlylinkedlist_item_get_value(interfaceDefHandle);
 
     SINGLYLINKEDLIST_HANDLE command = interfaceDef->Commands;
     LIST_ITEM_HANDLE eventDef = singlylinkedlist_get_head_item(command);
@@ -405,21 +658,24 @@ const CommandDefinition* SerialPnp_LookupCommand(
 }
 
 IOTHUB_CLIENT_RESULT SerialPnp_PropertyHandler(
-    PSERIAL_DEVICE_CONTEXT serialDevice,
+    PSERIAL_COMPONENT_CONTEXT serialComponent,
     const char* property,
     char* data)
 {
-    const PropertyDefinition* prop = SerialPnp_LookupProperty(serialDevice->InterfaceDefinitions, property, 0);
+    PSERIAL_DEVICE_CONTEXT serialDevice = serialComponent->Device;
+    const PropertyDefinition* prop = SerialPnp_LookupProperty(SerialPnp_AcquireComponentInterface(serialComponent), property);
     byte* input = (byte*)data;
 
     if (NULL == prop)
     {
+        SerialPnp_ReleaseComponentInterface(serialComponent);
         return IOTHUB_CLIENT_ERROR;
     }
 
     // Otherwise serialize data
     int dataLength = 0;
     byte* inputPayload = SerialPnp_StringSchemaToBinary(prop->DataSchema, input, &dataLength);
+    SerialPnp_ReleaseComponentInterface(serialComponent);
     if (!inputPayload)
     {
         return IOTHUB_CLIENT_ERROR;
@@ -439,7 +695,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_PropertyHandler(
     txPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = (byte)(txlength >> 8);
     txPacket[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST;
     // txPacket[3] is reserved
-    txPacket[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET] = (byte)0;
+    txPacket[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET] = (byte)serialComponent->InterfaceIndex;
     txPacket[SERIALPNP_PACKET_NAME_LENGTH_OFFSET] = (byte)nameLength;
 
     memcpy(txPacket + SERIALPNP_PACKET_NAME_OFFSET, property, nameLength);
@@ -447,23 +703,31 @@ IOTHUB_CLIENT_RESULT SerialPnp_PropertyHandler(
 
     LogInfo("Setting property %s to %s", property, input);
 
-    SerialPnp_TxPacket(serialDevice, txPacket, txlength);
+    // Property writes are not acknowledged by the device; a burst of them is coalesced
+    IOTHUB_CLIENT_RESULT result = SerialPnp_PostPacket(serialDevice, txPacket, txlength);
 
     free(inputPayload);
     free(txPacket);
 
-    return IOTHUB_CLIENT_OK;
+    return result;
 }
 
 IOTHUB_CLIENT_RESULT SerialPnp_CommandHandler(
-    PSERIAL_DEVICE_CONTEXT serialDevice,
+    PSERIAL_COMPONENT_CONTEXT serialComponent,
     const char* command,
     char* data,
     char** response)
 {
+    PSERIAL_DEVICE_CONTEXT serialDevice = serialComponent->Device;
+
+    // Only one command can be outstanding on the link, whichever interface it targets
     Lock(serialDevice->CommandLock);
 
-    const CommandDefinition* cmd = SerialPnp_LookupCommand(serialDevice->InterfaceDefinitions, command, 0);
+    // The schemas are copied, as the device may change its descriptor while the command runs
+    const CommandDefinition* cmd = SerialPnp_LookupCommand(SerialPnp_AcquireComponentInterface(serialComponent), command);
+    Schema requestSchema = (NULL != cmd) ? cmd->RequestSchema : Invalid;
+    Schema responseSchema = (NULL != cmd) ? cmd->ResponseSchema : Invalid;
+    SerialPnp_ReleaseComponentInterface(serialComponent);
     byte* input = (byte*)data;
 
     if (NULL == cmd)
@@ -474,7 +738,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_CommandHandler(
 
     // Otherwise serialize data
     int length = 0;
-    byte* inputPayload = SerialPnp_StringSchemaToBinary(cmd->RequestSchema, input, &length);
+    byte* inputPayload = SerialPnp_StringSchemaToBinary(requestSchema, input, &length);
     if (!inputPayload)
     {
         Unlock(serialDevice->CommandLock);
@@ -496,7 +760,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_CommandHandler(
     txPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = (byte)(txlength >> 8);
     txPacket[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_COMMAND_REQUEST;
     // txPacket[3] is reserved
-    txPacket[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET] = (byte)0;
+    txPacket[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET] = (byte)serialComponent->InterfaceIndex;
     txPacket[SERIALPNP_PACKET_NAME_LENGTH_OFFSET] = (byte)nameLength;
 
     memcpy(txPacket + SERIALPNP_PACKET_NAME_OFFSET, command, nameLength);
@@ -504,31 +768,57 @@ IOTHUB_CLIENT_RESULT SerialPnp_CommandHandler(
 
     LogInfo("Invoking command %s to %s", command, input);
 
+    // Hold the response lock from before the request goes out, so that the reading thread cannot
+    // hand over the response before this thread waits for it. A response left over from a command
+    // that timed out is dropped.
+    Lock(serialDevice->CommandResponseWaitLock);
+    free(serialDevice->pbMainBuffer);
+    serialDevice->pbMainBuffer = NULL;
+
     if (IOTHUB_CLIENT_OK != SerialPnp_TxPacket(serialDevice, txPacket, txlength))
     {
         LogError("Error: command not sent to device.");
         free(inputPayload);
         free(txPacket);
+        Unlock(serialDevice->CommandResponseWaitLock);
         Unlock(serialDevice->CommandLock);
         return IOTHUB_CLIENT_ERROR;
     }
 
-    Lock(serialDevice->CommandResponseWaitLock);
-    if (COND_OK != Condition_Wait(serialDevice->CommandResponseWaitCondition, serialDevice->CommandResponseWaitLock, 60000))
+    uint64_t deadline = SerialPnp_MonotonicMicroseconds() + (uint64_t)SERIALPNP_COMMAND_TIMEOUT_MS * 1000;
+    while (NULL == serialDevice->pbMainBuffer)
     {
-        LogError("Timeout waiting for response from device");
-        free(inputPayload);
-        free(txPacket);
-        Unlock(serialDevice->CommandLock);
-        Unlock(serialDevice->CommandResponseWaitLock);
-        return IOTHUB_CLIENT_ERROR;
+        uint64_t now = SerialPnp_MonotonicMicroseconds();
+        if (now >= deadline)
+        {
+            LogError("Timeout waiting for response from device");
+            free(inputPayload);
+            free(txPacket);
+            Unlock(serialDevice->CommandResponseWaitLock);
+            Unlock(serialDevice->CommandLock);
+            return IOTHUB_CLIENT_ERROR;
+        }
+        // Rounded up, as a wait of 0 ms would not time out
+        (void)Condition_Wait(serialDevice->CommandResponseWaitCondition, serialDevice->CommandResponseWaitLock,
+            (int)((deadline - now + 999) / 1000));
     }
-    Unlock(serialDevice->CommandResponseWaitLock);
 
     byte* responsePacket = serialDevice->pbMainBuffer;
+    serialDevice->pbMainBuffer = NULL;
+    Unlock(serialDevice->CommandResponseWaitLock);
+
     int dataOffset = SERIALPNP_PACKET_NAME_OFFSET + nameLength;
-    byte* commandResponse = responsePacket + dataOffset;
-    char* stval = SerialPnp_BinarySchemaToString(cmd->ResponseSchema, commandResponse, (byte)length);
+    int responseLength = responsePacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] |
+                         (responsePacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] << 8);
+    char* stval = NULL;
+    if (responseLength < dataOffset)
+    {
+        LogError("Response to command %s is too short", command);
+    }
+    else
+    {
+        stval = SerialPnp_BinarySchemaToString(responseSchema, responsePacket + dataOffset, (byte)(responseLength - dataOffset));
+    }
     free(inputPayload);
     free(responsePacket);
     free(txPacket);
@@ -563,11 +853,19 @@ void SerialPnp_ParseDescriptor(
 
     c += display_name_length;
 
+    int interfaceIndex = 0;
     while (c < (int)length)
     {
         if (descriptor[c++] == 0x05)
         {
             InterfaceDefinition* indef = calloc(1, sizeof(InterfaceDefinition));
+            if (!indef)
+            {
+                LogError("Error out of memory");
+                return;
+            }
+            // Interfaces are numbered on the wire in the order the descriptor lists them
+            indef->Index = interfaceIndex++;
             indef->Events = singlylinkedlist_create();
             indef->Properties = singlylinkedlist_create();
             indef->Commands = singlylinkedlist_create();
@@ -850,17 +1148,134 @@ IOTHUB_CLIENT_RESULT SerialPnp_FindSerialDevices()
 }
 #endif
 
-int SerialPnp_ParseInterfaceConfig(
-    void* context)
+// SerialPnp_InstallDescriptor parses a descriptor response and makes its interfaces the ones served
+// on the link. Definitions it replaces are retired while property and command handlers are using
+// them, and freed by the last of those to finish.
+static IOTHUB_CLIENT_RESULT SerialPnp_InstallDescriptor(
+    PSERIAL_DEVICE_CONTEXT deviceContext,
+    byte* desc,
+    DWORD length)
+{
+    SINGLYLINKEDLIST_HANDLE interfaceDefinitions = singlylinkedlist_create();
+    if (NULL == interfaceDefinitions)
+    {
+        LogError("Error out of memory");
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    SerialPnp_ParseDescriptor(interfaceDefinitions, desc, length);
+
+    LIST_ITEM_HANDLE interfaceItem = singlylinkedlist_get_head_item(interfaceDefinitions);
+    while (NULL != interfaceItem)
+    {
+        InterfaceDefinition* interfaceDef = (InterfaceDefinition*)singlylinkedlist_item_get_value(interfaceItem);
+        if (IOTHUB_CLIENT_OK != SerialPnp_IndexInterfaceEvents(interfaceDef))
+        {
+            LogError("Unable to index events of interface %s, event batches from it will be dropped", interfaceDef->Id);
+        }
+        interfaceItem = singlylinkedlist_get_next_item(interfaceItem);
+    }
+
+    Lock(deviceContext->ComponentTableLock);
+    SINGLYLINKEDLIST_HANDLE previousDefinitions = deviceContext->InterfaceDefinitions;
+    deviceContext->InterfaceDefinitions = interfaceDefinitions;
+
+    memset((void*)deviceContext->Interfaces, 0, sizeof(deviceContext->Interfaces));
+    deviceContext->InterfaceCount = 0;
+    interfaceItem = singlylinkedlist_get_head_item(interfaceDefinitions);
+    while ((NULL != interfaceItem) && (deviceContext->InterfaceCount < SERIALPNP_MAX_INTERFACE_COUNT))
+    {
+        deviceContext->Interfaces[deviceContext->InterfaceCount++] = singlylinkedlist_item_get_value(interfaceItem);
+        interfaceItem = singlylinkedlist_get_next_item(interfaceItem);
+    }
+
+    for (int i = 0; i < SERIALPNP_MAX_INTERFACE_COUNT; i++)
+    {
+        if ((NULL != deviceContext->Components[i]) && (i >= deviceContext->InterfaceCount))
+        {
+            LogError("Component %s is bound to interface %d, but %s only describes %d interface(s)",
+                deviceContext->Components[i]->ComponentName, i, deviceContext->PortName, deviceContext->InterfaceCount);
+        }
+    }
+
+    if ((NULL != previousDefinitions) && (0 == deviceContext->InterfaceUsers))
+    {
+        SerialPnp_FreeInterfaceDefinitions(previousDefinitions);
+    }
+    else if ((NULL != previousDefinitions) &&
+        (NULL == singlylinkedlist_add(deviceContext->RetiredInterfaceDefinitions, previousDefinitions)))
+    {
+        LogError("Unable to retire previous interface definitions of %s", deviceContext->PortName);
+    }
+    Unlock(deviceContext->ComponentTableLock);
+
+    return IOTHUB_CLIENT_OK;
+}
+
+// SerialPnp_AdoptDescriptor installs a descriptor received from the device. The descriptor is cached
+// when the device reports a hash for it, so the next start can skip the exchange.
+static IOTHUB_CLIENT_RESULT SerialPnp_AdoptDescriptor(
+    PSERIAL_DEVICE_CONTEXT deviceContext,
+    byte* desc,
+    DWORD length,
+    bool hashReported,
+    uint32_t reportedHash)
+{
+    const char* cachePath = (NULL != deviceContext->Adapter) ? deviceContext->Adapter->DescriptorCachePath : NULL;
+
+    IOTHUB_CLIENT_RESULT result = SerialPnp_InstallDescriptor(deviceContext, desc, length);
+    if (IOTHUB_CLIENT_OK == result)
+    {
+        uint32_t hash = SerialPnp_DescriptorHash(desc, length);
+        deviceContext->DescriptorFromCache = false;
+        deviceContext->DescriptorHashKnown = hashReported && (hash == reportedHash);
+        deviceContext->DescriptorHash = hash;
+
+        if (hashReported && (hash != reportedHash))
+        {
+            LogError("Device on %s reported descriptor hash %08x, but its descriptor hashes to %08x",
+                deviceContext->PortName, reportedHash, hash);
+        }
+
+        if (NULL != cachePath)
+        {
+            if (deviceContext->DescriptorHashKnown)
+            {
+                SerialPnp_StoreCachedDescriptor(cachePath, deviceContext->PortName, desc, length, hash);
+            }
+            else
+            {
+                // Without a hash from the device a cached copy could never be verified
+                SerialPnp_RemoveCachedDescriptor(cachePath, deviceContext->PortName);
+            }
+        }
+
+        // A reset makes the device stop timestamping events, which it only does when asked
+        if (deviceContext->DeviceHasClock &&
+            (IOTHUB_CLIENT_OK != SerialPnp_RequestDescriptorHash(deviceContext)))
+        {
+            LogError("Unable to ask %s to timestamp its events", deviceContext->PortName);
+        }
+    }
+
+    return result;
+}
+
+// SerialPnp_ExchangeDescriptor resets the device and fetches its descriptor. It reads the port itself,
+// so it only runs before the reader is started.
+static IOTHUB_CLIENT_RESULT SerialPnp_ExchangeDescriptor(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
 {
     byte* desc;
     DWORD length;
-    PSERIAL_DEVICE_CONTEXT deviceContext = context;
+    uint32_t reportedHash = 0;
+    bool hashReported = false;
+
     int retries = SERIALPNP_RESET_OR_DESCRIPTOR_MAX_RETRIES;
-    while (IOTHUB_CLIENT_OK != SerialPnp_ResetDevice(deviceContext))
+    while (IOTHUB_CLIENT_OK != SerialPnp_ResetDevice(deviceContext, &reportedHash, &hashReported))
     {
         LogError("Error sending reset request. Retrying...");
-        if (0 == --retries)
+        if ((0 == --retries) || deviceContext->Closing)
         {
             LogError("Error exceeded max number of reset request retries. ");
             return IOTHUB_CLIENT_ERROR;
@@ -871,7 +1286,7 @@ int SerialPnp_ParseInterfaceConfig(
     while (IOTHUB_CLIENT_OK != SerialPnp_DeviceDescriptorRequest(deviceContext, &desc, &length))
     {
         LogError("Descriptor response not received. Retrying...");
-        if (0 == --retries)
+        if ((0 == --retries) || deviceContext->Closing)
         {
             LogError("Error exceeded max number of descriptor request retries. ");
             return IOTHUB_CLIENT_ERROR;
@@ -879,8 +1294,141 @@ int SerialPnp_ParseInterfaceConfig(
         ThreadAPI_Sleep(5000);
     }
 
-    SerialPnp_ParseDescriptor(deviceContext->InterfaceDefinitions, desc, length);
-    return IOTHUB_CLIENT_OK;
+    IOTHUB_CLIENT_RESULT result = SerialPnp_AdoptDescriptor(deviceContext, desc, length, hashReported, reportedHash);
+    free(desc);
+
+    return result;
+}
+
+int SerialPnp_ParseInterfaceConfig(
+    void* context)
+{
+    return SerialPnp_ExchangeDescriptor((PSERIAL_DEVICE_CONTEXT)context);
+}
+
+// SerialPnp_SendDescriptorRequest asks the device for its descriptor
+static IOTHUB_CLIENT_RESULT SerialPnp_SendDescriptorRequest(
+    PSERIAL_DEVICE_CONTEXT serialDevice)
+{
+    byte txPacket[SERIALPNP_MIN_PACKET_LENGTH] = { 0 }; // packet header
+    txPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = SERIALPNP_MIN_PACKET_LENGTH;
+    txPacket[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_DESCRIPTOR_REQUEST;
+
+    serialDevice->DescriptorRequestTime = SerialPnp_MonotonicMicroseconds();
+    return SerialPnp_TxPacket(serialDevice, txPacket, SERIALPNP_MIN_PACKET_LENGTH);
+}
+
+// SerialPnp_RefetchDescriptor asks a running device for its descriptor again. The reader installs the
+// response when it arrives, and keeps handling other packets in the meantime.
+static void SerialPnp_RefetchDescriptor(
+    PSERIAL_DEVICE_CONTEXT device,
+    bool hashReported,
+    uint32_t reportedHash)
+{
+    device->DescriptorRequestPending = true;
+    device->DescriptorRequestRetries = SERIALPNP_RESET_OR_DESCRIPTOR_MAX_RETRIES;
+    device->RequestedDescriptorHashKnown = hashReported;
+    device->RequestedDescriptorHash = reportedHash;
+    if (IOTHUB_CLIENT_OK != SerialPnp_SendDescriptorRequest(device))
+    {
+        LogError("Unable to request the descriptor of %s", device->PortName);
+    }
+}
+
+// SerialPnp_CheckDescriptorRequest sends a descriptor request again when the device did not answer
+// it in time, giving up after a few attempts. Runs on the reader thread.
+static void SerialPnp_CheckDescriptorRequest(
+    PSERIAL_DEVICE_CONTEXT device,
+    uint64_t now)
+{
+    if (!device->DescriptorRequestPending ||
+        (now < device->DescriptorRequestTime + (uint64_t)SERIALPNP_RESPONSE_TIMEOUT_MS * 1000))
+    {
+        return;
+    }
+
+    if (0 == --device->DescriptorRequestRetries)
+    {
+        LogError("Unable to fetch the new descriptor of %s, keeping the previous one", device->PortName);
+        device->DescriptorRequestPending = false;
+    }
+    else
+    {
+        LogError("Descriptor response not received. Retrying...");
+        if (IOTHUB_CLIENT_OK != SerialPnp_SendDescriptorRequest(device))
+        {
+            LogError("Unable to request the descriptor of %s", device->PortName);
+        }
+    }
+}
+
+// SerialPnp_DescriptorResponse installs a descriptor the reader asked for
+static void SerialPnp_DescriptorResponse(
+    PSERIAL_DEVICE_CONTEXT device,
+    byte* packet,
+    DWORD length)
+{
+    if (!device->DescriptorRequestPending)
+    {
+        // Answers a request that was retried and already answered
+        return;
+    }
+
+    device->DescriptorRequestPending = false;
+    LogInfo("Receieved descriptor response, of length %d", length);
+    if (IOTHUB_CLIENT_OK != SerialPnp_AdoptDescriptor(device, packet, length,
+            device->RequestedDescriptorHashKnown, device->RequestedDescriptorHash))
+    {
+        LogError("Unable to install the new descriptor of %s, keeping the previous one", device->PortName);
+    }
+}
+
+// SerialPnp_CheckDescriptorHash compares a descriptor hash reported by the device with the descriptor
+// in use, and fetches the descriptor again if the device no longer matches it. Runs on the reader
+// thread, which is the only one reading from the port once components have started.
+static void SerialPnp_CheckDescriptorHash(
+    PSERIAL_DEVICE_CONTEXT device,
+    byte* packet,
+    DWORD length)
+{
+    if (!device->DescriptorHashKnown || device->DescriptorRequestPending)
+    {
+        // Nothing to compare against, as the device never reported a hash for its descriptor, or
+        // the descriptor is already being fetched
+        return;
+    }
+
+    bool hashReported = (length >= SERIALPNP_DESCRIPTOR_HASH_PACKET_LENGTH);
+    uint32_t reportedHash = hashReported ? SerialPnp_GetDescriptorHash(packet) : 0;
+    if (hashReported && (reportedHash == device->DescriptorHash))
+    {
+        if (device->DescriptorFromCache)
+        {
+            LogInfo("Device on %s confirmed the cached descriptor", device->PortName);
+            device->DescriptorFromCache = false;
+        }
+        return;
+    }
+
+    LogInfo("Device on %s changed its descriptor, fetching it again", device->PortName);
+    SerialPnp_RefetchDescriptor(device, hashReported, reportedHash);
+}
+
+// SerialPnp_RequestDescriptorHash asks the device for the hash of its descriptor, and the time of its
+// clock if it has one. The response is handled by the reader thread.
+static IOTHUB_CLIENT_RESULT SerialPnp_RequestDescriptorHash(
+    PSERIAL_DEVICE_CONTEXT device)
+{
+    byte txPacket[SERIALPNP_MIN_PACKET_LENGTH] = { 0 };
+    txPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = SERIALPNP_MIN_PACKET_LENGTH;
+    txPacket[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_REQUEST;
+    // Devices with a clock answer with their time, and timestamp their events from then on
+    txPacket[SERIALPNP_PACKET_FLAGS_OFFSET] = SERIALPNP_REQUEST_FLAG_TIMESTAMPS;
+
+    // The clock sample is only good if it answers this request, so a response to an older one that
+    // arrives late makes for a long round trip and is discarded
+    device->ClockSyncRequestTime = SerialPnp_MonotonicMicroseconds();
+    return SerialPnp_TxPacket(device, txPacket, SERIALPNP_MIN_PACKET_LENGTH);
 }
 
 #ifndef WIN32
@@ -946,6 +1494,23 @@ set_blocking(
     if (tcsetattr(fd, TCSANOW, &tty) != 0)
         LogError("error %d setting term attributes", errno);
 }
+
+static speed_t SerialPnp_GetBaudRateSpeed(
+    DWORD baudRate)
+{
+    switch (baudRate)
+    {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        default:
+            LogError("Unsupported baud rate %u, using 115200", baudRate);
+            return B115200;
+    }
+}
 #endif 
 
 IOTHUB_CLIENT_RESULT SerialPnp_OpenDevice(
@@ -1004,20 +1569,18 @@ IOTHUB_CLIENT_RESULT SerialPnp_OpenDevice(
         return -1;
     }
 #else 
-    char *portname = "/dev/ttyACM0";
-    int fd = open(portname, O_RDWR | O_NOCTTY | O_SYNC);
+    int fd = open(port, O_RDWR | O_NOCTTY | O_SYNC | O_CLOEXEC);
     if (fd < 0)
     {
-        LogError("error %d opening %s: %s", errno, portname, strerror(errno));
-        return -1;
+        LogError("error %d opening %s: %s", errno, port, strerror(errno));
+        return (ENOENT == errno) ? IOTHUB_CLIENT_INVALID_ARG : IOTHUB_CLIENT_ERROR;
     }
 
-    set_interface_attribs(fd, B115200, 0);  // set speed to 115,200 bps, 8n1 (no parity)
+    set_interface_attribs(fd, SerialPnp_GetBaudRateSpeed(baudRate), 0);  // 8n1 (no parity)
 
 #endif
 
 #ifdef WIN32
-    deviceContext->hSerial = hSerial;
     deviceContext->osWriter.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
     deviceContext->osReader.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
     if (NULL == deviceContext->osWriter.hEvent ||
@@ -1026,22 +1589,174 @@ IOTHUB_CLIENT_RESULT SerialPnp_OpenDevice(
         if (NULL != deviceContext->osWriter.hEvent)
         {
             CloseHandle(deviceContext->osWriter.hEvent);
+            deviceContext->osWriter.hEvent = NULL;
         }
         if (NULL != deviceContext->osReader.hEvent)
         {
             CloseHandle(deviceContext->osReader.hEvent);
+            deviceContext->osReader.hEvent = NULL;
         }
+        CloseHandle(hSerial);
         result = IOTHUB_CLIENT_ERROR;
         goto exit;
     }
+#endif
+
+    Lock(deviceContext->TxLock);
+#ifdef WIN32
+    deviceContext->hSerial = hSerial;
 #else 
     deviceContext->hSerial = fd;
 #endif
+    deviceContext->RxBufferIndex = 0;
+    deviceContext->RxEscaped = false;
+    deviceContext->Connected = true;
+    Unlock(deviceContext->TxLock);
 
 exit:
     return result;
 }
 
+// SerialPnp_ClosePort closes the port of a link. Writers see the link as disconnected from then on.
+static void SerialPnp_ClosePort(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    if (NULL == deviceContext->TxLock)
+    {
+        return;
+    }
+
+    Lock(deviceContext->TxLock);
+    deviceContext->Connected = false;
+#ifdef WIN32
+    if (NULL != deviceContext->hSerial)
+    {
+        CloseHandle(deviceContext->hSerial);
+    }
+    if (NULL != deviceContext->osWriter.hEvent)
+    {
+        CloseHandle(deviceContext->osWriter.hEvent);
+        deviceContext->osWriter.hEvent = NULL;
+    }
+    if (NULL != deviceContext->osReader.hEvent)
+    {
+        CloseHandle(deviceContext->osReader.hEvent);
+        deviceContext->osReader.hEvent = NULL;
+    }
+#else
+    if (0 < deviceContext->hSerial)
+    {
+        close(deviceContext->hSerial);
+    }
+#endif
+    deviceContext->hSerial = 0;
+    Unlock(deviceContext->TxLock);
+}
+
+// SerialPnp_ReopenDevice opens the port of a link again. A device matched by USB id is looked up
+// afresh, since it may come back on another tty.
+static IOTHUB_CLIENT_RESULT SerialPnp_ReopenDevice(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    if (NULL != deviceContext->UsbId.Vid)
+    {
+        char* devicePath = NULL;
+        if (IOTHUB_CLIENT_OK != SerialPnp_FindTtyByUsbId(&deviceContext->UsbId, &devicePath))
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+        if ((NULL == deviceContext->DevicePath) || (0 != strcmp(devicePath, deviceContext->DevicePath)))
+        {
+            LogInfo("Serial device %s is on %s", deviceContext->PortName, devicePath);
+        }
+        free(deviceContext->DevicePath);
+        deviceContext->DevicePath = devicePath;
+    }
+#ifndef WIN32
+    else if (0 != access(deviceContext->DevicePath, F_OK))
+    {
+        // Still unplugged
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+#endif
+
+    return SerialPnp_OpenDevice(deviceContext->DevicePath, deviceContext->BaudRate, deviceContext);
+}
+
+// SerialPnp_SignalReconnect wakes the reader of a disconnected link to try its port right away
+static void SerialPnp_SignalReconnect(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    Lock(deviceContext->ReconnectLock);
+    deviceContext->ReconnectSignaled = true;
+    Condition_Post(deviceContext->ReconnectCondition);
+    Unlock(deviceContext->ReconnectLock);
+}
+
+// SerialPnp_Reconnect reopens the port of a disconnected link and resynchronizes with the device.
+// Runs on the reader thread and returns once the device is back or the link is closing.
+static void SerialPnp_Reconnect(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    int fastRetries = 0;
+
+    LogInfo("Waiting for serial device %s", deviceContext->PortName);
+    SerialPnp_ClosePort(deviceContext);
+
+    Lock(deviceContext->ReconnectLock);
+    while (!deviceContext->Closing)
+    {
+        if (deviceContext->ReconnectSignaled)
+        {
+            deviceContext->ReconnectSignaled = false;
+            fastRetries = SERIALPNP_HOTPLUG_RETRY_COUNT;
+        }
+        Unlock(deviceContext->ReconnectLock);
+
+        bool reopened = (IOTHUB_CLIENT_OK == SerialPnp_ReopenDevice(deviceContext));
+
+        Lock(deviceContext->ReconnectLock);
+        if (reopened)
+        {
+            break;
+        }
+
+        // Without hotplug events (e.g. on Windows) the port is retried periodically
+        if (!deviceContext->ReconnectSignaled && !deviceContext->Closing)
+        {
+            (void)Condition_Wait(deviceContext->ReconnectCondition, deviceContext->ReconnectLock,
+                (fastRetries > 0) ? SERIALPNP_HOTPLUG_RETRY_MS : SERIALPNP_RECONNECT_RETRY_MS);
+            if (fastRetries > 0)
+            {
+                fastRetries--;
+            }
+        }
+    }
+    bool closing = deviceContext->Closing;
+    Unlock(deviceContext->ReconnectLock);
+
+    if (closing)
+    {
+        return;
+    }
+    LogInfo("Reopened serial device %s on %s", deviceContext->PortName, deviceContext->DevicePath);
+
+    if (deviceContext->DescriptorHashKnown)
+    {
+        // The device confirms the descriptor in use through the reader, as on a start from the
+        // cache, so components keep running without a full descriptor exchange
+        deviceContext->DescriptorFromCache = true;
+        if (IOTHUB_CLIENT_OK != SerialPnp_RequestDescriptorHash(deviceContext))
+        {
+            LogError("Unable to ask %s to confirm its descriptor", deviceContext->PortName);
+        }
+    }
+    else
+    {
+        SerialPnp_RefetchDescriptor(deviceContext, false, 0);
+    }
+}
+
 IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
     PSERIAL_DEVICE_CONTEXT serialDevice,
     byte** receivedPacket,
@@ -1049,12 +1764,12 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
     char packetType)
 {
     byte inb = 0;
-    DWORD dwRead = 0;
     *receivedPacket = NULL;
     *length = 0;
     int error = 0;
 
 #ifdef WIN32
+    DWORD dwRead = 0;
     while (true)
     {
         if (!ReadFile(serialDevice->hSerial, &inb, 1, &dwRead, &serialDevice->osReader)) // if completed asynchronously, wait. 
@@ -1063,6 +1778,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
             {
                 // Read returned actual error and not just pending
                 LogError("read failed: %d", error);
+                serialDevice->Connected = false;
                 return IOTHUB_CLIENT_ERROR;
             }
             else
@@ -1071,6 +1787,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
                 {
                     error = GetLastError();
                     LogError("read failed: %d", error);
+                    serialDevice->Connected = false;
                     return IOTHUB_CLIENT_ERROR;
                 }
             }
@@ -1080,25 +1797,79 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
         // Read can be successful but with no bytes actually read, shouldn't happen though
         if (dwRead == 0)
         {
+            if (serialDevice->Closing)
+            {
+                return IOTHUB_CLIENT_ERROR;
+            }
             continue;
         }
         //LogInfo("read completed successfully");
 #else
-    while ((dwRead = read(serialDevice->hSerial, (void*)&inb, 1)) != -1)
+    int idleTime = 0;
+    while (true)
     {
-#endif
-        // Check for a start of packet byte
-        if (SERIALPNP_START_OF_FRAME_BYTE == inb)
+        // Wait for data with a timeout, so that a stopping link and an unresponsive device
+        // are noticed instead of blocking in read()
+        struct pollfd pfd = { serialDevice->hSerial, POLLIN, 0 };
+        int ready = poll(&pfd, 1, SERIALPNP_RX_POLL_INTERVAL_MS);
+        if (ready < 0)
         {
-            serialDevice->RxBufferIndex = 0;
-            serialDevice->RxEscaped = false;
-            continue;
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            LogError("poll failed on %s: %s", serialDevice->PortName, strerror(errno));
+            serialDevice->Connected = false;
+            return IOTHUB_CLIENT_ERROR;
         }
 
-        // Check for an escape byte
-        if (SERIALPNP_ESCAPE_BYTE == inb)
+        if (0 == ready)
         {
-            serialDevice->RxEscaped = true;
+            if (serialDevice->Closing)
+            {
+                return IOTHUB_CLIENT_ERROR;
+            }
+            if (0x00 == packetType)
+            {
+                // Nothing arrived; the reader calls again
+                return IOTHUB_CLIENT_OK;
+            }
+            idleTime += SERIALPNP_RX_POLL_INTERVAL_MS;
+            if (idleTime >= SERIALPNP_RESPONSE_TIMEOUT_MS)
+            {
+                LogError("Timed out waiting for packet type %d on %s", packetType, serialDevice->PortName);
+                return IOTHUB_CLIENT_ERROR;
+            }
+            continue;
+        }
+
+        // The tty hangs up when a USB-serial device is unplugged, and reads fail from then on
+        ssize_t bytesRead = (0 != (pfd.revents & POLLIN)) ?
+            read(serialDevice->hSerial, (void*)&inb, 1) : 0;
+        if (bytesRead <= 0)
+        {
+            if ((bytesRead < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+            {
+                continue;
+            }
+            LogError("Serial device on %s was disconnected", serialDevice->PortName);
+            serialDevice->Connected = false;
+            return IOTHUB_CLIENT_ERROR;
+        }
+        idleTime = 0;
+#endif
+        // Check for a start of packet byte
+        if (SERIALPNP_START_OF_FRAME_BYTE == inb)
+        {
+            serialDevice->RxBufferIndex = 0;
+            serialDevice->RxEscaped = false;
+            continue;
+        }
+
+        // Check for an escape byte
+        if (SERIALPNP_ESCAPE_BYTE == inb)
+        {
+            serialDevice->RxEscaped = true;
             continue;
         }
 
@@ -1114,6 +1885,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
         if (serialDevice->RxBufferIndex >= MAX_BUFFER_SIZE)
         {
             LogError("Filled Rx buffer. Protocol is bad.");
+            serialDevice->RxBufferIndex = 0;
             return IOTHUB_CLIENT_ERROR;
         }
 
@@ -1142,9 +1914,10 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
                 {
                     // signal the main thread in this case, pass back the buffer 
                     // using the pointer in the serial context instead of the return value
+                    Lock(serialDevice->CommandResponseWaitLock);
+                    free(serialDevice->pbMainBuffer);
                     serialDevice->pbMainBuffer = *receivedPacket;
                     *receivedPacket = NULL;
-                    Lock(serialDevice->CommandResponseWaitLock);
                     Condition_Post(serialDevice->CommandResponseWaitCondition);
                     Unlock(serialDevice->CommandResponseWaitLock);
                 }
@@ -1156,17 +1929,22 @@ IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
 }
 
 IOTHUB_CLIENT_RESULT SerialPnp_ResetDevice(
-    PSERIAL_DEVICE_CONTEXT serialDevice)
+    PSERIAL_DEVICE_CONTEXT serialDevice,
+    uint32_t* descriptorHash,
+    bool* descriptorHashReported)
 {
+    *descriptorHashReported = false;
+
     IOTHUB_CLIENT_RESULT error = IOTHUB_CLIENT_OK;
     // Prepare packet
-    byte resetPacket[3] = { 0 }; // packet header
+    byte resetPacket[SERIALPNP_MIN_PACKET_LENGTH] = { 0 }; // packet header
     byte* responsePacket = NULL;
     resetPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = 4; // length 4
     resetPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = 0;
     resetPacket[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_RESET_REQUEST;
 
     // Send the new packet
+    uint64_t requestTime = SerialPnp_MonotonicMicroseconds();
     if (IOTHUB_CLIENT_OK != SerialPnp_TxPacket(serialDevice, resetPacket, 4))
     {
         LogError("Error sending request packet");
@@ -1187,6 +1965,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_ResetDevice(
     {
         LogError("received NULL for response packet");
         error = IOTHUB_CLIENT_ERROR;
+        goto exit;
     }
 
     if (SERIALPNP_PACKET_TYPE_RESET_RESPONSE != responsePacket[2])
@@ -1199,6 +1978,21 @@ IOTHUB_CLIENT_RESULT SerialPnp_ResetDevice(
     if (IOTHUB_CLIENT_OK == error)
     {
         LogInfo("Receieved reset response");
+
+        if (length >= SERIALPNP_DESCRIPTOR_HASH_PACKET_LENGTH)
+        {
+            *descriptorHash = SerialPnp_GetDescriptorHash(responsePacket);
+            *descriptorHashReported = true;
+        }
+
+        // The reset restarted the device clock, if it has one
+        serialDevice->DeviceHasClock = (length >= SERIALPNP_DEVICE_TIME_PACKET_LENGTH);
+        serialDevice->DeviceClock.Synchronized = false;
+        if (serialDevice->DeviceHasClock)
+        {
+            (void)SerialPnp_DeviceClock_AddSample(&serialDevice->DeviceClock, requestTime, SerialPnp_MonotonicMicroseconds(),
+                SerialPnp_GetDeviceTime(responsePacket + SERIALPNP_DEVICE_TIME_OFFSET));
+        }
     }
 
 exit:
@@ -1214,14 +2008,7 @@ IOTHUB_CLIENT_RESULT SerialPnp_DeviceDescriptorRequest(
     byte** desc,
     DWORD* length)
 {
-    // Prepare packet
-    byte txPacket[3] = { 0 }; // packet header
-    txPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = 4; // length 4
-    txPacket[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = 0;
-    txPacket[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_DESCRIPTOR_REQUEST;
-
-    // Send the new packets
-    if (IOTHUB_CLIENT_OK != SerialPnp_TxPacket(serialDevice, txPacket, 4))
+    if (IOTHUB_CLIENT_OK != SerialPnp_SendDescriptorRequest(serialDevice))
     {
         LogError("Error sending request packet");
         return IOTHUB_CLIENT_ERROR;
@@ -1254,40 +2041,298 @@ IOTHUB_CLIENT_RESULT SerialPnp_DeviceDescriptorRequest(
     return IOTHUB_CLIENT_OK;
 }
 
+// A telemetry message waiting for its delivery to be confirmed. It holds a reference to the latency
+// histograms of its link, which may be gone by the time the confirmation arrives.
+typedef struct _SERIAL_TELEMETRY_CONTEXT {
+    SERIALPNP_LATENCY_HANDLE Latency;
+    uint64_t Captured;
+    uint64_t Sent;
+    char Description[1];
+} SERIAL_TELEMETRY_CONTEXT;
+
 void SerialPnp_SendEventCallback(
     IOTHUB_CLIENT_CONFIRMATION_RESULT pnpSendEventStatus,
     void* userContextCallback)
 {
-    LogInfo("SerialDataSendEventCallback called, result=%d, telemetry=%s", pnpSendEventStatus, (char*) userContextCallback);
+    SERIAL_TELEMETRY_CONTEXT* telemetryContext = (SERIAL_TELEMETRY_CONTEXT*)userContextCallback;
+    LogInfo("SerialDataSendEventCallback called, result=%d, telemetry=%s", pnpSendEventStatus, telemetryContext->Description);
+
+    if (IOTHUB_CLIENT_CONFIRMATION_OK == pnpSendEventStatus)
+    {
+        uint64_t confirmed = SerialPnp_MonotonicMicroseconds();
+        SerialPnp_Latency_Record(telemetryContext->Latency, SerialPnpLatency_Confirm, confirmed - telemetryContext->Sent);
+        if (0 != telemetryContext->Captured)
+        {
+            SerialPnp_Latency_Record(telemetryContext->Latency, SerialPnpLatency_EndToEnd, confirmed - telemetryContext->Captured);
+        }
+    }
+
+    SerialPnp_Latency_Release(telemetryContext->Latency);
+    free(telemetryContext);
 }
 
-IOTHUB_CLIENT_RESULT SerialPnp_SendEventAsync(
-    PSERIAL_DEVICE_CONTEXT DeviceContext,
-    char* TelemetryName,
-    char* TelemetryData)
+// SerialPnp_SetCreationTime stamps a message with the time its data was captured, or an estimate of
+// it from when it was received if the device does not timestamp events
+static void SerialPnp_SetCreationTime(
+    IOTHUB_MESSAGE_HANDLE messageHandle,
+    const SERIALPNP_EVENT_TIMES* Times)
 {
-    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
-    IOTHUB_MESSAGE_HANDLE messageHandle = NULL;
+    uint64_t created = Times->Captured;
+    if (0 == created)
+    {
+        uint64_t age = (uint64_t)Times->DeviceAge * 1000;
+        created = (Times->Received > age) ? Times->Received - age : Times->Received;
+    }
 
+    char creationTime[SERIALPNP_UTC_TIME_LENGTH];
+    if (!SerialPnp_FormatUtcTime(created, creationTime, sizeof(creationTime)) ||
+        (IOTHUB_MESSAGE_OK != IoTHubMessage_SetProperty(messageHandle, SERIALPNP_CREATION_TIME_PROPERTY, creationTime)))
+    {
+        LogError("Serial Pnp Adapter: unable to set the creation time of a telemetry message");
+    }
+}
 
-    char telemetryMessageData[512] = { 0 };
-    sprintf(telemetryMessageData, "{\"%s\":%s}", TelemetryName, TelemetryData);
+IOTHUB_CLIENT_RESULT SerialPnp_SendTelemetryAsync(
+    PSERIAL_COMPONENT_CONTEXT ComponentContext,
+    const char* TelemetryJson,
+    const char* Description,
+    const SERIALPNP_EVENT_TIMES* Times)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    IOTHUB_MESSAGE_HANDLE messageHandle = NULL;
+    SERIALPNP_LATENCY_HANDLE latency = ComponentContext->Device->Latency;
+    SERIAL_TELEMETRY_CONTEXT* telemetryContext = NULL;
 
-    if ((messageHandle = PnP_CreateTelemetryMessageHandle(DeviceContext->ComponentName, telemetryMessageData)) == NULL)
+    if ((messageHandle = PnP_CreateTelemetryMessageHandle(ComponentContext->ComponentName, TelemetryJson)) == NULL)
     {
         LogError("Serial Pnp Adapter: PnP_CreateTelemetryMessageHandle failed.");
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
     }
-    else if ((result = PnpBridgeClient_SendEventAsync(DeviceContext->ClientHandle, messageHandle,
-            SerialPnp_SendEventCallback, (void*)TelemetryName)) != IOTHUB_CLIENT_OK)
+    SerialPnp_SetCreationTime(messageHandle, Times);
+
+    telemetryContext = malloc(sizeof(SERIAL_TELEMETRY_CONTEXT) + strlen(Description));
+    if (NULL == telemetryContext)
+    {
+        LogError("Error out of memory");
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+    strcpy(telemetryContext->Description, Description);
+    telemetryContext->Latency = latency;
+    telemetryContext->Captured = Times->Captured;
+    SerialPnp_Latency_AddRef(latency);
+
+    uint64_t enqueued = SerialPnp_MonotonicMicroseconds();
+    telemetryContext->Sent = enqueued;
+    if ((result = PnpBridgeClient_SendEventAsync(ComponentContext->ClientHandle, messageHandle,
+            SerialPnp_SendEventCallback, telemetryContext)) != IOTHUB_CLIENT_OK)
     {
         LogError("Serial Pnp Adapter: IoTHub client call to _SendEventAsync failed, error=%d", result);
+        SerialPnp_Latency_Release(latency);
+        free(telemetryContext);
+        goto exit;
+    }
+
+    uint64_t sent = SerialPnp_MonotonicMicroseconds();
+    if (0 != Times->Captured)
+    {
+        SerialPnp_Latency_Record(latency, SerialPnpLatency_Receive, Times->Received - Times->Captured);
+    }
+    SerialPnp_Latency_Record(latency, SerialPnpLatency_Decode, Times->Decoded - Times->Received);
+    SerialPnp_Latency_Record(latency, SerialPnpLatency_Enqueue, enqueued - Times->Decoded);
+    SerialPnp_Latency_Record(latency, SerialPnpLatency_Send, sent - enqueued);
+
+exit:
+    if (NULL != messageHandle)
+    {
+        IoTHubMessage_Destroy(messageHandle);
+    }
+
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_SendEventAsync(
+    PSERIAL_COMPONENT_CONTEXT ComponentContext,
+    char* TelemetryName,
+    char* TelemetryData,
+    const SERIALPNP_EVENT_TIMES* Times)
+{
+    // The value is already JSON: a string was quoted and escaped when it was decoded, at most six
+    // characters per byte received, so its length is final and the message is sized from it
+    size_t messageSize = strlen(TelemetryName) + strlen(TelemetryData) + sizeof("{\"\":}");
+    char* telemetryMessageData = malloc(messageSize);
+    if (NULL == telemetryMessageData)
+    {
+        LogError("Error out of memory");
+        return IOTHUB_CLIENT_ERROR;
+    }
+    (void)snprintf(telemetryMessageData, messageSize, "{\"%s\":%s}", TelemetryName, TelemetryData);
+
+    IOTHUB_CLIENT_RESULT result = SerialPnp_SendTelemetryAsync(ComponentContext, telemetryMessageData, TelemetryName, Times);
+    free(telemetryMessageData);
+    return result;
+}
+
+// SerialPnp_RecordReportedProperty notes a value that has been sent to the twin, so that the device
+// echoing the same value back later does not produce a redundant patch. Caller must hold PropertyReportLock.
+static void SerialPnp_RecordReportedProperty(
+    PSERIAL_COMPONENT_CONTEXT ComponentContext,
+    const char* PropertyName,
+    const JSON_Value* PropertyValue)
+{
+    JSON_Value* copy = json_value_deep_copy(PropertyValue);
+    if (NULL == copy ||
+        JSONSuccess != json_object_set_value(json_value_get_object(ComponentContext->ReportedProperties), PropertyName, copy))
+    {
+        LogError("Serial Pnp Adapter: Unable to cache reported value of property %s", PropertyName);
+        json_value_free(copy);
+    }
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_QueuePropertyReport(
+    PSERIAL_COMPONENT_CONTEXT ComponentContext,
+    const char* PropertyName,
+    const char* PropertyData)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    JSON_Value* value = json_parse_string(PropertyData);
+    if (NULL == value)
+    {
+        LogError("Serial Pnp Adapter: Property %s has a value that is not valid JSON: %s", PropertyName, PropertyData);
+        return IOTHUB_CLIENT_INVALID_ARG;
     }
 
-    IoTHubMessage_Destroy(messageHandle);
+    Lock(ComponentContext->PropertyReportLock);
+
+    JSON_Object* pending = json_value_get_object(ComponentContext->PendingProperties);
+    const JSON_Value* reported = json_object_get_value(json_value_get_object(ComponentContext->ReportedProperties), PropertyName);
+    if (NULL != reported && json_value_equals(reported, value))
+    {
+        // The twin already holds this value. Drop any change still pending for the property,
+        // since the device has settled back on what was last reported.
+        json_object_remove(pending, PropertyName);
+        json_value_free(value);
+    }
+    else if (JSONSuccess != json_object_set_value(pending, PropertyName, value))
+    {
+        LogError("Serial Pnp Adapter: Unable to queue report of property %s", PropertyName);
+        json_value_free(value);
+        result = IOTHUB_CLIENT_ERROR;
+    }
+    else
+    {
+        Condition_Post(ComponentContext->PropertyReportCondition);
+    }
 
+    Unlock(ComponentContext->PropertyReportLock);
     return result;
 }
 
+static void SerialPnp_ReportedStateCallback(
+    int reportedStateResult,
+    void* userContextCallback)
+{
+    AZURE_UNREFERENCED_PARAMETER(userContextCallback);
+    LogInfo("Serial Pnp Adapter: Reported property patch acknowledged, status=%d", reportedStateResult);
+}
+
+// SerialPnp_FlushPropertyReports sends every pending property change as one reported-property patch
+// for the component. Caller must hold PropertyReportLock.
+static void SerialPnp_FlushPropertyReports(
+    PSERIAL_COMPONENT_CONTEXT ComponentContext)
+{
+    IOTHUB_CLIENT_RESULT iothubClientResult;
+    JSON_Value* componentValue = ComponentContext->PendingProperties;
+    JSON_Object* componentObject = json_value_get_object(componentValue);
+    size_t propertyCount = json_object_get_count(componentObject);
+    JSON_Value* patchValue = NULL;
+    char* patch = NULL;
+
+    if (0 == propertyCount)
+    {
+        return;
+    }
+
+    if (NULL == (ComponentContext->PendingProperties = json_value_init_object()))
+    {
+        LogError("Serial Pnp Adapter: Unable to allocate pending property set");
+        ComponentContext->PendingProperties = componentValue;
+        return;
+    }
+
+    for (size_t i = 0; i < propertyCount; i++)
+    {
+        SerialPnp_RecordReportedProperty(ComponentContext, json_object_get_name(componentObject, i), json_object_get_value_at(componentObject, i));
+    }
+
+    if (NULL == (patchValue = json_value_init_object()) ||
+        JSONSuccess != json_object_set_string(componentObject, "__t", "c") ||
+        JSONSuccess != json_object_set_value(json_value_get_object(patchValue), ComponentContext->ComponentName, componentValue))
+    {
+        LogError("Serial Pnp Adapter: Unable to build reported property patch for component %s", ComponentContext->ComponentName);
+        json_value_free(componentValue);
+        goto exit;
+    }
+
+    // componentValue is now owned by patchValue
+    if (NULL == (patch = json_serialize_to_string(patchValue)))
+    {
+        LogError("Serial Pnp Adapter: Unable to serialize reported property patch for component %s", ComponentContext->ComponentName);
+        goto exit;
+    }
+
+    if ((iothubClientResult = PnpBridgeClient_SendReportedState(ComponentContext->ClientHandle, (const unsigned char*)patch, strlen(patch),
+        SerialPnp_ReportedStateCallback, NULL)) != IOTHUB_CLIENT_OK)
+    {
+        LogError("Serial Pnp Adapter: Unable to send reported state for component %s, error=%d",
+            ComponentContext->ComponentName, iothubClientResult);
+    }
+    else
+    {
+        LogInfo("Serial Pnp Adapter: Reported %d device property change(s) for component %s", (int)propertyCount, ComponentContext->ComponentName);
+    }
+
+exit:
+    if (NULL != patch)
+    {
+        json_free_serialized_string(patch);
+    }
+    if (NULL != patchValue)
+    {
+        json_value_free(patchValue);
+    }
+}
+
+int SerialPnp_PropertyReportWorker(
+    void* context)
+{
+    PSERIAL_COMPONENT_CONTEXT componentContext = (PSERIAL_COMPONENT_CONTEXT)context;
+
+    Lock(componentContext->PropertyReportLock);
+    while (componentContext->PropertyReportWorkerRunning)
+    {
+        if (0 == json_object_get_count(json_value_get_object(componentContext->PendingProperties)))
+        {
+            Condition_Wait(componentContext->PropertyReportCondition, componentContext->PropertyReportLock, 0);
+            continue;
+        }
+
+        // Give the device a short window to send related changes so they land in the same patch
+        Unlock(componentContext->PropertyReportLock);
+        ThreadAPI_Sleep(SERIALPNP_PROPERTY_COALESCE_WINDOW_MS);
+        Lock(componentContext->PropertyReportLock);
+
+        SerialPnp_FlushPropertyReports(componentContext);
+    }
+
+    // Don't drop changes that arrived just before the component was stopped
+    SerialPnp_FlushPropertyReports(componentContext);
+    Unlock(componentContext->PropertyReportLock);
+
+    return IOTHUB_CLIENT_OK;
+}
+
 int SerialPnp_GetListCount(
     SINGLYLINKEDLIST_HANDLE list)
 {
@@ -1315,7 +2360,7 @@ static void SerialPnp_PropertyUpdateHandler(
 {
     AZURE_UNREFERENCED_PARAMETER(version);
     IOTHUB_CLIENT_RESULT iothubClientResult;
-    PSERIAL_DEVICE_CONTEXT deviceContext = PnpComponentHandleGetContext(PnpComponentHandle);
+    PSERIAL_COMPONENT_CONTEXT componentContext = PnpComponentHandleGetContext(PnpComponentHandle);
 
     STRING_HANDLE jsonToSend = NULL;
     const char * PropertyValueString = json_value_get_string(PropertyValue);
@@ -1323,21 +2368,27 @@ static void SerialPnp_PropertyUpdateHandler(
 
     int propertyCount = 0;
 
-    if (NULL != deviceContext)
+    if (NULL != componentContext)
     {
-        LIST_ITEM_HANDLE interfaceDefHandle = singlylinkedlist_get_head_item(deviceContext->InterfaceDefinitions);
-        const InterfaceDefinition* interfaceDef = singlylinkedlist_item_get_value(interfaceDefHandle);
+        const InterfaceDefinition* interfaceDef = SerialPnp_AcquireComponentInterface(componentContext);
+        if (NULL == interfaceDef)
+        {
+            SerialPnp_ReleaseComponentInterface(componentContext);
+            LogError("Serial Pnp Adapter: Component %s is not bound to an interface on the device", componentContext->ComponentName);
+            return;
+        }
 
         propertyCount = SerialPnp_GetListCount(interfaceDef->Properties);
+        SerialPnp_ReleaseComponentInterface(componentContext);
 
         if ((PropertyName != NULL) && (PropertyValueString != NULL) && (propertyCount > 0))
         {
 
             LogInfo("Serial Pnp Adapter: Processed property. PropertyUpdated = %.*s", (int)PropertyValueLen, PropertyValueString);
 
-            SerialPnp_PropertyHandler(deviceContext, PropertyName, (char*) PropertyValueString);
+            SerialPnp_PropertyHandler(componentContext, PropertyName, (char*) PropertyValueString);
 
-            if ((jsonToSend = PnP_CreateReportedProperty(deviceContext->ComponentName, PropertyName, PropertyValueString)) == NULL)
+            if ((jsonToSend = PnP_CreateReportedProperty(componentContext->ComponentName, PropertyName, PropertyValueString)) == NULL)
             {
                 LogError("Serial Pnp Adapter: Unable to build reported property response for propertyName=%s, propertyValue=%s",
                     PropertyName, PropertyValueString);
@@ -1357,6 +2408,15 @@ static void SerialPnp_PropertyUpdateHandler(
                 {
                     LogInfo("Serial Pnp Adapter: Sending device information property to IoTHub. propertyName=%s, propertyValue=%s",
                         PropertyName, PropertyValueString);
+
+                    JSON_Value* reportedValue = json_parse_string(PropertyValueString);
+                    if (NULL != reportedValue)
+                    {
+                        Lock(componentContext->PropertyReportLock);
+                        SerialPnp_RecordReportedProperty(componentContext, PropertyName, reportedValue);
+                        Unlock(componentContext->PropertyReportLock);
+                        json_value_free(reportedValue);
+                    }
                 }
 
                 STRING_delete(jsonToSend);
@@ -1400,44 +2460,113 @@ SerialPnp_CommandUpdateHandler(
     unsigned char** CommandResponse,
     size_t* CommandResponseSize)
 {
-    PSERIAL_DEVICE_CONTEXT deviceContext = PnpComponentHandleGetContext(PnpComponentHandle);
-    LIST_ITEM_HANDLE interfaceDefHandle = singlylinkedlist_get_head_item(deviceContext->InterfaceDefinitions);
-    const InterfaceDefinition* interfaceDef = singlylinkedlist_item_get_value(interfaceDefHandle);
+    PSERIAL_COMPONENT_CONTEXT componentContext = PnpComponentHandleGetContext(PnpComponentHandle);
+    const InterfaceDefinition* interfaceDef = SerialPnp_AcquireComponentInterface(componentContext);
+    if (NULL == interfaceDef)
+    {
+        SerialPnp_ReleaseComponentInterface(componentContext);
+        LogError("Serial Pnp Adapter: Component %s is not bound to an interface on the device", componentContext->ComponentName);
+        return PNP_STATUS_NOT_FOUND;
+    }
     int commandCount = SerialPnp_GetListCount(interfaceDef->Commands);
+    SerialPnp_ReleaseComponentInterface(componentContext);
 
     char* response = NULL;
     char* requestData = (char*) json_value_get_string(CommandValue);
     if ((commandCount > 0) && (requestData != NULL))
     {
-        SerialPnp_CommandHandler(deviceContext, CommandName, (char*)requestData, &response);
-        return SerialPnp_SetCommandResponse(CommandResponse, CommandResponseSize, response);
+        SerialPnp_CommandHandler(componentContext, CommandName, (char*)requestData, &response);
+        int result = SerialPnp_SetCommandResponse(CommandResponse, CommandResponseSize, response);
+        free(response);
+        return result;
     }
     return PNP_STATUS_NOT_FOUND;
 }
 
+static void SerialPnp_StopPropertyReportWorker(
+    PSERIAL_COMPONENT_CONTEXT componentContext)
+{
+    if (NULL != componentContext->PropertyReportWorkerHandle)
+    {
+        Lock(componentContext->PropertyReportLock);
+        componentContext->PropertyReportWorkerRunning = false;
+        Condition_Post(componentContext->PropertyReportCondition);
+        Unlock(componentContext->PropertyReportLock);
+        ThreadAPI_Join(componentContext->PropertyReportWorkerHandle, NULL);
+        componentContext->PropertyReportWorkerHandle = NULL;
+    }
+}
+
 IOTHUB_CLIENT_RESULT
 SerialPnp_StartPnpComponent(
     PNPBRIDGE_ADAPTER_HANDLE AdapterHandle,
     PNPBRIDGE_COMPONENT_HANDLE PnpComponentHandle)
 {
     AZURE_UNREFERENCED_PARAMETER(AdapterHandle);
-    PSERIAL_DEVICE_CONTEXT deviceContext = PnpComponentHandleGetContext(PnpComponentHandle);
-    if (NULL == deviceContext)
+    PSERIAL_COMPONENT_CONTEXT componentContext = PnpComponentHandleGetContext(PnpComponentHandle);
+    if (NULL == componentContext)
     {
-        LogError("Device context is null, unable to start component");
+        LogError("Component context is null, unable to start component");
         return IOTHUB_CLIENT_ERROR;
     }
+    PSERIAL_DEVICE_CONTEXT deviceContext = componentContext->Device;
 
     // Assign client handle
-    deviceContext->ClientHandle = PnpComponentHandleGetClientHandle(PnpComponentHandle);
-
-    PnpComponentHandleSetContext(PnpComponentHandle, deviceContext);
+    componentContext->ClientHandle = PnpComponentHandleGetClientHandle(PnpComponentHandle);
 
-    // Start telemetry thread
-    if (ThreadAPI_Create(&deviceContext->TelemetryWorkerHandle, SerialPnp_UartReceiver, deviceContext) != THREADAPI_OK) {
+    // Start property report thread
+    componentContext->PropertyReportWorkerRunning = true;
+    if (ThreadAPI_Create(&componentContext->PropertyReportWorkerHandle, SerialPnp_PropertyReportWorker, componentContext) != THREADAPI_OK) {
         LogError("ThreadAPI_Create failed");
+        componentContext->PropertyReportWorkerRunning = false;
+        componentContext->PropertyReportWorkerHandle = NULL;
         return IOTHUB_CLIENT_ERROR;
     }
+
+    // The first component started on a link starts the reader thread shared by all of them,
+    // once the descriptor exchange has finished with the port
+    Lock(deviceContext->StartLock);
+    if (0 == deviceContext->StartedComponentCount)
+    {
+        if (NULL != deviceContext->SerialDeviceWorker)
+        {
+            ThreadAPI_Join(deviceContext->SerialDeviceWorker, NULL);
+            deviceContext->SerialDeviceWorker = NULL;
+        }
+
+        // A link restarted after a stop, or created while its device was unplugged, is opened by
+        // the reader
+        deviceContext->Closing = false;
+
+        // Start telemetry thread
+        if (ThreadAPI_Create(&deviceContext->TelemetryWorkerHandle, SerialPnp_UartReceiver, deviceContext) != THREADAPI_OK) {
+            LogError("ThreadAPI_Create failed");
+            deviceContext->TelemetryWorkerHandle = NULL;
+            Unlock(deviceContext->StartLock);
+            SerialPnp_StopPropertyReportWorker(componentContext);
+            return IOTHUB_CLIENT_ERROR;
+        }
+
+        // The reader checks the answer against the cached descriptor in the background, and samples
+        // the device clock now that responses are read as soon as they arrive
+        if (deviceContext->Connected && (deviceContext->DescriptorFromCache || deviceContext->DeviceHasClock) &&
+            (IOTHUB_CLIENT_OK != SerialPnp_RequestDescriptorHash(deviceContext)))
+        {
+            LogError("Unable to ask %s to confirm its descriptor", deviceContext->PortName);
+        }
+    }
+    deviceContext->StartedComponentCount++;
+    Unlock(deviceContext->StartLock);
+
+    Lock(deviceContext->ComponentTableLock);
+    if (NULL == SerialPnp_GetInterface(deviceContext, componentContext->InterfaceIndex))
+    {
+        LogError("Component %s is bound to interface %d, which %s does not describe",
+            componentContext->ComponentName, componentContext->InterfaceIndex, deviceContext->PortName);
+    }
+    componentContext->Started = true;
+    Unlock(deviceContext->ComponentTableLock);
+
     return IOTHUB_CLIENT_OK;
 }
 
@@ -1481,6 +2610,7 @@ void SerialPnp_FreeEventDefinition(
         free(e);
         eventItem = singlylinkedlist_get_next_item(eventItem);
     }
+    singlylinkedlist_destroy(events);
 }
 
 void SerialPnp_FreeCommandDefinition(
@@ -1499,6 +2629,7 @@ void SerialPnp_FreeCommandDefinition(
         free(c);
         cmdItem = singlylinkedlist_get_next_item(cmdItem);
     }
+    singlylinkedlist_destroy(cmds);
 }
 
 void SerialPnp_FreePropertiesDefinition(
@@ -1521,78 +2652,406 @@ void SerialPnp_FreePropertiesDefinition(
         free(p);
         propItem = singlylinkedlist_get_next_item(propItem);
     }
+    singlylinkedlist_destroy(props);
+}
+
+static void SerialPnp_FreeInterfaceDefinitions(
+    SINGLYLINKEDLIST_HANDLE interfaceDefinitions)
+{
+    if (NULL == interfaceDefinitions)
+    {
+        return;
+    }
+
+    LIST_ITEM_HANDLE interfaceItem = singlylinkedlist_get_head_item(interfaceDefinitions);
+    while (NULL != interfaceItem)
+    {
+        InterfaceDefinition* def = (InterfaceDefinition*)singlylinkedlist_item_get_value(interfaceItem);
+        if (NULL != def->Id)
+        {
+            free(def->Id);
+        }
+        SerialPnp_FreeEventDefinition(def->Events);
+        SerialPnp_FreeCommandDefinition(def->Commands);
+        SerialPnp_FreePropertiesDefinition(def->Properties);
+        if (NULL != def->EventsByIndex)
+        {
+            free((void*)def->EventsByIndex);
+        }
+
+        free(def);
+        interfaceItem = singlylinkedlist_get_next_item(interfaceItem);
+    }
+    singlylinkedlist_destroy(interfaceDefinitions);
+}
+
+static void SerialPnp_CloseDevice(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    // Stop the reader, including one waiting for its device to come back
+    if (NULL != deviceContext->ReconnectLock)
+    {
+        Lock(deviceContext->ReconnectLock);
+        deviceContext->Closing = true;
+        Condition_Post(deviceContext->ReconnectCondition);
+        Unlock(deviceContext->ReconnectLock);
+    }
+
+#ifdef WIN32
+    // Closing the handle ends a pending read
+    SerialPnp_ClosePort(deviceContext);
+#endif
+
+    if (NULL != deviceContext->SerialDeviceWorker)
+    {
+        ThreadAPI_Join(deviceContext->SerialDeviceWorker, NULL);
+        deviceContext->SerialDeviceWorker = NULL;
+    }
+    if (NULL != deviceContext->TelemetryWorkerHandle)
+    {
+        ThreadAPI_Join(deviceContext->TelemetryWorkerHandle, NULL);
+        deviceContext->TelemetryWorkerHandle = NULL;
+    }
+
+#ifndef WIN32
+    // The reader notices Closing within one poll interval, after which nothing uses the port
+    SerialPnp_ClosePort(deviceContext);
+#endif
 }
 
 IOTHUB_CLIENT_RESULT SerialPnp_StopPnpComponent(
     PNPBRIDGE_COMPONENT_HANDLE PnpComponentHandle)
 {
-    PSERIAL_DEVICE_CONTEXT deviceContext = PnpComponentHandleGetContext(PnpComponentHandle);
+    PSERIAL_COMPONENT_CONTEXT componentContext = PnpComponentHandleGetContext(PnpComponentHandle);
 
-    if (NULL == deviceContext)
+    if ((NULL == componentContext) || !componentContext->Started)
     {
         return IOTHUB_CLIENT_OK;
     }
+    PSERIAL_DEVICE_CONTEXT deviceContext = componentContext->Device;
 
-#ifdef WIN32
-    if (NULL != deviceContext->hSerial)
+    // Stop routing packets for this interface before tearing the component down
+    Lock(deviceContext->ComponentTableLock);
+    componentContext->Started = false;
+    Unlock(deviceContext->ComponentTableLock);
+
+    SerialPnp_StopPropertyReportWorker(componentContext);
+
+    // The last component stopped on a link closes the port and its reader
+    Lock(deviceContext->StartLock);
+    if (0 == --deviceContext->StartedComponentCount)
     {
-        CloseHandle(deviceContext->hSerial);
+        SerialPnp_CloseDevice(deviceContext);
     }
-    if (NULL != deviceContext->osWriter.hEvent)
+    Unlock(deviceContext->StartLock);
+
+    return IOTHUB_CLIENT_OK;
+}
+
+static void SerialPnp_DestroyDevice(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    SerialPnp_CloseDevice(deviceContext);
+
+    if (NULL != deviceContext->TxQueue)
     {
-        CloseHandle(deviceContext->osWriter.hEvent);
+        SERIALPNP_TX_STATISTICS statistics;
+        SerialPnp_TxQueue_GetStatistics(deviceContext->TxQueue, &statistics);
+        uint64_t frames = statistics.Frames + statistics.FailedFrames;
+        if (0 != frames)
+        {
+            LogInfo("Serial device on %s: sent %llu frames, %llu bytes in %llu write calls (%.2f per frame), %llu frames failed",
+                deviceContext->PortName, (unsigned long long)statistics.Frames, (unsigned long long)statistics.Bytes,
+                (unsigned long long)statistics.WriteCalls, (double)statistics.WriteCalls / (double)frames,
+                (unsigned long long)statistics.FailedFrames);
+        }
+        SerialPnp_TxQueue_Destroy(deviceContext->TxQueue);
     }
-    if (NULL != deviceContext->osReader.hEvent)
+
+    // Messages still in flight keep the histograms alive until they are confirmed
+    if (NULL != deviceContext->Latency)
     {
-        CloseHandle(deviceContext->osReader.hEvent);
+        SerialPnp_Latency_Log(deviceContext->Latency, deviceContext->PortName);
+        SerialPnp_Latency_Release(deviceContext->Latency);
     }
-#else
-    if (0 < deviceContext->hSerial)
+
+    SerialPnp_FreeInterfaceDefinitions(deviceContext->InterfaceDefinitions);
+    if (NULL != deviceContext->RetiredInterfaceDefinitions)
     {
-        close(deviceContext->hSerial);
+        LIST_ITEM_HANDLE retiredItem = singlylinkedlist_get_head_item(deviceContext->RetiredInterfaceDefinitions);
+        while (NULL != retiredItem)
+        {
+            SerialPnp_FreeInterfaceDefinitions((SINGLYLINKEDLIST_HANDLE)singlylinkedlist_item_get_value(retiredItem));
+            retiredItem = singlylinkedlist_get_next_item(retiredItem);
+        }
+        singlylinkedlist_destroy(deviceContext->RetiredInterfaceDefinitions);
     }
-#endif
-    ThreadAPI_Join(deviceContext->TelemetryWorkerHandle, NULL);
-    return IOTHUB_CLIENT_OK;
+
+    if (NULL != deviceContext->CommandLock)
+    {
+        Lock_Deinit(deviceContext->CommandLock);
+    }
+    free(deviceContext->pbMainBuffer);
+    if (NULL != deviceContext->CommandResponseWaitLock)
+    {
+        Lock_Deinit(deviceContext->CommandResponseWaitLock);
+    }
+    if (NULL != deviceContext->CommandResponseWaitCondition)
+    {
+        Condition_Deinit(deviceContext->CommandResponseWaitCondition);
+    }
+    if (NULL != deviceContext->TxLock)
+    {
+        Lock_Deinit(deviceContext->TxLock);
+    }
+    if (NULL != deviceContext->ComponentTableLock)
+    {
+        Lock_Deinit(deviceContext->ComponentTableLock);
+    }
+    if (NULL != deviceContext->StartLock)
+    {
+        Lock_Deinit(deviceContext->StartLock);
+    }
+    if (NULL != deviceContext->ReconnectLock)
+    {
+        Lock_Deinit(deviceContext->ReconnectLock);
+    }
+    if (NULL != deviceContext->ReconnectCondition)
+    {
+        Condition_Deinit(deviceContext->ReconnectCondition);
+    }
+    if (NULL != deviceContext->PortName)
+    {
+        free(deviceContext->PortName);
+    }
+    free(deviceContext->DevicePath);
+    free(deviceContext->UsbId.Vid);
+    free(deviceContext->UsbId.Pid);
+    free(deviceContext->UsbId.Serial);
+
+    free(deviceContext);
+}
+
+static bool SerialPnp_DeviceMatchesPort(
+    LIST_ITEM_HANDLE list_item,
+    const void* match_context)
+{
+    const SERIAL_DEVICE_CONTEXT* deviceContext = singlylinkedlist_item_get_value(list_item);
+    return (0 == strcmp(deviceContext->PortName, (const char*)match_context));
+}
+
+// SerialPnp_ReleaseDevice drops a component's reference to its link, destroying the link with the last one
+static void SerialPnp_ReleaseDevice(
+    PSERIAL_DEVICE_CONTEXT deviceContext)
+{
+    PSERIAL_ADAPTER_CONTEXT adapterContext = deviceContext->Adapter;
+
+    Lock(adapterContext->SerialDevicesLock);
+    if (0 < --deviceContext->ReferenceCount)
+    {
+        Unlock(adapterContext->SerialDevicesLock);
+        return;
+    }
+
+    // Once off the list the hotplug monitor no longer signals the link
+    LIST_ITEM_HANDLE item = singlylinkedlist_find(adapterContext->SerialDevices, SerialPnp_DeviceMatchesPort, deviceContext->PortName);
+    if (NULL != item)
+    {
+        singlylinkedlist_remove(adapterContext->SerialDevices, item);
+    }
+    Unlock(adapterContext->SerialDevicesLock);
+
+    SerialPnp_DestroyDevice(deviceContext);
+}
+
+static void SerialPnp_DestroyComponentContext(
+    PSERIAL_COMPONENT_CONTEXT componentContext)
+{
+    PSERIAL_DEVICE_CONTEXT deviceContext = componentContext->Device;
+    if (NULL != deviceContext)
+    {
+        Lock(deviceContext->ComponentTableLock);
+        if (deviceContext->Components[componentContext->InterfaceIndex] == componentContext)
+        {
+            deviceContext->Components[componentContext->InterfaceIndex] = NULL;
+        }
+        Unlock(deviceContext->ComponentTableLock);
+
+        SerialPnp_ReleaseDevice(deviceContext);
+    }
+
+    if (NULL != componentContext->ComponentName)
+    {
+        free(componentContext->ComponentName);
+    }
+    if (NULL != componentContext->PropertyReportLock)
+    {
+        Lock_Deinit(componentContext->PropertyReportLock);
+    }
+    if (NULL != componentContext->PropertyReportCondition)
+    {
+        Condition_Deinit(componentContext->PropertyReportCondition);
+    }
+    if (NULL != componentContext->PendingProperties)
+    {
+        json_value_free(componentContext->PendingProperties);
+    }
+    if (NULL != componentContext->ReportedProperties)
+    {
+        json_value_free(componentContext->ReportedProperties);
+    }
+
+    free(componentContext);
 }
 
 IOTHUB_CLIENT_RESULT SerialPnp_DestroyPnpComponent(
     PNPBRIDGE_COMPONENT_HANDLE PnpComponentHandle)
 {
-    PSERIAL_DEVICE_CONTEXT deviceContext = PnpComponentHandleGetContext(PnpComponentHandle);
+    PSERIAL_COMPONENT_CONTEXT componentContext = PnpComponentHandleGetContext(PnpComponentHandle);
 
-    if (NULL == deviceContext) {
+    if (NULL == componentContext) {
         return IOTHUB_CLIENT_OK;
     }
 
-    if (deviceContext->InterfaceDefinitions)
+    SerialPnp_DestroyComponentContext(componentContext);
+
+    return IOTHUB_CLIENT_OK;
+}
+
+// SerialPnp_CreateDevice opens a serial link and starts the descriptor exchange with the device on it.
+// port names the link; a device matched by usbId is opened on whichever tty it currently has.
+static IOTHUB_CLIENT_RESULT SerialPnp_CreateDevice(
+    PSERIAL_ADAPTER_CONTEXT adapterContext,
+    const char* port,
+    const SERIAL_USB_ID* usbId,
+    DWORD baudRate,
+    PSERIAL_DEVICE_CONTEXT* device)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    IOTHUB_CLIENT_RESULT openResult = IOTHUB_CLIENT_OK;
+
+    // Setup serial pnp device context
+    LogInfo("Opening com port %s", port);
+
+    PSERIAL_DEVICE_CONTEXT deviceContext = calloc(1, sizeof(SERIAL_DEVICE_CONTEXT));
+    if (NULL == deviceContext)
+    {
+        LogError("Error out of memory");
+        return IOTHUB_CLIENT_ERROR;
+    }
+    deviceContext->RxBufferIndex = 0;
+    deviceContext->RxEscaped = false;
+    deviceContext->Adapter = adapterContext;
+    deviceContext->BaudRate = baudRate;
+
+    if ((0 != mallocAndStrcpy_s(&deviceContext->PortName, port)) ||
+        ((NULL != usbId->Vid) && (0 != mallocAndStrcpy_s(&deviceContext->UsbId.Vid, usbId->Vid))) ||
+        ((NULL != usbId->Pid) && (0 != mallocAndStrcpy_s(&deviceContext->UsbId.Pid, usbId->Pid))) ||
+        ((NULL != usbId->Serial) && (0 != mallocAndStrcpy_s(&deviceContext->UsbId.Serial, usbId->Serial))) ||
+        ((NULL == usbId->Vid) && (0 != mallocAndStrcpy_s(&deviceContext->DevicePath, port))))
+    {
+        LogError("Error out of memory");
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    deviceContext->CommandLock = Lock_Init();
+    deviceContext->CommandResponseWaitLock = Lock_Init();
+    deviceContext->CommandResponseWaitCondition = Condition_Init();
+    deviceContext->TxLock = Lock_Init();
+    deviceContext->ComponentTableLock = Lock_Init();
+    deviceContext->StartLock = Lock_Init();
+    deviceContext->ReconnectLock = Lock_Init();
+    deviceContext->ReconnectCondition = Condition_Init();
+    deviceContext->RetiredInterfaceDefinitions = singlylinkedlist_create();
+    if (NULL == deviceContext->CommandLock ||
+        NULL == deviceContext->CommandResponseWaitLock ||
+        NULL == deviceContext->CommandResponseWaitCondition ||
+        NULL == deviceContext->TxLock ||
+        NULL == deviceContext->ComponentTableLock ||
+        NULL == deviceContext->StartLock ||
+        NULL == deviceContext->ReconnectLock ||
+        NULL == deviceContext->ReconnectCondition ||
+        NULL == deviceContext->RetiredInterfaceDefinitions)
+    {
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    // Writes from every component on the link go through one queue and its writer thread
+    if (NULL == (deviceContext->TxQueue = SerialPnp_TxQueue_Create(SerialPnp_WritePort, deviceContext)))
     {
-        LIST_ITEM_HANDLE interfaceItem = singlylinkedlist_get_head_item(deviceContext->InterfaceDefinitions);
-        while (NULL != interfaceItem)
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    if (NULL == (deviceContext->Latency = SerialPnp_Latency_Create()))
+    {
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    // Open device and store handle in device context
+    openResult = SerialPnp_ReopenDevice(deviceContext);
+
+    // A descriptor cached by an earlier run lets the components start right away; the device is
+    // asked to confirm it once the reader is running. With a cached descriptor the link is also
+    // created while the device is unplugged, and the reader opens it when the device appears.
+    if (NULL != adapterContext->DescriptorCachePath)
+    {
+        byte* desc = NULL;
+        DWORD length = 0;
+        uint32_t hash = 0;
+        if ((IOTHUB_CLIENT_OK == SerialPnp_LoadCachedDescriptor(adapterContext->DescriptorCachePath, port, &desc, &length, &hash)) &&
+            (IOTHUB_CLIENT_OK == SerialPnp_InstallDescriptor(deviceContext, desc, length)))
         {
-            InterfaceDefinition* def = (InterfaceDefinition*)singlylinkedlist_item_get_value(interfaceItem);
-            if (NULL != def->Id)
-            {
-                free(def->Id);
-            }
-            SerialPnp_FreeEventDefinition(def->Events);
-            SerialPnp_FreeCommandDefinition(def->Commands);
-            SerialPnp_FreePropertiesDefinition(def->Properties);
+            LogInfo("Using cached descriptor %08x for %s", hash, port);
+            deviceContext->DescriptorHash = hash;
+            deviceContext->DescriptorHashKnown = true;
+            deviceContext->DescriptorFromCache = true;
+        }
+        free(desc);
+    }
 
-            free(def);
-            interfaceItem = singlylinkedlist_get_next_item(interfaceItem);
+    if (IOTHUB_CLIENT_OK != openResult)
+    {
+        if (!deviceContext->DescriptorFromCache)
+        {
+            LogError("Unable to open serial device %s", port);
+            result = openResult;
+            goto exit;
         }
-        singlylinkedlist_destroy(deviceContext->InterfaceDefinitions);
+        LogInfo("Serial device %s is not connected, waiting for it", port);
     }
 
-    if(deviceContext->ComponentName)
+    // Retrieve device descriptor and populate supported interface configurations
+    if (deviceContext->DescriptorFromCache)
     {
-        free(deviceContext->ComponentName);
+        deviceContext->SerialDeviceWorker = NULL;
+    }
+    else if (THREADAPI_OK != ThreadAPI_Create(&deviceContext->SerialDeviceWorker, SerialPnp_ParseInterfaceConfig, deviceContext))
+    {
+        LogError("ThreadAPI_Create failed");
+        deviceContext->SerialDeviceWorker = NULL;
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
     }
 
-    free(deviceContext);
+    if (NULL == singlylinkedlist_add(adapterContext->SerialDevices, deviceContext))
+    {
+        LogError("Unable to track serial device on %s", port);
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
 
-    return IOTHUB_CLIENT_OK;
+    *device = deviceContext;
+
+exit:
+    if (result != IOTHUB_CLIENT_OK)
+    {
+        SerialPnp_DestroyDevice(deviceContext);
+    }
+    return result;
 }
 
 IOTHUB_CLIENT_RESULT
@@ -1602,8 +3061,10 @@ SerialPnp_CreatePnpComponent(
     const JSON_Object* AdapterComponentConfig,
     PNPBRIDGE_COMPONENT_HANDLE BridgeComponentHandle)
 {
-    AZURE_UNREFERENCED_PARAMETER(AdapterHandle);
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    PSERIAL_ADAPTER_CONTEXT adapterContext = PnpAdapterHandleGetContext(AdapterHandle);
+    PSERIAL_COMPONENT_CONTEXT componentContext = NULL;
+    PSERIAL_DEVICE_CONTEXT deviceContext = NULL;
 
     if (strlen(ComponentName) > PNP_MAXIMUM_COMPONENT_LENGTH)
     {
@@ -1617,7 +3078,11 @@ SerialPnp_CreatePnpComponent(
     const char* port = NULL;
     const char* useComDevInterfaceStr;
     const char* baudRateParam;
+    const char* interfaceIndexParam;
     bool useComDeviceInterface = false;
+    int interfaceIndex = 0;
+    SERIAL_USB_ID usbId = { 0 };
+    char usbPort[SERIALPNP_USB_PORT_NAME_LENGTH];
 
     useComDevInterfaceStr = json_object_dotget_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_SERIALPNP_USEDEFAULT);
     if ((NULL != useComDevInterfaceStr) && (0 == strcmp(useComDevInterfaceStr, "true")))
@@ -1625,7 +3090,26 @@ SerialPnp_CreatePnpComponent(
         useComDeviceInterface = true;
     }
 
-    if (!useComDeviceInterface)
+    // A USB-serial device can be matched by its USB ids instead of a port, which follows the
+    // device when it is plugged back in on another tty
+    usbId.Vid = (char*)json_object_dotget_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_SERIALPNP_USB_VID);
+    usbId.Pid = (char*)json_object_dotget_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_SERIALPNP_USB_PID);
+    usbId.Serial = (char*)json_object_dotget_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_SERIALPNP_USB_SERIAL);
+    if ((NULL == usbId.Vid) != (NULL == usbId.Pid))
+    {
+        LogError("Both %s and %s are needed to match a USB serial device", PNP_CONFIG_ADAPTER_SERIALPNP_USB_VID, PNP_CONFIG_ADAPTER_SERIALPNP_USB_PID);
+        result = IOTHUB_CLIENT_INVALID_ARG;
+        goto exit;
+    }
+
+    if (NULL != usbId.Vid)
+    {
+        // The USB id names the link, for sharing it between components and for the descriptor cache
+        (void)snprintf(usbPort, sizeof(usbPort), "usb-%s-%s%s%s", usbId.Vid, usbId.Pid,
+            (NULL != usbId.Serial) ? "-" : "", (NULL != usbId.Serial) ? usbId.Serial : "");
+        port = usbPort;
+    }
+    else if (!useComDeviceInterface)
     {
         port = json_object_dotget_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_SERIALPNP_COMPORT);
         if (NULL == port)
@@ -1644,9 +3128,22 @@ SerialPnp_CreatePnpComponent(
         goto exit;
     }
 
+    // Interface of the device descriptor exposed by this component; defaults to the first one
+    interfaceIndexParam = json_object_dotget_string(AdapterComponentConfig, PNP_CONFIG_ADAPTER_SERIALPNP_INTERFACE_INDEX);
+    if (NULL != interfaceIndexParam)
+    {
+        interfaceIndex = atoi(interfaceIndexParam);
+        if ((interfaceIndex < 0) || (interfaceIndex >= SERIALPNP_MAX_INTERFACE_COUNT))
+        {
+            LogError("Interface index %s is out of range", interfaceIndexParam);
+            result = IOTHUB_CLIENT_INVALID_ARG;
+            goto exit;
+        }
+    }
+
     PSERIAL_DEVICE seriaDevice = NULL;
     DWORD baudRate = atoi(baudRateParam);
-    if (useComDeviceInterface)
+    if (useComDeviceInterface && (NULL == usbId.Vid))
     {
 #ifdef WIN32
         if (SerialPnp_FindSerialDevices() != IOTHUB_CLIENT_OK)
@@ -1666,92 +3163,193 @@ SerialPnp_CreatePnpComponent(
         }
 
         seriaDevice = (PSERIAL_DEVICE)singlylinkedlist_item_get_value(item);
+        port = seriaDevice->InterfaceName;
     }
 
-    // Setup serial pnp device context
-    LogInfo("Opening com port %s", useComDeviceInterface ? seriaDevice->InterfaceName : port);
-
-    PSERIAL_DEVICE_CONTEXT deviceContext = malloc(sizeof(SERIAL_DEVICE_CONTEXT));
-    if (NULL == deviceContext)
+    // Setup serial pnp component context
+    componentContext = calloc(1, sizeof(SERIAL_COMPONENT_CONTEXT));
+    if (NULL == componentContext)
     {
         LogError("Error out of memory");
         result = IOTHUB_CLIENT_ERROR;
         goto exit;
     }
-    memset(deviceContext, 0, sizeof(SERIAL_DEVICE_CONTEXT));
-    mallocAndStrcpy_s((char**)&deviceContext->ComponentName, ComponentName);
-    deviceContext->RxBufferIndex = 0;
-    deviceContext->RxEscaped = false;
-
-    deviceContext->CommandLock = Lock_Init();
-    deviceContext->CommandResponseWaitLock = Lock_Init();
-    deviceContext->CommandResponseWaitCondition = Condition_Init();
-    if (NULL == deviceContext->CommandLock ||
-        NULL == deviceContext->CommandResponseWaitLock ||
-        NULL == deviceContext->CommandResponseWaitCondition)
-    {
-        if (NULL != deviceContext->CommandLock)
-        {
-            Lock_Deinit(deviceContext->CommandLock);
-        }
-        if (NULL != deviceContext->CommandResponseWaitLock)
-        {
-            Lock_Deinit(deviceContext->CommandResponseWaitLock);
-        }
-        if (NULL != deviceContext->CommandResponseWaitCondition)
-        {
-            Lock_Deinit(deviceContext->CommandResponseWaitCondition);
-        }
+    componentContext->InterfaceIndex = interfaceIndex;
+    componentContext->PropertyReportLock = Lock_Init();
+    componentContext->PropertyReportCondition = Condition_Init();
+    componentContext->PendingProperties = json_value_init_object();
+    componentContext->ReportedProperties = json_value_init_object();
+    if (0 != mallocAndStrcpy_s(&componentContext->ComponentName, ComponentName) ||
+        NULL == componentContext->PropertyReportLock ||
+        NULL == componentContext->PropertyReportCondition ||
+        NULL == componentContext->PendingProperties ||
+        NULL == componentContext->ReportedProperties)
+    {
+        LogError("Unable to allocate component state");
         result = IOTHUB_CLIENT_ERROR;
         goto exit;
     }
-    deviceContext->InterfaceDefinitions = singlylinkedlist_create();
 
-    // Open device and store handle in device context
-    result = SerialPnp_OpenDevice(useComDeviceInterface ? seriaDevice->InterfaceName : port, baudRate, deviceContext);
+    // Components configured on the same port share one link to the device
+    Lock(adapterContext->SerialDevicesLock);
+    LIST_ITEM_HANDLE deviceItem = singlylinkedlist_find(adapterContext->SerialDevices, SerialPnp_DeviceMatchesPort, port);
+    if (NULL != deviceItem)
+    {
+        deviceContext = (PSERIAL_DEVICE_CONTEXT)singlylinkedlist_item_get_value(deviceItem);
+    }
+    else if (IOTHUB_CLIENT_OK != (result = SerialPnp_CreateDevice(adapterContext, port, &usbId, baudRate, &deviceContext)))
+    {
+        Unlock(adapterContext->SerialDevicesLock);
+        LogError("Failed to open serial device on %s", port);
+        goto exit;
+    }
+    deviceContext->ReferenceCount++;
+    componentContext->Device = deviceContext;
+    Unlock(adapterContext->SerialDevicesLock);
 
-    // Retrieve device descriptor and populate supported interface configurations
-    if (THREADAPI_OK != ThreadAPI_Create(&deviceContext->SerialDeviceWorker, SerialPnp_ParseInterfaceConfig, deviceContext))
+    Lock(deviceContext->ComponentTableLock);
+    if (NULL != deviceContext->Components[interfaceIndex])
     {
-        LogError("ThreadAPI_Create failed");
+        LogError("Interface %d on %s is already exposed by component %s", interfaceIndex, port,
+            deviceContext->Components[interfaceIndex]->ComponentName);
+        result = IOTHUB_CLIENT_INVALID_ARG;
+    }
+    else
+    {
+        deviceContext->Components[interfaceIndex] = componentContext;
+    }
+    Unlock(deviceContext->ComponentTableLock);
+    if (IOTHUB_CLIENT_OK != result)
+    {
+        goto exit;
     }
 
     // Assign client handle
     if (PnpComponentHandleGetIoTType(BridgeComponentHandle) == PNP_BRIDGE_IOT_TYPE_DEVICE)
     {
-        deviceContext->ClientType = PNP_BRIDGE_IOT_TYPE_DEVICE;
+        componentContext->ClientType = PNP_BRIDGE_IOT_TYPE_DEVICE;
     }
     else
     {
-        deviceContext->ClientType = PNP_BRIDGE_IOT_TYPE_RUNTIME_MODULE;
+        componentContext->ClientType = PNP_BRIDGE_IOT_TYPE_RUNTIME_MODULE;
     }
 
-    PnpComponentHandleSetContext(BridgeComponentHandle, deviceContext);
+    PnpComponentHandleSetContext(BridgeComponentHandle, componentContext);
     PnpComponentHandleSetPropertyUpdateCallback(BridgeComponentHandle, SerialPnp_PropertyUpdateHandler);
     PnpComponentHandleSetCommandCallback(BridgeComponentHandle, SerialPnp_CommandUpdateHandler);
 
 exit:
-    if (result != IOTHUB_CLIENT_OK)
+    if ((result != IOTHUB_CLIENT_OK) && (NULL != componentContext))
     {
-        SerialPnp_DestroyPnpComponent(BridgeComponentHandle);
+        SerialPnp_DestroyComponentContext(componentContext);
     }
 
     return result;
 }
 
-IOTHUB_CLIENT_RESULT SerialPnp_CreatePnpAdapter(
-    const JSON_Object* AdapterGlobalConfig,
+// SerialPnp_TtyAdded wakes the readers of disconnected links whose device was just plugged in
+static void SerialPnp_TtyAdded(
+    const char* DeviceName,
+    void* Context)
+{
+    PSERIAL_ADAPTER_CONTEXT adapterContext = (PSERIAL_ADAPTER_CONTEXT)Context;
+
+    Lock(adapterContext->SerialDevicesLock);
+    LIST_ITEM_HANDLE deviceItem = singlylinkedlist_get_head_item(adapterContext->SerialDevices);
+    while (NULL != deviceItem)
+    {
+        PSERIAL_DEVICE_CONTEXT deviceContext = (PSERIAL_DEVICE_CONTEXT)singlylinkedlist_item_get_value(deviceItem);
+        if (!deviceContext->Connected &&
+            ((NULL != deviceContext->UsbId.Vid) ?
+                SerialPnp_TtyMatchesUsbId(DeviceName, &deviceContext->UsbId) :
+                SerialPnp_TtyMatchesPort(DeviceName, deviceContext->DevicePath)))
+        {
+            SerialPnp_SignalReconnect(deviceContext);
+        }
+        deviceItem = singlylinkedlist_get_next_item(deviceItem);
+    }
+    Unlock(adapterContext->SerialDevicesLock);
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_DestroyPnpAdapter(
     PNPBRIDGE_ADAPTER_HANDLE AdapterHandle)
 {
-    AZURE_UNREFERENCED_PARAMETER(AdapterGlobalConfig);
-    AZURE_UNREFERENCED_PARAMETER(AdapterHandle);
+    PSERIAL_ADAPTER_CONTEXT adapterContext = PnpAdapterHandleGetContext(AdapterHandle);
+    if (NULL == adapterContext)
+    {
+        return IOTHUB_CLIENT_OK;
+    }
+
+    SerialPnp_HotplugMonitor_Destroy(adapterContext->HotplugMonitor);
+
+    // Every link is released along with its last component
+    if (NULL != adapterContext->SerialDevices)
+    {
+        singlylinkedlist_destroy(adapterContext->SerialDevices);
+    }
+    if (NULL != adapterContext->SerialDevicesLock)
+    {
+        Lock_Deinit(adapterContext->SerialDevicesLock);
+    }
+    if (NULL != adapterContext->DescriptorCachePath)
+    {
+        free(adapterContext->DescriptorCachePath);
+    }
+    free(adapterContext);
+    PnpAdapterHandleSetContext(AdapterHandle, NULL);
     return IOTHUB_CLIENT_OK;
 }
 
-IOTHUB_CLIENT_RESULT SerialPnp_DestroyPnpAdapter(
+IOTHUB_CLIENT_RESULT SerialPnp_CreatePnpAdapter(
+    const JSON_Object* AdapterGlobalConfig,
     PNPBRIDGE_ADAPTER_HANDLE AdapterHandle)
 {
-    AZURE_UNREFERENCED_PARAMETER(AdapterHandle);
+    PSERIAL_ADAPTER_CONTEXT adapterContext = calloc(1, sizeof(SERIAL_ADAPTER_CONTEXT));
+    if (NULL == adapterContext)
+    {
+        LogError("Could not allocate memory for adapter context.");
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    adapterContext->SerialDevices = singlylinkedlist_create();
+    adapterContext->SerialDevicesLock = Lock_Init();
+    if ((NULL == adapterContext->SerialDevices) || (NULL == adapterContext->SerialDevicesLock))
+    {
+        LogError("Could not allocate serial device list.");
+        if (NULL != adapterContext->SerialDevices)
+        {
+            singlylinkedlist_destroy(adapterContext->SerialDevices);
+        }
+        if (NULL != adapterContext->SerialDevicesLock)
+        {
+            Lock_Deinit(adapterContext->SerialDevicesLock);
+        }
+        free(adapterContext);
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    // Descriptors are cached only when a cache directory is configured
+    const char* cachePath = (NULL != AdapterGlobalConfig) ?
+        json_object_dotget_string(AdapterGlobalConfig, PNP_CONFIG_ADAPTER_SERIALPNP_DESCRIPTOR_CACHE_PATH) : NULL;
+    if ((NULL != cachePath) && (0 != mallocAndStrcpy_s(&adapterContext->DescriptorCachePath, cachePath)))
+    {
+        LogError("Could not allocate descriptor cache path.");
+        singlylinkedlist_destroy(adapterContext->SerialDevices);
+        Lock_Deinit(adapterContext->SerialDevicesLock);
+        free(adapterContext);
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+#ifndef WIN32
+    // Without the monitor, unplugged devices are still picked up by periodic retries
+    adapterContext->HotplugMonitor = SerialPnp_HotplugMonitor_Create(SerialPnp_TtyAdded, adapterContext);
+    if (NULL == adapterContext->HotplugMonitor)
+    {
+        LogError("Serial device hotplug monitor is unavailable, reconnects will be slower");
+    }
+#endif
+
+    PnpAdapterHandleSetContext(AdapterHandle, (void*)adapterContext);
     return IOTHUB_CLIENT_OK;
 }
 
@@ -1,13 +1,56 @@
 // Copyright (c) Microsoft. All rights reserved. 
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "azure_c_shared_utility/lock.h"
 #include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/singlylinkedlist.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "parson.h"
+
+#include <pnpadapter_api.h>
+
+#include "serial_pnp_latency.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+typedef unsigned int DWORD;
+typedef uint8_t byte;
+typedef int HANDLE;
+typedef short USHORT;
+typedef uint16_t UINT16;
+#endif
 
 #define MAX_BUFFER_SIZE 4096
 
 #define SERIALPNP_RESET_OR_DESCRIPTOR_MAX_RETRIES 3
 
+// The interface number is a single byte in every packet
+#define SERIALPNP_MAX_INTERFACE_COUNT 256
+
+// Property notifications received from the device within this window are
+// reported to the twin as a single patch
+#define SERIALPNP_PROPERTY_COALESCE_WINDOW_MS 100
+
+// How often a reader waiting for data checks whether its link is being closed
+#define SERIALPNP_RX_POLL_INTERVAL_MS 100
+// How long the bridge waits for the response to a reset or descriptor request
+#define SERIALPNP_RESPONSE_TIMEOUT_MS 2000
+// How long a command may run on the device before its invocation fails
+#define SERIALPNP_COMMAND_TIMEOUT_MS 60000
+// How often a disconnected link tries to reopen its port when no hotplug events arrive
+#define SERIALPNP_RECONNECT_RETRY_MS 1000
+// After a hotplug event the port is retried quickly for a while, until udev has set it up
+#define SERIALPNP_HOTPLUG_RETRY_MS 50
+#define SERIALPNP_HOTPLUG_RETRY_COUNT 20
+// How often the clock of a device that reports one is sampled again, to follow its drift
+#define SERIALPNP_CLOCK_SYNC_INTERVAL_MS (5 * 60 * 1000)
+// How often the event latencies of a link are logged
+#define SERIALPNP_LATENCY_LOG_INTERVAL_MS (5 * 60 * 1000)
+
 #define SERIALPNP_MIN_PACKET_LENGTH 4
 #define SERIALPNP_START_OF_FRAME_BYTE 0x5A
 #define SERIALPNP_ESCAPE_BYTE         0xEF
@@ -15,6 +58,7 @@
 // Offsets of fields within the packet relative to the start of packet
 #define SERIALPNP_PACKET_PACKET_LENGTH_OFFSET    0
 #define SERIALPNP_PACKET_PACKET_TYPE_OFFSET      2
+#define SERIALPNP_PACKET_FLAGS_OFFSET            3
 #define SERIALPNP_PACKET_PAYLOAD_OFFSET          4
 #define SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET 4
 #define SERIALPNP_PACKET_NAME_LENGTH_OFFSET      5
@@ -33,8 +77,42 @@
 #define SERIALPNP_PACKET_TYPE_COMMAND_REQUEST       0x05
 #define SERIALPNP_PACKET_TYPE_COMMAND_RESPONSE      0x06
 #define SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST      0x07
-#define SERIALPNP_PACKET_TYPE_PROPERTY_NOTIFICATION 0x08
+#define SERIALPNP_PACKET_TYPE_PROPERTY_RESPONSE     0x08
+#define SERIALPNP_PACKET_TYPE_PROPERTY_NOTIFICATION 0x09
 #define SERIALPNP_PACKET_TYPE_EVENT_NOTIFICATION    0x0A
+#define SERIALPNP_PACKET_TYPE_EVENT_BATCH           0x0B
+#define SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_REQUEST  0x0C
+#define SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_RESPONSE 0x0D
+
+// Reset and descriptor hash responses carry a 32-bit hash of the device descriptor (LE) after
+// the header. Devices that do not report a hash send a bare reset response.
+#define SERIALPNP_DESCRIPTOR_HASH_OFFSET            4
+#define SERIALPNP_DESCRIPTOR_HASH_PACKET_LENGTH     8
+
+// Devices with a clock follow the hash with their time, a 32-bit count of milliseconds (LE) that
+// the bridge uses to relate event timestamps to its own clock
+#define SERIALPNP_DEVICE_TIME_OFFSET                8
+#define SERIALPNP_DEVICE_TIME_PACKET_LENGTH         12
+
+// Header flags of a descriptor hash request. With TIMESTAMPS the device timestamps the events it
+// sends from then on, until it is reset.
+#define SERIALPNP_REQUEST_FLAG_TIMESTAMPS           0x01
+
+// Header flag of an event notification whose last 4 bytes are the device time of its capture
+#define SERIALPNP_PACKET_FLAG_TIMESTAMP             0x01
+#define SERIALPNP_DEVICE_TIME_LENGTH                4
+
+// Layout of an event batch packet. Each sample that follows the header is an event index
+// (position of the event within its interface in the descriptor), an optional 16-bit time
+// delta and the value, whose size is given by the event's schema. With the TIMESTAMP flag the
+// sample count is followed by the device time at which the batch was sent, and time deltas count
+// back from it.
+#define SERIALPNP_BATCH_FLAGS_OFFSET                5
+#define SERIALPNP_BATCH_SAMPLE_COUNT_OFFSET         6
+#define SERIALPNP_BATCH_SAMPLES_OFFSET              7
+#define SERIALPNP_BATCH_TIMESTAMP_OFFSET            7
+#define SERIALPNP_BATCH_FLAG_TIME_DELTA             0x01
+#define SERIALPNP_BATCH_FLAG_TIMESTAMP              0x02
 
 #ifdef __cplusplus
 extern "C"
@@ -98,6 +176,9 @@ extern "C"
         SINGLYLINKEDLIST_HANDLE Events;
         SINGLYLINKEDLIST_HANDLE Properties;
         SINGLYLINKEDLIST_HANDLE Commands;
+        // Events in descriptor order, as referenced by event batch packets
+        const EventDefinition** EventsByIndex;
+        int EventCount;
     } InterfaceDefinition;
 
     typedef enum DefinitionType {
@@ -106,16 +187,36 @@ extern "C"
         Command
     } DefinitionType;
 
+    // Identifies a USB-serial device independently of the tty it is assigned
+    typedef struct _SERIAL_USB_ID {
+        char* Vid;      // e.g. "2341"
+        char* Pid;
+        char* Serial;   // optional, NULL matches any serial number
+    } SERIAL_USB_ID;
+
+    // Size of the name given to links matched by USB id, "usb-<vid>-<pid>[-<serial>]"
+    #define SERIALPNP_USB_PORT_NAME_LENGTH 128
+
+    struct _SERIAL_COMPONENT_CONTEXT;
+    struct _SERIAL_ADAPTER_CONTEXT;
+    struct _SERIALPNP_HOTPLUG_MONITOR;
+    struct _SERIALPNP_TX_QUEUE;
+
+    // A serial link to one device. Every interface in the device descriptor can be exposed as its own
+    // bridge component; all of those components share this context, its reader thread and its writer.
     typedef struct _SERIAL_DEVICE_CONTEXT {
         HANDLE hSerial;
-        PNP_BRIDGE_CLIENT_HANDLE ClientHandle;
-        PNP_BRIDGE_IOT_TYPE ClientType;
-        char * ComponentName;
+        char* PortName;                 // configured port, or the USB id of devices matched by one
+        char* DevicePath;               // port currently opened for the device
+        DWORD BaudRate;
+        SERIAL_USB_ID UsbId;            // set when the device is matched by USB id rather than port
         byte RxBuffer[MAX_BUFFER_SIZE]; // Temporary buffer that gets filled by the reading thread. TODO: maximum buffer size
         byte* pbMainBuffer;             // pointer used to pass buffers back to the main thread
         LOCK_HANDLE CommandLock;
         LOCK_HANDLE CommandResponseWaitLock;
         COND_HANDLE CommandResponseWaitCondition;
+        LOCK_HANDLE TxLock;             // serializes writes from all components on this link
+        struct _SERIALPNP_TX_QUEUE* TxQueue; // frames waiting to be written by the link's writer thread
 #ifdef WIN32
         OVERLAPPED osReader;
         OVERLAPPED osWriter;
@@ -124,10 +225,78 @@ extern "C"
         bool RxEscaped;
         THREAD_HANDLE SerialDeviceWorker;
         THREAD_HANDLE TelemetryWorkerHandle;
+        // The port is open; cleared when the device goes away, after which the reader reopens it
+        bool Connected;
+        // The link is being stopped and its reader should exit
+        bool Closing;
+        // Wakes a reader waiting for the device to come back, on hotplug events and on stop
+        LOCK_HANDLE ReconnectLock;
+        COND_HANDLE ReconnectCondition;
+        bool ReconnectSignaled;
         // list of interface definitions on this serial device
         SINGLYLINKEDLIST_HANDLE InterfaceDefinitions;
+        // Interface definitions replaced after the device changed its descriptor while handlers were
+        // using them; freed when the last handler is done, under ComponentTableLock
+        SINGLYLINKEDLIST_HANDLE RetiredInterfaceDefinitions;
+        int InterfaceUsers;             // handlers using interface definitions outside the reader
+        // Hash of the descriptor in use, when the device reports one
+        uint32_t DescriptorHash;
+        bool DescriptorHashKnown;
+        // The descriptor was loaded from the cache and the device has not confirmed it yet
+        bool DescriptorFromCache;
+        // The reader asked the running device for its descriptor again, and installs the response
+        bool DescriptorRequestPending;
+        int DescriptorRequestRetries;
+        uint64_t DescriptorRequestTime;
+        uint32_t RequestedDescriptorHash;   // the hash the device reported when it was asked
+        bool RequestedDescriptorHashKnown;
+        // Maps event timestamps to host time, for devices that report their clock
+        SERIALPNP_DEVICE_CLOCK DeviceClock;
+        bool DeviceHasClock;
+        uint64_t ClockSyncRequestTime;  // when the last descriptor hash request was sent
+        // Latency of the events received on this link, by stage
+        SERIALPNP_LATENCY_HANDLE Latency;
+        // Interface definitions and bound components, indexed by the interface number used on the wire
+        const InterfaceDefinition* Interfaces[SERIALPNP_MAX_INTERFACE_COUNT];
+        int InterfaceCount;
+        struct _SERIAL_COMPONENT_CONTEXT* Components[SERIALPNP_MAX_INTERFACE_COUNT];
+        LOCK_HANDLE ComponentTableLock;
+        int ReferenceCount;             // components created on this link
+        // Components are started and stopped one at a time, the first and last of them starting and
+        // stopping the reader; not taken by the reader, which a stop joins
+        LOCK_HANDLE StartLock;
+        int StartedComponentCount;      // components started on this link, under StartLock
+        struct _SERIAL_ADAPTER_CONTEXT* Adapter;
     } SERIAL_DEVICE_CONTEXT, *PSERIAL_DEVICE_CONTEXT;
 
+    // A bridge component backed by one interface of a serial device
+    typedef struct _SERIAL_COMPONENT_CONTEXT {
+        PSERIAL_DEVICE_CONTEXT Device;
+        PNP_BRIDGE_CLIENT_HANDLE ClientHandle;
+        PNP_BRIDGE_IOT_TYPE ClientType;
+        char * ComponentName;
+        int InterfaceIndex;
+        bool Started;
+        // Device-side property changes waiting to be reported, latest value per property
+        LOCK_HANDLE PropertyReportLock;
+        COND_HANDLE PropertyReportCondition;
+        THREAD_HANDLE PropertyReportWorkerHandle;
+        bool PropertyReportWorkerRunning;
+        JSON_Value* PendingProperties;
+        // Last value reported to the twin for each property, used to suppress unchanged values
+        JSON_Value* ReportedProperties;
+    } SERIAL_COMPONENT_CONTEXT, *PSERIAL_COMPONENT_CONTEXT;
+
+    typedef struct _SERIAL_ADAPTER_CONTEXT {
+        // Open serial links, one per port, shared by the components configured on that port
+        SINGLYLINKEDLIST_HANDLE SerialDevices;
+        LOCK_HANDLE SerialDevicesLock;
+        // Reports serial devices being plugged in, so disconnected links reopen right away
+        struct _SERIALPNP_HOTPLUG_MONITOR* HotplugMonitor;
+        // Directory holding cached device descriptors, or NULL if descriptors are not cached
+        char* DescriptorCachePath;
+    } SERIAL_ADAPTER_CONTEXT, *PSERIAL_ADAPTER_CONTEXT;
+
     IOTHUB_CLIENT_RESULT SerialPnp_RxPacket(
         PSERIAL_DEVICE_CONTEXT serialDevice,
         byte** receivedPacket,
@@ -144,27 +313,49 @@ extern "C"
         byte* packet,
         DWORD length);
 
-    IOTHUB_CLIENT_RESULT SerialPnp_ResetDevice(PSERIAL_DEVICE_CONTEXT serialDevice);
+    IOTHUB_CLIENT_RESULT SerialPnp_ResetDevice(
+        PSERIAL_DEVICE_CONTEXT serialDevice,
+        uint32_t* descriptorHash,
+        bool* descriptorHashReported);
 
     IOTHUB_CLIENT_RESULT SerialPnp_DeviceDescriptorRequest(
         PSERIAL_DEVICE_CONTEXT serialDevice,
         byte** desc,
         DWORD* length);
 
-    byte* SerialPnp_StringSchemaToBinary(
-        Schema Schema,
-        byte* data,
-        int* length);
+    // When an event was captured and went through the bridge, in host monotonic microseconds
+    typedef struct _SERIALPNP_EVENT_TIMES {
+        uint64_t Captured;  // 0 if the device did not timestamp the event
+        uint64_t Received;  // the frame carrying it was read
+        uint64_t Decoded;   // its telemetry was built
+        uint16_t DeviceAge; // milliseconds it waited on the device before being sent, from a batch time delta
+    } SERIALPNP_EVENT_TIMES;
+
+    // Messages are stamped with the capture time of their data in this system property
+    #define SERIALPNP_CREATION_TIME_PROPERTY "iothub-creation-time-utc"
 
     IOTHUB_CLIENT_RESULT SerialPnp_SendEventAsync(
-        PSERIAL_DEVICE_CONTEXT DeviceContext,
+        PSERIAL_COMPONENT_CONTEXT ComponentContext,
         char* TelemetryName,
-        char* TelemetryData);
+        char* TelemetryData,
+        const SERIALPNP_EVENT_TIMES* Times);
+
+    IOTHUB_CLIENT_RESULT SerialPnp_QueuePropertyReport(
+        PSERIAL_COMPONENT_CONTEXT ComponentContext,
+        const char* PropertyName,
+        const char* PropertyData);
 
     // Serial Pnp Adapter Config
     #define PNP_CONFIG_ADAPTER_SERIALPNP_COMPORT "com_port"
     #define PNP_CONFIG_ADAPTER_SERIALPNP_USEDEFAULT "use_com_device_interface"
     #define PNP_CONFIG_ADAPTER_SERIALPNP_BAUDRATE "baud_rate"
+    #define PNP_CONFIG_ADAPTER_SERIALPNP_INTERFACE_INDEX "interface_index"
+    #define PNP_CONFIG_ADAPTER_SERIALPNP_USB_VID "usb_vid"
+    #define PNP_CONFIG_ADAPTER_SERIALPNP_USB_PID "usb_pid"
+    #define PNP_CONFIG_ADAPTER_SERIALPNP_USB_SERIAL "usb_serial"
+
+    // Serial Pnp Adapter Global Config
+    #define PNP_CONFIG_ADAPTER_SERIALPNP_DESCRIPTOR_CACHE_PATH "descriptor_cache_path"
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,170 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdlib.h>
+
+#include "serial_pnp_batch.h"
+
+byte SerialPnp_SchemaValueSize(
+    Schema DataSchema)
+{
+    switch (DataSchema)
+    {
+        case Byte:
+        case Boolean:
+            return 1;
+        case Float:
+        case Int:
+            return 4;
+        case Double:
+        case Long:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_IndexInterfaceEvents(
+    InterfaceDefinition* Interface)
+{
+    int eventCount = 0;
+    LIST_ITEM_HANDLE eventItem = singlylinkedlist_get_head_item(Interface->Events);
+    while (NULL != eventItem)
+    {
+        eventCount++;
+        eventItem = singlylinkedlist_get_next_item(eventItem);
+    }
+
+    if (0 == eventCount)
+    {
+        return IOTHUB_CLIENT_OK;
+    }
+
+    Interface->EventsByIndex = calloc(eventCount, sizeof(EventDefinition*));
+    if (NULL == Interface->EventsByIndex)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    eventItem = singlylinkedlist_get_head_item(Interface->Events);
+    while (NULL != eventItem)
+    {
+        Interface->EventsByIndex[Interface->EventCount++] = singlylinkedlist_item_get_value(eventItem);
+        eventItem = singlylinkedlist_get_next_item(eventItem);
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
+bool SerialPnp_GetEventBatchTimestamp(
+    const byte* Packet,
+    DWORD Length,
+    uint32_t* DeviceTime)
+{
+    if ((Length < SERIALPNP_BATCH_TIMESTAMP_OFFSET + SERIALPNP_DEVICE_TIME_LENGTH) ||
+        (0 == (Packet[SERIALPNP_BATCH_FLAGS_OFFSET] & SERIALPNP_BATCH_FLAG_TIMESTAMP)))
+    {
+        return false;
+    }
+
+    const byte* field = Packet + SERIALPNP_BATCH_TIMESTAMP_OFFSET;
+    *DeviceTime = (uint32_t)field[0] | ((uint32_t)field[1] << 8) | ((uint32_t)field[2] << 16) | ((uint32_t)field[3] << 24);
+    return true;
+}
+
+// SerialPnp_WalkEventBatch checks the samples of a batch against the interface, and calls
+// SampleCallback for each of them when one is given
+static IOTHUB_CLIENT_RESULT SerialPnp_WalkEventBatch(
+    const InterfaceDefinition* Interface,
+    const byte* Packet,
+    DWORD Length,
+    SERIALPNP_EVENT_SAMPLE_CALLBACK SampleCallback,
+    void* Context)
+{
+    bool hasTimeDelta = (Packet[SERIALPNP_BATCH_FLAGS_OFFSET] & SERIALPNP_BATCH_FLAG_TIME_DELTA) != 0;
+    byte sampleCount = Packet[SERIALPNP_BATCH_SAMPLE_COUNT_OFFSET];
+    DWORD c = SERIALPNP_BATCH_SAMPLES_OFFSET;
+
+    // Samples follow the timestamp of a timestamped batch
+    if (0 != (Packet[SERIALPNP_BATCH_FLAGS_OFFSET] & SERIALPNP_BATCH_FLAG_TIMESTAMP))
+    {
+        c += SERIALPNP_DEVICE_TIME_LENGTH;
+        if (c > Length)
+        {
+            return IOTHUB_CLIENT_INVALID_SIZE;
+        }
+    }
+
+    for (int i = 0; i < sampleCount; i++)
+    {
+        uint16_t timeDelta = 0;
+
+        if (c >= Length)
+        {
+            return IOTHUB_CLIENT_INVALID_SIZE;
+        }
+
+        byte eventIndex = Packet[c++];
+        if (eventIndex >= Interface->EventCount)
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+        const EventDefinition* ev = Interface->EventsByIndex[eventIndex];
+
+        if (hasTimeDelta)
+        {
+            if (c + 2 > Length)
+            {
+                return IOTHUB_CLIENT_INVALID_SIZE;
+            }
+            timeDelta = (uint16_t)(Packet[c] | (Packet[c + 1] << 8));
+            c += 2;
+        }
+
+        byte valueSize = SerialPnp_SchemaValueSize(ev->DataSchema);
+        if (0 == valueSize)
+        {
+            return IOTHUB_CLIENT_INVALID_ARG;
+        }
+        if (c + valueSize > Length)
+        {
+            return IOTHUB_CLIENT_INVALID_SIZE;
+        }
+
+        if (NULL != SampleCallback)
+        {
+            SampleCallback(ev, timeDelta, Packet + c, valueSize, Context);
+        }
+        c += valueSize;
+    }
+
+    return (c == Length) ? IOTHUB_CLIENT_OK : IOTHUB_CLIENT_INVALID_SIZE;
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_DecodeEventBatch(
+    const InterfaceDefinition* Interface,
+    const byte* Packet,
+    DWORD Length,
+    SERIALPNP_EVENT_SAMPLE_CALLBACK SampleCallback,
+    void* Context)
+{
+    IOTHUB_CLIENT_RESULT result;
+
+    if ((NULL == Interface) || (NULL == Packet) || (NULL == SampleCallback))
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    if ((Length < SERIALPNP_BATCH_SAMPLES_OFFSET) ||
+        (SERIALPNP_PACKET_TYPE_EVENT_BATCH != Packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]))
+    {
+        return IOTHUB_CLIENT_INVALID_ARG;
+    }
+
+    // Validate the whole batch first so that a truncated or corrupt packet is dropped as a unit
+    if (IOTHUB_CLIENT_OK != (result = SerialPnp_WalkEventBatch(Interface, Packet, Length, NULL, NULL)))
+    {
+        return result;
+    }
+
+    return SerialPnp_WalkEventBatch(Interface, Packet, Length, SampleCallback, Context);
+}
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include "serial_pnp.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Called once per sample decoded from an event batch packet. TimeDelta is the number of
+    // milliseconds between the device taking the sample and sending the batch, or 0 when the
+    // batch carries no time deltas. A timestamped batch tells when it was sent, see
+    // SerialPnp_GetEventBatchTimestamp.
+    typedef void (*SERIALPNP_EVENT_SAMPLE_CALLBACK)(
+        const EventDefinition* Event,
+        uint16_t TimeDelta,
+        const byte* Value,
+        byte ValueLength,
+        void* Context);
+
+    // Size in bytes of a value of the given schema on the wire, or 0 if values of that
+    // schema have no fixed size and cannot be carried in an event batch
+    byte SerialPnp_SchemaValueSize(
+        Schema DataSchema);
+
+    // Builds the index of events in descriptor order used to resolve event batch samples
+    IOTHUB_CLIENT_RESULT SerialPnp_IndexInterfaceEvents(
+        InterfaceDefinition* Interface);
+
+    // Reads the device time at which a batch was sent, from a batch with the TIMESTAMP flag. Returns
+    // false if the batch carries no timestamp.
+    bool SerialPnp_GetEventBatchTimestamp(
+        const byte* Packet,
+        DWORD Length,
+        uint32_t* DeviceTime);
+
+    // Walks the samples of an event batch packet, calling SampleCallback for each of them.
+    // Every sample is validated before the first callback, so a malformed packet produces
+    // no callbacks at all.
+    IOTHUB_CLIENT_RESULT SerialPnp_DecodeEventBatch(
+        const InterfaceDefinition* Interface,
+        const byte* Packet,
+        DWORD Length,
+        SERIALPNP_EVENT_SAMPLE_CALLBACK SampleCallback,
+        void* Context);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,230 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#include "serial_pnp_cache.h"
+
+// Cache entry layout: magic, format version, descriptor hash (LE), descriptor length (LE),
+// then the descriptor response packet as received from the device
+#define SERIALPNP_CACHE_MAGIC           "SPDC"
+#define SERIALPNP_CACHE_MAGIC_LENGTH    4
+#define SERIALPNP_CACHE_FORMAT_VERSION  1
+#define SERIALPNP_CACHE_HEADER_LENGTH   (SERIALPNP_CACHE_MAGIC_LENGTH + 1 + 4 + 4)
+
+#define SERIALPNP_FNV_OFFSET_BASIS      0x811C9DC5
+#define SERIALPNP_FNV_PRIME             0x01000193
+
+uint32_t SerialPnp_DescriptorHash(
+    const byte* Descriptor,
+    DWORD Length)
+{
+    uint32_t hash = SERIALPNP_FNV_OFFSET_BASIS;
+    for (DWORD i = SERIALPNP_PACKET_PAYLOAD_OFFSET; i < Length; i++)
+    {
+        hash ^= Descriptor[i];
+        hash *= SERIALPNP_FNV_PRIME;
+    }
+    return hash;
+}
+
+static void SerialPnp_PutUint32(
+    byte* Buffer,
+    uint32_t Value)
+{
+    Buffer[0] = (byte)(Value & 0xFF);
+    Buffer[1] = (byte)((Value >> 8) & 0xFF);
+    Buffer[2] = (byte)((Value >> 16) & 0xFF);
+    Buffer[3] = (byte)((Value >> 24) & 0xFF);
+}
+
+static uint32_t SerialPnp_GetUint32(
+    const byte* Buffer)
+{
+    return (uint32_t)Buffer[0] | ((uint32_t)Buffer[1] << 8) | ((uint32_t)Buffer[2] << 16) | ((uint32_t)Buffer[3] << 24);
+}
+
+// SerialPnp_GetCacheFileName maps a port to its cache entry, e.g. /dev/ttyACM0 to
+// <CachePath>/serialpnp__dev_ttyACM0.desc. The caller frees the returned name.
+static char* SerialPnp_GetCacheFileName(
+    const char* CachePath,
+    const char* PortName,
+    const char* Suffix)
+{
+    size_t length = strlen(CachePath) + strlen("/serialpnp_") + strlen(PortName) + strlen(".desc") + strlen(Suffix) + 1;
+    char* fileName = malloc(length);
+    if (NULL == fileName)
+    {
+        LogError("Error out of memory");
+        return NULL;
+    }
+
+    (void)snprintf(fileName, length, "%s/serialpnp_", CachePath);
+    char* portPart = fileName + strlen(fileName);
+    for (const char* c = PortName; *c != '\0'; c++)
+    {
+        *portPart++ = isalnum((unsigned char)*c) ? *c : '_';
+    }
+    *portPart = '\0';
+    strcat(fileName, ".desc");
+    strcat(fileName, Suffix);
+
+    return fileName;
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_LoadCachedDescriptor(
+    const char* CachePath,
+    const char* PortName,
+    byte** Descriptor,
+    DWORD* Length,
+    uint32_t* DescriptorHash)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    byte header[SERIALPNP_CACHE_HEADER_LENGTH];
+    byte* descriptor = NULL;
+    FILE* cacheFile = NULL;
+
+    *Descriptor = NULL;
+    *Length = 0;
+
+    char* fileName = SerialPnp_GetCacheFileName(CachePath, PortName, "");
+    if (NULL == fileName)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    if (NULL == (cacheFile = fopen(fileName, "rb")))
+    {
+        // No descriptor has been cached for this port yet
+        result = IOTHUB_CLIENT_INVALID_ARG;
+        goto exit;
+    }
+
+    if ((1 != fread(header, sizeof(header), 1, cacheFile)) ||
+        (0 != memcmp(header, SERIALPNP_CACHE_MAGIC, SERIALPNP_CACHE_MAGIC_LENGTH)) ||
+        (SERIALPNP_CACHE_FORMAT_VERSION != header[SERIALPNP_CACHE_MAGIC_LENGTH]))
+    {
+        LogError("Ignoring unrecognized descriptor cache entry %s", fileName);
+        result = IOTHUB_CLIENT_INVALID_SIZE;
+        goto exit;
+    }
+
+    uint32_t hash = SerialPnp_GetUint32(header + SERIALPNP_CACHE_MAGIC_LENGTH + 1);
+    DWORD length = SerialPnp_GetUint32(header + SERIALPNP_CACHE_MAGIC_LENGTH + 5);
+    if ((length < SERIALPNP_MIN_PACKET_LENGTH) || (length > 0xFFFF))
+    {
+        LogError("Ignoring descriptor cache entry %s of bad length %u", fileName, length);
+        result = IOTHUB_CLIENT_INVALID_SIZE;
+        goto exit;
+    }
+
+    if (NULL == (descriptor = malloc(length)))
+    {
+        LogError("Error out of memory");
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    // The stored hash covers the descriptor itself, so a truncated or damaged entry is never used
+    if ((1 != fread(descriptor, length, 1, cacheFile)) ||
+        (length != (DWORD)(descriptor[0] | (descriptor[1] << 8))) ||
+        (SERIALPNP_PACKET_TYPE_DESCRIPTOR_RESPONSE != descriptor[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]) ||
+        (hash != SerialPnp_DescriptorHash(descriptor, length)))
+    {
+        LogError("Ignoring damaged descriptor cache entry %s", fileName);
+        result = IOTHUB_CLIENT_INVALID_SIZE;
+        goto exit;
+    }
+
+    *Descriptor = descriptor;
+    *Length = length;
+    *DescriptorHash = hash;
+    descriptor = NULL;
+
+exit:
+    if (NULL != cacheFile)
+    {
+        fclose(cacheFile);
+    }
+    free(descriptor);
+    free(fileName);
+    return result;
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_StoreCachedDescriptor(
+    const char* CachePath,
+    const char* PortName,
+    const byte* Descriptor,
+    DWORD Length,
+    uint32_t DescriptorHash)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_OK;
+    byte header[SERIALPNP_CACHE_HEADER_LENGTH];
+    FILE* cacheFile = NULL;
+
+    char* fileName = SerialPnp_GetCacheFileName(CachePath, PortName, "");
+    char* tempFileName = SerialPnp_GetCacheFileName(CachePath, PortName, ".tmp");
+    if ((NULL == fileName) || (NULL == tempFileName))
+    {
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    memcpy(header, SERIALPNP_CACHE_MAGIC, SERIALPNP_CACHE_MAGIC_LENGTH);
+    header[SERIALPNP_CACHE_MAGIC_LENGTH] = SERIALPNP_CACHE_FORMAT_VERSION;
+    SerialPnp_PutUint32(header + SERIALPNP_CACHE_MAGIC_LENGTH + 1, DescriptorHash);
+    SerialPnp_PutUint32(header + SERIALPNP_CACHE_MAGIC_LENGTH + 5, Length);
+
+    // Write a new entry beside the old one and swap it in, so a crash never leaves a partial entry
+    if (NULL == (cacheFile = fopen(tempFileName, "wb")))
+    {
+        LogError("Unable to create descriptor cache entry %s", tempFileName);
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    bool written = (1 == fwrite(header, sizeof(header), 1, cacheFile)) &&
+                   (1 == fwrite(Descriptor, Length, 1, cacheFile));
+    if ((0 != fclose(cacheFile)) || !written)
+    {
+        LogError("Unable to write descriptor cache entry %s", tempFileName);
+        (void)remove(tempFileName);
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+#ifdef WIN32
+    (void)remove(fileName);
+#endif
+    if (0 != rename(tempFileName, fileName))
+    {
+        LogError("Unable to replace descriptor cache entry %s", fileName);
+        (void)remove(tempFileName);
+        result = IOTHUB_CLIENT_ERROR;
+        goto exit;
+    }
+
+    LogInfo("Cached descriptor of %s in %s", PortName, fileName);
+
+exit:
+    free(tempFileName);
+    free(fileName);
+    return result;
+}
+
+void SerialPnp_RemoveCachedDescriptor(
+    const char* CachePath,
+    const char* PortName)
+{
+    char* fileName = SerialPnp_GetCacheFileName(CachePath, PortName, "");
+    if (NULL != fileName)
+    {
+        (void)remove(fileName);
+        free(fileName);
+    }
+}
@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include "serial_pnp.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // FNV-1a hash of the payload of a descriptor response packet. Devices report the same hash
+    // of their descriptor, which lets the bridge check a cached descriptor without fetching it.
+    uint32_t SerialPnp_DescriptorHash(
+        const byte* Descriptor,
+        DWORD Length);
+
+    // Reads the descriptor response packet cached for a port. Fails if there is no cache entry
+    // or if the entry is damaged; on success the caller frees *Descriptor.
+    IOTHUB_CLIENT_RESULT SerialPnp_LoadCachedDescriptor(
+        const char* CachePath,
+        const char* PortName,
+        byte** Descriptor,
+        DWORD* Length,
+        uint32_t* DescriptorHash);
+
+    // Caches the descriptor response packet received from the device on a port, replacing any
+    // previous entry for that port
+    IOTHUB_CLIENT_RESULT SerialPnp_StoreCachedDescriptor(
+        const char* CachePath,
+        const char* PortName,
+        const byte* Descriptor,
+        DWORD Length,
+        uint32_t DescriptorHash);
+
+    void SerialPnp_RemoveCachedDescriptor(
+        const char* CachePath,
+        const char* PortName);
+
+#ifdef __cplusplus
+}
+#endif
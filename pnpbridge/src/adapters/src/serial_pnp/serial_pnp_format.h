@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include "serial_pnp.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Size of a buffer that holds any number written by the formatters below, including the
+    // terminating NUL
+    #define SERIALPNP_NUMBER_STRING_LENGTH 32
+
+    // Integer formatters. Each writes the decimal text of Value and a terminating NUL to Buffer,
+    // and returns the number of characters written, not counting the NUL.
+    size_t SerialPnp_FormatUInt64(
+        uint64_t Value,
+        char* Buffer);
+
+    size_t SerialPnp_FormatInt64(
+        int64_t Value,
+        char* Buffer);
+
+    size_t SerialPnp_FormatInt32(
+        int32_t Value,
+        char* Buffer);
+
+    // Floating point formatters. Each writes the shortest decimal text that reads back as exactly
+    // Value, as a JSON number: plain notation for magnitudes from 1e-6 up to 1e21, exponent
+    // notation outside of that. JSON has no representation for NaN and infinities, so those are
+    // written as null.
+    size_t SerialPnp_FormatFloat(
+        float Value,
+        char* Buffer);
+
+    size_t SerialPnp_FormatDouble(
+        double Value,
+        char* Buffer);
+
+    // Converts the text of a property or command value to the wire encoding of the given schema.
+    // Returns a buffer the caller frees, holding *length bytes, or NULL if the text is not a valid
+    // value of the schema.
+    byte* SerialPnp_StringSchemaToBinary(
+        Schema Schema,
+        byte* data,
+        int* length);
+
+    // Converts a value received from the device to JSON text. Strings are quoted and escaped, so the
+    // result can be embedded in a JSON document as is. Returns a string the caller frees, or NULL if
+    // length does not match the schema.
+    char* SerialPnp_BinarySchemaToString(
+        Schema Schema,
+        const byte* Data,
+        byte length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,400 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+#include "serial_pnp_hotplug.h"
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <dirent.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define SERIALPNP_UEVENT_BUFFER_SIZE    8192
+#define SERIALPNP_USB_ATTRIBUTE_SIZE    128
+// How far above the tty's device directory the USB device directory may be
+// (tty -> interface -> device for CDC ACM, one more level for some USB-serial drivers)
+#define SERIALPNP_USB_SEARCH_DEPTH      4
+#define SERIALPNP_SYSFS_ROOT            "/sys"
+
+typedef struct _SERIALPNP_HOTPLUG_MONITOR {
+    int Socket;
+    int StopPipe[2];        // Write end is closed by SerialPnp_HotplugMonitor_Destroy to wake and stop the worker
+    THREAD_HANDLE Worker;
+    SERIALPNP_TTY_ADDED_CALLBACK Callback;
+    void* Context;
+} SERIALPNP_HOTPLUG_MONITOR;
+
+// A kernel uevent is a header line followed by NUL-separated KEY=VALUE pairs
+void SerialPnp_HandleUevent(
+    const char* Message,
+    size_t Length,
+    SERIALPNP_TTY_ADDED_CALLBACK Callback,
+    void* Context)
+{
+    const char* action = NULL;
+    const char* subsystem = NULL;
+    const char* deviceName = NULL;
+
+    for (size_t offset = strlen(Message) + 1; offset < Length; offset += strlen(Message + offset) + 1)
+    {
+        const char* field = Message + offset;
+        if (0 == strncmp(field, "ACTION=", 7))
+        {
+            action = field + 7;
+        }
+        else if (0 == strncmp(field, "SUBSYSTEM=", 10))
+        {
+            subsystem = field + 10;
+        }
+        else if (0 == strncmp(field, "DEVNAME=", 8))
+        {
+            deviceName = field + 8;
+        }
+    }
+
+    if ((NULL != action) && (NULL != subsystem) && (NULL != deviceName) &&
+        (0 == strcmp(action, "add")) && (0 == strcmp(subsystem, "tty")))
+    {
+        LogInfo("Serial device %s was plugged in", deviceName);
+        Callback(deviceName, Context);
+    }
+}
+
+static int SerialPnp_HotplugWorker(
+    void* context)
+{
+    SERIALPNP_HOTPLUG_MONITOR* monitor = (SERIALPNP_HOTPLUG_MONITOR*)context;
+    char* buffer = malloc(SERIALPNP_UEVENT_BUFFER_SIZE);
+    if (NULL == buffer)
+    {
+        LogError("Error out of memory");
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    while (true)
+    {
+        struct pollfd pfds[2] = { { monitor->Socket, POLLIN, 0 }, { monitor->StopPipe[0], POLLIN, 0 } };
+        int ready = poll(pfds, 2, -1);
+        if (ready < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            LogError("Hotplug monitor poll failed: %s", strerror(errno));
+            break;
+        }
+
+        // The monitor is being destroyed
+        if (0 != pfds[1].revents)
+        {
+            break;
+        }
+        if (0 == (pfds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        ssize_t received = recv(monitor->Socket, buffer, SERIALPNP_UEVENT_BUFFER_SIZE - 1, 0);
+        if (received <= 0)
+        {
+            continue;
+        }
+        buffer[received] = '\0';
+        SerialPnp_HandleUevent(buffer, (size_t)received, monitor->Callback, monitor->Context);
+    }
+
+    free(buffer);
+    return IOTHUB_CLIENT_OK;
+}
+
+SERIALPNP_HOTPLUG_MONITOR_HANDLE SerialPnp_HotplugMonitor_Create(
+    SERIALPNP_TTY_ADDED_CALLBACK Callback,
+    void* Context)
+{
+    struct sockaddr_nl address = { 0 };
+    SERIALPNP_HOTPLUG_MONITOR* monitor = calloc(1, sizeof(SERIALPNP_HOTPLUG_MONITOR));
+    if (NULL == monitor)
+    {
+        LogError("Error out of memory");
+        return NULL;
+    }
+    monitor->Callback = Callback;
+    monitor->Context = Context;
+
+    if (0 != pipe(monitor->StopPipe))
+    {
+        LogError("Unable to create hotplug monitor stop pipe: %s", strerror(errno));
+        free(monitor);
+        return NULL;
+    }
+    (void)fcntl(monitor->StopPipe[0], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(monitor->StopPipe[1], F_SETFD, FD_CLOEXEC);
+
+    // Kernel uevents are multicast to group 1; they arrive as soon as the device node exists,
+    // without waiting for udev rules to run
+    monitor->Socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (monitor->Socket < 0)
+    {
+        LogError("Unable to open uevent socket: %s", strerror(errno));
+        close(monitor->StopPipe[0]);
+        close(monitor->StopPipe[1]);
+        free(monitor);
+        return NULL;
+    }
+
+    address.nl_family = AF_NETLINK;
+    address.nl_pid = 0;
+    address.nl_groups = 1;
+    if (0 != bind(monitor->Socket, (struct sockaddr*)&address, sizeof(address)))
+    {
+        LogError("Unable to bind uevent socket: %s", strerror(errno));
+        close(monitor->Socket);
+        close(monitor->StopPipe[0]);
+        close(monitor->StopPipe[1]);
+        free(monitor);
+        return NULL;
+    }
+
+    if (THREADAPI_OK != ThreadAPI_Create(&monitor->Worker, SerialPnp_HotplugWorker, monitor))
+    {
+        LogError("ThreadAPI_Create failed");
+        close(monitor->Socket);
+        close(monitor->StopPipe[0]);
+        close(monitor->StopPipe[1]);
+        free(monitor);
+        return NULL;
+    }
+
+    return monitor;
+}
+
+void SerialPnp_HotplugMonitor_Destroy(
+    SERIALPNP_HOTPLUG_MONITOR_HANDLE Monitor)
+{
+    if (NULL == Monitor)
+    {
+        return;
+    }
+
+    // Closing the write end wakes the worker, which sees its end of the pipe hang up
+    close(Monitor->StopPipe[1]);
+    ThreadAPI_Join(Monitor->Worker, NULL);
+    close(Monitor->Socket);
+    close(Monitor->StopPipe[0]);
+    free(Monitor);
+}
+
+// SerialPnp_ReadUsbAttribute reads a sysfs attribute such as idVendor, without its trailing newline
+static bool SerialPnp_ReadUsbAttribute(
+    const char* deviceDirectory,
+    const char* attribute,
+    char* value,
+    size_t valueSize)
+{
+    char path[PATH_MAX];
+    (void)snprintf(path, sizeof(path), "%s/%s", deviceDirectory, attribute);
+
+    FILE* file = fopen(path, "r");
+    if (NULL == file)
+    {
+        return false;
+    }
+
+    bool read = (NULL != fgets(value, (int)valueSize, file));
+    fclose(file);
+    if (read)
+    {
+        value[strcspn(value, "\r\n")] = '\0';
+    }
+    return read;
+}
+
+bool SerialPnp_TtyMatchesUsbIdInSysfs(
+    const char* SysfsRoot,
+    const char* DeviceName,
+    const SERIAL_USB_ID* UsbId)
+{
+    char path[PATH_MAX];
+    char deviceDirectory[PATH_MAX];
+    char value[SERIALPNP_USB_ATTRIBUTE_SIZE];
+
+    (void)snprintf(path, sizeof(path), "%s/class/tty/%s/device", SysfsRoot, DeviceName);
+    if (NULL == realpath(path, deviceDirectory))
+    {
+        // Virtual terminals and other ttys without a backing device
+        return false;
+    }
+
+    // Walk up from the tty's device to the USB device that carries the ids
+    for (int depth = 0; depth < SERIALPNP_USB_SEARCH_DEPTH; depth++)
+    {
+        if (SerialPnp_ReadUsbAttribute(deviceDirectory, "idVendor", value, sizeof(value)))
+        {
+            if (0 != strcasecmp(value, UsbId->Vid))
+            {
+                return false;
+            }
+            if (!SerialPnp_ReadUsbAttribute(deviceDirectory, "idProduct", value, sizeof(value)) ||
+                (0 != strcasecmp(value, UsbId->Pid)))
+            {
+                return false;
+            }
+            if (NULL != UsbId->Serial)
+            {
+                return SerialPnp_ReadUsbAttribute(deviceDirectory, "serial", value, sizeof(value)) &&
+                       (0 == strcmp(value, UsbId->Serial));
+            }
+            return true;
+        }
+
+        char* separator = strrchr(deviceDirectory, '/');
+        if ((NULL == separator) || (separator == deviceDirectory))
+        {
+            break;
+        }
+        *separator = '\0';
+    }
+
+    return false;
+}
+
+bool SerialPnp_TtyMatchesUsbId(
+    const char* DeviceName,
+    const SERIAL_USB_ID* UsbId)
+{
+    return SerialPnp_TtyMatchesUsbIdInSysfs(SERIALPNP_SYSFS_ROOT, DeviceName, UsbId);
+}
+
+bool SerialPnp_TtyMatchesPort(
+    const char* DeviceName,
+    const char* Port)
+{
+    char resolvedPort[PATH_MAX];
+    char devicePath[PATH_MAX];
+
+    if (NULL == realpath(Port, resolvedPort))
+    {
+        return true;
+    }
+
+    (void)snprintf(devicePath, sizeof(devicePath), "/dev/%s", DeviceName);
+    return (0 == strcmp(resolvedPort, devicePath));
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_FindTtyByUsbId(
+    const SERIAL_USB_ID* UsbId,
+    char** DevicePath)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
+    struct dirent* entry;
+
+    DIR* ttys = opendir(SERIALPNP_SYSFS_ROOT "/class/tty");
+    if (NULL == ttys)
+    {
+        LogError("Unable to enumerate serial devices: %s", strerror(errno));
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    while (NULL != (entry = readdir(ttys)))
+    {
+        if (('.' != entry->d_name[0]) && SerialPnp_TtyMatchesUsbId(entry->d_name, UsbId))
+        {
+            size_t length = strlen("/dev/") + strlen(entry->d_name) + 1;
+            if (NULL == (*DevicePath = malloc(length)))
+            {
+                LogError("Error out of memory");
+                result = IOTHUB_CLIENT_ERROR;
+                break;
+            }
+            (void)snprintf(*DevicePath, length, "/dev/%s", entry->d_name);
+            result = IOTHUB_CLIENT_OK;
+            break;
+        }
+    }
+
+    closedir(ttys);
+    return result;
+}
+
+#else
+
+SERIALPNP_HOTPLUG_MONITOR_HANDLE SerialPnp_HotplugMonitor_Create(
+    SERIALPNP_TTY_ADDED_CALLBACK Callback,
+    void* Context)
+{
+    (void)Callback;
+    (void)Context;
+    return NULL;
+}
+
+void SerialPnp_HotplugMonitor_Destroy(
+    SERIALPNP_HOTPLUG_MONITOR_HANDLE Monitor)
+{
+    (void)Monitor;
+}
+
+void SerialPnp_HandleUevent(
+    const char* Message,
+    size_t Length,
+    SERIALPNP_TTY_ADDED_CALLBACK Callback,
+    void* Context)
+{
+    (void)Message;
+    (void)Length;
+    (void)Callback;
+    (void)Context;
+}
+
+bool SerialPnp_TtyMatchesUsbIdInSysfs(
+    const char* SysfsRoot,
+    const char* DeviceName,
+    const SERIAL_USB_ID* UsbId)
+{
+    (void)SysfsRoot;
+    (void)DeviceName;
+    (void)UsbId;
+    return false;
+}
+
+bool SerialPnp_TtyMatchesUsbId(
+    const char* DeviceName,
+    const SERIAL_USB_ID* UsbId)
+{
+    (void)DeviceName;
+    (void)UsbId;
+    return false;
+}
+
+bool SerialPnp_TtyMatchesPort(
+    const char* DeviceName,
+    const char* Port)
+{
+    (void)DeviceName;
+    (void)Port;
+    return false;
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_FindTtyByUsbId(
+    const SERIAL_USB_ID* UsbId,
+    char** DevicePath)
+{
+    (void)UsbId;
+    (void)DevicePath;
+    LogError("Matching serial devices by USB id is only supported on Linux");
+    return IOTHUB_CLIENT_ERROR;
+}
+
+#endif
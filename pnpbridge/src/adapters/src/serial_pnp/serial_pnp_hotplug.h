@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include "serial_pnp.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Called on the monitor thread whenever a tty device appears, with its kernel name (e.g. ttyACM0)
+    typedef void (*SERIALPNP_TTY_ADDED_CALLBACK)(
+        const char* DeviceName,
+        void* Context);
+
+    typedef struct _SERIALPNP_HOTPLUG_MONITOR* SERIALPNP_HOTPLUG_MONITOR_HANDLE;
+
+    // Starts watching for serial devices being plugged in. Only supported on Linux, where kernel
+    // uevents are received over netlink; returns NULL elsewhere.
+    SERIALPNP_HOTPLUG_MONITOR_HANDLE SerialPnp_HotplugMonitor_Create(
+        SERIALPNP_TTY_ADDED_CALLBACK Callback,
+        void* Context);
+
+    void SerialPnp_HotplugMonitor_Destroy(
+        SERIALPNP_HOTPLUG_MONITOR_HANDLE Monitor);
+
+    // Calls Callback with the kernel name of the tty if a uevent received by the monitor announces
+    // that one was added, and does nothing for any other event
+    void SerialPnp_HandleUevent(
+        const char* Message,
+        size_t Length,
+        SERIALPNP_TTY_ADDED_CALLBACK Callback,
+        void* Context);
+
+    // Whether the USB device behind a tty has the given vendor, product and (if set) serial number
+    bool SerialPnp_TtyMatchesUsbId(
+        const char* DeviceName,
+        const SERIAL_USB_ID* UsbId);
+
+    // SerialPnp_TtyMatchesUsbId against the sysfs mounted at SysfsRoot rather than /sys
+    bool SerialPnp_TtyMatchesUsbIdInSysfs(
+        const char* SysfsRoot,
+        const char* DeviceName,
+        const SERIAL_USB_ID* UsbId);
+
+    // Whether a tty is the device a configured port refers to. Ports that do not resolve yet, such as
+    // udev symlinks that are created after the kernel announces the device, are treated as matching.
+    bool SerialPnp_TtyMatchesPort(
+        const char* DeviceName,
+        const char* Port);
+
+    // Finds the device node (e.g. /dev/ttyACM0) of the tty whose USB device matches UsbId. The
+    // caller frees *DevicePath.
+    IOTHUB_CLIENT_RESULT SerialPnp_FindTtyByUsbId(
+        const SERIAL_USB_ID* UsbId,
+        char** DevicePath);
+
+#ifdef __cplusplus
+}
+#endif
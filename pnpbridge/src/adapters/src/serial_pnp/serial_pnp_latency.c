@@ -0,0 +1,335 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/lock.h"
+
+#include "serial_pnp_latency.h"
+
+typedef struct _SERIALPNP_LATENCY {
+    LOCK_HANDLE Lock;
+    int References;
+    SERIALPNP_LATENCY_HISTOGRAM Histograms[SerialPnpLatency_StageCount];
+} SERIALPNP_LATENCY;
+
+static const char* SerialPnp_LatencyStageNames[SerialPnpLatency_StageCount] = {
+    "receive", "decode", "enqueue", "send", "confirm", "end to end"
+};
+
+// SerialPnp_LatencyBucket returns the bucket of a value: values below 16 have one bucket each, and
+// every power of two above is split in 8 by the bits following the leading one
+static size_t SerialPnp_LatencyBucket(
+    uint64_t value)
+{
+    const int subBuckets = 1 << SERIALPNP_LATENCY_SUB_BUCKET_BITS;
+    if (value < (uint64_t)(2 * subBuckets))
+    {
+        return (size_t)value;
+    }
+
+    int exponent = 0;
+    for (uint64_t v = value; v > 1; v >>= 1)
+    {
+        exponent++;
+    }
+    if (exponent > SERIALPNP_LATENCY_MAX_EXPONENT)
+    {
+        return SERIALPNP_LATENCY_BUCKET_COUNT - 1;
+    }
+
+    int shift = exponent - SERIALPNP_LATENCY_SUB_BUCKET_BITS;
+    return (size_t)(((shift + 1) << SERIALPNP_LATENCY_SUB_BUCKET_BITS) + ((value >> shift) & (subBuckets - 1)));
+}
+
+// SerialPnp_LatencyBucketLowest returns the smallest value that falls in a bucket
+static uint64_t SerialPnp_LatencyBucketLowest(
+    size_t bucket)
+{
+    const size_t subBuckets = 1 << SERIALPNP_LATENCY_SUB_BUCKET_BITS;
+    if (bucket < 2 * subBuckets)
+    {
+        return bucket;
+    }
+
+    return (uint64_t)(subBuckets + (bucket & (subBuckets - 1))) << ((bucket >> SERIALPNP_LATENCY_SUB_BUCKET_BITS) - 1);
+}
+
+void SerialPnp_LatencyHistogram_Record(
+    SERIALPNP_LATENCY_HISTOGRAM* Histogram,
+    uint64_t Microseconds)
+{
+    if ((0 == Histogram->Count) || (Microseconds < Histogram->Min))
+    {
+        Histogram->Min = Microseconds;
+    }
+    if (Microseconds > Histogram->Max)
+    {
+        Histogram->Max = Microseconds;
+    }
+    Histogram->Count++;
+    Histogram->Sum += Microseconds;
+    Histogram->Buckets[SerialPnp_LatencyBucket(Microseconds)]++;
+}
+
+uint64_t SerialPnp_LatencyHistogram_Percentile(
+    const SERIALPNP_LATENCY_HISTOGRAM* Histogram,
+    double Percentile)
+{
+    if (0 == Histogram->Count)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)((Percentile / 100.0) * (double)Histogram->Count + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < SERIALPNP_LATENCY_BUCKET_COUNT; i++)
+    {
+        seen += Histogram->Buckets[i];
+        if (seen >= rank)
+        {
+            // Report the top of the bucket, but never beyond what was actually recorded
+            uint64_t highest = (i + 1 < SERIALPNP_LATENCY_BUCKET_COUNT) ? SerialPnp_LatencyBucketLowest(i + 1) - 1 : Histogram->Max;
+            if (highest > Histogram->Max)
+            {
+                highest = Histogram->Max;
+            }
+            if (highest < Histogram->Min)
+            {
+                highest = Histogram->Min;
+            }
+            return highest;
+        }
+    }
+
+    return Histogram->Max;
+}
+
+bool SerialPnp_DeviceClock_AddSample(
+    SERIALPNP_DEVICE_CLOCK* Clock,
+    uint64_t RequestTime,
+    uint64_t ResponseTime,
+    uint32_t DeviceTime)
+{
+    if ((ResponseTime < RequestTime) ||
+        (ResponseTime - RequestTime > (uint64_t)SERIALPNP_CLOCK_SYNC_MAX_ROUND_TRIP_MS * 1000))
+    {
+        return false;
+    }
+
+    uint64_t roundTrip = ResponseTime - RequestTime;
+    uint64_t midpoint = RequestTime + roundTrip / 2;
+
+    // A sample replaces the current estimate unless that one is much more precise; since the clocks
+    // drift apart, an old estimate only stays better for so long
+    if (Clock->Synchronized && (roundTrip > 2 * Clock->RoundTrip + 2000) &&
+        (midpoint - Clock->HostTime < (uint64_t)60 * 1000 * 1000))
+    {
+        return false;
+    }
+
+    Clock->Synchronized = true;
+    Clock->DeviceTime = DeviceTime;
+    Clock->HostTime = midpoint;
+    Clock->RoundTrip = roundTrip;
+    return true;
+}
+
+bool SerialPnp_DeviceClock_ToHost(
+    const SERIALPNP_DEVICE_CLOCK* Clock,
+    uint32_t DeviceTime,
+    uint64_t* HostTime)
+{
+    if (!Clock->Synchronized)
+    {
+        return false;
+    }
+
+    // The difference in modular arithmetic is right across a wrap of the device clock
+    int32_t elapsed = (int32_t)(DeviceTime - Clock->DeviceTime);
+    int64_t hostTime = (int64_t)Clock->HostTime + (int64_t)elapsed * 1000;
+    *HostTime = (hostTime < 0) ? 0 : (uint64_t)hostTime;
+    return true;
+}
+
+uint64_t SerialPnp_MonotonicMicroseconds(void)
+{
+#ifdef WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (0 == frequency.QuadPart)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+#endif
+}
+
+// SerialPnp_UtcMicroseconds returns the time since the Unix epoch
+static uint64_t SerialPnp_UtcMicroseconds(void)
+{
+#ifdef WIN32
+    // File times count 100ns intervals since 1601
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    uint64_t ticks = ((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    return ticks / 10 - 11644473600000000ULL;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+#endif
+}
+
+bool SerialPnp_FormatUtcTime(
+    uint64_t MonotonicTime,
+    char* Buffer,
+    size_t BufferSize)
+{
+    uint64_t monotonicNow = SerialPnp_MonotonicMicroseconds();
+    uint64_t utc = SerialPnp_UtcMicroseconds();
+    uint64_t age = (MonotonicTime < monotonicNow) ? monotonicNow - MonotonicTime : 0;
+    if (age > utc)
+    {
+        return false;
+    }
+    utc -= age;
+
+    // Civil date from days since the epoch, valid for the proleptic Gregorian calendar
+    uint64_t milliseconds = utc / 1000;
+    int64_t days = (int64_t)(milliseconds / 86400000);
+    uint32_t msOfDay = (uint32_t)(milliseconds % 86400000);
+
+    int64_t z = days + 719468;
+    int64_t era = z / 146097;
+    uint32_t dayOfEra = (uint32_t)(z - era * 146097);
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t mp = (5 * dayOfYear + 2) / 153;
+    uint32_t day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    uint32_t month = (mp < 10) ? mp + 3 : mp - 9;
+    int64_t year = (int64_t)yearOfEra + era * 400 + ((month <= 2) ? 1 : 0);
+
+    int written = snprintf(Buffer, BufferSize, "%04d-%02u-%02uT%02u:%02u:%02u.%03uZ",
+                           (int)year, month, day,
+                           msOfDay / 3600000, (msOfDay / 60000) % 60, (msOfDay / 1000) % 60, msOfDay % 1000);
+    return (written > 0) && ((size_t)written < BufferSize);
+}
+
+SERIALPNP_LATENCY_HANDLE SerialPnp_Latency_Create(void)
+{
+    SERIALPNP_LATENCY* latency = calloc(1, sizeof(SERIALPNP_LATENCY));
+    if (NULL == latency)
+    {
+        LogError("Error out of memory");
+        return NULL;
+    }
+
+    latency->Lock = Lock_Init();
+    if (NULL == latency->Lock)
+    {
+        LogError("Error out of memory");
+        free(latency);
+        return NULL;
+    }
+
+    latency->References = 1;
+    return latency;
+}
+
+void SerialPnp_Latency_AddRef(
+    SERIALPNP_LATENCY_HANDLE Latency)
+{
+    Lock(Latency->Lock);
+    Latency->References++;
+    Unlock(Latency->Lock);
+}
+
+void SerialPnp_Latency_Release(
+    SERIALPNP_LATENCY_HANDLE Latency)
+{
+    if (NULL == Latency)
+    {
+        return;
+    }
+
+    Lock(Latency->Lock);
+    int references = --Latency->References;
+    Unlock(Latency->Lock);
+
+    if (0 == references)
+    {
+        Lock_Deinit(Latency->Lock);
+        free(Latency);
+    }
+}
+
+void SerialPnp_Latency_Record(
+    SERIALPNP_LATENCY_HANDLE Latency,
+    SERIALPNP_LATENCY_STAGE Stage,
+    uint64_t Microseconds)
+{
+    Lock(Latency->Lock);
+    SerialPnp_LatencyHistogram_Record(&Latency->Histograms[Stage], Microseconds);
+    Unlock(Latency->Lock);
+}
+
+void SerialPnp_Latency_GetHistogram(
+    SERIALPNP_LATENCY_HANDLE Latency,
+    SERIALPNP_LATENCY_STAGE Stage,
+    SERIALPNP_LATENCY_HISTOGRAM* Histogram)
+{
+    Lock(Latency->Lock);
+    *Histogram = Latency->Histograms[Stage];
+    Unlock(Latency->Lock);
+}
+
+void SerialPnp_Latency_Log(
+    SERIALPNP_LATENCY_HANDLE Latency,
+    const char* PortName)
+{
+    // Copy one stage at a time, the histograms are too big to copy all of them onto the stack
+    SERIALPNP_LATENCY_HISTOGRAM* histogram = malloc(sizeof(SERIALPNP_LATENCY_HISTOGRAM));
+    if (NULL == histogram)
+    {
+        return;
+    }
+
+    for (int stage = 0; stage < SerialPnpLatency_StageCount; stage++)
+    {
+        SerialPnp_Latency_GetHistogram(Latency, (SERIALPNP_LATENCY_STAGE)stage, histogram);
+        if (0 == histogram->Count)
+        {
+            continue;
+        }
+
+        LogInfo("Serial device on %s %s latency (us): %llu events, p50 %llu, p90 %llu, p99 %llu, max %llu",
+                PortName, SerialPnp_LatencyStageNames[stage],
+                (unsigned long long)histogram->Count,
+                (unsigned long long)SerialPnp_LatencyHistogram_Percentile(histogram, 50),
+                (unsigned long long)SerialPnp_LatencyHistogram_Percentile(histogram, 90),
+                (unsigned long long)SerialPnp_LatencyHistogram_Percentile(histogram, 99),
+                (unsigned long long)histogram->Max);
+    }
+
+    free(histogram);
+}
@@ -0,0 +1,119 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Latencies are recorded in microseconds. Buckets are exact below 16us, then split every power
+    // of two in 8, so a percentile is within 12.5% of the true value, up to 2^40us (about 12 days).
+    #define SERIALPNP_LATENCY_SUB_BUCKET_BITS 3
+    #define SERIALPNP_LATENCY_MAX_EXPONENT 39
+    #define SERIALPNP_LATENCY_BUCKET_COUNT \
+        ((SERIALPNP_LATENCY_MAX_EXPONENT - SERIALPNP_LATENCY_SUB_BUCKET_BITS + 2) << SERIALPNP_LATENCY_SUB_BUCKET_BITS)
+
+    // Length of an ISO 8601 UTC time with milliseconds, e.g. "2020-06-01T12:00:00.000Z", with its terminator
+    #define SERIALPNP_UTC_TIME_LENGTH 25
+
+    // Stages of an event on its way from the device to IoT Hub
+    typedef enum _SERIALPNP_LATENCY_STAGE {
+        SerialPnpLatency_Receive,   // captured on the device to its frame read by the bridge; needs device timestamps
+        SerialPnpLatency_Decode,    // frame read to telemetry built
+        SerialPnpLatency_Enqueue,   // telemetry built to IoT Hub message created
+        SerialPnpLatency_Send,      // message handed to the IoT Hub client
+        SerialPnpLatency_Confirm,   // handed to the client to delivery confirmed
+        SerialPnpLatency_EndToEnd,  // captured on the device to delivery confirmed; needs device timestamps
+        SerialPnpLatency_StageCount
+    } SERIALPNP_LATENCY_STAGE;
+
+    typedef struct _SERIALPNP_LATENCY_HISTOGRAM {
+        uint64_t Count;
+        uint64_t Sum;
+        uint64_t Min;
+        uint64_t Max;
+        uint64_t Buckets[SERIALPNP_LATENCY_BUCKET_COUNT];
+    } SERIALPNP_LATENCY_HISTOGRAM;
+
+    void SerialPnp_LatencyHistogram_Record(
+        SERIALPNP_LATENCY_HISTOGRAM* Histogram,
+        uint64_t Microseconds);
+
+    // Returns the smallest recorded value bound such that Percentile percent of the samples are at
+    // or below it, or 0 if the histogram is empty
+    uint64_t SerialPnp_LatencyHistogram_Percentile(
+        const SERIALPNP_LATENCY_HISTOGRAM* Histogram,
+        double Percentile);
+
+    // Maps the millisecond clock of a device to host time. Each sample comes from a request answered
+    // with the device time, which is taken to have been read halfway through the round trip, so an
+    // estimate is off by at most half the round trip of its sample.
+    typedef struct _SERIALPNP_DEVICE_CLOCK {
+        bool Synchronized;
+        uint32_t DeviceTime;    // device clock reading, in milliseconds
+        uint64_t HostTime;      // host monotonic time of that reading, in microseconds
+        uint64_t RoundTrip;     // round trip of the exchange the estimate comes from
+    } SERIALPNP_DEVICE_CLOCK;
+
+    // Samples taken over a round trip longer than this are too imprecise to be used
+    #define SERIALPNP_CLOCK_SYNC_MAX_ROUND_TRIP_MS 250
+
+    // Updates the estimate from a request sent at RequestTime and answered at ResponseTime with the
+    // device time DeviceTime. Returns false if the sample was discarded.
+    bool SerialPnp_DeviceClock_AddSample(
+        SERIALPNP_DEVICE_CLOCK* Clock,
+        uint64_t RequestTime,
+        uint64_t ResponseTime,
+        uint32_t DeviceTime);
+
+    // Converts a device time to host monotonic time. The device clock may wrap around; times within
+    // 24 days of the last sample convert correctly. Returns false until the clock is synchronized.
+    bool SerialPnp_DeviceClock_ToHost(
+        const SERIALPNP_DEVICE_CLOCK* Clock,
+        uint32_t DeviceTime,
+        uint64_t* HostTime);
+
+    // Host monotonic time in microseconds
+    uint64_t SerialPnp_MonotonicMicroseconds(void);
+
+    // Formats a host monotonic time as the UTC time it corresponds to now, in the ISO 8601 form
+    // IoT Hub expects in iothub-creation-time-utc
+    bool SerialPnp_FormatUtcTime(
+        uint64_t MonotonicTime,
+        char* Buffer,
+        size_t BufferSize);
+
+    // Histograms of every stage for the events of one link. The link and every message in flight
+    // hold a reference, since confirmations may arrive after the link is gone.
+    typedef struct _SERIALPNP_LATENCY* SERIALPNP_LATENCY_HANDLE;
+
+    SERIALPNP_LATENCY_HANDLE SerialPnp_Latency_Create(void);
+
+    void SerialPnp_Latency_AddRef(
+        SERIALPNP_LATENCY_HANDLE Latency);
+
+    void SerialPnp_Latency_Release(
+        SERIALPNP_LATENCY_HANDLE Latency);
+
+    void SerialPnp_Latency_Record(
+        SERIALPNP_LATENCY_HANDLE Latency,
+        SERIALPNP_LATENCY_STAGE Stage,
+        uint64_t Microseconds);
+
+    void SerialPnp_Latency_GetHistogram(
+        SERIALPNP_LATENCY_HANDLE Latency,
+        SERIALPNP_LATENCY_STAGE Stage,
+        SERIALPNP_LATENCY_HISTOGRAM* Histogram);
+
+    // Logs the median, 90th and 99th percentile and maximum of every stage with samples
+    void SerialPnp_Latency_Log(
+        SERIALPNP_LATENCY_HANDLE Latency,
+        const char* PortName);
+
+#ifdef __cplusplus
+}
+#endif
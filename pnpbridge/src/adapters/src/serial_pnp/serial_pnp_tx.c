@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#include <stdlib.h>
+#include <string.h>
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+#include "serial_pnp_tx.h"
+
+#define SERIALPNP_TX_INITIAL_CAPACITY 1024
+
+// A sender waiting for its frame to be written. Each has a condition of its own, since
+// Condition_Post wakes a single thread and a batch can hold the frames of several senders.
+typedef struct _SERIALPNP_TX_WAITER {
+    IOTHUB_CLIENT_RESULT Result;
+    bool Done;
+    COND_HANDLE Written;
+    struct _SERIALPNP_TX_WAITER* Next;
+} SERIALPNP_TX_WAITER;
+
+typedef struct _SERIALPNP_TX_BUFFER {
+    byte* Data;
+    size_t Length;
+    size_t Capacity;
+    uint64_t Frames;
+    SERIALPNP_TX_WAITER* Waiters;   // senders of frames in this buffer that wait for the write
+} SERIALPNP_TX_BUFFER;
+
+typedef struct _SERIALPNP_TX_QUEUE {
+    LOCK_HANDLE Lock;
+    COND_HANDLE Queued;             // posted when frames are queued, or the queue is stopping
+    COND_HANDLE Written;            // posted when a batch has been written, once per throttled sender
+    size_t Throttled;               // senders waiting for room in the queue
+    // Senders fill one buffer while the writer thread writes the other
+    SERIALPNP_TX_BUFFER Buffers[2];
+    SERIALPNP_TX_BUFFER* Pending;
+    bool Stopping;
+    THREAD_HANDLE Writer;
+    SERIALPNP_TX_WRITE_CALLBACK WriteCallback;
+    void* Context;
+    SERIALPNP_TX_STATISTICS Statistics;
+} SERIALPNP_TX_QUEUE;
+
+static int SerialPnp_TxQueueWriter(
+    void* context)
+{
+    SERIALPNP_TX_QUEUE* queue = (SERIALPNP_TX_QUEUE*)context;
+
+    Lock(queue->Lock);
+    for (;;)
+    {
+        while (!queue->Stopping && (0 == queue->Pending->Length))
+        {
+            Condition_Wait(queue->Queued, queue->Lock, 0);
+        }
+        if (0 == queue->Pending->Length)
+        {
+            break;
+        }
+
+        // Take everything queued so far, and let senders carry on with the other buffer
+        SERIALPNP_TX_BUFFER* batch = queue->Pending;
+        queue->Pending = (batch == &queue->Buffers[0]) ? &queue->Buffers[1] : &queue->Buffers[0];
+        Unlock(queue->Lock);
+
+        uint64_t writeCalls = 0;
+        IOTHUB_CLIENT_RESULT result = queue->WriteCallback(queue->Context, batch->Data, batch->Length, &writeCalls);
+
+        Lock(queue->Lock);
+        queue->Statistics.Batches++;
+        queue->Statistics.WriteCalls += writeCalls;
+        if (IOTHUB_CLIENT_OK == result)
+        {
+            queue->Statistics.Frames += batch->Frames;
+            queue->Statistics.Bytes += batch->Length;
+        }
+        else
+        {
+            queue->Statistics.FailedFrames += batch->Frames;
+        }
+
+        for (SERIALPNP_TX_WAITER* waiter = batch->Waiters; NULL != waiter; waiter = waiter->Next)
+        {
+            waiter->Result = result;
+            waiter->Done = true;
+            Condition_Post(waiter->Written);
+        }
+        batch->Waiters = NULL;
+        batch->Length = 0;
+        batch->Frames = 0;
+        for (size_t i = 0; i < queue->Throttled; i++)
+        {
+            Condition_Post(queue->Written);
+        }
+    }
+    Unlock(queue->Lock);
+
+    return IOTHUB_CLIENT_OK;
+}
+
+SERIALPNP_TX_QUEUE_HANDLE SerialPnp_TxQueue_Create(
+    SERIALPNP_TX_WRITE_CALLBACK WriteCallback,
+    void* Context)
+{
+    SERIALPNP_TX_QUEUE* queue = calloc(1, sizeof(SERIALPNP_TX_QUEUE));
+    if (NULL == queue)
+    {
+        LogError("Error out of memory");
+        return NULL;
+    }
+
+    queue->WriteCallback = WriteCallback;
+    queue->Context = Context;
+    queue->Pending = &queue->Buffers[0];
+    queue->Lock = Lock_Init();
+    queue->Queued = Condition_Init();
+    queue->Written = Condition_Init();
+    for (int i = 0; i < 2; i++)
+    {
+        queue->Buffers[i].Data = malloc(SERIALPNP_TX_INITIAL_CAPACITY);
+        queue->Buffers[i].Capacity = SERIALPNP_TX_INITIAL_CAPACITY;
+    }
+
+    if ((NULL == queue->Lock) || (NULL == queue->Queued) || (NULL == queue->Written) ||
+        (NULL == queue->Buffers[0].Data) || (NULL == queue->Buffers[1].Data))
+    {
+        LogError("Error out of memory");
+        SerialPnp_TxQueue_Destroy(queue);
+        return NULL;
+    }
+
+    if (THREADAPI_OK != ThreadAPI_Create(&queue->Writer, SerialPnp_TxQueueWriter, queue))
+    {
+        LogError("ThreadAPI_Create failed");
+        queue->Writer = NULL;
+        SerialPnp_TxQueue_Destroy(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void SerialPnp_TxQueue_Destroy(
+    SERIALPNP_TX_QUEUE_HANDLE Queue)
+{
+    if (NULL == Queue)
+    {
+        return;
+    }
+
+    if (NULL != Queue->Writer)
+    {
+        Lock(Queue->Lock);
+        Queue->Stopping = true;
+        Condition_Post(Queue->Queued);
+        Unlock(Queue->Lock);
+        ThreadAPI_Join(Queue->Writer, NULL);
+    }
+
+    if (NULL != Queue->Lock)
+    {
+        Lock_Deinit(Queue->Lock);
+    }
+    if (NULL != Queue->Queued)
+    {
+        Condition_Deinit(Queue->Queued);
+    }
+    if (NULL != Queue->Written)
+    {
+        Condition_Deinit(Queue->Written);
+    }
+    free(Queue->Buffers[0].Data);
+    free(Queue->Buffers[1].Data);
+    free(Queue);
+}
+
+// SerialPnp_ReserveTxBuffer makes room for Length more bytes in a buffer, keeping its contents
+static bool SerialPnp_ReserveTxBuffer(
+    SERIALPNP_TX_BUFFER* buffer,
+    size_t length)
+{
+    if (buffer->Length + length <= buffer->Capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = buffer->Capacity * 2;
+    if (capacity < buffer->Length + length)
+    {
+        capacity = buffer->Length + length;
+    }
+
+    byte* data = realloc(buffer->Data, capacity);
+    if (NULL == data)
+    {
+        return false;
+    }
+    buffer->Data = data;
+    buffer->Capacity = capacity;
+    return true;
+}
+
+IOTHUB_CLIENT_RESULT SerialPnp_TxQueue_Send(
+    SERIALPNP_TX_QUEUE_HANDLE Queue,
+    const byte* Packet,
+    size_t Length,
+    bool Wait)
+{
+    // Worst case, every byte is escaped, plus the start of frame byte
+    size_t framedLength = 2 * Length + 1;
+    SERIALPNP_TX_WAITER waiter = { IOTHUB_CLIENT_OK, false, NULL, NULL };
+
+    if (Wait)
+    {
+        waiter.Written = Condition_Init();
+        if (NULL == waiter.Written)
+        {
+            LogError("Error out of memory");
+            return IOTHUB_CLIENT_ERROR;
+        }
+    }
+
+    Lock(Queue->Lock);
+
+    // Wait for the writer to catch up if the port is slower than the senders
+    while (!Queue->Stopping && (0 != Queue->Pending->Length) &&
+           (Queue->Pending->Length + framedLength > SERIALPNP_TX_QUEUE_LIMIT))
+    {
+        Queue->Throttled++;
+        Condition_Wait(Queue->Written, Queue->Lock, 0);
+        Queue->Throttled--;
+    }
+
+    SERIALPNP_TX_BUFFER* pending = Queue->Pending;
+    if (Queue->Stopping || !SerialPnp_ReserveTxBuffer(pending, framedLength))
+    {
+        if (!Queue->Stopping)
+        {
+            LogError("Error out of memory");
+        }
+        Unlock(Queue->Lock);
+        if (NULL != waiter.Written)
+        {
+            Condition_Deinit(waiter.Written);
+        }
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    byte* out = pending->Data + pending->Length;
+    *out++ = SERIALPNP_START_OF_FRAME_BYTE;
+    for (size_t i = 0; i < Length; i++)
+    {
+        // Escape these bytes where necessary
+        if ((SERIALPNP_START_OF_FRAME_BYTE == Packet[i]) || (SERIALPNP_ESCAPE_BYTE == Packet[i]))
+        {
+            *out++ = SERIALPNP_ESCAPE_BYTE;
+            *out++ = (byte)(Packet[i] - 1);
+        }
+        else
+        {
+            *out++ = Packet[i];
+        }
+    }
+    pending->Length = (size_t)(out - pending->Data);
+    pending->Frames++;
+
+    if (Wait)
+    {
+        waiter.Next = pending->Waiters;
+        pending->Waiters = &waiter;
+    }
+    Condition_Post(Queue->Queued);
+
+    while (Wait && !waiter.Done)
+    {
+        Condition_Wait(waiter.Written, Queue->Lock, 0);
+    }
+
+    Unlock(Queue->Lock);
+    if (NULL != waiter.Written)
+    {
+        Condition_Deinit(waiter.Written);
+    }
+    return waiter.Result;
+}
+
+void SerialPnp_TxQueue_GetStatistics(
+    SERIALPNP_TX_QUEUE_HANDLE Queue,
+    SERIALPNP_TX_STATISTICS* Statistics)
+{
+    Lock(Queue->Lock);
+    *Statistics = Queue->Statistics;
+    Unlock(Queue->Lock);
+}
@@ -0,0 +1,57 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+#pragma once
+#include "serial_pnp.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Most framed bytes a queue holds before senders wait for the writer to catch up
+    #define SERIALPNP_TX_QUEUE_LIMIT (4 * MAX_BUFFER_SIZE)
+
+    // Writes a batch of framed packets to the port, returning once all of Length is written or
+    // the write failed. WriteCalls is incremented for every write system call made.
+    typedef IOTHUB_CLIENT_RESULT (*SERIALPNP_TX_WRITE_CALLBACK)(
+        void* Context,
+        const byte* Data,
+        size_t Length,
+        uint64_t* WriteCalls);
+
+    typedef struct _SERIALPNP_TX_STATISTICS {
+        uint64_t Frames;        // frames handed to the port
+        uint64_t Bytes;         // bytes handed to the port, after framing and escaping
+        uint64_t Batches;       // writes of queued frames, one or more frames each
+        uint64_t WriteCalls;    // write system calls made for those batches
+        uint64_t FailedFrames;  // frames in batches that could not be written
+    } SERIALPNP_TX_STATISTICS;
+
+    typedef struct _SERIALPNP_TX_QUEUE* SERIALPNP_TX_QUEUE_HANDLE;
+
+    // Creates the transmit queue of a link and its writer thread. Frames are escaped into a
+    // buffer reused from batch to batch, and everything queued while the previous batch was
+    // being written goes out in a single write.
+    SERIALPNP_TX_QUEUE_HANDLE SerialPnp_TxQueue_Create(
+        SERIALPNP_TX_WRITE_CALLBACK WriteCallback,
+        void* Context);
+
+    // Writes the frames still queued, then stops the writer thread
+    void SerialPnp_TxQueue_Destroy(
+        SERIALPNP_TX_QUEUE_HANDLE Queue);
+
+    // Frames Packet and queues it. With Wait set, returns once the frame has been written, with
+    // the result of the write; otherwise returns as soon as the frame is queued.
+    IOTHUB_CLIENT_RESULT SerialPnp_TxQueue_Send(
+        SERIALPNP_TX_QUEUE_HANDLE Queue,
+        const byte* Packet,
+        size_t Length,
+        bool Wait);
+
+    void SerialPnp_TxQueue_GetStatistics(
+        SERIALPNP_TX_QUEUE_HANDLE Queue,
+        SERIALPNP_TX_STATISTICS* Statistics);
+
+#ifdef __cplusplus
+}
+#endif
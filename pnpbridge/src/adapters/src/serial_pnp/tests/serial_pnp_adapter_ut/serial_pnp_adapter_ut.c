@@ -0,0 +1,956 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIN32
+// For the pseudo-terminal of the test device
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "testrunnerswitcher.h"
+
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "parson.h"
+
+#include "serial_pnp.h"
+#include "serial_pnp_cache.h"
+
+#define TEST_NAME_LENGTH 16
+#define TEST_CONFIG_LENGTH 512
+#define TEST_PORT_NAME_LENGTH 64
+#define TEST_PATH_LENGTH 256
+#define TEST_PACKET_SIZE 512
+#define TEST_MAX_PATCHES 16
+#define TEST_POLL_MS 10
+#define TEST_PATCH_TIMEOUT_MS 2000
+// Long enough after the expected patches for any that should not have been sent to show up
+#define TEST_SETTLE_MS (3 * SERIALPNP_PROPERTY_COALESCE_WINDOW_MS)
+#define TEST_COMMAND_NAME "increment"
+#define TEST_COMMANDS 200
+// Far less than the time the adapter waits for a response it missed
+#define TEST_COMMANDS_TIMEOUT_MS 10000
+
+// A component of the bridge, which the adapter is handed as a component handle
+typedef struct TEST_COMPONENT {
+    void* Context;
+    char Name[TEST_NAME_LENGTH];
+    JSON_Value* Config;
+    PNPBRIDGE_COMPONENT_METHOD_CALLBACK CommandCallback;
+} TEST_COMPONENT;
+
+// The device at the other end of the link. The adapter opens the terminal end of a pseudo-terminal
+// as its serial port, and the device answers on the other end the way the device-side library does.
+typedef struct TEST_DEVICE {
+    int Master;
+    int Terminal;           // Held open, so that the terminal does not hang up between opens by the adapter
+    char PortName[TEST_PORT_NAME_LENGTH];
+    THREAD_HANDLE Worker;
+    bool Stopping;
+    byte Descriptor[TEST_PACKET_SIZE];
+    size_t DescriptorLength;
+    byte RxBuffer[TEST_PACKET_SIZE];
+    size_t RxLength;
+    bool RxEscaped;
+    int Resets;
+    int DescriptorRequests;
+    int HashRequests;
+    int CommandRequests;
+} TEST_DEVICE;
+
+extern PNP_ADAPTER SerialPnpInterface;
+
+static TEST_COMPONENT g_components[2];
+static TEST_DEVICE g_device;
+static void* g_adapterContext;
+static JSON_Value* g_adapterConfig;
+static char g_cachePath[TEST_PATH_LENGTH];
+static char g_client;
+static char g_message;
+static LOCK_HANDLE g_lock;
+static char* g_patches[TEST_MAX_PATCHES];
+static int g_patchCount;
+
+// Provided by the bridge, in place of the component and adapter handles it gives the adapter
+void PnpAdapterHandleSetContext(
+    PNPBRIDGE_ADAPTER_HANDLE AdapterHandle,
+    void* AdapterContext)
+{
+    *(void**)AdapterHandle = AdapterContext;
+}
+
+void* PnpAdapterHandleGetContext(
+    PNPBRIDGE_ADAPTER_HANDLE AdapterHandle)
+{
+    return *(void**)AdapterHandle;
+}
+
+void PnpComponentHandleSetContext(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle,
+    void* ComponentDeviceContext)
+{
+    ((TEST_COMPONENT*)ComponentHandle)->Context = ComponentDeviceContext;
+}
+
+void* PnpComponentHandleGetContext(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle)
+{
+    return ((TEST_COMPONENT*)ComponentHandle)->Context;
+}
+
+void PnpComponentHandleSetPropertyUpdateCallback(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle,
+    PNPBRIDGE_COMPONENT_PROPERTY_CALLBACK PropertyUpdateCallback)
+{
+    (void)ComponentHandle;
+    (void)PropertyUpdateCallback;
+}
+
+void PnpComponentHandleSetCommandCallback(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle,
+    PNPBRIDGE_COMPONENT_METHOD_CALLBACK CommandCallback)
+{
+    ((TEST_COMPONENT*)ComponentHandle)->CommandCallback = CommandCallback;
+}
+
+PNP_BRIDGE_CLIENT_HANDLE PnpComponentHandleGetClientHandle(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle)
+{
+    (void)ComponentHandle;
+    return (PNP_BRIDGE_CLIENT_HANDLE)&g_client;
+}
+
+PNP_BRIDGE_IOT_TYPE PnpComponentHandleGetIoTType(
+    PNPBRIDGE_COMPONENT_HANDLE ComponentHandle)
+{
+    (void)ComponentHandle;
+    return PNP_BRIDGE_IOT_TYPE_DEVICE;
+}
+
+// Provided by the bridge and the SDK, in place of the hub. Reported property patches are kept for
+// the test to check; telemetry is dropped.
+IOTHUB_MESSAGE_HANDLE PnP_CreateTelemetryMessageHandle(
+    const char* componentName,
+    const char* telemetryData)
+{
+    (void)componentName;
+    (void)telemetryData;
+    return (IOTHUB_MESSAGE_HANDLE)&g_message;
+}
+
+STRING_HANDLE PnP_CreateReportedProperty(
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue)
+{
+    (void)componentName;
+    (void)propertyName;
+    (void)propertyValue;
+    return NULL;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetProperty(
+    IOTHUB_MESSAGE_HANDLE iotHubMessageHandle,
+    const char* key,
+    const char* value)
+{
+    (void)iotHubMessageHandle;
+    (void)key;
+    (void)value;
+    return IOTHUB_MESSAGE_OK;
+}
+
+void IoTHubMessage_Destroy(
+    IOTHUB_MESSAGE_HANDLE iotHubMessageHandle)
+{
+    (void)iotHubMessageHandle;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_SendEventAsync(
+    IOTHUB_DEVICE_CLIENT_HANDLE iotHubClientHandle,
+    IOTHUB_MESSAGE_HANDLE eventMessageHandle,
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventConfirmationCallback,
+    void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)eventMessageHandle;
+    (void)eventConfirmationCallback;
+    (void)userContextCallback;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT IoTHubDeviceClient_SendReportedState(
+    IOTHUB_DEVICE_CLIENT_HANDLE iotHubClientHandle,
+    const unsigned char* reportedState,
+    size_t size,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportedStateCallback,
+    void* userContextCallback)
+{
+    (void)iotHubClientHandle;
+    (void)reportedStateCallback;
+    (void)userContextCallback;
+
+    char* patch = malloc(size + 1);
+    if (NULL == patch)
+    {
+        return IOTHUB_CLIENT_ERROR;
+    }
+    memcpy(patch, reportedState, size);
+    patch[size] = '\0';
+
+    Lock(g_lock);
+    if (g_patchCount < TEST_MAX_PATCHES)
+    {
+        g_patches[g_patchCount++] = patch;
+        patch = NULL;
+    }
+    Unlock(g_lock);
+
+    free(patch);
+    return IOTHUB_CLIENT_OK;
+}
+
+#ifndef WIN32
+static int test_get_patch_count(void)
+{
+    Lock(g_lock);
+    int count = g_patchCount;
+    Unlock(g_lock);
+    return count;
+}
+
+// Waits for the adapter to send a number of reported property patches, and returns how many it
+// sent, including any sent shortly after
+static int test_wait_for_patches(
+    int count)
+{
+    for (int waited = 0; (test_get_patch_count() < count) && (waited < TEST_PATCH_TIMEOUT_MS); waited += TEST_POLL_MS)
+    {
+        ThreadAPI_Sleep(TEST_POLL_MS);
+    }
+    ThreadAPI_Sleep(TEST_SETTLE_MS);
+    return test_get_patch_count();
+}
+
+// Returns the properties a patch reports for a component, or NULL if it holds none for it
+static JSON_Object* test_get_patch_component(
+    JSON_Value* patch,
+    const char* componentName)
+{
+    return json_object_get_object(json_value_get_object(patch), componentName);
+}
+
+static bool test_device_stopping(
+    TEST_DEVICE* device)
+{
+    Lock(g_lock);
+    bool stopping = device->Stopping;
+    Unlock(g_lock);
+    return stopping;
+}
+
+// Frames a packet and writes it to the adapter
+static void test_device_send(
+    TEST_DEVICE* device,
+    const byte* packet,
+    size_t length)
+{
+    byte frame[2 * TEST_PACKET_SIZE + 1];
+    size_t frameLength = 0;
+
+    frame[frameLength++] = SERIALPNP_START_OF_FRAME_BYTE;
+    for (size_t i = 0; i < length; i++)
+    {
+        if ((SERIALPNP_START_OF_FRAME_BYTE == packet[i]) || (SERIALPNP_ESCAPE_BYTE == packet[i]))
+        {
+            frame[frameLength++] = SERIALPNP_ESCAPE_BYTE;
+            frame[frameLength++] = (byte)(packet[i] - 1);
+        }
+        else
+        {
+            frame[frameLength++] = packet[i];
+        }
+    }
+
+    for (size_t written = 0; written < frameLength;)
+    {
+        ssize_t result = write(device->Master, frame + written, frameLength - written);
+        if (result <= 0)
+        {
+            return;
+        }
+        written += (size_t)result;
+    }
+}
+
+// Answers a reset or a descriptor hash request with the hash of the descriptor
+static void test_device_send_hash(
+    TEST_DEVICE* device,
+    byte packetType)
+{
+    byte packet[SERIALPNP_DESCRIPTOR_HASH_PACKET_LENGTH] = { 0 };
+    uint32_t hash = SerialPnp_DescriptorHash(device->Descriptor, (DWORD)device->DescriptorLength);
+
+    packet[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = SERIALPNP_DESCRIPTOR_HASH_PACKET_LENGTH;
+    packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = packetType;
+    for (int i = 0; i < 4; i++)
+    {
+        packet[SERIALPNP_MIN_PACKET_LENGTH + i] = (byte)(hash >> (8 * i));
+    }
+    test_device_send(device, packet, sizeof(packet));
+}
+
+// Answers the increment command, whose request and response are both an integer, with its
+// request plus one
+static void test_device_send_command_response(
+    TEST_DEVICE* device,
+    const byte* packet,
+    size_t length)
+{
+    byte response[TEST_PACKET_SIZE];
+    int32_t value = 0;
+    size_t dataOffset = SERIALPNP_PACKET_NAME_OFFSET + packet[SERIALPNP_PACKET_NAME_LENGTH_OFFSET];
+
+    if (dataOffset + sizeof(value) != length)
+    {
+        return;
+    }
+    memcpy(response, packet, length);
+    memcpy(&value, packet + dataOffset, sizeof(value));
+    value++;
+    memcpy(response + dataOffset, &value, sizeof(value));
+    response[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_COMMAND_RESPONSE;
+    test_device_send(device, response, length);
+}
+
+static void test_device_handle_packet(
+    TEST_DEVICE* device,
+    const byte* packet,
+    size_t length)
+{
+    switch (packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET])
+    {
+        case SERIALPNP_PACKET_TYPE_RESET_REQUEST:
+            Lock(g_lock);
+            device->Resets++;
+            Unlock(g_lock);
+            test_device_send_hash(device, SERIALPNP_PACKET_TYPE_RESET_RESPONSE);
+            break;
+
+        case SERIALPNP_PACKET_TYPE_DESCRIPTOR_REQUEST:
+            Lock(g_lock);
+            device->DescriptorRequests++;
+            Unlock(g_lock);
+            test_device_send(device, device->Descriptor, device->DescriptorLength);
+            break;
+
+        case SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_REQUEST:
+            Lock(g_lock);
+            device->HashRequests++;
+            Unlock(g_lock);
+            test_device_send_hash(device, SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_RESPONSE);
+            break;
+
+        case SERIALPNP_PACKET_TYPE_COMMAND_REQUEST:
+            Lock(g_lock);
+            device->CommandRequests++;
+            Unlock(g_lock);
+            test_device_send_command_response(device, packet, length);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static int test_device_worker(
+    void* context)
+{
+    TEST_DEVICE* device = (TEST_DEVICE*)context;
+    byte buffer[TEST_PACKET_SIZE];
+
+    while (!test_device_stopping(device))
+    {
+        struct pollfd pfd = { device->Master, POLLIN, 0 };
+        if ((poll(&pfd, 1, TEST_POLL_MS) <= 0) || (0 == (pfd.revents & POLLIN)))
+        {
+            continue;
+        }
+
+        ssize_t received = read(device->Master, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < received; i++)
+        {
+            byte inb = buffer[i];
+            if (SERIALPNP_START_OF_FRAME_BYTE == inb)
+            {
+                device->RxLength = 0;
+                device->RxEscaped = false;
+                continue;
+            }
+            if (SERIALPNP_ESCAPE_BYTE == inb)
+            {
+                device->RxEscaped = true;
+                continue;
+            }
+            if (device->RxEscaped)
+            {
+                inb++;
+                device->RxEscaped = false;
+            }
+            if (device->RxLength >= TEST_PACKET_SIZE)
+            {
+                device->RxLength = 0;
+            }
+            device->RxBuffer[device->RxLength++] = inb;
+
+            if ((device->RxLength >= SERIALPNP_MIN_PACKET_LENGTH) &&
+                (device->RxLength == (size_t)(device->RxBuffer[0] | (device->RxBuffer[1] << 8))))
+            {
+                test_device_handle_packet(device, device->RxBuffer, device->RxLength);
+                device->RxLength = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void test_put_byte(
+    TEST_DEVICE* device,
+    byte value)
+{
+    device->Descriptor[device->DescriptorLength++] = value;
+}
+
+static void test_put_text(
+    TEST_DEVICE* device,
+    const char* text)
+{
+    size_t length = strlen(text);
+    test_put_byte(device, (byte)length);
+    memcpy(device->Descriptor + device->DescriptorLength, text, length);
+    device->DescriptorLength += length;
+}
+
+static void test_put_interface(
+    TEST_DEVICE* device,
+    const char* id)
+{
+    size_t length = strlen(id);
+    test_put_byte(device, 0x05);
+    test_put_byte(device, (byte)(length & 0xFF));
+    test_put_byte(device, (byte)(length >> 8));
+    memcpy(device->Descriptor + device->DescriptorLength, id, length);
+    device->DescriptorLength += length;
+}
+
+// Adds a writable integer property, named, displayed and without a description or unit
+static void test_put_property(
+    TEST_DEVICE* device,
+    const char* name)
+{
+    test_put_byte(device, 0x02);
+    test_put_text(device, name);
+    test_put_text(device, name);
+    test_put_text(device, "");
+    test_put_text(device, "");
+    test_put_byte(device, (byte)Int);
+    test_put_byte(device, 0);
+    test_put_byte(device, 0x01);
+}
+
+// Adds a command taking and returning an integer
+static void test_put_command(
+    TEST_DEVICE* device,
+    const char* name)
+{
+    test_put_byte(device, 0x01);
+    test_put_text(device, name);
+    test_put_text(device, name);
+    test_put_text(device, "");
+    test_put_byte(device, (byte)Int);
+    test_put_byte(device, 0);
+    test_put_byte(device, (byte)Int);
+    test_put_byte(device, 0);
+}
+
+// Builds the descriptor of the device: two interfaces with integer properties a and another, the
+// first of which also has the increment command
+static void test_build_descriptor(
+    TEST_DEVICE* device,
+    const char* propertyName)
+{
+    device->DescriptorLength = SERIALPNP_MIN_PACKET_LENGTH;
+    test_put_byte(device, 1);
+    test_put_text(device, "test device");
+    test_put_interface(device, "urn:test:first:1");
+    test_put_property(device, "a");
+    test_put_property(device, propertyName);
+    test_put_command(device, TEST_COMMAND_NAME);
+    test_put_interface(device, "urn:test:second:1");
+    test_put_property(device, "a");
+    test_put_property(device, propertyName);
+
+    device->Descriptor[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = (byte)(device->DescriptorLength & 0xFF);
+    device->Descriptor[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = (byte)(device->DescriptorLength >> 8);
+    device->Descriptor[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_DESCRIPTOR_RESPONSE;
+    device->Descriptor[SERIALPNP_PACKET_FLAGS_OFFSET] = 0;
+}
+
+static void test_device_start(
+    TEST_DEVICE* device)
+{
+    struct termios settings;
+    const char* terminalName = NULL;
+
+    memset(device, 0, sizeof(*device));
+    test_build_descriptor(device, "b");
+
+    device->Master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT_IS_TRUE(device->Master >= 0);
+    ASSERT_ARE_EQUAL(int, 0, grantpt(device->Master));
+    ASSERT_ARE_EQUAL(int, 0, unlockpt(device->Master));
+    ASSERT_IS_NOT_NULL(terminalName = ptsname(device->Master));
+    (void)snprintf(device->PortName, sizeof(device->PortName), "%s", terminalName);
+    device->Terminal = open(device->PortName, O_RDWR | O_NOCTTY);
+    ASSERT_IS_TRUE(device->Terminal >= 0);
+
+    // Frames are binary, so nothing may be translated or buffered up to a line end on the way
+    ASSERT_ARE_EQUAL(int, 0, tcgetattr(device->Terminal, &settings));
+    cfmakeraw(&settings);
+    ASSERT_ARE_EQUAL(int, 0, tcsetattr(device->Terminal, TCSANOW, &settings));
+
+    ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&device->Worker, test_device_worker, device));
+}
+
+static void test_device_stop(
+    TEST_DEVICE* device)
+{
+    Lock(g_lock);
+    device->Stopping = true;
+    Unlock(g_lock);
+    ThreadAPI_Join(device->Worker, NULL);
+    (void)close(device->Terminal);
+    (void)close(device->Master);
+}
+
+static int test_get_device_count(
+    const int* count)
+{
+    Lock(g_lock);
+    int value = *count;
+    Unlock(g_lock);
+    return value;
+}
+
+// Waits for the device to have received a number of requests of a kind
+static void test_wait_for_requests(
+    const int* count,
+    int expected)
+{
+    for (int waited = 0; (test_get_device_count(count) < expected) && (waited < TEST_PATCH_TIMEOUT_MS); waited += TEST_POLL_MS)
+    {
+        ThreadAPI_Sleep(TEST_POLL_MS);
+    }
+}
+
+static void test_create_adapter(void)
+{
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.createAdapter(NULL, &g_adapterContext));
+}
+
+// Creates the adapter with a descriptor cache in a directory of its own
+static void test_create_adapter_with_cache(void)
+{
+    char config[TEST_CONFIG_LENGTH];
+
+    (void)snprintf(g_cachePath, sizeof(g_cachePath), "/tmp/serial_pnp_adapter_ut_XXXXXX");
+    ASSERT_IS_NOT_NULL(mkdtemp(g_cachePath));
+    (void)snprintf(config, sizeof(config), "{\"" PNP_CONFIG_ADAPTER_SERIALPNP_DESCRIPTOR_CACHE_PATH "\":\"%s\"}", g_cachePath);
+
+    g_adapterConfig = json_parse_string(config);
+    ASSERT_IS_NOT_NULL(g_adapterConfig);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.createAdapter(json_value_get_object(g_adapterConfig), &g_adapterContext));
+}
+
+static void test_destroy_adapter(void)
+{
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.destroyAdapter(&g_adapterContext));
+    if (NULL != g_adapterConfig)
+    {
+        SerialPnp_RemoveCachedDescriptor(g_cachePath, g_device.PortName);
+        (void)rmdir(g_cachePath);
+        json_value_free(g_adapterConfig);
+        g_adapterConfig = NULL;
+    }
+}
+
+// Caches a descriptor for the port of the device, as an earlier run of the bridge would have
+static void test_store_cached_descriptor(
+    const char* propertyName,
+    uint32_t hashChange)
+{
+    TEST_DEVICE cachedDevice;
+
+    test_build_descriptor(&cachedDevice, propertyName);
+    uint32_t hash = SerialPnp_DescriptorHash(cachedDevice.Descriptor, (DWORD)cachedDevice.DescriptorLength);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_StoreCachedDescriptor(g_cachePath, g_device.PortName,
+        cachedDevice.Descriptor, (DWORD)cachedDevice.DescriptorLength, hash + hashChange));
+}
+
+// Checks that the cache holds the descriptor of the device
+static void test_assert_device_descriptor_cached(void)
+{
+    byte* descriptor = NULL;
+    DWORD length = 0;
+    uint32_t hash = 0;
+
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_LoadCachedDescriptor(g_cachePath, g_device.PortName, &descriptor, &length, &hash));
+    ASSERT_ARE_EQUAL(int, g_device.DescriptorLength, length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_device.Descriptor, descriptor, length));
+    ASSERT_ARE_EQUAL(int, SerialPnp_DescriptorHash(g_device.Descriptor, (DWORD)g_device.DescriptorLength), hash);
+    free(descriptor);
+}
+
+// Creates and starts a component exposing an interface of the device
+static void test_start_component(
+    int index,
+    const char* name,
+    int interfaceIndex)
+{
+    TEST_COMPONENT* component = &g_components[index];
+    char config[TEST_CONFIG_LENGTH];
+
+    (void)snprintf(component->Name, sizeof(component->Name), "%s", name);
+    (void)snprintf(config, sizeof(config),
+        "{\"" PNP_CONFIG_ADAPTER_SERIALPNP_COMPORT "\":\"%s\",\"" PNP_CONFIG_ADAPTER_SERIALPNP_BAUDRATE "\":\"115200\",\"" PNP_CONFIG_ADAPTER_SERIALPNP_INTERFACE_INDEX "\":\"%d\"}",
+        g_device.PortName, interfaceIndex);
+
+    component->Config = json_parse_string(config);
+    ASSERT_IS_NOT_NULL(component->Config);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.createPnpComponent(&g_adapterContext, component->Name,
+        json_value_get_object(component->Config), component));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.startPnpComponent(&g_adapterContext, component));
+}
+
+static void test_stop_component(
+    int index)
+{
+    TEST_COMPONENT* component = &g_components[index];
+
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.stopPnpComponent(component));
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnpInterface.destroyPnpComponent(component));
+    json_value_free(component->Config);
+    component->Config = NULL;
+}
+
+// Hands the adapter a property notification from the device, as its reader does
+static void test_notify_property(
+    int index,
+    const char* name,
+    int32_t value)
+{
+    PSERIAL_COMPONENT_CONTEXT component = (PSERIAL_COMPONENT_CONTEXT)g_components[index].Context;
+    byte packet[TEST_PACKET_SIZE];
+    size_t nameLength = strlen(name);
+    size_t length = SERIALPNP_PACKET_NAME_OFFSET + nameLength + sizeof(value);
+
+    memset(packet, 0, sizeof(packet));
+    packet[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = (byte)(length & 0xFF);
+    packet[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = (byte)(length >> 8);
+    packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_PROPERTY_NOTIFICATION;
+    packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET] = (byte)component->InterfaceIndex;
+    packet[SERIALPNP_PACKET_NAME_LENGTH_OFFSET] = (byte)nameLength;
+    memcpy(packet + SERIALPNP_PACKET_NAME_OFFSET, name, nameLength);
+    memcpy(packet + SERIALPNP_PACKET_NAME_OFFSET + nameLength, &value, sizeof(value));
+
+    SerialPnp_UnsolicitedPacket(component->Device, packet, (DWORD)length);
+}
+
+// Invokes the increment command on a component as the bridge does, and returns the response
+static int32_t test_invoke_increment(
+    int index,
+    int32_t value)
+{
+    TEST_COMPONENT* component = &g_components[index];
+    char request[TEST_NAME_LENGTH];
+    unsigned char* response = NULL;
+    size_t responseSize = 0;
+
+    (void)snprintf(request, sizeof(request), "%d", (int)value);
+    JSON_Value* requestValue = json_value_init_string(request);
+    ASSERT_IS_NOT_NULL(requestValue);
+    int status = component->CommandCallback(component, TEST_COMMAND_NAME, requestValue, &response, &responseSize);
+    json_value_free(requestValue);
+
+    ASSERT_ARE_EQUAL(int, PNP_STATUS_SUCCESS, status);
+    ASSERT_IS_NOT_NULL(response);
+    ASSERT_ARE_EQUAL(size_t, strlen((char*)response), responseSize);
+    int32_t result = (int32_t)strtol((char*)response, NULL, 10);
+    free(response);
+    return result;
+}
+#endif
+
+BEGIN_TEST_SUITE(serial_pnp_adapter_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    g_lock = Lock_Init();
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    Lock_Deinit(g_lock);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    memset(g_components, 0, sizeof(g_components));
+    g_adapterContext = NULL;
+    g_adapterConfig = NULL;
+    g_patchCount = 0;
+}
+
+TEST_FUNCTION_CLEANUP(TestMethodCleanup)
+{
+    for (int i = 0; i < g_patchCount; i++)
+    {
+        free(g_patches[i]);
+        g_patches[i] = NULL;
+    }
+    g_patchCount = 0;
+}
+
+#ifndef WIN32
+TEST_FUNCTION(SerialPnp_commands_get_the_response_of_the_device)
+{
+    // arrange
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+    ASSERT_IS_NOT_NULL(tickCounter);
+    test_device_start(&g_device);
+    test_create_adapter();
+    test_start_component(0, "first", 0);
+    ASSERT_IS_NOT_NULL(g_components[0].CommandCallback);
+
+    // act: the device answers at once, so its response can arrive before the adapter waits for it
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int32_t value = 0; value < TEST_COMMANDS; value++)
+    {
+        ASSERT_ARE_EQUAL(int, value + 1, test_invoke_increment(0, value));
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+    tickcounter_destroy(tickCounter);
+    int commandRequests = test_get_device_count(&g_device.CommandRequests);
+
+    test_stop_component(0);
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: no response was missed and waited out
+    ASSERT_ARE_EQUAL(int, TEST_COMMANDS, commandRequests);
+    ASSERT_IS_TRUE(end - start < TEST_COMMANDS_TIMEOUT_MS);
+}
+
+TEST_FUNCTION(SerialPnp_property_notifications_are_coalesced_into_one_patch_per_component)
+{
+    // arrange: two components share the link, one per interface of the device
+    test_device_start(&g_device);
+    test_create_adapter();
+    test_start_component(0, "first", 0);
+    test_start_component(1, "second", 1);
+
+    // act: the device reports changes to both of them within the coalescing window
+    test_notify_property(0, "a", 1);
+    test_notify_property(1, "a", 10);
+    test_notify_property(0, "b", 2);
+    test_notify_property(1, "b", 20);
+    int patchCount = test_wait_for_patches(2);
+
+    test_stop_component(1);
+    test_stop_component(0);
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: each component reported all of its changes in a patch of its own
+    ASSERT_ARE_EQUAL(int, 2, patchCount);
+    for (int i = 0; i < patchCount; i++)
+    {
+        JSON_Value* patch = json_parse_string(g_patches[i]);
+        ASSERT_IS_NOT_NULL(patch);
+        ASSERT_ARE_EQUAL(int, 1, (int)json_object_get_count(json_value_get_object(patch)));
+
+        JSON_Object* first = test_get_patch_component(patch, "first");
+        JSON_Object* second = test_get_patch_component(patch, "second");
+        ASSERT_IS_TRUE((NULL == first) != (NULL == second));
+        JSON_Object* properties = (NULL != first) ? first : second;
+        int scale = (NULL != first) ? 1 : 10;
+        ASSERT_ARE_EQUAL(int, 3, (int)json_object_get_count(properties));
+        ASSERT_ARE_EQUAL(int, 1 * scale, (int)json_object_get_number(properties, "a"));
+        ASSERT_ARE_EQUAL(int, 2 * scale, (int)json_object_get_number(properties, "b"));
+        ASSERT_ARE_EQUAL(char_ptr, "c", json_object_get_string(properties, "__t"));
+        json_value_free(patch);
+    }
+}
+
+TEST_FUNCTION(SerialPnp_property_notifications_report_the_latest_value)
+{
+    // arrange
+    test_device_start(&g_device);
+    test_create_adapter();
+    test_start_component(0, "first", 0);
+
+    // act: a property changes several times within the coalescing window
+    for (int32_t value = 1; value <= 5; value++)
+    {
+        test_notify_property(0, "a", value);
+        test_notify_property(0, "b", -value);
+    }
+    int patchCount = test_wait_for_patches(1);
+
+    test_stop_component(0);
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: only the last value of each property was reported
+    ASSERT_ARE_EQUAL(int, 1, patchCount);
+    JSON_Value* patch = json_parse_string(g_patches[0]);
+    JSON_Object* properties = test_get_patch_component(patch, "first");
+    ASSERT_IS_NOT_NULL(properties);
+    ASSERT_ARE_EQUAL(int, 5, (int)json_object_get_number(properties, "a"));
+    ASSERT_ARE_EQUAL(int, -5, (int)json_object_get_number(properties, "b"));
+    json_value_free(patch);
+}
+
+TEST_FUNCTION(SerialPnp_property_notifications_of_unchanged_values_are_not_reported)
+{
+    // arrange: the twin holds a = 1 and b = 2
+    test_device_start(&g_device);
+    test_create_adapter();
+    test_start_component(0, "first", 0);
+    test_notify_property(0, "a", 1);
+    test_notify_property(0, "b", 2);
+    ASSERT_ARE_EQUAL(int, 1, test_wait_for_patches(1));
+
+    // act: the device reports the same values again, and a change that it takes back within the
+    // window, and then one real change
+    test_notify_property(0, "a", 1);
+    test_notify_property(0, "b", 2);
+    test_notify_property(0, "a", 7);
+    test_notify_property(0, "a", 1);
+    int unchangedPatchCount = test_wait_for_patches(2);
+    test_notify_property(0, "a", 1);
+    test_notify_property(0, "b", 3);
+    int patchCount = test_wait_for_patches(2);
+
+    test_stop_component(0);
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: only the change was reported, on its own
+    ASSERT_ARE_EQUAL(int, 1, unchangedPatchCount);
+    ASSERT_ARE_EQUAL(int, 2, patchCount);
+    JSON_Value* patch = json_parse_string(g_patches[1]);
+    JSON_Object* properties = test_get_patch_component(patch, "first");
+    ASSERT_IS_NOT_NULL(properties);
+    ASSERT_IS_FALSE(json_object_has_value(properties, "a"));
+    ASSERT_ARE_EQUAL(int, 3, (int)json_object_get_number(properties, "b"));
+    json_value_free(patch);
+}
+
+TEST_FUNCTION(SerialPnp_cached_descriptor_confirmed_by_the_device_is_used_without_an_exchange)
+{
+    // arrange
+    test_device_start(&g_device);
+    test_create_adapter_with_cache();
+    test_store_cached_descriptor("b", 0);
+
+    // act
+    test_start_component(0, "first", 0);
+    test_wait_for_requests(&g_device.HashRequests, 1);
+    ThreadAPI_Sleep(TEST_SETTLE_MS);
+    test_notify_property(0, "b", 1);
+    int patchCount = test_wait_for_patches(1);
+
+    test_stop_component(0);
+    int resets = g_device.Resets;
+    int descriptorRequests = g_device.DescriptorRequests;
+    test_assert_device_descriptor_cached();
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: the device was only asked for the hash of its descriptor
+    ASSERT_ARE_EQUAL(int, 0, resets);
+    ASSERT_ARE_EQUAL(int, 0, descriptorRequests);
+    ASSERT_ARE_EQUAL(int, 1, patchCount);
+}
+
+TEST_FUNCTION(SerialPnp_cached_descriptor_with_another_hash_is_fetched_again)
+{
+    // arrange: the cache holds the descriptor of an older firmware, which has no property b
+    test_device_start(&g_device);
+    test_create_adapter_with_cache();
+    test_store_cached_descriptor("old", 0);
+
+    // act
+    test_start_component(0, "first", 0);
+    test_wait_for_requests(&g_device.DescriptorRequests, 1);
+    ThreadAPI_Sleep(TEST_SETTLE_MS);
+    test_notify_property(0, "b", 1);
+    int patchCount = test_wait_for_patches(1);
+
+    test_stop_component(0);
+    int resets = g_device.Resets;
+    int descriptorRequests = g_device.DescriptorRequests;
+    test_assert_device_descriptor_cached();
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: the descriptor of the device replaced the cached one, in the adapter and in the cache
+    ASSERT_ARE_EQUAL(int, 0, resets);
+    ASSERT_ARE_EQUAL(int, 1, descriptorRequests);
+    ASSERT_ARE_EQUAL(int, 1, patchCount);
+}
+
+TEST_FUNCTION(SerialPnp_damaged_cached_descriptor_falls_back_to_the_full_exchange)
+{
+    // arrange: the cache entry does not match its own hash
+    test_device_start(&g_device);
+    test_create_adapter_with_cache();
+    test_store_cached_descriptor("b", 1);
+
+    // act
+    test_start_component(0, "first", 0);
+    test_notify_property(0, "b", 1);
+    int patchCount = test_wait_for_patches(1);
+
+    test_stop_component(0);
+    int resets = g_device.Resets;
+    int descriptorRequests = g_device.DescriptorRequests;
+    test_assert_device_descriptor_cached();
+    test_destroy_adapter();
+    test_device_stop(&g_device);
+
+    // assert: the device was reset and asked for its descriptor, which was cached anew
+    ASSERT_ARE_EQUAL(int, 1, resets);
+    ASSERT_ARE_EQUAL(int, 1, descriptorRequests);
+    ASSERT_ARE_EQUAL(int, 1, patchCount);
+}
+#endif
+
+END_TEST_SUITE(serial_pnp_adapter_ut)
@@ -0,0 +1,405 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "testrunnerswitcher.h"
+
+#include "SerialPnP.h"
+#include "serial_pnp_batch.h"
+
+#define TEST_WIRE_BUFFER_SIZE 1024
+#define TEST_THROUGHPUT_BATCHES 100000
+#define TEST_THROUGHPUT_BATCH_SAMPLES 8
+
+// Platform hooks of the device-side library. Everything the device writes is captured
+// so that it can be deframed and fed to the bridge decoder.
+static byte g_wire[TEST_WIRE_BUFFER_SIZE];
+static size_t g_wireLength;
+
+void SerialPnP_PlatformSerialInit()
+{
+}
+
+unsigned int SerialPnP_PlatformSerialAvailable()
+{
+    return 0;
+}
+
+int SerialPnP_PlatformSerialRead()
+{
+    return -1;
+}
+
+void SerialPnP_PlatformSerialWrite(char Character)
+{
+    if (g_wireLength < TEST_WIRE_BUFFER_SIZE)
+    {
+        g_wire[g_wireLength++] = (byte)Character;
+    }
+}
+
+void SerialPnP_PlatformReset()
+{
+}
+
+// Events of the test interface, in descriptor order
+typedef struct TEST_EVENT {
+    const char* Name;
+    Schema DataSchema;
+} TEST_EVENT;
+
+static const TEST_EVENT g_testEvents[] = {
+    { "temperature", Float },
+    { "humidity", Int },
+    { "count", Long },
+    { "door_open", Boolean },
+    { "status", String },
+    { "voltage", Double }
+};
+#define TEST_EVENT_COUNT (sizeof(g_testEvents) / sizeof(g_testEvents[0]))
+
+static EventDefinition g_eventDefinitions[TEST_EVENT_COUNT];
+static InterfaceDefinition g_interface;
+
+// Decoded samples recorded by the test callback
+typedef struct TEST_SAMPLE {
+    const EventDefinition* Event;
+    uint16_t TimeDelta;
+    byte Value[8];
+    byte ValueLength;
+} TEST_SAMPLE;
+
+static TEST_SAMPLE g_samples[SERIALPNP_MAX_BATCH_SAMPLES];
+static int g_sampleCount;
+
+static void test_sample_callback(
+    const EventDefinition* Event,
+    uint16_t TimeDelta,
+    const byte* Value,
+    byte ValueLength,
+    void* Context)
+{
+    (void)Context;
+    if (g_sampleCount < SERIALPNP_MAX_BATCH_SAMPLES)
+    {
+        g_samples[g_sampleCount].Event = Event;
+        g_samples[g_sampleCount].TimeDelta = TimeDelta;
+        memcpy(g_samples[g_sampleCount].Value, Value, ValueLength);
+        g_samples[g_sampleCount].ValueLength = ValueLength;
+    }
+    g_sampleCount++;
+}
+
+static void count_sample_callback(
+    const EventDefinition* Event,
+    uint16_t TimeDelta,
+    const byte* Value,
+    byte ValueLength,
+    void* Context)
+{
+    (void)Event;
+    (void)TimeDelta;
+    (void)Value;
+    (void)ValueLength;
+    (*(int*)Context)++;
+}
+
+// Strips the start of frame byte and escaping from the captured wire bytes, the same
+// way the bridge receiver does, and returns the length of the packet
+static DWORD deframe(byte* Packet)
+{
+    DWORD length = 0;
+    bool escaped = false;
+
+    for (size_t c = 0; c < g_wireLength; c++)
+    {
+        byte b = g_wire[c];
+        if (SERIALPNP_START_OF_FRAME_BYTE == b)
+        {
+            length = 0;
+            escaped = false;
+            continue;
+        }
+        if (SERIALPNP_ESCAPE_BYTE == b)
+        {
+            escaped = true;
+            continue;
+        }
+        if (escaped)
+        {
+            b++;
+            escaped = false;
+        }
+        Packet[length++] = b;
+    }
+
+    return length;
+}
+
+BEGIN_TEST_SUITE(serial_pnp_batch_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    SerialPnP_Setup("Batch Test Device");
+    SerialPnP_NewInterface("http://contoso.com/batch_test");
+
+    g_interface.Id = "http://contoso.com/batch_test";
+    g_interface.Events = singlylinkedlist_create();
+    ASSERT_IS_NOT_NULL(g_interface.Events);
+
+    for (size_t i = 0; i < TEST_EVENT_COUNT; i++)
+    {
+        SerialPnP_NewEvent(g_testEvents[i].Name, "", "", (SerialPnPSchema)g_testEvents[i].DataSchema, "");
+
+        g_eventDefinitions[i].defintion.Name = (char*)g_testEvents[i].Name;
+        g_eventDefinitions[i].DataSchema = g_testEvents[i].DataSchema;
+        ASSERT_IS_NOT_NULL(singlylinkedlist_add(g_interface.Events, &g_eventDefinitions[i]));
+    }
+
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_IndexInterfaceEvents(&g_interface));
+    ASSERT_ARE_EQUAL(int, TEST_EVENT_COUNT, g_interface.EventCount);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    free((void*)g_interface.EventsByIndex);
+    singlylinkedlist_destroy(g_interface.Events);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    g_wireLength = 0;
+    g_sampleCount = 0;
+    memset(g_samples, 0, sizeof(g_samples));
+}
+
+TEST_FUNCTION(SerialPnp_DecodeEventBatch_round_trips_samples)
+{
+    // arrange
+    float temperature = 21.5f;
+    int32_t humidity = 0x5A5AEF5A; // exercises escaping of every byte
+    int64_t count = 1234567890123LL;
+    bool doorOpen = true;
+    double voltage = 3.3;
+    SerialPnPEventSample samples[5] = {
+        { (uint8_t)SerialPnP_GetEventIndex("temperature"), 0, &temperature },
+        { (uint8_t)SerialPnP_GetEventIndex("humidity"), 0, &humidity },
+        { (uint8_t)SerialPnP_GetEventIndex("count"), 0, &count },
+        { (uint8_t)SerialPnP_GetEventIndex("door_open"), 0, &doorOpen },
+        { (uint8_t)SerialPnP_GetEventIndex("voltage"), 0, &voltage }
+    };
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+
+    // act
+    ASSERT_IS_TRUE(SerialPnP_SendEventBatch(samples, 5, false));
+    DWORD length = deframe(packet);
+    IOTHUB_CLIENT_RESULT result = SerialPnp_DecodeEventBatch(&g_interface, packet, length, test_sample_callback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_EVENT_BATCH, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, (int)length, packet[0] | (packet[1] << 8));
+    ASSERT_ARE_EQUAL(int, 5, g_sampleCount);
+
+    ASSERT_IS_TRUE(&g_eventDefinitions[0] == g_samples[0].Event);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[0].Value, &temperature, sizeof(temperature)));
+    ASSERT_IS_TRUE(&g_eventDefinitions[1] == g_samples[1].Event);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[1].Value, &humidity, sizeof(humidity)));
+    ASSERT_IS_TRUE(&g_eventDefinitions[2] == g_samples[2].Event);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[2].Value, &count, sizeof(count)));
+    ASSERT_IS_TRUE(&g_eventDefinitions[3] == g_samples[3].Event);
+    ASSERT_ARE_EQUAL(int, 1, g_samples[3].ValueLength);
+    ASSERT_ARE_EQUAL(int, 1, g_samples[3].Value[0]);
+    ASSERT_IS_TRUE(&g_eventDefinitions[5] == g_samples[4].Event);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[4].Value, &voltage, sizeof(voltage)));
+
+    for (int i = 0; i < 5; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, g_samples[i].TimeDelta);
+    }
+}
+
+TEST_FUNCTION(SerialPnp_DecodeEventBatch_reports_time_deltas)
+{
+    // arrange
+    float t0 = 20.0f;
+    float t1 = 20.5f;
+    float t2 = 21.0f;
+    SerialPnPEventSample samples[3] = {
+        { (uint8_t)SerialPnP_GetEventIndex("temperature"), 0x5A02, &t0 },
+        { (uint8_t)SerialPnP_GetEventIndex("temperature"), 250, &t1 },
+        { (uint8_t)SerialPnP_GetEventIndex("temperature"), 0, &t2 }
+    };
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+
+    // act
+    ASSERT_IS_TRUE(SerialPnP_SendEventBatch(samples, 3, true));
+    DWORD length = deframe(packet);
+    IOTHUB_CLIENT_RESULT result = SerialPnp_DecodeEventBatch(&g_interface, packet, length, test_sample_callback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, 3, g_sampleCount);
+    ASSERT_ARE_EQUAL(int, 0x5A02, g_samples[0].TimeDelta);
+    ASSERT_ARE_EQUAL(int, 250, g_samples[1].TimeDelta);
+    ASSERT_ARE_EQUAL(int, 0, g_samples[2].TimeDelta);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[1].Value, &t1, sizeof(t1)));
+}
+
+static uint32_t test_clock(void)
+{
+    return 0x5AEF1234; // exercises escaping of the timestamp
+}
+
+TEST_FUNCTION(SerialPnp_DecodeEventBatch_skips_the_batch_timestamp)
+{
+    // arrange
+    const char hashRequest[] = { SERIALPNP_START_OF_FRAME_BYTE, SERIALPNP_MIN_PACKET_LENGTH, 0x00,
+        SERIALPNP_PACKET_TYPE_DESCRIPTOR_HASH_REQUEST, SERIALPNP_REQUEST_FLAG_TIMESTAMPS };
+    float t0 = 20.0f;
+    int32_t humidity = 40;
+    SerialPnPEventSample samples[2] = {
+        { (uint8_t)SerialPnP_GetEventIndex("temperature"), 100, &t0 },
+        { (uint8_t)SerialPnP_GetEventIndex("humidity"), 0, &humidity }
+    };
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+    uint32_t timestamp = 0;
+
+    SerialPnP_SetClock(test_clock);
+    ASSERT_ARE_EQUAL(int, sizeof(hashRequest), SerialPnP_RxPushBuffer(hashRequest, sizeof(hashRequest)));
+    SerialPnP_Process();
+    DWORD hashLength = deframe(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_DEVICE_TIME_PACKET_LENGTH, (int)hashLength);
+    ASSERT_ARE_EQUAL(int, 0x34, packet[SERIALPNP_DEVICE_TIME_OFFSET]);
+    ASSERT_ARE_EQUAL(int, 0x5A, packet[SERIALPNP_DEVICE_TIME_OFFSET + 3]);
+    g_wireLength = 0;
+
+    // act
+    ASSERT_IS_TRUE(SerialPnP_SendEventBatch(samples, 2, true));
+    SerialPnP_SetClock(NULL);
+    DWORD length = deframe(packet);
+    bool hasTimestamp = SerialPnp_GetEventBatchTimestamp(packet, length, &timestamp);
+    IOTHUB_CLIENT_RESULT result = SerialPnp_DecodeEventBatch(&g_interface, packet, length, test_sample_callback, NULL);
+
+    // assert
+    ASSERT_IS_TRUE(hasTimestamp);
+    ASSERT_ARE_EQUAL(int, 0x5AEF1234, (int)timestamp);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, 2, g_sampleCount);
+    ASSERT_ARE_EQUAL(int, 100, g_samples[0].TimeDelta);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[0].Value, &t0, sizeof(t0)));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_samples[1].Value, &humidity, sizeof(humidity)));
+}
+
+TEST_FUNCTION(SerialPnP_SendEventBatch_rejects_string_events)
+{
+    // arrange
+    const char* status = "ok";
+    SerialPnPEventSample sample = { (uint8_t)SerialPnP_GetEventIndex("status"), 0, status };
+
+    // act
+    bool sent = SerialPnP_SendEventBatch(&sample, 1, false);
+
+    // assert
+    ASSERT_IS_FALSE(sent);
+    ASSERT_ARE_EQUAL(int, 0, (int)g_wireLength);
+    ASSERT_ARE_EQUAL(int, -1, SerialPnP_GetEventIndex("no_such_event"));
+}
+
+TEST_FUNCTION(SerialPnp_DecodeEventBatch_truncated_packet_produces_no_samples)
+{
+    // arrange
+    float temperature = 21.5f;
+    int32_t humidity = 40;
+    SerialPnPEventSample samples[2] = {
+        { (uint8_t)SerialPnP_GetEventIndex("temperature"), 0, &temperature },
+        { (uint8_t)SerialPnP_GetEventIndex("humidity"), 0, &humidity }
+    };
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+
+    ASSERT_IS_TRUE(SerialPnP_SendEventBatch(samples, 2, false));
+    DWORD length = deframe(packet);
+
+    // act
+    IOTHUB_CLIENT_RESULT result = SerialPnp_DecodeEventBatch(&g_interface, packet, length - 1, test_sample_callback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_SIZE, result);
+    ASSERT_ARE_EQUAL(int, 0, g_sampleCount);
+}
+
+TEST_FUNCTION(SerialPnp_DecodeEventBatch_unknown_event_index_fails)
+{
+    // arrange
+    float temperature = 21.5f;
+    SerialPnPEventSample sample = { (uint8_t)SerialPnP_GetEventIndex("temperature"), 0, &temperature };
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+
+    ASSERT_IS_TRUE(SerialPnP_SendEventBatch(&sample, 1, false));
+    DWORD length = deframe(packet);
+    packet[SERIALPNP_BATCH_SAMPLES_OFFSET] = TEST_EVENT_COUNT;
+
+    // act
+    IOTHUB_CLIENT_RESULT result = SerialPnp_DecodeEventBatch(&g_interface, packet, length, test_sample_callback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_ARG, result);
+    ASSERT_ARE_EQUAL(int, 0, g_sampleCount);
+}
+
+// Encodes, deframes and decodes batches of float samples, and compares the bytes on the
+// wire per sample against sending the same samples one event per packet
+TEST_FUNCTION(SerialPnp_EventBatch_throughput)
+{
+    // arrange
+    float values[TEST_THROUGHPUT_BATCH_SAMPLES];
+    SerialPnPEventSample samples[TEST_THROUGHPUT_BATCH_SAMPLES];
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+    int decodedSamples = 0;
+    size_t batchWireBytes = 0;
+
+    for (int i = 0; i < TEST_THROUGHPUT_BATCH_SAMPLES; i++)
+    {
+        values[i] = 20.0f + i;
+        samples[i].Event = (uint8_t)SerialPnP_GetEventIndex("temperature");
+        samples[i].TimeDelta = (uint16_t)((TEST_THROUGHPUT_BATCH_SAMPLES - 1 - i) * 10);
+        samples[i].Value = &values[i];
+    }
+
+    // act
+    clock_t start = clock();
+    for (int b = 0; b < TEST_THROUGHPUT_BATCHES; b++)
+    {
+        g_wireLength = 0;
+        values[0] = (float)b;
+        ASSERT_IS_TRUE(SerialPnP_SendEventBatch(samples, TEST_THROUGHPUT_BATCH_SAMPLES, true));
+        batchWireBytes += g_wireLength;
+
+        DWORD length = deframe(packet);
+        ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK,
+            SerialPnp_DecodeEventBatch(&g_interface, packet, length, count_sample_callback, &decodedSamples));
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    g_wireLength = 0;
+    SerialPnP_SendEventFloat("temperature", values[1]);
+    size_t singleWireBytes = g_wireLength;
+
+    // assert
+    double totalSamples = (double)TEST_THROUGHPUT_BATCHES * TEST_THROUGHPUT_BATCH_SAMPLES;
+    double batchBytesPerSample = (double)batchWireBytes / totalSamples;
+
+    ASSERT_ARE_EQUAL(int, TEST_THROUGHPUT_BATCHES * TEST_THROUGHPUT_BATCH_SAMPLES, decodedSamples);
+    ASSERT_IS_TRUE(batchBytesPerSample < (double)singleWireBytes);
+
+    (void)printf("event batch: %.0f samples/s encoded and decoded, %.2f wire bytes per sample (single event packet: %u bytes)\r\n",
+        (seconds > 0) ? totalSamples / seconds : 0.0, batchBytesPerSample, (unsigned int)singleWireBytes);
+}
+
+END_TEST_SUITE(serial_pnp_batch_ut)
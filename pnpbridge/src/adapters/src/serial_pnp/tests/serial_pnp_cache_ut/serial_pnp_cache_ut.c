@@ -0,0 +1,251 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIN32
+// For the temporary cache directory
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "testrunnerswitcher.h"
+
+#include "serial_pnp_cache.h"
+
+#define TEST_PORT_NAME "/dev/ttyACM0"
+#define TEST_CACHE_FILE_NAME "serialpnp__dev_ttyACM0.desc"
+#define TEST_PATH_LENGTH 256
+#define TEST_FILE_SIZE 512
+// Magic, format version, hash and length
+#define TEST_CACHE_HEADER_LENGTH 13
+
+static char g_cachePath[TEST_PATH_LENGTH];
+static char g_cacheFileName[2 * TEST_PATH_LENGTH];
+static byte g_descriptor[64];
+static DWORD g_descriptorLength;
+
+// Builds a descriptor response packet with a payload that is different for every seed
+static void test_build_descriptor(
+    byte seed)
+{
+    g_descriptorLength = sizeof(g_descriptor);
+    g_descriptor[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = (byte)g_descriptorLength;
+    g_descriptor[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = 0;
+    g_descriptor[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = SERIALPNP_PACKET_TYPE_DESCRIPTOR_RESPONSE;
+    g_descriptor[SERIALPNP_PACKET_FLAGS_OFFSET] = 0;
+    for (DWORD i = SERIALPNP_PACKET_PAYLOAD_OFFSET; i < g_descriptorLength; i++)
+    {
+        g_descriptor[i] = (byte)(seed + i * 7);
+    }
+}
+
+static size_t test_read_cache_file(
+    byte* contents)
+{
+    FILE* file = fopen(g_cacheFileName, "rb");
+    ASSERT_IS_NOT_NULL(file);
+    size_t length = fread(contents, 1, TEST_FILE_SIZE, file);
+    (void)fclose(file);
+    return length;
+}
+
+static void test_write_cache_file(
+    const byte* contents,
+    size_t length)
+{
+    FILE* file = fopen(g_cacheFileName, "wb");
+    ASSERT_IS_NOT_NULL(file);
+    size_t written = fwrite(contents, 1, length, file);
+    int closeResult = fclose(file);
+    ASSERT_ARE_EQUAL(size_t, length, written);
+    ASSERT_ARE_EQUAL(int, 0, closeResult);
+}
+
+// Stores the test descriptor, and returns the cache entry written for it
+static size_t test_store_entry(
+    byte* contents)
+{
+    test_build_descriptor(1);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_StoreCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        g_descriptor, g_descriptorLength, SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength)));
+    size_t length = test_read_cache_file(contents);
+    ASSERT_ARE_EQUAL(size_t, TEST_CACHE_HEADER_LENGTH + g_descriptorLength, length);
+    return length;
+}
+
+static void test_assert_load_fails(void)
+{
+    byte* descriptor = NULL;
+    DWORD length = 0;
+    uint32_t hash = 0;
+
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_SIZE, SerialPnp_LoadCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        &descriptor, &length, &hash));
+    ASSERT_IS_TRUE(NULL == descriptor);
+    ASSERT_ARE_EQUAL(int, 0, length);
+}
+
+// Stores the test descriptor, changes one byte of its cache entry, and checks that it no longer loads
+static void test_assert_changed_entry_fails(
+    size_t offset,
+    byte value)
+{
+    byte contents[TEST_FILE_SIZE];
+    size_t length = test_store_entry(contents);
+    contents[offset] = value;
+    test_write_cache_file(contents, length);
+    test_assert_load_fails();
+}
+
+BEGIN_TEST_SUITE(serial_pnp_cache_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+}
+
+#ifndef WIN32
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    (void)snprintf(g_cachePath, sizeof(g_cachePath), "/tmp/serial_pnp_cache_ut_XXXXXX");
+    ASSERT_IS_NOT_NULL(mkdtemp(g_cachePath));
+    (void)snprintf(g_cacheFileName, sizeof(g_cacheFileName), "%s/" TEST_CACHE_FILE_NAME, g_cachePath);
+}
+
+TEST_FUNCTION_CLEANUP(TestMethodCleanup)
+{
+    (void)remove(g_cacheFileName);
+    (void)rmdir(g_cachePath);
+}
+
+TEST_FUNCTION(SerialPnp_DescriptorHash_covers_only_the_payload)
+{
+    // arrange
+    test_build_descriptor(1);
+    uint32_t hash = SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength);
+
+    // act
+    g_descriptor[SERIALPNP_PACKET_FLAGS_OFFSET] = 0xFF;
+    uint32_t flaggedHash = SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength);
+    g_descriptor[g_descriptorLength - 1]++;
+    uint32_t changedHash = SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, hash, flaggedHash);
+    ASSERT_IS_TRUE(hash != changedHash);
+}
+
+TEST_FUNCTION(SerialPnp_CachedDescriptor_round_trips)
+{
+    // arrange
+    byte* descriptor = NULL;
+    DWORD length = 0;
+    uint32_t hash = 0;
+    test_build_descriptor(1);
+    uint32_t storedHash = SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength);
+
+    // act
+    IOTHUB_CLIENT_RESULT storeResult = SerialPnp_StoreCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        g_descriptor, g_descriptorLength, storedHash);
+    IOTHUB_CLIENT_RESULT loadResult = SerialPnp_LoadCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        &descriptor, &length, &hash);
+
+    // assert: the entry is named after the port, and holds the descriptor as stored
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, storeResult);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, loadResult);
+    ASSERT_ARE_EQUAL(int, 0, access(g_cacheFileName, F_OK));
+    ASSERT_ARE_EQUAL(int, g_descriptorLength, length);
+    ASSERT_ARE_EQUAL(int, storedHash, hash);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_descriptor, descriptor, length));
+    free(descriptor);
+}
+
+TEST_FUNCTION(SerialPnp_StoreCachedDescriptor_replaces_the_entry_of_the_port)
+{
+    // arrange
+    byte* descriptor = NULL;
+    DWORD length = 0;
+    uint32_t hash = 0;
+    test_build_descriptor(1);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_StoreCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        g_descriptor, g_descriptorLength, SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength)));
+
+    // act
+    test_build_descriptor(2);
+    uint32_t storedHash = SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_StoreCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        g_descriptor, g_descriptorLength, storedHash));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_LoadCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        &descriptor, &length, &hash));
+    ASSERT_ARE_EQUAL(int, storedHash, hash);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_descriptor, descriptor, length));
+    free(descriptor);
+}
+
+TEST_FUNCTION(SerialPnp_LoadCachedDescriptor_without_an_entry_fails)
+{
+    // arrange
+    byte* descriptor = NULL;
+    DWORD length = 0;
+    uint32_t hash = 0;
+    test_build_descriptor(1);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_StoreCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        g_descriptor, g_descriptorLength, SerialPnp_DescriptorHash(g_descriptor, g_descriptorLength)));
+
+    // act
+    SerialPnp_RemoveCachedDescriptor(g_cachePath, TEST_PORT_NAME);
+    IOTHUB_CLIENT_RESULT removedResult = SerialPnp_LoadCachedDescriptor(g_cachePath, TEST_PORT_NAME,
+        &descriptor, &length, &hash);
+    IOTHUB_CLIENT_RESULT otherPortResult = SerialPnp_LoadCachedDescriptor(g_cachePath, "/dev/ttyACM1",
+        &descriptor, &length, &hash);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_ARG, removedResult);
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_INVALID_ARG, otherPortResult);
+    ASSERT_IS_TRUE(NULL == descriptor);
+}
+
+TEST_FUNCTION(SerialPnp_LoadCachedDescriptor_rejects_a_truncated_entry)
+{
+    byte contents[TEST_FILE_SIZE];
+
+    // Cut short in the descriptor
+    size_t length = test_store_entry(contents);
+    test_write_cache_file(contents, length - 1);
+    test_assert_load_fails();
+
+    // Cut short in the header
+    test_write_cache_file(contents, TEST_CACHE_HEADER_LENGTH - 1);
+    test_assert_load_fails();
+}
+
+TEST_FUNCTION(SerialPnp_LoadCachedDescriptor_rejects_a_corrupt_entry)
+{
+    // A damaged payload no longer matches the stored hash
+    test_assert_changed_entry_fails(TEST_CACHE_HEADER_LENGTH + SERIALPNP_PACKET_PAYLOAD_OFFSET + 3, 0xFF);
+    // Nor does a damaged hash
+    test_assert_changed_entry_fails(5, 0xFF);
+    // An entry of another format
+    test_assert_changed_entry_fails(0, 'X');
+    test_assert_changed_entry_fails(4, 2);
+    // A packet whose own length disagrees with the entry
+    test_assert_changed_entry_fails(TEST_CACHE_HEADER_LENGTH + SERIALPNP_PACKET_PACKET_LENGTH_OFFSET, sizeof(g_descriptor) - 1);
+    // A packet that is not a descriptor response
+    test_assert_changed_entry_fails(TEST_CACHE_HEADER_LENGTH + SERIALPNP_PACKET_PACKET_TYPE_OFFSET, SERIALPNP_PACKET_TYPE_RESET_RESPONSE);
+}
+#endif
+
+END_TEST_SUITE(serial_pnp_cache_ut)
@@ -0,0 +1,504 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "SerialPnP.h"
+#include "serial_pnp.h"
+
+#define TEST_WIRE_BUFFER_SIZE 1024
+#define TEST_FRAME_BUFFER_SIZE 256
+#define TEST_THROUGHPUT_FRAMES 100000
+
+// Platform hooks of the device-side library. Received bytes are handed over through
+// SerialPnP_RxPush..., the way an interrupt handler would, so the platform buffer is
+// always empty. Everything the device writes is captured.
+static byte g_wire[TEST_WIRE_BUFFER_SIZE];
+static size_t g_wireLength;
+
+void SerialPnP_PlatformSerialInit()
+{
+}
+
+unsigned int SerialPnP_PlatformSerialAvailable()
+{
+    return 0;
+}
+
+int SerialPnP_PlatformSerialRead()
+{
+    return -1;
+}
+
+void SerialPnP_PlatformSerialWrite(char Character)
+{
+    if (g_wireLength < TEST_WIRE_BUFFER_SIZE)
+    {
+        g_wire[g_wireLength++] = (byte)Character;
+    }
+}
+
+void SerialPnP_PlatformReset()
+{
+}
+
+// Every callback records its calls in its own slot, and answers with its input plus
+// its slot number, or with its slot number alone when read
+typedef struct TEST_CALLBACK_RECORD {
+    int Calls;
+    bool HadInput;
+    int32_t LastInput;
+} TEST_CALLBACK_RECORD;
+
+static TEST_CALLBACK_RECORD g_records[SERIALPNP_MAX_CALLBACK_COUNT];
+static volatile int32_t g_nextSequence;
+static volatile bool g_sequenceBroken;
+
+static void test_record(int Slot, void* Input, void* Output)
+{
+    int32_t input = 0;
+
+    g_records[Slot].Calls++;
+    g_records[Slot].HadInput = (NULL != Input);
+    if (NULL != Input)
+    {
+        memcpy(&input, Input, sizeof(input));
+        g_records[Slot].LastInput = input;
+    }
+    *(int32_t*)Output = input + Slot;
+}
+
+#define TEST_CALLBACK(n) static void test_callback_##n(void* Input, void* Output) { test_record(n, Input, Output); }
+TEST_CALLBACK(0)
+TEST_CALLBACK(1)
+TEST_CALLBACK(2)
+TEST_CALLBACK(3)
+TEST_CALLBACK(4)
+TEST_CALLBACK(5)
+TEST_CALLBACK(6)
+
+// Checks that commands arrive in the order they were sent
+static void test_sequence_callback(void* Input, void* Output)
+{
+    int32_t sequence;
+
+    memcpy(&sequence, Input, sizeof(sequence));
+    if (sequence != g_nextSequence)
+    {
+        g_sequenceBroken = true;
+    }
+    g_nextSequence = sequence + 1;
+    *(int32_t*)Output = sequence;
+}
+
+// Fills every callback slot. "mode" is both a property and a command, and must reach
+// a different callback for each.
+static void define_test_device(void)
+{
+    SerialPnP_Setup("Device Test");
+    SerialPnP_NewInterface("http://contoso.com/device_test");
+    SerialPnP_NewEvent("temperature", "", "", SerialPnPSchema_Float, "celsius");
+    SerialPnP_NewProperty("mode", "", "", "", SerialPnPSchema_Int, false, true, (SerialPnPCb*)test_callback_0);
+    SerialPnP_NewCommand("mode", "", "", SerialPnPSchema_Int, SerialPnPSchema_Int, (SerialPnPCb*)test_callback_1);
+    SerialPnP_NewProperty("sample_rate", "", "", "ms", SerialPnPSchema_Int, false, true, (SerialPnPCb*)test_callback_2);
+    SerialPnP_NewCommand("calibrate", "", "", SerialPnPSchema_Int, SerialPnPSchema_Int, (SerialPnPCb*)test_callback_3);
+    SerialPnP_NewCommand("reboot", "", "", SerialPnPSchema_Int, SerialPnPSchema_Int, (SerialPnPCb*)test_callback_4);
+    SerialPnP_NewProperty("threshold", "", "", "", SerialPnPSchema_Int, false, true, (SerialPnPCb*)test_callback_5);
+    SerialPnP_NewCommand("blink", "", "", SerialPnPSchema_Int, SerialPnPSchema_Int, (SerialPnPCb*)test_callback_6);
+    SerialPnP_NewCommand("sequence", "", "", SerialPnPSchema_Int, SerialPnPSchema_Int, (SerialPnPCb*)test_sequence_callback);
+    SerialPnP_Ready();
+}
+
+// Frames a request to an interface the way the bridge does, and returns its length on the wire
+static size_t frame_interface_request(byte Interface, byte PacketType, const char* Name, const int32_t* Value, byte* Frame)
+{
+    byte packet[TEST_FRAME_BUFFER_SIZE];
+    size_t nameLength = strlen(Name);
+    size_t length = SERIALPNP_PACKET_NAME_OFFSET + nameLength + ((NULL != Value) ? sizeof(*Value) : 0);
+    size_t framed = 0;
+
+    packet[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET] = (byte)(length & 0xFF);
+    packet[SERIALPNP_PACKET_PACKET_LENGTH_OFFSET + 1] = (byte)(length >> 8);
+    packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET] = PacketType;
+    packet[3] = 0;
+    packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET] = Interface;
+    packet[SERIALPNP_PACKET_NAME_LENGTH_OFFSET] = (byte)nameLength;
+    memcpy(&packet[SERIALPNP_PACKET_NAME_OFFSET], Name, nameLength);
+    if (NULL != Value)
+    {
+        memcpy(&packet[SERIALPNP_PACKET_NAME_OFFSET + nameLength], Value, sizeof(*Value));
+    }
+
+    Frame[framed++] = SERIALPNP_START_OF_FRAME_BYTE;
+    for (size_t i = 0; i < length; i++)
+    {
+        if ((SERIALPNP_START_OF_FRAME_BYTE == packet[i]) || (SERIALPNP_ESCAPE_BYTE == packet[i]))
+        {
+            Frame[framed++] = SERIALPNP_ESCAPE_BYTE;
+            Frame[framed++] = (byte)(packet[i] - 1);
+        }
+        else
+        {
+            Frame[framed++] = packet[i];
+        }
+    }
+
+    return framed;
+}
+
+static size_t frame_request(byte PacketType, const char* Name, const int32_t* Value, byte* Frame)
+{
+    return frame_interface_request(0, PacketType, Name, Value, Frame);
+}
+
+// Deframes the captured wire bytes and returns the length of the last packet
+static size_t deframe_last(byte* Packet)
+{
+    size_t length = 0;
+    bool escaped = false;
+
+    for (size_t c = 0; c < g_wireLength; c++)
+    {
+        byte b = g_wire[c];
+        if (SERIALPNP_START_OF_FRAME_BYTE == b)
+        {
+            length = 0;
+            escaped = false;
+            continue;
+        }
+        if (SERIALPNP_ESCAPE_BYTE == b)
+        {
+            escaped = true;
+            continue;
+        }
+        if (escaped)
+        {
+            b++;
+            escaped = false;
+        }
+        Packet[length++] = b;
+    }
+
+    return length;
+}
+
+static int32_t response_value(const byte* Packet, size_t Length)
+{
+    int32_t value;
+    memcpy(&value, &Packet[Length - sizeof(value)], sizeof(value));
+    return value;
+}
+
+static int test_producer(void* Context)
+{
+    (void)Context;
+
+    for (int32_t sequence = 0; sequence < TEST_THROUGHPUT_FRAMES; sequence++)
+    {
+        byte frame[TEST_FRAME_BUFFER_SIZE];
+        size_t length = frame_request(SERIALPNP_PACKET_TYPE_COMMAND_REQUEST, "sequence", &sequence, frame);
+        size_t pushed = 0;
+
+        while (pushed < length)
+        {
+            uint16_t queued = SerialPnP_RxPushBuffer((const char*)frame + pushed, (uint16_t)(length - pushed));
+            if (0 == queued)
+            {
+                // Let the consumer run when both share a core
+                ThreadAPI_Sleep(0);
+            }
+            pushed += queued;
+        }
+    }
+
+    return 0;
+}
+
+BEGIN_TEST_SUITE(serial_pnp_device_ut)
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    define_test_device();
+    g_wireLength = 0;
+    g_nextSequence = 0;
+    g_sequenceBroken = false;
+    memset(g_records, 0, sizeof(g_records));
+}
+
+TEST_FUNCTION(SerialPnP_Process_reassembles_packet_split_across_calls)
+{
+    // arrange
+    int32_t input = 0x5AEF5A01; // escaped on the wire
+    byte frame[TEST_FRAME_BUFFER_SIZE];
+    byte packet[TEST_FRAME_BUFFER_SIZE];
+    size_t length = frame_request(SERIALPNP_PACKET_TYPE_COMMAND_REQUEST, "calibrate", &input, frame);
+
+    // act
+    for (size_t i = 0; i < length; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, g_records[3].Calls);
+        ASSERT_IS_TRUE(SerialPnP_RxPush((char)frame[i]));
+        SerialPnP_Process();
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, g_records[3].Calls);
+    ASSERT_ARE_EQUAL(int, input, g_records[3].LastInput);
+
+    size_t responseLength = deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_COMMAND_RESPONSE, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, (int)responseLength, packet[0] | (packet[1] << 8));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(&packet[SERIALPNP_PACKET_NAME_OFFSET], "calibrate", 9));
+    ASSERT_ARE_EQUAL(int, input + 3, response_value(packet, responseLength));
+}
+
+TEST_FUNCTION(SerialPnP_Process_dispatches_property_and_command_with_same_name)
+{
+    // arrange
+    int32_t input = 7;
+    byte frames[2 * TEST_FRAME_BUFFER_SIZE];
+    byte packet[TEST_FRAME_BUFFER_SIZE];
+    size_t length = frame_request(SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST, "mode", NULL, frames);
+    length += frame_request(SERIALPNP_PACKET_TYPE_COMMAND_REQUEST, "mode", &input, frames + length);
+
+    // act
+    ASSERT_ARE_EQUAL(int, (int)length, SerialPnP_RxPushBuffer((const char*)frames, (uint16_t)length));
+    SerialPnP_Process();
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, g_records[0].Calls);
+    ASSERT_IS_FALSE(g_records[0].HadInput);
+    ASSERT_ARE_EQUAL(int, 1, g_records[1].Calls);
+    ASSERT_IS_TRUE(g_records[1].HadInput);
+    ASSERT_ARE_EQUAL(int, input, g_records[1].LastInput);
+
+    size_t responseLength = deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_COMMAND_RESPONSE, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, input + 1, response_value(packet, responseLength));
+}
+
+TEST_FUNCTION(SerialPnP_SendPropertyInt_is_not_sent_as_a_property_response)
+{
+    // arrange
+    int32_t input = 20;
+    byte frame[TEST_FRAME_BUFFER_SIZE];
+    byte packet[TEST_FRAME_BUFFER_SIZE];
+    size_t length = frame_request(SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST, "sample_rate", &input, frame);
+    ASSERT_ARE_EQUAL(int, (int)length, SerialPnP_RxPushBuffer((const char*)frame, (uint16_t)length));
+    SerialPnP_Process();
+    (void)deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_PROPERTY_RESPONSE, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+
+    // act
+    SerialPnP_SendPropertyInt("sample_rate", 50);
+
+    // assert: the bridge reports the change, and ignores the answer to its own write
+    size_t notificationLength = deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_PROPERTY_NOTIFICATION, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(&packet[SERIALPNP_PACKET_NAME_OFFSET], "sample_rate", 11));
+    ASSERT_ARE_EQUAL(int, 50, response_value(packet, notificationLength));
+}
+
+TEST_FUNCTION(SerialPnP_Process_dispatches_each_interface_to_its_own_callbacks)
+{
+    // arrange: both interfaces have a "mode" property, and only the second one an "alarm" event
+    int32_t input = 3;
+    byte frame[TEST_FRAME_BUFFER_SIZE];
+    byte packet[TEST_FRAME_BUFFER_SIZE];
+    SerialPnP_Setup("Device Test");
+    SerialPnP_NewInterface("http://contoso.com/device_test");
+    SerialPnP_NewProperty("mode", "", "", "", SerialPnPSchema_Int, false, true, (SerialPnPCb*)test_callback_0);
+    SerialPnP_NewInterface("http://contoso.com/device_test_alarm");
+    SerialPnP_NewProperty("mode", "", "", "", SerialPnPSchema_Int, false, true, (SerialPnPCb*)test_callback_1);
+    SerialPnP_NewEvent("alarm", "", "", SerialPnPSchema_Int, "");
+    SerialPnP_Ready();
+    size_t length = frame_interface_request(1, SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST, "mode", &input, frame);
+
+    // act
+    ASSERT_ARE_EQUAL(int, (int)length, SerialPnP_RxPushBuffer((const char*)frame, (uint16_t)length));
+    SerialPnP_Process();
+
+    // assert: the write reaches the second interface, and is answered from it
+    ASSERT_ARE_EQUAL(int, 0, g_records[0].Calls);
+    ASSERT_ARE_EQUAL(int, 1, g_records[1].Calls);
+    size_t responseLength = deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_PROPERTY_RESPONSE, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, 1, packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET]);
+    ASSERT_ARE_EQUAL(int, input + 1, response_value(packet, responseLength));
+
+    // events are sent on the interface that defines them
+    SerialPnP_SendEventInt("alarm", 1);
+    (void)deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_EVENT_NOTIFICATION, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, 1, packet[SERIALPNP_PACKET_INTERFACE_NUMBER_OFFSET]);
+}
+
+TEST_FUNCTION(SerialPnP_Process_unknown_name_answers_without_callback)
+{
+    // arrange
+    int32_t input = 1;
+    byte frame[TEST_FRAME_BUFFER_SIZE];
+    byte packet[TEST_FRAME_BUFFER_SIZE];
+    size_t length = frame_request(SERIALPNP_PACKET_TYPE_COMMAND_REQUEST, "sample_rate", &input, frame);
+
+    // act
+    ASSERT_ARE_EQUAL(int, (int)length, SerialPnP_RxPushBuffer((const char*)frame, (uint16_t)length));
+    SerialPnP_Process();
+
+    // assert
+    for (int i = 0; i < SERIALPNP_MAX_CALLBACK_COUNT; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, g_records[i].Calls);
+    }
+    size_t responseLength = deframe_last(packet);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_COMMAND_RESPONSE, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, -1, response_value(packet, responseLength));
+}
+
+TEST_FUNCTION(SerialPnP_Process_discards_packet_longer_than_receive_buffer)
+{
+    // arrange
+    byte frame[TEST_FRAME_BUFFER_SIZE];
+    size_t length = 0;
+    int32_t input = 3;
+
+    // The oversized packet is a write of "threshold" followed by filler, so it would
+    // reach a callback if it were not skipped as a whole
+    frame[length++] = SERIALPNP_START_OF_FRAME_BYTE;
+    frame[length++] = (byte)(SERIALPNP_RXBUFFER_SIZE + 20);
+    frame[length++] = 0;
+    frame[length++] = SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST;
+    frame[length++] = 0;
+    frame[length++] = 0;
+    frame[length++] = 9;
+    memcpy(&frame[length], "threshold", 9);
+    length += 9;
+    while (length < 1 + SERIALPNP_RXBUFFER_SIZE + 20)
+    {
+        frame[length++] = 0x11;
+    }
+    length += frame_request(SERIALPNP_PACKET_TYPE_COMMAND_REQUEST, "blink", &input, frame + length);
+
+    // act
+    size_t pushed = 0;
+    while (pushed < length)
+    {
+        pushed += SerialPnP_RxPushBuffer((const char*)frame + pushed, (uint16_t)(length - pushed));
+        SerialPnP_Process();
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, g_records[5].Calls);
+    ASSERT_ARE_EQUAL(int, 1, g_records[6].Calls);
+    ASSERT_ARE_EQUAL(int, input, g_records[6].LastInput);
+}
+
+TEST_FUNCTION(SerialPnP_RxPush_reports_full_ring)
+{
+    // arrange
+    char block[SERIALPNP_RXRING_SIZE + 8];
+    memset(block, 0x11, sizeof(block));
+
+    // act
+    uint16_t queued = SerialPnP_RxPushBuffer(block, sizeof(block));
+    bool pushedWhenFull = SerialPnP_RxPush(0x11);
+    SerialPnP_Process();
+    bool pushedAfterProcess = SerialPnP_RxPush(0x11);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, SERIALPNP_RXRING_SIZE, queued);
+    ASSERT_IS_FALSE(pushedWhenFull);
+    ASSERT_IS_TRUE(pushedAfterProcess);
+}
+
+TEST_FUNCTION(SerialPnP_Setup_truncates_descriptor_that_does_not_fit)
+{
+    // arrange
+    char name[32];
+    byte packet[TEST_WIRE_BUFFER_SIZE];
+    int defined = 0;
+
+    SerialPnP_Setup("Device Test");
+    SerialPnP_NewInterface("http://contoso.com/device_test");
+    for (int i = 0; i < SERIALPNP_MAX_EVENT_COUNT; i++)
+    {
+        (void)sprintf(name, "event_with_a_long_name_%02d", i);
+        SerialPnP_NewEvent(name, name, name, SerialPnPSchema_Float, "");
+    }
+    for (int i = 0; i < SERIALPNP_MAX_EVENT_COUNT; i++)
+    {
+        (void)sprintf(name, "event_with_a_long_name_%02d", i);
+        if (SerialPnP_GetEventIndex(name) == i)
+        {
+            defined++;
+        }
+    }
+
+    // act
+    g_wireLength = 0;
+    byte request[TEST_FRAME_BUFFER_SIZE];
+    request[0] = SERIALPNP_START_OF_FRAME_BYTE;
+    request[1] = SERIALPNP_MIN_PACKET_LENGTH;
+    request[2] = 0;
+    request[3] = SERIALPNP_PACKET_TYPE_DESCRIPTOR_REQUEST;
+    request[4] = 0;
+    ASSERT_ARE_EQUAL(int, 5, SerialPnP_RxPushBuffer((const char*)request, 5));
+    SerialPnP_Process();
+    size_t length = deframe_last(packet);
+
+    // assert
+    ASSERT_IS_TRUE(defined > 0);
+    ASSERT_IS_TRUE(defined < SERIALPNP_MAX_EVENT_COUNT);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_PACKET_TYPE_DESCRIPTOR_RESPONSE, packet[SERIALPNP_PACKET_PACKET_TYPE_OFFSET]);
+    ASSERT_ARE_EQUAL(int, (int)length, packet[0] | (packet[1] << 8));
+    ASSERT_IS_TRUE(length <= SERIALPNP_MIN_PACKET_LENGTH + SERIALPNP_DESCRIPTOR_SIZE);
+}
+
+// Feeds command frames from another thread, standing in for a receive interrupt, while
+// this thread runs SerialPnP_Process, and reports the rate at which they are dispatched
+TEST_FUNCTION(SerialPnP_Process_interrupt_producer_throughput)
+{
+    // arrange
+    THREAD_HANDLE producer;
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start;
+    tickcounter_ms_t end;
+    ASSERT_IS_NOT_NULL(tickCounter);
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&producer, test_producer, NULL));
+    while (g_nextSequence < TEST_THROUGHPUT_FRAMES)
+    {
+        int32_t dispatched = g_nextSequence;
+
+        g_wireLength = 0;
+        SerialPnP_Process();
+        if (dispatched == g_nextSequence)
+        {
+            ThreadAPI_Sleep(0);
+        }
+    }
+    ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Join(producer, NULL));
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+    tickcounter_destroy(tickCounter);
+
+    // assert
+    ASSERT_IS_FALSE(g_sequenceBroken);
+    ASSERT_ARE_EQUAL(int, TEST_THROUGHPUT_FRAMES, g_nextSequence);
+
+    double seconds = (double)(end - start) / 1000.0;
+    (void)printf("device receive: %.0f commands/s parsed and dispatched through a %d byte ring\r\n",
+        (seconds > 0) ? TEST_THROUGHPUT_FRAMES / seconds : 0.0, SERIALPNP_RXRING_SIZE);
+}
+
+END_TEST_SUITE(serial_pnp_device_ut)
@@ -0,0 +1,365 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "testrunnerswitcher.h"
+
+#include "serial_pnp_format.h"
+
+#define TEST_ROUND_TRIP_VALUES 200000
+#define TEST_BENCHMARK_VALUES 1000000
+
+static uint64_t g_randomState;
+
+// xorshift64, so that every run checks the same values
+static uint64_t test_random(void)
+{
+    g_randomState ^= g_randomState << 13;
+    g_randomState ^= g_randomState >> 7;
+    g_randomState ^= g_randomState << 17;
+    return g_randomState;
+}
+
+// Number of significant digits in a formatted number
+static int test_significant_digits(const char* text)
+{
+    char digits[SERIALPNP_NUMBER_STRING_LENGTH];
+    int count = 0;
+
+    for (; ('\0' != *text) && ('e' != *text); text++)
+    {
+        if ((*text >= '0') && (*text <= '9') && ((count > 0) || ('0' != *text)))
+        {
+            digits[count++] = *text;
+        }
+    }
+    while ((count > 1) && ('0' == digits[count - 1]))
+    {
+        count--;
+    }
+    return count;
+}
+
+static void test_format_value(Schema schema, const void* value, byte length, const char* expected)
+{
+    char* text = SerialPnp_BinarySchemaToString(schema, (const byte*)value, length);
+    ASSERT_IS_NOT_NULL(text);
+    ASSERT_ARE_EQUAL(char_ptr, expected, text);
+    free(text);
+}
+
+static void test_parse_value(Schema schema, const char* text, const void* expected, int expectedLength)
+{
+    int length = 0;
+    byte* value = SerialPnp_StringSchemaToBinary(schema, (byte*)text, &length);
+    ASSERT_IS_NOT_NULL(value);
+    ASSERT_ARE_EQUAL(int, expectedLength, length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(expected, value, expectedLength));
+    free(value);
+}
+
+static void test_parse_rejected(Schema schema, const char* text)
+{
+    int length = 0;
+    byte* value = SerialPnp_StringSchemaToBinary(schema, (byte*)text, &length);
+    ASSERT_IS_TRUE(NULL == value);
+}
+
+BEGIN_TEST_SUITE(serial_pnp_format_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    g_randomState = 88172645463325252ULL;
+}
+
+TEST_FUNCTION(SerialPnp_FormatFloat_writes_shortest_text)
+{
+    char text[SERIALPNP_NUMBER_STRING_LENGTH];
+
+    SerialPnp_FormatFloat(0.1f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "0.1", text);
+    SerialPnp_FormatFloat(21.5f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "21.5", text);
+    SerialPnp_FormatFloat(-40.0f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "-40", text);
+    SerialPnp_FormatFloat(16777216.0f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "16777216", text);
+    SerialPnp_FormatFloat(0.000001f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "0.000001", text);
+    SerialPnp_FormatFloat(-1.5e-7f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "-1.5e-7", text);
+    SerialPnp_FormatFloat(3.4028235e38f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "3.4028235e+38", text);
+    SerialPnp_FormatFloat(1e-45f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "1e-45", text);
+    SerialPnp_FormatFloat(0.0f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "0", text);
+    SerialPnp_FormatFloat(-0.0f, text);
+    ASSERT_ARE_EQUAL(char_ptr, "-0", text);
+    SerialPnp_FormatFloat(NAN, text);
+    ASSERT_ARE_EQUAL(char_ptr, "null", text);
+    SerialPnp_FormatFloat(-INFINITY, text);
+    ASSERT_ARE_EQUAL(char_ptr, "null", text);
+}
+
+TEST_FUNCTION(SerialPnp_FormatDouble_writes_shortest_text)
+{
+    char text[SERIALPNP_NUMBER_STRING_LENGTH];
+
+    SerialPnp_FormatDouble(0.3, text);
+    ASSERT_ARE_EQUAL(char_ptr, "0.3", text);
+    SerialPnp_FormatDouble(2.0 / 3.0, text);
+    ASSERT_ARE_EQUAL(char_ptr, "0.6666666666666666", text);
+    SerialPnp_FormatDouble(1234.5678, text);
+    ASSERT_ARE_EQUAL(char_ptr, "1234.5678", text);
+    SerialPnp_FormatDouble(1e20, text);
+    ASSERT_ARE_EQUAL(char_ptr, "100000000000000000000", text);
+    SerialPnp_FormatDouble(1e21, text);
+    ASSERT_ARE_EQUAL(char_ptr, "1e+21", text);
+    SerialPnp_FormatDouble(5e-324, text);
+    ASSERT_ARE_EQUAL(char_ptr, "5e-324", text);
+    SerialPnp_FormatDouble(1.7976931348623157e308, text);
+    ASSERT_ARE_EQUAL(char_ptr, "1.7976931348623157e+308", text);
+    SerialPnp_FormatDouble(INFINITY, text);
+    ASSERT_ARE_EQUAL(char_ptr, "null", text);
+}
+
+// Random bit patterns must read back exactly, and no shorter text may read back as the same value
+TEST_FUNCTION(SerialPnp_FormatFloat_round_trips)
+{
+    char text[SERIALPNP_NUMBER_STRING_LENGTH];
+    char shorter[SERIALPNP_NUMBER_STRING_LENGTH];
+
+    for (int i = 0; i < TEST_ROUND_TRIP_VALUES; i++)
+    {
+        uint32_t bits = (uint32_t)test_random();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        if (!isfinite(value))
+        {
+            continue;
+        }
+
+        size_t length = SerialPnp_FormatFloat(value, text);
+        ASSERT_ARE_EQUAL(int, (int)strlen(text), (int)length);
+        ASSERT_IS_TRUE(length < SERIALPNP_NUMBER_STRING_LENGTH);
+
+        float parsed = strtof(text, NULL);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(&parsed, &value, sizeof(value)));
+
+        int digits = test_significant_digits(text);
+        if ((0.0f != value) && (digits > 1))
+        {
+            (void)snprintf(shorter, sizeof(shorter), "%.*e", digits - 2, value);
+            ASSERT_IS_TRUE(strtof(shorter, NULL) != value);
+        }
+    }
+}
+
+TEST_FUNCTION(SerialPnp_FormatDouble_round_trips)
+{
+    char text[SERIALPNP_NUMBER_STRING_LENGTH];
+    char shorter[SERIALPNP_NUMBER_STRING_LENGTH];
+
+    for (int i = 0; i < TEST_ROUND_TRIP_VALUES; i++)
+    {
+        uint64_t bits = test_random();
+        if (0 == (i % 2))
+        {
+            // Every other value is subnormal
+            bits &= 0x800FFFFFFFFFFFFFULL;
+        }
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (!isfinite(value))
+        {
+            continue;
+        }
+
+        size_t length = SerialPnp_FormatDouble(value, text);
+        ASSERT_ARE_EQUAL(int, (int)strlen(text), (int)length);
+        ASSERT_IS_TRUE(length < SERIALPNP_NUMBER_STRING_LENGTH);
+
+        double parsed = strtod(text, NULL);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(&parsed, &value, sizeof(value)));
+
+        int digits = test_significant_digits(text);
+        if ((0.0 != value) && (digits > 1))
+        {
+            (void)snprintf(shorter, sizeof(shorter), "%.*e", digits - 2, value);
+            ASSERT_IS_TRUE(strtod(shorter, NULL) != value);
+        }
+    }
+}
+
+TEST_FUNCTION(SerialPnp_FormatInt64_writes_limits)
+{
+    char text[SERIALPNP_NUMBER_STRING_LENGTH];
+
+    ASSERT_ARE_EQUAL(int, 1, (int)SerialPnp_FormatInt64(0, text));
+    ASSERT_ARE_EQUAL(char_ptr, "0", text);
+    SerialPnp_FormatInt64(INT64_MIN, text);
+    ASSERT_ARE_EQUAL(char_ptr, "-9223372036854775808", text);
+    SerialPnp_FormatInt64(INT64_MAX, text);
+    ASSERT_ARE_EQUAL(char_ptr, "9223372036854775807", text);
+    SerialPnp_FormatInt32(INT32_MIN, text);
+    ASSERT_ARE_EQUAL(char_ptr, "-2147483648", text);
+    ASSERT_ARE_EQUAL(int, 20, (int)SerialPnp_FormatUInt64(UINT64_MAX, text));
+    ASSERT_ARE_EQUAL(char_ptr, "18446744073709551615", text);
+    SerialPnp_FormatUInt64(1000000007, text);
+    ASSERT_ARE_EQUAL(char_ptr, "1000000007", text);
+}
+
+TEST_FUNCTION(SerialPnp_BinarySchemaToString_formats_every_schema)
+{
+    byte byteValue = 200;
+    byte boolValue = 1;
+    int32_t intValue = -123456;
+    int64_t longValue = 1234567890123LL;
+    float floatValue = 21.1f;
+    double doubleValue = 3.3;
+    const char stringValue[] = "say \"hi\"\\\n\x01";
+
+    test_format_value(Byte, &byteValue, 1, "200");
+    test_format_value(Boolean, &boolValue, 1, "true");
+    boolValue = 0;
+    test_format_value(Boolean, &boolValue, 1, "false");
+    test_format_value(Int, &intValue, 4, "-123456");
+    test_format_value(Long, &longValue, 8, "1234567890123");
+    test_format_value(Float, &floatValue, 4, "21.1");
+    test_format_value(Double, &doubleValue, 8, "3.3");
+    test_format_value(String, stringValue, (byte)strlen(stringValue), "\"say \\\"hi\\\"\\\\\\n\\u0001\"");
+    test_format_value(String, stringValue, 0, "\"\"");
+
+    // Values whose length does not match the schema are rejected
+    ASSERT_IS_TRUE(NULL == SerialPnp_BinarySchemaToString(Int, (const byte*)&longValue, 8));
+    ASSERT_IS_TRUE(NULL == SerialPnp_BinarySchemaToString(Invalid, (const byte*)&byteValue, 1));
+}
+
+TEST_FUNCTION(SerialPnp_StringSchemaToBinary_parses_every_schema)
+{
+    byte byteValue = 255;
+    byte trueValue = 1;
+    byte falseValue = 0;
+    int32_t intValue = -2147483647 - 1;
+    int64_t longValue = -1234567890123LL;
+    float floatValue = 21.1f;
+    double doubleValue = 0.1;
+
+    test_parse_value(Byte, "255", &byteValue, 1);
+    test_parse_value(Boolean, "true", &trueValue, 1);
+    test_parse_value(Boolean, "false", &falseValue, 1);
+    test_parse_value(Boolean, "1", &trueValue, 1);
+    test_parse_value(Int, "-2147483648", &intValue, 4);
+    test_parse_value(Long, "-1234567890123", &longValue, 8);
+    test_parse_value(Float, "21.1", &floatValue, 4);
+    test_parse_value(Double, "0.1 ", &doubleValue, 8);
+    test_parse_value(String, "hello", "hello", 5);
+
+    test_parse_rejected(Byte, "256");
+    test_parse_rejected(Byte, "-1");
+    test_parse_rejected(Boolean, "yes");
+    test_parse_rejected(Int, "2147483648");
+    test_parse_rejected(Int, "12abc");
+    test_parse_rejected(Long, "99999999999999999999");
+    test_parse_rejected(Float, "");
+    test_parse_rejected(Double, "warm");
+    test_parse_rejected(Invalid, "1");
+}
+
+// Values formatted by the bridge must read back as what the device sent
+TEST_FUNCTION(SerialPnp_schema_conversion_round_trips)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t bits = test_random();
+        float floatValue;
+        double doubleValue;
+        int64_t longValue = (int64_t)bits;
+        memcpy(&floatValue, &bits, sizeof(floatValue));
+        memcpy(&doubleValue, &bits, sizeof(doubleValue));
+
+        Schema schemas[3] = { Float, Double, Long };
+        const void* values[3] = { &floatValue, &doubleValue, &longValue };
+        byte lengths[3] = { 4, 8, 8 };
+        for (int s = 0; s < 3; s++)
+        {
+            if (((Float == schemas[s]) && !isfinite(floatValue)) || ((Double == schemas[s]) && !isfinite(doubleValue)))
+            {
+                continue;
+            }
+
+            char* text = SerialPnp_BinarySchemaToString(schemas[s], (const byte*)values[s], lengths[s]);
+            ASSERT_IS_NOT_NULL(text);
+            test_parse_value(schemas[s], text, values[s], lengths[s]);
+            free(text);
+        }
+    }
+}
+
+// Compares the formatter against the sprintf calls it replaces. "%.6f" is what the adapter used
+// before and loses precision; "%.9g" is the shortest fixed precision that round trips every float.
+TEST_FUNCTION(SerialPnp_FormatFloat_benchmark)
+{
+    // arrange
+    float* values = malloc(TEST_BENCHMARK_VALUES * sizeof(float));
+    char text[64];
+    size_t formattedLength = 0;
+    size_t printedLength = 0;
+    size_t roundTripLength = 0;
+    ASSERT_IS_NOT_NULL(values);
+
+    for (int i = 0; i < TEST_BENCHMARK_VALUES; i++)
+    {
+        // Readings in the range sensors typically report
+        values[i] = (float)((double)(test_random() % 2000000) / 1000.0 - 1000.0);
+    }
+
+    // act
+    clock_t start = clock();
+    for (int i = 0; i < TEST_BENCHMARK_VALUES; i++)
+    {
+        formattedLength += SerialPnp_FormatFloat(values[i], text);
+    }
+    double formatSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (int i = 0; i < TEST_BENCHMARK_VALUES; i++)
+    {
+        printedLength += (size_t)snprintf(text, sizeof(text), "%.6f", values[i]);
+    }
+    double printSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (int i = 0; i < TEST_BENCHMARK_VALUES; i++)
+    {
+        roundTripLength += (size_t)snprintf(text, sizeof(text), "%.9g", values[i]);
+    }
+    double roundTripSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    // assert
+    ASSERT_IS_TRUE(formattedLength < roundTripLength);
+    free(values);
+
+    (void)printf("float formatting: %.1f ns/value, %.1f characters (sprintf %%.6f: %.1f ns/value, %.1f characters; %%.9g: %.1f ns/value, %.1f characters)\r\n",
+        formatSeconds * 1e9 / TEST_BENCHMARK_VALUES, (double)formattedLength / TEST_BENCHMARK_VALUES,
+        printSeconds * 1e9 / TEST_BENCHMARK_VALUES, (double)printedLength / TEST_BENCHMARK_VALUES,
+        roundTripSeconds * 1e9 / TEST_BENCHMARK_VALUES, (double)roundTripLength / TEST_BENCHMARK_VALUES);
+}
+
+END_TEST_SUITE(serial_pnp_format_ut)
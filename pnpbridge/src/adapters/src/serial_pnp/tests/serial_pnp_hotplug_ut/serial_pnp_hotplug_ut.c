@@ -0,0 +1,357 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIN32
+// For the temporary sysfs tree
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "testrunnerswitcher.h"
+
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "serial_pnp_hotplug.h"
+
+#define TEST_UEVENT_SIZE 512
+#define TEST_NAME_LENGTH 32
+#define TEST_ROOT_LENGTH 64
+#define TEST_PATH_LENGTH 512
+#define TEST_MAX_ADDED 4
+#define TEST_MONITOR_STOP_MS 100
+
+// The ttys the callback was called with
+static char g_added[TEST_MAX_ADDED][TEST_NAME_LENGTH];
+static int g_addedCount;
+static char g_sysfsRoot[TEST_ROOT_LENGTH];
+
+static void test_tty_added(
+    const char* DeviceName,
+    void* Context)
+{
+    (void)Context;
+    if (g_addedCount < TEST_MAX_ADDED)
+    {
+        (void)snprintf(g_added[g_addedCount], TEST_NAME_LENGTH, "%s", DeviceName);
+    }
+    g_addedCount++;
+}
+
+// Builds a uevent from its header line and fields, ending with a NULL, and returns its length
+static size_t test_build_uevent(
+    char* message,
+    const char* header,
+    ...)
+{
+    va_list fields;
+    size_t length = 0;
+
+    va_start(fields, header);
+    for (const char* field = header; NULL != field; field = va_arg(fields, const char*))
+    {
+        size_t fieldLength = strlen(field) + 1;
+        memcpy(message + length, field, fieldLength);
+        length += fieldLength;
+    }
+    va_end(fields);
+
+    return length;
+}
+
+#ifndef WIN32
+static void test_make_directory(
+    const char* path)
+{
+    char fullPath[TEST_PATH_LENGTH];
+    (void)snprintf(fullPath, sizeof(fullPath), "%s/%s", g_sysfsRoot, path);
+    ASSERT_ARE_EQUAL(int, 0, mkdir(fullPath, 0700));
+}
+
+static void test_write_attribute(
+    const char* path,
+    const char* value)
+{
+    char fullPath[TEST_PATH_LENGTH];
+    (void)snprintf(fullPath, sizeof(fullPath), "%s/%s", g_sysfsRoot, path);
+    FILE* file = fopen(fullPath, "w");
+    ASSERT_IS_NOT_NULL(file);
+    (void)fprintf(file, "%s\n", value);
+    (void)fclose(file);
+}
+
+// Links the device of a tty to a directory of the device tree, as sysfs does
+static void test_link_device(
+    const char* ttyName,
+    const char* devicePath)
+{
+    char tty[TEST_NAME_LENGTH * 2];
+    char link[TEST_PATH_LENGTH];
+    char target[TEST_PATH_LENGTH];
+
+    (void)snprintf(tty, sizeof(tty), "class/tty/%s", ttyName);
+    test_make_directory(tty);
+    (void)snprintf(link, sizeof(link), "%s/%s/device", g_sysfsRoot, tty);
+    (void)snprintf(target, sizeof(target), "%s/%s", g_sysfsRoot, devicePath);
+    ASSERT_ARE_EQUAL(int, 0, symlink(target, link));
+}
+
+static int test_remove_entry(
+    const char* path,
+    const struct stat* status,
+    int type,
+    struct FTW* ftw)
+{
+    (void)status;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+// Builds a sysfs tree with a CDC ACM device on ttyACM0, a USB-serial adapter without a serial
+// number on ttyUSB0, whose tty sits one level further down, and a virtual terminal tty1
+static void test_build_sysfs(void)
+{
+    (void)snprintf(g_sysfsRoot, sizeof(g_sysfsRoot), "/tmp/serial_pnp_hotplug_ut_XXXXXX");
+    ASSERT_IS_NOT_NULL(mkdtemp(g_sysfsRoot));
+
+    test_make_directory("devices");
+    test_make_directory("devices/usb1");
+    test_make_directory("devices/usb1/1-1");
+    test_write_attribute("devices/usb1/1-1/idVendor", "2a03");
+    test_write_attribute("devices/usb1/1-1/idProduct", "0043");
+    test_write_attribute("devices/usb1/1-1/serial", "A1B2C3");
+    test_make_directory("devices/usb1/1-1/1-1:1.0");
+
+    test_make_directory("devices/usb1/1-2");
+    test_write_attribute("devices/usb1/1-2/idVendor", "0403");
+    test_write_attribute("devices/usb1/1-2/idProduct", "6001");
+    test_make_directory("devices/usb1/1-2/1-2:1.0");
+    test_make_directory("devices/usb1/1-2/1-2:1.0/ttyUSB0");
+
+    test_make_directory("class");
+    test_make_directory("class/tty");
+    test_link_device("ttyACM0", "devices/usb1/1-1/1-1:1.0");
+    test_link_device("ttyUSB0", "devices/usb1/1-2/1-2:1.0/ttyUSB0");
+    test_make_directory("class/tty/tty1");
+}
+
+static bool test_matches(
+    const char* ttyName,
+    const char* vid,
+    const char* pid,
+    const char* serial)
+{
+    SERIAL_USB_ID usbId;
+    usbId.Vid = (char*)vid;
+    usbId.Pid = (char*)pid;
+    usbId.Serial = (char*)serial;
+    return SerialPnp_TtyMatchesUsbIdInSysfs(g_sysfsRoot, ttyName, &usbId);
+}
+#endif
+
+BEGIN_TEST_SUITE(serial_pnp_hotplug_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    memset(g_added, 0, sizeof(g_added));
+    g_addedCount = 0;
+    g_sysfsRoot[0] = '\0';
+}
+
+TEST_FUNCTION_CLEANUP(TestMethodCleanup)
+{
+#ifndef WIN32
+    if ('\0' != g_sysfsRoot[0])
+    {
+        (void)nftw(g_sysfsRoot, test_remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    }
+#endif
+}
+
+#ifndef WIN32
+TEST_FUNCTION(SerialPnp_HandleUevent_reports_an_added_tty)
+{
+    // arrange
+    char message[TEST_UEVENT_SIZE];
+    size_t length = test_build_uevent(message, "add@/devices/usb1/1-1/1-1:1.0/tty/ttyACM0",
+        "ACTION=add", "DEVPATH=/devices/usb1/1-1/1-1:1.0/tty/ttyACM0", "SUBSYSTEM=tty",
+        "MAJOR=166", "MINOR=0", "DEVNAME=ttyACM0", "SEQNUM=4242", NULL);
+
+    // act
+    SerialPnp_HandleUevent(message, length, test_tty_added, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, g_addedCount);
+    ASSERT_ARE_EQUAL(char_ptr, "ttyACM0", g_added[0]);
+}
+
+TEST_FUNCTION(SerialPnp_HandleUevent_reads_fields_in_any_order)
+{
+    // arrange
+    char message[TEST_UEVENT_SIZE];
+    size_t length = test_build_uevent(message, "add@/devices/usb1/1-2/1-2:1.0/ttyUSB0/tty/ttyUSB0",
+        "DEVNAME=ttyUSB0", "SUBSYSTEM=tty", "ACTION=add", NULL);
+
+    // act
+    SerialPnp_HandleUevent(message, length, test_tty_added, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, g_addedCount);
+    ASSERT_ARE_EQUAL(char_ptr, "ttyUSB0", g_added[0]);
+}
+
+TEST_FUNCTION(SerialPnp_HandleUevent_ignores_a_removed_tty)
+{
+    // arrange
+    char message[TEST_UEVENT_SIZE];
+    size_t length = test_build_uevent(message, "remove@/devices/usb1/1-1/1-1:1.0/tty/ttyACM0",
+        "ACTION=remove", "SUBSYSTEM=tty", "DEVNAME=ttyACM0", NULL);
+
+    // act
+    SerialPnp_HandleUevent(message, length, test_tty_added, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, g_addedCount);
+}
+
+TEST_FUNCTION(SerialPnp_HandleUevent_ignores_other_subsystems)
+{
+    // arrange: the USB device and interface of a serial device are announced before its tty
+    char message[TEST_UEVENT_SIZE];
+    size_t deviceLength = test_build_uevent(message, "add@/devices/usb1/1-1",
+        "ACTION=add", "SUBSYSTEM=usb", "DEVNAME=bus/usb/001/002", "DEVTYPE=usb_device", NULL);
+
+    // act
+    SerialPnp_HandleUevent(message, deviceLength, test_tty_added, NULL);
+    size_t interfaceLength = test_build_uevent(message, "add@/devices/usb1/1-1/1-1:1.0",
+        "ACTION=add", "SUBSYSTEM=usb", "DEVTYPE=usb_interface", NULL);
+    SerialPnp_HandleUevent(message, interfaceLength, test_tty_added, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, g_addedCount);
+}
+
+TEST_FUNCTION(SerialPnp_HandleUevent_ignores_a_tty_without_a_device_name)
+{
+    // arrange
+    char message[TEST_UEVENT_SIZE];
+    size_t length = test_build_uevent(message, "add@/devices/virtual/tty/ttyX",
+        "ACTION=add", "SUBSYSTEM=tty", "DEVPATH=/devices/virtual/tty/ttyX", NULL);
+
+    // act
+    SerialPnp_HandleUevent(message, length, test_tty_added, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, g_addedCount);
+}
+
+TEST_FUNCTION(SerialPnp_HandleUevent_reads_no_further_than_the_message)
+{
+    // arrange: the device name lies past the end of the message received
+    char message[TEST_UEVENT_SIZE];
+    size_t length = test_build_uevent(message, "add@/devices/usb1/1-1/1-1:1.0/tty/ttyACM0",
+        "ACTION=add", "SUBSYSTEM=tty", NULL);
+    (void)test_build_uevent(message + length, "DEVNAME=ttyACM0", NULL);
+
+    // act
+    SerialPnp_HandleUevent(message, length, test_tty_added, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, g_addedCount);
+}
+
+TEST_FUNCTION(SerialPnp_TtyMatchesUsbId_matches_the_usb_device_of_a_tty)
+{
+    // arrange
+    test_build_sysfs();
+
+    // act
+    bool acm = test_matches("ttyACM0", "2a03", "0043", NULL);
+    bool acmUpperCase = test_matches("ttyACM0", "2A03", "0043", NULL);
+    bool acmSerial = test_matches("ttyACM0", "2a03", "0043", "A1B2C3");
+    bool usbSerial = test_matches("ttyUSB0", "0403", "6001", NULL);
+
+    // assert: the ids are found however far above the tty the USB device is
+    ASSERT_IS_TRUE(acm);
+    ASSERT_IS_TRUE(acmUpperCase);
+    ASSERT_IS_TRUE(acmSerial);
+    ASSERT_IS_TRUE(usbSerial);
+}
+
+TEST_FUNCTION(SerialPnp_TtyMatchesUsbId_rejects_other_devices)
+{
+    // arrange
+    test_build_sysfs();
+
+    // act
+    bool otherVendor = test_matches("ttyACM0", "0403", "0043", NULL);
+    bool otherProduct = test_matches("ttyACM0", "2a03", "0042", NULL);
+    bool otherSerial = test_matches("ttyACM0", "2a03", "0043", "A1B2C4");
+    bool serialCase = test_matches("ttyACM0", "2a03", "0043", "a1b2c3");
+    bool noSerial = test_matches("ttyUSB0", "0403", "6001", "A1B2C3");
+    bool otherTty = test_matches("ttyUSB0", "2a03", "0043", NULL);
+
+    // assert: serial numbers are compared exactly, unlike the hexadecimal ids
+    ASSERT_IS_FALSE(otherVendor);
+    ASSERT_IS_FALSE(otherProduct);
+    ASSERT_IS_FALSE(otherSerial);
+    ASSERT_IS_FALSE(serialCase);
+    ASSERT_IS_FALSE(noSerial);
+    ASSERT_IS_FALSE(otherTty);
+}
+
+TEST_FUNCTION(SerialPnp_TtyMatchesUsbId_rejects_ttys_without_a_usb_device)
+{
+    // arrange
+    test_build_sysfs();
+
+    // act
+    bool virtualTerminal = test_matches("tty1", "2a03", "0043", NULL);
+    bool missing = test_matches("ttyACM1", "2a03", "0043", NULL);
+
+    // assert
+    ASSERT_IS_FALSE(virtualTerminal);
+    ASSERT_IS_FALSE(missing);
+}
+
+TEST_FUNCTION(SerialPnp_HotplugMonitor_Destroy_stops_the_monitor_right_away)
+{
+    // arrange: uevents need a netlink socket, which sandboxes may not allow
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    tickcounter_ms_t start = 0;
+    tickcounter_ms_t end = 0;
+    SERIALPNP_HOTPLUG_MONITOR_HANDLE monitor = SerialPnp_HotplugMonitor_Create(test_tty_added, NULL);
+
+    // act
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    SerialPnp_HotplugMonitor_Destroy(monitor);
+    (void)tickcounter_get_current_ms(tickCounter, &end);
+    tickcounter_destroy(tickCounter);
+
+    // assert: the worker is woken to stop, rather than noticing on its own
+    ASSERT_IS_TRUE(end - start < TEST_MONITOR_STOP_MS);
+    ASSERT_ARE_EQUAL(int, 0, g_addedCount);
+}
+#endif
+
+END_TEST_SUITE(serial_pnp_hotplug_ut)
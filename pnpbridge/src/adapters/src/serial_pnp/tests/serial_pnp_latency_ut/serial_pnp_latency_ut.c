@@ -0,0 +1,209 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "testrunnerswitcher.h"
+
+#include "serial_pnp_latency.h"
+
+#ifdef WIN32
+#define timegm _mkgmtime
+#endif
+
+static SERIALPNP_LATENCY_HISTOGRAM g_histogram;
+
+BEGIN_TEST_SUITE(serial_pnp_latency_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    memset(&g_histogram, 0, sizeof(g_histogram));
+}
+
+TEST_FUNCTION(SerialPnp_LatencyHistogram_keeps_small_values_exact)
+{
+    // act
+    for (uint64_t v = 0; v < 16; v++)
+    {
+        SerialPnp_LatencyHistogram_Record(&g_histogram, v);
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 16, (int)g_histogram.Count);
+    ASSERT_ARE_EQUAL(int, 120, (int)g_histogram.Sum);
+    ASSERT_ARE_EQUAL(int, 0, (int)g_histogram.Min);
+    ASSERT_ARE_EQUAL(int, 15, (int)g_histogram.Max);
+    ASSERT_ARE_EQUAL(int, 7, (int)SerialPnp_LatencyHistogram_Percentile(&g_histogram, 50));
+    ASSERT_ARE_EQUAL(int, 15, (int)SerialPnp_LatencyHistogram_Percentile(&g_histogram, 100));
+}
+
+TEST_FUNCTION(SerialPnp_LatencyHistogram_percentiles_are_within_an_eighth)
+{
+    // act
+    for (uint64_t v = 1; v <= 100000; v++)
+    {
+        SerialPnp_LatencyHistogram_Record(&g_histogram, v);
+    }
+
+    // assert
+    const double percentiles[] = { 1, 10, 50, 90, 99, 99.9 };
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        double exact = percentiles[i] * 1000;
+        double reported = (double)SerialPnp_LatencyHistogram_Percentile(&g_histogram, percentiles[i]);
+        ASSERT_IS_TRUE(reported >= exact);
+        ASSERT_IS_TRUE(reported <= exact * 1.125);
+    }
+    ASSERT_ARE_EQUAL(int, 100000, (int)SerialPnp_LatencyHistogram_Percentile(&g_histogram, 100));
+}
+
+TEST_FUNCTION(SerialPnp_LatencyHistogram_clamps_to_recorded_values)
+{
+    // act
+    SerialPnp_LatencyHistogram_Record(&g_histogram, 1000);
+    uint64_t single = SerialPnp_LatencyHistogram_Percentile(&g_histogram, 50);
+    SerialPnp_LatencyHistogram_Record(&g_histogram, (uint64_t)1 << 50);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1000, (int)single);
+    ASSERT_ARE_EQUAL(int, 1023, (int)SerialPnp_LatencyHistogram_Percentile(&g_histogram, 50));
+    ASSERT_IS_TRUE(((uint64_t)1 << 50) == SerialPnp_LatencyHistogram_Percentile(&g_histogram, 100));
+    ASSERT_IS_TRUE(((uint64_t)1 << 50) == g_histogram.Max);
+}
+
+TEST_FUNCTION(SerialPnp_DeviceClock_maps_device_time_to_the_round_trip_midpoint)
+{
+    // arrange
+    SERIALPNP_DEVICE_CLOCK clock = { 0 };
+    uint64_t hostTime = 0;
+
+    // act
+    bool beforeSync = SerialPnp_DeviceClock_ToHost(&clock, 5000, &hostTime);
+    bool accepted = SerialPnp_DeviceClock_AddSample(&clock, 1000000, 1010000, 5000);
+
+    // assert
+    ASSERT_IS_FALSE(beforeSync);
+    ASSERT_IS_TRUE(accepted);
+    ASSERT_IS_TRUE(SerialPnp_DeviceClock_ToHost(&clock, 5000, &hostTime));
+    ASSERT_ARE_EQUAL(int, 1005000, (int)hostTime);
+    ASSERT_IS_TRUE(SerialPnp_DeviceClock_ToHost(&clock, 5100, &hostTime));
+    ASSERT_ARE_EQUAL(int, 1105000, (int)hostTime);
+    ASSERT_IS_TRUE(SerialPnp_DeviceClock_ToHost(&clock, 4900, &hostTime));
+    ASSERT_ARE_EQUAL(int, 905000, (int)hostTime);
+}
+
+TEST_FUNCTION(SerialPnp_DeviceClock_follows_the_device_clock_across_a_wrap)
+{
+    // arrange
+    SERIALPNP_DEVICE_CLOCK clock = { 0 };
+    uint64_t hostTime = 0;
+    ASSERT_IS_TRUE(SerialPnp_DeviceClock_AddSample(&clock, 10000000, 10000000, 0xFFFFFF00));
+
+    // act
+    bool converted = SerialPnp_DeviceClock_ToHost(&clock, 0x100, &hostTime);
+
+    // assert
+    ASSERT_IS_TRUE(converted);
+    ASSERT_ARE_EQUAL(int, 10000000 + 512 * 1000, (int)hostTime);
+}
+
+TEST_FUNCTION(SerialPnp_DeviceClock_discards_imprecise_samples)
+{
+    // arrange
+    SERIALPNP_DEVICE_CLOCK clock = { 0 };
+    uint64_t hostTime = 0;
+    const uint64_t tooLong = (uint64_t)(SERIALPNP_CLOCK_SYNC_MAX_ROUND_TRIP_MS + 1) * 1000;
+
+    // act
+    bool slow = SerialPnp_DeviceClock_AddSample(&clock, 0, tooLong, 1);
+    bool precise = SerialPnp_DeviceClock_AddSample(&clock, 1000000, 1002000, 1000);
+    bool worse = SerialPnp_DeviceClock_AddSample(&clock, 2000000, 2100000, 2050);
+    bool later = SerialPnp_DeviceClock_AddSample(&clock, 100000000, 100100000, 100000);
+
+    // assert
+    ASSERT_IS_FALSE(slow);
+    ASSERT_IS_TRUE(precise);
+    ASSERT_IS_FALSE(worse);
+    ASSERT_IS_TRUE(later);
+    ASSERT_IS_TRUE(SerialPnp_DeviceClock_ToHost(&clock, 100000, &hostTime));
+    ASSERT_ARE_EQUAL(int, 100050000, (int)hostTime);
+}
+
+TEST_FUNCTION(SerialPnp_FormatUtcTime_formats_iso8601_utc)
+{
+    // arrange
+    char text[SERIALPNP_UTC_TIME_LENGTH];
+    uint64_t now = SerialPnp_MonotonicMicroseconds();
+    struct tm parsed = { 0 };
+    int milliseconds = -1;
+    // Monotonic time may start at boot, so stay within it
+    uint64_t age = (now > 10000000) ? 10000000 : (now / 1000000) * 1000000;
+
+    // act
+    bool formatted = SerialPnp_FormatUtcTime(now - age, text, sizeof(text));
+    time_t expected = time(NULL) - (time_t)(age / 1000000);
+
+    // assert
+    ASSERT_IS_TRUE(formatted);
+    ASSERT_ARE_EQUAL(int, SERIALPNP_UTC_TIME_LENGTH - 1, (int)strlen(text));
+    ASSERT_ARE_EQUAL(int, 'T', text[10]);
+    ASSERT_ARE_EQUAL(int, 'Z', text[23]);
+    ASSERT_ARE_EQUAL(int, 7, sscanf(text, "%4d-%2d-%2dT%2d:%2d:%2d.%3d", &parsed.tm_year, &parsed.tm_mon,
+        &parsed.tm_mday, &parsed.tm_hour, &parsed.tm_min, &parsed.tm_sec, &milliseconds));
+    parsed.tm_year -= 1900;
+    parsed.tm_mon -= 1;
+    double difference = difftime(timegm(&parsed), expected);
+    ASSERT_IS_TRUE((difference >= -2) && (difference <= 2));
+    ASSERT_IS_TRUE((milliseconds >= 0) && (milliseconds < 1000));
+}
+
+TEST_FUNCTION(SerialPnp_FormatUtcTime_fails_on_a_short_buffer)
+{
+    // arrange
+    char text[SERIALPNP_UTC_TIME_LENGTH - 1];
+
+    // act
+    bool formatted = SerialPnp_FormatUtcTime(SerialPnp_MonotonicMicroseconds(), text, sizeof(text));
+
+    // assert
+    ASSERT_IS_FALSE(formatted);
+}
+
+TEST_FUNCTION(SerialPnp_Latency_outlives_the_link_while_referenced)
+{
+    // arrange
+    SERIALPNP_LATENCY_HANDLE latency = SerialPnp_Latency_Create();
+    ASSERT_IS_NOT_NULL(latency);
+
+    // act
+    SerialPnp_Latency_AddRef(latency);
+    SerialPnp_Latency_Release(latency);
+    SerialPnp_Latency_Record(latency, SerialPnpLatency_Confirm, 250);
+    SerialPnp_Latency_Record(latency, SerialPnpLatency_Confirm, 750);
+    SerialPnp_Latency_GetHistogram(latency, SerialPnpLatency_Confirm, &g_histogram);
+    SerialPnp_Latency_Log(latency, "COM1");
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 2, (int)g_histogram.Count);
+    ASSERT_ARE_EQUAL(int, 1000, (int)g_histogram.Sum);
+    ASSERT_ARE_EQUAL(int, 250, (int)g_histogram.Min);
+    ASSERT_ARE_EQUAL(int, 750, (int)g_histogram.Max);
+
+    // cleanup
+    SerialPnp_Latency_Release(latency);
+}
+
+END_TEST_SUITE(serial_pnp_latency_ut)
@@ -0,0 +1,345 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "testrunnerswitcher.h"
+
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/tickcounter.h"
+
+#include "serial_pnp_tx.h"
+
+#define TEST_WIRE_BUFFER_SIZE 4096
+#define TEST_BURST_FRAMES 50
+#define TEST_WAITED_SENDERS 2
+// Long enough for the waited senders to be done with, were they woken
+#define TEST_WAITED_SEND_MS 2000
+#define TEST_THROUGHPUT_SENDERS 4
+#define TEST_THROUGHPUT_FRAMES 20000
+#define TEST_THROUGHPUT_FRAME_LENGTH 24
+// Busy work standing in for the cost of a write system call to a serial port
+#define TEST_WRITE_CALL_COST 2000
+
+// Everything written to the fake port
+static byte g_wire[TEST_WIRE_BUFFER_SIZE];
+static size_t g_wireLength;
+static int g_writeCount;
+static unsigned int g_firstWriteDelay;
+static IOTHUB_CLIENT_RESULT g_writeResult;
+static volatile uint32_t g_writeWork;
+
+static IOTHUB_CLIENT_RESULT test_write(
+    void* Context,
+    const byte* Data,
+    size_t Length,
+    uint64_t* WriteCalls)
+{
+    (void)Context;
+
+    // Hold up the first write, so that the frames sent meanwhile queue up behind it
+    if ((0 == g_writeCount++) && (0 != g_firstWriteDelay))
+    {
+        ThreadAPI_Sleep(g_firstWriteDelay);
+    }
+
+    if (g_wireLength + Length <= TEST_WIRE_BUFFER_SIZE)
+    {
+        memcpy(g_wire + g_wireLength, Data, Length);
+        g_wireLength += Length;
+    }
+    (*WriteCalls)++;
+    return g_writeResult;
+}
+
+static void test_write_call_cost(void)
+{
+    for (int i = 0; i < TEST_WRITE_CALL_COST; i++)
+    {
+        g_writeWork = g_writeWork * 31 + i;
+    }
+}
+
+static IOTHUB_CLIENT_RESULT test_timed_write(
+    void* Context,
+    const byte* Data,
+    size_t Length,
+    uint64_t* WriteCalls)
+{
+    (void)Context;
+    (void)Data;
+    (void)Length;
+
+    test_write_call_cost();
+    (*WriteCalls)++;
+    return IOTHUB_CLIENT_OK;
+}
+
+typedef struct TEST_SENDER {
+    SERIALPNP_TX_QUEUE_HANDLE Queue;
+    int Failures;
+} TEST_SENDER;
+
+static int test_sender(
+    void* Context)
+{
+    TEST_SENDER* sender = (TEST_SENDER*)Context;
+    byte packet[TEST_THROUGHPUT_FRAME_LENGTH] = { 0 };
+
+    packet[0] = TEST_THROUGHPUT_FRAME_LENGTH;
+    packet[2] = SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST;
+    for (int i = 0; i < TEST_THROUGHPUT_FRAMES; i++)
+    {
+        packet[TEST_THROUGHPUT_FRAME_LENGTH - 1] = (byte)i;
+        if (IOTHUB_CLIENT_OK != SerialPnp_TxQueue_Send(sender->Queue, packet, sizeof(packet), false))
+        {
+            sender->Failures++;
+        }
+    }
+
+    return 0;
+}
+
+typedef struct TEST_WAITED_SENDER {
+    SERIALPNP_TX_QUEUE_HANDLE Queue;
+    LOCK_HANDLE Lock;
+    byte Id;
+    bool Done;
+    IOTHUB_CLIENT_RESULT Result;
+} TEST_WAITED_SENDER;
+
+static int test_waited_sender(
+    void* Context)
+{
+    TEST_WAITED_SENDER* sender = (TEST_WAITED_SENDER*)Context;
+    byte packet[SERIALPNP_MIN_PACKET_LENGTH] = { SERIALPNP_MIN_PACKET_LENGTH, 0, SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST, sender->Id };
+
+    IOTHUB_CLIENT_RESULT result = SerialPnp_TxQueue_Send(sender->Queue, packet, sizeof(packet), true);
+
+    Lock(sender->Lock);
+    sender->Result = result;
+    sender->Done = true;
+    Unlock(sender->Lock);
+    return 0;
+}
+
+static int test_waited_senders_done(
+    TEST_WAITED_SENDER* senders)
+{
+    int done = 0;
+    for (int i = 0; i < TEST_WAITED_SENDERS; i++)
+    {
+        Lock(senders[i].Lock);
+        done += senders[i].Done ? 1 : 0;
+        Unlock(senders[i].Lock);
+    }
+    return done;
+}
+
+BEGIN_TEST_SUITE(serial_pnp_tx_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInit)
+{
+    g_wireLength = 0;
+    g_writeCount = 0;
+    g_firstWriteDelay = 0;
+    g_writeResult = IOTHUB_CLIENT_OK;
+}
+
+TEST_FUNCTION(SerialPnp_TxQueue_Send_frames_and_escapes)
+{
+    // arrange
+    const byte packet[] = { 0x06, 0x00, SERIALPNP_START_OF_FRAME_BYTE, 0x00, SERIALPNP_ESCAPE_BYTE, 0x01 };
+    const byte expected[] = { SERIALPNP_START_OF_FRAME_BYTE, 0x06, 0x00, SERIALPNP_ESCAPE_BYTE, SERIALPNP_START_OF_FRAME_BYTE - 1, 0x00,
+                              SERIALPNP_ESCAPE_BYTE, SERIALPNP_ESCAPE_BYTE - 1, 0x01 };
+    SERIALPNP_TX_STATISTICS statistics;
+    SERIALPNP_TX_QUEUE_HANDLE queue = SerialPnp_TxQueue_Create(test_write, NULL);
+    ASSERT_IS_NOT_NULL(queue);
+
+    // act
+    IOTHUB_CLIENT_RESULT result = SerialPnp_TxQueue_Send(queue, packet, sizeof(packet), true);
+    SerialPnp_TxQueue_GetStatistics(queue, &statistics);
+    SerialPnp_TxQueue_Destroy(queue);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, result);
+    ASSERT_ARE_EQUAL(int, sizeof(expected), (int)g_wireLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(expected, g_wire, sizeof(expected)));
+    ASSERT_ARE_EQUAL(int, 1, (int)statistics.Frames);
+    ASSERT_ARE_EQUAL(int, sizeof(expected), (int)statistics.Bytes);
+    ASSERT_ARE_EQUAL(int, 1, (int)statistics.Batches);
+    ASSERT_ARE_EQUAL(int, 1, (int)statistics.WriteCalls);
+}
+
+TEST_FUNCTION(SerialPnp_TxQueue_coalesces_frames_queued_during_a_write)
+{
+    // arrange
+    byte packet[SERIALPNP_MIN_PACKET_LENGTH] = { SERIALPNP_MIN_PACKET_LENGTH, 0, SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST, 0 };
+    SERIALPNP_TX_STATISTICS statistics;
+    SERIALPNP_TX_QUEUE_HANDLE queue = SerialPnp_TxQueue_Create(test_write, NULL);
+    ASSERT_IS_NOT_NULL(queue);
+    g_firstWriteDelay = 100;
+
+    // act
+    for (int i = 0; i < TEST_BURST_FRAMES; i++)
+    {
+        packet[3] = (byte)i;
+        ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_TxQueue_Send(queue, packet, sizeof(packet), i == (TEST_BURST_FRAMES - 1)));
+    }
+    SerialPnp_TxQueue_GetStatistics(queue, &statistics);
+    SerialPnp_TxQueue_Destroy(queue);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, TEST_BURST_FRAMES, (int)statistics.Frames);
+    ASSERT_IS_TRUE(statistics.Batches < TEST_BURST_FRAMES / 2);
+    ASSERT_ARE_EQUAL(int, (int)statistics.Batches, (int)statistics.WriteCalls);
+
+    // Frames keep their order across batches
+    ASSERT_ARE_EQUAL(int, TEST_BURST_FRAMES * (1 + SERIALPNP_MIN_PACKET_LENGTH), (int)g_wireLength);
+    for (int i = 0; i < TEST_BURST_FRAMES; i++)
+    {
+        const byte* frame = g_wire + i * (1 + SERIALPNP_MIN_PACKET_LENGTH);
+        ASSERT_ARE_EQUAL(int, SERIALPNP_START_OF_FRAME_BYTE, frame[0]);
+        ASSERT_ARE_EQUAL(int, i, frame[4]);
+    }
+}
+
+TEST_FUNCTION(SerialPnp_TxQueue_Send_reports_write_failure)
+{
+    // arrange
+    byte packet[SERIALPNP_MIN_PACKET_LENGTH] = { SERIALPNP_MIN_PACKET_LENGTH, 0, SERIALPNP_PACKET_TYPE_RESET_REQUEST, 0 };
+    SERIALPNP_TX_STATISTICS statistics;
+    SERIALPNP_TX_QUEUE_HANDLE queue = SerialPnp_TxQueue_Create(test_write, NULL);
+    ASSERT_IS_NOT_NULL(queue);
+    g_writeResult = IOTHUB_CLIENT_ERROR;
+
+    // act
+    IOTHUB_CLIENT_RESULT result = SerialPnp_TxQueue_Send(queue, packet, sizeof(packet), true);
+    SerialPnp_TxQueue_GetStatistics(queue, &statistics);
+    SerialPnp_TxQueue_Destroy(queue);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_ERROR, result);
+    ASSERT_ARE_EQUAL(int, 0, (int)statistics.Frames);
+    ASSERT_ARE_EQUAL(int, 1, (int)statistics.FailedFrames);
+}
+
+TEST_FUNCTION(SerialPnp_TxQueue_Send_wakes_every_waiter_of_a_batch)
+{
+    // arrange
+    byte packet[SERIALPNP_MIN_PACKET_LENGTH] = { SERIALPNP_MIN_PACKET_LENGTH, 0, SERIALPNP_PACKET_TYPE_PROPERTY_REQUEST, 0 };
+    TEST_WAITED_SENDER senders[TEST_WAITED_SENDERS];
+    THREAD_HANDLE threads[TEST_WAITED_SENDERS];
+    SERIALPNP_TX_STATISTICS statistics;
+    SERIALPNP_TX_QUEUE_HANDLE queue = SerialPnp_TxQueue_Create(test_write, NULL);
+    ASSERT_IS_NOT_NULL(queue);
+    g_firstWriteDelay = 100;
+
+    // act: both waited frames queue up behind the first write, and go out in the same batch
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_TxQueue_Send(queue, packet, sizeof(packet), false));
+    for (int i = 0; i < TEST_WAITED_SENDERS; i++)
+    {
+        senders[i].Queue = queue;
+        senders[i].Lock = Lock_Init();
+        senders[i].Id = (byte)(i + 1);
+        senders[i].Done = false;
+        senders[i].Result = IOTHUB_CLIENT_ERROR;
+        ASSERT_IS_NOT_NULL(senders[i].Lock);
+        ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&threads[i], test_waited_sender, &senders[i]));
+    }
+    for (int waited = 0; (waited < TEST_WAITED_SEND_MS) && (test_waited_senders_done(senders) < TEST_WAITED_SENDERS); waited += 10)
+    {
+        ThreadAPI_Sleep(10);
+    }
+    int done = test_waited_senders_done(senders);
+
+    // assert: a sender left waiting would never return, so stop here rather than join it
+    ASSERT_ARE_EQUAL(int, TEST_WAITED_SENDERS, done);
+    for (int i = 0; i < TEST_WAITED_SENDERS; i++)
+    {
+        ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Join(threads[i], NULL));
+        ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, senders[i].Result);
+        Lock_Deinit(senders[i].Lock);
+    }
+    SerialPnp_TxQueue_GetStatistics(queue, &statistics);
+    SerialPnp_TxQueue_Destroy(queue);
+    ASSERT_ARE_EQUAL(int, 1 + TEST_WAITED_SENDERS, (int)statistics.Frames);
+    ASSERT_ARE_EQUAL(int, 2, (int)statistics.Batches);
+}
+
+// Several components sending property writes at once, against a port where every write call
+// costs the same. Compares write calls per frame with the one write per frame of sending each
+// frame straight to the port.
+TEST_FUNCTION(SerialPnp_TxQueue_throughput)
+{
+    // arrange
+    TEST_SENDER senders[TEST_THROUGHPUT_SENDERS];
+    THREAD_HANDLE threads[TEST_THROUGHPUT_SENDERS];
+    SERIALPNP_TX_STATISTICS statistics;
+    byte packet[SERIALPNP_MIN_PACKET_LENGTH] = { SERIALPNP_MIN_PACKET_LENGTH, 0, SERIALPNP_PACKET_TYPE_RESET_REQUEST, 0 };
+    tickcounter_ms_t start;
+    tickcounter_ms_t queuedEnd;
+    tickcounter_ms_t directEnd;
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    SERIALPNP_TX_QUEUE_HANDLE queue = SerialPnp_TxQueue_Create(test_timed_write, NULL);
+    ASSERT_IS_NOT_NULL(tickCounter);
+    ASSERT_IS_NOT_NULL(queue);
+
+    // act, timing wall clock rather than processor time since the senders run in parallel
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_THROUGHPUT_SENDERS; i++)
+    {
+        senders[i].Queue = queue;
+        senders[i].Failures = 0;
+        ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Create(&threads[i], test_sender, &senders[i]));
+    }
+    for (int i = 0; i < TEST_THROUGHPUT_SENDERS; i++)
+    {
+        ASSERT_ARE_EQUAL(int, THREADAPI_OK, ThreadAPI_Join(threads[i], NULL));
+    }
+    ASSERT_ARE_EQUAL(int, IOTHUB_CLIENT_OK, SerialPnp_TxQueue_Send(queue, packet, sizeof(packet), true));
+    (void)tickcounter_get_current_ms(tickCounter, &queuedEnd);
+    double queuedSeconds = (double)(queuedEnd - start) / 1000.0;
+    SerialPnp_TxQueue_GetStatistics(queue, &statistics);
+    SerialPnp_TxQueue_Destroy(queue);
+
+    (void)tickcounter_get_current_ms(tickCounter, &start);
+    for (int i = 0; i < TEST_THROUGHPUT_SENDERS * TEST_THROUGHPUT_FRAMES; i++)
+    {
+        test_write_call_cost();
+    }
+    (void)tickcounter_get_current_ms(tickCounter, &directEnd);
+    double directSeconds = (double)(directEnd - start) / 1000.0;
+    tickcounter_destroy(tickCounter);
+
+    // assert
+    double frames = (double)statistics.Frames;
+    for (int i = 0; i < TEST_THROUGHPUT_SENDERS; i++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, senders[i].Failures);
+    }
+    ASSERT_ARE_EQUAL(int, TEST_THROUGHPUT_SENDERS * TEST_THROUGHPUT_FRAMES + 1, (int)statistics.Frames);
+    ASSERT_IS_TRUE(statistics.WriteCalls < statistics.Frames);
+
+    (void)printf("transmit queue: %.0f frames/s, %.0f bytes/s, %.3f write calls per frame, %.1f frames per batch (one write per frame: %.0f frames/s)\r\n",
+        (queuedSeconds > 0) ? frames / queuedSeconds : 0.0,
+        (queuedSeconds > 0) ? (double)statistics.Bytes / queuedSeconds : 0.0,
+        (double)statistics.WriteCalls / frames,
+        frames / (double)statistics.Batches,
+        (directSeconds > 0) ? frames / directSeconds : 0.0);
+}
+
+END_TEST_SUITE(serial_pnp_tx_ut)
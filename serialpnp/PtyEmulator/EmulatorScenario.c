@@ -0,0 +1,270 @@
+//
+// Serial PnP Emulator Scenario
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//
+#include "EmulatorScenario.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMULATOR_MAX_LINE_LENGTH        512
+#define EMULATOR_MAX_TOKENS             8
+
+#define EMULATOR_DEFAULT_BATCH_DELAY_MS 100
+
+typedef struct _EmulatorSchemaName {
+    const char*         Name;
+    SerialPnPSchema     Schema;
+} EmulatorSchemaName;
+
+static const EmulatorSchemaName g_EmulatorSchemaNames[] = {
+    { "byte",    SerialPnPSchema_Byte },
+    { "float",   SerialPnPSchema_Float },
+    { "double",  SerialPnPSchema_Double },
+    { "int",     SerialPnPSchema_Int },
+    { "long",    SerialPnPSchema_Long },
+    { "boolean", SerialPnPSchema_Boolean },
+};
+
+static bool
+EmulatorScenario_ParseSchema(
+    const char*         Name,
+    SerialPnPSchema*    Schema
+)
+{
+    size_t c;
+
+    for (c = 0; c < sizeof(g_EmulatorSchemaNames) / sizeof(g_EmulatorSchemaNames[0]); c++) {
+        if (strcmp(Name, g_EmulatorSchemaNames[c].Name) == 0) {
+            *Schema = g_EmulatorSchemaNames[c].Schema;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool
+EmulatorScenario_CopyName(
+    char*               Destination,
+    size_t              DestinationSize,
+    const char*         Source
+)
+{
+    if (strlen(Source) >= DestinationSize) {
+        return false;
+    }
+
+    strcpy(Destination, Source);
+    return true;
+}
+
+// Splits a line into whitespace separated tokens, dropping any comment.
+static int
+EmulatorScenario_Tokenize(
+    char*               Line,
+    char**              Tokens
+)
+{
+    int count = 0;
+    char* comment = strchr(Line, '#');
+    char* token;
+
+    if (comment) {
+        *comment = '\0';
+    }
+
+    for (token = strtok(Line, " \t\r\n");
+         (token != 0) && (count < EMULATOR_MAX_TOKENS);
+         token = strtok(0, " \t\r\n"))
+    {
+        Tokens[count++] = token;
+    }
+
+    return count;
+}
+
+static bool
+EmulatorScenario_ParseLine(
+    char**              Tokens,
+    int                 Count,
+    EmulatorScenario*   Scenario
+)
+{
+    const char* directive = Tokens[0];
+
+    if (strcmp(directive, "device") == 0) {
+        int t;
+
+        // The device name is the rest of the line
+        if (Count < 2) {
+            return false;
+        }
+
+        Scenario->DeviceName[0] = '\0';
+        for (t = 1; t < Count; t++) {
+            if (strlen(Scenario->DeviceName) + strlen(Tokens[t]) + 2 > sizeof(Scenario->DeviceName)) {
+                return false;
+            }
+            if (t > 1) {
+                strcat(Scenario->DeviceName, " ");
+            }
+            strcat(Scenario->DeviceName, Tokens[t]);
+        }
+        return true;
+
+    } else if (strcmp(directive, "interface") == 0) {
+        if ((Count != 2) || (Scenario->InterfaceCount >= EMULATOR_MAX_INTERFACES)) {
+            return false;
+        }
+        return EmulatorScenario_CopyName(Scenario->Interfaces[Scenario->InterfaceCount++],
+                                         EMULATOR_MAX_URI_LENGTH,
+                                         Tokens[1]);
+
+    } else if (strcmp(directive, "event") == 0) {
+        EmulatorEvent* ev;
+
+        if ((Count < 4) || (Count > 5) ||
+            (Scenario->InterfaceCount == 0) ||
+            (Scenario->EventCount >= SERIALPNP_MAX_EVENT_COUNT)) {
+            return false;
+        }
+
+        ev = &Scenario->Events[Scenario->EventCount];
+        ev->Interface = Scenario->InterfaceCount - 1;
+        ev->RateHz = atof(Tokens[3]);
+        if (!EmulatorScenario_CopyName(ev->Name, sizeof(ev->Name), Tokens[1]) ||
+            !EmulatorScenario_ParseSchema(Tokens[2], &ev->Schema) ||
+            (ev->RateHz <= 0) ||
+            ((Count == 5) && !EmulatorScenario_CopyName(ev->Units, sizeof(ev->Units), Tokens[4]))) {
+            return false;
+        }
+
+        Scenario->EventCount++;
+        return true;
+
+    } else if ((strcmp(directive, "property") == 0) || (strcmp(directive, "command") == 0)) {
+        EmulatorCallback* cb;
+        int latencyToken;
+
+        if ((Scenario->InterfaceCount == 0) ||
+            (Scenario->CallbackCount >= SERIALPNP_MAX_CALLBACK_COUNT)) {
+            return false;
+        }
+
+        cb = &Scenario->Callbacks[Scenario->CallbackCount];
+        memset(cb, 0, sizeof(*cb));
+        cb->IsCommand = (directive[0] == 'c');
+        cb->Interface = Scenario->InterfaceCount - 1;
+        if ((Count < 3) ||
+            !EmulatorScenario_CopyName(cb->Name, sizeof(cb->Name), Tokens[1]) ||
+            !EmulatorScenario_ParseSchema(Tokens[2], &cb->Schema)) {
+            return false;
+        }
+
+        if (cb->IsCommand) {
+            if ((Count < 4) || (Count > 5) ||
+                !EmulatorScenario_ParseSchema(Tokens[3], &cb->OutputSchema)) {
+                return false;
+            }
+            latencyToken = 4;
+        } else {
+            latencyToken = 3;
+            if ((Count > 3) && (strcmp(Tokens[3], "writeable") == 0)) {
+                cb->Writeable = true;
+                latencyToken = 4;
+            }
+            if (Count > latencyToken + 1) {
+                return false;
+            }
+        }
+
+        if (Count > latencyToken) {
+            cb->LatencyMs = (uint32_t) strtoul(Tokens[latencyToken], 0, 10);
+        }
+
+        Scenario->CallbackCount++;
+        return true;
+
+    } else if (strcmp(directive, "batch") == 0) {
+        long samples;
+
+        if ((Count < 2) || (Count > 3)) {
+            return false;
+        }
+
+        samples = strtol(Tokens[1], 0, 10);
+        if ((samples < 0) || (samples > SERIALPNP_MAX_BATCH_SAMPLES)) {
+            return false;
+        }
+
+        Scenario->BatchSize = (uint8_t) samples;
+        if (Count == 3) {
+            Scenario->BatchDelayMs = (uint32_t) strtoul(Tokens[2], 0, 10);
+        }
+        return true;
+
+    } else if (strcmp(directive, "noise") == 0) {
+        if (Count != 2) {
+            return false;
+        }
+
+        Scenario->NoiseProbability = atof(Tokens[1]);
+        return (Scenario->NoiseProbability >= 0) && (Scenario->NoiseProbability <= 1);
+
+    } else if (strcmp(directive, "duration") == 0) {
+        if (Count != 2) {
+            return false;
+        }
+
+        Scenario->DurationSeconds = (uint32_t) strtoul(Tokens[1], 0, 10);
+        return true;
+    }
+
+    return false;
+}
+
+bool
+EmulatorScenario_Load(
+    const char*         Path,
+    EmulatorScenario*   Scenario
+)
+{
+    char line[EMULATOR_MAX_LINE_LENGTH];
+    char* tokens[EMULATOR_MAX_TOKENS];
+    int lineNumber = 0;
+    bool result = true;
+    FILE* file;
+
+    memset(Scenario, 0, sizeof(*Scenario));
+    strcpy(Scenario->DeviceName, "Serial PnP Emulator");
+    Scenario->BatchDelayMs = EMULATOR_DEFAULT_BATCH_DELAY_MS;
+
+    file = fopen(Path, "r");
+    if (file == 0) {
+        fprintf(stderr, "Unable to open scenario %s\n", Path);
+        return false;
+    }
+
+    while (result && fgets(line, sizeof(line), file)) {
+        int count;
+
+        lineNumber++;
+        count = EmulatorScenario_Tokenize(line, tokens);
+        if ((count > 0) && !EmulatorScenario_ParseLine(tokens, count, Scenario)) {
+            fprintf(stderr, "%s:%d: invalid '%s' directive\n", Path, lineNumber, tokens[0]);
+            result = false;
+        }
+    }
+
+    fclose(file);
+
+    if (result && (Scenario->InterfaceCount == 0)) {
+        fprintf(stderr, "%s: no interface is defined\n", Path);
+        result = false;
+    }
+
+    return result;
+}
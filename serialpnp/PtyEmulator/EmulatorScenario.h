@@ -0,0 +1,76 @@
+//
+// Serial PnP Emulator Scenario
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "../SerialPnP.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMULATOR_MAX_INTERFACES         8
+#define EMULATOR_MAX_NAME_LENGTH        64
+#define EMULATOR_MAX_URI_LENGTH         128
+
+// An event the emulated device sends RateHz times per second.
+typedef struct _EmulatorEvent {
+    char                Name[EMULATOR_MAX_NAME_LENGTH];
+    char                Units[EMULATOR_MAX_NAME_LENGTH];
+    SerialPnPSchema     Schema;
+    double              RateHz;
+    uint8_t             Interface;
+} EmulatorEvent;
+
+// A property or command; both are served through a Serial PnP callback.
+typedef struct _EmulatorCallback {
+    char                Name[EMULATOR_MAX_NAME_LENGTH];
+    bool                IsCommand;
+    SerialPnPSchema     Schema;         // property schema, or command input schema
+    SerialPnPSchema     OutputSchema;   // command output schema
+    bool                Writeable;
+    uint32_t            LatencyMs;      // time the device takes to handle a request
+    uint8_t             Interface;
+} EmulatorCallback;
+
+typedef struct _EmulatorScenario {
+    char                DeviceName[EMULATOR_MAX_NAME_LENGTH];
+    char                Interfaces[EMULATOR_MAX_INTERFACES][EMULATOR_MAX_URI_LENGTH];
+    uint8_t             InterfaceCount;
+    EmulatorEvent       Events[SERIALPNP_MAX_EVENT_COUNT];
+    uint8_t             EventCount;
+    EmulatorCallback    Callbacks[SERIALPNP_MAX_CALLBACK_COUNT];
+    uint8_t             CallbackCount;
+    uint8_t             BatchSize;          // samples per event batch, 0 sends single events
+    uint32_t            BatchDelayMs;       // longest time a sample waits for its batch
+    double              NoiseProbability;   // chance that a byte sent to the host is corrupted
+    uint32_t            DurationSeconds;    // 0 runs until interrupted
+} EmulatorScenario;
+
+// Loads a scenario file. Each line holds one directive; '#' starts a comment.
+//
+//   device <name, may contain spaces>
+//   interface <uri>
+//   event <name> <schema> <rate_hz> [units]
+//   property <name> <schema> [writeable] [latency_ms]
+//   command <name> <input_schema> <output_schema> [latency_ms]
+//   batch <samples> [max_delay_ms]
+//   noise <probability>
+//   duration <seconds>
+//
+// Schemas are byte, float, double, int, long and boolean. Events, properties and
+// commands belong to the interface declared before them. Returns false and prints
+// the offending line if the file cannot be used.
+bool
+EmulatorScenario_Load(
+    const char*         Path,
+    EmulatorScenario*   Scenario
+);
+
+#ifdef __cplusplus
+}
+#endif
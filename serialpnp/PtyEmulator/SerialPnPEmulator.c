@@ -0,0 +1,636 @@
+//
+// Serial PnP Device Emulator
+//
+// Runs the Serial PnP device library on a Linux host, behind a pseudo-terminal
+// that the gateway opens like the serial port of a real device. What the
+// device exposes and how it behaves is described by a scenario file.
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+//
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "EmulatorScenario.h"
+
+#define EMULATOR_RX_BUFFER_SIZE         4096
+#define EMULATOR_TX_BUFFER_SIZE         65536
+#define EMULATOR_MAX_POLL_MS            10
+#define EMULATOR_WAVE_PERIOD_SECONDS    10.0
+
+// Samples waiting to be sent in the next batch of an interface
+typedef struct _EmulatorBatch {
+    SerialPnPEventSample    Samples[SERIALPNP_MAX_BATCH_SAMPLES];
+    uint64_t                Values[SERIALPNP_MAX_BATCH_SAMPLES];
+    double                  SampleTimes[SERIALPNP_MAX_BATCH_SAMPLES];
+    uint8_t                 Count;
+} EmulatorBatch;
+
+typedef struct _EmulatorStatistics {
+    uint64_t                EventSamples;
+    uint64_t                EventPackets;
+    uint64_t                PropertyRequests;
+    uint64_t                CommandRequests;
+    uint64_t                BytesReceived;
+    uint64_t                BytesSent;
+    uint64_t                BytesDropped;       // host not reading, pty buffer full
+    uint64_t                BytesCorrupted;     // injected line noise
+} EmulatorStatistics;
+
+//
+// Global Variables
+//
+EmulatorScenario            g_EmulatorScenario;
+EmulatorStatistics          g_EmulatorStatistics;
+int                         g_EmulatorMaster = -1;
+volatile sig_atomic_t       g_EmulatorStop = 0;
+
+// The host starts talking first; until then nothing is sent, as nobody would read it
+bool                        g_EmulatorHostActive = false;
+
+uint8_t                     g_EmulatorRxBuffer[EMULATOR_RX_BUFFER_SIZE];
+unsigned int                g_EmulatorRxHead = 0;
+unsigned int                g_EmulatorRxCount = 0;
+uint8_t                     g_EmulatorTxBuffer[EMULATOR_TX_BUFFER_SIZE];
+unsigned int                g_EmulatorTxCount = 0;
+
+double                      g_EmulatorNextEvent[SERIALPNP_MAX_EVENT_COUNT];
+int                         g_EmulatorEventIndex[SERIALPNP_MAX_EVENT_COUNT];
+uint64_t                    g_EmulatorEventCounter[SERIALPNP_MAX_EVENT_COUNT];
+EmulatorBatch               g_EmulatorBatches[EMULATOR_MAX_INTERFACES];
+uint64_t                    g_EmulatorPropertyValues[SERIALPNP_MAX_CALLBACK_COUNT];
+
+//
+// Helpers
+//
+static double
+Emulator_NowMs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000.0) + (now.tv_nsec / 1000000.0);
+}
+
+// The device clock given to Serial PnP, so the host can timestamp events
+static uint32_t
+Emulator_ClockMs()
+{
+    return (uint32_t) Emulator_NowMs();
+}
+
+static void
+Emulator_SleepMs(
+    uint32_t            Milliseconds
+)
+{
+    struct timespec duration;
+
+    duration.tv_sec = Milliseconds / 1000;
+    duration.tv_nsec = (long) (Milliseconds % 1000) * 1000000L;
+    while ((nanosleep(&duration, &duration) != 0) && (errno == EINTR) && !g_EmulatorStop);
+}
+
+static void
+Emulator_FlushTx()
+{
+    unsigned int offset = 0;
+
+    while (offset < g_EmulatorTxCount) {
+        ssize_t written = write(g_EmulatorMaster, g_EmulatorTxBuffer + offset, g_EmulatorTxCount - offset);
+
+        if (written > 0) {
+            offset += (unsigned int) written;
+        } else if ((written < 0) && (errno == EINTR)) {
+            continue;
+        } else {
+            // Like a UART nobody listens to, output the host does not take is lost
+            g_EmulatorStatistics.BytesDropped += g_EmulatorTxCount - offset;
+            break;
+        }
+    }
+
+    g_EmulatorStatistics.BytesSent += offset;
+    g_EmulatorTxCount = 0;
+}
+
+static void
+Emulator_ReceiveRx()
+{
+    while (g_EmulatorRxCount < EMULATOR_RX_BUFFER_SIZE) {
+        uint8_t buffer[256];
+        unsigned int space = EMULATOR_RX_BUFFER_SIZE - g_EmulatorRxCount;
+        ssize_t received = read(g_EmulatorMaster, buffer, (space < sizeof(buffer)) ? space : sizeof(buffer));
+        ssize_t c;
+
+        if (received <= 0) {
+            break;
+        }
+
+        for (c = 0; c < received; c++) {
+            g_EmulatorRxBuffer[(g_EmulatorRxHead + g_EmulatorRxCount++) % EMULATOR_RX_BUFFER_SIZE] = buffer[c];
+        }
+
+        g_EmulatorStatistics.BytesReceived += (uint64_t) received;
+        g_EmulatorHostActive = true;
+    }
+}
+
+//
+// Platform Functions
+//
+void
+SerialPnP_PlatformSerialInit()
+{
+    g_EmulatorRxHead = 0;
+    g_EmulatorRxCount = 0;
+    g_EmulatorTxCount = 0;
+}
+
+unsigned int
+SerialPnP_PlatformSerialAvailable()
+{
+    return g_EmulatorRxCount;
+}
+
+int
+SerialPnP_PlatformSerialRead()
+{
+    uint8_t inb;
+
+    if (g_EmulatorRxCount == 0) {
+        return -1;
+    }
+
+    inb = g_EmulatorRxBuffer[g_EmulatorRxHead];
+    g_EmulatorRxHead = (g_EmulatorRxHead + 1) % EMULATOR_RX_BUFFER_SIZE;
+    g_EmulatorRxCount--;
+    return inb;
+}
+
+void
+SerialPnP_PlatformSerialWrite(
+    char            Character
+)
+{
+    if ((g_EmulatorScenario.NoiseProbability > 0) &&
+        ((double) rand() / RAND_MAX < g_EmulatorScenario.NoiseProbability)) {
+        Character = (char) (rand() & 0xFF);
+        g_EmulatorStatistics.BytesCorrupted++;
+    }
+
+    if (g_EmulatorTxCount == EMULATOR_TX_BUFFER_SIZE) {
+        Emulator_FlushTx();
+    }
+
+    g_EmulatorTxBuffer[g_EmulatorTxCount++] = (uint8_t) Character;
+}
+
+void
+SerialPnP_PlatformReset()
+{
+    // Nothing to reinitialize; the host learns that the device is ready again
+    SerialPnP_Ready();
+}
+
+//
+// Properties and Commands
+//
+
+// Requests are served after the latency the scenario gives them, during which the
+// device does nothing else, as on a single threaded MCU.
+static void
+Emulator_HandleCallback(
+    uint8_t         Index,
+    void*           Input,
+    void*           Output
+)
+{
+    const EmulatorCallback* cb = &g_EmulatorScenario.Callbacks[Index];
+    int32_t result;
+
+    if (cb->LatencyMs) {
+        Emulator_SleepMs(cb->LatencyMs);
+    }
+
+    if (cb->IsCommand) {
+        // Commands echo their input; the library always returns 4 bytes
+        g_EmulatorStatistics.CommandRequests++;
+        result = 0;
+        if (Input) {
+            memcpy(&result, Input, sizeof(result));
+        }
+    } else {
+        g_EmulatorStatistics.PropertyRequests++;
+        if (Input && cb->Writeable) {
+            memcpy(&g_EmulatorPropertyValues[Index], Input, sizeof(int32_t));
+        }
+        memcpy(&result, &g_EmulatorPropertyValues[Index], sizeof(result));
+    }
+
+    memcpy(Output, &result, sizeof(result));
+}
+
+// The library passes no context to callbacks, so each callback slot gets its own entry point
+#define EMULATOR_CALLBACK(n)                                \
+    static void Emulator_Callback##n(void* In, void* Out)   \
+    {                                                       \
+        Emulator_HandleCallback(n, In, Out);                \
+    }
+
+EMULATOR_CALLBACK(0)
+EMULATOR_CALLBACK(1)
+EMULATOR_CALLBACK(2)
+EMULATOR_CALLBACK(3)
+EMULATOR_CALLBACK(4)
+EMULATOR_CALLBACK(5)
+EMULATOR_CALLBACK(6)
+EMULATOR_CALLBACK(7)
+
+static SerialPnPCb const g_EmulatorCallbacks[] = {
+    Emulator_Callback0, Emulator_Callback1, Emulator_Callback2, Emulator_Callback3,
+    Emulator_Callback4, Emulator_Callback5, Emulator_Callback6, Emulator_Callback7,
+};
+
+_Static_assert(sizeof(g_EmulatorCallbacks) / sizeof(g_EmulatorCallbacks[0]) == SERIALPNP_MAX_CALLBACK_COUNT,
+               "one entry point is needed per callback slot");
+
+//
+// Events
+//
+static void
+Emulator_SampleValue(
+    uint8_t         Event,
+    double          NowMs,
+    void*           Value
+)
+{
+    const EmulatorEvent* ev = &g_EmulatorScenario.Events[Event];
+    uint64_t counter = g_EmulatorEventCounter[Event]++;
+
+    // Real valued events follow a slow wave, integers count samples
+    double wave = 20.0 + 5.0 * sin((2 * M_PI * NowMs / 1000.0 / EMULATOR_WAVE_PERIOD_SECONDS) + Event);
+    float f = (float) wave;
+    int32_t i = (int32_t) counter;
+    int64_t l = (int64_t) counter;
+    uint8_t b = (uint8_t) counter;
+
+    switch (ev->Schema) {
+    case SerialPnPSchema_Float:     memcpy(Value, &f, sizeof(f)); break;
+    case SerialPnPSchema_Double:    memcpy(Value, &wave, sizeof(wave)); break;
+    case SerialPnPSchema_Int:       memcpy(Value, &i, sizeof(i)); break;
+    case SerialPnPSchema_Long:      memcpy(Value, &l, sizeof(l)); break;
+    case SerialPnPSchema_Boolean:   b &= 1; memcpy(Value, &b, sizeof(b)); break;
+    default:                        memcpy(Value, &b, sizeof(b)); break;
+    }
+}
+
+static void
+Emulator_SendBatch(
+    uint8_t         Interface,
+    double          NowMs
+)
+{
+    EmulatorBatch* batch = &g_EmulatorBatches[Interface];
+    uint8_t s;
+
+    if (batch->Count == 0) {
+        return;
+    }
+
+    for (s = 0; s < batch->Count; s++) {
+        double age = NowMs - batch->SampleTimes[s];
+        batch->Samples[s].TimeDelta = (age > 0xFFFF) ? 0xFFFF : (uint16_t) age;
+    }
+
+    if (SerialPnP_SendEventBatch(batch->Samples, batch->Count, true)) {
+        g_EmulatorStatistics.EventPackets++;
+    }
+    batch->Count = 0;
+}
+
+static void
+Emulator_SendEvent(
+    uint8_t         Event,
+    double          NowMs
+)
+{
+    const EmulatorEvent* ev = &g_EmulatorScenario.Events[Event];
+    uint64_t value = 0;
+
+    Emulator_SampleValue(Event, NowMs, &value);
+    g_EmulatorStatistics.EventSamples++;
+
+    if (g_EmulatorScenario.BatchSize > 0) {
+        EmulatorBatch* batch = &g_EmulatorBatches[ev->Interface];
+
+        batch->Values[batch->Count] = value;
+        batch->SampleTimes[batch->Count] = NowMs;
+        batch->Samples[batch->Count].Event = (uint8_t) g_EmulatorEventIndex[Event];
+        batch->Samples[batch->Count].Value = &batch->Values[batch->Count];
+        if (++batch->Count >= g_EmulatorScenario.BatchSize) {
+            Emulator_SendBatch(ev->Interface, NowMs);
+        }
+        return;
+    }
+
+    // The single event calls only exist for the first interface's float and int events;
+    // everything else goes out as a batch of one
+    if ((ev->Interface == 0) && (ev->Schema == SerialPnPSchema_Float)) {
+        float f;
+        memcpy(&f, &value, sizeof(f));
+        SerialPnP_SendEventFloat(ev->Name, f);
+    } else if ((ev->Interface == 0) && (ev->Schema == SerialPnPSchema_Int)) {
+        int32_t i;
+        memcpy(&i, &value, sizeof(i));
+        SerialPnP_SendEventInt(ev->Name, i);
+    } else {
+        SerialPnPEventSample sample = { (uint8_t) g_EmulatorEventIndex[Event], 0, &value };
+        SerialPnP_SendEventBatch(&sample, 1, false);
+    }
+    g_EmulatorStatistics.EventPackets++;
+}
+
+// Sends the events that are due and returns how long until the next one
+static double
+Emulator_RunEvents(
+    double          NowMs
+)
+{
+    double next = NowMs + EMULATOR_MAX_POLL_MS;
+    uint8_t e, i;
+
+    for (e = 0; e < g_EmulatorScenario.EventCount; e++) {
+        double period = 1000.0 / g_EmulatorScenario.Events[e].RateHz;
+
+        // Catch up after a stall (e.g. a slow command) without sending a burst
+        if (NowMs - g_EmulatorNextEvent[e] > 1000.0) {
+            g_EmulatorNextEvent[e] = NowMs;
+        }
+
+        while (g_EmulatorNextEvent[e] <= NowMs) {
+            Emulator_SendEvent(e, NowMs);
+            g_EmulatorNextEvent[e] += period;
+        }
+
+        if (g_EmulatorNextEvent[e] < next) {
+            next = g_EmulatorNextEvent[e];
+        }
+    }
+
+    for (i = 0; i < g_EmulatorScenario.InterfaceCount; i++) {
+        EmulatorBatch* batch = &g_EmulatorBatches[i];
+
+        if (batch->Count == 0) {
+            continue;
+        }
+
+        if (NowMs - batch->SampleTimes[0] >= g_EmulatorScenario.BatchDelayMs) {
+            Emulator_SendBatch(i, NowMs);
+        } else if (batch->SampleTimes[0] + g_EmulatorScenario.BatchDelayMs < next) {
+            next = batch->SampleTimes[0] + g_EmulatorScenario.BatchDelayMs;
+        }
+    }
+
+    return next - NowMs;
+}
+
+//
+// Setup
+//
+static bool
+Emulator_DefineDevice()
+{
+    const EmulatorScenario* scenario = &g_EmulatorScenario;
+    uint8_t i, e, c;
+
+    SerialPnP_Setup(scenario->DeviceName);
+    SerialPnP_SetClock(Emulator_ClockMs);
+
+    for (i = 0; i < scenario->InterfaceCount; i++) {
+        SerialPnP_NewInterface(scenario->Interfaces[i]);
+
+        for (e = 0; e < scenario->EventCount; e++) {
+            const EmulatorEvent* ev = &scenario->Events[e];
+
+            if (ev->Interface == i) {
+                SerialPnP_NewEvent(ev->Name, ev->Name, ev->Name, ev->Schema, ev->Units);
+            }
+        }
+
+        // Callback slots are taken in registration order. Scenario items always follow
+        // their interface, so slot c serves the scenario's callback c.
+        for (c = 0; c < scenario->CallbackCount; c++) {
+            const EmulatorCallback* cb = &scenario->Callbacks[c];
+
+            if (cb->Interface != i) {
+                continue;
+            }
+
+            if (cb->IsCommand) {
+                SerialPnP_NewCommand(cb->Name, cb->Name, cb->Name, cb->Schema, cb->OutputSchema,
+                                     (SerialPnPCb*) g_EmulatorCallbacks[c]);
+            } else {
+                SerialPnP_NewProperty(cb->Name, cb->Name, cb->Name, "", cb->Schema, false, cb->Writeable,
+                                      (SerialPnPCb*) g_EmulatorCallbacks[c]);
+            }
+        }
+    }
+
+    for (e = 0; e < scenario->EventCount; e++) {
+        g_EmulatorEventIndex[e] = SerialPnP_GetEventIndex(scenario->Events[e].Name);
+        if (g_EmulatorEventIndex[e] < 0) {
+            fprintf(stderr, "Event %s could not be defined\n", scenario->Events[e].Name);
+            return false;
+        }
+    }
+
+    SerialPnP_Ready();
+    return true;
+}
+
+//
+// Pseudo-terminal
+//
+
+// Opens the pty pair. The slave side is kept open so that the master never sees a
+// hang-up while the gateway has the port closed, as with a device that stays plugged in.
+static bool
+Emulator_OpenPty(
+    const char*     LinkPath,
+    int*            Slave
+)
+{
+    struct termios tty;
+    const char* slaveName;
+
+    g_EmulatorMaster = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if ((g_EmulatorMaster < 0) || (grantpt(g_EmulatorMaster) != 0) || (unlockpt(g_EmulatorMaster) != 0)) {
+        perror("Unable to create pseudo-terminal");
+        return false;
+    }
+
+    slaveName = ptsname(g_EmulatorMaster);
+    *Slave = (slaveName != 0) ? open(slaveName, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+    if (*Slave < 0) {
+        perror("Unable to open pseudo-terminal");
+        return false;
+    }
+
+    // Raw bytes both ways, like a UART
+    if (tcgetattr(*Slave, &tty) == 0) {
+        cfmakeraw(&tty);
+        (void) tcsetattr(*Slave, TCSANOW, &tty);
+    }
+
+    if (LinkPath) {
+        (void) unlink(LinkPath);
+        if (symlink(slaveName, LinkPath) != 0) {
+            perror("Unable to create link to pseudo-terminal");
+            return false;
+        }
+    }
+
+    printf("Serial PnP emulator '%s' is on %s%s%s\n",
+           g_EmulatorScenario.DeviceName, slaveName,
+           LinkPath ? ", linked from " : "", LinkPath ? LinkPath : "");
+    fflush(stdout);
+    return true;
+}
+
+static void
+Emulator_Stop(
+    int             Signal
+)
+{
+    (void) Signal;
+    g_EmulatorStop = 1;
+}
+
+static void
+Emulator_PrintStatistics(
+    double          ElapsedMs
+)
+{
+    const EmulatorStatistics* stats = &g_EmulatorStatistics;
+    double seconds = (ElapsedMs > 0) ? ElapsedMs / 1000.0 : 1.0;
+
+    printf("Ran for %.1f s\n", seconds);
+    printf("  event samples     %llu (%.1f/s) in %llu packets\n",
+           (unsigned long long) stats->EventSamples, stats->EventSamples / seconds,
+           (unsigned long long) stats->EventPackets);
+    printf("  property requests %llu\n", (unsigned long long) stats->PropertyRequests);
+    printf("  command requests  %llu\n", (unsigned long long) stats->CommandRequests);
+    printf("  bytes received    %llu\n", (unsigned long long) stats->BytesReceived);
+    printf("  bytes sent        %llu (%.1f/s)\n",
+           (unsigned long long) stats->BytesSent, stats->BytesSent / seconds);
+    printf("  bytes dropped     %llu\n", (unsigned long long) stats->BytesDropped);
+    printf("  bytes corrupted   %llu\n", (unsigned long long) stats->BytesCorrupted);
+}
+
+static void
+Emulator_Usage(
+    const char*     Program
+)
+{
+    fprintf(stderr,
+            "Usage: %s [-l link] [-s seed] scenario\n"
+            "  -l link   create a symbolic link to the emulated port, e.g. /tmp/ttySerialPnP\n"
+            "  -s seed   seed of the line noise generator\n",
+            Program);
+}
+
+int
+main(
+    int             argc,
+    char**          argv
+)
+{
+    const char* linkPath = 0;
+    unsigned int seed = (unsigned int) time(0);
+    double startMs, nextMs;
+    int slave = -1;
+    int option;
+    uint8_t e;
+
+    while ((option = getopt(argc, argv, "l:s:h")) != -1) {
+        switch (option) {
+        case 'l': linkPath = optarg; break;
+        case 's': seed = (unsigned int) strtoul(optarg, 0, 10); break;
+        default:  Emulator_Usage(argv[0]); return 2;
+        }
+    }
+
+    if ((optind != argc - 1) || !EmulatorScenario_Load(argv[optind], &g_EmulatorScenario)) {
+        if (optind != argc - 1) {
+            Emulator_Usage(argv[0]);
+        }
+        return 2;
+    }
+
+    srand(seed);
+    signal(SIGINT, Emulator_Stop);
+    signal(SIGTERM, Emulator_Stop);
+
+    if (!Emulator_OpenPty(linkPath, &slave) || !Emulator_DefineDevice()) {
+        return 1;
+    }
+
+    // The ready notification is only meant for a host that is listening
+    g_EmulatorTxCount = 0;
+
+    startMs = Emulator_NowMs();
+    for (e = 0; e < g_EmulatorScenario.EventCount; e++) {
+        g_EmulatorNextEvent[e] = startMs;
+    }
+
+    nextMs = startMs + EMULATOR_MAX_POLL_MS;
+    while (!g_EmulatorStop) {
+        struct pollfd pfd = { g_EmulatorMaster, POLLIN, 0 };
+        double nowMs = Emulator_NowMs();
+        int timeout = (nextMs > nowMs) ? (int) (nextMs - nowMs) + 1 : 0;
+
+        if ((g_EmulatorScenario.DurationSeconds > 0) &&
+            (nowMs - startMs >= g_EmulatorScenario.DurationSeconds * 1000.0)) {
+            break;
+        }
+
+        if (poll(&pfd, 1, (timeout > EMULATOR_MAX_POLL_MS) ? EMULATOR_MAX_POLL_MS : timeout) > 0) {
+            Emulator_ReceiveRx();
+        }
+
+        SerialPnP_Process();
+
+        nowMs = Emulator_NowMs();
+        if (g_EmulatorHostActive) {
+            nextMs = nowMs + Emulator_RunEvents(nowMs);
+        } else {
+            // Keep the schedule from piling up while nobody listens
+            for (e = 0; e < g_EmulatorScenario.EventCount; e++) {
+                g_EmulatorNextEvent[e] = nowMs;
+            }
+            nextMs = nowMs + EMULATOR_MAX_POLL_MS;
+        }
+
+        Emulator_FlushTx();
+    }
+
+    Emulator_PrintStatistics(Emulator_NowMs() - startMs);
+
+    if (linkPath) {
+        (void) unlink(linkPath);
+    }
+    close(slave);
+    close(g_EmulatorMaster);
+    return 0;
+}
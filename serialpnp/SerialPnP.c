@@ -6,7 +6,6 @@
 //
 #include "SerialPnP.h"
 #include <string.h>
-#include <stdlib.h>
 
 #define SERIALPNP_PROTOCOL_VERSION          0x01
 #define SERIALPNP_PROTOCOL_PACKETSTART      0x5A
@@ -21,13 +20,58 @@
 #define SERIALPNP_PACKETTYPE_COMMANDRESP    6
 #define SERIALPNP_PACKETTYPE_PROPREQ        7
 #define SERIALPNP_PACKETTYPE_PROPRESP       8
+#define SERIALPNP_PACKETTYPE_PROPNOTIFY     9
 #define SERIALPNP_PACKETTYPE_EVENT          10
+#define SERIALPNP_PACKETTYPE_EVENTBATCH     11
+#define SERIALPNP_PACKETTYPE_DESCHASHREQ    12
+#define SERIALPNP_PACKETTYPE_DESCHASHRESP   13
+
+#define SERIALPNP_FNV_OFFSET_BASIS          0x811C9DC5
+#define SERIALPNP_FNV_PRIME                 0x01000193
+
+#define SERIALPNP_EVENTBATCH_FLAG_TIMEDELTA 0x01
+#define SERIALPNP_EVENTBATCH_FLAG_TIMESTAMP 0x02
+
+// Header flags. A descriptor hash request with TIMESTAMPS asks for event
+// timestamps; an event with TIMESTAMP ends with the device time it was sent.
+#define SERIALPNP_REQUEST_FLAG_TIMESTAMPS   0x01
+#define SERIALPNP_PACKET_FLAG_TIMESTAMP     0x01
 
 #define SERIALPNP_DESCRIPTORTYPE_INTERFACE  5
 #define SERIALPNP_DESCRIPTORTYPE_COMMAND    1
 #define SERIALPNP_DESCRIPTORTYPE_PROPERTY   2
 #define SERIALPNP_DESCRIPTORTYPE_EVENT      3
 
+#define SERIALPNP_PACKET_HEADER_SIZE        4
+#define SERIALPNP_PACKET_NAME_OFFSET        6
+
+// Callbacks are found through an open addressing table keyed by the FNV-1a hash
+// of the interface, descriptor type and name. Keeping it at least twice the
+// number of callbacks means a lookup almost always inspects a single entry.
+#define SERIALPNP_CALLBACK_TABLE_SIZE       16
+#define SERIALPNP_CALLBACK_TABLE_MASK       (SERIALPNP_CALLBACK_TABLE_SIZE - 1)
+#define SERIALPNP_RXRING_MASK               (SERIALPNP_RXRING_SIZE - 1)
+
+// Compile-time checks; C99 has no static assertions
+typedef char SerialPnPCallbackTableCheck[((SERIALPNP_CALLBACK_TABLE_SIZE & SERIALPNP_CALLBACK_TABLE_MASK) == 0) &&
+                                         (SERIALPNP_CALLBACK_TABLE_SIZE >= 2 * SERIALPNP_MAX_CALLBACK_COUNT) ? 1 : -1];
+typedef char SerialPnPRxRingCheck[((SERIALPNP_RXRING_SIZE & SERIALPNP_RXRING_MASK) == 0) &&
+                                  (SERIALPNP_RXRING_SIZE <= 128) ? 1 : -1];
+
+// Orders the ring indices against the ring contents. A compiler barrier is all
+// a single core needs to see the interrupt handler's writes in order; on a
+// hosted system the producer may run on another core, so a full fence is used.
+// Other multi-core platforms must define SERIALPNP_RX_BARRIER themselves.
+#ifndef SERIALPNP_RX_BARRIER
+#if defined(__GNUC__) && defined(__linux__)
+#define SERIALPNP_RX_BARRIER()              __sync_synchronize()
+#elif defined(__GNUC__)
+#define SERIALPNP_RX_BARRIER()              __asm__ __volatile__("" ::: "memory")
+#else
+#define SERIALPNP_RX_BARRIER()
+#endif
+#endif
+
 //
 // Struct & Type Definitions
 //
@@ -35,41 +79,72 @@ typedef struct _SerialPnPPacketHeader {
     uint16_t                    Length;
     uint8_t                     PacketType;
     uint8_t                     Reserved;
-    char                        Body[0];
 } SerialPnPPacketHeader;
 
 typedef struct _SerialPnPPacketBody {
     uint8_t                     InterfaceId;
     uint8_t                     NameLength;
-    char                        Payload[0];
 } SerialPnPPacketBody;
 
-typedef struct _SerialPnPDescriptorEntry {
-    struct _SerialPnPDescriptorEntry
-                                *Next;
-    uint16_t                    ContentSize;
-    char                        Content[0];
-} SerialPnPDescriptorEntry;
+typedef struct _SerialPnPEvent {
+    uint16_t                    DescriptorOffset;
+    uint8_t                     InterfaceId;
+    uint8_t                     Index;      // position of the event within its interface
+    uint8_t                     ValueSize;  // 0 if the schema cannot be batched
+} SerialPnPEvent;
 
 typedef struct _SerialPnPCallback {
-    SerialPnPDescriptorEntry*   DescriptorEntry;
+    uint32_t                    Hash;
+    uint16_t                    DescriptorOffset;
+    uint8_t                     InterfaceId;
     void*                       Callback;
 } SerialPnPCallback;
 
+// State of the receive parser, kept between calls to SerialPnP_Process so that
+// a packet may arrive in any number of pieces
+typedef enum _SerialPnPRxState {
+    SerialPnPRxState_Idle = 0,  // waiting for the start of a packet
+    SerialPnPRxState_Receiving,
+    SerialPnPRxState_Discarding // packet does not fit the receive buffer
+} SerialPnPRxState;
+
 //
 // Global Variables
 //
-SerialPnPDescriptorEntry*       g_SerialPnPDescriptor = 0;
-char                            g_SerialPnPRxBuffer[SERIALPNP_RXBUFFER_SIZE];
+// The descriptor is built in place, one entry after the other, in the order
+// the host expects to receive it.
+uint8_t                         g_SerialPnPDescriptor[SERIALPNP_DESCRIPTOR_SIZE];
+uint16_t                        g_SerialPnPDescriptorLength = 0;
+bool                            g_SerialPnPDescriptorFull = false;
+uint8_t                         g_SerialPnPRxBuffer[SERIALPNP_RXBUFFER_SIZE];
+SerialPnPRxState                g_SerialPnPRxState = SerialPnPRxState_Idle;
 bool                            g_SerialPnPRxEscaped = false;
-uint8_t                         g_SerialPnPRxBufferIndex = 0;
+uint16_t                        g_SerialPnPRxIndex = 0;
+uint16_t                        g_SerialPnPRxLength = 0;
+// Single producer, single consumer ring. Only the producer writes the head and
+// only SerialPnP_Process writes the tail; both run freely and wrap at 256.
+volatile uint8_t                g_SerialPnPRxRing[SERIALPNP_RXRING_SIZE];
+volatile uint8_t                g_SerialPnPRxRingHead = 0;
+volatile uint8_t                g_SerialPnPRxRingTail = 0;
 SerialPnPCallback               g_SerialPnPCallbacks[SERIALPNP_MAX_CALLBACK_COUNT];
+uint8_t                         g_SerialPnPCallbackCount = 0;
+uint8_t                         g_SerialPnPCallbackTable[SERIALPNP_CALLBACK_TABLE_SIZE]; // callback index + 1, 0 if free
+SerialPnPEvent                  g_SerialPnPEvents[SERIALPNP_MAX_EVENT_COUNT];
+uint8_t                         g_SerialPnPEventCount = 0;
+uint8_t                         g_SerialPnPInterfaceCount = 0;
+uint8_t                         g_SerialPnPInterfaceEventCount = 0;
+uint32_t                        g_SerialPnPDescriptorHash = 0;
+SerialPnPClock                  g_SerialPnPClock = NULL;
+// The host asked for timestamped events; forgotten on reset
+bool                            g_SerialPnPTimestamps = false;
 
 //
 // Internal Function Definitions
 //
 void
-SerialPnP_SendEventRaw(
+SerialPnP_SendNotificationRaw(
+    uint8_t                     PacketType,
+    uint8_t                     DescriptorType,
     const char*                 Name,
     void*                       Value,
     uint8_t                     ValueSize
@@ -77,36 +152,101 @@ SerialPnP_SendEventRaw(
 
 void
 SerialPnP_SerialWriteBuffer(
-    char*                       Buffer,
+    const char*                 Buffer,
     uint16_t                    BufferSize
 );
 
+void
+SerialPnP_SendDescriptorHash(
+    uint8_t                     PacketType
+);
+
 void
 SerialPnP_SerialWriteChar(
     char                        Out
 );
 
 void
-SerialPnP_AppendDescriptor(
-    SerialPnPDescriptorEntry*   NewEntry
+SerialPnP_SerialWriteUint32(
+    uint32_t                    Out
+);
+
+uint8_t*
+SerialPnP_NewDescriptorEntry(
+    uint16_t                    Size
+);
+
+uint16_t
+SerialPnP_DescriptorPutString(
+    uint8_t*                    Entry,
+    uint16_t                    Offset,
+    const char*                 Value,
+    uint8_t                     Length
 );
 
 void
 SerialPnP_AddCallback(
-    SerialPnPDescriptorEntry*   DescriptorEntry,
+    const uint8_t*              DescriptorEntry,
     void*                       Callback
 );
 
+void
+SerialPnP_AddEvent(
+    const uint8_t*              DescriptorEntry,
+    SerialPnPSchema             Schema
+);
+
+uint8_t
+SerialPnP_SchemaSize(
+    SerialPnPSchema             Schema
+);
+
+uint16_t
+SerialPnP_DescriptorEntrySize(
+    const uint8_t*              Entry
+);
+
+uint8_t
+SerialPnP_FindInterfaceId(
+    uint8_t                     Type,
+    const char*                 Name,
+    uint8_t                     NameSize
+);
+
+uint32_t
+SerialPnP_CallbackHash(
+    uint8_t                     InterfaceId,
+    uint8_t                     Type,
+    const char*                 Name,
+    uint8_t                     NameSize
+);
+
 SerialPnPCallback*
 SerialPnP_FindCallback(
+    uint8_t                     InterfaceId,
     uint8_t                     Type,
     const char*                 Name,
     uint8_t                     NameSize
 );
 
+void
+SerialPnP_RxByte(
+    uint8_t                     Inb
+);
+
 void
 SerialPnP_ProcessPacket(
-    SerialPnPPacketHeader       *Packet
+    const uint8_t*              Packet,
+    uint16_t                    Length
+);
+
+void
+SerialPnP_SendCallbackResponse(
+    uint8_t                     PacketType,
+    uint8_t                     InterfaceId,
+    const uint8_t*              Name,
+    uint8_t                     NameLength,
+    const void*                 Value
 );
 
 //
@@ -117,45 +257,66 @@ SerialPnP_Setup(
     const char*     DeviceName
 )
 {
-    char* rawDescriptorEntry;
+    uint8_t* rawDescriptorEntry;
     uint8_t deviceNameLength = strlen(DeviceName);
 
     // Reset state
-    g_SerialPnPRxBufferIndex = 0;
+    g_SerialPnPRxState = SerialPnPRxState_Idle;
     g_SerialPnPRxEscaped = false;
+    g_SerialPnPRxIndex = 0;
+    g_SerialPnPRxLength = 0;
+    g_SerialPnPRxRingTail = g_SerialPnPRxRingHead;
 
-    // First record holds version, name length, and name.
-    g_SerialPnPDescriptor = malloc(sizeof(SerialPnPDescriptorEntry) +
-                                   deviceNameLength + 2);
-    g_SerialPnPDescriptor->ContentSize = deviceNameLength + 2;
-    g_SerialPnPDescriptor->Next = 0;
-
-    rawDescriptorEntry = g_SerialPnPDescriptor->Content;
-    rawDescriptorEntry[0] = SERIALPNP_PROTOCOL_VERSION;
-    rawDescriptorEntry[1] = deviceNameLength;
-
-    memcpy(&rawDescriptorEntry[2],
-           DeviceName,
-           deviceNameLength);
+    g_SerialPnPDescriptorLength = 0;
+    g_SerialPnPDescriptorFull = false;
+    g_SerialPnPTimestamps = false;
 
     memset(g_SerialPnPCallbacks, 0, sizeof(g_SerialPnPCallbacks));
+    memset(g_SerialPnPCallbackTable, 0, sizeof(g_SerialPnPCallbackTable));
+    memset(g_SerialPnPEvents, 0, sizeof(g_SerialPnPEvents));
+    g_SerialPnPCallbackCount = 0;
+    g_SerialPnPEventCount = 0;
+    g_SerialPnPInterfaceCount = 0;
+    g_SerialPnPInterfaceEventCount = 0;
+
+    // First record holds version, name length, and name.
+    rawDescriptorEntry = SerialPnP_NewDescriptorEntry(deviceNameLength + 2);
+    if (rawDescriptorEntry) {
+        rawDescriptorEntry[0] = SERIALPNP_PROTOCOL_VERSION;
+        SerialPnP_DescriptorPutString(rawDescriptorEntry, 1, DeviceName, deviceNameLength);
+    }
 
     // Call platform-specific initialization function for serial port.
     SerialPnP_PlatformSerialInit();
 }
 
+void
+SerialPnP_SetClock(
+    SerialPnPClock  Clock
+)
+{
+    g_SerialPnPClock = Clock;
+    if (!Clock) {
+        g_SerialPnPTimestamps = false;
+    }
+}
+
 void
 SerialPnP_Ready()
 {
-    // Send reset completion notification.
-    SerialPnPPacketHeader out = {0};
+    // The descriptor is complete now. Its hash lets the host reuse a cached copy
+    // instead of requesting the whole descriptor again.
+    uint32_t hash = SERIALPNP_FNV_OFFSET_BASIS;
+
+    for (uint16_t c = 0; c < g_SerialPnPDescriptorLength; c++) {
+        hash ^= g_SerialPnPDescriptor[c];
+        hash *= SERIALPNP_FNV_PRIME;
+    }
 
-    out.Length = sizeof(SerialPnPPacketHeader);
-    out.PacketType = SERIALPNP_PACKETTYPE_RESETRESP;
+    g_SerialPnPDescriptorHash = hash;
 
-    SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART);
-    SerialPnP_SerialWriteBuffer((char*) &out,
-                                sizeof(SerialPnPPacketHeader));
+    // Send reset completion notification.
+    SerialPnP_SendDescriptorHash(SERIALPNP_PACKETTYPE_RESETRESP);
 }
 
 void
@@ -163,14 +324,14 @@ SerialPnP_NewInterface(
     const char*     InterfaceIdUri
 )
 {
-    char* rawDescriptorEntry;
     uint16_t interfaceIdUriLength = strlen(InterfaceIdUri);
 
-    // Allocate a record to hold the interface definition
-    SerialPnPDescriptorEntry* entry = malloc(sizeof(SerialPnPDescriptorEntry) +
-                                             interfaceIdUriLength + 3);
-    entry->ContentSize = interfaceIdUriLength + 3;
-    rawDescriptorEntry = entry->Content;
+    // Reserve a record to hold the interface definition
+    uint8_t* rawDescriptorEntry = SerialPnP_NewDescriptorEntry(interfaceIdUriLength + 3);
+    if (!rawDescriptorEntry) {
+        return;
+    }
+
     rawDescriptorEntry[0] = SERIALPNP_DESCRIPTORTYPE_INTERFACE;
     rawDescriptorEntry[1] = interfaceIdUriLength & 0xFF;
     rawDescriptorEntry[2] = interfaceIdUriLength >> 8;
@@ -179,7 +340,9 @@ SerialPnP_NewInterface(
            InterfaceIdUri,
            interfaceIdUriLength);
 
-    SerialPnP_AppendDescriptor(entry);
+    // Events are numbered from zero within each interface
+    g_SerialPnPInterfaceCount++;
+    g_SerialPnPInterfaceEventCount = 0;
 }
 
 void
@@ -191,7 +354,6 @@ SerialPnP_NewEvent(
     const char*     Units
 )
 {
-    char* rawDescriptorEntry;
     uint16_t rawDescriptorOffset = 0;
 
     uint8_t nlen = strlen(Name);
@@ -199,42 +361,23 @@ SerialPnP_NewEvent(
     uint8_t desclen = strlen(Description);
     uint8_t ulen = strlen(Units);
 
-    SerialPnPDescriptorEntry* entry = malloc(sizeof(SerialPnPDescriptorEntry) +
-                                             nlen + dnlen + desclen + ulen +
-                                             7);
-    entry->ContentSize = nlen + dnlen + desclen + ulen + 7;
-    rawDescriptorEntry = entry->Content;
+    uint8_t* rawDescriptorEntry = SerialPnP_NewDescriptorEntry(nlen + dnlen + desclen + ulen + 7);
+    if (!rawDescriptorEntry) {
+        return;
+    }
+
     rawDescriptorEntry[rawDescriptorOffset++] = SERIALPNP_DESCRIPTORTYPE_EVENT;
 
-    rawDescriptorEntry[rawDescriptorOffset++] = nlen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Name,
-           nlen);
-    rawDescriptorOffset += nlen;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = dnlen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           DisplayName,
-           dnlen);
-    rawDescriptorOffset += dnlen;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = desclen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Description,
-           desclen);
-    rawDescriptorOffset += desclen;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = ulen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Units,
-           ulen);
-    rawDescriptorOffset += ulen;
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Name, nlen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, DisplayName, dnlen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Description, desclen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Units, ulen);
 
     // Schema is 2 bytes wide
     rawDescriptorEntry[rawDescriptorOffset++] = Schema;
     rawDescriptorEntry[rawDescriptorOffset++] = 0;
 
-    SerialPnP_AppendDescriptor(entry);
+    SerialPnP_AddEvent(rawDescriptorEntry, Schema);
 }
 
 void
@@ -249,58 +392,37 @@ SerialPnP_NewProperty(
     SerialPnPCb*    Callback
 )
 {
-    char* rawDescriptorEntry;
     uint16_t rawDescriptorOffset = 0;
+    uint8_t flags = 0;
 
     uint8_t nlen = strlen(Name);
     uint8_t dnlen = strlen(DisplayName);
     uint8_t desclen = strlen(Description);
     uint8_t ulen = strlen(Units);
 
-    SerialPnPDescriptorEntry* entry = malloc(sizeof(SerialPnPDescriptorEntry) +
-                                             nlen + dnlen + desclen + ulen +
-                                             8);
-    entry->ContentSize = nlen + dnlen + desclen + ulen + 8;
-    rawDescriptorEntry = entry->Content;
+    uint8_t* rawDescriptorEntry = SerialPnP_NewDescriptorEntry(nlen + dnlen + desclen + ulen + 8);
+    if (!rawDescriptorEntry) {
+        return;
+    }
+
     rawDescriptorEntry[rawDescriptorOffset++] = SERIALPNP_DESCRIPTORTYPE_PROPERTY;
 
-    rawDescriptorEntry[rawDescriptorOffset++] = nlen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Name,
-           nlen);
-    rawDescriptorOffset += nlen;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = dnlen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           DisplayName,
-           dnlen);
-    rawDescriptorOffset += dnlen;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = desclen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Description,
-           desclen);
-    rawDescriptorOffset += desclen;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = ulen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Units,
-           ulen);
-    rawDescriptorOffset += ulen;
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Name, nlen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, DisplayName, dnlen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Description, desclen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Units, ulen);
 
     // Schema is 2 bytes wide
     rawDescriptorEntry[rawDescriptorOffset++] = Schema;
     rawDescriptorEntry[rawDescriptorOffset++] = 0;
 
     // Set flags
-    ulen = 0;
-    if (Required) ulen |= (1 << 1);
-    if (Writeable) ulen |= (1 << 0);
+    if (Required) flags |= (1 << 1);
+    if (Writeable) flags |= (1 << 0);
 
-    rawDescriptorEntry[rawDescriptorOffset++] = ulen;
+    rawDescriptorEntry[rawDescriptorOffset++] = flags;
 
-    SerialPnP_AppendDescriptor(entry);
-    SerialPnP_AddCallback(entry, Callback);
+    SerialPnP_AddCallback(rawDescriptorEntry, Callback);
 }
 
 void
@@ -313,37 +435,22 @@ SerialPnP_NewCommand(
     SerialPnPCb*    Callback
 )
 {
-    char* rawDescriptorEntry;
     uint16_t rawDescriptorOffset = 0;
 
     uint8_t nlen = strlen(Name);
     uint8_t dnlen = strlen(DisplayName);
     uint8_t desclen = strlen(Description);
 
-    SerialPnPDescriptorEntry* entry = malloc(sizeof(SerialPnPDescriptorEntry) +
-                                             nlen + dnlen + desclen +
-                                             8);
-    entry->ContentSize = nlen + dnlen + desclen + 8;
-    rawDescriptorEntry = entry->Content;
-    rawDescriptorEntry[rawDescriptorOffset++] = SERIALPNP_DESCRIPTORTYPE_COMMAND;
-
-    rawDescriptorEntry[rawDescriptorOffset++] = nlen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Name,
-           nlen);
-    rawDescriptorOffset += nlen;
+    uint8_t* rawDescriptorEntry = SerialPnP_NewDescriptorEntry(nlen + dnlen + desclen + 8);
+    if (!rawDescriptorEntry) {
+        return;
+    }
 
-    rawDescriptorEntry[rawDescriptorOffset++] = dnlen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           DisplayName,
-           dnlen);
-    rawDescriptorOffset += dnlen;
+    rawDescriptorEntry[rawDescriptorOffset++] = SERIALPNP_DESCRIPTORTYPE_COMMAND;
 
-    rawDescriptorEntry[rawDescriptorOffset++] = desclen;
-    memcpy(&rawDescriptorEntry[rawDescriptorOffset],
-           Description,
-           desclen);
-    rawDescriptorOffset += desclen;
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Name, nlen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, DisplayName, dnlen);
+    rawDescriptorOffset = SerialPnP_DescriptorPutString(rawDescriptorEntry, rawDescriptorOffset, Description, desclen);
 
     // Schema is 2 bytes wide
     rawDescriptorEntry[rawDescriptorOffset++] = InputSchema;
@@ -352,73 +459,207 @@ SerialPnP_NewCommand(
     rawDescriptorEntry[rawDescriptorOffset++] = OutputSchema;
     rawDescriptorEntry[rawDescriptorOffset++] = 0;
 
-    SerialPnP_AppendDescriptor(entry);
-    SerialPnP_AddCallback(entry, Callback);
+    SerialPnP_AddCallback(rawDescriptorEntry, Callback);
+}
+
+bool
+SerialPnP_RxPush(
+    char            Character
+)
+{
+    uint8_t head = g_SerialPnPRxRingHead;
+
+    if ((uint8_t) (head - g_SerialPnPRxRingTail) == SERIALPNP_RXRING_SIZE) {
+        return false;
+    }
+
+    g_SerialPnPRxRing[head & SERIALPNP_RXRING_MASK] = (uint8_t) Character;
+
+    // The byte must be in the ring before the consumer can see the new head
+    SERIALPNP_RX_BARRIER();
+    g_SerialPnPRxRingHead = head + 1;
+    return true;
+}
+
+uint16_t
+SerialPnP_RxPushBuffer(
+    const char*     Buffer,
+    uint16_t        BufferSize
+)
+{
+    uint8_t head = g_SerialPnPRxRingHead;
+    uint8_t space = SERIALPNP_RXRING_SIZE - (uint8_t) (head - g_SerialPnPRxRingTail);
+    uint16_t count = (BufferSize < space) ? BufferSize : space;
+    uint16_t c;
+
+    for (c = 0; c < count; c++) {
+        g_SerialPnPRxRing[(uint8_t) (head + c) & SERIALPNP_RXRING_MASK] = (uint8_t) Buffer[c];
+    }
+
+    // Publish the whole block at once
+    SERIALPNP_RX_BARRIER();
+    g_SerialPnPRxRingHead = head + (uint8_t) count;
+    return count;
 }
 
 void
 SerialPnP_Process()
 {
+    uint8_t tail = g_SerialPnPRxRingTail;
+    uint8_t head = g_SerialPnPRxRingHead;
+
+    // Bytes queued by SerialPnP_RxPush... first. The head is read before the
+    // contents, and every slot is handed back as soon as it has been parsed, so
+    // the producer never waits for a packet handler to return.
+    SERIALPNP_RX_BARRIER();
+    while (tail != head) {
+        uint8_t inb = g_SerialPnPRxRing[tail & SERIALPNP_RXRING_MASK];
+
+        SERIALPNP_RX_BARRIER();
+        g_SerialPnPRxRingTail = ++tail;
+
+        SerialPnP_RxByte(inb);
+    }
+
+    // Then any bytes the platform buffers itself
     while (SerialPnP_PlatformSerialAvailable()) {
-        char inb = SerialPnP_PlatformSerialRead();
+        int inb = SerialPnP_PlatformSerialRead();
 
-        if (inb == SERIALPNP_PROTOCOL_PACKETSTART) {
-            g_SerialPnPRxBufferIndex = 0;
-            g_SerialPnPRxEscaped = false;
-            continue;
+        if (inb < 0) {
+            break;
         }
 
-        if (inb == SERIALPNP_PROTOCOL_ESCAPE) {
-            g_SerialPnPRxEscaped = true;
-            continue;
+        SerialPnP_RxByte((uint8_t) inb);
+    }
+}
+
+void
+SerialPnP_SendEventFloat(
+    const char*     Name,
+    float           Value
+)
+{
+    SerialPnP_SendNotificationRaw(SERIALPNP_PACKETTYPE_EVENT, SERIALPNP_DESCRIPTORTYPE_EVENT, Name, (void*) &Value, sizeof(float));
+}
+
+void
+SerialPnP_SendEventInt(
+    const char*     Name,
+    int32_t         Value
+)
+{
+    SerialPnP_SendNotificationRaw(SERIALPNP_PACKETTYPE_EVENT, SERIALPNP_DESCRIPTORTYPE_EVENT, Name, (void*) &Value, sizeof(int32_t));
+}
+
+int
+SerialPnP_GetEventIndex(
+    const char*     Name
+)
+{
+    uint8_t nlen = strlen(Name);
+    uint8_t c;
+
+    for (c = 0; c < g_SerialPnPEventCount; c++) {
+        const uint8_t* rawDescriptorEntry = &g_SerialPnPDescriptor[g_SerialPnPEvents[c].DescriptorOffset];
+
+        if ((rawDescriptorEntry[1] == nlen) &&
+            (memcmp(rawDescriptorEntry + 2, Name, nlen) == 0)) {
+            return c;
         }
+    }
+
+    return -1;
+}
+
+bool
+SerialPnP_SendEventBatch(
+    const SerialPnPEventSample* Samples,
+    uint8_t                     SampleCount,
+    bool                        IncludeTimeDelta
+)
+{
+    SerialPnPPacketHeader out = {0};
+    uint8_t interfaceId;
+    uint8_t s;
 
-        if (g_SerialPnPRxEscaped) {
-            inb++;
-            g_SerialPnPRxEscaped = false;
+    if ((SampleCount == 0) || (SampleCount > SERIALPNP_MAX_BATCH_SAMPLES)) {
+        return false;
+    }
+
+    interfaceId = (Samples[0].Event < g_SerialPnPEventCount) ?
+                  g_SerialPnPEvents[Samples[0].Event].InterfaceId : 0;
+
+    // The length is sent first, so validate and size the whole batch up front
+    out.Length = sizeof(SerialPnPPacketHeader) + 3; // interface id, flags, sample count
+    if (g_SerialPnPTimestamps) {
+        out.Length += sizeof(uint32_t);
+    }
+    for (s = 0; s < SampleCount; s++) {
+        SerialPnPEvent* ev;
+
+        if (Samples[s].Event >= g_SerialPnPEventCount) {
+            return false;
         }
 
-        if (g_SerialPnPRxBufferIndex >= SERIALPNP_RXBUFFER_SIZE) {
-            g_SerialPnPRxBufferIndex = SERIALPNP_RXBUFFER_SIZE - 1;
+        ev = &g_SerialPnPEvents[Samples[s].Event];
+        if ((ev->ValueSize == 0) || (ev->InterfaceId != interfaceId)) {
+            return false;
         }
 
-        g_SerialPnPRxBuffer[g_SerialPnPRxBufferIndex++] = inb;
+        out.Length += 1 + (IncludeTimeDelta ? sizeof(uint16_t) : 0) + ev->ValueSize;
+    }
 
-        if (g_SerialPnPRxBufferIndex >= sizeof(SerialPnPPacketHeader)) {
-            SerialPnPPacketHeader *p = (SerialPnPPacketHeader*) g_SerialPnPRxBuffer;
+    out.PacketType = SERIALPNP_PACKETTYPE_EVENTBATCH;
 
-            if (p->Length == g_SerialPnPRxBufferIndex) {
-                // we can parse the packet now
-                SerialPnP_ProcessPacket(p);
-                g_SerialPnPRxBufferIndex = 0;
-            }
+    SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
+    SerialPnP_SerialWriteBuffer((char*) &out, sizeof(SerialPnPPacketHeader));
+    SerialPnP_SerialWriteChar(interfaceId);
+    SerialPnP_SerialWriteChar((IncludeTimeDelta ? SERIALPNP_EVENTBATCH_FLAG_TIMEDELTA : 0) |
+                              (g_SerialPnPTimestamps ? SERIALPNP_EVENTBATCH_FLAG_TIMESTAMP : 0));
+    SerialPnP_SerialWriteChar(SampleCount);
+    if (g_SerialPnPTimestamps) {
+        SerialPnP_SerialWriteUint32(g_SerialPnPClock());
+    }
+
+    for (s = 0; s < SampleCount; s++) {
+        SerialPnPEvent* ev = &g_SerialPnPEvents[Samples[s].Event];
+
+        SerialPnP_SerialWriteChar(ev->Index);
+        if (IncludeTimeDelta) {
+            SerialPnP_SerialWriteChar(Samples[s].TimeDelta & 0xFF);
+            SerialPnP_SerialWriteChar(Samples[s].TimeDelta >> 8);
         }
+        SerialPnP_SerialWriteBuffer((const char*) Samples[s].Value, ev->ValueSize);
     }
+
+    return true;
 }
 
 void
-SerialPnP_SendEventFloat(
+SerialPnP_SendPropertyFloat(
     const char*     Name,
     float           Value
 )
 {
-    SerialPnP_SendEventRaw(Name, (void*) &Value, sizeof(float));
+    SerialPnP_SendNotificationRaw(SERIALPNP_PACKETTYPE_PROPNOTIFY, SERIALPNP_DESCRIPTORTYPE_PROPERTY, Name, (void*) &Value, sizeof(float));
 }
 
 void
-SerialPnP_SendEventInt(
+SerialPnP_SendPropertyInt(
     const char*     Name,
     int32_t         Value
 )
 {
-    SerialPnP_SendEventRaw(Name, (void*) &Value, sizeof(int32_t));
+    SerialPnP_SendNotificationRaw(SERIALPNP_PACKETTYPE_PROPNOTIFY, SERIALPNP_DESCRIPTORTYPE_PROPERTY, Name, (void*) &Value, sizeof(int32_t));
 }
 
 //
 // Internal Function Implementations
 //
 void
-SerialPnP_SendEventRaw(
+SerialPnP_SendNotificationRaw(
+    uint8_t                     PacketType,
+    uint8_t                     DescriptorType,
     const char*                 Name,
     void*                       Value,
     uint8_t                     ValueSize
@@ -427,32 +668,40 @@ SerialPnP_SendEventRaw(
     SerialPnPPacketHeader out = {0};
 
     uint8_t nlen = strlen(Name);
+    uint8_t interfaceId = SerialPnP_FindInterfaceId(DescriptorType, Name, nlen);
+    bool timestamp = (PacketType == SERIALPNP_PACKETTYPE_EVENT) && g_SerialPnPTimestamps;
+    uint32_t now = timestamp ? g_SerialPnPClock() : 0;
 
     out.Length = sizeof(SerialPnPPacketHeader) +
                  sizeof(SerialPnPPacketBody) +
                  nlen +
-                 ValueSize;
+                 ValueSize +
+                 (timestamp ? sizeof(uint32_t) : 0);
 
-    out.PacketType = SERIALPNP_PACKETTYPE_EVENT;
+    out.PacketType = PacketType;
+    out.Reserved = timestamp ? SERIALPNP_PACKET_FLAG_TIMESTAMP : 0;
 
     SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
     SerialPnP_SerialWriteBuffer((char*) &out, sizeof(SerialPnPPacketHeader));
-    SerialPnP_SerialWriteChar(0); // interface id = 0
+    SerialPnP_SerialWriteChar(interfaceId);
     SerialPnP_SerialWriteChar(nlen);
-    SerialPnP_SerialWriteBuffer((char*) Name, nlen);
+    SerialPnP_SerialWriteBuffer(Name, nlen);
     SerialPnP_SerialWriteBuffer(Value, ValueSize);
+    if (timestamp) {
+        SerialPnP_SerialWriteUint32(now);
+    }
 }
 
 void
 SerialPnP_SerialWriteBuffer(
-    char*                       Buffer,
+    const char*                 Buffer,
     uint16_t                    BufferSize
 )
 {
     uint16_t c;
 
     for (c = 0; c < BufferSize; c++) {
-        if ((Buffer[c] == SERIALPNP_PROTOCOL_PACKETSTART) || (Buffer[c] == SERIALPNP_PROTOCOL_ESCAPE)) {
+        if (((uint8_t) Buffer[c] == SERIALPNP_PROTOCOL_PACKETSTART) || ((uint8_t) Buffer[c] == SERIALPNP_PROTOCOL_ESCAPE)) {
             SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_ESCAPE);
             SerialPnP_PlatformSerialWrite(Buffer[c] - 1);
         } else {
@@ -461,12 +710,32 @@ SerialPnP_SerialWriteBuffer(
     }
 }
 
+void
+SerialPnP_SendDescriptorHash(
+    uint8_t                     PacketType
+)
+{
+    SerialPnPPacketHeader out = {0};
+
+    // With a clock, the device time follows the hash
+    out.Length = sizeof(SerialPnPPacketHeader) + sizeof(uint32_t) +
+                 (g_SerialPnPClock ? sizeof(uint32_t) : 0);
+    out.PacketType = PacketType;
+
+    SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
+    SerialPnP_SerialWriteBuffer((char*) &out, sizeof(SerialPnPPacketHeader));
+    SerialPnP_SerialWriteUint32(g_SerialPnPDescriptorHash);
+    if (g_SerialPnPClock) {
+        SerialPnP_SerialWriteUint32(g_SerialPnPClock());
+    }
+}
+
 void
 SerialPnP_SerialWriteChar(
     char                        Out
 )
 {
-    if ((Out == SERIALPNP_PROTOCOL_PACKETSTART) || (Out == SERIALPNP_PROTOCOL_ESCAPE)) {
+    if (((uint8_t) Out == SERIALPNP_PROTOCOL_PACKETSTART) || ((uint8_t) Out == SERIALPNP_PROTOCOL_ESCAPE)) {
         SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_ESCAPE);
         SerialPnP_PlatformSerialWrite(Out - 1);
     } else {
@@ -474,178 +743,403 @@ SerialPnP_SerialWriteChar(
     }
 }
 
+// Writes a 32-bit value least significant byte first, whatever the platform's
+// byte order
 void
-SerialPnP_AppendDescriptor(
-    SerialPnPDescriptorEntry*   NewEntry
+SerialPnP_SerialWriteUint32(
+    uint32_t                    Out
 )
 {
-    NewEntry->Next = 0;
-
-    SerialPnPDescriptorEntry* lastDescriptor = g_SerialPnPDescriptor;
+    SerialPnP_SerialWriteChar(Out & 0xFF);
+    SerialPnP_SerialWriteChar((Out >> 8) & 0xFF);
+    SerialPnP_SerialWriteChar((Out >> 16) & 0xFF);
+    SerialPnP_SerialWriteChar((Out >> 24) & 0xFF);
+}
 
-    while (lastDescriptor->Next) {
-        lastDescriptor = lastDescriptor->Next;
+uint8_t*
+SerialPnP_NewDescriptorEntry(
+    uint16_t                    Size
+)
+{
+    uint8_t* entry;
+
+    // Once an entry does not fit, later ones are dropped as well, so that no
+    // event or callback is reported under the wrong interface.
+    if (g_SerialPnPDescriptorFull ||
+        (Size > SERIALPNP_DESCRIPTOR_SIZE - g_SerialPnPDescriptorLength)) {
+        g_SerialPnPDescriptorFull = true;
+        return 0;
     }
 
-    lastDescriptor->Next = NewEntry;
+    entry = &g_SerialPnPDescriptor[g_SerialPnPDescriptorLength];
+    g_SerialPnPDescriptorLength += Size;
+    return entry;
+}
+
+uint16_t
+SerialPnP_DescriptorPutString(
+    uint8_t*                    Entry,
+    uint16_t                    Offset,
+    const char*                 Value,
+    uint8_t                     Length
+)
+{
+    Entry[Offset++] = Length;
+    memcpy(&Entry[Offset],
+           Value,
+           Length);
+
+    return Offset + Length;
 }
 
 void
 SerialPnP_AddCallback(
-    SerialPnPDescriptorEntry*   DescriptorEntry,
+    const uint8_t*              DescriptorEntry,
     void*                       Callback
 )
 {
-    uint8_t c = 0;
+    SerialPnPCallback* cc;
+    uint8_t slot;
+
+    if ((Callback == 0) || (g_SerialPnPCallbackCount >= SERIALPNP_MAX_CALLBACK_COUNT)) {
+        return;
+    }
+
+    cc = &g_SerialPnPCallbacks[g_SerialPnPCallbackCount++];
+    cc->DescriptorOffset = DescriptorEntry - g_SerialPnPDescriptor;
+    cc->InterfaceId = g_SerialPnPInterfaceCount ? g_SerialPnPInterfaceCount - 1 : 0;
+    cc->Callback = Callback;
+    cc->Hash = SerialPnP_CallbackHash(cc->InterfaceId,
+                                      DescriptorEntry[0],
+                                      (const char*) DescriptorEntry + 2,
+                                      DescriptorEntry[1]);
+
+    // Linear probing; the table never fills, and a name registered twice on
+    // one interface resolves to the first registration as it is found first.
+    slot = cc->Hash & SERIALPNP_CALLBACK_TABLE_MASK;
+    while (g_SerialPnPCallbackTable[slot] != 0) {
+        slot = (slot + 1) & SERIALPNP_CALLBACK_TABLE_MASK;
+    }
+
+    g_SerialPnPCallbackTable[slot] = g_SerialPnPCallbackCount;
+}
+
+void
+SerialPnP_AddEvent(
+    const uint8_t*              DescriptorEntry,
+    SerialPnPSchema             Schema
+)
+{
+    // The host numbers events per interface in descriptor order, so every event
+    // takes an index even if it cannot be tracked here.
+    uint8_t index = g_SerialPnPInterfaceEventCount++;
+
+    if (g_SerialPnPEventCount < SERIALPNP_MAX_EVENT_COUNT) {
+        SerialPnPEvent* ev = &g_SerialPnPEvents[g_SerialPnPEventCount++];
+
+        ev->DescriptorOffset = DescriptorEntry - g_SerialPnPDescriptor;
+        ev->InterfaceId = g_SerialPnPInterfaceCount ? g_SerialPnPInterfaceCount - 1 : 0;
+        ev->Index = index;
+        ev->ValueSize = SerialPnP_SchemaSize(Schema);
+    }
+}
+
+uint8_t
+SerialPnP_SchemaSize(
+    SerialPnPSchema             Schema
+)
+{
+    switch (Schema) {
+    case SerialPnPSchema_Byte:
+    case SerialPnPSchema_Boolean:
+        return 1;
+    case SerialPnPSchema_Float:
+    case SerialPnPSchema_Int:
+        return 4;
+    case SerialPnPSchema_Double:
+    case SerialPnPSchema_Long:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Size of an entry after the device record, which depends on its type and the
+// strings it holds; 0 if the type is unknown
+uint16_t
+SerialPnP_DescriptorEntrySize(
+    const uint8_t*              Entry
+)
+{
+    uint16_t size = 1;
+    uint8_t strings;
+    uint8_t trailer;
+
+    switch (Entry[0]) {
+    case SERIALPNP_DESCRIPTORTYPE_INTERFACE:
+        return 3 + (Entry[1] | (Entry[2] << 8));
+    case SERIALPNP_DESCRIPTORTYPE_EVENT:
+        strings = 4;    // name, display name, description, units
+        trailer = 2;    // schema
+        break;
+    case SERIALPNP_DESCRIPTORTYPE_PROPERTY:
+        strings = 4;    // name, display name, description, units
+        trailer = 3;    // schema, flags
+        break;
+    case SERIALPNP_DESCRIPTORTYPE_COMMAND:
+        strings = 3;    // name, display name, description
+        trailer = 4;    // input and output schema
+        break;
+    default:
+        return 0;
+    }
+
+    while (strings--) {
+        size += 1 + Entry[size];
+    }
+
+    return size + trailer;
+}
+
+// Interface an event or property was declared on, found by walking the
+// descriptor. A name used on several interfaces resolves to the first of them.
+uint8_t
+SerialPnP_FindInterfaceId(
+    uint8_t                     Type,
+    const char*                 Name,
+    uint8_t                     NameSize
+)
+{
+    uint16_t offset;
+    uint16_t size;
+    uint8_t interfaceCount = 0;
+
+    if (g_SerialPnPDescriptorLength == 0) {
+        return 0;
+    }
+
+    // Skip the device record of version, name length and name
+    for (offset = 2 + g_SerialPnPDescriptor[1]; offset < g_SerialPnPDescriptorLength; offset += size) {
+        const uint8_t* rawDescriptorEntry = &g_SerialPnPDescriptor[offset];
 
-    while (c < SERIALPNP_MAX_CALLBACK_COUNT) {
-        SerialPnPCallback* cc = &g_SerialPnPCallbacks[c];
+        if (rawDescriptorEntry[0] == SERIALPNP_DESCRIPTORTYPE_INTERFACE) {
+            interfaceCount++;
+        } else if ((rawDescriptorEntry[0] == Type) &&
+                   (rawDescriptorEntry[1] == NameSize) &&
+                   (memcmp(rawDescriptorEntry + 2, Name, NameSize) == 0)) {
+            return interfaceCount ? interfaceCount - 1 : 0;
+        }
 
-        if (cc->Callback == 0) {
-            cc->DescriptorEntry = DescriptorEntry;
-            cc->Callback = Callback;
+        size = SerialPnP_DescriptorEntrySize(rawDescriptorEntry);
+        if (size == 0) {
             break;
         }
+    }
+
+    return 0;
+}
+
+uint32_t
+SerialPnP_CallbackHash(
+    uint8_t                     InterfaceId,
+    uint8_t                     Type,
+    const char*                 Name,
+    uint8_t                     NameSize
+)
+{
+    uint32_t hash = SERIALPNP_FNV_OFFSET_BASIS;
+    uint8_t c;
+
+    hash ^= InterfaceId;
+    hash *= SERIALPNP_FNV_PRIME;
+    hash ^= Type;
+    hash *= SERIALPNP_FNV_PRIME;
 
-        c++;
+    for (c = 0; c < NameSize; c++) {
+        hash ^= (uint8_t) Name[c];
+        hash *= SERIALPNP_FNV_PRIME;
     }
+
+    return hash;
 }
 
 SerialPnPCallback*
 SerialPnP_FindCallback(
+    uint8_t                     InterfaceId,
     uint8_t                     Type,
     const char*                 Name,
     uint8_t                     NameSize
 )
 {
-    uint8_t c = 0;
-    char* rawDescriptorEntry;
+    uint32_t hash = SerialPnP_CallbackHash(InterfaceId, Type, Name, NameSize);
+    uint8_t slot = hash & SERIALPNP_CALLBACK_TABLE_MASK;
+
+    while (g_SerialPnPCallbackTable[slot] != 0) {
+        SerialPnPCallback* cc = &g_SerialPnPCallbacks[g_SerialPnPCallbackTable[slot] - 1];
+        const uint8_t* rawDescriptorEntry = &g_SerialPnPDescriptor[cc->DescriptorOffset];
+
+        if ((cc->Hash == hash) &&
+            (cc->InterfaceId == InterfaceId) &&
+            (rawDescriptorEntry[0] == Type) &&
+            (rawDescriptorEntry[1] == NameSize) &&
+            (memcmp(rawDescriptorEntry + 2, Name, NameSize) == 0)) {
+            return cc;
+        }
 
-    while (c < SERIALPNP_MAX_CALLBACK_COUNT) {
-        SerialPnPCallback* cc = &g_SerialPnPCallbacks[c];
+        slot = (slot + 1) & SERIALPNP_CALLBACK_TABLE_MASK;
+    }
 
-        c++;
+    return 0;
+}
 
-        if (cc->Callback == 0) {
-            continue;
-        }
+void
+SerialPnP_RxByte(
+    uint8_t                     Inb
+)
+{
+    // A start byte always begins a new packet, abandoning any partial one
+    if (Inb == SERIALPNP_PROTOCOL_PACKETSTART) {
+        g_SerialPnPRxState = SerialPnPRxState_Receiving;
+        g_SerialPnPRxEscaped = false;
+        g_SerialPnPRxIndex = 0;
+        return;
+    }
 
-        rawDescriptorEntry = cc->DescriptorEntry->Content;
+    if (g_SerialPnPRxState == SerialPnPRxState_Idle) {
+        return;
+    }
 
-        // if len matches
-        if ((*(rawDescriptorEntry) == Type) &&
-            (*(rawDescriptorEntry+1) == NameSize)) {
-            if (strncmp(rawDescriptorEntry+2, Name, NameSize) == 0) {
-                return cc;
-            }
+    if (Inb == SERIALPNP_PROTOCOL_ESCAPE) {
+        g_SerialPnPRxEscaped = true;
+        return;
+    }
+
+    if (g_SerialPnPRxEscaped) {
+        Inb++;
+        g_SerialPnPRxEscaped = false;
+    }
+
+    if (g_SerialPnPRxState == SerialPnPRxState_Receiving) {
+        g_SerialPnPRxBuffer[g_SerialPnPRxIndex] = Inb;
+    }
+
+    g_SerialPnPRxIndex++;
+
+    // The length comes first, so a packet is known to fit before its body arrives
+    if (g_SerialPnPRxIndex == sizeof(uint16_t)) {
+        g_SerialPnPRxLength = g_SerialPnPRxBuffer[0] | (g_SerialPnPRxBuffer[1] << 8);
+
+        if (g_SerialPnPRxLength < SERIALPNP_PACKET_HEADER_SIZE) {
+            g_SerialPnPRxState = SerialPnPRxState_Idle;
+        } else if (g_SerialPnPRxLength > SERIALPNP_RXBUFFER_SIZE) {
+            g_SerialPnPRxState = SerialPnPRxState_Discarding;
         }
+
+        return;
     }
 
-    return 0;
+    if (g_SerialPnPRxIndex == g_SerialPnPRxLength) {
+        if (g_SerialPnPRxState == SerialPnPRxState_Receiving) {
+            SerialPnP_ProcessPacket(g_SerialPnPRxBuffer, g_SerialPnPRxLength);
+        }
+
+        g_SerialPnPRxState = SerialPnPRxState_Idle;
+    }
 }
 
 void
 SerialPnP_ProcessPacket(
-    SerialPnPPacketHeader       *Packet
+    const uint8_t*              Packet,
+    uint16_t                    Length
 )
 {
     SerialPnPPacketHeader out = {0};
+    uint8_t packetType = Packet[2];
 
     // Reset request
-    if (Packet->PacketType == SERIALPNP_PACKETTYPE_RESETREQ) {
+    if (packetType == SERIALPNP_PACKETTYPE_RESETREQ) {
+        g_SerialPnPTimestamps = false;
         SerialPnP_PlatformReset();
 
-    // Descriptor request
-    } else if (Packet->PacketType == SERIALPNP_PACKETTYPE_DESCREQ) {
-        // First we have to calculate length of the descriptor
-        uint16_t descriptorLength = 0;
-
-        for (SerialPnPDescriptorEntry* entry = g_SerialPnPDescriptor;
-             entry != 0;
-             entry = entry->Next)
-        {
-            descriptorLength += entry->ContentSize;
-        }
+    // Descriptor hash request, which also asks for timestamps
+    } else if (packetType == SERIALPNP_PACKETTYPE_DESCHASHREQ) {
+        g_SerialPnPTimestamps = g_SerialPnPClock &&
+                                (Packet[3] & SERIALPNP_REQUEST_FLAG_TIMESTAMPS);
+        SerialPnP_SendDescriptorHash(SERIALPNP_PACKETTYPE_DESCHASHRESP);
 
-        out.Length = sizeof(SerialPnPPacketHeader) + descriptorLength;
+    // Descriptor request
+    } else if (packetType == SERIALPNP_PACKETTYPE_DESCREQ) {
+        out.Length = sizeof(SerialPnPPacketHeader) + g_SerialPnPDescriptorLength;
         out.PacketType = SERIALPNP_PACKETTYPE_DESCRESP;
 
         SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
         SerialPnP_SerialWriteBuffer((char*) &out, sizeof(SerialPnPPacketHeader));
+        SerialPnP_SerialWriteBuffer((const char*) g_SerialPnPDescriptor, g_SerialPnPDescriptorLength);
+
+    // Property write request, or command
+    } else if ((packetType == SERIALPNP_PACKETTYPE_PROPREQ) ||
+               (packetType == SERIALPNP_PACKETTYPE_COMMANDREQ)) {
+        const uint8_t* name = Packet + SERIALPNP_PACKET_NAME_OFFSET;
+        uint8_t interfaceId;
+        uint8_t nameLength;
+        uint16_t payloadOffset;
+        SerialPnPCallback* cb;
+        int32_t outp = -1;
+
+        if (Length < SERIALPNP_PACKET_NAME_OFFSET) {
+            return;
+        }
 
-        // Send actual descriptor, piece by piece
-        for (SerialPnPDescriptorEntry* entry = g_SerialPnPDescriptor;
-             entry != 0;
-             entry = entry->Next)
-        {
-            SerialPnP_SerialWriteBuffer(entry->Content, entry->ContentSize);
+        interfaceId = Packet[SERIALPNP_PACKET_NAME_OFFSET - 2];
+        nameLength = Packet[SERIALPNP_PACKET_NAME_OFFSET - 1];
+        payloadOffset = SERIALPNP_PACKET_NAME_OFFSET + nameLength;
+        if (payloadOffset > Length) {
+            return;
         }
 
-    // Property write request
-    } else if (Packet->PacketType == SERIALPNP_PACKETTYPE_PROPREQ) {
-        // find entry in table
-        SerialPnPPacketBody* body = (SerialPnPPacketBody*) Packet->Body;
+        if (packetType == SERIALPNP_PACKETTYPE_PROPREQ) {
+            cb = SerialPnP_FindCallback(interfaceId, SERIALPNP_DESCRIPTORTYPE_PROPERTY, (const char*) name, nameLength);
 
-        SerialPnPCallback* cb = 0;
-        cb = SerialPnP_FindCallback(SERIALPNP_DESCRIPTORTYPE_PROPERTY, //property type
-                                    body->Payload,
-                                    body->NameLength);
+            if (cb) {
+                // If there's no data, call it for output only
+                ((SerialPnPCb) cb->Callback)((payloadOffset == Length) ? 0 : (void*) (Packet + payloadOffset), &outp);
+            }
 
-            uint32_t outp = -1;
+            SerialPnP_SendCallbackResponse(SERIALPNP_PACKETTYPE_PROPRESP, interfaceId, name, nameLength, &outp);
+        } else {
+            cb = SerialPnP_FindCallback(interfaceId, SERIALPNP_DESCRIPTORTYPE_COMMAND, (const char*) name, nameLength);
 
             if (cb) {
-            // If there's no data, call it for output only
-            if (Packet->Length - (sizeof(SerialPnPPacketHeader) +
-                                  sizeof(SerialPnPPacketBody) +
-                                  body->NameLength) == 0) {
-
-                ((SerialPnPCb) cb->Callback)(0, &outp);
-            } else {
-                ((SerialPnPCb) cb->Callback)(body->Payload + body->NameLength, &outp);
-            }
+                ((SerialPnPCb) cb->Callback)((void*) (Packet + payloadOffset), &outp);
             }
 
-            out.Length = sizeof(SerialPnPPacketHeader) +
-                         sizeof(SerialPnPPacketBody) +
-                         body->NameLength +
-                         sizeof(outp); // payload size; uint32
-
-            out.PacketType = SERIALPNP_PACKETTYPE_PROPRESP;
-
-            SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
-            SerialPnP_SerialWriteBuffer((char*) &out, sizeof(out));
-            SerialPnP_SerialWriteChar(0); // Interface ID = 0
-            SerialPnP_SerialWriteChar(body->NameLength);
-            SerialPnP_SerialWriteBuffer((char*) body->Payload, body->NameLength);
-            SerialPnP_SerialWriteBuffer((char*) &outp, sizeof(outp));
-        
-    } else if (Packet->PacketType == SERIALPNP_PACKETTYPE_COMMANDREQ) {
-        // find entry in table
-        SerialPnPPacketBody* body = (SerialPnPPacketBody*) Packet->Body;
-
-        SerialPnPCallback* cb = 0;
-        cb = SerialPnP_FindCallback(SERIALPNP_DESCRIPTORTYPE_COMMAND, //method type
-                                    body->Payload,
-                                    body->NameLength);
-
-          int32_t outp = -1;
-
-          if (cb) {
-            ((SerialPnPCb) cb->Callback)(body->Payload + body->NameLength, &outp);
-          }
-   
-            out.Length = sizeof(SerialPnPPacketHeader) +
-                         sizeof(SerialPnPPacketBody) +
-                         body->NameLength +
-                         sizeof(outp); // payload size; uint32
-
-            out.PacketType = SERIALPNP_PACKETTYPE_COMMANDRESP;
-
-            SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
-            SerialPnP_SerialWriteBuffer((char*) &out, sizeof(out));
-            SerialPnP_SerialWriteChar(0); // Interface ID = 0
-            SerialPnP_SerialWriteChar(body->NameLength);
-            SerialPnP_SerialWriteBuffer((char*) body->Payload, body->NameLength);
-            SerialPnP_SerialWriteBuffer((char*) &outp, sizeof(outp));
-    }
-}
\ No newline at end of file
+            SerialPnP_SendCallbackResponse(SERIALPNP_PACKETTYPE_COMMANDRESP, interfaceId, name, nameLength, &outp);
+        }
+    }
+}
+
+void
+SerialPnP_SendCallbackResponse(
+    uint8_t                     PacketType,
+    uint8_t                     InterfaceId,
+    const uint8_t*              Name,
+    uint8_t                     NameLength,
+    const void*                 Value
+)
+{
+    SerialPnPPacketHeader out = {0};
+
+    out.Length = sizeof(SerialPnPPacketHeader) +
+                 sizeof(SerialPnPPacketBody) +
+                 NameLength +
+                 sizeof(int32_t); // payload size; uint32
+
+    out.PacketType = PacketType;
+
+    SerialPnP_PlatformSerialWrite(SERIALPNP_PROTOCOL_PACKETSTART); // need to send sync
+    SerialPnP_SerialWriteBuffer((char*) &out, sizeof(out));
+    SerialPnP_SerialWriteChar(InterfaceId);
+    SerialPnP_SerialWriteChar(NameLength);
+    SerialPnP_SerialWriteBuffer((const char*) Name, NameLength);
+    SerialPnP_SerialWriteBuffer((const char*) Value, sizeof(int32_t));
+}
@@ -14,6 +14,19 @@ extern "C" {
 // This may be adjusted to support longer schemas in the future.
 #define SERIALPNP_RXBUFFER_SIZE         64
 #define SERIALPNP_MAX_CALLBACK_COUNT    8
+#define SERIALPNP_MAX_EVENT_COUNT       16
+#define SERIALPNP_MAX_BATCH_SAMPLES     32
+
+// The library allocates no memory. The descriptor is built in a fixed buffer,
+// which must hold every interface, event, property and command definition, and
+// received bytes pass through a ring of SERIALPNP_RXRING_SIZE bytes (a power of
+// two, at most 128). Both may be overridden when compiling the library.
+#ifndef SERIALPNP_DESCRIPTOR_SIZE
+#define SERIALPNP_DESCRIPTOR_SIZE       512
+#endif
+#ifndef SERIALPNP_RXRING_SIZE
+#define SERIALPNP_RXRING_SIZE           64
+#endif
 
 //
 // PLATFORM-SPECIFIC FUNCTIONS
@@ -28,7 +41,8 @@ void
 SerialPnP_PlatformSerialInit();
 
 // This function should return the number of buffered characters available from
-// the serial port used for SerialPnP operation.
+// the serial port used for SerialPnP operation. Platforms that hand received
+// characters to SerialPnP_RxPush... instead should return 0.
 unsigned int
 SerialPnP_PlatformSerialAvailable();
 
@@ -71,6 +85,18 @@ SerialPnP_Setup(
     const char*     DeviceName
 );
 
+// A free-running millisecond clock, such as Arduino's millis(). It may wrap.
+typedef uint32_t (*SerialPnPClock)(void);
+
+// Optionally gives Serial PnP a clock. The host then learns the device time
+// from reset and descriptor hash responses, and asks for events to be
+// timestamped when they are sent, so it can tell how old a reading is when it
+// reaches the cloud. May be called before or after SerialPnP_Setup.
+void
+SerialPnP_SetClock(
+    SerialPnPClock  Clock
+);
+
 // This call must be made once to complete Serial PnP Setup, after all interaces have been defined.
 // It will notify the host that device initialization is complete.
 void
@@ -114,10 +140,30 @@ SerialPnP_NewCommand(
 );
 
 // Must be called regularly and frequently to process any incoming commands or
-// other protocol operations.
+// other protocol operations. Packets may arrive over any number of calls.
 void
 SerialPnP_Process();
 
+// Queues a received character for the next SerialPnP_Process call. Safe to call
+// from a UART receive interrupt while the main loop runs SerialPnP_Process, as
+// long as a single context pushes. Returns false if the character was dropped
+// because SERIALPNP_RXRING_SIZE characters are already waiting.
+bool
+SerialPnP_RxPush(
+    char            Character
+);
+
+// Queues a block of received characters, for example from a DMA completion
+// interrupt, with the same rules as SerialPnP_RxPush. Returns the number of
+// characters queued, which is less than BufferSize if the ring filled up.
+uint16_t
+SerialPnP_RxPushBuffer(
+    const char*     Buffer,
+    uint16_t        BufferSize
+);
+
+// Sends an event on the interface it was defined on. An event name used on
+// several interfaces is sent on the first of them.
 void
 SerialPnP_SendEventFloat(
     const char*     Name,
@@ -130,6 +176,51 @@ SerialPnP_SendEventInt(
     int32_t         Value
 );
 
+// Handle of an event, as returned by SerialPnP_GetEventIndex, and a value of
+// that event taken TimeDelta milliseconds before the batch is sent. Value must
+// point to a value of the event's schema; string events cannot be batched.
+typedef struct _SerialPnPEventSample {
+    uint8_t         Event;
+    uint16_t        TimeDelta;
+    const void*     Value;
+} SerialPnPEventSample;
+
+// Returns the handle used to reference an event in a batch, or -1 if no event
+// with this name was defined.
+int
+SerialPnP_GetEventIndex(
+    const char*     Name
+);
+
+// Sends several event samples in a single packet. Samples are referenced by
+// index rather than by name, which makes a batch much smaller than the same
+// samples sent with SerialPnP_SendEvent... All samples must belong to the same
+// interface. When IncludeTimeDelta is false the host treats all samples as
+// taken when the batch is sent, which is timestamped if a clock was given.
+// Returns false if the batch was not sent.
+bool
+SerialPnP_SendEventBatch(
+    const SerialPnPEventSample* Samples,
+    uint8_t                     SampleCount,
+    bool                        IncludeTimeDelta
+);
+
+// Notifies the host that the value of a property changed on the device, for
+// example after a local user action. The host reports the new value to the
+// twin; changes sent in quick succession are reported together. Like events,
+// the property is reported on the first interface that defines its name.
+void
+SerialPnP_SendPropertyFloat(
+    const char*     Name,
+    float           Value
+);
+
+void
+SerialPnP_SendPropertyInt(
+    const char*     Name,
+    int32_t         Value
+);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file